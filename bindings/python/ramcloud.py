@@ -106,6 +106,8 @@ def load_so():
     address             = ctypes.c_char_p
     buf                 = ctypes.c_void_p
     client              = ctypes.c_void_p
+    counter             = ctypes.c_int64
+    flag                = ctypes.c_uint8
     id                  = ctypes.c_uint64
     len                 = ctypes.c_uint32
     name                = ctypes.c_char_p
@@ -123,6 +125,11 @@ def load_so():
     so.rc_disconnect.argtypes = [client]
     so.rc_disconnect.restype  = None
 
+    so.rc_compareAndSwap.argtypes = [client, table, id, buf, len, buf, len,
+                                     POINTER(version), POINTER(flag),
+                                     buf, len, POINTER(len)]
+    so.rc_compareAndSwap.restype  = status
+
     so.rc_create.argtypes = [client, table, buf, len, POINTER(id),
                              POINTER(version)]
     so.rc_create.restype  = status
@@ -136,6 +143,10 @@ def load_so():
     so.rc_getStatus.argtypes = []
     so.rc_getStatus.restype  = status
 
+    so.rc_increment.argtypes = [client, table, id, counter, rejectRules,
+                                POINTER(version), POINTER(counter)]
+    so.rc_increment.restype  = status
+
     so.rc_openTable.argtypes = [client, name, POINTER(table)]
     so.rc_openTable.restype  = status
 
@@ -204,6 +215,29 @@ class RAMCloud(object):
         s = so.rc_connect(serverLocator, ctypes.byref(self.client))
         self.handle_error(s)
 
+    def compare_and_swap(self, table_id, id, old_data, new_data):
+        """Replace an object's value only if it is still old_data.
+
+        Returns (swapped, current_data, version); current_data is the
+        object's value if it wasn't old_data, and None otherwise.
+        """
+        max_length = 1024 * 1024 * 2
+        buf = ctypes.create_string_buffer(max_length)
+        actual_length = ctypes.c_uint32()
+        got_version = ctypes.c_uint64()
+        swapped = ctypes.c_uint8()
+        self.hook()
+        s = so.rc_compareAndSwap(self.client, table_id, id,
+                                 old_data, len(old_data),
+                                 new_data, len(new_data),
+                                 ctypes.byref(got_version),
+                                 ctypes.byref(swapped), ctypes.byref(buf),
+                                 max_length, ctypes.byref(actual_length))
+        self.handle_error(s, got_version.value)
+        if swapped.value:
+            return (True, None, got_version.value)
+        return (False, buf.raw[0:actual_length.value], got_version.value)
+
     def create(self, table_id, id, data):
         reject_rules = RejectRules(object_exists=True)
         return self.write_rr(table_id, id, data, reject_rules)
@@ -231,6 +265,27 @@ class RAMCloud(object):
         s = so.rc_dropTable(self.client, name)
         self.handle_error(s)
 
+    def increment(self, table_id, id, amount=1, want_version=None):
+        """Atomically add amount to a counter and return its new value.
+
+        The object must hold a 64-bit little-endian integer (see
+        struct.pack('<q', n)); one that doesn't exist counts as zero.
+
+        Returns (value, version).
+        """
+        if want_version:
+            reject_rules = RejectRules.exactly(want_version)
+        else:
+            reject_rules = RejectRules()
+        new_value = ctypes.c_int64()
+        got_version = ctypes.c_uint64()
+        self.hook()
+        s = so.rc_increment(self.client, table_id, id, amount,
+                            ctypes.byref(reject_rules),
+                            ctypes.byref(got_version), ctypes.byref(new_value))
+        self.handle_error(s, got_version.value)
+        return (new_value.value, got_version.value)
+
     def insert(self, table_id, data):
         id = ctypes.c_uint64()
         version = ctypes.c_uint64()
@@ -22,11 +22,16 @@ See RAM-39.
 
 This is a stress test and something of a microbenchmark for RAMCloud.
 
+With --atomic, the objects are plain 64-bit counters updated with the
+INCREMENT RPC instead, which the master applies atomically; no increment
+is ever aborted or retried, however many processes contend.
+
 Run this program with --help for usage."""
 
 import os
 import sys
 import random
+import struct
 import time
 from optparse import OptionParser
 
@@ -62,6 +67,9 @@ class CountdownHook(object):
             self.count -= 1
 
 class Test(object):
+    # whether algo() needs each object's value and version read beforehand
+    reads_objects = True
+
     def __init__(self, txrc, table, oids, stats, die, options, args):
         self.txrc = txrc
         self.table = table
@@ -99,7 +107,7 @@ class Test(object):
                     if die.value:
                         return
                     for oid in self.oids:
-                        if self.cache[oid] is None:
+                        if self.reads_objects and self.cache[oid] is None:
                             blob, version = self.txrc.read(self.table, oid)
                             value = int(blob)
                             self.cache[oid] = (value, version)
@@ -157,6 +165,15 @@ class TestMT(Test):
             self.local_stats[Stats.INCREMENTS] += 1
             return True
 
+class TestIncrement(Test):
+    reads_objects = False
+
+    def algo(self):
+        for oid in self.oids:
+            self.txrc.increment(self.table, oid)
+        self.local_stats[Stats.INCREMENTS] += 1
+        return True
+
 if __name__ == '__main__':
     parser = OptionParser()
     parser.set_description(__doc__.split('\n\n', 1)[0])
@@ -181,10 +198,20 @@ if __name__ == '__main__':
     parser.add_option("-u", "--unsafe", action="store_true",
                       dest="unsafe", default=False,
                       help="don't use transactions")
+    parser.add_option("-a", "--atomic", action="store_true",
+                      dest="atomic", default=False,
+                      help="use the server-side INCREMENT operation")
     (options, args) = parser.parse_args()
     assert not args
 
-    r = txramcloud.TxRAMCloud(7)
+    if options.atomic:
+        r = ramcloud.RAMCloud()
+        encode = lambda value: struct.pack('<q', value)
+        decode = lambda blob: struct.unpack('<q', blob)[0]
+    else:
+        r = txramcloud.TxRAMCloud(7)
+        encode = str
+        decode = int
     r.connect()
 
     r.create_table("test")
@@ -193,12 +220,14 @@ if __name__ == '__main__':
     oids = range(options.num_objects)
 
     for oid in oids:
-        r.create(table, oid, str(0))
+        r.create(table, oid, encode(0))
 
     stats = multiprocessing.Array('i', Stats.NUM)
     die = multiprocessing.Value('i', 0, lock=False)
 
-    if options.unsafe:
+    if options.atomic:
+        target_class = TestIncrement
+    elif options.unsafe:
         target_class = TestWrite
     else:
         target_class = TestMT
@@ -225,6 +254,6 @@ if __name__ == '__main__':
     print "stats:", Stats.to_str(stats[:])
     for oid in oids:
         blob, version = r.read(table, oid)
-        value = int(blob)
+        value = decode(blob)
         print 'oid %d: value=%d, version=%d' % (oid, value, version)
 
@@ -163,6 +163,30 @@ def broadcast(name, options, cluster_args, client_args):
             (obj_path, flatten_args(client_args), name), **cluster_args)
     print(get_client_log(), end='')
 
+def cacheZipfian(name, options, cluster_args, client_args):
+    # A 1 GB cache in front of a key space of about 10 GB.
+    cluster_args['num_servers'] = 1
+    cluster_args['backups_per_server'] = 0
+    cluster_args['replicas'] = 0
+    if 'num_clients' not in cluster_args:
+        cluster_args['num_clients'] = 16
+    cluster_args['master_args'] = '%s --cacheMode -t 1024' % (
+            cluster_args.get('master_args', ''))
+    cluster.run(client='%s/ClusterPerf %s %s' %
+            (obj_path, flatten_args(client_args), name), **cluster_args)
+    print(get_client_log(), end='')
+
+def migrateTablet(name, options, cluster_args, client_args):
+    if options.num_servers == None or options.num_servers < 2:
+        cluster_args['num_servers'] = 2
+    # The source master needs a spare worker thread to keep serving reads
+    # while another migrates the tablet.
+    cluster_args['master_args'] = '%s --masterWorkerThreads 4' % (
+            cluster_args.get('master_args', ''))
+    cluster.run(client='%s/ClusterPerf %s %s' %
+            (obj_path, flatten_args(client_args), name), **cluster_args)
+    print(get_client_log(), end='')
+
 def netBandwidth(name, options, cluster_args, client_args):
     if 'num_clients' not in cluster_args:
         cluster_args['num_clients'] = 2*len(config.hosts)
@@ -186,6 +210,8 @@ def readAllToAll(name, options, cluster_args, client_args):
     if options.num_servers == None:
         cluster_args['num_servers'] = len(hosts)
     client_args['--numTables'] = cluster_args['num_servers'];
+    if options.server_span != None:
+        client_args['--serverSpan'] = options.server_span
     cluster.run(client='%s/ClusterPerf %s %s' %
             (obj_path, flatten_args(client_args), name), **cluster_args)
     print(get_client_log(), end='')
@@ -208,6 +234,37 @@ def readRandom(name, options, cluster_args, client_args):
             (obj_path, flatten_args(client_args), name), **cluster_args)
     print(get_client_log(), end='')
 
+def readThroughput(name, options, cluster_args, client_args):
+    cluster_args['num_servers'] = 1
+    cluster_args['backups_per_server'] = 0
+    cluster_args['replicas'] = 0
+    if 'num_clients' not in cluster_args:
+        cluster_args['num_clients'] = 16
+    master_args = cluster_args.get('master_args', '')
+    for threads in [1, 2, 4, 8]:
+        cluster_args['master_args'] = '%s --masterWorkerThreads %d' % (
+                master_args, threads)
+        cluster.run(client='%s/ClusterPerf %s %s' %
+                (obj_path, flatten_args(client_args), name), **cluster_args)
+        print('# Master worker threads: %d' % (threads))
+        print(get_client_log(), end='')
+        print('\n')
+
+def writeThroughput(name, options, cluster_args, client_args):
+    if options.num_servers == None:
+        cluster_args['num_servers'] = 4
+    if 'num_clients' not in cluster_args:
+        cluster_args['num_clients'] = 16
+    master_args = cluster_args.get('master_args', '')
+    for threads in [1, 2, 4, 8]:
+        cluster_args['master_args'] = '%s --masterWorkerThreads %d' % (
+                master_args, threads)
+        cluster.run(client='%s/ClusterPerf %s %s' %
+                (obj_path, flatten_args(client_args), name), **cluster_args)
+        print('# Master worker threads: %d' % (threads))
+        print(get_client_log(), end='')
+        print('\n')
+
 #-------------------------------------------------------------------
 #  End of driver functions.
 #-------------------------------------------------------------------
@@ -222,6 +279,8 @@ def readRandom(name, options, cluster_args, client_args):
 simple_tests = [
     Test("basic", default),
     Test("broadcast", broadcast),
+    Test("bulkLoad", default),
+    Test("migrateTablet", migrateTablet),
     Test("netBandwidth", netBandwidth),
     Test("readAllToAll", readAllToAll),
     Test("readNotFound", default),
@@ -229,8 +288,11 @@ simple_tests = [
 ]
 
 graph_tests = [
+    Test("cacheZipfian", cacheZipfian),
     Test("readLoaded", readLoaded),
-    Test("readRandom", readRandom)
+    Test("readRandom", readRandom),
+    Test("readThroughput", readThroughput),
+    Test("writeThroughput", writeThroughput)
 ]
 
 if __name__ == '__main__':
@@ -267,6 +329,10 @@ if __name__ == '__main__':
             help='Number of hosts on which to run servers')
     parser.add_option('-s', '--size', type=int,
             help='Object size in bytes')
+    parser.add_option('--serverSpan', type=int,
+            metavar='N', dest='server_span',
+            help='Number of masters to split each table across (only '
+                 'used by readAllToAll)')
     parser.add_option('-t', '--timeout', type=int, default=20,
             metavar='SECS',
             help="Abort if the client application doesn't finish within "
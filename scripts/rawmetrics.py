@@ -168,6 +168,8 @@ master = Group('Master', 'metrics for masters')
 master.metric('recoveryCount',
     'number of recoveries in which this master participated')
 master.metric('recoveryTicks', 'the elapsed time during recoveries')
+master.metric('restartTicks',
+    'time replaying the log from local storage after a restart')
 master.metric('replicaManagerTicks', 'time spent in ReplicaManager')
 master.metric('segmentAppendTicks', 'time spent in Segment::append')
 master.metric('segmentAppendCopyTicks',
@@ -214,7 +216,17 @@ master.metric('logSyncBytes',
 master.metric('recoveryWillTicks',
     'time rebuilding will at the end of recovery')
 master.metric('removeTombstoneTicks',
-    'time deleting tombstones at the end of recovery')
+    'time starting the removal of tombstones at the end of recovery')
+master.metric('tombstoneReapTicks',
+    'time the background tombstone reaper spent sweeping the object map')
+master.metric('tombstoneReapBuckets',
+    'object map buckets swept by the background tombstone reaper')
+master.metric('tombstoneReapPendingBuckets',
+    'object map buckets the current tombstone sweep has yet to visit')
+master.metric('tombstoneReapSweeps',
+    'number of complete sweeps by the background tombstone reaper')
+master.metric('tombstoneReapCount',
+    'number of tombstones removed from the object map')
 master.metric('replicationTicks',
     'time with outstanding RPCs to backups')
 master.metric('replicationBytes',
@@ -230,6 +242,52 @@ master.metric('logSyncCloseTicks',
     'time close segments during log sync')
 master.metric('logSyncCloseCount',
     'number of segments closed during log sync')
+master.metric('updateSyncCount',
+    'number of update RPCs whose replies waited for their log appends '
+    'to reach backups')
+master.metric('updateSyncTicks',
+    'time update RPCs spent waiting for backups after releasing the '
+    'object update lock')
+master.metric('hashTableBuckets',
+    'number of buckets in the object map')
+master.metric('hashTableEntries',
+    'number of objects and tombstones in the object map')
+master.metric('hashTableOverflowLines',
+    'number of overflow cache lines chained off object map buckets')
+master.metric('hashTableResizes',
+    'number of times the object map has started growing')
+master.metric('hashTableResizeTicks',
+    'time spent migrating object map buckets while growing')
+master.metric('cleanerThreads',
+    'number of threads the log cleaner relocates live data with')
+master.metric('cleanerPassCount',
+    'number of log cleaning passes completed')
+master.metric('cleanerPassTicks',
+    'time spent in completed log cleaning passes')
+master.metric('cleanerSegmentsCleaned',
+    'number of segments freed by the log cleaner')
+master.metric('cleanerSegmentsGenerated',
+    'number of survivor segments written by the log cleaner')
+master.metric('cleanerEntriesEvicted',
+    'number of live objects evicted by the log cleaner in cache mode')
+master.metric('expiredObjectCount',
+    'number of expired objects dropped by the log cleaner')
+master.metric('expiredObjectBytes',
+    'bytes of log space reclaimed from expired objects')
+master.metric('migrationCount',
+    'number of tablets migrated away from this master')
+master.metric('migrationTicks',
+    'time spent migrating tablets away from this master')
+master.metric('migrationBytes',
+    'bytes of log entries sent to other masters by tablet migration')
+master.metric('migrationPauseTicks',
+    'time updates were blocked during the final phase of migrations')
+master.metric('tabletSplitCount',
+    'number of tablets this master split because they grew too large')
+master.metric('enumerateObjects',
+    'objects returned by ENUMERATE_TABLE RPCs')
+master.metric('enumerateBytes',
+    'bytes of log entries returned by ENUMERATE_TABLE RPCs')
 
 backup = Group('Backup', 'metrics for backups')
 backup.metric('recoveryCount',
@@ -300,17 +358,22 @@ rpc.metric('setServerListCount', 'number of invocations of SET_SERVER_LIST RPC')
 rpc.metric('updateServerListCount', 'number of invocations of UPDATE_SERVER_LIST RPC')
 rpc.metric('requestServerListCount', 'number of invocations of REQUEST_SERVER_LIST RPC')
 rpc.metric('getServerId', 'number of invocations of GET_SERVER_ID RPC')
+rpc.metric('multiWriteCount', 'number of invocations of MULTI_WRITE RPC')
+rpc.metric('multiRemoveCount', 'number of invocations of MULTI_REMOVE RPC')
+rpc.metric('migrateTabletCount', 'number of invocations of MIGRATE_TABLET RPC')
+rpc.metric('prepForMigrationCount', 'number of invocations of PREP_FOR_MIGRATION RPC')
+rpc.metric('receiveMigrationDataCount', 'number of invocations of RECEIVE_MIGRATION_DATA RPC')
+rpc.metric('reassignTabletOwnershipCount', 'number of invocations of REASSIGN_TABLET_OWNERSHIP RPC')
+rpc.metric('splitTabletCount', 'number of invocations of SPLIT_TABLET RPC')
+rpc.metric('enumerateTableCount', 'number of invocations of ENUMERATE_TABLE RPC')
+rpc.metric('incrementCount', 'number of invocations of INCREMENT RPC')
+rpc.metric('compareAndSwapCount', 'number of invocations of COMPARE_AND_SWAP RPC')
+rpc.metric('transactionCount', 'number of invocations of TRANSACTION RPC')
+rpc.metric('prepareTransactionCount', 'number of invocations of PREPARE_TRANSACTION RPC')
+rpc.metric('decideTransactionCount', 'number of invocations of DECIDE_TRANSACTION RPC')
+rpc.metric('setTransactionOutcomeCount', 'number of invocations of SET_TRANSACTION_OUTCOME RPC')
+rpc.metric('forgetTransactionOutcomeCount', 'number of invocations of FORGET_TRANSACTION_OUTCOME RPC')
 rpc.metric('illegalRpcCount', 'number of invocations of RPCs with illegal opcodes')
-rpc.metric('rpc38Count', 'number of invocations of RPC 38 (undefined)')
-rpc.metric('rpc39Count', 'number of invocations of RPC 39 (undefined)')
-rpc.metric('rpc40Count', 'number of invocations of RPC 40 (undefined)')
-rpc.metric('rpc41Count', 'number of invocations of RPC 41 (undefined)')
-rpc.metric('rpc42Count', 'number of invocations of RPC 42 (undefined)')
-rpc.metric('rpc43Count', 'number of invocations of RPC 43 (undefined)')
-rpc.metric('rpc44Count', 'number of invocations of RPC 44 (undefined)')
-rpc.metric('rpc45Count', 'number of invocations of RPC 45 (undefined)')
-rpc.metric('rpc46Count', 'number of invocations of RPC 46 (undefined)')
-rpc.metric('rpc47Count', 'number of invocations of RPC 47 (undefined)')
 
 rpc.metric('rpc0Ticks', 'time spent executing RPC 0 (undefined)')
 rpc.metric('rpc1Ticks', 'time spent executing RPC 1 (undefined)')
@@ -349,17 +412,26 @@ rpc.metric('backupStartReadingDataTicks', 'time spent executing BACKUP_STARTREAD
 rpc.metric('backupWriteTicks', 'time spent executing BACKUP_WRITE RPC')
 rpc.metric('backupRecoveryCompleteTicks', 'time spent executing BACKUP_RECOVERYCOMPLETE RPC')
 rpc.metric('backupQuiesceTicks', 'time spent executing BACKUP_QUIESCE RPC')
+rpc.metric('setServerListTicks', 'time spent executing SET_SERVER_LIST RPC')
+rpc.metric('updateServerListTicks', 'time spent executing UPDATE_SERVER_LIST RPC')
+rpc.metric('requestServerListTicks', 'time spent executing REQUEST_SERVER_LIST RPC')
+rpc.metric('getServerIdTicks', 'time spent executing GET_SERVER_ID RPC')
+rpc.metric('multiWriteTicks', 'time spent executing MULTI_WRITE RPC')
+rpc.metric('multiRemoveTicks', 'time spent executing MULTI_REMOVE RPC')
+rpc.metric('migrateTabletTicks', 'time spent executing MIGRATE_TABLET RPC')
+rpc.metric('prepForMigrationTicks', 'time spent executing PREP_FOR_MIGRATION RPC')
+rpc.metric('receiveMigrationDataTicks', 'time spent executing RECEIVE_MIGRATION_DATA RPC')
+rpc.metric('reassignTabletOwnershipTicks', 'time spent executing REASSIGN_TABLET_OWNERSHIP RPC')
+rpc.metric('splitTabletTicks', 'time spent executing SPLIT_TABLET RPC')
+rpc.metric('enumerateTableTicks', 'time spent executing ENUMERATE_TABLE RPC')
+rpc.metric('incrementTicks', 'time spent executing INCREMENT RPC')
+rpc.metric('compareAndSwapTicks', 'time spent executing COMPARE_AND_SWAP RPC')
+rpc.metric('transactionTicks', 'time spent executing TRANSACTION RPC')
+rpc.metric('prepareTransactionTicks', 'time spent executing PREPARE_TRANSACTION RPC')
+rpc.metric('decideTransactionTicks', 'time spent executing DECIDE_TRANSACTION RPC')
+rpc.metric('setTransactionOutcomeTicks', 'time spent executing SET_TRANSACTION_OUTCOME RPC')
+rpc.metric('forgetTransactionOutcomeTicks', 'time spent executing FORGET_TRANSACTION_OUTCOME RPC')
 rpc.metric('illegalRpcTicks', 'time spent executing RPCs with illegal opcodes')
-rpc.metric('rpc38Ticks', 'time spent executing RPC 38 (undefined)')
-rpc.metric('rpc39Ticks', 'time spent executing RPC 39 (undefined)')
-rpc.metric('rpc40Ticks', 'time spent executing RPC 40 (undefined)')
-rpc.metric('rpc41Ticks', 'time spent executing RPC 41 (undefined)')
-rpc.metric('rpc42Ticks', 'time spent executing RPC 42 (undefined)')
-rpc.metric('rpc43Ticks', 'time spent executing RPC 43 (undefined)')
-rpc.metric('rpc44Ticks', 'time spent executing RPC 44 (undefined)')
-rpc.metric('rpc45Ticks', 'time spent executing RPC 45 (undefined)')
-rpc.metric('rpc46Ticks', 'time spent executing RPC 46 (undefined)')
-rpc.metric('rpc47Ticks', 'time spent executing RPC 47 (undefined)')
 
 transmit = Group('Transmit', 'metrics related to transmitting messages')
 transmit.metric('ticks', 'elapsed time transmitting messages')
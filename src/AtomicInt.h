@@ -16,6 +16,8 @@
 #ifndef RAMCLOUD_ATOMICINT_H
 #define RAMCLOUD_ATOMICINT_H
 
+#include "Common.h"
+
 namespace RAMCloud {
 
 /**
@@ -45,9 +45,20 @@ BackupStats::getExpectedReadMs() {
  * \param tracker
  *      The tracker used to find backups and track replica distribution
  *      stats.
+ * \param localId
+ *      Id of the server this runs on; only needs to be valid once replicas
+ *      are placed.
+ * \param localReplica
+ *      If true, keep one secondary replica of each segment on the backup
+ *      running in this same server so that a restarted master can reload
+ *      its log from local disk.
  */
-BackupSelector::BackupSelector(BackupTracker& tracker)
+BackupSelector::BackupSelector(BackupTracker& tracker,
+                               const ServerId& localId,
+                               bool localReplica)
     : tracker(tracker)
+    , localId(localId)
+    , localReplica(localReplica)
 {
 }
 
@@ -65,9 +76,9 @@ ServerId
 BackupSelector::selectPrimary(uint32_t numBackups,
                               const ServerId backupIds[])
 {
-    ServerId primary = selectSecondary(numBackups, backupIds);
+    ServerId primary = selectRemote(numBackups, backupIds);
     for (uint32_t i = 0; i < 5 - 1; ++i) {
-        ServerId candidate = selectSecondary(numBackups, backupIds);
+        ServerId candidate = selectRemote(numBackups, backupIds);
         if (tracker[primary]->getExpectedReadMs() >
             tracker[candidate]->getExpectedReadMs()) {
             primary = candidate;
@@ -85,7 +96,8 @@ BackupSelector::selectPrimary(uint32_t numBackups,
 
 /**
  * Choose a random backup that does not conflict with an existing set of
- * backups.
+ * backups. If #localReplica is set and the segment has no replica on the
+ * local backup yet, the local backup is chosen instead.
  * \param numBackups
  *      The number of entries in the \a backupIds array.
  * \param backupIds
@@ -95,18 +107,57 @@ BackupSelector::selectPrimary(uint32_t numBackups,
 ServerId
 BackupSelector::selectSecondary(uint32_t numBackups,
                                 const ServerId backupIds[])
+{
+    if (localReplica && !conflictWithAny(localId, numBackups, backupIds)) {
+        // The local backup enlisted along with this master, but the
+        // tracker may not have heard about it yet.
+        while (!localBackupTracked())
+            applyTrackerChanges();
+        return localId;
+    }
+    return selectRemote(numBackups, backupIds);
+}
+
+// - private -
+
+/**
+ * Choose a random backup that does not conflict with an existing set of
+ * backups and, if #localReplica is set, is not the local backup.
+ * \param numBackups
+ *      The number of entries in the \a backupIds array.
+ * \param backupIds
+ *      An array of numBackups backup ids, none of which may conflict with the
+ *      returned backup.
+ */
+ServerId
+BackupSelector::selectRemote(uint32_t numBackups,
+                             const ServerId backupIds[])
 {
     while (true) {
         applyTrackerChanges();
         ServerId id = tracker.getRandomServerIdWithService(BACKUP_SERVICE);
         if (id.isValid() &&
+            !(localReplica && id == localId) &&
             !conflictWithAny(id, numBackups, backupIds)) {
             return id;
         }
     }
 }
 
-// - private -
+/**
+ * Return whether the backup on this server is in #tracker, so that
+ * replicas can be sent to it.
+ */
+bool
+BackupSelector::localBackupTracked()
+{
+    try {
+        return tracker.getServerDetails(localId)->services.has(
+            BACKUP_SERVICE);
+    } catch (const Exception& e) {
+        return false;
+    }
+}
 
 /**
  * Apply all updates to #tracker from the Server's ServerList since the last
@@ -64,11 +64,14 @@ class BaseBackupSelector {
 class BackupSelector : public BaseBackupSelector {
   PUBLIC:
 
-    explicit BackupSelector(BackupTracker& tracker);
+    BackupSelector(BackupTracker& tracker, const ServerId& localId,
+                   bool localReplica);
     ServerId selectPrimary(uint32_t numBackups, const ServerId backupIds[]);
     ServerId selectSecondary(uint32_t numBackups, const ServerId backupIds[]);
 
   PRIVATE:
+    ServerId selectRemote(uint32_t numBackups, const ServerId backupIds[]);
+    bool localBackupTracked();
     void applyTrackerChanges();
     bool conflict(const ServerId backupId,
                   const ServerId otherBackupId) const;
@@ -85,6 +88,15 @@ class BackupSelector : public BaseBackupSelector {
      */
     BackupTracker& tracker;
 
+    /// Id of the server this runs on; its backup is the local backup.
+    const ServerId& localId;
+
+    /**
+     * If true, one secondary replica of each segment is placed on the
+     * local backup and all others, the primary included, are kept off it.
+     */
+    const bool localReplica;
+
     DISALLOW_COPY_AND_ASSIGN(BackupSelector);
 };
 
@@ -234,6 +234,18 @@ TEST_F(BackupSelectorTest, selectSecondary) {
     EXPECT_EQ(ServerId(4, 0), id);
 }
 
+TEST_F(BackupSelectorTest, localReplica) {
+    std::vector<ServerId> ids;
+    addEqualHosts(coordinator, ids);
+    BackupSelector local(selector->tracker, ids[2], true);
+
+    EXPECT_EQ(ids[2], local.selectSecondary(0, NULL));
+    for (uint32_t i = 0; i < 100; ++i) {
+        EXPECT_NE(ids[2], local.selectPrimary(0, NULL));
+        EXPECT_NE(ids[2], local.selectSecondary(1, &ids[2]));
+    }
+}
+
 TEST_F(BackupSelectorTest, conflict) {
     ServerId backup(1, 0);
     const ServerId conflictingId(backup);
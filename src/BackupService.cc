@@ -105,6 +105,13 @@ BackupService::SegmentInfo::~SegmentInfo()
         LOG(NOTICE, "Backup shutting down with open segment <%lu,%lu>, "
             "closing out to storage", *masterId, segmentId);
         state = CLOSED;
+        // The staging memory past what was written is left over from
+        // earlier segments; clear it so a master restarting from this
+        // replica sees where its log ends.
+        if (rightmostWrittenOffset < segmentSize) {
+            memset(segment + rightmostWrittenOffset, 0,
+                   segmentSize - rightmostWrittenOffset);
+        }
         CycleCounter<RawMetric> _(&metrics->backup.storageWriteTicks);
         ++metrics->backup.storageWriteCount;
         metrics->backup.storageWriteBytes += segmentSize;
@@ -216,8 +223,9 @@ BackupService::SegmentInfo::appendRecoverySegment(uint64_t partitionId,
  * Find which of a set of partitions this object or tombstone is in.
  *
  * \param type
- *      Either LOG_ENTRY_TYPE_OBJ or LOG_ENTRY_TYPE_OBJTOMB.  The result
- *      of this function for a SegmentEntry of any other type is undefined.
+ *      LOG_ENTRY_TYPE_OBJ, LOG_ENTRY_TYPE_OBJTOMB, or
+ *      LOG_ENTRY_TYPE_TXINTENT.  The result of this function for a
+ *      SegmentEntry of any other type is undefined.
  * \param data
  *      The start of an object or tombstone in memory.
  * \param partitions
@@ -236,24 +244,30 @@ whichPartition(const LogEntryType type,
         reinterpret_cast<const Object*>(data);
     const ObjectTombstone* tombstone =
         reinterpret_cast<const ObjectTombstone*>(data);
+    const TransactionIntent* intent =
+        reinterpret_cast<const TransactionIntent*>(data);
 
     uint64_t tableId;
     uint64_t objectId;
     if (type == LOG_ENTRY_TYPE_OBJ) {
         tableId = object->id.tableId;
         objectId = object->id.objectId;
-    } else { // LOG_ENTRY_TYPE_OBJTOMB:
+    } else if (type == LOG_ENTRY_TYPE_OBJTOMB) {
         tableId = tombstone->id.tableId;
         objectId = tombstone->id.objectId;
+    } else { // LOG_ENTRY_TYPE_TXINTENT:
+        tableId = intent->id.tableId;
+        objectId = intent->id.objectId;
     }
 
     Tub<uint64_t> ret;
+    uint64_t tabletKey = Object::tabletKey(objectId);
     // TODO(stutsman): need to check how slow this is, can do better with a tree
     for (int i = 0; i < partitions.tablet_size(); i++) {
         const ProtoBuf::Tablets::Tablet& tablet(partitions.tablet(i));
         if (tablet.table_id() == tableId &&
-            (tablet.start_object_id() <= objectId &&
-            tablet.end_object_id() >= objectId)) {
+            (tablet.start_object_id() <= tabletKey &&
+            tablet.end_object_id() >= tabletKey)) {
             ret.construct(tablet.user_data());
             return ret;
         }
@@ -309,8 +323,24 @@ BackupService::SegmentInfo::buildRecoverySegments(
         {
             if (it.getType() == LOG_ENTRY_TYPE_UNINIT)
                 break;
+            const SegmentEntry* entry = reinterpret_cast<const SegmentEntry*>(
+                    reinterpret_cast<const char*>(it.getPointer()) -
+                    sizeof(*entry));
+            const uint32_t len = (downCast<uint32_t>(sizeof(*entry)) +
+                                  it.getLength());
+
+            // A decision may concern intents in any partition, and it is
+            // small, so every partition gets a copy.
+            if (it.getType() == LOG_ENTRY_TYPE_TXDECISION) {
+                for (uint32_t i = 0; i < partitionCount; i++) {
+                    void *out = new(&recoverySegments[i], APPEND) char[len];
+                    memcpy(out, entry, len);
+                }
+                continue;
+            }
             if (it.getType() != LOG_ENTRY_TYPE_OBJ &&
-                it.getType() != LOG_ENTRY_TYPE_OBJTOMB)
+                it.getType() != LOG_ENTRY_TYPE_OBJTOMB &&
+                it.getType() != LOG_ENTRY_TYPE_TXINTENT)
                 continue;
 
             // find out which partition this entry belongs in
@@ -319,11 +349,6 @@ BackupService::SegmentInfo::buildRecoverySegments(
                                                              partitions);
             if (!partitionId)
                 continue;
-            const SegmentEntry* entry = reinterpret_cast<const SegmentEntry*>(
-                    reinterpret_cast<const char*>(it.getPointer()) -
-                    sizeof(*entry));
-            const uint32_t len = (downCast<uint32_t>(sizeof(*entry)) +
-                                  it.getLength());
             void *out = new(&recoverySegments[*partitionId], APPEND) char[len];
             memcpy(out, entry, len);
         }
@@ -414,6 +439,53 @@ BackupService::SegmentInfo::free()
     state = FREED;
 }
 
+/**
+ * Bring this segment into memory and return its LogDigest if it was still
+ * the open head of its log when it was stored, that is, if it holds a
+ * LogDigest but no footer.  A head is only stored while open when the
+ * backup shuts down cleanly; see ~SegmentInfo().
+ *
+ * \param[out] byteLength
+ *      Optional out parameter for the number of bytes the LogDigest
+ *      occupies.
+ * 
+eturn
+ *      NULL if this segment has no LogDigest, was closed, or couldn't be
+ *      loaded, else a pointer to the LogDigest which remains valid until
+ *      this segment leaves memory.
+ */
+const void*
+BackupService::SegmentInfo::getHeadLogDigest(uint32_t* byteLength)
+{
+    Lock lock(mutex);
+    waitForOngoingOps(lock);
+    if (state != CLOSED)
+        return NULL;
+
+    if (!inMemory()) {
+        ioScheduler.load(*this);
+        ++storageOpCount;
+        waitForOngoingOps(lock);
+        if (!inMemory())
+            return NULL;
+    }
+
+    try {
+        for (SegmentIterator it(segment, segmentSize, true);
+             !it.isDone(); it.next()) {
+            if (it.getType() == LOG_ENTRY_TYPE_UNINIT)
+                break;
+            if (it.getType() == LOG_ENTRY_TYPE_SEGFOOTER)
+                return NULL;
+        }
+    } catch (SegmentIteratorException& e) {
+        LOG(WARNING, "Couldn't scan stored segment <%lu,%lu>: %s",
+            *masterId, segmentId, e.str().c_str());
+        return NULL;
+    }
+    return getLogDigest(byteLength);
+}
+
 /**
  * Open the segment.  After this the segment is in memory and mutable
  * with reserved storage.  Any controlled shutdown of the server will
@@ -450,6 +522,55 @@ BackupService::SegmentInfo::open()
     state = OPEN;
 }
 
+/**
+ * Drop the in memory copy of this segment and its recovery segments once
+ * they have been consumed, keeping its storage.  The segment is CLOSED
+ * afterwards, so it can be freed without waiting on recovery.
+ */
+void
+BackupService::SegmentInfo::releaseMemory()
+{
+    Lock lock(mutex);
+    waitForOngoingOps(lock);
+    while (state == RECOVERING &&
+           primary &&
+           !isRecovered() &&
+           !recoveryException)
+        condition.wait(lock);
+
+    if (isRecovered()) {
+        delete[] recoverySegments;
+        recoverySegments = NULL;
+        recoverySegmentsLength = 0;
+    }
+    if (inMemory()) {
+        pool.free(segment);
+        segment = NULL;
+    }
+    recoveryException.reset();
+    recoveryPartitions.destroy();
+    state = CLOSED;
+}
+
+/**
+ * Adopt a replica found in storage when the backup started.  After this
+ * the segment is CLOSED and is handled as if this backup had stored it
+ * during its current run.
+ *
+ * \param handle
+ *      Storage handle for the replica; see BackupStorage::scan().  Ownership
+ *      passes to this SegmentInfo.
+ */
+void
+BackupService::SegmentInfo::reload(BackupStorage::Handle* handle)
+{
+    Lock lock(mutex);
+    assert(state == UNINIT);
+    storageHandle = handle;
+    rightmostWrittenOffset = BYTES_WRITTEN_CLOSED;
+    state = CLOSED;
+}
+
 /**
  * Begin reading of segment from disk to memory. Marks the segment
  * CLOSED (immutable) as well.  Once the segment is in memory
@@ -865,6 +986,7 @@ BackupService::BackupService(const ServerConfig& config)
     , pool(config.backup.segmentSize)
     , recoveryThreadCount{0}
     , segments()
+    , segmentsMutex()
     , segmentSize(config.backup.segmentSize)
     , storage()
     , storageBenchmarkResults()
@@ -889,6 +1011,9 @@ BackupService::BackupService(const ServerConfig& config)
     try {
         recoveryTicks.construct(); // make unit tests happy
 
+        if (config.restartServerId.isValid())
+            reloadReplicas();
+
         // Prime the segment pool. This removes an overhead that would
         // otherwise be seen during the first recovery.
         void* mem[100];
@@ -924,6 +1049,7 @@ BackupService::~BackupService()
     // but don't free them; perhaps we want to load them up
     // on a cold start.  The infos destructor will ensure the
     // segment is properly stored before termination.
+    Lock _(segmentsMutex);
     foreach (const SegmentsMap::value_type& value, segments) {
         SegmentInfo* info = value.second;
         delete info;
@@ -994,6 +1120,38 @@ BackupService::dispatch(RpcOpcode opcode, Rpc& rpc)
     }
 }
 
+/**
+ * Release all replicas of a master's former log once the master has
+ * replayed it and re-replicated its contents; see findLocalLog().
+ *
+ * \param masterId
+ *      Id the master ran under before its restart.
+ */
+void
+BackupService::freeLocalLog(ServerId masterId)
+{
+    vector<SegmentInfo*> infos;
+    {
+        Lock _(segmentsMutex);
+        SegmentsMap::iterator it = segments.begin();
+        while (it != segments.end()) {
+            if (it->first.masterId == masterId) {
+                infos.push_back(it->second);
+                segments.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    foreach (SegmentInfo* info, infos) {
+        info->free();
+        delete info;
+    }
+    LOG(NOTICE, "Freed %lu replicas of former server %lu",
+        infos.size(), *masterId);
+}
+
 /**
  * Removes the specified segment from permanent storage and releases
  * any in memory copy if it exists.
@@ -1017,21 +1175,88 @@ BackupService::freeSegment(const BackupFreeRpc::Request& reqHdr,
 {
     LOG(DEBUG, "Handling: %lu %lu", reqHdr.masterId, reqHdr.segmentId);
 
-    SegmentsMap::iterator it =
-        segments.find(MasterSegmentIdPair(ServerId(reqHdr.masterId),
-                                                   reqHdr.segmentId));
-    if (it == segments.end()) {
-        LOG(WARNING, "Master tried to free non-existent segment: <%lu,%lu>",
-            reqHdr.masterId, reqHdr.segmentId);
-        return;
+    SegmentInfo *info;
+    {
+        Lock _(segmentsMutex);
+        SegmentsMap::iterator it =
+            segments.find(MasterSegmentIdPair(ServerId(reqHdr.masterId),
+                                                       reqHdr.segmentId));
+        if (it == segments.end()) {
+            LOG(WARNING, "Master tried to free non-existent segment: "
+                "<%lu,%lu>", reqHdr.masterId, reqHdr.segmentId);
+            return;
+        }
+        info = it->second;
+        segments.erase(it);
     }
 
-    SegmentInfo *info = it->second;
     info->free();
-    segments.erase(it);
     delete info;
 }
 
+/**
+ * Find the log a master left in this backup's storage before it was
+ * restarted, and check that all of it is here, so that the master can
+ * replay it locally instead of going through crash recovery; see
+ * ServerConfig::restartServerId.
+ *
+ * \param masterId
+ *      Id the master ran under before its restart.
+ * \param[out] segmentIds
+ *      Set to the ids of the segments in the master's log, as listed by
+ *      the LogDigest in its head, if this returns true.
+ * \return
+ *      True if the newest replica of the master's log was stored while it
+ *      was still the open head, so nothing can have been written after it,
+ *      and every segment its LogDigest names is in storage.  False
+ *      otherwise, in which case the master's data must be recovered from
+ *      its remote replicas.
+ */
+bool
+BackupService::findLocalLog(ServerId masterId, vector<uint64_t>& segmentIds)
+{
+    SegmentInfo* head = NULL;
+    {
+        Lock _(segmentsMutex);
+        foreach (const SegmentsMap::value_type& value, segments) {
+            if (value.first.masterId == masterId &&
+                (!head || head->segmentId < value.first.segmentId))
+                head = value.second;
+        }
+    }
+    if (!head) {
+        LOG(WARNING, "No replicas of former server %lu in storage",
+            *masterId);
+        return false;
+    }
+
+    uint32_t digestBytes = 0;
+    const void* digestPtr = head->getHeadLogDigest(&digestBytes);
+    if (!digestPtr) {
+        LOG(WARNING, "Newest replica <%lu,%lu> in storage wasn't stored as "
+            "an open head; later writes may be missing", *masterId,
+            head->segmentId);
+        return false;
+    }
+
+    LogDigest digest(digestPtr, digestBytes);
+    vector<uint64_t> ids;
+    for (int i = 0; i < digest.getSegmentCount(); i++) {
+        uint64_t segmentId = digest.getSegmentIds()[i];
+        if (!findSegmentInfo(masterId, segmentId)) {
+            LOG(WARNING, "Segment <%lu,%lu> of the log is missing from "
+                "storage", *masterId, segmentId);
+            return false;
+        }
+        ids.push_back(segmentId);
+    }
+
+    LOG(NOTICE, "Found all %lu segments of former server %lu's log in "
+        "storage, head is %lu", ids.size(), *masterId, head->segmentId);
+    segmentIds.swap(ids);
+    return true;
+}
+
 /**
  * Find SegmentInfo for a segment or NULL if we don't know about it.
  *
@@ -1046,6 +1271,7 @@ BackupService::freeSegment(const BackupFreeRpc::Request& reqHdr,
 BackupService::SegmentInfo*
 BackupService::findSegmentInfo(ServerId masterId, uint64_t segmentId)
 {
+    Lock _(segmentsMutex);
     SegmentsMap::iterator it =
         segments.find(MasterSegmentIdPair(masterId, segmentId));
     if (it == segments.end())
@@ -1054,6 +1280,36 @@ BackupService::findSegmentInfo(ServerId masterId, uint64_t segmentId)
 }
 
 
+/**
+ * Append the objects and tombstones of one segment of a master's former
+ * log to a buffer, once startReadingLocalLog() has them ready.  This is
+ * the local counterpart of getRecoveryData(), for a single partition.
+ *
+ * \param masterId
+ *      Id the master ran under before its restart.
+ * \param segmentId
+ *      The segment whose data is wanted.
+ * \param[out] buffer
+ *      The data is appended here.  It is not copied and remains valid until
+ *      releaseLocalRecoveryData() is called on the segment.
+ * \return
+ *      STATUS_OK if the data was appended, STATUS_RETRY if the segment
+ *      isn't ready yet and the caller should try again later.
+ * \throw BackupBadSegmentIdException
+ *      If the segment isn't part of a log being read locally.
+ * \throw SegmentRecoveryFailedException
+ *      If the segment couldn't be parsed.
+ */
+Status
+BackupService::getLocalRecoveryData(ServerId masterId, uint64_t segmentId,
+                                    Buffer& buffer)
+{
+    SegmentInfo* info = findSegmentInfo(masterId, segmentId);
+    if (!info)
+        throw BackupBadSegmentIdException(HERE);
+    return info->appendRecoverySegment(0, buffer);
+}
+
 /**
  * Return the data for a particular tablet that was recovered by a call
  * to startReadingData().
@@ -1155,6 +1411,63 @@ BackupService::recoveryComplete(
     recoveryTicks.destroy();
 }
 
+/**
+ * Drop the in memory copy of a segment of a master's former log once the
+ * master has replayed it, keeping the replica in storage until
+ * freeLocalLog().  This bounds the memory used while replaying a log that
+ * is larger than the backup's segment pool would comfortably hold.
+ *
+ * \param masterId
+ *      Id the master ran under before its restart.
+ * \param segmentId
+ *      The segment whose data is no longer needed.
+ */
+void
+BackupService::releaseLocalRecoveryData(ServerId masterId, uint64_t segmentId)
+{
+    SegmentInfo* info = findSegmentInfo(masterId, segmentId);
+    if (info)
+        info->releaseMemory();
+}
+
+/**
+ * Adopt the replicas a previous run of this server left in storage, so the
+ * master restarting in this process can replay its former log from them;
+ * see ServerConfig::restartServerId.  Replicas of other masters are freed:
+ * they were written off when this server went down and nothing would ever
+ * free them otherwise.
+ */
+void
+BackupService::reloadReplicas()
+{
+    vector<BackupStorage::StoredReplica> replicas;
+    storage->scan(replicas);
+
+    uint32_t reloaded = 0;
+    foreach (const BackupStorage::StoredReplica& replica, replicas) {
+        ServerId masterId(replica.masterId);
+        if (masterId != config.restartServerId) {
+            storage->free(replica.handle);
+            continue;
+        }
+#ifdef SINGLE_THREADED_BACKUP
+        bool primary = false;
+#else
+        bool primary = true;
+#endif
+        SegmentInfo* info = new SegmentInfo(*storage, pool, ioScheduler,
+                                            masterId, replica.segmentId,
+                                            segmentSize, primary);
+        info->reload(replica.handle);
+        Lock _(segmentsMutex);
+        segments[MasterSegmentIdPair(masterId, replica.segmentId)] = info;
+        ++reloaded;
+    }
+    LOG(NOTICE, "Reloaded %u replicas of former server %lu from storage, "
+        "freed %lu others", reloaded, *config.restartServerId,
+        replicas.size() - reloaded);
+}
+
 /**
  * Returns true if left points to a SegmentInfo with a lesser
  * segmentId than that pointed to by right.
@@ -1226,6 +1539,7 @@ BackupService::startReadingData(
     vector<SegmentInfo*> primarySegments;
     vector<SegmentInfo*> secondarySegments;
 
+    Lock lock(segmentsMutex);
     for (SegmentsMap::iterator it = segments.begin();
          it != segments.end(); it++)
     {
@@ -1254,6 +1568,7 @@ BackupService::startReadingData(
             }
         }
     }
+    lock.unlock();
 
     // Shuffle the primary entries, this helps all recovery
     // masters to stay busy even if the log contains long sequences of
@@ -1312,6 +1627,50 @@ BackupService::startReadingData(
 #endif
 }
 
+/**
+ * Begin reading a master's former log from this backup's storage so the
+ * master can replay it; see findLocalLog().  The segments are loaded and
+ * filtered on a separate thread while the master replays the ones already
+ * read, and their data is fetched with getLocalRecoveryData().
+ *
+ * \param masterId
+ *      Id the master ran under before its restart.
+ * \param segmentIds
+ *      The segments of the log, as returned by findLocalLog().
+ * \param partitions
+ *      The tablets the master is taking back, all in partition 0.  Objects
+ *      outside of them belonged to tablets dropped since and are skipped.
+ */
+void
+BackupService::startReadingLocalLog(ServerId masterId,
+                                    const vector<uint64_t>& segmentIds,
+                                    const ProtoBuf::Tablets& partitions)
+{
+    vector<SegmentInfo*> primarySegments;
+    foreach (uint64_t segmentId, segmentIds) {
+        SegmentInfo* info = findSegmentInfo(masterId, segmentId);
+        assert(info);
+        if (info->primary) {
+            info->setRecovering();
+            primarySegments.push_back(info);
+        } else {
+            info->setRecovering(partitions);
+        }
+    }
+
+#ifndef SINGLE_THREADED_BACKUP
+    RecoverySegmentBuilder builder(Context::get(),
+                                   primarySegments,
+                                   partitions,
+                                   recoveryThreadCount);
+    ++recoveryThreadCount;
+    std::thread builderThread(builder);
+    builderThread.detach();
+#endif
+    LOG(DEBUG, "Reading %lu segments of former server %lu's log",
+        segmentIds.size(), *masterId);
+}
+
 /**
  * Store an opaque string of bytes in a currently open segment on
  * this backup server.  This data is guaranteed to be considered on recovery
@@ -1366,10 +1725,16 @@ BackupService::writeSegment(const BackupWriteRpc::Request& reqHdr,
 #endif
             info = new SegmentInfo(*storage, pool, ioScheduler,
                                    masterId, segmentId, segmentSize, primary);
-            segments[MasterSegmentIdPair(masterId, segmentId)] = info;
+            {
+                Lock _(segmentsMutex);
+                segments[MasterSegmentIdPair(masterId, segmentId)] = info;
+            }
             info->open();
         } catch (...) {
-            segments.erase(MasterSegmentIdPair(masterId, segmentId));
+            {
+                Lock _(segmentsMutex);
+                segments.erase(MasterSegmentIdPair(masterId, segmentId));
+            }
             delete info;
             throw;
         }
@@ -208,6 +208,7 @@ class BackupService : public Service {
         void buildRecoverySegments(const ProtoBuf::Tablets& partitions);
         void close();
         void free();
+        const void* getHeadLogDigest(uint32_t* byteLength = NULL);
 
         /// See #rightmostWrittenOffset.
         uint32_t
@@ -224,6 +225,8 @@ class BackupService : public Service {
         }
 
         void open();
+        void releaseMemory();
+        void reload(BackupStorage::Handle* handle);
 
         /**
          * Set the state to #RECOVERING from #OPEN or #CLOSED.
@@ -480,8 +483,18 @@ class BackupService : public Service {
     void dispatch(RpcOpcode opcode, Rpc& rpc);
     ServerId getServerId() const;
     void init(ServerId id);
+    bool findLocalLog(ServerId masterId, vector<uint64_t>& segmentIds);
+    void freeLocalLog(ServerId masterId);
+    Status getLocalRecoveryData(ServerId masterId, uint64_t segmentId,
+                                Buffer& buffer)
+        __attribute__((warn_unused_result));
+    void releaseLocalRecoveryData(ServerId masterId, uint64_t segmentId);
+    void startReadingLocalLog(ServerId masterId,
+                              const vector<uint64_t>& segmentIds,
+                              const ProtoBuf::Tablets& partitions);
 
   PRIVATE:
+    void reloadReplicas();
     void freeSegment(const BackupFreeRpc::Request& reqHdr,
                      BackupFreeRpc::Response& respHdr,
                      Rpc& rpc);
@@ -555,6 +568,16 @@ class BackupService : public Service {
      */
     SegmentsMap segments;
 
+    /// The type of locks used to lock #segmentsMutex.
+    typedef std::unique_lock<std::mutex> Lock;
+
+    /**
+     * Protects #segments.  RPCs are handled one at a time, but a master
+     * restarting in this process replays its former log from a thread of
+     * its own (see findLocalLog()).
+     */
+    std::mutex segmentsMutex;
+
     /// The uniform size of each segment this backup deals with.
     const uint32_t segmentSize;
 
@@ -575,6 +598,7 @@ class BackupService : public Service {
     /// Used to ensure that init() is invoked before the dispatcher runs.
     bool initCalled;
 
+    friend class RestartBenchmark;
     DISALLOW_COPY_AND_ASSIGN(BackupService);
 };
 
@@ -75,12 +75,13 @@ class BackupServiceTest : public ::testing::Test {
     uint32_t
     writeObject(ServerId masterId, uint64_t segmentId,
                 uint32_t offset, const char *data, uint32_t bytes,
-                uint64_t tableId, uint64_t objectId)
+                uint64_t tableId, uint64_t tabletKey)
     {
         char objectMem[sizeof(Object) + bytes];
         Object* obj = reinterpret_cast<Object*>(objectMem);
         memset(obj, 'A', sizeof(*obj));
-        obj->id.objectId = objectId;
+        // Placed by tablet key to line up with createTabletList().
+        obj->id.objectId = Object::objectIdForTabletKey(tabletKey);
         obj->id.tableId = tableId;
         obj->version = 0;
         memcpy(objectMem + sizeof(*obj), data, bytes);
@@ -90,13 +91,25 @@ class BackupServiceTest : public ::testing::Test {
 
     uint32_t
     writeTombstone(ServerId masterId, uint64_t segmentId,
-                   uint32_t offset, uint64_t tableId, uint64_t objectId)
+                   uint32_t offset, uint64_t tableId, uint64_t tabletKey)
     {
-        ObjectTombstone tombstone(segmentId, tableId, objectId, 0);
+        // Placed by tablet key to line up with createTabletList().
+        ObjectTombstone tombstone(segmentId, tableId,
+                                  Object::objectIdForTabletKey(tabletKey), 0);
         return writeEntry(masterId, segmentId, LOG_ENTRY_TYPE_OBJTOMB, offset,
                           &tombstone, sizeof(tombstone));
     }
 
+    uint32_t
+    writeIntent(ServerId masterId, uint64_t segmentId,
+                uint32_t offset, uint64_t tableId, uint64_t tabletKey)
+    {
+        TransactionIntent intent(tableId,
+                                 Object::objectIdForTabletKey(tabletKey), 77);
+        return writeEntry(masterId, segmentId, LOG_ENTRY_TYPE_TXINTENT,
+                          offset, &intent, sizeof(intent));
+    }
+
     uint32_t
     writeHeader(ServerId masterId, uint64_t segmentId)
     {
@@ -183,6 +196,46 @@ class BackupServiceTest : public ::testing::Test {
 };
 
 
+TEST_F(BackupServiceTest, findLocalLog) {
+    client->openSegment(ServerId(99, 0), 87);
+    client->closeSegment(ServerId(99, 0), 87);
+    client->openSegment(ServerId(99, 0), 88);
+    writeDigestedSegment(ServerId(99, 0), 88, { 87, 88 });
+    char end[sizeof(SegmentEntry)] = {};
+    client->writeSegment(ServerId(99, 0), 88, 52, end,
+                         downCast<uint32_t>(sizeof(end)));
+    client->closeSegment(ServerId(99, 0), 88);
+
+    vector<uint64_t> segmentIds;
+    EXPECT_TRUE(backup->findLocalLog(ServerId(99, 0), segmentIds));
+    EXPECT_EQ((vector<uint64_t>{ 87, 88 }), segmentIds);
+    EXPECT_FALSE(backup->findLocalLog(ServerId(98, 0), segmentIds));
+}
+
+TEST_F(BackupServiceTest, findLocalLog_segmentMissing) {
+    client->openSegment(ServerId(99, 0), 88);
+    writeDigestedSegment(ServerId(99, 0), 88, { 87, 88 });
+    char end[sizeof(SegmentEntry)] = {};
+    client->writeSegment(ServerId(99, 0), 88, 52, end,
+                         downCast<uint32_t>(sizeof(end)));
+    client->closeSegment(ServerId(99, 0), 88);
+
+    vector<uint64_t> segmentIds;
+    EXPECT_FALSE(backup->findLocalLog(ServerId(99, 0), segmentIds));
+    EXPECT_EQ(0U, segmentIds.size());
+}
+
+TEST_F(BackupServiceTest, findLocalLog_headClosed) {
+    // A footer means the master moved on to a head that wasn't stored.
+    client->openSegment(ServerId(99, 0), 88);
+    writeDigestedSegment(ServerId(99, 0), 88, { 88 });
+    writeFooter(ServerId(99, 0), 88, 52);
+    client->closeSegment(ServerId(99, 0), 88);
+
+    vector<uint64_t> segmentIds;
+    EXPECT_FALSE(backup->findLocalLog(ServerId(99, 0), segmentIds));
+}
+
 TEST_F(BackupServiceTest, findSegmentInfo) {
     EXPECT_TRUE(NULL == backup->findSegmentInfo(ServerId(99, 0), 88));
     client->openSegment(ServerId(99, 0), 88);
@@ -265,30 +318,79 @@ TEST_F(BackupServiceTest, getRecoveryData) {
     EXPECT_FALSE(it.isDone());
     EXPECT_EQ(LOG_ENTRY_TYPE_OBJ, it.getType());
     EXPECT_EQ(123U, it.get<Object>()->id.tableId);
-    EXPECT_EQ(29U, it.get<Object>()->id.objectId);
+    EXPECT_EQ(29U, Object::tabletKey(it.get<Object>()->id.objectId));
     it.next();
 
     EXPECT_FALSE(it.isDone());
     EXPECT_EQ(LOG_ENTRY_TYPE_OBJ, it.getType());
     EXPECT_EQ(124U, it.get<Object>()->id.tableId);
-    EXPECT_EQ(20U, it.get<Object>()->id.objectId);
+    EXPECT_EQ(20U, Object::tabletKey(it.get<Object>()->id.objectId));
     it.next();
 
     EXPECT_FALSE(it.isDone());
     EXPECT_EQ(LOG_ENTRY_TYPE_OBJTOMB, it.getType());
     EXPECT_EQ(123U, it.get<ObjectTombstone>()->id.tableId);
-    EXPECT_EQ(29U, it.get<ObjectTombstone>()->id.objectId);
+    EXPECT_EQ(29U,
+              Object::tabletKey(it.get<ObjectTombstone>()->id.objectId));
     it.next();
 
     EXPECT_FALSE(it.isDone());
     EXPECT_EQ(LOG_ENTRY_TYPE_OBJTOMB, it.getType());
     EXPECT_EQ(124U, it.get<ObjectTombstone>()->id.tableId);
-    EXPECT_EQ(20U, it.get<ObjectTombstone>()->id.objectId);
+    EXPECT_EQ(20U,
+              Object::tabletKey(it.get<ObjectTombstone>()->id.objectId));
     it.next();
 
     EXPECT_TRUE(it.isDone());
 }
 
+TEST_F(BackupServiceTest, getRecoveryData_transactions) {
+    ProtoBuf::Tablets tablets;
+    createTabletList(tablets);
+
+    uint32_t offset = 0;
+    client->openSegment(ServerId(99, 0), 88);
+    offset = writeHeader(ServerId(99, 0), 88);
+    offset += writeIntent(ServerId(99, 0), 88, offset, 123, 29);
+    offset += writeIntent(ServerId(99, 0), 88, offset, 123, 30);
+    TransactionDecision decision(77, true, 0);
+    offset += writeEntry(ServerId(99, 0), 88, LOG_ENTRY_TYPE_TXDECISION,
+                         offset, &decision, sizeof(decision));
+    offset += writeFooter(ServerId(99, 0), 88, offset);
+    client->closeSegment(ServerId(99, 0), 88);
+    client->startReadingData(ServerId(99, 0), tablets);
+
+    // Each intent goes with its object's partition; every partition gets
+    // the decision.
+    for (uint64_t partitionId = 0; partitionId < 2; partitionId++) {
+        Buffer response;
+        while (true) {
+            try {
+                BackupClient::GetRecoveryData(
+                    *client, ServerId(99, 0), 88, partitionId, response)();
+            } catch (const RetryException& e) {
+                response.reset();
+                continue;
+            }
+            break;
+        }
+
+        RecoverySegmentIterator it(
+            response.getRange(0, response.getTotalLength()),
+            response.getTotalLength());
+        EXPECT_FALSE(it.isDone());
+        EXPECT_EQ(LOG_ENTRY_TYPE_TXINTENT, it.getType());
+        EXPECT_EQ(29U + partitionId, Object::tabletKey(
+            it.get<TransactionIntent>()->id.objectId));
+        it.next();
+        EXPECT_FALSE(it.isDone());
+        EXPECT_EQ(LOG_ENTRY_TYPE_TXDECISION, it.getType());
+        EXPECT_EQ(77U, it.get<TransactionDecision>()->transactionId);
+        it.next();
+        EXPECT_TRUE(it.isDone());
+    }
+}
+
 TEST_F(BackupServiceTest, getRecoveryData_moreThanOneSegmentStored) {
     uint32_t offset = 0;
     client->openSegment(ServerId(99, 0), 87);
@@ -804,7 +906,7 @@ TEST_F(SegmentInfoTest, appendRecoverySegment) {
     segment.append(LOG_ENTRY_TYPE_SEGHEADER, &header, sizeof(header));
 
     Object object(sizeof(object));
-    object.id.objectId = 10;
+    object.id.objectId = Object::objectIdForTabletKey(10);
     object.id.tableId = 123;
     object.version = 0;
     segment.append(LOG_ENTRY_TYPE_OBJ, &object, sizeof(object));
@@ -841,7 +943,7 @@ TEST_F(SegmentInfoTest, appendRecoverySegmentSecondarySegment) {
     segment.append(LOG_ENTRY_TYPE_SEGHEADER, &header, sizeof(header));
 
     Object object(sizeof(object));
-    object.id.objectId = 10;
+    object.id.objectId = Object::objectIdForTabletKey(10);
     object.id.tableId = 123;
     object.version = 0;
     segment.append(LOG_ENTRY_TYPE_OBJ, &object, sizeof(object));
@@ -938,7 +1040,7 @@ TEST_F(SegmentInfoTest, whichPartition) {
     createTabletList(partitions);
 
     Object object(sizeof(object));
-    object.id.objectId = 10;
+    object.id.objectId = Object::objectIdForTabletKey(10);
     object.id.tableId = 123;
     object.version = 0;
 
@@ -946,18 +1048,19 @@ TEST_F(SegmentInfoTest, whichPartition) {
     EXPECT_TRUE(r);
     EXPECT_EQ(0u, *r);
 
-    object.id.objectId = 30;
+    object.id.objectId = Object::objectIdForTabletKey(30);
     r = whichPartition(LOG_ENTRY_TYPE_OBJ, &object, partitions);
     EXPECT_TRUE(r);
     EXPECT_EQ(1u, *r);
 
     TestLog::Enable _;
-    object.id.objectId = 40;
+    object.id.objectId = Object::objectIdForTabletKey(40);
     r = whichPartition(LOG_ENTRY_TYPE_OBJ, &object, partitions);
     EXPECT_FALSE(r);
-    EXPECT_EQ("whichPartition: Couldn't place object <123,40> into any of the "
-              "given tablets for recovery; hopefully it belonged to a deleted "
-              "tablet or lives in another log now", TestLog::get());
+    EXPECT_EQ(format("whichPartition: Couldn't place object <123,%lu> into "
+                     "any of the given tablets for recovery; hopefully it "
+                     "belonged to a deleted tablet or lives in another log "
+                     "now", object.id.objectId), TestLog::get());
 }
 
 TEST_F(SegmentInfoTest, buildRecoverySegment) {
@@ -968,7 +1071,7 @@ TEST_F(SegmentInfoTest, buildRecoverySegment) {
     segment.append(LOG_ENTRY_TYPE_SEGHEADER, &header, sizeof(header));
 
     Object object(sizeof(object));
-    object.id.objectId = 10;
+    object.id.objectId = Object::objectIdForTabletKey(10);
     object.id.tableId = 123;
     object.version = 0;
     segment.append(LOG_ENTRY_TYPE_OBJ, &object, sizeof(object));
@@ -269,6 +269,46 @@ SingleFileStorage::putSegment(const BackupStorage::Handle* handle,
         throw BackupStorageException(HERE, errno);
 }
 
+// See BackupStorage::scan().
+void
+SingleFileStorage::scan(vector<StoredReplica>& replicas)
+{
+    // Reads must be block sized and aligned when the file uses O_DIRECT;
+    // the segment header fits well within the first block of a frame.
+    void* block;
+    int r = posix_memalign(&block, killMessageLen, killMessageLen);
+    if (r != 0)
+        throw std::bad_alloc();
+
+    for (uint32_t frame = 0; frame < segmentFrames; ++frame) {
+        if (!freeMap[frame])
+            continue;
+        ssize_t bytesRead = pread(fd, block, killMessageLen,
+                                  offsetOfSegmentFrame(frame));
+        if (bytesRead == -1) {
+            std::free(block);
+            throw BackupStorageException(HERE,
+                    "Failed to read stored segment header", errno);
+        }
+        const SegmentEntry* entry = static_cast<const SegmentEntry*>(block);
+        const SegmentHeader* header =
+            reinterpret_cast<const SegmentHeader*>(entry + 1);
+        if (bytesRead < static_cast<ssize_t>(sizeof(*entry) +
+                                             sizeof(*header)) ||
+            entry->type != LOG_ENTRY_TYPE_SEGHEADER ||
+            entry->length != sizeof(SegmentHeader) ||
+            header->segmentCapacity != segmentSize) {
+            continue;
+        }
+        LOG(DEBUG, "Found <%lu,%lu> in frame %u", header->logId,
+            header->segmentId, frame);
+        freeMap[frame] = 0;
+        replicas.push_back({header->logId, header->segmentId,
+                            new Handle(frame)});
+    }
+    std::free(block);
+}
+
 // - private -
 
 /**
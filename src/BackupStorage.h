@@ -124,6 +124,16 @@ class BackupStorage {
     /// See #storageType.
     enum class Type { UNKNOWN = 0, MEMORY = 1, DISK = 2 };
 
+    /// A replica left in storage by an earlier process; see scan().
+    struct StoredReplica {
+        /// Id of the master the replica belongs to.
+        uint64_t masterId;
+        /// Id of the segment the replica is of.
+        uint64_t segmentId;
+        /// Handle to the storage holding the replica; owned by the caller.
+        Handle* handle;
+    };
+
     /**
      * Set aside storage for a specific segment and give a handle back
      * for working with that storage.
@@ -177,6 +187,19 @@ class BackupStorage {
     virtual void
     putSegment(const Handle* handle, const char* segment) const = 0;
 
+    /**
+     * Find the replicas a previous process left in this storage and
+     * reserve their storage as if allocate() had returned it, so that a
+     * restarted backup can serve them again. Replicas are recognized by
+     * the segment header at the start of each one; freed storage was
+     * overwritten by free() and is skipped. Must be called before any
+     * allocate(). Storage which does not outlive the process finds nothing.
+     *
+     * \param[out] replicas
+     *      Each replica found is appended here.
+     */
+    virtual void scan(vector<StoredReplica>& replicas) {}
+
   protected:
     /**
      * Specify the segment size this BackupStorage will operate on.  Used
@@ -252,6 +275,7 @@ class SingleFileStorage : public BackupStorage {
                char* segment) const;
     virtual void putSegment(const BackupStorage::Handle* handle,
                             const char* segment) const;
+    virtual void scan(vector<StoredReplica>& replicas);
 
   PRIVATE:
     uint64_t offsetOfSegmentFrame(uint32_t segmentFrame) const;
@@ -182,6 +182,39 @@ TEST_F(SingleFileStorageTest, putSegment_seekFailed) {
     storage->fd = open(path, O_CREAT | O_RDWR, 0666); // supresses LOG ERROR
 }
 
+TEST_F(SingleFileStorageTest, scan) {
+    const uint32_t bigSegmentSize = 1024;
+    delete storage;
+    unlink(path);
+    storage = new SingleFileStorage(bigSegmentSize, 3, path, 0);
+
+    char segment[bigSegmentSize];
+    memset(segment, 0, sizeof(segment));
+    SegmentEntry entry(LOG_ENTRY_TYPE_SEGHEADER, sizeof(SegmentHeader));
+    SegmentHeader header = { 99, 88, bigSegmentSize };
+    memcpy(segment, &entry, sizeof(entry));
+    memcpy(segment + sizeof(entry), &header, sizeof(header));
+    std::unique_ptr<BackupStorage::Handle> kept(storage->allocate(99, 88));
+    storage->putSegment(kept.get(), segment);
+    BackupStorage::Handle* freed = storage->allocate(99, 89);
+    storage->putSegment(freed, segment);
+    storage->free(freed);
+    delete storage;
+
+    storage = new SingleFileStorage(bigSegmentSize, 3, path, 0);
+    vector<BackupStorage::StoredReplica> replicas;
+    storage->scan(replicas);
+    ASSERT_EQ(1U, replicas.size());
+    EXPECT_EQ(99U, replicas[0].masterId);
+    EXPECT_EQ(88U, replicas[0].segmentId);
+    EXPECT_EQ(0U, static_cast<SingleFileStorage::Handle*>(
+        replicas[0].handle)->getSegmentFrame());
+    EXPECT_EQ(0, storage->freeMap[0]);
+    EXPECT_EQ(1, storage->freeMap[1]);
+    EXPECT_EQ(1, storage->freeMap[2]);
+    delete replicas[0].handle;
+}
+
 class InMemoryStorageTest : public ::testing::Test {
   public:
     const uint32_t segmentFrames;
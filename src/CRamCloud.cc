@@ -103,6 +103,70 @@ void rc_disconnect(struct rc_client* client) {
 //   pointer argument here.
 // See the documentation in RamCloudClient.cc for details.
 
+/**
+ * Similar to RamCloud::compareAndSwap, except that if the object doesn't
+ * hold the expected value, its current value is copied out to a
+ * fixed-length buffer rather than returned in a Buffer object.
+ *
+ * \param client
+ *      Handle for the RAMCloud connection.
+ * \param tableId
+ *      The table containing the object (return value from a previous
+ *      call to openTable).
+ * \param id
+ *      Identifier within tableId of the object to be updated.
+ * \param oldBuf
+ *      The value the object must currently hold.
+ * \param oldLength
+ *      Size in bytes of oldBuf.
+ * \param newBuf
+ *      The value to store if the object holds oldBuf.
+ * \param newLength
+ *      Size in bytes of newBuf.
+ * \param[out] version
+ *      If non-NULL, the version number of the object after the operation
+ *      is returned here.
+ * \param[out] swapped
+ *      Set to 1 if the value was replaced, 0 otherwise.
+ * \param[out] currentBuf
+ *      If the value wasn't replaced, the object's current value is copied
+ *      to this location.
+ * \param maxLength
+ *      Number of bytes of space available at currentBuf.
+ * \param[out] actualLength
+ *      If the value wasn't replaced, the size of the object's current
+ *      value is stored here; this may be larger than maxLength.
+ *      Otherwise 0 is stored here.
+ *
+ * \return
+ *      0 means success, anything else indicates an error. A value that
+ *      didn't match is not an error.
+ */
+Status
+rc_compareAndSwap(struct rc_client* client, uint32_t tableId, uint64_t id,
+        const void* oldBuf, uint32_t oldLength,
+        const void* newBuf, uint32_t newLength,
+        uint64_t* version, uint8_t* swapped,
+        void* currentBuf, uint32_t maxLength, uint32_t* actualLength)
+{
+    Buffer current;
+    *swapped = 0;
+    *actualLength = 0;
+    try {
+        *swapped = client->client->compareAndSwap(tableId, id,
+                oldBuf, oldLength, newBuf, newLength, &current, version);
+        *actualLength = current.getTotalLength();
+        uint32_t bytesToCopy = *actualLength;
+        if (bytesToCopy > maxLength) {
+            bytesToCopy = maxLength;
+        }
+        current.copy(0, bytesToCopy, currentBuf);
+    } catch (ClientException& e) {
+        return e.status;
+    }
+    return STATUS_OK;
+}
+
 Status rc_create(struct rc_client* client, uint32_t tableId,
         const void* buf, uint32_t length, uint64_t* id, uint64_t* version)
 {
@@ -147,6 +211,20 @@ rc_getStatus(struct rc_client* client) {
     return client->client->status;
 }
 
+Status
+rc_increment(struct rc_client* client, uint32_t tableId, uint64_t id,
+        int64_t incrementValue, const struct RejectRules* rejectRules,
+        uint64_t* version, int64_t* newValue)
+{
+    try {
+        *newValue = client->client->increment(tableId, id, incrementValue,
+                rejectRules, version);
+    } catch (ClientException& e) {
+        return e.status;
+    }
+    return STATUS_OK;
+}
+
 Status
 rc_openTable(struct rc_client* client, const char* name,
         uint32_t* tableId)
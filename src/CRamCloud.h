@@ -36,12 +36,23 @@ RAMCloud::Status    rc_connectWithClient(
                             struct rc_client** newClient);
 void                rc_disconnect(struct rc_client* client);
 
+RAMCloud::Status    rc_compareAndSwap(struct rc_client* client,
+                            uint32_t tableId, uint64_t id,
+                            const void* oldBuf, uint32_t oldLength,
+                            const void* newBuf, uint32_t newLength,
+                            uint64_t* version, uint8_t* swapped,
+                            void* currentBuf, uint32_t maxLength,
+                            uint32_t* actualLength);
 RAMCloud::Status    rc_create(struct rc_client* client, uint32_t tableId,
                             const void* buf, uint32_t length, uint64_t* id,
                             uint64_t* version);
 RAMCloud::Status    rc_createTable(struct rc_client* client, const char* name);
 RAMCloud::Status    rc_dropTable(struct rc_client* client, const char* name);
 RAMCloud::Status    rc_getStatus(struct rc_client* client);
+RAMCloud::Status    rc_increment(struct rc_client* client, uint32_t tableId,
+                            uint64_t id, int64_t incrementValue,
+                            const struct RAMCloud::RejectRules* rejectRules,
+                            uint64_t* version, int64_t* newValue);
 RAMCloud::Status    rc_openTable(struct rc_client* client, const char* name,
                             uint32_t* tableId);
 RAMCloud::Status    rc_ping(struct rc_client* client,
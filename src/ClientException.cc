@@ -109,6 +109,8 @@ ClientException::throwException(const CodeLocation& where, Status status)
             throw TimeoutException(where);
         case STATUS_INTERNAL_ERROR:
             throw InternalError(where, status);
+        case STATUS_INVALID_OBJECT:
+            throw InvalidObjectException(where);
         default:
             throw InternalError(where, status);
     }
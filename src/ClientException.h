@@ -149,6 +149,9 @@ DEFINE_EXCEPTION(ServiceNotAvailableException,
 DEFINE_EXCEPTION(TimeoutException,
                  STATUS_TIMEOUT,
                  ClientException)
+DEFINE_EXCEPTION(InvalidObjectException,
+                 STATUS_INVALID_OBJECT,
+                 ClientException)
 
 } // namespace RAMCloud
 
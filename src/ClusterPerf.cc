@@ -41,6 +41,7 @@
 
 #include <boost/program_options.hpp>
 #include <boost/version.hpp>
+#include <cmath>
 #include <iostream>
 namespace po = boost::program_options;
 
@@ -71,6 +72,10 @@ static int objectSize;
 // to specify the number of tables to create.
 static int numTables;
 
+// Value of the "--serverSpan" command-line option: used by some tests
+// to specify how many masters each table they create is split across.
+static int serverSpan;
+
 // Identifier for table that is used for test-specific data.
 uint32_t dataTable = -1;
 
@@ -602,10 +607,15 @@ sendCommand(const char* command, const char* state, int firstSlave,
  *      Number of bytes in the object to create each table.
  * \param objectId
  *      Identifier to use for the created object in each table.
+ * \param span
+ *      Number of masters to split each table across. This many objects are
+ *      created in each table, with consecutive ids starting at \a objectId;
+ *      the masters place them by the hash of their ids, so they spread
+ *      across the tablets.
  *
  */
 int*
-createTables(int numTables, int objectSize, int objectId = 0)
+createTables(int numTables, int objectSize, int objectId = 0, int span = 1)
 {
     int* tableIds = new int[numTables];
 
@@ -617,12 +627,14 @@ createTables(int numTables, int objectSize, int objectId = 0)
     for (int i = numTables-1; i >= 0;  i--) {
         char tableName[20];
         snprintf(tableName, sizeof(tableName), "table%d", i);
-        cluster->createTable(tableName);
+        cluster->createTable(tableName, span);
         tableIds[i] = cluster->openTable(tableName);
-        Buffer data;
-        fillBuffer(data, objectSize, tableIds[i], objectId);
-        cluster->write(tableIds[i], objectId, data.getRange(0, objectSize),
-                objectSize);
+        for (int id = objectId; id < objectId + span; id++) {
+            Buffer data;
+            fillBuffer(data, objectSize, tableIds[i], id);
+            cluster->write(tableIds[i], id, data.getRange(0, objectSize),
+                    objectSize);
+        }
     }
     return tableIds;
 }
@@ -773,6 +785,67 @@ average(std::vector<double>& data)
     return result / length;
 }
 
+/**
+ * Generates numbers in [0, n) drawn from a Zipfian distribution, so that
+ * a few small numbers are very popular and the rest form a long tail. This
+ * is the method of Gray et al., "Quickly Generating Billion-Record
+ * Synthetic Databases" (SIGMOD 1994), which YCSB also uses: the expensive
+ * zeta constant is computed once up front and each number is then drawn in
+ * constant time.
+ */
+class ZipfianGenerator {
+  public:
+    /**
+     * \param n
+     *      Numbers are drawn from the range [0, n).
+     * \param theta
+     *      Skew of the distribution; 0 is uniform and values approaching 1
+     *      are ever more skewed. YCSB uses 0.99.
+     */
+    explicit ZipfianGenerator(uint64_t n, double theta = 0.99)
+        : n(n)
+        , theta(theta)
+        , alpha(1 / (1 - theta))
+        , zetan(zeta(n, theta))
+        , eta((1 - pow(2.0 / static_cast<double>(n), 1 - theta)) /
+              (1 - zeta(2, theta) / zetan))
+    {
+    }
+
+    /// Return the next number; 0 is the most popular, then 1, and so on.
+    uint64_t
+    nextNumber()
+    {
+        double u = static_cast<double>(generateRandom()) /
+                   static_cast<double>(~0UL);
+        double uz = u * zetan;
+        if (uz < 1)
+            return 0;
+        if (uz < 1 + pow(0.5, theta))
+            return 1;
+        uint64_t result = static_cast<uint64_t>(static_cast<double>(n) *
+                                                pow(eta * u - eta + 1, alpha));
+        return (result < n) ? result : n - 1;
+    }
+
+  private:
+    /// Return the sum of 1 / i^theta for i from 1 through n.
+    static double
+    zeta(uint64_t n, double theta)
+    {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++)
+            sum += 1 / pow(static_cast<double>(i), theta);
+        return sum;
+    }
+
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+};
+
 //----------------------------------------------------------------------
 // Test functions start here
 //----------------------------------------------------------------------
@@ -886,6 +959,311 @@ broadcast()
     printTime("broadcast", Cycles::toSeconds(totalTime)/count, description);
 }
 
+// Measure how quickly a single client can load objects into the cluster
+// with multiWrite, as a function of the number of objects sent in each
+// RPC. Individual writes are measured too, for comparison.
+void
+bulkLoad()
+{
+    if (clientIndex != 0)
+        return;
+    int size = objectSize;
+    if (size < 0)
+        size = 100;
+    const int numObjects = 20000;
+    const int batchSizes[] = {1, 2, 5, 10, 20, 50, 100, 200, 500};
+    const int numBatchSizes = sizeof(batchSizes) / sizeof(batchSizes[0]);
+    const int maxBatchSize = batchSizes[numBatchSizes - 1];
+    char name[50], description[50];
+
+    char value[size];
+    memset(value, 'x', size);
+
+    // Each run writes fresh objects, so that no run pays for the tombstones
+    // of another.
+    uint64_t nextId = 0;
+
+    uint64_t start = Cycles::rdtsc();
+    for (int i = 0; i < numObjects; i++)
+        cluster->write(dataTable, nextId++, value, size);
+    double seconds = Cycles::toSeconds(Cycles::rdtsc() - start);
+    printRate("bulkLoad.write", numObjects/seconds,
+              "objects/sec with write");
+
+    MasterClient::WriteObject objects[maxBatchSize];
+    MasterClient::WriteObject* requests[maxBatchSize];
+    for (int b = 0; b < numBatchSizes; b++) {
+        int batchSize = batchSizes[b];
+        start = Cycles::rdtsc();
+        for (int done = 0; done < numObjects; done += batchSize) {
+            for (int i = 0; i < batchSize; i++) {
+                objects[i] = MasterClient::WriteObject(dataTable, nextId++,
+                                                       value, size);
+                requests[i] = &objects[i];
+            }
+            cluster->multiWrite(requests, batchSize);
+            for (int i = 0; i < batchSize; i++) {
+                if (objects[i].status != STATUS_OK) {
+                    throw Exception(HERE, format(
+                        "multiWrite of object %lu failed: %s",
+                        objects[i].id, statusToString(objects[i].status)));
+                }
+            }
+        }
+        seconds = Cycles::toSeconds(Cycles::rdtsc() - start);
+        snprintf(name, sizeof(name), "bulkLoad.multi%d", batchSize);
+        snprintf(description, sizeof(description),
+                 "objects/sec, %d per multiWrite", batchSize);
+        printRate(name, numObjects/seconds, description);
+    }
+}
+
+/**
+ * This method contains the core of the "cacheZipfian" test; it is shared
+ * by the master and slaves and measures a single client using RAMCloud as
+ * a look-aside cache: each key is read, and on a miss the client fetches
+ * it from "the database" (free here) and writes it into the cache.
+ *
+ * \param generator
+ *      Chooses which objects in #dataTable to read.
+ * \param size
+ *      Number of bytes in each object written on a miss.
+ * \param ms
+ *      How long to run for, in milliseconds.
+ * \param docString
+ *      Information provided by the master about this run; used
+ *      in log messages.
+ */
+void
+cacheZipfianCommon(ZipfianGenerator& generator, int size, double ms,
+                   const char *docString)
+{
+    uint64_t startTime = Cycles::rdtsc();
+    uint64_t endTime = startTime + Cycles::fromSeconds(ms/1e03);
+    uint64_t stop;
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+    uint64_t fillTicks = 0;
+    uint64_t maxFillTicks = 0;
+    char* value = new char[size];
+    memset(value, 'x', size);
+
+    while (true) {
+        uint64_t id = generator.nextNumber();
+        Buffer buffer;
+        try {
+            cluster->read(dataTable, id, &buffer);
+            hits++;
+        } catch (ObjectDoesntExistException& e) {
+            uint64_t start = Cycles::rdtsc();
+            cluster->write(dataTable, id, value, size);
+            uint64_t ticks = Cycles::rdtsc() - start;
+            fillTicks += ticks;
+            if (ticks > maxFillTicks)
+                maxFillTicks = ticks;
+        }
+        lookups++;
+        stop = Cycles::rdtsc();
+        if (stop > endTime)
+            break;
+    }
+    delete[] value;
+    double thruput = static_cast<double>(lookups) /
+                     Cycles::toSeconds(stop - startTime);
+    sendMetrics(thruput, static_cast<double>(lookups),
+                static_cast<double>(hits), Cycles::toSeconds(fillTicks),
+                Cycles::toSeconds(maxFillTicks));
+    if (clientIndex != 0) {
+        RAMCLOUD_LOG(NOTICE, "%s: throughput: %.1f lookups/sec, "
+                "hit rate %.1f%%", docString, thruput,
+                100.0 * static_cast<double>(hits) /
+                static_cast<double>(lookups));
+    }
+}
+
+// This benchmark runs a master as a bounded-memory cache (clusterperf.py
+// starts it with --cacheMode and far less memory than the key space
+// needs) under a skewed, YCSB-like workload. It shows the hit rate the
+// master's CLOCK eviction achieves, and whether throughput and the latency
+// of filling misses hold up once the cache is full and every fill forces
+// an eviction.
+void
+cacheZipfian()
+{
+    const uint64_t numObjects = 10000000;
+    int size = objectSize;
+    if (size < 0)
+        size = 1000;
+    ZipfianGenerator generator(numObjects);
+
+    if (clientIndex > 0) {
+        // This is a slave: execute commands coming from the master.
+        while (true) {
+            char command[20];
+            char doc[200];
+            getCommand(command, sizeof(command));
+            if (strcmp(command, "run") == 0) {
+                readObject(controlTable, objectId(0, DOC), doc, sizeof(doc));
+                setSlaveState("running");
+                cacheZipfianCommon(generator, size, 1000, doc);
+                setSlaveState("idle");
+            } else if (strcmp(command, "done") == 0) {
+                setSlaveState("done");
+                return;
+            } else {
+                RAMCLOUD_LOG(ERROR, "unknown command %s", command);
+                return;
+            }
+        }
+    }
+
+    // This is the master: warm the cache up (and fill it, if it's small
+    // enough) before measuring anything.
+    cacheZipfianCommon(generator, size, 10000, "warmup");
+
+    // Vary the number of clients and repeat the test for each number.
+    printf("# RAMCloud used as a look-aside cache by 1 or more clients\n");
+    printf("# reading Zipfian-chosen (theta 0.99) %d-byte objects from a set\n"
+            "# of %lu, writing each one that misses into the cache.\n",
+            size, numObjects);
+    printf("# Generated by 'clusterperf.py cacheZipfian'\n");
+    printf("#\n");
+    printf("# numClients  throughput     hit rate  avg fill   max fill\n");
+    printf("#             (klookups/sec) (%%)       (us)       (us)\n");
+    printf("#----------------------------------------------------------\n");
+    fflush(stdout);
+    for (int numActive = 1; numActive <= numClients; numActive++) {
+        char doc[100];
+        snprintf(doc, sizeof(doc), "%d active clients", numActive);
+        cluster->write(controlTable, objectId(0, DOC), doc);
+        sendCommand("run", "running", 1, numActive-1);
+        cacheZipfianCommon(generator, size, 1000, doc);
+        sendCommand(NULL, "idle", 1, numActive-1);
+        ClientMetrics metrics;
+        getMetrics(metrics, numActive);
+        double lookups = sum(metrics[1]);
+        double hits = sum(metrics[2]);
+        double fills = lookups - hits;
+        printf("%3d           %8.1f       %6.2f    %8.1f   %8.1f\n",
+                numActive, sum(metrics[0])/1e03, 100.0 * hits / lookups,
+                (fills > 0) ? 1e06 * sum(metrics[3]) / fills : 0.0,
+                1e06 * max(metrics[4]));
+        fflush(stdout);
+    }
+    sendCommand("done", "done", 1, numClients-1);
+}
+
+// Migrate a loaded tablet from one master to another while reading from
+// it, to measure how long migration takes and how much it disturbs reads.
+// Needs at least two masters.
+void
+migrateTablet()
+{
+    if (clientIndex != 0)
+        return;
+    int size = objectSize;
+    if (size < 0)
+        size = 100;
+    const int numObjects = 100000;
+    const int batchSize = 100;
+
+    cluster->createTable("migrate");
+    uint32_t tableId = cluster->openTable("migrate");
+    char value[size];
+    memset(value, 'x', size);
+    MasterClient::WriteObject objects[batchSize];
+    MasterClient::WriteObject* requests[batchSize];
+    for (int done = 0; done < numObjects; done += batchSize) {
+        for (int i = 0; i < batchSize; i++) {
+            objects[i] = MasterClient::WriteObject(tableId, done + i,
+                                                   value, size);
+            requests[i] = &objects[i];
+        }
+        cluster->multiWrite(requests, batchSize);
+    }
+
+    // Find the tablet's owner and some other master to move it to.
+    ProtoBuf::Tablets tabletMap;
+    cluster->coordinator.getTabletMap(tabletMap);
+    const ProtoBuf::Tablets::Tablet* tablet = NULL;
+    foreach (const ProtoBuf::Tablets::Tablet& t, tabletMap.tablet()) {
+        if (t.table_id() == tableId)
+            tablet = &t;
+    }
+    ProtoBuf::ServerList masters;
+    cluster->coordinator.getMasterList(masters);
+    const ProtoBuf::ServerList::Entry* newOwner = NULL;
+    foreach (const ProtoBuf::ServerList::Entry& m, masters.server()) {
+        if (m.server_id() != tablet->server_id())
+            newOwner = &m;
+    }
+    if (newOwner == NULL) {
+        printf("migrateTablet needs at least 2 masters\n");
+        return;
+    }
+    ServerMetrics before = cluster->getMetrics(
+        tablet->service_locator().c_str());
+
+    Buffer result;
+    uint64_t readsBefore = 0;
+    uint64_t start = Cycles::rdtsc();
+    while (Cycles::toSeconds(Cycles::rdtsc() - start) < 0.5) {
+        cluster->read(tableId, generateRandom() % numObjects, &result);
+        readsBefore++;
+    }
+    double readBefore = Cycles::toSeconds(Cycles::rdtsc() - start) /
+                        static_cast<double>(readsBefore);
+
+    // Keep reading until the migration finishes. Once the tablet has moved,
+    // reads fail until the client notices and refreshes its tablet map.
+    MasterClient source(Context::get().transportManager->getSession(
+        tablet->service_locator().c_str()));
+    uint64_t readsDuring = 0;
+    uint64_t maxReadTicks = 0;
+    start = Cycles::rdtsc();
+    MasterClient::MigrateTablet migrate(source, tableId,
+                                        tablet->start_object_id(),
+                                        tablet->end_object_id(),
+                                        ServerId(newOwner->server_id()));
+    uint64_t readStart = Cycles::rdtsc();
+    while (!migrate.isReady()) {
+        try {
+            cluster->read(tableId, generateRandom() % numObjects, &result);
+        } catch (TableDoesntExistException& e) {
+            cluster->objectFinder.flush();
+            continue;
+        }
+        uint64_t now = Cycles::rdtsc();
+        maxReadTicks = std::max(maxReadTicks, now - readStart);
+        readStart = now;
+        readsDuring++;
+    }
+    migrate();
+    double seconds = Cycles::toSeconds(Cycles::rdtsc() - start);
+    cluster->objectFinder.flush();
+
+    ServerMetrics after = cluster->getMetrics(
+        tablet->service_locator().c_str());
+    ServerMetrics delta = after.difference(before);
+    double pause = static_cast<double>(delta["master.migrationPauseTicks"]) /
+                   static_cast<double>(after["clockFrequency"]);
+
+    printTime("migrateTablet.time", seconds, "migrate tablet");
+    printBandwidth("migrateTablet.bandwidth",
+                   static_cast<double>(delta["master.migrationBytes"]) /
+                   seconds, "migration throughput");
+    printTime("migrateTablet.readBefore", readBefore,
+              "read before migration");
+    if (readsDuring > 0) {
+        printTime("migrateTablet.readDuring",
+                  seconds / static_cast<double>(readsDuring),
+                  "read during migration");
+    }
+    printTime("migrateTablet.readMax", Cycles::toSeconds(maxReadTicks),
+              "slowest read during migration");
+    printTime("migrateTablet.pause", pause, "updates blocked on source");
+}
+
 // This benchmark measures overall network bandwidth using many clients, each
 // reading repeatedly a single large object on a different server.  The goal
 // is to stress the internal network switching fabric without overloading any
@@ -972,22 +1350,24 @@ readAllToAll()
             try {
                 int tableId = cluster->openTable(tableName.c_str());
 
-                Buffer result;
-                uint64_t startCycles = Cycles::rdtsc();
-                RamCloud::Read read(*cluster, tableId, 0, &result);
-                while (!read.isReady()) {
-                    Context::get().dispatch->poll();
-                    double secsWaiting =
-                        Cycles::toSeconds(Cycles::rdtsc() - startCycles);
-                    if (secsWaiting > 1.0) {
-                        RAMCLOUD_LOG(ERROR,
-                                    "Client %d couldn't read from table %s",
-                                    clientIndex, tableName.c_str());
-                        read.cancel();
-                        continue;
+                for (int id = 0; id < serverSpan; id++) {
+                    Buffer result;
+                    uint64_t startCycles = Cycles::rdtsc();
+                    RamCloud::Read read(*cluster, tableId, id, &result);
+                    while (!read.isReady()) {
+                        Context::get().dispatch->poll();
+                        double secsWaiting =
+                            Cycles::toSeconds(Cycles::rdtsc() - startCycles);
+                        if (secsWaiting > 1.0) {
+                            RAMCLOUD_LOG(ERROR,
+                                        "Client %d couldn't read from table "
+                                        "%s", clientIndex, tableName.c_str());
+                            read.cancel();
+                            continue;
+                        }
                     }
+                    read();
                 }
-                read();
             } catch (ClientException& e) {
                 RAMCLOUD_LOG(ERROR,
                     "Client %d got exception reading from table %s: %s",
@@ -1005,24 +1385,26 @@ readAllToAll()
     int size = objectSize;
     if (size < 0)
         size = 100;
-    int* tableIds = createTables(numTables, size);
+    int* tableIds = createTables(numTables, size, 0, serverSpan);
 
     std::cout << "Master client reading from all masters" << std::endl;
     for (int i = 0; i < numTables; ++i) {
         int tableId = tableIds[i];
-        Buffer result;
-        uint64_t startCycles = Cycles::rdtsc();
-        RamCloud::Read read(*cluster, tableId, 0, &result);
-        while (!read.isReady()) {
-            Context::get().dispatch->poll();
-            if (Cycles::toSeconds(Cycles::rdtsc() - startCycles) > 1.0) {
-                RAMCLOUD_LOG(ERROR,
-                            "Master client %d couldn't read from tableId %d",
-                            clientIndex, tableId);
-                return;
+        for (int id = 0; id < serverSpan; id++) {
+            Buffer result;
+            uint64_t startCycles = Cycles::rdtsc();
+            RamCloud::Read read(*cluster, tableId, id, &result);
+            while (!read.isReady()) {
+                Context::get().dispatch->poll();
+                if (Cycles::toSeconds(Cycles::rdtsc() - startCycles) > 1.0) {
+                    RAMCLOUD_LOG(ERROR,
+                                "Master client %d couldn't read from tableId "
+                                "%d", clientIndex, tableId);
+                    return;
+                }
             }
+            read();
         }
-        read();
     }
 
     for (int slaveIndex = 1; slaveIndex < numClients; ++slaveIndex) {
@@ -1280,6 +1662,208 @@ readRandom()
     sendCommand("done", "done", 1, numClients-1);
 }
 
+/**
+ * This method contains the core of the "readThroughput" test; it is
+ * shared by the master and slaves.
+ *
+ * \param numObjects
+ *      The test reads objects with identifiers 0 through numObjects-1
+ *      in #dataTable, chosen at random.
+ * \param docString
+ *      Information provided by the master about this run; used
+ *      in log messages.
+ */
+void readThroughputCommon(int numObjects, char *docString)
+{
+    // Duration of test.
+    double ms = 100;
+    uint64_t startTime = Cycles::rdtsc();
+    uint64_t endTime = startTime + Cycles::fromSeconds(ms/1e03);
+    uint64_t readEnd;
+    int count = 0;
+
+    while (true) {
+        uint64_t id = generateRandom() % numObjects;
+        Buffer value;
+        cluster->read(dataTable, id, &value);
+        count++;
+        readEnd = Cycles::rdtsc();
+        if (readEnd > endTime)
+            break;
+    }
+    double thruput = count/Cycles::toSeconds(readEnd - startTime);
+    sendMetrics(thruput);
+    if (clientIndex != 0) {
+        RAMCLOUD_LOG(NOTICE, "%s: throughput: %.1f reads/sec.", docString,
+                thruput);
+    }
+}
+
+// This benchmark measures the aggregate throughput of a single master
+// as the number of clients reading random objects from it increases.
+// The master's worker thread count is set by clusterperf.py, which runs
+// this test once for each thread count to show how read throughput scales
+// with the number of workers.
+void
+readThroughput()
+{
+    const int numObjects = 1000;
+
+    if (clientIndex > 0) {
+        // This is a slave: execute commands coming from the master.
+        while (true) {
+            char command[20];
+            char doc[200];
+            getCommand(command, sizeof(command));
+            if (strcmp(command, "run") == 0) {
+                readObject(controlTable, objectId(0, DOC), doc, sizeof(doc));
+                setSlaveState("running");
+                readThroughputCommon(numObjects, doc);
+                setSlaveState("idle");
+            } else if (strcmp(command, "done") == 0) {
+                setSlaveState("done");
+                return;
+            } else {
+                RAMCLOUD_LOG(ERROR, "unknown command %s", command);
+                return;
+            }
+        }
+    }
+
+    // This is the master: first, fill in the objects.
+    int size = objectSize;
+    if (size < 0)
+        size = 100;
+    for (int i = 0; i < numObjects; i++) {
+        Buffer data;
+        fillBuffer(data, size, dataTable, i);
+        cluster->write(dataTable, i, data.getRange(0, size), size);
+    }
+
+    // Vary the number of clients and repeat the test for each number.
+    printf("# RAMCloud read throughput of a single master when 1 or more\n");
+    printf("# clients read randomly-chosen %d-byte objects from a set of %d.\n",
+            size, numObjects);
+    printf("# Generated by 'clusterperf.py readThroughput'\n");
+    printf("#\n");
+    printf("# numClients  throughput(total kreads/sec)\n");
+    printf("#------------------------------------------\n");
+    fflush(stdout);
+    for (int numActive = 1; numActive <= numClients; numActive++) {
+        char doc[100];
+        snprintf(doc, sizeof(doc), "%d active clients", numActive);
+        cluster->write(controlTable, objectId(0, DOC), doc);
+        sendCommand("run", "running", 1, numActive-1);
+        readThroughputCommon(numObjects, doc);
+        sendCommand(NULL, "idle", 1, numActive-1);
+        ClientMetrics metrics;
+        getMetrics(metrics, numActive);
+        printf("%3d               %6.0f\n", numActive, sum(metrics[0])/1e03);
+        fflush(stdout);
+    }
+    sendCommand("done", "done", 1, numClients-1);
+}
+
+/**
+ * This method contains the core of the "writeThroughput" test; it is
+ * shared by the master and slaves and measures write throughput for a
+ * single client.
+ *
+ * \param numObjects
+ *      The test overwrites objects with identifiers 0 through numObjects-1
+ *      in #dataTable, chosen at random.
+ * \param size
+ *      Number of bytes in each object written.
+ * \param docString
+ *      Information provided by the master about this run; used
+ *      in log messages.
+ */
+void writeThroughputCommon(int numObjects, int size, char *docString)
+{
+    // Duration of test.
+    double ms = 100;
+    uint64_t startTime = Cycles::rdtsc();
+    uint64_t endTime = startTime + Cycles::fromSeconds(ms/1e03);
+    uint64_t writeEnd;
+    int count = 0;
+    char* value = new char[size];
+    memset(value, 'x', size);
+
+    while (true) {
+        uint64_t id = generateRandom() % numObjects;
+        cluster->write(dataTable, id, value, size);
+        count++;
+        writeEnd = Cycles::rdtsc();
+        if (writeEnd > endTime)
+            break;
+    }
+    delete[] value;
+    double thruput = count/Cycles::toSeconds(writeEnd - startTime);
+    sendMetrics(thruput);
+    if (clientIndex != 0) {
+        RAMCLOUD_LOG(NOTICE, "%s: throughput: %.1f writes/sec.", docString,
+                thruput);
+    }
+}
+
+// This benchmark measures the aggregate throughput of a single master
+// as the number of clients overwriting random objects on it increases.
+// Every write is durable, so this shows how well concurrent writes share
+// rounds of replication to backups; clusterperf.py runs it once for each
+// of several master worker thread counts.
+void
+writeThroughput()
+{
+    const int numObjects = 1000;
+    int size = objectSize;
+    if (size < 0)
+        size = 100;
+
+    if (clientIndex > 0) {
+        // This is a slave: execute commands coming from the master.
+        while (true) {
+            char command[20];
+            char doc[200];
+            getCommand(command, sizeof(command));
+            if (strcmp(command, "run") == 0) {
+                readObject(controlTable, objectId(0, DOC), doc, sizeof(doc));
+                setSlaveState("running");
+                writeThroughputCommon(numObjects, size, doc);
+                setSlaveState("idle");
+            } else if (strcmp(command, "done") == 0) {
+                setSlaveState("done");
+                return;
+            } else {
+                RAMCLOUD_LOG(ERROR, "unknown command %s", command);
+                return;
+            }
+        }
+    }
+
+    // Vary the number of clients and repeat the test for each number.
+    printf("# RAMCloud write throughput of a single master when 1 or more\n");
+    printf("# clients overwrite randomly-chosen %d-byte objects from a set "
+            "of %d.\n", size, numObjects);
+    printf("# Generated by 'clusterperf.py writeThroughput'\n");
+    printf("#\n");
+    printf("# numClients  throughput(total kwrites/sec)\n");
+    printf("#-------------------------------------------\n");
+    fflush(stdout);
+    for (int numActive = 1; numActive <= numClients; numActive++) {
+        char doc[100];
+        snprintf(doc, sizeof(doc), "%d active clients", numActive);
+        cluster->write(controlTable, objectId(0, DOC), doc);
+        sendCommand("run", "running", 1, numActive-1);
+        writeThroughputCommon(numObjects, size, doc);
+        sendCommand(NULL, "idle", 1, numActive-1);
+        ClientMetrics metrics;
+        getMetrics(metrics, numActive);
+        printf("%3d               %6.1f\n", numActive, sum(metrics[0])/1e03);
+        fflush(stdout);
+    }
+    sendCommand("done", "done", 1, numClients-1);
+}
+
 // This benchmark measures the latency and server throughput for write
 // when some data is written asynchronously and then some smaller value
 // is written synchronously.
@@ -1348,12 +1932,17 @@ struct TestInfo {
 TestInfo tests[] = {
     {"basic", basic},
     {"broadcast", broadcast},
+    {"bulkLoad", bulkLoad},
+    {"cacheZipfian", cacheZipfian},
+    {"migrateTablet", migrateTablet},
     {"netBandwidth", netBandwidth},
     {"readAllToAll", readAllToAll},
     {"readLoaded", readLoaded},
     {"readNotFound", readNotFound},
     {"readRandom", readRandom},
+    {"readThroughput", readThroughput},
     {"writeAsyncSync", writeAsyncSync},
+    {"writeThroughput", writeThroughput},
 };
 
 int
@@ -1391,6 +1980,9 @@ try
                 "Size of objects (in bytes) to use for test")
         ("numTables", po::value<int>(&numTables)->default_value(10),
                 "Number of tables to use for test")
+        ("serverSpan", po::value<int>(&serverSpan)->default_value(1),
+                "Number of masters to split each table across (used by "
+                "readAllToAll)")
         ("testName", po::value<vector<string>>(&testNames),
                 "Name(s) of test(s) to run");
     po::positional_options_description desc2;
@@ -173,6 +173,54 @@ pinToCpu(uint32_t cpu)
     return true;
 }
 
+/**
+ * Pin the calling thread, and any threads it creates afterwards, to the CPUs
+ * of a particular NUMA node, as listed in
+ * /sys/devices/system/node/node<N>/cpulist.
+ * \param node
+ *      The number of the NUMA node on which to execute, starting from 0.
+ * \return
+ *      Whether the operation succeeded.
+ */
+bool
+pinToNumaNode(uint32_t node)
+{
+    string path = format("/sys/devices/system/node/node%u/cpulist", node);
+    FILE* fp = fopen(path.c_str(), "r");
+    if (fp == NULL) {
+        LOG(ERROR, "server: Couldn't read CPUs of NUMA node %u: %s",
+            node, strerror(errno));
+        return false;
+    }
+
+    // The list looks like "0-7,16-23".
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    uint32_t first, last;
+    int n;
+    while ((n = fscanf(fp, "%u-%u", &first, &last)) > 0) {
+        if (n == 1)
+            last = first;
+        for (uint32_t cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &cpus);
+        if (fgetc(fp) != ',')
+            break;
+    }
+    fclose(fp);
+
+    if (CPU_COUNT(&cpus) == 0) {
+        LOG(ERROR, "server: NUMA node %u has no CPUs", node);
+        return false;
+    }
+    int r = sched_setaffinity(0, sizeof(cpus), &cpus);
+    if (r < 0) {
+        LOG(ERROR, "server: Couldn't pin to NUMA node %u: %s",
+            node, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
 /**
  * Obtain the total amount of system memory in bytes as reported by
  * /proc/meminfo on Linux.
@@ -176,6 +176,7 @@ void debug_dump64(const void *buf, uint64_t bytes);
 class Buffer;
 void debug_dump64(Buffer& buffer);
 bool pinToCpu(uint32_t cpu);
+bool pinToNumaNode(uint32_t node);
 uint64_t getTotalSystemMemory();
 
 // conveniences for dealing with maps
@@ -24,16 +24,23 @@ namespace RAMCloud {
  *
  * \param name
  *      Name for the new table (NULL-terminated string).
+ * \param serverSpan
+ *      The number of masters to spread the table across. The table's tablet
+ *      key space (see Object::tabletKey) is split evenly into this many
+ *      tablets, each placed on a different master, so that objects are
+ *      spread evenly whatever ids they have. If there are fewer masters
+ *      than this, the table spans all of them.
  *
  * \exception InternalError
  */
 void
-CoordinatorClient::createTable(const char* name)
+CoordinatorClient::createTable(const char* name, uint32_t serverSpan)
 {
     Buffer req;
     uint32_t length = downCast<uint32_t>(strlen(name) + 1);
     CreateTableRpc::Request& reqHdr(allocHeader<CreateTableRpc>(req));
     reqHdr.nameLength = length;
+    reqHdr.serverSpan = serverSpan;
     memcpy(new(&req, APPEND) char[length], name, length);
     while (true) {
         Buffer resp;
@@ -115,6 +122,14 @@ CoordinatorClient::openTable(const char* name)
  * \param writeSpeed
  *      Write speed of the backup in MB/s if serviceMask includes BACKUP,
  *      otherwise ignored.
+ * \param replacesId
+ *      The id this server ran under before a planned restart, or an invalid
+ *      id for a fresh server. The coordinator removes the old id from the
+ *      cluster as part of enlisting.
+ * \param takeOverTablets
+ *      If true the master has found replacesId's log on its local backup
+ *      and will replay it itself, so the coordinator hands the old id's
+ *      tablets to the new one instead of starting crash recovery.
  * \return
  *      A ServerId guaranteed never to have been used before.
  */
@@ -122,7 +137,9 @@ ServerId
 CoordinatorClient::enlistServer(ServiceMask serviceMask,
                                 string localServiceLocator,
                                 uint32_t readSpeed,
-                                uint32_t writeSpeed)
+                                uint32_t writeSpeed,
+                                ServerId replacesId,
+                                bool takeOverTablets)
 {
     while (true) {
         try {
@@ -133,6 +150,8 @@ CoordinatorClient::enlistServer(ServiceMask serviceMask,
             reqHdr.serviceMask = serviceMask.serialize();
             reqHdr.readSpeed = readSpeed;
             reqHdr.writeSpeed = writeSpeed;
+            reqHdr.replacesId = replacesId.isValid() ? replacesId.getId() : 0;
+            reqHdr.takeOverTablets = takeOverTablets;
             reqHdr.serviceLocatorLength =
                 downCast<uint32_t>(localServiceLocator.length() + 1);
             strncpy(new(&req, APPEND) char[reqHdr.serviceLocatorLength],
@@ -284,20 +303,101 @@ CoordinatorClient::quiesce()
  * \param[in] will
  *      The serialized ProtoBuf representation of the post-recovery
  *      Will to send to the Coordinator.
+ * \param[in] status
+ *      STATUS_OK if the tablets were recovered. Anything else means the
+ *      caller gave up on them; see MasterService::abortRestart().
  */
 void
 CoordinatorClient::tabletsRecovered(uint64_t masterId,
-    const ProtoBuf::Tablets& tablets, const ProtoBuf::Tablets& will)
+    const ProtoBuf::Tablets& tablets, const ProtoBuf::Tablets& will,
+    Status status)
 {
     Buffer req, resp;
     TabletsRecoveredRpc::Request& reqHdr(allocHeader<TabletsRecoveredRpc>(req));
     reqHdr.masterId = masterId;
+    reqHdr.status = status;
     reqHdr.tabletsLength = serializeToRequest(req, tablets);
     reqHdr.willLength = serializeToRequest(req, will);
     sendRecv<TabletsRecoveredRpc>(session, req, resp);
     checkStatus(HERE);
 }
 
+/**
+ * Make another master the owner of a tablet in the coordinator's tablet
+ * map. The current owner calls this at the end of a tablet migration, once
+ * the new owner holds all of the tablet's data; the tablet is also moved
+ * from the old owner's will to the new owner's.
+ *
+ * \param tableId
+ *      The table containing the tablet.
+ * \param firstId
+ *      Identifier of the first object in the tablet.
+ * \param lastId
+ *      Identifier of the last object in the tablet.
+ * \param newOwnerMasterId
+ *      The master taking over the tablet.
+ */
+void
+CoordinatorClient::reassignTabletOwnership(uint32_t tableId, uint64_t firstId,
+                                           uint64_t lastId,
+                                           ServerId newOwnerMasterId)
+{
+    Buffer req, resp;
+    ReassignTabletOwnershipRpc::Request& reqHdr(
+        allocHeader<ReassignTabletOwnershipRpc>(req));
+    reqHdr.tableId = tableId;
+    reqHdr.firstId = firstId;
+    reqHdr.lastId = lastId;
+    reqHdr.newOwnerMasterId = newOwnerMasterId.getId();
+    sendRecv<ReassignTabletOwnershipRpc>(session, req, resp);
+    checkStatus(HERE);
+}
+
+/**
+ * Settle the outcome of a transaction spanning several masters, unless
+ * it has been settled already; see CoordinatorService::setTransactionOutcome.
+ *
+ * \param transactionId
+ *      The transaction, as named in PREPARE_TRANSACTION.
+ * \param commit
+ *      The outcome to record if none has been yet: true to commit, false
+ *      to abort.
+ * \return
+ *      True if the transaction commits, false if it aborts. Only the first
+ *      outcome recorded counts, so this may differ from \a commit.
+ */
+bool
+CoordinatorClient::setTransactionOutcome(uint64_t transactionId, bool commit)
+{
+    Buffer req, resp;
+    SetTransactionOutcomeRpc::Request& reqHdr(
+        allocHeader<SetTransactionOutcomeRpc>(req));
+    reqHdr.transactionId = transactionId;
+    reqHdr.commit = commit;
+    const SetTransactionOutcomeRpc::Response& respHdr(
+        sendRecv<SetTransactionOutcomeRpc>(session, req, resp));
+    checkStatus(HERE);
+    return respHdr.commit;
+}
+
+/**
+ * Tell the coordinator it no longer needs to remember the outcome of a
+ * transaction, because every master in it has applied that outcome.
+ *
+ * \param transactionId
+ *      The transaction, as named in PREPARE_TRANSACTION.
+ */
+void
+CoordinatorClient::forgetTransactionOutcome(uint64_t transactionId)
+{
+    Buffer req, resp;
+    ForgetTransactionOutcomeRpc::Request& reqHdr(
+        allocHeader<ForgetTransactionOutcomeRpc>(req));
+    reqHdr.transactionId = transactionId;
+    sendRecv<ForgetTransactionOutcomeRpc>(session, req, resp);
+    checkStatus(HERE);
+}
+
 /**
  * Update a masterId's Will with the Coordinator.
  *
@@ -317,6 +417,35 @@ CoordinatorClient::setWill(uint64_t masterId, const ProtoBuf::Tablets& will)
     checkStatus(HERE);
 }
 
+/**
+ * Split a tablet in two in the coordinator's tablet map. Its owner calls
+ * this once the tablet has grown too large; both halves stay with the same
+ * master, which splits its own copy of the tablet afterwards.
+ *
+ * \param tableId
+ *      The table containing the tablet.
+ * \param firstId
+ *      Identifier of the first object in the tablet.
+ * \param lastId
+ *      Identifier of the last object in the tablet.
+ * \param splitId
+ *      Identifier of the first object in the upper half. Must be in
+ *      (firstId, lastId].
+ */
+void
+CoordinatorClient::splitTablet(uint32_t tableId, uint64_t firstId,
+                               uint64_t lastId, uint64_t splitId)
+{
+    Buffer req, resp;
+    SplitTabletRpc::Request& reqHdr(allocHeader<SplitTabletRpc>(req));
+    reqHdr.tableId = tableId;
+    reqHdr.firstId = firstId;
+    reqHdr.lastId = lastId;
+    reqHdr.splitId = splitId;
+    sendRecv<SplitTabletRpc>(session, req, resp);
+    checkStatus(HERE);
+}
+
 /**
  * Request that the coordinator send a complete server list to the
  * given server.
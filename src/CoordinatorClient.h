@@ -39,24 +39,33 @@ class CoordinatorClient : public Client {
     {
     }
 
-    void createTable(const char* name);
+    void createTable(const char* name, uint32_t serverSpan = 1);
     void dropTable(const char* name);
     uint32_t openTable(const char* name);
 
     ServerId enlistServer(ServiceMask serviceMask,
                           string localServiceLocator,
                           uint32_t readSpeed = 0,
-                          uint32_t writeSpeed = 0);
+                          uint32_t writeSpeed = 0,
+                          ServerId replacesId = ServerId(),
+                          bool takeOverTablets = false);
     void getServerList(ProtoBuf::ServerList& serverList);
     void getMasterList(ProtoBuf::ServerList& serverList);
     void getBackupList(ProtoBuf::ServerList& serverList);
     void getTabletMap(ProtoBuf::Tablets& tabletMap);
     void hintServerDown(ServerId serverId);
     void quiesce();
+    void reassignTabletOwnership(uint32_t tableId, uint64_t firstId,
+                                 uint64_t lastId, ServerId newOwnerMasterId);
     void tabletsRecovered(uint64_t masterId,
                           const ProtoBuf::Tablets& tablets,
-                          const ProtoBuf::Tablets& will);
+                          const ProtoBuf::Tablets& will,
+                          Status status = STATUS_OK);
     void setWill(uint64_t masterId, const ProtoBuf::Tablets& will);
+    bool setTransactionOutcome(uint64_t transactionId, bool commit);
+    void forgetTransactionOutcome(uint64_t transactionId);
+    void splitTablet(uint32_t tableId, uint64_t firstId, uint64_t lastId,
+                     uint64_t splitId);
     void requestServerList(ServerId destination);
 
   private:
@@ -33,6 +33,7 @@ CoordinatorService::CoordinatorService()
     , tables()
     , nextTableId(0)
     , nextTableMasterIdx(0)
+    , transactionOutcomes()
     , mockRecovery(NULL)
     , test_forceServerReallyDown(false)
 {
@@ -96,6 +97,22 @@ CoordinatorService::dispatch(RpcOpcode opcode,
             callHandler<SetWillRpc, CoordinatorService,
                         &CoordinatorService::setWill>(rpc);
             break;
+        case ReassignTabletOwnershipRpc::opcode:
+            callHandler<ReassignTabletOwnershipRpc, CoordinatorService,
+                        &CoordinatorService::reassignTabletOwnership>(rpc);
+            break;
+        case SplitTabletRpc::opcode:
+            callHandler<SplitTabletRpc, CoordinatorService,
+                        &CoordinatorService::splitTablet>(rpc);
+            break;
+        case SetTransactionOutcomeRpc::opcode:
+            callHandler<SetTransactionOutcomeRpc, CoordinatorService,
+                        &CoordinatorService::setTransactionOutcome>(rpc);
+            break;
+        case ForgetTransactionOutcomeRpc::opcode:
+            callHandler<ForgetTransactionOutcomeRpc, CoordinatorService,
+                        &CoordinatorService::forgetTransactionOutcome>(rpc);
+            break;
         case RequestServerListRpc::opcode:
             callHandler<RequestServerListRpc, CoordinatorService,
                         &CoordinatorService::requestServerList>(rpc);
@@ -126,54 +143,70 @@ CoordinatorService::createTable(const CreateTableRpc::Request& reqHdr,
     uint32_t tableId = nextTableId++;
     tables[name] = tableId;
 
-    // Find the next master in the list.
-    CoordinatorServerList::Entry* master = NULL;
-    while (true) {
-        size_t masterIdx = nextTableMasterIdx++ % serverList.size();
-        if (serverList[masterIdx] != NULL &&
-            serverList[masterIdx]->isMaster()) {
-            master = serverList[masterIdx];
-            break;
+    // Split the tablet key space into serverSpan equal tablets. Objects are
+    // placed by the hash of their ids (see Object::tabletKey), so even
+    // densely allocated ids spread evenly across them. Masters are
+    // assigned round-robin, so as long as there are at least as many
+    // masters as tablets each tablet lands on a different one.
+    uint32_t serverSpan = std::max(1U, std::min(reqHdr.serverSpan,
+                                                serverList.masterCount()));
+    uint64_t tabletRange = 1 + ~0UL / serverSpan;
+    for (uint32_t i = 0; i < serverSpan; i++) {
+        uint64_t startObjectId = i * tabletRange;
+        uint64_t endObjectId = (i == serverSpan - 1) ?
+                                    ~0UL : startObjectId + tabletRange - 1;
+
+        // Find the next master in the list.
+        CoordinatorServerList::Entry* master = NULL;
+        while (true) {
+            size_t masterIdx = nextTableMasterIdx++ % serverList.size();
+            if (serverList[masterIdx] != NULL &&
+                serverList[masterIdx]->isMaster()) {
+                master = serverList[masterIdx];
+                break;
+            }
         }
-    }
 
-    // Create tablet map entry.
-    ProtoBuf::Tablets_Tablet& tablet(*tabletMap.add_tablet());
-    tablet.set_table_id(tableId);
-    tablet.set_start_object_id(0);
-    tablet.set_end_object_id(~0UL);
-    tablet.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
-    tablet.set_server_id(master->serverId.getId());
-    tablet.set_service_locator(master->serviceLocator);
+        // Create tablet map entry.
+        ProtoBuf::Tablets_Tablet& tablet(*tabletMap.add_tablet());
+        tablet.set_table_id(tableId);
+        tablet.set_start_object_id(startObjectId);
+        tablet.set_end_object_id(endObjectId);
+        tablet.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
+        tablet.set_server_id(master->serverId.getId());
+        tablet.set_service_locator(master->serviceLocator);
+
+        // Create will entry. The tablet is empty, so it doesn't matter where
+        // it goes or in how many partitions, initially. It just has to go
+        // somewhere.
+        ProtoBuf::Tablets& will = *master->will;
+        ProtoBuf::Tablets_Tablet& willEntry(*will.add_tablet());
+        willEntry.set_table_id(tableId);
+        willEntry.set_start_object_id(startObjectId);
+        willEntry.set_end_object_id(endObjectId);
+        willEntry.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
+        uint64_t maxPartitionId;
+        if (will.tablet_size() > 1)
+            maxPartitionId = will.tablet(will.tablet_size() - 2).user_data();
+        else
+            maxPartitionId = -1;
+        willEntry.set_user_data(maxPartitionId + 1);
+
+        // Inform the master.
+        const char* locator = master->serviceLocator.c_str();
+        MasterClient masterClient(
+            Context::get().transportManager->getSession(locator));
+        ProtoBuf::Tablets masterTabletMap;
+        foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
+            if (tablet.server_id() == master->serverId.getId())
+                *masterTabletMap.add_tablet() = tablet;
+        }
+        masterClient.setTablets(masterTabletMap);
 
-    // Create will entry. The tablet is empty, so it doesn't matter where it
-    // goes or in how many partitions, initially. It just has to go somewhere.
-    ProtoBuf::Tablets& will = *master->will;
-    ProtoBuf::Tablets_Tablet& willEntry(*will.add_tablet());
-    willEntry.set_table_id(tableId);
-    willEntry.set_start_object_id(0);
-    willEntry.set_end_object_id(~0UL);
-    willEntry.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
-    uint64_t maxPartitionId;
-    if (will.tablet_size() > 1)
-        maxPartitionId = will.tablet(will.tablet_size() - 2).user_data();
-    else
-        maxPartitionId = -1;
-    willEntry.set_user_data(maxPartitionId + 1);
-
-    // Inform the master.
-    const char* locator = master->serviceLocator.c_str();
-    MasterClient masterClient(
-        Context::get().transportManager->getSession(locator));
-    ProtoBuf::Tablets masterTabletMap;
-    foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
-        if (tablet.server_id() == master->serverId.getId())
-            *masterTabletMap.add_tablet() = tablet;
+        LOG(NOTICE, "Created table '%s' with id %u tablet [%lu, %lu] on "
+                    "master %lu", name, tableId, startObjectId, endObjectId,
+                    master->serverId.getId());
     }
-    masterClient.setTablets(masterTabletMap);
-
-    LOG(NOTICE, "Created table '%s' with id %u on master %lu",
-                name, tableId, master->serverId.getId());
     LOG(DEBUG, "There are now %d tablets in the map", tabletMap.tablet_size());
 }
 
@@ -251,6 +284,7 @@ CoordinatorService::enlistServer(const EnlistServerRpc::Request& reqHdr,
     ServiceMask serviceMask = ServiceMask::deserialize(reqHdr.serviceMask);
     const uint32_t readSpeed = reqHdr.readSpeed;
     const uint32_t writeSpeed = reqHdr.writeSpeed;
+    const ServerId replacesId(reqHdr.replacesId);
     const char *serviceLocator = getString(rpc.requestPayload, sizeof(reqHdr),
                                            reqHdr.serviceLocatorLength);
 
@@ -276,12 +310,45 @@ CoordinatorService::enlistServer(const EnlistServerRpc::Request& reqHdr,
             newServerId.getId(), readSpeed, writeSpeed);
     }
 
+    // A server restarting in place supersedes the id it ran under before.
+    // If its master is about to replay the old log from its own disk it
+    // inherits the old id's tablets and will; otherwise the old id is
+    // crash recovered like any other failed server.
+    const bool replacesServer = replacesId.isValid() &&
+                                serverList.contains(replacesId);
+    const bool warmRestart = replacesServer && reqHdr.takeOverTablets &&
+                             entry.isMaster() &&
+                             serverList[replacesId].isMaster();
+    ProtoBuf::ServerList removalUpdate;
+    if (warmRestart) {
+        LOG(NOTICE, "Server id %lu restarted as %lu and is reloading its "
+            "tablets from local storage", replacesId.getId(),
+            newServerId.getId());
+        CoordinatorServerList::Entry oldEntry = serverList[replacesId];
+        serverList.remove(replacesId, removalUpdate);
+        delete entry.will;
+        entry.will = oldEntry.will;
+        foreach (ProtoBuf::Tablets::Tablet& tablet,
+                 *tabletMap.mutable_tablet()) {
+            if (tablet.server_id() == replacesId.getId()) {
+                tablet.set_state(ProtoBuf::Tablets_Tablet::RECOVERING);
+                tablet.set_user_data(0);
+                tablet.set_service_locator(serviceLocator);
+                tablet.set_server_id(newServerId.getId());
+            }
+        }
+    }
+
     respHdr.serverId = newServerId.getId();
     rpc.sendReply();
 
     if (entry.serviceMask.has(MEMBERSHIP_SERVICE))
         sendServerList(newServerId);
     sendMembershipUpdate(additionUpdate, newServerId);
+    if (warmRestart)
+        sendMembershipUpdate(removalUpdate, newServerId);
+    else if (replacesServer)
+        serverDown(replacesId);
 }
 
 /**
@@ -361,6 +428,21 @@ CoordinatorService::hintServerDown(const HintServerDownRpc::Request& reqHdr,
     LOG(NOTICE, "Verified host failure, removing from cluster: id %lu (\"%s\")",
         *serverId, serviceLocator.c_str());
 
+    serverDown(serverId);
+}
+
+/**
+ * Remove a server that is known to be gone from the cluster and, if it was
+ * a master, start recovering its tablets onto the remaining masters.
+ * Used both for verified failures reported through hintServerDown and for
+ * servers superseded by a restarted process that cannot reload their data.
+ *
+ * \param serverId
+ *      The id of the server to remove; it must be in #serverList.
+ */
+void
+CoordinatorService::serverDown(ServerId serverId)
+{
     /*
      * If this machine has a backup and master on the same host we need to
      * remove the dead backup before initiating recovery. Otherwise, other hosts
@@ -414,6 +496,89 @@ CoordinatorService::hintServerDown(const HintServerDownRpc::Request& reqHdr,
     sendMembershipUpdate(removalUpdate, ServerId(/* invalid id */));
 }
 
+/**
+ * Fall back to crash recovery for tablets that a restarted master could
+ * not reload from its former log (see MasterService::restart). The former
+ * server's replicas are still on the backups, and the will it left was
+ * handed to the restarted master when it enlisted.
+ *
+ * \param masterId
+ *      The restarted master giving up on the tablets.
+ * \param failedTablets
+ *      The tablets it gave up on. Each one's server_id names the former
+ *      server whose log holds them.
+ * \return
+ *      True if recovery of the tablets has been started. False if they
+ *      aren't waiting on a restart by \a masterId, as when a recovery
+ *      master reports a failure; nothing is changed then.
+ */
+bool
+CoordinatorService::restartFailed(ServerId masterId,
+                                  const ProtoBuf::Tablets& failedTablets)
+{
+    if (failedTablets.tablet_size() == 0 ||
+        !serverList.contains(masterId) || !serverList[masterId].isMaster())
+        return false;
+    ServerId formerId(failedTablets.tablet(0).server_id());
+
+    // Tablets handed over at enlistment are the only RECOVERING ones that
+    // no Recovery is tracking.
+    vector<ProtoBuf::Tablets::Tablet*> restartTablets;
+    foreach (const ProtoBuf::Tablets::Tablet& failed, failedTablets.tablet()) {
+        ProtoBuf::Tablets::Tablet* match = NULL;
+        foreach (ProtoBuf::Tablets::Tablet& tablet,
+                 *tabletMap.mutable_tablet()) {
+            if (tablet.table_id() == failed.table_id() &&
+                tablet.start_object_id() == failed.start_object_id() &&
+                tablet.end_object_id() == failed.end_object_id() &&
+                tablet.server_id() == masterId.getId() &&
+                tablet.state() == ProtoBuf::Tablets_Tablet::RECOVERING &&
+                tablet.user_data() == 0)
+                match = &tablet;
+        }
+        if (match == NULL)
+            return false;
+        restartTablets.push_back(match);
+    }
+
+    // Split the restarted master's will: entries for the failed tablets
+    // guide their recovery, and the master keeps the rest.
+    CoordinatorServerList::Entry& master = serverList[masterId];
+    ProtoBuf::Tablets formerWill;
+    ProtoBuf::Tablets* keptWill = new ProtoBuf::Tablets;
+    foreach (const ProtoBuf::Tablets::Tablet& entry, master.will->tablet()) {
+        bool failed = false;
+        foreach (const ProtoBuf::Tablets::Tablet& tablet,
+                 failedTablets.tablet()) {
+            if (entry.table_id() == tablet.table_id() &&
+                entry.start_object_id() >= tablet.start_object_id() &&
+                entry.end_object_id() <= tablet.end_object_id())
+                failed = true;
+        }
+        *(failed ? formerWill.add_tablet() : keptWill->add_tablet()) = entry;
+    }
+    delete master.will;
+    master.will = keptWill;
+
+    LOG(WARNING, "Master %lu could not reload %d tablets of former server "
+        "%lu; recovering them from backups", masterId.getId(),
+        failedTablets.tablet_size(), formerId.getId());
+
+    BaseRecovery* recovery = NULL;
+    if (mockRecovery != NULL) {
+        (*mockRecovery)(formerId, formerWill, serverList);
+        recovery = mockRecovery;
+    } else {
+        recovery = new Recovery(formerId, formerWill, serverList);
+    }
+    foreach (ProtoBuf::Tablets::Tablet* tablet, restartTablets) {
+        tablet->set_server_id(formerId.getId());
+        tablet->set_user_data(reinterpret_cast<uint64_t>(recovery));
+    }
+    recovery->start();
+    return true;
+}
+
 /**
  * Handle the TABLETS_RECOVERED RPC.
  * \copydetails Service::ping
@@ -423,16 +588,19 @@ CoordinatorService::tabletsRecovered(const TabletsRecoveredRpc::Request& reqHdr,
                                      TabletsRecoveredRpc::Response& respHdr,
                                      Rpc& rpc)
 {
+    ProtoBuf::Tablets recoveredTablets;
+    ProtoBuf::parseFromResponse(rpc.requestPayload,
+                                downCast<uint32_t>(sizeof(reqHdr)),
+                                reqHdr.tabletsLength, recoveredTablets);
+
     if (reqHdr.status != STATUS_OK) {
+        if (restartFailed(ServerId(reqHdr.masterId), recoveredTablets))
+            return;
         // we'll need to restart a recovery of that partition elsewhere
         // right now this just leaks the recovery object in the tabletMap
         LOG(ERROR, "A recovery master failed to recover its partition");
     }
 
-    ProtoBuf::Tablets recoveredTablets;
-    ProtoBuf::parseFromResponse(rpc.requestPayload,
-                                downCast<uint32_t>(sizeof(reqHdr)),
-                                reqHdr.tabletsLength, recoveredTablets);
     ProtoBuf::Tablets* newWill = new ProtoBuf::Tablets;
     ProtoBuf::parseFromResponse(rpc.requestPayload,
                                 downCast<uint32_t>(sizeof(reqHdr)) +
@@ -471,6 +639,10 @@ CoordinatorService::tabletsRecovered(const TabletsRecoveredRpc::Request& reqHdr,
                 // so just copy it over.
                 tablet.set_service_locator(recoveredTablet.service_locator());
                 tablet.set_server_id(recoveredTablet.server_id());
+                // A restarted master replaying its own log has no Recovery
+                // tracking it (see enlistServer).
+                if (recovery == NULL)
+                    continue;
                 bool recoveryComplete =
                     recovery->tabletsRecovered(recoveredTablets);
                 if (recoveryComplete) {
@@ -509,6 +681,123 @@ CoordinatorService::quiesce(const BackupQuiesceRpc::Request& reqHdr,
     }
 }
 
+/**
+ * Handle the REASSIGN_TABLET_OWNERSHIP RPC, which a master sends at the
+ * end of migrating a tablet to another master (see
+ * MasterService::migrateTablet). The tablet map is pointed at the new owner
+ * and the tablet moves from the old owner's will to a partition of its own
+ * in the new owner's will; the masters' tablets are left alone, since both
+ * already know about the move.
+ *
+ * \copydetails Service::ping
+ */
+void
+CoordinatorService::reassignTabletOwnership(
+    const ReassignTabletOwnershipRpc::Request& reqHdr,
+    ReassignTabletOwnershipRpc::Response& respHdr,
+    Rpc& rpc)
+{
+    ServerId newOwnerId(reqHdr.newOwnerMasterId);
+    if (!serverList.contains(newOwnerId) ||
+        !serverList[newOwnerId].isMaster()) {
+        LOG(WARNING, "Server %lu is not a master; can't give it tablet "
+            "%u [%lu, %lu]", newOwnerId.getId(), reqHdr.tableId,
+            reqHdr.firstId, reqHdr.lastId);
+        throw RequestFormatError(HERE);
+    }
+    CoordinatorServerList::Entry& newOwner = serverList[newOwnerId];
+
+    ProtoBuf::Tablets_Tablet* tablet = NULL;
+    foreach (ProtoBuf::Tablets::Tablet& t, *tabletMap.mutable_tablet()) {
+        if (t.table_id() == reqHdr.tableId &&
+            t.start_object_id() == reqHdr.firstId &&
+            t.end_object_id() == reqHdr.lastId) {
+            tablet = &t;
+            break;
+        }
+    }
+    if (tablet == NULL) {
+        respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
+        return;
+    }
+
+    // Drop the tablet from the old owner's will. A will may have split the
+    // tablet across several partitions.
+    ServerId oldOwnerId(tablet->server_id());
+    if (serverList.contains(oldOwnerId)) {
+        ProtoBuf::Tablets& oldWill = *serverList[oldOwnerId].will;
+        ProtoBuf::Tablets keptWill;
+        foreach (const ProtoBuf::Tablets::Tablet& entry, oldWill.tablet()) {
+            if (entry.table_id() != reqHdr.tableId ||
+                entry.end_object_id() < reqHdr.firstId ||
+                entry.start_object_id() > reqHdr.lastId)
+                *keptWill.add_tablet() = entry;
+        }
+        oldWill.Swap(&keptWill);
+    }
+
+    // Give it a partition of its own in the new owner's will until the new
+    // owner next recomputes its will.
+    ProtoBuf::Tablets& will = *newOwner.will;
+    uint64_t partitionId = 0;
+    foreach (const ProtoBuf::Tablets::Tablet& entry, will.tablet())
+        partitionId = std::max(partitionId, entry.user_data() + 1);
+    ProtoBuf::Tablets_Tablet& willEntry(*will.add_tablet());
+    willEntry.set_table_id(reqHdr.tableId);
+    willEntry.set_start_object_id(reqHdr.firstId);
+    willEntry.set_end_object_id(reqHdr.lastId);
+    willEntry.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
+    willEntry.set_user_data(partitionId);
+
+    tablet->set_server_id(newOwnerId.getId());
+    tablet->set_service_locator(newOwner.serviceLocator);
+
+    LOG(NOTICE, "Tablet %u [%lu, %lu] moved from master %lu to master %lu",
+        reqHdr.tableId, reqHdr.firstId, reqHdr.lastId, oldOwnerId.getId(),
+        newOwnerId.getId());
+}
+
+/**
+ * Handle the SET_TRANSACTION_OUTCOME RPC, which settles whether a
+ * transaction spanning several masters commits. The client proposes a
+ * commit once every master has prepared; a master that has waited too
+ * long for the client's decision proposes an abort. Whichever arrives
+ * first is recorded, and every caller is told that outcome, so the masters
+ * never disagree.
+ *
+ * \copydetails Service::ping
+ */
+void
+CoordinatorService::setTransactionOutcome(
+    const SetTransactionOutcomeRpc::Request& reqHdr,
+    SetTransactionOutcomeRpc::Response& respHdr,
+    Rpc& rpc)
+{
+    auto outcome = transactionOutcomes.insert(
+        std::make_pair(reqHdr.transactionId, reqHdr.commit != 0));
+    respHdr.commit = outcome.first->second;
+    if (outcome.second) {
+        LOG(DEBUG, "Transaction %lu %s", reqHdr.transactionId,
+            respHdr.commit ? "commits" : "aborts");
+    }
+}
+
+/**
+ * Handle the FORGET_TRANSACTION_OUTCOME RPC, which a client sends once
+ * every master in a transaction has applied its outcome, so that none of
+ * them will ask for it again.
+ *
+ * \copydetails Service::ping
+ */
+void
+CoordinatorService::forgetTransactionOutcome(
+    const ForgetTransactionOutcomeRpc::Request& reqHdr,
+    ForgetTransactionOutcomeRpc::Response& respHdr,
+    Rpc& rpc)
+{
+    transactionOutcomes.erase(reqHdr.transactionId);
+}
+
 /**
  * Update the Will associated with a specific Master. This is used
  * by Masters to keep their partitions balanced for efficient
@@ -570,6 +859,79 @@ CoordinatorService::setWill(ServerId masterId, Buffer& buffer,
     return false;
 }
 
+/**
+ * Handle the SPLIT_TABLET RPC, which a master sends when one of its tablets
+ * has grown too large (see MasterService::splitTablets). The tablet is
+ * replaced by its two halves in the tablet map, both still owned by the
+ * same master, and any entry of the master's will spanning the split is
+ * split too. No data moves.
+ *
+ * \copydetails Service::ping
+ */
+void
+CoordinatorService::splitTablet(const SplitTabletRpc::Request& reqHdr,
+                                SplitTabletRpc::Response& respHdr,
+                                Rpc& rpc)
+{
+    uint64_t splitId = reqHdr.splitId;
+    if (splitId <= reqHdr.firstId || splitId > reqHdr.lastId) {
+        LOG(WARNING, "Can't split tablet %u [%lu, %lu] at %lu",
+            reqHdr.tableId, reqHdr.firstId, reqHdr.lastId, splitId);
+        throw RequestFormatError(HERE);
+    }
+
+    ProtoBuf::Tablets newTabletMap;
+    ServerId ownerId;
+    bool found = false;
+    foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
+        *newTabletMap.add_tablet() = tablet;
+        if (tablet.table_id() != reqHdr.tableId ||
+            tablet.start_object_id() != reqHdr.firstId ||
+            tablet.end_object_id() != reqHdr.lastId)
+            continue;
+        if (tablet.state() != ProtoBuf::Tablets_Tablet_State_NORMAL) {
+            respHdr.common.status = STATUS_RETRY;
+            return;
+        }
+        ProtoBuf::Tablets::Tablet& upper(*newTabletMap.add_tablet());
+        upper = tablet;
+        upper.set_start_object_id(splitId);
+        newTabletMap.mutable_tablet(newTabletMap.tablet_size() - 2)->
+            set_end_object_id(splitId - 1);
+        ownerId = ServerId(tablet.server_id());
+        found = true;
+    }
+    if (!found) {
+        respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
+        return;
+    }
+    tabletMap.Swap(&newTabletMap);
+
+    // Recovery partitions are made of whole will entries, so none may
+    // straddle the two halves.
+    if (serverList.contains(ownerId)) {
+        ProtoBuf::Tablets& will = *serverList[ownerId].will;
+        ProtoBuf::Tablets newWill;
+        foreach (const ProtoBuf::Tablets::Tablet& entry, will.tablet()) {
+            *newWill.add_tablet() = entry;
+            if (entry.table_id() != reqHdr.tableId ||
+                entry.start_object_id() >= splitId ||
+                entry.end_object_id() < splitId)
+                continue;
+            newWill.mutable_tablet(newWill.tablet_size() - 1)->
+                set_end_object_id(splitId - 1);
+            ProtoBuf::Tablets::Tablet& upper(*newWill.add_tablet());
+            upper = entry;
+            upper.set_start_object_id(splitId);
+        }
+        will.Swap(&newWill);
+    }
+
+    LOG(NOTICE, "Split tablet %u [%lu, %lu] of master %lu at %lu",
+        reqHdr.tableId, reqHdr.firstId, reqHdr.lastId, ownerId.getId(),
+        splitId);
+}
+
 /**
  * Handle the REQUEST_SERVER_LIST RPC.
  *
@@ -72,6 +72,10 @@ class CoordinatorService : public Service {
                         HintServerDownRpc::Response& respHdr,
                         Rpc& rpc);
 
+    void serverDown(ServerId serverId);
+    bool restartFailed(ServerId masterId,
+                       const ProtoBuf::Tablets& failedTablets);
+
     void tabletsRecovered(const TabletsRecoveredRpc::Request& reqHdr,
                           TabletsRecoveredRpc::Response& respHdr,
                           Rpc& rpc);
@@ -80,6 +84,21 @@ class CoordinatorService : public Service {
                  BackupQuiesceRpc::Response& respHdr,
                  Rpc& rpc);
 
+    void reassignTabletOwnership(
+        const ReassignTabletOwnershipRpc::Request& reqHdr,
+        ReassignTabletOwnershipRpc::Response& respHdr,
+        Rpc& rpc);
+
+    void setTransactionOutcome(
+        const SetTransactionOutcomeRpc::Request& reqHdr,
+        SetTransactionOutcomeRpc::Response& respHdr,
+        Rpc& rpc);
+
+    void forgetTransactionOutcome(
+        const ForgetTransactionOutcomeRpc::Request& reqHdr,
+        ForgetTransactionOutcomeRpc::Response& respHdr,
+        Rpc& rpc);
+
     void setWill(const SetWillRpc::Request& reqHdr,
                  SetWillRpc::Response& respHdr,
                  Rpc& rpc);
@@ -87,6 +106,10 @@ class CoordinatorService : public Service {
     bool setWill(ServerId masterId, Buffer& buffer,
                  uint32_t offset, uint32_t length);
 
+    void splitTablet(const SplitTabletRpc::Request& reqHdr,
+                     SplitTabletRpc::Response& respHdr,
+                     Rpc& rpc);
+
     void requestServerList(const RequestServerListRpc::Request& reqHdr,
                            RequestServerListRpc::Response& respHdr,
                            Rpc& rpc);
@@ -135,6 +158,14 @@ class CoordinatorService : public Service {
      */
     uint32_t nextTableMasterIdx;
 
+    /**
+     * Whether each transaction spanning several masters committed, by
+     * transaction id; see setTransactionOutcome(). An entry stays until
+     * the transaction's client reports that every master has applied it,
+     * so the outcomes of transactions whose clients vanish are kept.
+     */
+    std::map<uint64_t, bool> transactionOutcomes;
+
     /// Used in unit testing.
     BaseRecovery* mockRecovery;
 
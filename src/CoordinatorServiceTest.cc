@@ -98,6 +98,41 @@ TEST_F(CoordinatorServiceTest, createTable) {
     EXPECT_EQ(1, master2.tablets.tablet_size());
 }
 
+TEST_F(CoordinatorServiceTest, createTable_serverSpan) {
+    ServerConfig master2Config = masterConfig;
+    master2Config.localLocator = "mock:host=master2";
+    MasterService& master2 = *cluster.addServer(master2Config)->master;
+    client->createTable("foo", 2);
+    client->createTable("bar", 3); // only 2 masters, so span both
+    EXPECT_EQ("tablet { table_id: 0 start_object_id: 0 "
+              "end_object_id: 9223372036854775807 "
+              "state: NORMAL server_id: 1 "
+              "service_locator: \"mock:host=master\" } "
+              "tablet { table_id: 0 start_object_id: 9223372036854775808 "
+              "end_object_id: 18446744073709551615 "
+              "state: NORMAL server_id: 2 "
+              "service_locator: \"mock:host=master2\" } "
+              "tablet { table_id: 1 start_object_id: 0 "
+              "end_object_id: 9223372036854775807 "
+              "state: NORMAL server_id: 1 "
+              "service_locator: \"mock:host=master\" } "
+              "tablet { table_id: 1 start_object_id: 9223372036854775808 "
+              "end_object_id: 18446744073709551615 "
+              "state: NORMAL server_id: 2 "
+              "service_locator: \"mock:host=master2\" }",
+              service->tabletMap.ShortDebugString());
+    ProtoBuf::Tablets& will2 = *service->serverList[2]->will;
+    EXPECT_EQ("tablet { table_id: 0 start_object_id: 9223372036854775808 "
+              "end_object_id: 18446744073709551615 "
+              "state: NORMAL user_data: 0 } "
+              "tablet { table_id: 1 start_object_id: 9223372036854775808 "
+              "end_object_id: 18446744073709551615 "
+              "state: NORMAL user_data: 1 }",
+              will2.ShortDebugString());
+    EXPECT_EQ(2, master->tablets.tablet_size());
+    EXPECT_EQ(2, master2.tablets.tablet_size());
+}
+
 // TODO(ongaro): Find a way to test createTable with no masters online.
 
 // TODO(ongaro): test drop, open table
@@ -126,6 +161,51 @@ TEST_F(CoordinatorServiceTest, enlistServer) {
               backupList.ShortDebugString());
 }
 
+TEST_F(CoordinatorServiceTest, enlistServer_replacesServerWarm) {
+    client->createTable("foo");
+    ProtoBuf::Tablets& oldWill = *service->serverList[masterServerId].will;
+    ServerId newId = client->enlistServer({MASTER_SERVICE},
+                                          "mock:host=master2", 0, 0,
+                                          masterServerId, true);
+    EXPECT_FALSE(service->serverList.contains(masterServerId));
+    EXPECT_EQ(1U, service->serverList.masterCount());
+    EXPECT_EQ(&oldWill, service->serverList[newId].will);
+    EXPECT_EQ("tablet { table_id: 0 start_object_id: 0 "
+              "end_object_id: 18446744073709551615 "
+              "state: RECOVERING server_id: 2 "
+              "service_locator: \"mock:host=master2\" user_data: 0 }",
+              service->tabletMap.ShortDebugString());
+}
+
+TEST_F(CoordinatorServiceTest, enlistServer_replacesServerCold) {
+    struct MyMockRecovery : public BaseRecovery {
+        MyMockRecovery() : masterId(), started(false) {}
+        void
+        operator()(ServerId masterId,
+                   const ProtoBuf::Tablets& will,
+                   const CoordinatorServerList& serverList) {
+            this->masterId = masterId;
+        }
+        void start() { started = true; }
+        ServerId masterId;
+        bool started;
+    } mockRecovery;
+    service->mockRecovery = &mockRecovery;
+    client->createTable("foo");
+
+    // A backup can't take over tablets; the old master is crash recovered.
+    ServerId newId = client->enlistServer({BACKUP_SERVICE},
+                                          "mock:host=backup", 0, 0,
+                                          masterServerId, true);
+    EXPECT_FALSE(service->serverList.contains(masterServerId));
+    EXPECT_TRUE(service->serverList.contains(newId));
+    EXPECT_EQ(masterServerId, mockRecovery.masterId);
+    EXPECT_TRUE(mockRecovery.started);
+    EXPECT_EQ(ProtoBuf::Tablets::Tablet::RECOVERING,
+              service->tabletMap.tablet(0).state());
+    EXPECT_EQ(masterServerId.getId(), service->tabletMap.tablet(0).server_id());
+}
+
 TEST_F(CoordinatorServiceTest, getMasterList) {
     // master is already enlisted
     ProtoBuf::ServerList masterList;
@@ -247,6 +327,33 @@ tabletsRecoveredFilter(string s) {
     return s == "tabletsRecovered";
 }
 
+TEST_F(CoordinatorServiceTest, reassignTabletOwnership) {
+    ServerConfig master2Config = masterConfig;
+    master2Config.localLocator = "mock:host=master2";
+    ServerId master2Id = cluster.addServer(master2Config)->serverId;
+    client->createTable("foo");
+
+    client->reassignTabletOwnership(0, 0, ~0UL, master2Id);
+    EXPECT_EQ("tablet { table_id: 0 start_object_id: 0 "
+              "end_object_id: 18446744073709551615 "
+              "state: NORMAL server_id: 2 "
+              "service_locator: \"mock:host=master2\" }",
+              service->tabletMap.ShortDebugString());
+    EXPECT_EQ("", service->serverList[masterServerId].will->
+                    ShortDebugString());
+    EXPECT_EQ("tablet { table_id: 0 start_object_id: 0 "
+              "end_object_id: 18446744073709551615 "
+              "state: NORMAL user_data: 0 }",
+              service->serverList[master2Id].will->ShortDebugString());
+
+    // The tablet must match exactly.
+    EXPECT_THROW(client->reassignTabletOwnership(0, 0, 10, masterServerId),
+                 TableDoesntExistException);
+    // The new owner must be a master.
+    EXPECT_THROW(client->reassignTabletOwnership(0, 0, ~0UL, ServerId(9, 0)),
+                 RequestFormatError);
+}
+
 TEST_F(CoordinatorServiceTest, tabletsRecovered_basics) {
     typedef ProtoBuf::Tablets::Tablet Tablet;
     typedef ProtoBuf::Tablets Tablets;
@@ -304,6 +411,63 @@ TEST_F(CoordinatorServiceTest, tabletsRecovered_basics) {
     EXPECT_EQ(*master2Id, service->tabletMap.tablet(0).server_id());
 }
 
+TEST_F(CoordinatorServiceTest, tabletsRecovered_warmRestart) {
+    client->createTable("foo");
+    ServerId newId = client->enlistServer({MASTER_SERVICE},
+                                          "mock:host=master2", 0, 0,
+                                          masterServerId, true);
+
+    ProtoBuf::Tablets tablets = service->tabletMap;
+    tablets.mutable_tablet(0)->set_state(ProtoBuf::Tablets::Tablet::NORMAL);
+    ProtoBuf::Tablets will;
+    client->tabletsRecovered(newId.getId(), tablets, will);
+
+    EXPECT_EQ("tablet { table_id: 0 start_object_id: 0 "
+              "end_object_id: 18446744073709551615 "
+              "state: NORMAL server_id: 2 "
+              "service_locator: \"mock:host=master2\" user_data: 0 }",
+              service->tabletMap.ShortDebugString());
+}
+
+TEST_F(CoordinatorServiceTest, tabletsRecovered_restartFailed) {
+    struct MyMockRecovery : public BaseRecovery {
+        MyMockRecovery() : masterId(), will(), started(false) {}
+        void
+        operator()(ServerId masterId,
+                   const ProtoBuf::Tablets& will,
+                   const CoordinatorServerList& serverList) {
+            this->masterId = masterId;
+            this->will = will;
+        }
+        void start() { started = true; }
+        ServerId masterId;
+        ProtoBuf::Tablets will;
+        bool started;
+    } mockRecovery;
+    service->mockRecovery = &mockRecovery;
+    client->createTable("foo");
+    ProtoBuf::Tablets oldWill = *service->serverList[masterServerId].will;
+    ServerId newId = client->enlistServer({MASTER_SERVICE},
+                                          "mock:host=master2", 0, 0,
+                                          masterServerId, true);
+
+    // The restarted master names the former server whose log to recover.
+    ProtoBuf::Tablets tablets = service->tabletMap;
+    tablets.mutable_tablet(0)->set_server_id(masterServerId.getId());
+    client->tabletsRecovered(newId.getId(), tablets, ProtoBuf::Tablets(),
+                             STATUS_INTERNAL_ERROR);
+
+    EXPECT_EQ(masterServerId, mockRecovery.masterId);
+    EXPECT_TRUE(mockRecovery.started);
+    EXPECT_EQ(oldWill.ShortDebugString(),
+              mockRecovery.will.ShortDebugString());
+    EXPECT_EQ(0, service->serverList[newId].will->tablet_size());
+    const ProtoBuf::Tablets::Tablet& tablet = service->tabletMap.tablet(0);
+    EXPECT_EQ(ProtoBuf::Tablets::Tablet::RECOVERING, tablet.state());
+    EXPECT_EQ(masterServerId.getId(), tablet.server_id());
+    EXPECT_EQ(reinterpret_cast<uint64_t>(&mockRecovery), tablet.user_data());
+}
+
 static bool
 setWillFilter(string s) {
     return s == "setWill";
@@ -330,6 +494,45 @@ TEST_F(CoordinatorServiceTest, setWill) {
     EXPECT_THROW(client->setWill(23481234, will), InternalError);
 }
 
+TEST_F(CoordinatorServiceTest, setTransactionOutcome) {
+    // The first outcome proposed sticks.
+    EXPECT_TRUE(client->setTransactionOutcome(18, true));
+    EXPECT_TRUE(client->setTransactionOutcome(18, false));
+    EXPECT_FALSE(client->setTransactionOutcome(19, false));
+    EXPECT_FALSE(client->setTransactionOutcome(19, true));
+    EXPECT_EQ(2U, service->transactionOutcomes.size());
+
+    client->forgetTransactionOutcome(18);
+    client->forgetTransactionOutcome(20);
+    EXPECT_EQ(1U, service->transactionOutcomes.size());
+    EXPECT_FALSE(client->setTransactionOutcome(18, false));
+}
+
+TEST_F(CoordinatorServiceTest, splitTablet) {
+    client->createTable("foo");
+    client->splitTablet(0, 0, ~0UL, 1000);
+    EXPECT_EQ("tablet { table_id: 0 start_object_id: 0 "
+              "end_object_id: 999 "
+              "state: NORMAL server_id: 1 "
+              "service_locator: \"mock:host=master\" } "
+              "tablet { table_id: 0 start_object_id: 1000 "
+              "end_object_id: 18446744073709551615 "
+              "state: NORMAL server_id: 1 "
+              "service_locator: \"mock:host=master\" }",
+              service->tabletMap.ShortDebugString());
+    EXPECT_EQ("tablet { table_id: 0 start_object_id: 0 "
+              "end_object_id: 999 "
+              "state: NORMAL user_data: 0 } "
+              "tablet { table_id: 0 start_object_id: 1000 "
+              "end_object_id: 18446744073709551615 "
+              "state: NORMAL user_data: 0 }",
+              service->serverList[masterServerId].will->ShortDebugString());
+
+    EXPECT_THROW(client->splitTablet(0, 0, 999, 0), RequestFormatError);
+    EXPECT_THROW(client->splitTablet(0, 0, ~0UL, 10),
+                 TableDoesntExistException);
+}
+
 TEST_F(CoordinatorServiceTest, requestServerList) {
     TestLog::Enable _;
 
@@ -0,0 +1,184 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "EpochManager.h"
+#include "ServerRpcPool.h"
+
+namespace RAMCloud {
+
+EpochManager::Slot EpochManager::slots[EpochManager::MAX_THREADS];
+__thread EpochManager::Slot* EpochManager::threadSlot = NULL;
+
+namespace {
+
+/**
+ * Owns the pthread key whose destructor hands a thread's slot back when
+ * the thread exits.
+ */
+struct SlotKey {
+    explicit SlotKey(void (*destructor)(void*))
+        : key()
+    {
+        int r = pthread_key_create(&key, destructor);
+        if (r != 0)
+            throw FatalError(HERE, "Could not create EpochManager key", r);
+    }
+    pthread_key_t key;
+};
+
+} // anonymous namespace
+
+/**
+ * Return the current epoch. Readers entering a ReadGuard now will be
+ * tagged with this value.
+ */
+uint64_t
+EpochManager::getCurrentEpoch()
+{
+    return ServerRpcPool<>::getCurrentEpoch();
+}
+
+/**
+ * Start a new epoch. Call this after unlinking something that readers
+ * may still be using, and free it once #getEarliestActiveEpoch() is
+ * greater than the value returned.
+ *
+ * \return
+ *      The epoch that just ended: the newest epoch in which a reader
+ *      could have seen whatever the caller unlinked.
+ */
+uint64_t
+EpochManager::advance()
+{
+    return ServerRpcPool<>::incrementCurrentEpoch() - 1;
+}
+
+/**
+ * Return the epoch of the oldest ReadGuard currently held by any thread,
+ * or IDLE if no thread is reading. Anything retired before the epoch was
+ * advanced past the returned value is unreachable by every reader.
+ *
+ * This scans every slot, so callers that reclaim memory should batch
+ * their work rather than call this per object.
+ */
+uint64_t
+EpochManager::getEarliestActiveEpoch()
+{
+    // Make sure any unlinking the caller did is visible before we look
+    // at the slots; readers fence in the opposite direction on entry.
+    __sync_synchronize();
+    uint64_t earliest = IDLE;
+    for (uint32_t i = 0; i < MAX_THREADS; i++) {
+        if (!slots[i].inUse)
+            continue;
+        uint64_t epoch = slots[i].epoch;
+        if (epoch < earliest)
+            earliest = epoch;
+    }
+    return earliest;
+}
+
+/**
+ * Wait for a grace period: return once every ReadGuard that was held when
+ * this method was called has been released. Anything the caller unlinked
+ * before calling this may then be freed.
+ *
+ * The caller must not hold a ReadGuard itself.
+ */
+void
+EpochManager::synchronize()
+{
+    assert(threadSlot == NULL || threadSlot->depth == 0);
+    uint64_t epoch = advance();
+    while (getEarliestActiveEpoch() <= epoch)
+        sched_yield();
+}
+
+/**
+ * Return the calling thread's slot, claiming a free one the first time
+ * the thread asks.
+ *
+ * \throw FatalError
+ *      More than #MAX_THREADS threads have used ReadGuards.
+ */
+EpochManager::Slot*
+EpochManager::getSlot()
+{
+    if (threadSlot != NULL)
+        return threadSlot;
+
+    static SlotKey slotKey(releaseSlot);
+    for (uint32_t i = 0; i < MAX_THREADS; i++) {
+        Slot* slot = &slots[i];
+        if (slot->inUse || !__sync_bool_compare_and_swap(&slot->inUse,
+                                                         false, true))
+            continue;
+        slot->epoch = IDLE;
+        slot->depth = 0;
+        pthread_setspecific(slotKey.key, slot);
+        threadSlot = slot;
+        return slot;
+    }
+    throw FatalError(HERE, "Too many threads using EpochManager");
+}
+
+/**
+ * Give a thread's slot back. Invoked by pthreads when a thread that
+ * claimed a slot exits.
+ *
+ * \param slot
+ *      The exiting thread's slot.
+ */
+void
+EpochManager::releaseSlot(void* slot)
+{
+    Slot* s = static_cast<Slot*>(slot);
+    s->epoch = IDLE;
+    s->depth = 0;
+    __sync_synchronize();
+    s->inUse = false;
+}
+
+/**
+ * Enter a read-side critical section on behalf of the calling thread.
+ */
+EpochManager::ReadGuard::ReadGuard()
+    : slot(getSlot())
+{
+    if (slot->depth++ > 0)
+        return;
+    slot->epoch = getCurrentEpoch();
+    // Publish the epoch before reading anything it protects; this pairs
+    // with the fence in getEarliestActiveEpoch().
+    __sync_synchronize();
+}
+
+/**
+ * Leave the read-side critical section.
+ */
+EpochManager::ReadGuard::~ReadGuard()
+{
+    assert(slot->depth > 0);
+    if (--slot->depth > 0)
+        return;
+    // Finish all reads made under the guard before declaring them done.
+    __sync_synchronize();
+    slot->epoch = IDLE;
+}
+
+} // namespace RAMCloud
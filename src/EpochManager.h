@@ -0,0 +1,122 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUD_EPOCHMANAGER_H
+#define RAMCLOUD_EPOCHMANAGER_H
+
+#include "Common.h"
+
+namespace RAMCloud {
+
+/**
+ * EpochManager lets threads read shared structures without taking locks
+ * while other threads retire parts of those structures, in the style of
+ * read-copy-update.
+ *
+ * A reader brackets its accesses with a ReadGuard, which records the
+ * current epoch in a slot owned by the calling thread. A writer first
+ * unlinks whatever it wants to free, so that no new reader can reach it,
+ * and then waits for a grace period: either by blocking in #synchronize(),
+ * or by tagging the memory with the value returned by #advance() and
+ * freeing it once #getEarliestActiveEpoch() has moved past the tag. The
+ * Log and TabletIndex do the latter for cleaned segments and replaced
+ * tablet maps; the HashTable does the former for the buckets and cache
+ * lines it retires while growing.
+ *
+ * Epochs come from the same counter that ServerRpcPool uses to tag
+ * incoming RPCs, so an epoch value means the same thing to readers on
+ * worker threads and to requests still held by the transports.
+ *
+ * Slots are claimed the first time a thread enters a ReadGuard and are
+ * given back when the thread exits.
+ */
+class EpochManager {
+  public:
+    class ReadGuard;
+
+    static uint64_t getCurrentEpoch();
+    static uint64_t advance();
+    static uint64_t getEarliestActiveEpoch();
+    static void synchronize();
+
+    /**
+     * Upper bound on the number of threads that may be inside a ReadGuard
+     * at once (more precisely, the number of live threads that have ever
+     * used one).
+     */
+    static const uint32_t MAX_THREADS = 256;
+
+    /**
+     * The value of a slot's epoch while its thread is not reading.
+     */
+    static const uint64_t IDLE = ~0UL;
+
+  PRIVATE:
+    /**
+     * Per-thread state. Each slot fills a cache line of its own so that
+     * entering and leaving a ReadGuard doesn't bounce lines between cores.
+     */
+    struct Slot {
+        /// The epoch in which the owning thread entered its outermost
+        /// ReadGuard, or IDLE. Only written by the owning thread.
+        volatile uint64_t epoch;
+
+        /// The number of ReadGuards the owning thread is nested inside.
+        uint32_t depth;
+
+        /// Whether some thread owns this slot.
+        volatile bool inUse;
+
+        char pad[64 - sizeof(uint64_t) - sizeof(uint32_t) - sizeof(bool)];
+    } __attribute__((aligned(64)));
+    static_assert(sizeof(Slot) == 64, "EpochManager::Slot is not 64 bytes");
+
+    static Slot* getSlot();
+    static void releaseSlot(void* slot);
+
+    /// One slot per thread that has used a ReadGuard.
+    static Slot slots[MAX_THREADS];
+
+    /// The calling thread's slot, or NULL until it first enters a ReadGuard.
+    static __thread Slot* threadSlot;
+
+    EpochManager();
+    DISALLOW_COPY_AND_ASSIGN(EpochManager);
+};
+
+/**
+ * Marks the calling thread as reading shared structures for the lifetime
+ * of this object. Anything reachable when the guard is constructed stays
+ * allocated until the guard is destroyed. Guards may be nested.
+ *
+ * A thread must not call EpochManager::synchronize() while it holds a
+ * ReadGuard, and should not hold one any longer than necessary, since it
+ * keeps every retired structure in the system from being reclaimed.
+ */
+class EpochManager::ReadGuard {
+  public:
+    ReadGuard();
+    ~ReadGuard();
+
+  PRIVATE:
+    /// The calling thread's slot.
+    Slot* const slot;
+
+    DISALLOW_COPY_AND_ASSIGN(ReadGuard);
+};
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUD_EPOCHMANAGER_H
@@ -0,0 +1,211 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "TestUtil.h"
+#include "AtomicInt.h"
+#include "EpochManager.h"
+#include "ServerRpcPool.h"
+
+namespace RAMCloud {
+
+class EpochManagerTest : public ::testing::Test {
+  public:
+    EpochManagerTest()
+    {
+        ServerRpcPoolInternal::currentEpoch = 10;
+    }
+
+    static uint32_t
+    slotsInUse()
+    {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < EpochManager::MAX_THREADS; i++) {
+            if (EpochManager::slots[i].inUse)
+                count++;
+        }
+        return count;
+    }
+
+    DISALLOW_COPY_AND_ASSIGN(EpochManagerTest);
+};
+
+TEST_F(EpochManagerTest, advance) {
+    EXPECT_EQ(10U, EpochManager::getCurrentEpoch());
+    EXPECT_EQ(10U, EpochManager::advance());
+    EXPECT_EQ(11U, EpochManager::getCurrentEpoch());
+}
+
+TEST_F(EpochManagerTest, ReadGuard) {
+    EXPECT_TRUE(EpochManager::IDLE ==                       // NOLINT
+                EpochManager::getEarliestActiveEpoch());
+    {
+        EpochManager::ReadGuard _;
+        EXPECT_EQ(10U, EpochManager::getEarliestActiveEpoch());
+        EpochManager::advance();
+        {
+            // Nested guards keep the outermost epoch.
+            EpochManager::ReadGuard _;
+            EXPECT_EQ(10U, EpochManager::getEarliestActiveEpoch());
+        }
+        EXPECT_EQ(10U, EpochManager::getEarliestActiveEpoch());
+    }
+    EXPECT_TRUE(EpochManager::IDLE ==                       // NOLINT
+                EpochManager::getEarliestActiveEpoch());
+
+    EpochManager::ReadGuard _;
+    EXPECT_EQ(11U, EpochManager::getEarliestActiveEpoch());
+}
+
+// Enters a ReadGuard and exits, leaving its slot to be released.
+static void
+enterGuardAndExit()
+{
+    EpochManager::ReadGuard _;
+}
+
+TEST_F(EpochManagerTest, releaseSlot) {
+    { EpochManager::ReadGuard _; }
+    uint32_t before = slotsInUse();
+    std::thread thread(enterGuardAndExit);
+    thread.join();
+    EXPECT_EQ(before, slotsInUse());
+}
+
+// Holds a ReadGuard until told to let go.
+static void
+holdGuard(volatile bool* entered, volatile bool* release)
+{
+    EpochManager::ReadGuard _;
+    *entered = true;
+    while (!*release)
+        sched_yield();
+}
+
+// Waits for a grace period and notes that it ended.
+static void
+synchronizeThread(volatile bool* done)
+{
+    EpochManager::synchronize();
+    *done = true;
+}
+
+TEST_F(EpochManagerTest, synchronize) {
+    // No readers: returns right away.
+    EpochManager::synchronize();
+    EXPECT_EQ(11U, EpochManager::getCurrentEpoch());
+
+    volatile bool entered = false;
+    volatile bool release = false;
+    volatile bool done = false;
+    std::thread reader(holdGuard, &entered, &release);
+    while (!entered)
+        sched_yield();
+    std::thread writer(synchronizeThread, &done);
+    usleep(10000);
+    EXPECT_FALSE(done);
+
+    // Readers arriving after the grace period started don't hold it up.
+    {
+        EpochManager::ReadGuard _;
+        release = true;
+        reader.join();
+        writer.join();
+        EXPECT_TRUE(done);
+    }
+}
+
+/**
+ * State shared by the threads of EpochManagerTest.stress: readers follow
+ * #current while a writer keeps replacing it and reclaiming old copies.
+ */
+struct EpochStress {
+    struct Node {
+        Node() : value(LIVE) {}
+        volatile uint64_t value;
+    };
+    static const uint64_t LIVE = 0x1234;
+    static const uint64_t DEAD = 0xdead;
+
+    EpochStress() : current(new Node()), stop(false), errors(), reads() {}
+    Node* volatile current;
+    volatile bool stop;
+    AtomicInt errors;
+    AtomicInt reads;
+    DISALLOW_COPY_AND_ASSIGN(EpochStress);
+};
+
+static void
+epochStressReader(EpochStress* s)
+{
+    while (!s->stop) {
+        EpochManager::ReadGuard _;
+        EpochStress::Node* node = s->current;
+        for (int i = 0; i < 10; i++) {
+            if (node->value != EpochStress::LIVE)
+                s->errors.inc();
+        }
+        s->reads.inc();
+    }
+}
+
+TEST_F(EpochManagerTest, stress) {
+    EpochStress s;
+    std::vector<std::thread*> readers;
+    for (int i = 0; i < 4; i++)
+        readers.push_back(new std::thread(epochStressReader, &s));
+    while (s.reads == 0)
+        sched_yield();
+
+    // Alternate between the two ways of waiting for a grace period.
+    std::vector<EpochStress::Node*> dead;
+    std::vector<std::pair<uint64_t, EpochStress::Node*>> retired;
+    for (int i = 0; i < 5000; i++) {
+        EpochStress::Node* old = s.current;
+        s.current = new EpochStress::Node();
+        if (i % 500 == 0) {
+            EpochManager::synchronize();
+            old->value = EpochStress::DEAD;
+            dead.push_back(old);
+            continue;
+        }
+        retired.push_back({EpochManager::advance(), old});
+        uint64_t earliest = EpochManager::getEarliestActiveEpoch();
+        size_t kept = 0;
+        for (size_t j = 0; j < retired.size(); j++) {
+            if (retired[j].first < earliest) {
+                retired[j].second->value = EpochStress::DEAD;
+                dead.push_back(retired[j].second);
+            } else {
+                retired[kept++] = retired[j];
+            }
+        }
+        retired.resize(kept);
+    }
+    s.stop = true;
+    foreach (std::thread* t, readers) {
+        t->join();
+        delete t;
+    }
+
+    EXPECT_EQ(0, s.errors.load());
+    EXPECT_LT(0, s.reads.load());
+    foreach (EpochStress::Node* node, dead)
+        delete node;
+    foreach (auto& r, retired)
+        delete r.second;
+    delete s.current;
+}
+
+} // namespace RAMCloud
@@ -16,12 +16,22 @@
 #ifndef RAMCLOUD_HASHTABLE_H
 #define RAMCLOUD_HASHTABLE_H
 
+#include <mutex>
+#include <vector>
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "Common.h"
 #include "BitOps.h"
 #include "CycleCounter.h"
+#include "EpochManager.h"
+#include "Fence.h"
 #include "LargeBlockOfMemory.h"
 #include "Memory.h"
 #include "MurmurHash3.h"
+#include "SpinLock.h"
+#include "Tub.h"
 
 namespace RAMCloud {
 
@@ -34,7 +44,33 @@ namespace RAMCloud {
  * requests. I.e., to read and write a %RAMCloud object, this lets you find the
  * location of the the object: (key2, tableID) -> Object*.
  *
- * This code is not thread-safe.
+ * This code is not thread-safe by itself. To allow concurrent access, the
+ * table provides an array of SpinLocks striped across its buckets (see
+ * #getBucketLock()). Callers that hold the lock for a key's bucket may
+ * operate on that key concurrently with callers operating on keys in other
+ * buckets; callers needing a consistent view of the entire table can take
+ * every bucket lock with an ExclusiveLock. The PerfCounters are updated
+ * without synchronization and may undercount under concurrent use.
+ *
+ * Readers inside an EpochManager::ReadGuard may also use #lockFreeLookup(),
+ * which takes no lock at all in the common case. To support this, entries
+ * are read and written with single 64-bit accesses, a new overflow cache
+ * line is initialised before it is linked into its bucket, and memory that
+ * a lock-free reader might still be looking at (the old bucket array and
+ * its overflow cache lines after a resize) is only freed after a grace
+ * period (see #releaseRetiredBuckets()).
+ *
+ * If reference tracking is turned on (see #setReferenceTracking()), every
+ * lock-free lookup that finds its key also sets a referenced bit in the key's
+ * entry. The bit lets the owner run a CLOCK replacement policy over the
+ * referents (see #testAndClearReferenced()) without any memory beyond the
+ * entries themselves.
+ *
+ * Several referents may be stored under the same key, provided that the
+ * caller can tell them apart. Methods that look up a key optionally take a
+ * matcher, a function object that is called with each referent stored under
+ * the key and returns whether it is the one wanted (see #AnyReferent and
+ * #SameReferent). Without one, any referent stored under the key will do.
  *
  * \section impl Implementation Details
  *
@@ -49,6 +85,17 @@ namespace RAMCloud {
  * buckets). In this case, the last hash table entry in each of the
  * non-terminal cache lines has a pointer to the next cache line instead of a
  * pointer to a referent.
+ *
+ * \section resize Resizing
+ *
+ * The table can grow while it is in use (see #startResize()). A new bucket
+ * array is allocated and the old buckets are migrated into it a few at a
+ * time by #rehash(), each under its bucket lock, so no single operation
+ * has to wait for the whole table to be rehashed. While a resize is in
+ * progress, buckets below #rehashIndex live in the new array and the rest
+ * still live in the old one. The number of buckets only ever grows by a
+ * power of two, so every key in an old bucket moves to a new bucket guarded
+ * by the same bucket lock.
  */
 template<typename T>
 class HashTable {
@@ -204,6 +251,12 @@ class HashTable {
          */
         uint64_t lookupEntryHashCollisions;
 
+        /**
+         * The number of #lockFreeLookup() calls that had to fall back to
+         * taking a bucket lock because the table was being resized.
+         */
+        uint64_t lockFreeLookupRetries;
+
         /**
          * The distribution of CPU cycles spent for #lookupEntry() operations.
          */
@@ -216,7 +269,7 @@ class HashTable {
             : replaceCalls(0), lookupEntryCalls(0), replaceCycles(0),
             lookupEntryCycles(0), insertChainsFollowed(0),
             lookupEntryChainsFollowed(0), lookupEntryHashCollisions(0),
-            lookupEntryDist()
+            lockFreeLookupRetries(0), lookupEntryDist()
         {
         }
 
@@ -234,21 +287,61 @@ class HashTable {
             lookupEntryChainsFollowed = 0;
             lookupEntryHashCollisions = 0;
             lookupEntryDist.reset();
+            lockFreeLookupRetries = 0;
         }
     };
 
+    /**
+     * A matcher that accepts any referent stored under a key. Lookups that
+     * are given no matcher use this one.
+     */
+    struct AnyReferent {
+        bool operator()(T referent) const { return true; }
+    };
+
+    /**
+     * A matcher that accepts only one particular referent, for callers that
+     * already hold the referent they want to remove or replace.
+     */
+    class SameReferent {
+      public:
+        explicit SameReferent(T referent) : referent(referent) {}
+        bool operator()(T other) const { return other == referent; }
+      private:
+        T referent;
+    };
+
     /**
      * Constructor for HashTable.
      * \param[in] numBuckets
      *      The number of buckets in the new hash table. This should be a power
      *      of two.
+     * \param[in] placement
+     *      Where the memory for the buckets should come from: huge pages
+     *      make random lookups in a large table much cheaper. This is used
+     *      again if the table is resized.
      * \throw Exception
      *      An exception is thrown if numBuckets is 0.
      */
-    explicit HashTable(uint64_t numBuckets)
+    explicit HashTable(uint64_t numBuckets,
+                       const MemoryPlacement& placement = MemoryPlacement())
         : numBuckets(BitOps::powerOfTwoLessOrEqual(numBuckets))
-        , buckets(this->numBuckets * sizeof(CacheLine))
+        , placement(placement)
+        , buckets(this->numBuckets * sizeof(CacheLine), placement)
+        , nextBuckets()
+        , nextNumBuckets(0)
+        , rehashIndex(0)
+        , resizing(false)
+        , resizeSequence(0)
+        , retiredLines()
+        , numEntries(0)
+        , numOverflowLines(0)
+        , numBucketLocks(this->numBuckets < MAX_BUCKET_LOCKS ?
+                         this->numBuckets : MAX_BUCKET_LOCKS)
+        , bucketLocks(new SpinLock[numBucketLocks])
         , perfCounters()
+        , simdLookups(haveSimd)
+        , referenceTracking(false)
     {
         // HashTable<T> requires that T be a pointer. Assert that.
         {
@@ -273,6 +366,82 @@ class HashTable {
     ~HashTable()
     {
         // TODO(ongaro): free chained CacheLines that were allocated in insert()
+        foreach (CacheLine* cl, retiredLines)
+            free(cl);
+    }
+
+    /**
+     * Acquires every bucket lock of a HashTable for the lifetime of this
+     * object, which gives the holder exclusive access to the whole table.
+     * Locks are always taken in increasing order, so this cannot deadlock
+     * with callers holding a single bucket lock.
+     */
+    class ExclusiveLock {
+      public:
+        explicit ExclusiveLock(HashTable& hashTable)
+            : hashTable(hashTable)
+        {
+            for (uint64_t i = 0; i < hashTable.numBucketLocks; i++)
+                hashTable.bucketLocks[i].lock();
+        }
+
+        ~ExclusiveLock()
+        {
+            for (uint64_t i = hashTable.numBucketLocks; i > 0; i--)
+                hashTable.bucketLocks[i - 1].unlock();
+        }
+
+      PRIVATE:
+        /// The table whose bucket locks are held.
+        HashTable& hashTable;
+
+        DISALLOW_COPY_AND_ASSIGN(ExclusiveLock);
+    };
+
+    /**
+     * Return the lock protecting the bucket that a key hashes to. Holding
+     * this lock serialises #lookup(), #remove() and #replace() calls on any
+     * key in the same bucket.
+     * \param[in] key1
+     *      The first 64 bits of the key.
+     * \param[in] key2
+     *      The second 64 bits of the key.
+     */
+    SpinLock&
+    getBucketLock(uint64_t key1, uint64_t key2)
+    {
+        return bucketLocks[hash(key1, key2) & (numBucketLocks - 1)];
+    }
+
+    /**
+     * Return the lock protecting a bucket given its index, for use with
+     * #forEachInBucket().
+     * \param[in] bucket
+     *      An index into the HashTable's buckets.  Must be < #numBuckets.
+     */
+    SpinLock&
+    getBucketLockByIndex(uint64_t bucket)
+    {
+        assert(bucket < numBuckets);
+        return bucketLocks[bucket & (numBucketLocks - 1)];
+    }
+
+    /**
+     * Return the index of the bucket a key would fall in if the table had
+     * a given number of buckets. Since the table only grows, by powers of
+     * two, a key's index for a smaller size is its index for the current
+     * size modulo the smaller one.
+     * \param[in] key1
+     *      The first 64 bits of the key.
+     * \param[in] key2
+     *      The second 64 bits of the key.
+     * \param[in] numBuckets
+     *      A power of two no larger than 2^48.
+     */
+    static uint64_t
+    getBucketIndex(uint64_t key1, uint64_t key2, uint64_t numBuckets)
+    {
+        return hash(key1, key2) & (numBuckets - 1);
     }
 
     /**
@@ -286,14 +455,218 @@ class HashTable {
      */
     T
     lookup(uint64_t key1, uint64_t key2)
+    {
+        return lookup(key1, key2, AnyReferent());
+    }
+
+    /**
+     * Find the address of a referent given the key, choosing among the
+     * referents stored under it with a matcher.
+     * \param[in] key1
+     *      The first 64 bits of the key.
+     * \param[in] key2
+     *      The second 64 bits of the key.
+     * \param[in] matches
+     *      Called with each referent stored under the key; returns whether
+     *      it is the one wanted.
+     * \return
+     *      The address of the referent, or \a NULL if one doesn't exist.
+     */
+    template<typename Matches>
+    T
+    lookup(uint64_t key1, uint64_t key2, const Matches& matches)
     {
         uint64_t secondaryHash;
-        Entry *entry;
+        T referent;
         CacheLine *bucket = findBucket(key1, key2, &secondaryHash);
-        entry = lookupEntry(bucket, secondaryHash, key1, key2);
-        if (entry == NULL)
+        if (lookupEntry(bucket, secondaryHash, key1, key2, matches,
+                        &referent) == NULL)
+            return NULL;
+        return referent;
+    }
+
+    /**
+     * Find the address of a referent given the key, without holding the
+     * key's bucket lock. The caller must be inside an
+     * EpochManager::ReadGuard, which keeps the cache lines being searched
+     * (and, if the referents live in the Log, the referents themselves)
+     * from being freed.
+     *
+     * The result may already be stale by the time it is returned: it is
+     * the referent that was stored under the key at some point during the
+     * call. If the table is being resized in a way that could make the
+     * search miss, this falls back to taking the bucket lock. If reference
+     * tracking is on, the entry found is marked referenced.
+     * \param[in] key1
+     *      The first 64 bits of the key.
+     * \param[in] key2
+     *      The second 64 bits of the key.
+     * \return
+     *      The address of the referent, or \a NULL if one doesn't exist.
+     */
+    T
+    lockFreeLookup(uint64_t key1, uint64_t key2)
+    {
+        return lockFreeLookup(key1, key2, AnyReferent());
+    }
+
+    /**
+     * Find the address of a referent given the key, without holding the
+     * key's bucket lock, choosing among the referents stored under it with
+     * a matcher. The matcher is called on referents that may be changing
+     * underneath it, with the same protection as the lookup itself. See
+     * #lockFreeLookup(uint64_t, uint64_t).
+     * \param[in] key1
+     *      The first 64 bits of the key.
+     * \param[in] key2
+     *      The second 64 bits of the key.
+     * \param[in] matches
+     *      Called with each referent stored under the key; returns whether
+     *      it is the one wanted.
+     * \return
+     *      The address of the referent, or \a NULL if one doesn't exist.
+     */
+    template<typename Matches>
+    T
+    lockFreeLookup(uint64_t key1, uint64_t key2, const Matches& matches)
+    {
+        uint64_t sequence = resizeSequence;
+        Fence::lfence();
+        if ((sequence & 1) == 0) {
+            uint64_t secondaryHash;
+            T referent;
+            CacheLine *bucket = findBucket(key1, key2, &secondaryHash);
+            Entry *entry = lookupEntry(bucket, secondaryHash,
+                                       key1, key2, matches, &referent,
+                                       referenceTracking);
+            Fence::lfence();
+            if (sequence == resizeSequence)
+                return (entry == NULL) ? NULL : referent;
+        }
+
+        ++perfCounters.lockFreeLookupRetries;
+        std::lock_guard<SpinLock> _(getBucketLock(key1, key2));
+        uint64_t secondaryHash;
+        T referent;
+        CacheLine *bucket = findBucket(key1, key2, &secondaryHash);
+        if (lookupEntry(bucket, secondaryHash, key1, key2, matches,
+                        &referent, referenceTracking) == NULL)
             return NULL;
-        return entry->getReferent();
+        return referent;
+    }
+
+    /**
+     * Find the referents for a batch of keys. This is equivalent to calling
+     * #lookup() on each key in turn, but is faster when the buckets and
+     * referents are unlikely to be cached: the lookups are pipelined in
+     * stages (find and prefetch every bucket, then prefetch every candidate
+     * referent, then compare keys) so that their cache misses overlap
+     * rather than being taken one after another.
+     * \param[in] count
+     *      The number of keys in \a key1s and \a key2s.
+     * \param[in] key1s
+     *      The first 64 bits of each key.
+     * \param[in] key2s
+     *      The second 64 bits of each key.
+     * \param[out] referents
+     *      The address of the referent for each key, or \a NULL if one
+     *      doesn't exist, in the same order as the keys.
+     */
+    void
+    lookupBatch(uint32_t count, const uint64_t key1s[],
+                const uint64_t key2s[], T referents[])
+    {
+        for (uint32_t first = 0; first < count; first += MAX_BATCH_LOOKUPS) {
+            uint32_t n = count - first;
+            if (n > MAX_BATCH_LOOKUPS)
+                n = MAX_BATCH_LOOKUPS;
+            lookupGroup(n, &key1s[first], &key2s[first],
+                        static_cast<const AnyReferent*>(NULL),
+                        &referents[first], false);
+        }
+    }
+
+    /**
+     * Find the referents for a batch of keys, choosing among the referents
+     * stored under each key with a matcher of its own. See
+     * #lookupBatch(uint32_t, const uint64_t[], const uint64_t[], T[]).
+     * \param[in] count
+     *      The number of keys in \a key1s and \a key2s.
+     * \param[in] key1s
+     *      The first 64 bits of each key.
+     * \param[in] key2s
+     *      The second 64 bits of each key.
+     * \param[in] matches
+     *      The matcher for each key, in the same order as the keys.
+     * \param[out] referents
+     *      The address of the referent for each key, or \a NULL if one
+     *      doesn't exist, in the same order as the keys.
+     */
+    template<typename Matches>
+    void
+    lookupBatch(uint32_t count, const uint64_t key1s[],
+                const uint64_t key2s[], const Matches matches[],
+                T referents[])
+    {
+        for (uint32_t first = 0; first < count; first += MAX_BATCH_LOOKUPS) {
+            uint32_t n = count - first;
+            if (n > MAX_BATCH_LOOKUPS)
+                n = MAX_BATCH_LOOKUPS;
+            lookupGroup(n, &key1s[first], &key2s[first], &matches[first],
+                        &referents[first], false);
+        }
+    }
+
+    /**
+     * Find the referents for a batch of keys without holding their bucket
+     * locks. This is to #lookupBatch() what #lockFreeLookup() is to
+     * #lookup(); see #lockFreeLookup() for the caller's obligations.
+     * \copydetails lookupBatch
+     */
+    void
+    lockFreeLookupBatch(uint32_t count, const uint64_t key1s[],
+                        const uint64_t key2s[], T referents[])
+    {
+        lockFreeLookupBatch(count, key1s, key2s,
+                            static_cast<const AnyReferent*>(NULL), referents);
+    }
+
+    /**
+     * Find the referents for a batch of keys without holding their bucket
+     * locks, choosing among the referents stored under each key with a
+     * matcher of its own. This is to #lookupBatch() what #lockFreeLookup()
+     * is to #lookup(); the parameters are those of the #lookupBatch() that
+     * takes matchers.
+     */
+    template<typename Matches>
+    void
+    lockFreeLookupBatch(uint32_t count, const uint64_t key1s[],
+                        const uint64_t key2s[], const Matches matches[],
+                        T referents[])
+    {
+        for (uint32_t first = 0; first < count; first += MAX_BATCH_LOOKUPS) {
+            uint32_t n = count - first;
+            if (n > MAX_BATCH_LOOKUPS)
+                n = MAX_BATCH_LOOKUPS;
+            uint64_t sequence = resizeSequence;
+            Fence::lfence();
+            if ((sequence & 1) == 0) {
+                lookupGroup(n, &key1s[first], &key2s[first],
+                            matches == NULL ? NULL : &matches[first],
+                            &referents[first], referenceTracking);
+                Fence::lfence();
+                if (sequence == resizeSequence)
+                    continue;
+            }
+            for (uint32_t i = first; i < first + n; i++) {
+                if (matches == NULL) {
+                    referents[i] = lockFreeLookup(key1s[i], key2s[i]);
+                } else {
+                    referents[i] = lockFreeLookup(key1s[i], key2s[i],
+                                                  matches[i]);
+                }
+            }
+        }
     }
 
     /**
@@ -310,17 +683,42 @@ class HashTable {
      */
     bool
     remove(uint64_t key1, uint64_t key2, T* retPtr = NULL)
+    {
+        return remove(key1, key2, AnyReferent(), retPtr);
+    }
+
+    /**
+     * Remove a referent from the hash table, choosing among the referents
+     * stored under its key with a matcher.
+     * \param[in] key1
+     *      The first 64 bits of the key.
+     * \param[in] key2
+     *      The second 64 bits of the key.
+     * \param[in] matches
+     *      Called with each referent stored under the key; returns whether
+     *      it is the one to remove.
+     * \param[out] retPtr
+     *      If not NULL, return the address of the referent
+     *      removed here.
+     * \return
+     *      Whether the hash table contained a matching referent.
+     */
+    template<typename Matches>
+    bool
+    remove(uint64_t key1, uint64_t key2, const Matches& matches,
+           T* retPtr = NULL)
     {
         uint64_t secondaryHash;
         Entry *entry;
         CacheLine *bucket = findBucket(key1, key2, &secondaryHash);
-        entry = lookupEntry(bucket, secondaryHash, key1, key2);
+        entry = lookupEntry(bucket, secondaryHash, key1, key2, matches);
         if (entry == NULL)
             return false;
         T p = entry->getReferent();
         if (retPtr != NULL)
             *retPtr = p;
         entry->clear();
+        __sync_sub_and_fetch(&numEntries, 1);
         return true;
     }
 
@@ -342,12 +740,34 @@ class HashTable {
      */
     bool
     replace(T ptr, T* retPtr = NULL)
+    {
+        return replace(ptr, AnyReferent(), retPtr);
+    }
+
+    /**
+     * Update the referent corresponding to a key in the hash table, choosing
+     * among the referents stored under the key with a matcher. If none
+     * matches, the new referent is added alongside them.
+     * \param[in] ptr
+     *      The address of the new referent.
+     * \param[in] matches
+     *      Called with each referent stored under the key; returns whether
+     *      it is the one \a ptr takes the place of.
+     * \param[out] retPtr
+     *      If not NULL, return the address of the referent
+     *      replaced here. If nothing was replaced, the pointer
+     *      returned is undefined.
+     * \return
+     *      Whether a matching referent was replaced.
+     */
+    template<typename Matches>
+    bool
+    replace(T ptr, const Matches& matches, T* retPtr = NULL)
     {
         CycleCounter<> cycles(&perfCounters.replaceCycles);
         uint64_t secondaryHash;
         CacheLine *bucket;
         Entry *entry;
-        unsigned int i;
 
         ++perfCounters.replaceCalls;
 
@@ -355,40 +775,18 @@ class HashTable {
         uint64_t key2 = ptr->key2();
 
         bucket = findBucket(key1, key2, &secondaryHash);
-        entry = lookupEntry(bucket, secondaryHash, key1, key2);
+        entry = lookupEntry(bucket, secondaryHash, key1, key2, matches);
         if (entry != NULL) {
             T p = entry->getReferent();
             if (retPtr != NULL)
                 *retPtr = p;
-            entry->setReferent(secondaryHash, ptr);
+            entry->setReferent(secondaryHash, ptr, entry->isReferenced());
             return true;
         }
 
-        CacheLine *cl = bucket;
-        while (1) {
-            entry = cl->entries;
-            for (i = 0; i < ENTRIES_PER_CACHE_LINE; i++) {
-                if (entry->isAvailable()) {
-                    entry->setReferent(secondaryHash, ptr);
-                    return false;
-                }
-                entry++;
-            }
-
-            Entry &last = cl->entries[ENTRIES_PER_CACHE_LINE - 1];
-            cl = last.getChainPointer();
-            if (cl == NULL) {
-                // no empty space found, allocate a new cache line
-                void *buf = Memory::xmemalign(HERE, sizeof(CacheLine),
-                                              sizeof(CacheLine));
-                cl = static_cast<CacheLine *>(buf);
-                cl->entries[0] = last;
-                for (i = 1; i < ENTRIES_PER_CACHE_LINE; i++)
-                    cl->entries[i].clear();
-                last.setChainPointer(cl);
-            }
-            ++perfCounters.insertChainsFollowed;
-        }
+        insertEntry(bucket, secondaryHash, ptr);
+        __sync_add_and_fetch(&numEntries, 1);
+        return false;
     }
 
     /**
@@ -400,6 +798,8 @@ class HashTable {
      *      An opaque parameter to pass to the callback function.
      * \param bucket
      *      An index into the HashTable's buckets.  Must be < #numBuckets.
+     *      If the table grows between calls, entries in buckets that were
+     *      already visited may be visited again under their new index.
      * \return
      *      The total number of callbacks fired (i.e. the number of referents
      *      in the HashTable).
@@ -409,24 +809,15 @@ class HashTable {
                     void *cookie,
                     uint64_t bucket)
     {
-        uint64_t numCalls = 0;
-        CacheLine *cl = &buckets.get()[bucket];
-        while (1) {
-            for (uint32_t j = 0; j < ENTRIES_PER_CACHE_LINE; j++) {
-                Entry *e = &cl->entries[j];
-                if (!e->isAvailable() &&
-                    e->getChainPointer() == NULL) {
-                    T ptr = e->getReferent();
-                    callback(ptr, cookie);
-                    numCalls++;
-                }
-            }
+        if (bucket >= rehashIndex)
+            return forEachInChain(callback, cookie, &buckets.get()[bucket]);
 
-            Entry *entry = &cl->entries[ENTRIES_PER_CACHE_LINE - 1];
-            cl = entry->getChainPointer();
-            if (cl == NULL)
-                break;
-        }
+        // This bucket has been split across the new bucket array by an
+        // ongoing resize.
+        uint64_t numCalls = 0;
+        for (uint64_t i = bucket; i < nextNumBuckets; i += numBuckets)
+            numCalls += forEachInChain(callback, cookie,
+                                       &nextBuckets->get()[i]);
         return numCalls;
     }
 
@@ -473,8 +864,11 @@ class HashTable {
 
         // Scan this cache line. If the secondaryHash matches, prefetch.
         // If not, don't bother following any chain pointer.
-        Entry *candidate = cl->entries;
-        for (uint32_t i = 0; i < ENTRIES_PER_CACHE_LINE; i++, candidate++) {
+        uint32_t candidates = matchCandidates(cl, secondaryHash);
+        while (candidates != 0) {
+            Entry *candidate =
+                &cl->entries[BitOps::findFirstSet(candidates) - 1];
+            candidates &= candidates - 1;
             if (candidate->hashMatches(secondaryHash)) {
                 prefetch(candidate->getReferent(),
                          64 /* not really sure how many bytes to prefetch */);
@@ -523,102 +917,656 @@ class HashTable {
     }
 
     /**
-     * Returns the number of buckets allocated to the table.
+     * Choose how lookups scan a cache line: with SSE2, comparing the
+     * secondary hash bits of all of its entries at once, or one entry at a
+     * time. SSE2 is used by default if the processor has it; this exists
+     * so that benchmarks and tests can compare the two.
+     * \param enable
+     *      Whether to use SSE2. Ignored if the processor doesn't have it.
      */
-    uint64_t
-    getNumBuckets() const
+    void
+    setSimdLookups(bool enable)
     {
-        return numBuckets;
+        simdLookups = enable && haveSimd;
     }
 
-  PRIVATE:
-
-    // forward declarations
-    class Entry;
-    struct CacheLine;
+    /**
+     * Return whether lookups scan cache lines with SSE2.
+     * See #setSimdLookups().
+     */
+    bool
+    getSimdLookups() const
+    {
+        return simdLookups;
+    }
 
     /**
-     * A 64-bit to 64-bit hash function.
-     * This is a helper to #findBucket().
+     * Choose whether #lockFreeLookup() and #lockFreeLookupBatch() mark the
+     * entries they find as referenced. This is off by default, since it
+     * makes lookups write to the table.
+     * \param enable
+     *      Whether to mark entries.
      */
-    static uint64_t
-    hash(uint64_t key1, uint64_t key2)
+    void
+    setReferenceTracking(bool enable)
     {
-        uint64_t in[2] = { key1, key2 };
-        uint64_t out[2];
-        uint32_t seed = 0;
-        MurmurHash3_x64_128(in, sizeof(in), seed, &out);
-        return out[0];
+        referenceTracking = enable;
     }
 
     /**
-     * Find the bucket corresponding to a particular key.
-     * This also calculates the secondary hash bits used to disambiguate entries
-     * in the same bucket.
+     * Clear the referenced bit of a key's entry and return whether it was
+     * set, i.e. whether the referent has been found by a lock-free lookup
+     * since the last call (see #setReferenceTracking()). This is the test
+     * a CLOCK replacement policy makes as its hand passes each referent.
+     * The caller must hold the key's bucket lock.
      * \param[in] key1
      *      The first 64 bits of the key.
      * \param[in] key2
      *      The second 64 bits of the key.
-     * \param[out] secondaryHash
-     *      The secondary hash bits (16 bits).
      * \return
-     *      The bucket corresponding to the given referent ID.
+     *      Whether the entry was referenced. False if the table doesn't
+     *      contain the key.
      */
-    CacheLine *
-    findBucket(uint64_t key1, uint64_t key2,
-               uint64_t *secondaryHash) //const
+    bool
+    testAndClearReferenced(uint64_t key1, uint64_t key2)
     {
-        uint64_t hashValue = hash(key1, key2);
-        uint64_t bucketHash = hashValue & 0x0000ffffffffffffUL;
-        *secondaryHash = hashValue >> 48;
-        return &buckets.get()[bucketHash & (numBuckets - 1)];
-        // This is equivalent to:
-        //     &buckets.get()[bucketHash % numBuckets]
-        // since numBuckets is a power of two, and this saves about 14 cycles on
-        // an Intel Core 2 (see src/misc/modulus.cc).
+        return testAndClearReferenced(key1, key2, AnyReferent());
     }
 
     /**
-     * Find a hash table entry for a given key.
-     * This is used in #lookup(), #remove(), and #replace() to find the hash
-     * table entry to operate on.
-     * \param[in] bucket
-     *      The bucket corresponding to (key1, key2).
-     * \param[in] secondaryHash
-     *      Secondary hash bits for (key1, key2) as returned from #findBucket()
-     *      (16 bits).
+     * Clear the referenced bit of a referent's entry and return whether it
+     * was set, choosing among the referents stored under the key with a
+     * matcher. See #testAndClearReferenced(uint64_t, uint64_t).
      * \param[in] key1
      *      The first 64 bits of the key.
      * \param[in] key2
      *      The second 64 bits of the key.
+     * \param[in] matches
+     *      Called with each referent stored under the key; returns whether
+     *      it is the one wanted.
      * \return
-     *      The pointer to the hash table entry, or \a NULL if there is no such
-     *      hash table entry.
+     *      Whether the entry was referenced. False if the table doesn't
+     *      contain a matching referent.
      */
-    Entry *
-    lookupEntry(CacheLine *bucket, uint64_t secondaryHash,
-                uint64_t key1, uint64_t key2)
+    template<typename Matches>
+    bool
+    testAndClearReferenced(uint64_t key1, uint64_t key2,
+                           const Matches& matches)
     {
-        CycleCounter<> cycles(&perfCounters.lookupEntryCycles);
-        unsigned int i;
-
-        ++perfCounters.lookupEntryCalls;
-
-        CacheLine *cl = bucket;
+        uint64_t secondaryHash;
+        CacheLine *bucket = findBucket(key1, key2, &secondaryHash);
+        Entry *entry = lookupEntry(bucket, secondaryHash, key1, key2,
+                                   matches);
+        if (entry == NULL || !entry->isReferenced())
+            return false;
+        entry->clearReferenced();
+        return true;
+    }
+
+    /**
+     * Returns the number of buckets allocated to the table.
+     */
+    uint64_t
+    getNumBuckets() const
+    {
+        return numBuckets;
+    }
+
+    /**
+     * Returns the number of referents stored in the table.
+     */
+    uint64_t
+    getNumEntries() const
+    {
+        return numEntries;
+    }
+
+    /**
+     * Returns the number of overflow cache lines chained off of buckets.
+     * The average chain length in cache lines is
+     * (#getNumBuckets() + #getNumOverflowCacheLines()) / #getNumBuckets().
+     */
+    uint64_t
+    getNumOverflowCacheLines() const
+    {
+        return numOverflowLines;
+    }
+
+    /**
+     * Returns the fraction of the entries in the bucket array's cache lines
+     * that would be used if referents were spread evenly. Values close to
+     * or above 1.0 mean most buckets have overflowed into chained lines.
+     */
+    double
+    getLoadFactor() const
+    {
+        return static_cast<double>(numEntries) /
+               static_cast<double>(numBuckets * ENTRIES_PER_CACHE_LINE);
+    }
+
+    /**
+     * Returns whether a resize started with #startResize() is still
+     * migrating buckets.
+     */
+    bool
+    isResizing() const
+    {
+        return resizing;
+    }
+
+    /**
+     * Begin growing the table. This allocates the new bucket array; the
+     * buckets are then migrated by calls to #rehash(). Lookups and updates
+     * may continue while the resize is in progress. Only one thread may
+     * drive a resize (call this method, #rehash() or its parts, and
+     * #releaseRetiredBuckets()) at a time.
+     * \param newNumBuckets
+     *      The number of buckets in the grown table. This is rounded down
+     *      to a power of two and must be larger than #getNumBuckets().
+     * \throw FatalError
+     *      If the memory for the new buckets could not be allocated.
+     */
+    void
+    startResize(uint64_t newNumBuckets)
+    {
+        assert(!resizing);
+        newNumBuckets = BitOps::powerOfTwoLessOrEqual(newNumBuckets);
+        assert(newNumBuckets > numBuckets);
+
+        nextBuckets.destroy();
+        nextBuckets.construct(newNumBuckets * sizeof(CacheLine), placement);
+        nextNumBuckets = newNumBuckets;
+        resizing = true;
+
+        RAMCLOUD_LOG(NOTICE, "Growing HashTable from %lu to %lu buckets "
+                     "(%lu entries)", numBuckets, nextNumBuckets,
+                     getNumEntries());
+    }
+
+    /**
+     * Migrate buckets from the old bucket array to the new one during a
+     * resize, taking each bucket's lock while it is moved. Once the last
+     * bucket has moved, wait for lock-free readers and make the new array
+     * current, as #prepareToSwapBuckets() and #swapBuckets() do.
+     *
+     * The caller must ensure that nobody modifies the table without holding
+     * bucket locks while this runs.
+     * \param maxBuckets
+     *      Upper bound on the number of buckets to migrate in this call.
+     * \return
+     *      The number of buckets still to be migrated; 0 means the resize
+     *      is complete.
+     */
+    uint64_t
+    rehash(uint64_t maxBuckets)
+    {
+        uint64_t remaining = moveBuckets(maxBuckets);
+        if (remaining > 0)
+            return remaining;
+        prepareToSwapBuckets();
+        swapBuckets();
+        return 0;
+    }
+
+    /**
+     * Migrate buckets from the old bucket array to the new one during a
+     * resize, taking each bucket's lock while it is moved. This is the
+     * first part of #rehash(); once it returns 0, finish the resize with
+     * #prepareToSwapBuckets() and #swapBuckets().
+     *
+     * The caller must ensure that nobody modifies the table without holding
+     * bucket locks while this runs.
+     * \param maxBuckets
+     *      Upper bound on the number of buckets to migrate in this call.
+     * \return
+     *      The number of buckets still to be migrated.
+     */
+    uint64_t
+    moveBuckets(uint64_t maxBuckets)
+    {
+        assert(resizing);
+        for (uint64_t i = 0; i < maxBuckets && rehashIndex < numBuckets; i++) {
+            std::lock_guard<SpinLock> _(getBucketLockByIndex(rehashIndex));
+            beginResizeStep();
+            rehashBucket(rehashIndex);
+            rehashIndex++;
+            endResizeStep();
+        }
+        return numBuckets - rehashIndex;
+    }
+
+    /**
+     * Wait for lock-free readers that may be part way through reading
+     * #numBuckets and the bucket arrays, which are not updated atomically,
+     * so that #swapBuckets() may replace them. Readers that start later
+     * see an odd sequence number and take the bucket locks instead. This
+     * waits for a grace period, so the caller should hold none of its own
+     * locks and must not be inside an EpochManager::ReadGuard; the table
+     * may be used as usual meanwhile.
+     */
+    void
+    prepareToSwapBuckets()
+    {
+        assert(resizing && rehashIndex == numBuckets);
+        assert((resizeSequence & 1) == 0);
+        beginResizeStep();
+        EpochManager::synchronize();
+    }
+
+    /**
+     * Complete a resize by making the new bucket array current, holding
+     * every bucket lock. Must follow #prepareToSwapBuckets(), and the
+     * caller must ensure that nobody modifies the table without holding
+     * bucket locks while this runs.
+     */
+    void
+    swapBuckets()
+    {
+        assert(resizing && rehashIndex == numBuckets);
+        assert((resizeSequence & 1) == 1);
+        {
+            ExclusiveLock _(*this);
+            buckets.swap(*nextBuckets);
+            numBuckets = nextNumBuckets;
+            rehashIndex = 0;
+            resizing = false;
+        }
+        endResizeStep();
+    }
+
+    /**
+     * Free the bucket array replaced by the last completed resize, along
+     * with the overflow cache lines that were chained off of it. This is
+     * kept separate from #rehash() so that callers can unmap the (possibly
+     * large) old array without holding any of their own locks. It waits
+     * for a grace period first, so the caller must not be inside an
+     * EpochManager::ReadGuard.
+     */
+    void
+    releaseRetiredBuckets()
+    {
+        if (resizing || (!nextBuckets && retiredLines.empty()))
+            return;
+        EpochManager::synchronize();
+        nextBuckets.destroy();
+        foreach (CacheLine* cl, retiredLines)
+            free(cl);
+        retiredLines.clear();
+    }
+
+  PRIVATE:
+
+    // forward declarations
+    class Entry;
+    struct CacheLine;
+
+    /**
+     * A 64-bit to 64-bit hash function.
+     * This is a helper to #findBucket().
+     */
+    static uint64_t
+    hash(uint64_t key1, uint64_t key2)
+    {
+        uint64_t in[2] = { key1, key2 };
+        uint64_t out[2];
+        uint32_t seed = 0;
+        MurmurHash3_x64_128(in, sizeof(in), seed, &out);
+        return out[0];
+    }
+
+    /**
+     * Find the bucket corresponding to a particular key.
+     * This also calculates the secondary hash bits used to disambiguate entries
+     * in the same bucket.
+     * \param[in] key1
+     *      The first 64 bits of the key.
+     * \param[in] key2
+     *      The second 64 bits of the key.
+     * \param[out] secondaryHash
+     *      The secondary hash bits (15 bits).
+     * \return
+     *      The bucket corresponding to the given referent ID.
+     */
+    CacheLine *
+    findBucket(uint64_t key1, uint64_t key2,
+               uint64_t *secondaryHash) //const
+    {
+        uint64_t hashValue = hash(key1, key2);
+        uint64_t bucketHash = hashValue & 0x0000ffffffffffffUL;
+        *secondaryHash = (hashValue >> 48) & SECONDARY_HASH_MASK;
+        uint64_t bucket = bucketHash & (numBuckets - 1);
+        // This is equivalent to:
+        //     bucketHash % numBuckets
+        // since numBuckets is a power of two, and this saves about 14 cycles on
+        // an Intel Core 2 (see src/misc/modulus.cc).
+
+        if (bucket < rehashIndex) {
+            // This bucket has already been moved by an ongoing resize.
+            return &nextBuckets->get()[bucketHash & (nextNumBuckets - 1)];
+        }
+        return &buckets.get()[bucket];
+    }
+
+    /**
+     * Store a referent in the first free entry of a bucket, chaining a new
+     * cache line onto the bucket if it is full. This is a helper to
+     * #replace() and #rehashBucket(); the key must not already be present.
+     * \param[in] bucket
+     *      The bucket corresponding to the referent's key.
+     * \param[in] secondaryHash
+     *      Secondary hash bits for the referent's key (15 bits).
+     * \param[in] ptr
+     *      The address of the referent.
+     * \param[in] referenced
+     *      Whether to mark the new entry referenced.
+     */
+    void
+    insertEntry(CacheLine *bucket, uint64_t secondaryHash, T ptr,
+                bool referenced = false)
+    {
+        CacheLine *cl = bucket;
+        unsigned int i;
+        while (1) {
+            Entry *entry = cl->entries;
+            for (i = 0; i < ENTRIES_PER_CACHE_LINE; i++) {
+                if (entry->isAvailable()) {
+                    entry->setReferent(secondaryHash, ptr, referenced);
+                    return;
+                }
+                entry++;
+            }
+
+            Entry &last = cl->entries[ENTRIES_PER_CACHE_LINE - 1];
+            cl = last.getChainPointer();
+            if (cl == NULL) {
+                // no empty space found, allocate a new cache line
+                void *buf = Memory::xmemalign(HERE, sizeof(CacheLine),
+                                              sizeof(CacheLine));
+                cl = static_cast<CacheLine *>(buf);
+                cl->entries[0] = last;
+                for (i = 1; i < ENTRIES_PER_CACHE_LINE; i++)
+                    cl->entries[i].clear();
+                // Lock-free readers must never see the line before it's
+                // initialised.
+                Fence::sfence();
+                last.setChainPointer(cl);
+                __sync_add_and_fetch(&numOverflowLines, 1);
+            }
+            ++perfCounters.insertChainsFollowed;
+        }
+    }
+
+    /**
+     * Mark the start of a change that lock-free readers can't safely race
+     * with. This is a helper to #moveBuckets() and
+     * #prepareToSwapBuckets().
+     */
+    void
+    beginResizeStep()
+    {
+        resizeSequence = resizeSequence + 1;
+        // Readers that check the sequence after this must not see any of
+        // the changes that follow it without seeing the odd sequence, and
+        // EpochManager::synchronize() must not miss a reader that saw the
+        // old one.
+        __sync_synchronize();
+    }
+
+    /**
+     * Mark the end of a change started by #beginResizeStep().
+     */
+    void
+    endResizeStep()
+    {
+        Fence::sfence();
+        resizeSequence = resizeSequence + 1;
+    }
+
+    /**
+     * Move every referent in one bucket of the old bucket array into the
+     * new one and free the bucket's overflow cache lines. This is a helper
+     * to #moveBuckets(); the caller must hold the bucket's lock.
+     * \param[in] bucket
+     *      An index into the old bucket array. Must be #rehashIndex.
+     */
+    void
+    rehashBucket(uint64_t bucket)
+    {
+        CacheLine *first = &buckets.get()[bucket];
+        CacheLine *cl = first;
+        while (cl != NULL) {
+            CacheLine *next =
+                cl->entries[ENTRIES_PER_CACHE_LINE - 1].getChainPointer();
+            for (uint32_t i = 0; i < ENTRIES_PER_CACHE_LINE; i++) {
+                Entry *e = &cl->entries[i];
+                if (e->isAvailable() || e->getChainPointer() != NULL)
+                    continue;
+                T ptr = e->getReferent();
+                uint64_t hashValue = hash(ptr->key1(), ptr->key2());
+                uint64_t bucketHash = hashValue & 0x0000ffffffffffffUL;
+                insertEntry(&nextBuckets->get()[bucketHash &
+                                                (nextNumBuckets - 1)],
+                            (hashValue >> 48) & SECONDARY_HASH_MASK, ptr,
+                            e->isReferenced());
+                e->clear();
+            }
+            if (cl != first) {
+                // A lock-free reader may still be following the chain.
+                retiredLines.push_back(cl);
+                __sync_sub_and_fetch(&numOverflowLines, 1);
+            }
+            cl = next;
+        }
+        first->entries[ENTRIES_PER_CACHE_LINE - 1].clear();
+    }
 
+    /**
+     * Apply the given callback function to each referent in a chain of
+     * cache lines. This is a helper to #forEachInBucket().
+     * \param callback
+     *      The callback to fire on each referent.
+     * \param cookie
+     *      An opaque parameter to pass to the callback function.
+     * \param cl
+     *      The first cache line of the chain.
+     * \return
+     *      The number of callbacks fired.
+     */
+    uint64_t
+    forEachInChain(void (*callback)(T, void *), void *cookie, CacheLine *cl)
+    {
+        uint64_t numCalls = 0;
         while (1) {
+            for (uint32_t j = 0; j < ENTRIES_PER_CACHE_LINE; j++) {
+                Entry *e = &cl->entries[j];
+                if (!e->isAvailable() &&
+                    e->getChainPointer() == NULL) {
+                    T ptr = e->getReferent();
+                    callback(ptr, cookie);
+                    numCalls++;
+                }
+            }
+
+            Entry *entry = &cl->entries[ENTRIES_PER_CACHE_LINE - 1];
+            cl = entry->getChainPointer();
+            if (cl == NULL)
+                break;
+        }
+        return numCalls;
+    }
+
+    /**
+     * Do the work of #lookupBatch() for at most #MAX_BATCH_LOOKUPS keys.
+     * \copydetails lookupBatch
+     * \param[in] matches
+     *      The matcher for each key, or NULL to accept any referent.
+     * \param[in] markReferenced
+     *      Whether to mark the entries found as referenced.
+     */
+    template<typename Matches>
+    void
+    lookupGroup(uint32_t count, const uint64_t key1s[],
+                const uint64_t key2s[], const Matches matches[],
+                T referents[], bool markReferenced)
+    {
+        CacheLine* buckets[MAX_BATCH_LOOKUPS];
+        uint64_t secondaryHashes[MAX_BATCH_LOOKUPS];
+
+        for (uint32_t i = 0; i < count; i++) {
+            buckets[i] = findBucket(key1s[i], key2s[i], &secondaryHashes[i]);
+            prefetch(buckets[i]);
+        }
+
+        // By now the first buckets have arrived. Only the first cache line
+        // of each bucket is scanned here, as in #prefetchReferent().
+        for (uint32_t i = 0; i < count; i++) {
+            CacheLine* cl = buckets[i];
+            uint32_t candidates = matchCandidates(cl, secondaryHashes[i]);
+            while (candidates != 0) {
+                Entry *candidate =
+                    &cl->entries[BitOps::findFirstSet(candidates) - 1];
+                candidates &= candidates - 1;
+                if (candidate->hashMatches(secondaryHashes[i])) {
+                    prefetch(candidate->getReferent(), 64);
+                    break;
+                }
+            }
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            Entry* entry;
+            if (matches == NULL) {
+                entry = lookupEntry(buckets[i], secondaryHashes[i], key1s[i],
+                                    key2s[i], AnyReferent(), &referents[i],
+                                    markReferenced);
+            } else {
+                entry = lookupEntry(buckets[i], secondaryHashes[i], key1s[i],
+                                    key2s[i], matches[i], &referents[i],
+                                    markReferenced);
+            }
+            if (entry == NULL)
+                referents[i] = NULL;
+        }
+    }
 
-            // Try this cache line.
-            Entry *candidate = cl->entries;
-            for (i = 0; i < ENTRIES_PER_CACHE_LINE; i++, candidate++) {
+    /**
+     * Find the entries of a cache line that might hold the referent for a
+     * key. This is a helper to #lookupEntry().
+     * \param[in] cl
+     *      The cache line to scan.
+     * \param[in] secondaryHash
+     *      Secondary hash bits for the key as returned from #findBucket()
+     *      (15 bits).
+     * \return
+     *      A bitmask with bit i set if entry i is a candidate. Candidates
+     *      must still be checked with Entry::hashMatches(): an unused entry
+     *      may pass for one with a secondary hash of 0, and the entries
+     *      may change underneath a lock-free reader.
+     */
+    uint32_t
+    matchCandidates(const CacheLine *cl, uint64_t secondaryHash) const
+    {
+#if __SSE2__
+        if (simdLookups) {
+            static_assert(ENTRIES_PER_CACHE_LINE == 8,
+                          "matchCandidates assumes 8 entries per cache line");
+            // Below the referenced bit, the top 16 bits of an entry holding
+            // a referent are its secondary hash followed by a clear chain
+            // bit. Shift them to the bottom of each entry, mask off the
+            // referenced bit, and compare them for all entries at once;
+            // only the low 32-bit half of each entry matters.
+            const __m128i want = _mm_set1_epi32(
+                                    static_cast<int>(secondaryHash << 1));
+            const __m128i mask = _mm_set1_epi32(0xffff);
+            const __m128i* line = reinterpret_cast<const __m128i*>(
+                                                        cl->entries);
+            __m128i eq0 = _mm_cmpeq_epi32(_mm_and_si128(
+                _mm_srli_epi64(_mm_load_si128(line + 0), 47), mask), want);
+            __m128i eq1 = _mm_cmpeq_epi32(_mm_and_si128(
+                _mm_srli_epi64(_mm_load_si128(line + 1), 47), mask), want);
+            __m128i eq2 = _mm_cmpeq_epi32(_mm_and_si128(
+                _mm_srli_epi64(_mm_load_si128(line + 2), 47), mask), want);
+            __m128i eq3 = _mm_cmpeq_epi32(_mm_and_si128(
+                _mm_srli_epi64(_mm_load_si128(line + 3), 47), mask), want);
+            // Narrow the 32-bit results to bytes, in order, so that bit 2i
+            // of the mask is the result for entry i.
+            uint32_t matches = _mm_movemask_epi8(
+                _mm_packs_epi16(_mm_packs_epi32(eq0, eq1),
+                                _mm_packs_epi32(eq2, eq3)));
+            matches &= 0x5555;
+            matches = (matches | (matches >> 1)) & 0x3333;
+            matches = (matches | (matches >> 2)) & 0x0f0f;
+            matches = (matches | (matches >> 4)) & 0x00ff;
+            return matches;
+        }
+#endif
+        return (1U << ENTRIES_PER_CACHE_LINE) - 1;
+    }
+
+    /**
+     * Find a hash table entry for a given key.
+     * This is used in #lookup(), #remove(), and #replace() to find the hash
+     * table entry to operate on.
+     * \param[in] bucket
+     *      The bucket corresponding to (key1, key2).
+     * \param[in] secondaryHash
+     *      Secondary hash bits for (key1, key2) as returned from #findBucket()
+     *      (15 bits).
+     * \param[in] key1
+     *      The first 64 bits of the key.
+     * \param[in] key2
+     *      The second 64 bits of the key.
+     * \param[in] matches
+     *      Called with each referent stored under the key; returns whether
+     *      it is the one wanted.
+     * \param[out] referent
+     *      If not NULL and an entry is found, the referent it held when it
+     *      was examined. Unlike calling Entry::getReferent() on the result,
+     *      this is safe when the bucket lock is not held.
+     * \param[in] markReferenced
+     *      If true, mark the entry found as referenced.
+     * \return
+     *      The pointer to the hash table entry, or \a NULL if there is no such
+     *      hash table entry.
+     */
+    template<typename Matches>
+    Entry *
+    lookupEntry(CacheLine *bucket, uint64_t secondaryHash,
+                uint64_t key1, uint64_t key2, const Matches& matches,
+                T* referent = NULL, bool markReferenced = false)
+    {
+        CycleCounter<> cycles(&perfCounters.lookupEntryCycles);
+        unsigned int i;
+
+        ++perfCounters.lookupEntryCalls;
+
+        CacheLine *cl = bucket;
+
+        while (1) {
 
-                if (candidate->hashMatches(secondaryHash)) {
+            // Try the entries of this cache line that might match.
+            uint32_t candidates = matchCandidates(cl, secondaryHash);
+            while (candidates != 0) {
+                i = downCast<unsigned int>(
+                        BitOps::findFirstSet(candidates) - 1);
+                candidates &= candidates - 1;
+                Entry *candidate = &cl->entries[i];
+
+                // Examine a single snapshot of the entry, in case it is
+                // being changed underneath a lock-free reader.
+                Entry snapshot = candidate->load();
+                if (snapshot.hashMatches(secondaryHash)) {
                     // The hash within the hash table entry matches, so with
                     // high probability this is the pointer we're looking for.
                     // To check, we must go to the object.
-                    T c = candidate->getReferent();
-                    if (c->key1() == key1 && c->key2() == key2) {
+                    T c = snapshot.getReferent();
+                    if (c->key1() == key1 && c->key2() == key2 &&
+                        matches(c)) {
                         perfCounters.lookupEntryDist.storeSample(cycles.stop());
+                        if (referent != NULL)
+                            *referent = c;
+                        if (markReferenced && !snapshot.isReferenced())
+                            candidate->markReferenced(snapshot);
                         return candidate;
                     } else {
                         ++perfCounters.lookupEntryHashCollisions;
@@ -629,7 +1577,7 @@ class HashTable {
             // Not found in this cache line, see if there's a chain to another
             // cache line.
             Entry *entry = &cl->entries[ENTRIES_PER_CACHE_LINE - 1];
-            cl = entry->getChainPointer();
+            cl = entry->load().getChainPointer();
             if (cl == NULL) {
                 perfCounters.lookupEntryDist.storeSample(cycles.stop());
                 return NULL;
@@ -655,6 +1603,10 @@ class HashTable {
      *
      * A hash table entry can also be unused (see #clear() and #isAvailable()).
      * In this case, its pointer will be set to \c NULL.
+     *
+     * A normal entry also has a referenced bit for CLOCK replacement (see
+     * #isReferenced()). It is the only part of an entry that may be changed
+     * without holding the bucket lock.
      */
     class Entry {
 
@@ -667,21 +1619,38 @@ class HashTable {
         clear()
         {
             // the raw bytes of this Entry must be zero for memset, etc to work
-            value = 0;
+            store(0);
+        }
+
+        /**
+         * Return a copy of this hash table entry read with a single memory
+         * access, so that its fields are consistent even if another thread
+         * is updating the entry.
+         * \return
+         *      See above.
+         */
+        Entry
+        load() const
+        {
+            Entry e;
+            e.value = *const_cast<const volatile uint64_t*>(&value);
+            return e;
         }
 
         /**
          * Reinitialize a regular hash table entry.
          * \param[in] hash
-         *      The secondary hash bits computed from the key (16 bits).
+         *      The secondary hash bits computed from the key (15 bits).
          * \param[in] ptr
          *      The address of the referent. Must not be \c NULL.
+         * \param[in] referenced
+         *      The initial value of the referenced bit.
          */
         void
-        setReferent(uint64_t hash, T ptr)
+        setReferent(uint64_t hash, T ptr, bool referenced = false)
         {
             assert(ptr != NULL);
-            pack(hash, false, reinterpret_cast<uint64_t>(ptr));
+            pack(hash, false, reinterpret_cast<uint64_t>(ptr), referenced);
         }
 
         /**
@@ -741,7 +1710,7 @@ class HashTable {
         /**
          * Check whether the secondary hash bits stored match those given.
          * \param[in] hash
-         *      The secondary hash bits computed from the key to test (16 bits).
+         *      The secondary hash bits computed from the key to test (15 bits).
          * \return
          *      Whether the hash table entry holds the address to a referent and
          *      the secondary hash bits for that referent point to \a hash.
@@ -753,12 +1722,46 @@ class HashTable {
             return (!ue.chain && ue.ptr != 0 && ue.hash == hash);
         }
 
+        /**
+         * Return whether the referenced bit is set.
+         */
+        bool
+        isReferenced() const
+        {
+            return unpack().referenced;
+        }
+
+        /**
+         * Set the referenced bit, unless the entry has changed since
+         * \a snapshot was taken of it. This is safe to call without holding
+         * the bucket lock.
+         * \param[in] snapshot
+         *      A copy of this entry returned by #load().
+         */
+        void
+        markReferenced(Entry snapshot)
+        {
+            __sync_bool_compare_and_swap(&value, snapshot.value,
+                                         snapshot.value | REFERENCED_BIT);
+        }
+
+        /**
+         * Clear the referenced bit.
+         */
+        void
+        clearReferenced()
+        {
+            UnpackedEntry ue = unpack();
+            pack(ue.hash, ue.chain, ue.ptr, false);
+        }
+
       PRIVATE:
         /**
          * The packed value stored in the entry.
          *
          * The exact bits are, from MSB to LSB:
-         * \li 16 bits for the secondary hash
+         * \li 1 bit for whether the referent has been referenced
+         * \li 15 bits for the secondary hash
          * \li 1 bit for whether the pointer is a chain
          * \li 47 bits for the pointer
          *
@@ -773,7 +1776,7 @@ class HashTable {
         /**
          * Replace this hash table entry.
          * \param[in] hash
-         *      The secondary hash bits (16 bits) computed from the key.
+         *      The secondary hash bits (15 bits) computed from the key.
          *      Irrelevant if \a chain is true.
          * \param[in] chain
          *      Whether \a ptr is a chain pointer as opposed to a referent
@@ -781,12 +1784,15 @@ class HashTable {
          * \param[in] ptr
          *      The chain pointer to the next cache line or the referent pointer
          *      (determined by \a chain).
+         * \param[in] referenced
+         *      Whether to set the referenced bit. Must be false unless
+         *      \a ptr is a referent pointer.
          * \throw Exception
          *      An exception is thrown if the pointer cannot fix in the number
          *      of bits we have.
          */
         void
-        pack(uint64_t hash, bool chain, uint64_t ptr)
+        pack(uint64_t hash, bool chain, uint64_t ptr, bool referenced = false)
         {
             if (ptr == 0)
                 assert(hash == 0 && !chain);
@@ -799,8 +1805,22 @@ class HashTable {
             }
 
             uint64_t c = chain ? 1 : 0;
-            assert((hash & ~(0x000000000000ffffUL)) == 0);
-            this->value = ((hash << 48)  | (c << 47) | ptr);
+            uint64_t r = referenced ? 1 : 0;
+            assert((hash & ~(0x0000000000007fffUL)) == 0);
+            assert(r == 0 || (c == 0 && ptr != 0));
+            store((r << 63) | (hash << 48)  | (c << 47) | ptr);
+        }
+
+        /**
+         * Overwrite the packed value with a single memory access, so that
+         * lock-free readers see either the old entry or the new one.
+         * \param newValue
+         *      The new packed value.
+         */
+        void
+        store(uint64_t newValue)
+        {
+            *const_cast<volatile uint64_t*>(&value) = newValue;
         }
 
         /**
@@ -811,6 +1831,7 @@ class HashTable {
             uint64_t hash;
             bool chain;
             uint64_t ptr;
+            bool referenced;
         };
 
         /**
@@ -822,11 +1843,17 @@ class HashTable {
         unpack() const
         {
             UnpackedEntry ue;
-            ue.hash  = (this->value >> 48) & 0x000000000000ffffUL;
+            ue.referenced = (this->value >> 63) & 0x0000000000000001UL;
+            ue.hash  = (this->value >> 48) & 0x0000000000007fffUL;
             ue.chain = (this->value >> 47) & 0x0000000000000001UL;
             ue.ptr   = this->value         & 0x00007fffffffffffUL;
             return ue;
         }
+
+        /**
+         * The referenced bit within #value.
+         */
+        static const uint64_t REFERENCED_BIT = 1UL << 63;
     };
     static_assert(sizeof(Entry) == 8, "HashTable::Entry is not 8 bytes");
 
@@ -866,9 +1893,15 @@ class HashTable {
                   "HashTable entries don't fit evenly into a cacheline");
 
     /**
-     * The number of buckets allocated to the table.
+     * The number of buckets allocated to the table. While a resize is in
+     * progress this is the size of the old bucket array.
      */
-    const uint64_t numBuckets;
+    uint64_t numBuckets;
+
+    /**
+     * Where the memory for #buckets and #nextBuckets comes from.
+     */
+    MemoryPlacement placement;
 
     /**
      * The array of buckets.
@@ -876,16 +1909,134 @@ class HashTable {
      */
     LargeBlockOfMemory<CacheLine> buckets;
 
+    /**
+     * While a resize is in progress, the bucket array being migrated into.
+     * After a resize completes, this holds the retired bucket array until
+     * #releaseRetiredBuckets() is called.
+     */
+    Tub<LargeBlockOfMemory<CacheLine>> nextBuckets;
+
+    /**
+     * The number of buckets in #nextBuckets.
+     */
+    uint64_t nextNumBuckets;
+
+    /**
+     * Buckets of #buckets with an index below this have already been moved
+     * to #nextBuckets by an ongoing resize. Only modified while holding the
+     * lock for bucket #rehashIndex, so a caller holding the lock for any
+     * bucket sees a consistent value for that bucket. Zero when no resize
+     * is in progress.
+     */
+    uint64_t rehashIndex;
+
+    /**
+     * True between #startResize() and the #swapBuckets() call that
+     * completes it.
+     */
+    bool resizing;
+
+    /**
+     * Odd while #moveBuckets() is moving a bucket, or from
+     * #prepareToSwapBuckets() until #swapBuckets() has swapped in the new
+     * bucket array, and incremented again when it's done. #lockFreeLookup() uses
+     * this to detect that it may have raced with a resize.
+     */
+    volatile uint64_t resizeSequence;
+
+    /**
+     * Overflow cache lines unlinked by #rehashBucket() that lock-free
+     * readers may still be traversing. Freed by #releaseRetiredBuckets().
+     */
+    std::vector<CacheLine*> retiredLines;
+
+    /**
+     * The number of referents currently stored. Updated atomically.
+     */
+    uint64_t numEntries;
+
+    /**
+     * The number of overflow cache lines currently chained off of buckets.
+     * Updated atomically.
+     */
+    uint64_t numOverflowLines;
+
+    /**
+     * Upper bound on the number of locks striped across the buckets.
+     * See #getBucketLock().
+     */
+    static const uint64_t MAX_BUCKET_LOCKS = 1024;
+
+    /**
+     * The largest number of keys #lookupBatch() pipelines together. Larger
+     * batches are looked up in groups of this many.
+     */
+    static const uint32_t MAX_BATCH_LOOKUPS = 64;
+
+    /**
+     * Selects the secondary hash bits of a key from bits 48 and up of its
+     * #hash(). One bit fewer than is left over is used, to make room for
+     * each entry's referenced bit.
+     */
+    static const uint64_t SECONDARY_HASH_MASK = 0x7fff;
+
+    /**
+     * The number of locks in #bucketLocks: a power of two no larger than
+     * #numBuckets, so that every key in a bucket maps to the same lock.
+     */
+    const uint64_t numBucketLocks;
+
+    /**
+     * Locks guarding the buckets. Bucket i is protected by
+     * bucketLocks[i % numBucketLocks].
+     */
+    std::unique_ptr<SpinLock[]> bucketLocks;
+
     /**
      * The performance counters for the HashTable.
      * See #getPerfCounters().
      */
     PerfCounters perfCounters;
 
+    /**
+     * Whether #matchCandidates() uses SSE2. See #setSimdLookups().
+     */
+    bool simdLookups;
+
+    /**
+     * Whether lock-free lookups mark the entries they find as referenced.
+     * See #setReferenceTracking().
+     */
+    bool referenceTracking;
+
+    /**
+     * Whether this machine has SSE2 and this code was compiled to use it.
+     * Checked once at startup.
+     */
+    static bool haveSimd;
+
+    /**
+     * Determine the initial value of #haveSimd.
+     */
+    static bool
+    detectSimd()
+    {
+#if __SSE2__
+        uint32_t a, b, c, d;
+        __asm__("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "0" (1));
+        return (d & (1 << 26)) != 0;
+#else
+        return false;
+#endif
+    }
+
     friend void hashTableBenchmark(uint64_t nkeys, uint64_t nlines);
     DISALLOW_COPY_AND_ASSIGN(HashTable);
 };
 
+template<typename T>
+bool HashTable<T>::haveSimd = HashTable<T>::detectSimd();
+
 
 } // namespace RAMCloud
 
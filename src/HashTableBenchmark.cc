@@ -19,10 +19,14 @@
  */
 
 #include <math.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
 
 #include "Common.h"
 #include "Context.h"
 #include "Cycles.h"
+#include "Fence.h"
 #include "HashTable.h"
 #include "Memory.h"
 #include "OptionParser.h"
@@ -133,6 +137,51 @@ hashTableBenchmark(uint64_t nkeys, uint64_t nlines)
            pc.lookupEntryDist.max,
            Cycles::toNanoseconds(pc.lookupEntryDist.max));
 
+    // repeat the lookups comparing one entry at a time, for comparison
+    if (ht.getSimdLookups()) {
+        ht.setSimdLookups(false);
+        ht.resetPerfCounters();
+        lookupCycles = Cycles::rdtsc();
+        for (i = 0; i < nkeys; i++) {
+            TestObject *p = ht.lookup(0, i);
+            assert(p != NULL);
+        }
+        i = Cycles::rdtsc() - lookupCycles;
+        ht.setSimdLookups(true);
+
+        printf("== lookup() without SSE2 ==\n");
+
+        printf("    external avg: %lu ticks, %lu nsec\n", i / nkeys,
+            Cycles::toNanoseconds(i / nkeys));
+
+        printf("    internal avg: %lu ticks, %lu nsec\n",
+               pc.lookupEntryCycles / nkeys,
+               Cycles::toNanoseconds(pc.lookupEntryCycles / nkeys));
+    }
+
+    // repeat the lookups a batch at a time, for batches of 1 to 64 keys
+    printf("== lookupBatch() ==\n");
+    const uint32_t maxBatch = 64;
+    uint64_t key1s[maxBatch];
+    uint64_t key2s[maxBatch];
+    TestObject* referents[maxBatch];
+    for (uint32_t batch = 1; batch <= maxBatch; batch *= 2) {
+        lookupCycles = Cycles::rdtsc();
+        for (i = 0; i < nkeys; i += batch) {
+            uint32_t n = downCast<uint32_t>(std::min(uint64_t(batch),
+                                                     nkeys - i));
+            for (uint32_t j = 0; j < n; j++) {
+                key1s[j] = 0;
+                key2s[j] = i + j;
+            }
+            ht.lookupBatch(n, key1s, key2s, referents);
+            assert(referents[n - 1] != NULL);
+        }
+        uint64_t ticks = Cycles::rdtsc() - lookupCycles;
+        printf("    batch of %2u: %lu ticks, %lu nsec per key\n", batch,
+               ticks / nkeys, Cycles::toNanoseconds(ticks / nkeys));
+    }
+
     uint64_t *histogram = static_cast<uint64_t *>(
         Memory::xmalloc(HERE, nlines * sizeof(histogram[0])));
     memset(histogram, 0, sizeof(nlines * sizeof(histogram[0])));
@@ -202,6 +251,140 @@ hashTableBenchmark(uint64_t nkeys, uint64_t nlines)
     }
 }
 
+/**
+ * Print latency percentiles for a set of operations.
+ * \param name
+ *      Label for this set of samples.
+ * \param ticks
+ *      Latency of each operation, in cycles. This is sorted in place.
+ */
+void
+printLatencies(const char* name, std::vector<uint64_t>& ticks)
+{
+    if (ticks.empty()) {
+        printf("    %-14s no samples\n", name);
+        return;
+    }
+    std::sort(ticks.begin(), ticks.end());
+    size_t n = ticks.size();
+    printf("    %-14s %9lu ops  p50 %6lu  p99 %6lu  p99.9 %6lu  "
+           "max %8lu nsec\n", name, n,
+           Cycles::toNanoseconds(ticks[n / 2]),
+           Cycles::toNanoseconds(ticks[n * 99 / 100]),
+           Cycles::toNanoseconds(ticks[n * 999 / 1000]),
+           Cycles::toNanoseconds(ticks[n - 1]));
+}
+
+/// Shared state between hashTableGrowthBenchmark() and its resizer thread.
+struct GrowthResizer {
+    explicit GrowthResizer(TestObjectMap& ht)
+        : ht(ht), shouldExit(false), resizes(0), resizeTicks(0) {}
+    TestObjectMap& ht;
+    bool shouldExit;
+    uint64_t resizes;
+    uint64_t resizeTicks;
+    DISALLOW_COPY_AND_ASSIGN(GrowthResizer);
+};
+
+/**
+ * Grows the table in the background the same way the master's resizer
+ * thread does: double once the load factor exceeds 1.0, then migrate a
+ * few buckets at a time.
+ */
+void
+growthResizerThread(GrowthResizer* r)
+{
+    while (1) {
+        Fence::lfence();
+        if (r->shouldExit)
+            break;
+        if (r->ht.isResizing()) {
+            uint64_t start = Cycles::rdtsc();
+            r->ht.rehash(16);
+            r->resizeTicks += Cycles::rdtsc() - start;
+        } else if (r->ht.getLoadFactor() > 1.0) {
+            r->ht.releaseRetiredBuckets();
+            r->ht.startResize(2 * r->ht.getNumBuckets());
+            r->resizes++;
+        }
+    }
+    r->ht.releaseRetiredBuckets();
+}
+
+/**
+ * Insert keys into a table that starts out small and is grown online by a
+ * background thread, and compare the latency of inserts and lookups
+ * issued while a resize is in progress with those issued while it is not.
+ * Like the master, every operation holds the bucket lock for its key.
+ */
+void
+hashTableGrowthBenchmark(uint64_t nkeys, uint64_t nlines)
+{
+    TestObjectMap ht(nlines);
+    std::vector<TestObject*> values;
+    values.reserve(nkeys);
+    std::vector<uint64_t> steady[2], resizing[2];
+    for (int i = 0; i < 2; i++) {
+        steady[i].reserve(nkeys);
+        resizing[i].reserve(nkeys);
+    }
+
+    printf("hash table keys: %lu\n", nkeys);
+    printf("initial hash table lines: %lu\n", ht.getNumBuckets());
+    printf("running growth measurements...");
+    fflush(stdout);
+
+    GrowthResizer resizer(ht);
+    std::thread thread(growthResizerThread, &resizer);
+
+    uint64_t seed = 1;
+    for (uint64_t i = 0; i < nkeys; i++) {
+        values.push_back(new TestObject(0, i));
+
+        bool wasResizing = ht.isResizing();
+        uint64_t start = Cycles::rdtsc();
+        {
+            std::lock_guard<SpinLock> _(ht.getBucketLock(0, i));
+            ht.replace(values[i]);
+        }
+        uint64_t ticks = Cycles::rdtsc() - start;
+        (wasResizing ? resizing[0] : steady[0]).push_back(ticks);
+
+        // Cheap LCG so we don't measure the cost of random().
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        uint64_t key = (seed >> 33) % (i + 1);
+        wasResizing = ht.isResizing();
+        start = Cycles::rdtsc();
+        {
+            std::lock_guard<SpinLock> _(ht.getBucketLock(0, key));
+            TestObject* p = ht.lookup(0, key);
+            assert(p == values[key]);
+        }
+        ticks = Cycles::rdtsc() - start;
+        (wasResizing ? resizing[1] : steady[1]).push_back(ticks);
+    }
+
+    resizer.shouldExit = true;
+    Fence::sfence();
+    thread.join();
+    printf("done!\n");
+
+    printf("final hash table lines: %lu (%lu resizes, %lu msec migrating)\n",
+           ht.getNumBuckets(), resizer.resizes,
+           Cycles::toNanoseconds(resizer.resizeTicks) / 1000000);
+    printf("load factor: %.03f, overflow lines: %lu\n",
+           ht.getLoadFactor(), ht.getNumOverflowCacheLines());
+    printf("== replace() ==\n");
+    printLatencies("steady:", steady[0]);
+    printLatencies("resizing:", resizing[0]);
+    printf("== lookup() ==\n");
+    printLatencies("steady:", steady[1]);
+    printLatencies("resizing:", resizing[1]);
+
+    foreach (TestObject* value, values)
+        delete value;
+}
+
 } // namespace RAMCloud
 
 int
@@ -214,6 +397,7 @@ main(int argc, char **argv)
 
     uint64_t hashTableMegs, numberOfKeys;
     double loadFactor;
+    bool growth;
 
     OptionsDescription benchmarkOptions("HashTableBenchmark");
     benchmarkOptions.add_options()
@@ -228,7 +412,11 @@ main(int argc, char **argv)
         ("NumberOfKeys,n",
          ProgramOptions::value<uint64_t>(&numberOfKeys)->
             default_value(0),
-         "Number of keys to insert into the HashTable (overrides LoadFactor)");
+         "Number of keys to insert into the HashTable (overrides LoadFactor)")
+        ("Growth,g",
+         ProgramOptions::bool_switch(&growth),
+         "Start with a HashTable of HashTableMegs and measure operation "
+         "latency while it grows online to hold NumberOfKeys keys");
 
     OptionParser optionParser(benchmarkOptions, argc, argv);
 
@@ -244,6 +432,9 @@ main(int argc, char **argv)
                           static_cast<double>(totalEntries));
     }
 
-    hashTableBenchmark(numberOfKeys, numberOfCachelines);
+    if (growth)
+        hashTableGrowthBenchmark(numberOfKeys, numberOfCachelines);
+    else
+        hashTableBenchmark(numberOfKeys, numberOfCachelines);
     return 0;
 }
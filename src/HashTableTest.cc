@@ -15,6 +15,7 @@
 
 #include "TestUtil.h"
 
+#include "AtomicInt.h"
 #include "HashTable.h"
 
 namespace RAMCloud {
@@ -97,11 +98,13 @@ class HashTableEntryTest : public ::testing::Test {
      *      See #HashTable::Entry::pack().
      * \param ptr
      *      See #HashTable::Entry::pack().
+     * \param referenced
+     *      See #HashTable::Entry::pack().
      * \return
      *      Whether the fields out of #HashTable::Entry::unpack() are the same.
      */
     static bool
-    packable(uint64_t hash, bool chain, uint64_t ptr)
+    packable(uint64_t hash, bool chain, uint64_t ptr, bool referenced = false)
     {
         TestObjectMap::Entry e;
 
@@ -111,13 +114,15 @@ class HashTableEntryTest : public ::testing::Test {
         in.hash = hash;
         in.chain = chain;
         in.ptr = ptr;
+        in.referenced = referenced;
 
-        e.pack(in.hash, in.chain, in.ptr);
+        e.pack(in.hash, in.chain, in.ptr, in.referenced);
         out = e.unpack();
 
         return (in.hash == out.hash &&
                 in.chain == out.chain &&
-                in.ptr == out.ptr);
+                in.ptr == out.ptr &&
+                in.referenced == out.referenced);
     }
     DISALLOW_COPY_AND_ASSIGN(HashTableEntryTest);
 };
@@ -130,9 +135,11 @@ TEST_F(HashTableEntryTest, size) {
 TEST_F(HashTableEntryTest, pack) {
     // first without normal cases
     EXPECT_TRUE(packable(0x0000UL, false, 0x000000000000UL));
-    EXPECT_TRUE(packable(0xffffUL, true,  0x7fffffffffffUL));
-    EXPECT_TRUE(packable(0xffffUL, false, 0x7fffffffffffUL));
-    EXPECT_TRUE(packable(0xa257UL, false, 0x3cdeadbeef98UL));
+    EXPECT_TRUE(packable(0x7fffUL, true,  0x7fffffffffffUL));
+    EXPECT_TRUE(packable(0x7fffUL, false, 0x7fffffffffffUL));
+    EXPECT_TRUE(packable(0x7fffUL, false, 0x7fffffffffffUL, true));
+    EXPECT_TRUE(packable(0x2257UL, false, 0x3cdeadbeef98UL));
+    EXPECT_TRUE(packable(0x2257UL, false, 0x3cdeadbeef98UL, true));
 
     // and now test the exception cases of pack()
     TestObjectMap::Entry e;
@@ -165,13 +172,18 @@ TEST_F(HashTableEntryTest, trivial_clear) {
 TEST_F(HashTableEntryTest, setReferent) {
     TestObjectMap::Entry e;
     e.value = 0xdeadbeefdeadbeefUL;
-    e.setReferent(0xaaaaUL, reinterpret_cast<TestObject*>(
+    e.setReferent(0x2aaaUL, reinterpret_cast<TestObject*>(
         0x7fffffffffffUL));
     TestObjectMap::Entry::UnpackedEntry out;
     out = e.unpack();
-    EXPECT_EQ(0xaaaaUL, out.hash);
+    EXPECT_EQ(0x2aaaUL, out.hash);
     EXPECT_FALSE(out.chain);
     EXPECT_EQ(0x7fffffffffffUL, out.ptr);
+    EXPECT_FALSE(out.referenced);
+
+    e.setReferent(0x2aaaUL, reinterpret_cast<TestObject*>(
+        0x7fffffffffffUL), true);
+    EXPECT_TRUE(e.unpack().referenced);
 }
 
 TEST_F(HashTableEntryTest, setChainPointer) {
@@ -207,7 +219,7 @@ TEST_F(HashTableEntryTest, getReferent) {
     TestObjectMap::Entry e;
     TestObject *o =
         reinterpret_cast<TestObject*>(0x7fffffffffffUL);
-    e.setReferent(0xaaaaUL, o);
+    e.setReferent(0x2aaaUL, o, true);
     EXPECT_EQ(o, e.getReferent());
 }
 
@@ -232,11 +244,39 @@ TEST_F(HashTableEntryTest, hashMatches) {
     EXPECT_TRUE(!e.hashMatches(0UL));
     e.setReferent(0UL, reinterpret_cast<TestObject*>(0x1UL));
     EXPECT_TRUE(e.hashMatches(0UL));
-    EXPECT_TRUE(!e.hashMatches(0xbeefUL));
-    e.setReferent(0xbeefUL, reinterpret_cast<TestObject*>(0x1UL));
+    EXPECT_TRUE(!e.hashMatches(0x3eefUL));
+    e.setReferent(0x3eefUL, reinterpret_cast<TestObject*>(0x1UL));
     EXPECT_TRUE(!e.hashMatches(0UL));
-    EXPECT_TRUE(e.hashMatches(0xbeefUL));
-    EXPECT_TRUE(!e.hashMatches(0xfeedUL));
+    EXPECT_TRUE(e.hashMatches(0x3eefUL));
+    EXPECT_TRUE(!e.hashMatches(0x7eedUL));
+    e.setReferent(0x3eefUL, reinterpret_cast<TestObject*>(0x1UL), true);
+    EXPECT_TRUE(e.hashMatches(0x3eefUL));
+}
+
+TEST_F(HashTableEntryTest, markReferenced) {
+    TestObjectMap::Entry e;
+    e.setReferent(0x3eefUL, reinterpret_cast<TestObject*>(0x1UL));
+    EXPECT_FALSE(e.isReferenced());
+    TestObjectMap::Entry snapshot = e.load();
+    e.markReferenced(snapshot);
+    EXPECT_TRUE(e.isReferenced());
+    EXPECT_EQ(reinterpret_cast<TestObject*>(0x1UL), e.getReferent());
+    EXPECT_TRUE(e.hashMatches(0x3eefUL));
+
+    // The entry changed after the snapshot was taken: leave it alone.
+    e.setReferent(0x3eefUL, reinterpret_cast<TestObject*>(0x2UL));
+    e.markReferenced(snapshot);
+    EXPECT_FALSE(e.isReferenced());
+    EXPECT_EQ(reinterpret_cast<TestObject*>(0x2UL), e.getReferent());
+}
+
+TEST_F(HashTableEntryTest, clearReferenced) {
+    TestObjectMap::Entry e;
+    e.setReferent(0x3eefUL, reinterpret_cast<TestObject*>(0x1UL), true);
+    e.clearReferenced();
+    EXPECT_FALSE(e.isReferenced());
+    EXPECT_EQ(reinterpret_cast<TestObject*>(0x1UL), e.getReferent());
+    EXPECT_TRUE(e.hashMatches(0x3eefUL));
 }
 
 /**
@@ -377,7 +417,8 @@ class HashTableTest : public ::testing::Test {
         uint64_t secondaryHash;
         TestObjectMap::CacheLine *bucket;
         bucket = ht->findBucket(0, objectId, &secondaryHash);
-        return ht->lookupEntry(bucket, secondaryHash, tableId, objectId);
+        return ht->lookupEntry(bucket, secondaryHash, tableId, objectId,
+                               TestObjectMap::AnyReferent());
     }
 
     DISALLOW_COPY_AND_ASSIGN(HashTableTest);
@@ -403,9 +444,64 @@ TEST_F(HashTableTest, constructor_truncate) {
     EXPECT_EQ(8UL, TestObjectMap(8).numBuckets);
 }
 
+TEST_F(HashTableTest, constructor_memoryPlacement) {
+    MemoryPlacement placement;
+    placement.hugePages = MemoryPlacement::HUGETLBFS_PAGES;
+    placement.hugetlbfsPath = "/nonexistent-hugetlbfs";
+    TestLog::Enable _;
+    TestObjectMap ht(16, placement);
+    EXPECT_NE(string::npos, TestLog::get().find(
+        "LargeBlockOfMemory: No hugetlbfs pages for 1024 bytes"));
+    EXPECT_EQ(16 * sizeof(ht.buckets.get()[0]), ht.buckets.length);
+    EXPECT_TRUE(ht.buckets.get()[15].entries[0].isAvailable());
+
+    placement.hugePages = MemoryPlacement::TRANSPARENT_HUGE_PAGES;
+    TestObjectMap thp(16, placement);
+    EXPECT_TRUE(thp.buckets.get()[15].entries[0].isAvailable());
+    EXPECT_EQ(placement.hugePages, thp.placement.hugePages);
+}
+
 TEST_F(HashTableTest, destructor) {
 }
 
+TEST_F(HashTableTest, getBucketLock) {
+    // Fewer buckets than locks: one lock per bucket.
+    TestObjectMap small(16);
+    EXPECT_EQ(16UL, small.numBucketLocks);
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t secondaryHash;
+        uint64_t bucket = small.findBucket(0, i, &secondaryHash) -
+                          small.buckets.get();
+        EXPECT_EQ(&small.getBucketLockByIndex(bucket),
+                  &small.getBucketLock(0, i));
+    }
+
+    // More buckets than locks: keys in the same bucket share a lock.
+    TestObjectMap large(4 * TestObjectMap::MAX_BUCKET_LOCKS);
+    EXPECT_TRUE(TestObjectMap::MAX_BUCKET_LOCKS ==                // NOLINT
+                large.numBucketLocks);
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t secondaryHash;
+        uint64_t bucket = large.findBucket(0, i, &secondaryHash) -
+                          large.buckets.get();
+        EXPECT_EQ(&large.getBucketLockByIndex(bucket),
+                  &large.getBucketLock(0, i));
+    }
+}
+
+TEST_F(HashTableTest, ExclusiveLock) {
+    TestObjectMap ht(16);
+    {
+        TestObjectMap::ExclusiveLock _(ht);
+        for (uint64_t i = 0; i < 16; i++)
+            EXPECT_FALSE(ht.getBucketLockByIndex(i).try_lock());
+    }
+    for (uint64_t i = 0; i < 16; i++) {
+        EXPECT_TRUE(ht.getBucketLockByIndex(i).try_lock());
+        ht.getBucketLockByIndex(i).unlock();
+    }
+}
+
 TEST_F(HashTableTest, simple) {
     TestObjectMap ht(1024);
 
@@ -471,7 +567,7 @@ TEST_F(HashTableTest, findBucket) {
     hashValue = TestObjectMap::hash(0, 4327);
     EXPECT_EQ(static_cast<uint64_t>(bucket - ht.buckets.get()),
                             (hashValue & 0x0000ffffffffffffffffUL) % 1024);
-    EXPECT_EQ(secondaryHash, hashValue >> 48);
+    EXPECT_EQ(secondaryHash, (hashValue >> 48) & 0x7fffUL);
 }
 
 /**
@@ -547,6 +643,52 @@ TEST_F(HashTableTest, lookupEntry_hashCollision) {
     EXPECT_EQ(1UL, ht.getPerfCounters().lookupEntryHashCollisions);
 }
 
+TEST_F(HashTableTest, matchCandidates) {
+    SETUP(0, TestObjectMap::ENTRIES_PER_CACHE_LINE * 2);
+    TestObjectMap::CacheLine *cl = &ht.buckets.get()[0];
+    uint32_t all = (1U << TestObjectMap::ENTRIES_PER_CACHE_LINE) - 1;
+
+    ht.setSimdLookups(false);
+    EXPECT_EQ(all, ht.matchCandidates(cl, 0));
+
+    ht.setSimdLookups(true);
+    if (!ht.getSimdLookups())
+        return;
+    for (uint64_t i = 0; i < seven; i++) {
+        uint64_t secondaryHash;
+        ht.findBucket(0, i, &secondaryHash);
+        uint32_t candidates = ht.matchCandidates(cl, secondaryHash);
+        EXPECT_TRUE(candidates & (1U << i)) << i;
+        for (uint32_t j = 0; j < TestObjectMap::ENTRIES_PER_CACHE_LINE; j++) {
+            EXPECT_EQ(cl->entries[j].hashMatches(secondaryHash),
+                      (candidates & (1U << j)) != 0) << i << " " << j;
+        }
+    }
+
+    // The referenced bits don't get in the way.
+    for (uint32_t j = 0; j < TestObjectMap::ENTRIES_PER_CACHE_LINE - 1; j++)
+        cl->entries[j].markReferenced(cl->entries[j].load());
+    for (uint64_t i = 0; i < seven; i++) {
+        uint64_t secondaryHash;
+        ht.findBucket(0, i, &secondaryHash);
+        EXPECT_TRUE(ht.matchCandidates(cl, secondaryHash) & (1U << i)) << i;
+    }
+
+    // Unused entries look like referents with a secondary hash of 0.
+    TestObjectMap empty(1);
+    EXPECT_EQ(all, empty.matchCandidates(&empty.buckets.get()[0], 0));
+    EXPECT_EQ(0U, empty.matchCandidates(&empty.buckets.get()[0], 1));
+}
+
+TEST_F(HashTableTest, lookupEntry_scalar) {
+    SETUP(0, TestObjectMap::ENTRIES_PER_CACHE_LINE * 3);
+    ht.setSimdLookups(false);
+    for (uint64_t i = 0; i < numEnt; i++) {
+        EXPECT_EQ(&values[i], ht.lookup(0, i));
+    }
+    EXPECT_EQ(NULL_OBJECT, ht.lookup(0, numEnt));
+}
+
 TEST_F(HashTableTest, lookup) {
     TestObjectMap ht(1);
     TestObject *v = new TestObject(0, 83UL);
@@ -558,6 +700,116 @@ TEST_F(HashTableTest, lookup) {
     delete v;
 }
 
+TEST_F(HashTableTest, lockFreeLookup) {
+    TestObjectMap ht(1);
+    TestObject *v = new TestObject(0, 83UL);
+    EpochManager::ReadGuard _;
+    EXPECT_EQ(NULL_OBJECT, ht.lockFreeLookup(0, 83UL));
+    ht.replace(v);
+    EXPECT_EQ(v, ht.lockFreeLookup(0, 83UL));
+    EXPECT_EQ(0UL, ht.getPerfCounters().lockFreeLookupRetries);
+
+    // A resize step is in progress: fall back to the bucket lock.
+    ht.resizeSequence = 1;
+    EXPECT_EQ(v, ht.lockFreeLookup(0, 83UL));
+    EXPECT_EQ(1UL, ht.getPerfCounters().lockFreeLookupRetries);
+
+    delete v;
+}
+
+TEST_F(HashTableTest, lockFreeLookup_referenceTracking) {
+    TestObjectMap ht(1);
+    TestObject v(0, 83UL);
+    ht.replace(&v);
+    EpochManager::ReadGuard _;
+    ht.lockFreeLookup(0, 83UL);
+    EXPECT_FALSE(ht.testAndClearReferenced(0, 83UL));
+
+    ht.setReferenceTracking(true);
+    EXPECT_EQ(&v, ht.lockFreeLookup(0, 83UL));
+    EXPECT_EQ(&v, ht.lookup(0, 83UL));
+    EXPECT_TRUE(ht.testAndClearReferenced(0, 83UL));
+    EXPECT_FALSE(ht.testAndClearReferenced(0, 83UL));
+
+    // Plain lookups don't count.
+    ht.lookup(0, 83UL);
+    EXPECT_FALSE(ht.testAndClearReferenced(0, 83UL));
+
+    // Nor does a missing key.
+    EXPECT_EQ(NULL_OBJECT, ht.lockFreeLookup(0, 84UL));
+    EXPECT_FALSE(ht.testAndClearReferenced(0, 84UL));
+
+    // Falling back to the bucket lock still marks the entry.
+    ht.resizeSequence = 1;
+    EXPECT_EQ(&v, ht.lockFreeLookup(0, 83UL));
+    EXPECT_TRUE(ht.testAndClearReferenced(0, 83UL));
+}
+
+TEST_F(HashTableTest, lookupBatch) {
+    // Chained buckets, keys that are missing, and more keys than are
+    // pipelined together.
+    SETUP(0, TestObjectMap::ENTRIES_PER_CACHE_LINE * 10);
+    const uint32_t count = downCast<uint32_t>(numEnt + 2);
+    uint64_t key1s[count];
+    uint64_t key2s[count];
+    TestObject* referents[count];
+    for (uint32_t i = 0; i < count; i++) {
+        key1s[i] = 0;
+        key2s[i] = count - 1 - i;
+    }
+    ht.lookupBatch(count, key1s, key2s, referents);
+    EXPECT_EQ(NULL_OBJECT, referents[0]);
+    EXPECT_EQ(NULL_OBJECT, referents[1]);
+    for (uint32_t i = 2; i < count; i++)
+        EXPECT_EQ(&values[count - 1 - i], referents[i]) << i;
+
+    ht.lookupBatch(0, key1s, key2s, referents);
+}
+
+TEST_F(HashTableTest, lockFreeLookupBatch) {
+    TestObjectMap ht(1);
+    TestObject v1(0, 83UL);
+    TestObject v2(0, 84UL);
+    ht.replace(&v1);
+    ht.replace(&v2);
+    uint64_t key1s[] = { 0, 0, 0 };
+    uint64_t key2s[] = { 84UL, 85UL, 83UL };
+    TestObject* referents[3];
+    EpochManager::ReadGuard _;
+    ht.lockFreeLookupBatch(3, key1s, key2s, referents);
+    EXPECT_EQ(&v2, referents[0]);
+    EXPECT_EQ(NULL_OBJECT, referents[1]);
+    EXPECT_EQ(&v1, referents[2]);
+    EXPECT_EQ(0UL, ht.getPerfCounters().lockFreeLookupRetries);
+
+    // A resize step is in progress: fall back to the bucket locks.
+    ht.resizeSequence = 1;
+    ht.lockFreeLookupBatch(3, key1s, key2s, referents);
+    EXPECT_EQ(&v2, referents[0]);
+    EXPECT_EQ(NULL_OBJECT, referents[1]);
+    EXPECT_EQ(&v1, referents[2]);
+    EXPECT_EQ(3UL, ht.getPerfCounters().lockFreeLookupRetries);
+}
+
+TEST_F(HashTableTest, lockFreeLookupBatch_referenceTracking) {
+    TestObjectMap ht(1);
+    TestObject v1(0, 83UL);
+    TestObject v2(0, 84UL);
+    ht.replace(&v1);
+    ht.replace(&v2);
+    ht.setReferenceTracking(true);
+    uint64_t key1s[] = { 0 };
+    uint64_t key2s[] = { 84UL };
+    TestObject* referents[1];
+    ht.lookupBatch(1, key1s, key2s, referents);
+    EXPECT_FALSE(ht.testAndClearReferenced(0, 84UL));
+    EpochManager::ReadGuard _;
+    ht.lockFreeLookupBatch(1, key1s, key2s, referents);
+    EXPECT_EQ(&v2, referents[0]);
+    EXPECT_FALSE(ht.testAndClearReferenced(0, 83UL));
+    EXPECT_TRUE(ht.testAndClearReferenced(0, 84UL));
+}
+
 TEST_F(HashTableTest, remove) {
     TestObject * ptr;
     TestObjectMap ht(1);
@@ -588,10 +840,60 @@ TEST_F(HashTableTest, replace_normal) {
     EXPECT_EQ(v, replaced);
     EXPECT_EQ(const_cast<TestObject*>(w),
         ht.lookup(0, 83UL));
+
+    // Replacing a referent keeps its referenced bit.
+    ht.setReferenceTracking(true);
+    {
+        EpochManager::ReadGuard _;
+        ht.lockFreeLookup(0, 83UL);
+    }
+    EXPECT_TRUE(ht.replace(v));
+    EXPECT_TRUE(ht.testAndClearReferenced(0, 83UL));
     delete v;
     delete w;
 }
 
+TEST_F(HashTableTest, matchers) {
+    // Two referents under one key coexist when a matcher tells them apart.
+    TestObjectMap ht(1);
+    TestObject v(0, 83UL);
+    TestObject w(0, 83UL);
+    EXPECT_FALSE(ht.replace(&v, TestObjectMap::SameReferent(&v)));
+    EXPECT_FALSE(ht.replace(&w, TestObjectMap::SameReferent(&w)));
+    EXPECT_EQ(2U, ht.getNumEntries());
+    EXPECT_EQ(&v, ht.lookup(0, 83UL, TestObjectMap::SameReferent(&v)));
+    EXPECT_EQ(&w, ht.lookup(0, 83UL, TestObjectMap::SameReferent(&w)));
+    EXPECT_FALSE(ht.testAndClearReferenced(0, 83UL,
+                                           TestObjectMap::SameReferent(&w)));
+    {
+        EpochManager::ReadGuard _;
+        EXPECT_EQ(&w, ht.lockFreeLookup(0, 83UL,
+                                        TestObjectMap::SameReferent(&w)));
+        uint64_t key1s[] = { 0, 0 };
+        uint64_t key2s[] = { 83UL, 83UL };
+        TestObjectMap::SameReferent matches[] = {
+            TestObjectMap::SameReferent(&w),
+            TestObjectMap::SameReferent(&v)
+        };
+        TestObject* referents[2];
+        ht.lockFreeLookupBatch(2, key1s, key2s, matches, referents);
+        EXPECT_EQ(&w, referents[0]);
+        EXPECT_EQ(&v, referents[1]);
+        ht.lookupBatch(2, key1s, key2s, matches, referents);
+        EXPECT_EQ(&w, referents[0]);
+        EXPECT_EQ(&v, referents[1]);
+    }
+
+    TestObject* removed;
+    EXPECT_TRUE(ht.remove(0, 83UL, TestObjectMap::SameReferent(&v),
+                          &removed));
+    EXPECT_EQ(&v, removed);
+    EXPECT_FALSE(ht.remove(0, 83UL, TestObjectMap::SameReferent(&v)));
+    EXPECT_EQ(&w, ht.lookup(0, 83UL));
+    EXPECT_EQ(NULL_OBJECT, ht.lookup(0, 83UL,
+                                     TestObjectMap::SameReferent(&v)));
+}
+
 /**
  * Test #RAMCloud::HashTable::replace() when the object ID is new and the
  * first entry of the first cache line is available.
@@ -685,4 +987,251 @@ TEST_F(HashTableTest, forEach) {
         EXPECT_EQ(1U, checkoff[i].count);
 }
 
+TEST_F(HashTableTest, getNumEntries_getLoadFactor) {
+    TestObjectMap ht(2);
+    TestObject a(0, 1), b(0, 2), a2(0, 1);
+    EXPECT_EQ(0UL, ht.getNumEntries());
+    ht.replace(&a);
+    ht.replace(&b);
+    ht.replace(&a2);
+    EXPECT_EQ(2UL, ht.getNumEntries());
+    EXPECT_DOUBLE_EQ(2.0 / 16.0, ht.getLoadFactor());
+    ht.remove(0, 2);
+    EXPECT_EQ(1UL, ht.getNumEntries());
+}
+
+TEST_F(HashTableTest, resize) {
+    HashTable<ForEachTestStruct*> ht(2);
+    ForEachTestStruct values[100];
+    for (uint32_t i = 0; i < arrayLength(values); i++) {
+        values[i]._key1 = 0;
+        values[i]._key2 = i;
+        ht.replace(&values[i]);
+    }
+    EXPECT_LT(0UL, ht.getNumOverflowCacheLines());
+
+    ht.startResize(64);
+    EXPECT_TRUE(ht.isResizing());
+    EXPECT_EQ(1UL, ht.rehash(1));
+    EXPECT_TRUE(ht.isResizing());
+    EXPECT_EQ(2UL, ht.getNumBuckets());
+
+    // Half migrated: every key must still be found, updated and removed.
+    for (uint32_t i = 0; i < arrayLength(values); i++)
+        EXPECT_EQ(&values[i], ht.lookup(0, i));
+    EXPECT_EQ(100U, ht.forEach(test_forEach_callback,
+                               reinterpret_cast<void *>(57)));
+    for (uint32_t i = 0; i < arrayLength(values); i++)
+        EXPECT_EQ(1U, values[i].count);
+    EXPECT_TRUE(ht.remove(0, 0));
+    EXPECT_FALSE(ht.replace(&values[0]));
+
+    // Referenced bits survive being rehashed.
+    ht.setReferenceTracking(true);
+    {
+        EpochManager::ReadGuard _;
+        for (uint32_t i = 0; i < arrayLength(values); i += 2)
+            ht.lockFreeLookup(0, i);
+    }
+
+    EXPECT_EQ(0UL, ht.rehash(1));
+    EXPECT_FALSE(ht.isResizing());
+    EXPECT_EQ(64UL, ht.getNumBuckets());
+    EXPECT_EQ(6UL, ht.resizeSequence);
+    EXPECT_LT(0UL, ht.retiredLines.size());
+    ht.releaseRetiredBuckets();
+    EXPECT_EQ(0UL, ht.retiredLines.size());
+    EXPECT_FALSE(ht.nextBuckets);
+
+    for (uint32_t i = 0; i < arrayLength(values); i++) {
+        EXPECT_EQ(&values[i], ht.lookup(0, i));
+        EXPECT_EQ(i % 2 == 0, ht.testAndClearReferenced(0, i)) << i;
+    }
+    EXPECT_EQ(100UL, ht.getNumEntries());
+    EXPECT_EQ(0UL, ht.getNumOverflowCacheLines());
+}
+
+TEST_F(HashTableTest, resize_swapBucketsSeparately) {
+    HashTable<ForEachTestStruct*> ht(2);
+    ForEachTestStruct values[10];
+    for (uint32_t i = 0; i < arrayLength(values); i++) {
+        values[i]._key1 = 0;
+        values[i]._key2 = i;
+        ht.replace(&values[i]);
+    }
+
+    ht.startResize(8);
+    EXPECT_EQ(1UL, ht.moveBuckets(1));
+    EXPECT_EQ(0UL, ht.moveBuckets(1));
+    EXPECT_EQ(0UL, ht.moveBuckets(1));
+    EXPECT_TRUE(ht.isResizing());
+    EXPECT_EQ(4UL, ht.resizeSequence);
+
+    // Between the two, lock-free readers fall back to the bucket locks
+    // and updates carry on in the new buckets.
+    ht.prepareToSwapBuckets();
+    EXPECT_EQ(5UL, ht.resizeSequence);
+    EXPECT_TRUE(ht.isResizing());
+    {
+        EpochManager::ReadGuard _;
+        EXPECT_EQ(&values[3], ht.lockFreeLookup(0, 3));
+    }
+    EXPECT_TRUE(ht.remove(0, 3));
+    EXPECT_FALSE(ht.replace(&values[3]));
+
+    ht.swapBuckets();
+    EXPECT_FALSE(ht.isResizing());
+    EXPECT_EQ(6UL, ht.resizeSequence);
+    EXPECT_EQ(8UL, ht.getNumBuckets());
+    for (uint32_t i = 0; i < arrayLength(values); i++)
+        EXPECT_EQ(&values[i], ht.lookup(0, i));
+}
+
+/**
+ * State shared by the threads of HashTableTest.lockFreeLookup_stress.
+ */
+struct LockFreeStress {
+    /// Stored in StressObject::state while an object may be in the table.
+    static const uint64_t LIVE = 0x11111111;
+
+    /// Stored in StressObject::state once an object is reclaimed.
+    static const uint64_t DEAD = 0xdeaddead;
+
+    struct StressObject : public TestObject {
+        explicit StressObject(uint64_t key2)
+            : TestObject(0, key2), state(LIVE) {}
+        volatile uint64_t state;
+    };
+
+    explicit LockFreeStress(uint64_t numKeys)
+        : ht(4), numKeys(numKeys), stop(false), lookups(), errors()
+        , writersDone(), garbage(), garbageLock()
+    {
+        for (uint64_t i = 0; i < numKeys; i++)
+            ht.replace(new StressObject(i));
+    }
+
+    ~LockFreeStress()
+    {
+        for (uint64_t i = 0; i < numKeys; i++)
+            delete ht.lookup(0, i);
+        foreach (StressObject* o, garbage)
+            delete o;
+    }
+
+    HashTable<StressObject*> ht;
+    const uint64_t numKeys;
+    volatile bool stop;
+    AtomicInt lookups;
+    AtomicInt errors;
+    AtomicInt writersDone;
+
+    /// Objects replaced by the writers, freed once all threads have exited.
+    std::vector<StressObject*> garbage;
+    SpinLock garbageLock;
+    DISALLOW_COPY_AND_ASSIGN(LockFreeStress);
+};
+
+// Looks keys up without locks and checks that it never finds a missing,
+// wrong or reclaimed object.
+static void
+lockFreeStressReader(LockFreeStress* s)
+{
+    uint64_t key = 0;
+    while (!s->stop) {
+        EpochManager::ReadGuard _;
+        LockFreeStress::StressObject* o = s->ht.lockFreeLookup(0, key);
+        if (o == NULL || o->key2() != key || o->state != LockFreeStress::LIVE)
+            s->errors.inc();
+        s->lookups.inc();
+        key = (key + 1) % s->numKeys;
+    }
+}
+
+// Replaces objects the way the master does on writes and cleaning: swap in
+// a new copy under the bucket lock, then reclaim the old one only once no
+// reader can still be looking at it. Reclaimed objects are poisoned rather
+// than freed so that readers can tell if it happened too early.
+static void
+lockFreeStressWriter(LockFreeStress* s, uint64_t firstKey,
+                     uint32_t numWrites)
+{
+    typedef LockFreeStress::StressObject StressObject;
+    std::vector<std::pair<uint64_t, StressObject*>> retired;
+    std::vector<StressObject*> dead;
+    for (uint32_t i = 0; i < numWrites; i++) {
+        uint64_t key = (firstKey + i * 7) % s->numKeys;
+        StressObject* o = new StressObject(key);
+        StressObject* old = NULL;
+        {
+            std::lock_guard<SpinLock> _(s->ht.getBucketLock(0, key));
+            s->ht.replace(o, &old);
+        }
+        retired.push_back({EpochManager::advance(), old});
+        if (i % 64 == 0 || i == numWrites - 1) {
+            uint64_t earliest = EpochManager::getEarliestActiveEpoch();
+            size_t kept = 0;
+            for (size_t j = 0; j < retired.size(); j++) {
+                if (retired[j].first < earliest) {
+                    retired[j].second->state = LockFreeStress::DEAD;
+                    dead.push_back(retired[j].second);
+                } else {
+                    retired[kept++] = retired[j];
+                }
+            }
+            retired.resize(kept);
+        }
+    }
+    // Readers may still be looking at the objects not yet reclaimed, so
+    // leave it to the test to free everything once they have stopped.
+    std::lock_guard<SpinLock> _(s->garbageLock);
+    s->garbage.insert(s->garbage.end(), dead.begin(), dead.end());
+    foreach (auto& r, retired)
+        s->garbage.push_back(r.second);
+    s->writersDone.inc();
+}
+
+// Keeps growing the table while the readers and writers run.
+static void
+lockFreeStressResizer(LockFreeStress* s, int numWriters)
+{
+    while (s->writersDone < numWriters && s->ht.getNumBuckets() < 4096) {
+        s->ht.startResize(2 * s->ht.getNumBuckets());
+        while (s->ht.rehash(2) > 0) {
+        }
+        s->ht.releaseRetiredBuckets();
+    }
+}
+
+TEST_F(HashTableTest, lockFreeLookup_stress) {
+    const int numReaders = 3;
+    const int numWriters = 2;
+    LockFreeStress s(1000);
+
+    std::vector<std::thread*> threads;
+    for (int i = 0; i < numReaders; i++)
+        threads.push_back(new std::thread(lockFreeStressReader, &s));
+    while (s.lookups == 0)
+        sched_yield();
+    for (int i = 0; i < numWriters; i++) {
+        threads.push_back(new std::thread(lockFreeStressWriter, &s,
+                                          i * 500, 20000));
+    }
+    std::thread resizer(lockFreeStressResizer, &s, numWriters);
+    resizer.join();
+    while (s.writersDone < numWriters)
+        sched_yield();
+    s.stop = true;
+    foreach (std::thread* t, threads) {
+        t->join();
+        delete t;
+    }
+
+    EXPECT_EQ(0, s.errors.load());
+    EXPECT_LT(0, s.lookups.load());
+    EXPECT_LT(4UL, s.ht.getNumBuckets());
+    for (uint64_t i = 0; i < s.numKeys; i++)
+        EXPECT_EQ(i, s.ht.lookup(0, i)->key2());
+}
+
 } // namespace RAMCloud
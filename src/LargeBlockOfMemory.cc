@@ -19,6 +19,7 @@ namespace RAMCloud {
 
 namespace LargeBlockOfMemoryInternal {
     uint64_t nextProbeBase = (uint64_t)1 << 30;
+    uint64_t nextHugetlbfsFile = 0;
 }
 
 }
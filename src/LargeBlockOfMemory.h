@@ -19,6 +19,9 @@
 #include <limits.h>
 #include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#include <linux/mempolicy.h>
 #include <boost/type_traits.hpp>
 #include <boost/utility/enable_if.hpp>
 #include "Common.h"
@@ -34,8 +37,48 @@ namespace RAMCloud {
  */
 namespace LargeBlockOfMemoryInternal {
     extern uint64_t nextProbeBase;
+    extern uint64_t nextHugetlbfsFile;
 }
 
+/**
+ * Describes where the pages backing a #LargeBlockOfMemory should come from.
+ * Masters use this to put their log and hash table on huge pages, which
+ * cuts TLB misses on random accesses, and on the NUMA node their threads
+ * run on. Every request is best effort: if the system can't satisfy it,
+ * a warning is logged and ordinary memory is used instead.
+ */
+struct MemoryPlacement {
+    enum HugePages {
+        /// Use pages of the system's normal size.
+        NO_HUGE_PAGES = 0,
+
+        /// Ask the kernel for transparent huge pages (2 MB on x86-64).
+        TRANSPARENT_HUGE_PAGES,
+
+        /// Map a file in the hugetlbfs mount at #hugetlbfsPath, whose page
+        /// size (2 MB or 1 GB) was chosen when it was mounted. These pages
+        /// must have been reserved by the administrator.
+        HUGETLBFS_PAGES,
+    };
+
+    MemoryPlacement()
+        : hugePages(NO_HUGE_PAGES)
+        , hugetlbfsPath()
+        , numaNode(-1)
+    {}
+
+    /// What size of pages to use.
+    HugePages hugePages;
+
+    /// Directory where a hugetlbfs is mounted. Only used with
+    /// HUGETLBFS_PAGES.
+    string hugetlbfsPath;
+
+    /// NUMA node to allocate the pages from, or -1 to let the kernel
+    /// choose.
+    int numaNode;
+};
+
 /**
  * A wrapper for a large block of memory. Returned memory is guaranteed to be
  * at least one gigabyte aligned (at least the first 30 address bits will be 0).
@@ -54,7 +97,8 @@ struct LargeBlockOfMemory {
      */
     explicit LargeBlockOfMemory(size_t length)
         : length(length)
-        , block(static_cast<T*>(mmapGigabyteAligned(length, MAP_ANONYMOUS)))
+        , block(static_cast<T*>(mmapGigabyteAligned(length,
+                                        MAP_SHARED | MAP_ANONYMOUS)))
     {
         if (block == MAP_FAILED) {
             if (length == 0)
@@ -65,6 +109,66 @@ struct LargeBlockOfMemory {
         }
     }
 
+    /**
+     * Allocates backing pages for a block of memory as described by
+     * \a placement, pins them, and zeros them. The memory is aligned to a
+     * gigabyte boundary. If the huge pages or NUMA node asked for aren't
+     * available, this logs a warning and makes do without them.
+     * \param length
+     *      The number of bytes of memory to allocate. With HUGETLBFS_PAGES
+     *      this is rounded up to a whole number of huge pages.
+     * \param placement
+     *      Where the pages should come from.
+     * \throw FatalError
+     *      If the memory could not be allocated at all.
+     */
+    LargeBlockOfMemory(size_t length, const MemoryPlacement& placement)
+        : length(length)
+        , block(NULL)
+    {
+        if (length == 0)
+            return;
+
+        if (placement.hugePages == MemoryPlacement::HUGETLBFS_PAGES) {
+            string path = format("%s/ramcloud-%d-%lu",
+                    placement.hugetlbfsPath.c_str(), getpid(),
+                    LargeBlockOfMemoryInternal::nextHugetlbfsFile++);
+            try {
+                struct statfs fs;
+                if (statfs(placement.hugetlbfsPath.c_str(), &fs) != 0) {
+                    throw FatalError(HERE, format("Could not statfs [%s]",
+                                     placement.hugetlbfsPath.c_str()), errno);
+                }
+                uint64_t hugePageSize = fs.f_bsize;
+                this->length = (length + hugePageSize - 1) / hugePageSize *
+                               hugePageSize;
+                block = static_cast<T*>(mmapFile(path, placement.numaNode));
+                return;
+            } catch (FatalError& e) {
+                RAMCLOUD_LOG(WARNING, "No hugetlbfs pages for %lu bytes (%s); "
+                             "using normal pages instead", length, e.what());
+                this->length = length;
+            }
+        }
+
+        // Transparent huge pages are only used for private mappings.
+        int flags = MAP_ANONYMOUS;
+        if (placement.hugePages == MemoryPlacement::TRANSPARENT_HUGE_PAGES)
+            flags |= MAP_PRIVATE;
+        else
+            flags |= MAP_SHARED;
+        bool transparent =
+            placement.hugePages == MemoryPlacement::TRANSPARENT_HUGE_PAGES;
+        block = static_cast<T*>(mmapGigabyteAligned(length, flags, -1,
+                                                    placement.numaNode,
+                                                    transparent));
+        if (block == MAP_FAILED) {
+            throw FatalError(HERE,
+                             format("Could not allocate %lu bytes", length),
+                             errno);
+        }
+    }
+
     /**
      * Creates a file of the desired length and mmaps pages from it, pins them,
      * and zeros them. This is intended to be used with hugetlbfs to get
@@ -82,6 +186,58 @@ struct LargeBlockOfMemory {
     LargeBlockOfMemory(string filePath, size_t length)
         : length(length),
           block(NULL)
+    {
+        block = static_cast<T*>(mmapFile(filePath, -1));
+    }
+
+    ~LargeBlockOfMemory()
+    {
+        if (block != NULL && munmap(block, length) != 0)
+            RAMCLOUD_LOG(WARNING, "munmap of large block failed with %d",
+                         errno);
+    }
+
+    void swap(LargeBlockOfMemory<T>& other) {
+        std::swap(this->length, other.length);
+        std::swap(this->block, other.block);
+    }
+
+    /// Returns #block.
+    T* operator*() { return block; }
+    /// Returns #block.
+    T* operator->() { return block; }
+    /// Returns #block.
+    T* get() { return block; }
+
+    /// The number of bytes valid starting at #block.
+    size_t length;
+
+    /// Just for convenience.
+    static const uint64_t GIGABYTE = (uint64_t)1 << 30;
+
+    /**
+     * A page-aligned block of #length bytes of data.
+     * May be NULL if length is 0.
+     */
+    T* block;
+
+  private:
+    /**
+     * Create the file \a filePath, which must not already exist, size it to
+     * #length bytes, and mmap it with gigabyte alignment. The file is unlinked
+     * before returning; the mapping keeps its pages allocated.
+     *
+     * \param filePath
+     *      Where to create the file, usually in a hugetlbfs mount.
+     * \param numaNode
+     *      NUMA node to allocate the pages from, or -1 for any node.
+     * \return
+     *      The address of the mapping.
+     * \throw FatalError
+     *      If the file could not be created or mapped.
+     */
+    void*
+    mmapFile(string filePath, int numaNode)
     {
         const char* path = filePath.c_str();
 
@@ -105,13 +261,14 @@ struct LargeBlockOfMemory {
                 errno);
         }
 
-        block = reinterpret_cast<T*>(mmapGigabyteAligned(length, 0, fd));
-        if (reinterpret_cast<void*>(block) == MAP_FAILED) {
+        void* base = mmapGigabyteAligned(length, MAP_SHARED, fd, numaNode);
+        if (base == MAP_FAILED) {
+            int error = errno;
             unlink(path);
             close(fd);
             throw FatalError(HERE,
                 format("Could not mmap file [%s]", path),
-                errno);
+                error);
         }
 
         // Remove the file from the directory. Our memory will remain allocated,
@@ -121,46 +278,10 @@ struct LargeBlockOfMemory {
 
         RAMCLOUD_LOG(NOTICE,
                      "Mmapped %lu-byte region from [%s] at %p\n",
-                     length, path, reinterpret_cast<void*>(block));
-
-        // Fault in each mapping.
-        uint64_t pageSize = sysconf(_SC_PAGESIZE);
-        for (uint64_t i = 0; i < length; i += pageSize)
-            reinterpret_cast<uint8_t*>(block)[i] = 0;
-    }
-
-    ~LargeBlockOfMemory()
-    {
-        if (block != NULL && munmap(block, length) != 0)
-            RAMCLOUD_LOG(WARNING, "munmap of large block failed with %d",
-                         errno);
-    }
-
-    void swap(LargeBlockOfMemory<T>& other) {
-        std::swap(this->length, other.length);
-        std::swap(this->block, other.block);
+                     length, path, base);
+        return base;
     }
 
-    /// Returns #block.
-    T* operator*() { return block; }
-    /// Returns #block.
-    T* operator->() { return block; }
-    /// Returns #block.
-    T* get() { return block; }
-
-    /// The number of bytes valid starting at #block.
-    size_t length;
-
-    /// Just for convenience.
-    static const uint64_t GIGABYTE = (uint64_t)1 << 30;
-
-    /**
-     * A page-aligned block of #length bytes of data.
-     * May be NULL if length is 0.
-     */
-    T* block;
-
-  private:
     /**
      * Mmap the desired amount of space with gigabyte alignment (lower 30
      * bits of the address are 0). Also, ensure that all mappings are faulted
@@ -174,13 +295,21 @@ struct LargeBlockOfMemory {
      *
      * \param[in] length
      *      Length of the memory area to be mapped in bytes.
-     * \param[in] extraFlags
-     *      Extra flags to be passed to mmap(2).
+     * \param[in] flags
+     *      Flags to be passed to mmap(2); must include one of MAP_SHARED or
+     *      MAP_PRIVATE.
      * \param[in] fd
      *      Optional file descriptor (if mmaping a file, for instance).
+     * \param[in] numaNode
+     *      If not -1, bind the pages to this NUMA node before faulting them
+     *      in. Failure to do so is logged and otherwise ignored.
+     * \param[in] transparentHugePages
+     *      If true, ask the kernel to back the region with transparent huge
+     *      pages. Failure to do so is logged and otherwise ignored.
      */
     void*
-    mmapGigabyteAligned(size_t length, int extraFlags, int fd = -1)
+    mmapGigabyteAligned(size_t length, int flags, int fd = -1,
+                        int numaNode = -1, bool transparentHugePages = false)
     {
         const int maxTries = 10000;
         int i;
@@ -190,7 +319,7 @@ struct LargeBlockOfMemory {
             void *base = mmap(reinterpret_cast<void*>(tryBase),
                               length,
                               PROT_READ | PROT_WRITE,
-                              MAP_SHARED | extraFlags,
+                              flags,
                               fd,
                               0);
 
@@ -202,6 +331,9 @@ struct LargeBlockOfMemory {
                     RAMCLOUD_LOG(ERROR, "couldn't munmap undesirable mapping!");
                     return MAP_FAILED;
                 }
+            } else if (errno == ENOMEM && fd != -1) {
+                // Out of hugetlbfs pages: probing elsewhere won't help.
+                return MAP_FAILED;
             }
 
             tryBase += GIGABYTE;
@@ -214,6 +346,29 @@ struct LargeBlockOfMemory {
 
         void* block = reinterpret_cast<void*>(tryBase);
 
+        // Both of these must happen before the pages are touched below,
+        // since that is when the kernel decides where they come from.
+        if (transparentHugePages && madvise(block, length, MADV_HUGEPAGE)) {
+            RAMCLOUD_LOG(WARNING, "Couldn't enable transparent huge pages "
+                         "for %lu bytes: %s", length, strerror(errno));
+        }
+        if (numaNode >= 0) {
+            uint64_t nodeMask[16] = {0};
+            uint64_t maxNodes = 8 * sizeof(nodeMask);
+            int error = EINVAL;
+            if (static_cast<uint64_t>(numaNode) < maxNodes) {
+                nodeMask[numaNode / 64] = 1UL << (numaNode % 64);
+                error = 0;
+                if (syscall(SYS_mbind, block, length, MPOL_BIND, nodeMask,
+                            maxNodes, 0) != 0)
+                    error = errno;
+            }
+            if (error != 0) {
+                RAMCLOUD_LOG(WARNING, "Couldn't bind %lu bytes to NUMA node "
+                             "%d: %s", length, numaNode, strerror(error));
+            }
+        }
+
 #ifdef MLOCK_PAGES
         // Pin the pages. Don't do this with the mmap() MAP_LOCKED flag since
         // that slows down probing considerably (Linux might be locking down
@@ -18,6 +18,7 @@
 #include <exception>
 
 #include "Log.h"
+#include "EpochManager.h"
 #include "LogCleaner.h"
 #include "ServerRpcPool.h"
 #include "ShortMacros.h"
@@ -46,6 +47,14 @@ namespace RAMCloud {
  *      user of this object specify whether to use a cleaner, as well as
  *      whether to run it in a separate thread or inlined with the Log
  *      code.
+ * \param[in] cleanerThreads
+ *      The number of threads the cleaner relocates live data with in each
+ *      cleaning pass.
+ * \param[in] cleanerPolicy
+ *      How the cleaner chooses which Segments to clean.
+ * \param[in] memoryPlacement
+ *      Where the memory for the Log's Segments should come from, e.g. huge
+ *      pages on a particular NUMA node.
  * \throw LogException
  *      An exception is thrown if #logCapacity is not sufficient for
  *      a single segment's worth of log.
@@ -55,13 +64,16 @@ Log::Log(const ServerId& logId,
          uint32_t segmentCapacity,
          uint32_t maximumBytesPerAppend,
          ReplicaManager *replicaManager,
-         CleanerOption cleanerOption)
+         CleanerOption cleanerOption,
+         uint32_t cleanerThreads,
+         LogCleaner::CleaningPolicyType cleanerPolicy,
+         const MemoryPlacement& memoryPlacement)
     : stats(),
       logCapacity((logCapacity / segmentCapacity) * segmentCapacity),
       segmentCapacity(segmentCapacity),
       maximumBytesPerAppend(maximumBytesPerAppend),
       logId(logId),
-      segmentMemory(this->logCapacity),
+      segmentMemory(this->logCapacity, memoryPlacement),
       nextSegmentId(0),
       head(NULL),
       emergencyCleanerList(),
@@ -73,13 +85,14 @@ Log::Log(const ServerId& logId,
       freePendingDigestAndReferenceList(),
       freePendingReferenceList(),
       activeIdMap(),
-      activeBaseAddressMap(),
+      activeSegmentSlots(this->logCapacity / segmentCapacity),
       logTypeMap(),
       listLock(),
       replicaManager(replicaManager),
       cleanerOption(cleanerOption),
       cleaner(this, replicaManager,
-              cleanerOption == CONCURRENT_CLEANER)
+              cleanerOption == CONCURRENT_CLEANER, cleanerThreads,
+              cleanerPolicy)
 {
     if (logCapacity == 0) {
         throw LogException(HERE,
@@ -185,7 +198,7 @@ Log::allocateHead()
         downCast<uint32_t>(digestBytes));
 
     activeIdMap[nextHead->getId()] = nextHead;
-    activeBaseAddressMap[nextHead->getBaseAddress()] = nextHead;
+    activeSegmentSlots[getSegmentSlot(nextHead->getBaseAddress())] = nextHead;
 
     // only close the old head _after_ we've opened up the new head!
     if (head) {
@@ -281,9 +294,9 @@ Log::multiAppend(LogMultiAppendVector& appends, bool sync)
 
     for (size_t i = 0; i < appends.size(); i++) {
         assert(getTypeInfo(appends[i].type) != NULL);
-        if (appends[i].length > maximumBytesPerAppend) {
+        if (appends[i].totalLength() > maximumBytesPerAppend) {
             throw LogException(HERE, format("append length (%d) exceeds "
-                "maximum allowed (%d)", appends[i].length,
+                "maximum allowed (%d)", appends[i].totalLength(),
                 maximumBytesPerAppend));
         }
     }
@@ -300,7 +313,7 @@ Log::multiAppend(LogMultiAppendVector& appends, bool sync)
             if (allocatedHead) {
                 uint32_t appendSize = 0;
                 for (size_t i = 0; i < appends.size(); i++)
-                    appendSize += appends[i].length;
+                    appendSize += appends[i].totalLength();
                 throw LogException(HERE,
                    format("WARNING: multiAppend of length %u simply won't "
                           "fit in segment of size %u: object(s) too large",
@@ -406,6 +419,13 @@ Log::free(LogEntryHandle entry)
  *      new segment.
  * \param[in] scanArg
  *      A void* argument to be passed to the scan callback.
+ * \param[in] evictionCB
+ *      An optional callback invoked by a LogCleaner running an evicting
+ *      policy on live entries of this type instead of relocating them.
+ *      The callback must return true if it freed the entry, or false if
+ *      the entry should be relocated as usual.
+ * \param[in] evictionArg
+ *      A void* argument to be passed to the eviction callback.
  * \throw LogException
  *      An exception is thrown if the type has already been registered
  *      or if the parameters given are invalid.
@@ -419,7 +439,9 @@ Log::registerType(LogEntryType type,
                   void *relocationArg,
                   log_timestamp_cb_t timestampCB,
                   log_scan_cb_t scanCB,
-                  void *scanArg)
+                  void *scanArg,
+                  log_eviction_cb_t evictionCB,
+                  void *evictionArg)
 {
     if (contains(logTypeMap, type))
         throw LogException(HERE, "type already registered with the Log");
@@ -437,7 +459,9 @@ Log::registerType(LogEntryType type,
                                        relocationArg,
                                        timestampCB,
                                        scanCB,
-                                       scanArg);
+                                       scanArg,
+                                       evictionCB,
+                                       evictionArg);
 }
 
 /**
@@ -469,6 +493,55 @@ Log::sync()
         head->sync();
 }
 
+/**
+ * Wait for everything appended to the Log before \a logTime to be
+ * replicated. Unlike sync(), this lets other threads keep appending, and
+ * waiting for their own appends, in the meantime; concurrent callers share
+ * the round trips to backups rather than taking one each.
+ *
+ * \param logTime
+ *      A value returned by getHeadLogTime() after the appends of interest.
+ *      Its Segment must not have been freed yet. This holds for an RPC
+ *      that obtained it while being serviced, since cleaned Segments are
+ *      kept until no RPC that could refer to them is outstanding.
+ * \throw LogException
+ *      The Segment of \a logTime is no longer part of the Log.
+ */
+void
+Log::sync(LogTime logTime)
+{
+    // Nothing had been appended.
+    if (logTime.second == 0)
+        return;
+
+    Segment* segment;
+    {
+        std::lock_guard<SpinLock> lock(listLock);
+        ActiveIdMap::const_iterator it = activeIdMap.find(logTime.first);
+        if (it == activeIdMap.end())
+            throw LogException(HERE, "sync of a Segment no longer in the Log");
+        segment = it->second;
+    }
+    segment->sync(logTime.second);
+}
+
+/**
+ * Return the LogTime just past the last entry appended to the head of the
+ * Log. Once sync() has been called with it, everything appended to the
+ * Log before it is durable, provided something was appended to the head
+ * itself: replicas of a new head receive no appends until the old head
+ * has been durably closed. Entries the cleaner writes into other Segments
+ * are not covered.
+ */
+LogTime
+Log::getHeadLogTime()
+{
+    std::lock_guard<SpinLock> lock(listLock);
+    if (head == NULL)
+        return LogTime(0, 0);
+    return LogTime(head->getId(), head->getAppendedLength());
+}
+
 /**
  * Return total bytes concatenated to the Log so far including overhead.
  */
@@ -574,7 +647,7 @@ Log::cleaningInto(Segment* segment)
 
     cleaningIntoList.push_back(*segment);
     activeIdMap[segment->getId()] = segment;
-    activeBaseAddressMap[segment->getBaseAddress()] = segment;
+    activeSegmentSlots[getSegmentSlot(segment->getBaseAddress())] = segment;
 }
 
 /**
@@ -637,11 +710,13 @@ Log::cleaningComplete(SegmentVector& clean,
 
     // This is a good time to check cleaned Segments that are no
     // longer part of the Log, but may or may not still be referenced
-    // by outstanding RPCs.
-    uint64_t earliestEpoch = ServerRpcPool<>::getEarliestOutstandingEpoch();
+    // by outstanding RPCs or by threads reading without locks.
+    uint64_t earliestEpoch = std::min(
+        ServerRpcPool<>::getEarliestOutstandingEpoch(),
+        EpochManager::getEarliestActiveEpoch());
     SegmentVector freeSegments;
     foreach (Segment& s, freePendingReferenceList) {
-        if (s.cleanedEpoch < earliestEpoch) {
+        if (s.cleanedEpoch < earliestEpoch && s.pinCount == 0) {
             // not sure about mutating an intrusive list while iterating, so...
             freeSegments.push_back(&s);
         }
@@ -650,7 +725,7 @@ Log::cleaningComplete(SegmentVector& clean,
         Segment* s = freeSegments.back();
         freeSegments.pop_back();
         activeIdMap.erase(s->getId());
-        activeBaseAddressMap.erase(s->getBaseAddress());
+        activeSegmentSlots[getSegmentSlot(s->getBaseAddress())] = NULL;
         freePendingReferenceList.erase(
             freePendingReferenceList.iterator_to(*s));
         locklessAddToFreeList(const_cast<void*>(s->getBaseAddress()));
@@ -830,9 +905,70 @@ Log::getFromFreeList(bool mayUseLastSegment)
     return p;
 }
 
+/**
+ * Append a reference to data stored in the Log to a Buffer. The data is not
+ * copied; instead, the Segment containing it is pinned in memory until the
+ * Buffer is destroyed or reset.
+ *
+ * \param buffer
+ *      The Buffer to append the data to.
+ * \param log
+ *      The Log containing \a data.
+ * \param data
+ *      The address of the data to appear in the Buffer. This must point
+ *      into a Segment of \a log that has not yet been freed; callers
+ *      normally guarantee this by holding the lock that keeps the cleaner
+ *      from relocating the entry while it is being looked up.
+ * \param length
+ *      The number of bytes starting at \a data to append. The range must
+ *      not extend past the end of the Segment.
+ * \return
+ *      The newly constructed chunk.
+ * \throw LogException
+ *      \a data does not point into a Segment of \a log.
+ */
+Log::PinnedChunk*
+Log::PinnedChunk::appendToBuffer(Buffer* buffer,
+                                 Log& log,
+                                 const void* data,
+                                 uint32_t length)
+{
+    Segment* segment = log.getSegmentFromAddress(data);
+    PinnedChunk* chunk = new(buffer, CHUNK) PinnedChunk(segment, data, length);
+    Buffer::Chunk::appendChunkToBuffer(buffer, chunk);
+    return chunk;
+}
+
+/**
+ * Construct a PinnedChunk and pin its Segment.
+ *
+ * \param segment
+ *      The Segment containing \a data.
+ * \param data
+ *      See #appendToBuffer.
+ * \param length
+ *      See #appendToBuffer.
+ */
+Log::PinnedChunk::PinnedChunk(Segment* segment,
+                              const void* data,
+                              uint32_t length)
+    : Buffer::Chunk(data, length),
+      segment(segment)
+{
+    segment->pinCount.inc();
+}
+
+/// Unpins the Segment so that it may be freed once it is cleaned.
+Log::PinnedChunk::~PinnedChunk()
+{
+    segment->pinCount.add(-1);
+}
+
 /**
  * Given a pointer into the backing memory of some Segment, return
- * the Segment object associated with it.
+ * the Segment object associated with it. This takes no locks, since
+ * it is on the path of every read; the caller must ensure the Segment
+ * is not freed meanwhile (see #activeSegmentSlots).
  *
  * \throw LogException 
  *      An exception is thrown if no corresponding Segment could be
@@ -841,18 +977,29 @@ Log::getFromFreeList(bool mayUseLastSegment)
 Segment*
 Log::getSegmentFromAddress(const void* address)
 {
-    const void *base = Segment::getSegmentBaseAddress(address, segmentCapacity);
-
-    std::lock_guard<SpinLock> lock(listLock);
-
-    if (head != NULL && base == head->getBaseAddress())
-        return head;
-
-    BaseAddressMap::const_iterator it = activeBaseAddressMap.find(base);
-    if (it == activeBaseAddressMap.end())
+    Segment* segment = activeSegmentSlots[getSegmentSlot(address)];
+    if (segment == NULL)
         throw LogException(HERE, "getSegmentId on invalid pointer");
+    return segment;
+}
 
-    return it->second;
+/**
+ * Return the index in #activeSegmentSlots of the Segment whose backing
+ * memory contains the given address. Every Segment's memory is a
+ * #segmentCapacity-aligned slice of #segmentMemory, so this is simple
+ * arithmetic.
+ *
+ * \throw LogException
+ *      \a address does not point into #segmentMemory.
+ */
+size_t
+Log::getSegmentSlot(const void* address)
+{
+    uintptr_t addr = reinterpret_cast<uintptr_t>(address);
+    uintptr_t first = reinterpret_cast<uintptr_t>(segmentMemory.get());
+    if (addr < first || addr - first >= logCapacity)
+        throw LogException(HERE, "getSegmentId on invalid pointer");
+    return (addr - first) / segmentCapacity;
 }
 
 /**
@@ -21,6 +21,7 @@
 #include <vector>
 
 #include "BoostIntrusive.h"
+#include "Buffer.h"
 #include "LargeBlockOfMemory.h"
 #include "LogCleaner.h"
 #include "LogTypes.h"
@@ -63,6 +64,7 @@ typedef bool (*log_liveness_cb_t)(LogEntryHandle, void *);
 typedef bool (*log_relocation_cb_t)(LogEntryHandle, LogEntryHandle, void *);
 typedef uint32_t (*log_timestamp_cb_t)(LogEntryHandle);
 typedef void (*log_scan_cb_t)(LogEntryHandle, void *);
+typedef bool (*log_eviction_cb_t)(LogEntryHandle, void *);
 
 /**
  * Each append operation on a Log writes a typed blob. Types must
@@ -79,7 +81,9 @@ class LogTypeInfo {
                 void *relocationArg,
                 log_timestamp_cb_t timestampCB,
                 log_scan_cb_t scanCB,
-                void *scanArg)
+                void *scanArg,
+                log_eviction_cb_t evictionCB = NULL,
+                void *evictionArg = NULL)
         : type(type),
           explicitlyFreed(explicitlyFreed),
           livenessCB(livenessCB),
@@ -88,7 +92,9 @@ class LogTypeInfo {
           relocationArg(relocationArg),
           timestampCB(timestampCB),
           scanCB(scanCB),
-          scanArg(scanArg)
+          scanArg(scanArg),
+          evictionCB(evictionCB),
+          evictionArg(evictionArg)
     {
     }
 
@@ -133,6 +139,15 @@ class LogTypeInfo {
     /// Opaque cookie passed to the scan callback.
     void                     *scanArg;
 
+    /// Callback used by an evicting LogCleaner to ask the log's user to
+    /// give up a live entry rather than have it relocated. If the user
+    /// agrees, it must drop all references to the entry, free it, and
+    /// return true. May be NULL if entries of this type are never evicted.
+    const log_eviction_cb_t   evictionCB;
+
+    /// Opaque cookie passed to the eviction callback.
+    void                     *evictionArg;
+
   PRIVATE:
     DISALLOW_COPY_AND_ASSIGN(LogTypeInfo);
 };
@@ -175,7 +190,11 @@ class Log {
         uint32_t segmentCapacity,
         uint32_t maximumBytesPerAppend,
         ReplicaManager *replicaManager = NULL,
-        CleanerOption cleanerOption = CONCURRENT_CLEANER);
+        CleanerOption cleanerOption = CONCURRENT_CLEANER,
+        uint32_t cleanerThreads = 1,
+        LogCleaner::CleaningPolicyType cleanerPolicy =
+            LogCleaner::COST_BENEFIT_POLICY,
+        const MemoryPlacement& memoryPlacement = MemoryPlacement());
     ~Log();
     void           allocateHead();
     LogEntryHandle append(LogEntryType type,
@@ -196,9 +215,13 @@ class Log {
                                 void *relocationArg,
                                 log_timestamp_cb_t timestampCB,
                                 log_scan_cb_t scanCB,
-                                void* scanArg);
+                                void* scanArg,
+                                log_eviction_cb_t evictionCB = NULL,
+                                void* evictionArg = NULL);
     const LogTypeInfo* getTypeInfo(LogEntryType type);
     void           sync();
+    void           sync(LogTime logTime);
+    LogTime        getHeadLogTime();
     uint64_t       getSegmentId(const void *p);
     bool           isSegmentLive(uint64_t segmentId);
     uint64_t       getBytesAppended() const;
@@ -208,6 +231,33 @@ class Log {
     uint32_t       getSegmentCapacity() const;
     size_t         getNumberOfSegments() const;
 
+    /**
+     * A Buffer::Chunk that refers directly to data stored in the Log.
+     *
+     * While a PinnedChunk exists, the Segment containing its data will not
+     * be reused, even if the Segment has been cleaned and every RPC that
+     * was outstanding when it was cleaned has since finished. This lets
+     * services reply with zero-copy references to log data: the chunk is
+     * only destroyed along with its Buffer, after the transport is done
+     * transmitting it.
+     */
+    class PinnedChunk : public Buffer::Chunk {
+      public:
+        static PinnedChunk* appendToBuffer(Buffer* buffer,
+                                           Log& log,
+                                           const void* data,
+                                           uint32_t length);
+        ~PinnedChunk();
+      private:
+        PinnedChunk(Segment* segment, const void* data, uint32_t length);
+
+        /// The Segment containing the chunk's data, which is unpinned
+        /// when the chunk is destroyed.
+        Segment* const segment;
+
+        DISALLOW_COPY_AND_ASSIGN(PinnedChunk);
+    };
+
     // These public methods are only to be externally used by the cleaner.
     void           getNewCleanableSegments(SegmentVector& out);
     void           cleaningInto(Segment* newSegment);
@@ -266,13 +316,13 @@ class Log {
     typedef std::vector<void*> FreeList;
     typedef std::unordered_map<LogEntryType, LogTypeInfo*> LogTypeMap;
     typedef std::unordered_map<uint64_t, Segment *> ActiveIdMap;
-    typedef std::unordered_map<const void *, Segment *> BaseAddressMap;
 
     void        dumpListStats();
     void        locklessAddToFreeList(void *p);
     void*       getFromFreeList(bool mayUseLastSegment);
     void        markActive(Segment *s);
     Segment*    getSegmentFromAddress(const void*);
+    size_t      getSegmentSlot(const void* address);
 
     const ServerId& logId;
 
@@ -354,7 +404,8 @@ class Log {
     /// List of Segments that contain no live data, but which may have
     /// outstanding references (e.g. in Buffers deep within the various
     /// Transports). Once it has been determined that no data is referenced
-    /// in a Segment of this list it can be destroyed and the backing memory
+    /// in a Segment of this list (no older RPCs are outstanding and no
+    /// PinnedChunks refer to it) it can be destroyed and the backing memory
     /// returned to the freeList.
     SegmentList freePendingReferenceList;
 
@@ -364,18 +415,13 @@ class Log {
     /// the system (e.g. does the Segment a Tombstone refers to still exist?).
     ActiveIdMap activeIdMap;
 
-    /// Segment base address -> Segment * lookup within the active Segments (any
-    /// Segment that exists in the system, including the log head). This is used
-    /// during object deletion to obtain a reference to the associated Segment
-    /// so that utilisation statistics can be updated.
-
-    // TODO(Rumble): We can do away with this at least two different ways. The
-    // first is to not update stats as we go, but have the LogCleaner do so by
-    // checking if each object is live. Alternatively, we can just ensure that
-    // Segment objects are allocated contiguously and compute the offset. If we
-    // do that, we can then just add space to the backing memory for a Segment
-    // and do placement new on that.
-    BaseAddressMap activeBaseAddressMap;
+    /// The active Segment (any Segment that exists in the system, including
+    /// the log head) occupying each #segmentCapacity slot of #segmentMemory,
+    /// or NULL. This is used to find the Segment an entry lives in, for
+    /// instance to pin it for a read or to update utilisation statistics when
+    /// the entry is freed. Entries only change with #listLock held, but are
+    /// read without it: the caller must know the Segment can't be freed.
+    std::vector<Segment*> activeSegmentSlots;
 
     /// Per-LogEntryType callbacks (e.g. for relocation).
     LogTypeMap logTypeMap;
@@ -15,11 +15,13 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <limits>
 
 #include "Common.h"
 #include "Fence.h"
 #include "Log.h"
 #include "LogCleaner.h"
+#include "RawMetrics.h"
 #include "ShortMacros.h"
 #include "Segment.h"
 #include "SegmentIterator.h"
@@ -40,20 +42,38 @@ namespace RAMCloud {
  *      the #clean method. If false, it's expected that the owner of
  *      this object will call the #clean method when they want cleaning
  *      to occur.
+ * \param[in] numThreads
+ *      The number of threads to relocate live data with during each
+ *      cleaning pass. The calling thread counts as one of them.
+ * \param[in] policyType
+ *      Which CleaningPolicy to choose Segments to clean with.
  */
 LogCleaner::LogCleaner(Log* log,
                        ReplicaManager *replicaManager,
-                       bool startThread)
+                       bool startThread,
+                       uint32_t numThreads,
+                       CleaningPolicyType policyType)
     : bytesFreedBeforeLastCleaning(0),
       scanList(),
       nextScannedSegmentId(0),
       cleanableSegments(),
       log(log),
       replicaManager(replicaManager),
+      replicaManagerLock(),
+      numThreads(std::max(numThreads, 1U)),
+      policy(),
       thread(),
       threadShouldExit(false),
       perfCounters()
 {
+    if (policyType == GREEDY_POLICY)
+        policy.reset(new GreedyPolicy());
+    else if (policyType == CLOCK_EVICTION_POLICY)
+        policy.reset(new ClockEvictionPolicy());
+    else
+        policy.reset(new CostBenefitPolicy());
+
+    metrics->master.cleanerThreads = this->numThreads;
     if (startThread)
         thread.construct(cleanerThreadEntry, this, &Context::get());
 }
@@ -88,12 +108,14 @@ LogCleaner::clean()
 
     SegmentVector segmentsToClean;
     LiveSegmentEntryHandleVector liveEntries;
+    RelocationTaskVector tasks;
     std::vector<void*> cleanSegmentMemory;
 
     // Check to see if the Log is out of memory. If so, we need to do an
     // emergency cleaning pass.
     if (log->freeListCount() == 0) {
         if (!setUpEmergencyCleaningPass(liveEntries,
+                                        tasks,
                                         cleanSegmentMemory,
                                         segmentsToClean)) {
             // Reset counters to ignore this failed pass.
@@ -111,10 +133,14 @@ LogCleaner::clean()
         perfCounters.emergencyCleaningPasses++;
     } else {
         if (!setUpNormalCleaningPass(liveEntries,
+                                     tasks,
                                      cleanSegmentMemory,
                                      segmentsToClean)) {
-            // Reset counters to ignore this failed pass.
+            // Reset counters to ignore this failed pass. Any evictions it
+            // made can't be undone, though, so keep counting them.
+            uint64_t entriesEvicted = perfCounters.entriesEvicted;
             perfCounters = before;
+            perfCounters.entriesEvicted = entriesEvicted;
             perfCounters.failedEmergencyPasses++;
             perfCounters.failedEmergencyPassTicks += totalTicks.stop();
             return false;
@@ -123,7 +149,7 @@ LogCleaner::clean()
         perfCounters.cleaningPasses++;
     }
 
-    moveLiveData(liveEntries, cleanSegmentMemory, segmentsToClean);
+    moveLiveData(liveEntries, tasks, cleanSegmentMemory, segmentsToClean);
     perfCounters.segmentsCleaned += segmentsToClean.size();
 
     CycleCounter<uint64_t> logTicks(&perfCounters.cleaningCompleteTicks);
@@ -131,9 +157,17 @@ LogCleaner::clean()
     logTicks.stop();
 
     totalTicks.stop();
-    perfCounters.cleaningPassTicks += totalPassTicks.stop();
+    uint64_t passTicks = totalPassTicks.stop();
+    perfCounters.cleaningPassTicks += passTicks;
     dumpCleaningPassStats(before);
 
+    PerfCounters delta = perfCounters - before;
+    metrics->master.cleanerPassCount++;
+    metrics->master.cleanerPassTicks += passTicks;
+    metrics->master.cleanerSegmentsCleaned += delta.segmentsCleaned;
+    metrics->master.cleanerSegmentsGenerated += delta.segmentsGenerated;
+    metrics->master.cleanerEntriesEvicted += delta.entriesEvicted;
+
     return true;
 }
 
@@ -178,6 +212,24 @@ LogCleaner::cleanerThreadEntry(LogCleaner* logCleaner, Context* context)
     }
 }
 
+/**
+ * Entry point for the extra threads a cleaning pass uses to relocate live
+ * data. Each claims RelocationTasks from \a tasks, using \a nextTask to
+ * avoid running one twice, until there are none left and then exits.
+ */
+void
+LogCleaner::relocationThreadEntry(LogCleaner* logCleaner,
+                                  LiveSegmentEntryHandleVector* liveData,
+                                  RelocationTaskVector* tasks,
+                                  std::atomic<size_t>* nextTask,
+                                  Context* context)
+{
+    Context::Guard _(*context);
+    size_t i;
+    while ((i = (*nextTask)++) < tasks->size())
+        logCleaner->relocateLiveEntries(*liveData, (*tasks)[i]);
+}
+
 /**
  * Dump a table of various cleaning times and counters to the log
  * for human consumption.
@@ -236,6 +288,8 @@ LogCleaner::dumpCleaningPassStats(PerfCounters& before)
         static_cast<double>(delta.liveEntriesRelocated));
     LOG(level, "    Entries Rolled Back:            %9lu",
         delta.entriesRolledBack);
+    LOG(level, "    Entries Evicted:                %9lu",
+        delta.entriesEvicted);
     LOG(level, "    Average Entry Size + Metadata:  %9lu   "
         "(%lu bytes overall)",
         (delta.entriesLivenessChecked == 0) ? 0 :
@@ -569,13 +623,59 @@ LogCleaner::scanSegmentForFreeSpace(CleanableSegment& cleanableSegment)
     perfCounters.scanForFreeSpaceSegments++;
 }
 
+/**
+ * Score a Segment by the LFS cost-benefit formula, adjusted for Segments
+ * that never need to be read from disk. See CleaningPolicy::score.
+ */
+double
+LogCleaner::CostBenefitPolicy::score(Segment* segment, uint32_t now)
+{
+    int utilisation = segment->getUtilisation();
+    if (utilisation == 0)
+        return std::numeric_limits<double>::max();  // empty Segments are
+                                                    // priceless
+    uint64_t timestamp = segment->getAverageTimestamp();
+
+    // Mathematically this should be assured, however, a few issues
+    // can potentially pop up:
+    //  1) improper synchronisation in Segment.cc
+    //  2) unsynchronised clocks and "newer" recovered data in the
+    //     Log
+    //  3) unsynchronised TSCs (WallTime uses rdtsc)
+    assert(timestamp <= now);
+
+    uint64_t age = now - timestamp;
+    return static_cast<double>((100 - utilisation) * age) / utilisation;
+}
+
+/**
+ * Score a Segment by how much free space it has. See CleaningPolicy::score.
+ */
+double
+LogCleaner::GreedyPolicy::score(Segment* segment, uint32_t now)
+{
+    return 100 - segment->getUtilisation();
+}
+
+/**
+ * Score a Segment by its position in the log: the oldest Segment (lowest
+ * identifier) scores highest, so the cleaner sweeps the log in order.
+ * See CleaningPolicy::score.
+ */
+double
+LogCleaner::ClockEvictionPolicy::score(Segment* segment, uint32_t now)
+{
+    return -static_cast<double>(segment->getId());
+}
+
 /**
  * Decide which Segments, if any, to clean and return them in the provided
- * vector. This method implements the policy that determines which Segments
- * to clean, how many to clean, and whether or not to clean at all right
- * now. Note that any Segments returned from this method have NOT already
- * been removed from the #cleanableSegments vector. If cleaning is performed
- * they should be removed from that vector.
+ * vector. Candidates are ranked by #policy; this method decides how many of
+ * the best ones to clean, and whether or not to clean at all right now.
+ * Evicting policies clean only when free Segments run low, but then do
+ * so regardless of write cost. Note that any Segments returned from this
+ * method have NOT already been removed from the #cleanableSegments vector.
+ * If cleaning is performed they should be removed from that vector.
  *
  * \param[out] segmentsToClean
  *      Pointers to Segments that should be cleaned are appended to this
@@ -588,12 +688,17 @@ LogCleaner::getSegmentsToClean(SegmentVector& segmentsToClean)
 
     assert(segmentsToClean.size() == 0);
 
+    if (policy->evicts()) {
+        getSegmentsToEvict(segmentsToClean);
+        return;
+    }
+
     if (cleanableSegments.size() < CLEANED_SEGMENTS_PER_PASS)
         return;
 
     std::sort(cleanableSegments.begin(),
               cleanableSegments.end(),
-              CostBenefitLessThan());
+              PolicyLessThan(policy.get()));
 
     // Calculate the write cost for the best candidate Segments, i.e.
     // the number of bytes we need to write out in total to write however
@@ -644,6 +749,47 @@ LogCleaner::getSegmentsToClean(SegmentVector& segmentsToClean)
     LOG(DEBUG, "writeCost %.2f", cost);
 }
 
+/**
+ * The half of #getSegmentsToClean used by evicting policies. Once fewer
+ * than EVICTION_FREE_PERCENT of the log's Segments are free, the best
+ * CLEANED_SEGMENTS_PER_PASS candidates are chosen no matter how full they
+ * are: their live entries will mostly be evicted rather than relocated,
+ * so the usual write cost limit does not apply.
+ *
+ * \param[out] segmentsToClean
+ *      Pointers to Segments that should be cleaned are appended to this
+ *      empty vector.
+ */
+void
+LogCleaner::getSegmentsToEvict(SegmentVector& segmentsToClean)
+{
+    if (cleanableSegments.size() == 0)
+        return;
+
+    size_t numSegments = log->getCapacity() / log->getSegmentCapacity();
+    size_t minimumFree = numSegments * EVICTION_FREE_PERCENT / 100;
+    if (minimumFree == 0)
+        minimumFree = 1;
+    if (log->freeListCount() >= minimumFree)
+        return;
+
+    std::sort(cleanableSegments.begin(),
+              cleanableSegments.end(),
+              PolicyLessThan(policy.get()));
+
+    size_t numSegmentsToClean = cleanableSegments.size();
+    if (numSegmentsToClean > CLEANED_SEGMENTS_PER_PASS)
+        numSegmentsToClean = CLEANED_SEGMENTS_PER_PASS;
+    for (size_t i = 0; i < numSegmentsToClean; i++) {
+        size_t segmentIndex = cleanableSegments.size() - i - 1;
+        segmentsToClean.push_back(cleanableSegments[segmentIndex].segment);
+    }
+
+    // For unit testing's benefit.
+    LOG(DEBUG, "evicting from %lu segments, %lu free",
+        numSegmentsToClean, log->freeListCount());
+}
+
 /**
  * Walk a segment, extract all live entries, and append them to the
  * provided output vector. Return the total number of bytes in live
@@ -680,6 +826,12 @@ LogCleaner::getLiveEntries(Segment* segment,
             bool isLive = cb->livenessCB(handle, cb->livenessArg);
             livenessTicks.stop();
 
+            if (isLive && policy->evicts() && cb->evictionCB != NULL &&
+              cb->evictionCB(handle, cb->evictionArg)) {
+                perfCounters.entriesEvicted++;
+                isLive = false;
+            }
+
             if (isLive) {
                 assert(cb->timestampCB != NULL);
                 liveEntries.push_back({ handle, cb->timestampCB(handle) });
@@ -730,6 +882,125 @@ LogCleaner::getSortedLiveEntries(SegmentVector& segments,
     return liveEntryBytes;
 }
 
+/**
+ * Return the age class of an entry written at the given time. Entries
+ * whose ages are within a factor of two of one another share a class.
+ */
+int
+LogCleaner::ageClass(uint32_t timestamp, uint32_t now)
+{
+    if (timestamp >= now)
+        return 0;
+    return 32 - __builtin_clz(now - timestamp);
+}
+
+/**
+ * Divide a pass's age-sorted live entries into contiguous runs to be
+ * relocated separately, and work out how many clean Segments each run
+ * could need.
+ *
+ * If asked to, the entries are first cut wherever their age class (see
+ * #ageClass) changes, so that hot and cold data don't share survivors.
+ * A cut is only made once the data before it fills a Segment, since each
+ * run may leave its last survivor partly empty. Each of these groups is
+ * then split into up to \a maxTasks runs of roughly equal size, one per
+ * thread. Every run but the last of a group gets at least a Segment's
+ * worth of data.
+ *
+ * \param[in] liveEntries
+ *      The live entries of the pass, sorted by age.
+ * \param[in] maxTasks
+ *      The largest number of runs to split each group of entries into.
+ * \param[in] segregateByAge
+ *      If true, cut the entries into groups of similar age first.
+ * \param[out] tasks
+ *      One RelocationTask per run is appended to this empty vector. There
+ *      is always at least one.
+ * \return
+ *      The total number of clean Segments needed by all of the tasks.
+ */
+size_t
+LogCleaner::splitLiveEntries(LiveSegmentEntryHandleVector& liveEntries,
+                             uint32_t maxTasks,
+                             bool segregateByAge,
+                             RelocationTaskVector& tasks)
+{
+    assert(tasks.size() == 0);
+
+    uint32_t now = secondsTimestamp();
+    size_t segmentsNeeded = 0;
+    size_t first = 0;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < liveEntries.size(); i++) {
+        if (segregateByAge &&
+          bytes >= log->getSegmentCapacity() &&
+          ageClass(liveEntries[i].timestamp, now) !=
+          ageClass(liveEntries[i - 1].timestamp, now)) {
+            segmentsNeeded += splitRun(liveEntries, first, i, maxTasks, tasks);
+            first = i;
+            bytes = 0;
+        }
+        bytes += liveEntries[i].totalLength;
+    }
+    segmentsNeeded += splitRun(liveEntries, first, liveEntries.size(),
+                               maxTasks, tasks);
+
+    return segmentsNeeded;
+}
+
+/**
+ * Helper method for splitLiveEntries(). Split the live entries in
+ * [\a begin, \a end) into up to \a maxTasks RelocationTasks of roughly
+ * equal size, appending them to \a tasks. At least one task is always
+ * appended, even if the range is empty.
+ *
+ * \return
+ *      The number of clean Segments needed by the tasks appended.
+ */
+size_t
+LogCleaner::splitRun(LiveSegmentEntryHandleVector& liveEntries,
+                     size_t begin, size_t end,
+                     uint32_t maxTasks,
+                     RelocationTaskVector& tasks)
+{
+    // Entries' lengths here include their SegmentEntry headers, which
+    // maximumSegmentsNeededForEntries accounts for itself.
+    uint64_t totalBytes = 0;
+    for (size_t i = begin; i < end; i++)
+        totalBytes += liveEntries[i].totalLength;
+
+    uint64_t numTasks = std::min(static_cast<uint64_t>(maxTasks),
+                                 totalBytes / log->getSegmentCapacity());
+    numTasks = std::max(numTasks, 1UL);
+    uint64_t bytesPerTask = totalBytes / numTasks;
+
+    size_t segmentsNeeded = 0;
+    uint64_t tasksAdded = 0;
+    size_t first = begin;
+    do {
+        uint64_t bytes = 0;
+        size_t last = first;
+        while (last < end &&
+               (bytes < bytesPerTask || tasksAdded == numTasks - 1)) {
+            bytes += liveEntries[last].totalLength;
+            last++;
+        }
+
+        size_t numEntries = last - first;
+        size_t needed = Segment::maximumSegmentsNeededForEntries(
+                            numEntries,
+                            bytes - numEntries * sizeof(SegmentEntry),
+                            log->maximumBytesPerAppend,
+                            log->getSegmentCapacity());
+        tasks.push_back({ first, numEntries, needed });
+        tasksAdded++;
+        segmentsNeeded += needed;
+        first = last;
+    } while (first < end);
+
+    return segmentsNeeded;
+}
+
 /**
  * Helper method for moveLiveData().
  *
@@ -814,12 +1085,9 @@ LogCleaner::moveToFillSegment(Segment* lastNewSegment,
 }
 
 /**
- * Move the specified live data to new Segments and call the appropriate
- * type handler to deal with the relocation. Any newly created Segments
- * are returned in the #segmentsAdded parameter. Upon return, all new
- * Segments have been closed and synced to backups, if any are used.
- * This is the function that relocates live data from Segments we're trying
- * to clean to new, compacted Segments. 
+ * Relocate one run of live entries into survivor Segments of the task's
+ * own. This is the per-thread part of #moveLiveData() and may run in
+ * parallel with other tasks of the same pass.
  *
  * Importantly, some data we're trying to write may no longer be live (e.g.
  * objects may have been overwritten or deleted since). This is fine, however,
@@ -828,35 +1096,26 @@ LogCleaner::moveToFillSegment(Segment* lastNewSegment,
  * not live anymore.
  *
  * \param[in] liveData
- *      Vector of SegmentEntryHandles of recently live data to move.
- * \param[in] cleanSegmentMemory
- *      Vector of clean segment memory to use to write the live data in to.
- *      This contains the maximum number of clean segments we could possibly
- *      need to move all of the live data. This preallocation of segments from
- *      the log and ensures that this method can complete the cleaning pass.
- *      Memory that is used from this vector should be removed from it. If any
- *      remain after the method completes they will be returned to the log for
- *      immediate reuse.
- * \param[out] segmentsToClean
- *      Vector of Segments from which liveData came. This is only to be used
- *      if we choose to clean addition Segmnts not previously specified (e.g.
- *      in the moveToFillSegment method when packing the last new Segment).
+ *      Vector of SegmentEntryHandles of recently live data, sorted by age.
+ *      Only the entries described by \a task are touched.
+ * \param[in,out] task
+ *      The entries to move and the segment memory to move them into.
+ *      Memory that is used is removed from the task and the Segments
+ *      created from it are added to its survivors.
  */
 void
-LogCleaner::moveLiveData(LiveSegmentEntryHandleVector& liveData,
-                         std::vector<void*>& cleanSegmentMemory,
-                         SegmentVector& segmentsToClean)
+LogCleaner::relocateLiveEntries(LiveSegmentEntryHandleVector& liveData,
+                                RelocationTask& task)
 {
-    CycleCounter<uint64_t> _(&perfCounters.moveLiveDataTicks);
+    PerfCounters& counters = task.perfCounters;
+    PowerOfTwoSegmentBins segmentBins(counters);
+    size_t endEntry = task.firstEntry + task.numEntries;
 
-    SegmentVector segmentsAdded;
-    PowerOfTwoSegmentBins segmentBins(perfCounters);
-
-    for (size_t i = 0; i < liveData.size(); i++) {
+    for (size_t i = task.firstEntry; i < endEntry; i++) {
         LiveSegmentEntry& liveEntry = liveData[i];
 
         // Try to prefetch ahead, if possible.
-        if (i + PREFETCH_OFFSET < liveData.size()) {
+        if (i + PREFETCH_OFFSET < endEntry) {
             uint32_t maxFetch = MAX_PREFETCH_BYTES;
             prefetch(liveData[i + PREFETCH_OFFSET].handle,
                 std::min(liveData[i + PREFETCH_OFFSET].totalLength, maxFetch));
@@ -883,45 +1142,124 @@ LogCleaner::moveLiveData(LiveSegmentEntryHandleVector& liveData,
             if (segmentUsed == NULL) {
                 // This should never fail. The caller should have
                 // pre-allocated all we need.
-                void* segmentMemory = cleanSegmentMemory.back();
-                cleanSegmentMemory.pop_back();
-
-                Segment* newSeg = new Segment(log,
-                                              log->allocateSegmentId(),
-                                              segmentMemory,
-                                              log->getSegmentCapacity(),
-                                              replicaManager,
-                                              LOG_ENTRY_TYPE_UNINIT, NULL, 0);
+                void* segmentMemory = task.segmentMemory.back();
+                task.segmentMemory.pop_back();
+
+                Segment* newSeg;
+                {
+                    std::lock_guard<SpinLock> lock(replicaManagerLock);
+                    newSeg = new Segment(log,
+                                         log->allocateSegmentId(),
+                                         segmentMemory,
+                                         log->getSegmentCapacity(),
+                                         replicaManager,
+                                         LOG_ENTRY_TYPE_UNINIT, NULL, 0);
+                }
 
-                segmentsAdded.push_back(newSeg);
+                task.survivors.push_back(newSeg);
                 segmentBins.addSegment(newSeg);
                 log->cleaningInto(newSeg);
                 continue;
             }
 
-            CycleCounter<uint64_t> _(&perfCounters.segmentAppendTicks);
+            CycleCounter<uint64_t> _(&counters.segmentAppendTicks);
             newHandle = segmentUsed->append(handle, false);
         }
 
         const LogTypeInfo* cb = log->getTypeInfo(handle->type());
 
-        CycleCounter<uint64_t> relTicks(&perfCounters.relocationCallbackTicks);
+        CycleCounter<uint64_t> relTicks(&counters.relocationCallbackTicks);
         bool relocated = cb->relocationCB(handle, newHandle, cb->relocationArg);
         relTicks.stop();
 
         if (relocated) {
-            perfCounters.liveEntriesRelocated++;
-            perfCounters.relocEntryTypeCounts[handle->type()]++;
+            counters.liveEntriesRelocated++;
+            counters.relocEntryTypeCounts[handle->type()]++;
             segmentBins.updateSegment(segmentUsed);
         } else {
-            perfCounters.entriesRolledBack++;
+            counters.entriesRolledBack++;
             segmentUsed->rollBack(newHandle);
         }
     }
+}
+
+/**
+ * Move the specified live data to new Segments and call the appropriate
+ * type handler to deal with the relocation. Any newly created Segments
+ * are returned in the #segmentsAdded parameter. Upon return, all new
+ * Segments have been closed and synced to backups, if any are used.
+ * This is the function that relocates live data from Segments we're trying
+ * to clean to new, compacted Segments. 
+ *
+ * Each of the given tasks is relocated into its own survivor Segments
+ * (see #relocateLiveEntries). Up to #numThreads threads, including the
+ * calling one, work through the tasks in parallel.
+ *
+ * \param[in] liveData
+ *      Vector of SegmentEntryHandles of recently live data to move.
+ * \param[in] tasks
+ *      How to divide up \a liveData between threads, as computed by
+ *      #splitLiveEntries.
+ * \param[in] cleanSegmentMemory
+ *      Vector of clean segment memory to use to write the live data in to.
+ *      This contains the maximum number of clean segments we could possibly
+ *      need to move all of the live data. This preallocation of segments from
+ *      the log and ensures that this method can complete the cleaning pass.
+ *      Memory that is used from this vector should be removed from it. If any
+ *      remain after the method completes they will be returned to the log for
+ *      immediate reuse.
+ * \param[out] segmentsToClean
+ *      Vector of Segments from which liveData came. This is only to be used
+ *      if we choose to clean addition Segmnts not previously specified (e.g.
+ *      in the moveToFillSegment method when packing the last new Segment).
+ */
+void
+LogCleaner::moveLiveData(LiveSegmentEntryHandleVector& liveData,
+                         RelocationTaskVector& tasks,
+                         std::vector<void*>& cleanSegmentMemory,
+                         SegmentVector& segmentsToClean)
+{
+    CycleCounter<uint64_t> _(&perfCounters.moveLiveDataTicks);
+
+    foreach (RelocationTask& task, tasks) {
+        for (size_t i = 0; i < task.segmentsNeeded; i++) {
+            task.segmentMemory.push_back(cleanSegmentMemory.back());
+            cleanSegmentMemory.pop_back();
+        }
+    }
 
-    // End game: try to get good utilisation out of the last Segment.
-    if (segmentsAdded.size() > 0)
-        moveToFillSegment(segmentsAdded.back(), segmentsToClean);
+    std::atomic<size_t> nextTask(0);
+    std::vector<std::thread*> threads;
+    size_t threadsNeeded = std::min(tasks.size(),
+                                    static_cast<size_t>(numThreads));
+    for (size_t i = 1; i < threadsNeeded; i++) {
+        threads.push_back(new std::thread(relocationThreadEntry, this,
+                                          &liveData, &tasks, &nextTask,
+                                          &Context::get()));
+    }
+    relocationThreadEntry(this, &liveData, &tasks, &nextTask,
+                          &Context::get());
+    foreach (std::thread* thread, threads) {
+        thread->join();
+        delete thread;
+    }
+
+    SegmentVector segmentsAdded;
+    foreach (RelocationTask& task, tasks) {
+        perfCounters += task.perfCounters;
+        cleanSegmentMemory.insert(cleanSegmentMemory.end(),
+                                  task.segmentMemory.begin(),
+                                  task.segmentMemory.end());
+        task.segmentMemory.clear();
+
+        // End game: try to get good utilisation out of each task's last
+        // Segment.
+        if (task.survivors.size() > 0)
+            moveToFillSegment(task.survivors.back(), segmentsToClean);
+        segmentsAdded.insert(segmentsAdded.end(),
+                             task.survivors.begin(),
+                             task.survivors.end());
+    }
 
     // Close and sync all newly created Segments.
     CycleCounter<uint64_t> syncTicks(&perfCounters.closeAndSyncTicks);
@@ -945,6 +1283,10 @@ LogCleaner::moveLiveData(LiveSegmentEntryHandleVector& liveData,
  *      Vector of live entries to store references to entries in segments that
  *      will be cleaned.
  *
+ * \param[out] tasks
+ *      How the live entries are to be divided up between #numThreads
+ *      threads and, if #policy asks for it, segregated by age.
+ *
  * \param[out] cleanSegmentMemory
  *      Vector of segment memory that will be used for the survivor segments.
  *      This is preallocated to ensure that cleaning can proceed.
@@ -959,6 +1301,7 @@ LogCleaner::moveLiveData(LiveSegmentEntryHandleVector& liveData,
  */
 bool
 LogCleaner::setUpNormalCleaningPass(LiveSegmentEntryHandleVector& liveEntries,
+                                    RelocationTaskVector& tasks,
                                     std::vector<void*>& cleanSegmentMemory,
                                     SegmentVector& segmentsToClean)
 {
@@ -976,11 +1319,8 @@ LogCleaner::setUpNormalCleaningPass(LiveSegmentEntryHandleVector& liveEntries,
         (log->getSegmentCapacity() / MIN_ENTRY_BYTES));
     uint64_t liveEntryBytes = getSortedLiveEntries(segmentsToClean,
                                                    liveEntries);
-    size_t segmentsNeeded = Segment::maximumSegmentsNeededForEntries(
-                                                liveEntries.size(),
-                                                liveEntryBytes,
-                                                log->maximumBytesPerAppend,
-                                                log->getSegmentCapacity());
+    size_t segmentsNeeded = splitLiveEntries(liveEntries, numThreads,
+                                             policy->segregateByAge(), tasks);
 
     // Try to allocate the number of clean segments we'll need to complete
     // this pass up front. There's no guarantee that we'll have enough. If we
@@ -1018,6 +1358,11 @@ LogCleaner::setUpNormalCleaningPass(LiveSegmentEntryHandleVector& liveEntries,
  *      Vector of live entries to store references to entries in segments that
  *      will be cleaned.
  *
+ * \param[out] tasks
+ *      How the live entries are to be relocated. Emergency passes always
+ *      use a single thread, since each extra one may need an extra clean
+ *      Segment that we can't spare.
+ *
  * \param[out] cleanSegmentMemory
  *      Vector of segment memory that will be used for the survivor segments.
  *      This is preallocated to ensure that cleaning can proceed.
@@ -1033,6 +1378,7 @@ LogCleaner::setUpNormalCleaningPass(LiveSegmentEntryHandleVector& liveEntries,
 bool
 LogCleaner::setUpEmergencyCleaningPass(
                                     LiveSegmentEntryHandleVector& liveEntries,
+                                    RelocationTaskVector& tasks,
                                     std::vector<void*>& cleanSegmentMemory,
                                     SegmentVector& segmentsToClean)
 {
@@ -1093,6 +1439,7 @@ LogCleaner::setUpEmergencyCleaningPass(
         // Sort the live entries.
         SegmentVector empty;
         getSortedLiveEntries(empty, liveEntries);
+        splitLiveEntries(liveEntries, 1, false, tasks);
 
         // Be sure to remove the Segments we'll clean from the list.
         for (i = 0; i < segmentsToClean.size(); i++)
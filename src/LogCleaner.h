@@ -16,6 +16,8 @@
 #ifndef RAMCLOUD_LOGCLEANER_H
 #define RAMCLOUD_LOGCLEANER_H
 
+#include <atomic>
+#include <memory>
 #include <thread>
 #include <vector>
 
@@ -23,6 +25,7 @@
 #include "LogTypes.h"
 #include "Log.h"
 #include "Segment.h"
+#include "SpinLock.h"
 #include "ReplicaManager.h"
 
 namespace RAMCloud {
@@ -43,7 +46,8 @@ class Log;
  * of free space, but also for Segments that have less free space but a lot
  * of old data (the assumption being that old data is unlikely to die and
  * cleaning old data will reduce fragmentation and not soon require another
- * cleaning).
+ * cleaning). How candidates are ranked is up to a CleaningPolicy, so other
+ * rankings (e.g. LFS's greedy policy) can be swapped in for comparison.
  *
  * In addition, the LogCleaner attempts to segregate entries by age in the
  * hopes of packing old data and new data into different Segments. This has
@@ -51,11 +55,110 @@ class Log;
  * so those Segments will maintain high utilisation and therefore require
  * less cleaning. Second, new data is more likely to fragment, so Segments
  * containing newer data will hopefully be cheaper to clean in the future.
+ * If the policy asks for it, survivors are also split at age boundaries
+ * (see #splitLiveEntries) so that a survivor Segment doesn't straddle data
+ * of very different ages.
+ *
+ * A single cleaning pass may relocate live data using several threads. The
+ * age-sorted live entries are split into contiguous runs, and each run is
+ * written into its own survivor Segments by one of the threads, so the age
+ * segregation above is preserved and threads never append to the same
+ * Segment. Choosing Segments, collecting live entries
+ * and handing the results to the Log are still done by one thread.
  */
 class LogCleaner {
   public:
+    /// The CleaningPolicy implementations a LogCleaner can be built with.
+    typedef enum {
+        COST_BENEFIT_POLICY   = 0,
+        GREEDY_POLICY         = 1,
+        CLOCK_EVICTION_POLICY = 2
+    } CleaningPolicyType;
+
+    /**
+     * Interface for the policy that decides which Segments are the best to
+     * clean next, and whether their survivors should be segregated by age.
+     */
+    class CleaningPolicy {
+      public:
+        virtual ~CleaningPolicy() {}
+
+        /**
+         * Return how worthwhile it would be to clean the given Segment.
+         * Segments with higher scores are cleaned first.
+         *
+         * \param[in] segment
+         *      The closed Segment to rank.
+         * \param[in] now
+         *      The current time, as returned by secondsTimestamp(). This
+         *      is the same for all Segments ranked together.
+         */
+        virtual double score(Segment* segment, uint32_t now) = 0;
+
+        /**
+         * Return true if live data of very different ages should be
+         * relocated into different survivor Segments.
+         */
+        virtual bool segregateByAge() = 0;
+
+        /**
+         * Return true if live entries in the chosen Segments should be
+         * offered to their type's eviction callback rather than always
+         * being relocated. Evicting policies also clean whenever free
+         * Segments run low, regardless of write cost.
+         */
+        virtual bool evicts() = 0;
+    };
+
+    /**
+     * The LFS cost-benefit policy: prefer Segments with lots of free space
+     * and old data, since old data is unlikely to be freed soon. Since
+     * Segments live in memory we need not read them in to clean them, so
+     * the cost is only that of writing out the live data:
+     * score = free * age / live.
+     */
+    class CostBenefitPolicy : public CleaningPolicy {
+      public:
+        CostBenefitPolicy() {}
+        double score(Segment* segment, uint32_t now);
+        bool segregateByAge() { return true; }
+        bool evicts() { return false; }
+        DISALLOW_COPY_AND_ASSIGN(CostBenefitPolicy);
+    };
+
+    /**
+     * The greedy policy: always clean the least utilised Segments and
+     * ignore age entirely. This is mostly useful as a baseline to compare
+     * CostBenefitPolicy against.
+     */
+    class GreedyPolicy : public CleaningPolicy {
+      public:
+        GreedyPolicy() {}
+        double score(Segment* segment, uint32_t now);
+        bool segregateByAge() { return false; }
+        bool evicts() { return false; }
+        DISALLOW_COPY_AND_ASSIGN(GreedyPolicy);
+    };
+
+    /**
+     * The policy used when the log's owner is a bounded-memory cache: the
+     * oldest Segments are cleaned first, sweeping the log like the hand of
+     * a CLOCK. Each live entry swept is offered to its eviction callback,
+     * which either evicts it or, if it was referenced since the last
+     * sweep, clears its reference and lets it be relocated to the head.
+     */
+    class ClockEvictionPolicy : public CleaningPolicy {
+      public:
+        ClockEvictionPolicy() {}
+        double score(Segment* segment, uint32_t now);
+        bool segregateByAge() { return false; }
+        bool evicts() { return true; }
+        DISALLOW_COPY_AND_ASSIGN(ClockEvictionPolicy);
+    };
+
     explicit LogCleaner(Log* log, ReplicaManager* replicaManager,
-                        bool startThread);
+                        bool startThread, uint32_t numThreads = 1,
+                        CleaningPolicyType policyType = COST_BENEFIT_POLICY);
     ~LogCleaner();
     bool clean();
     void halt();
@@ -123,52 +226,30 @@ class LogCleaner {
     };
 
     /**
-     * CostBenefit comparison functor for a vector of Segment pointers.
-     * This is used to sort our array of cleanable Segments based on each
-     * one's associated cost-benefit calculation. Higher values (the better
+     * Comparison functor that sorts a vector of Segments by the score
+     * their CleaningPolicy gives them. Higher values (the better
      * candidates) come last. This lets us easily remove them by popping
      * the back, rather than pulling from the front and shifting all elements
      * down.
      */
-    struct CostBenefitLessThan {
+    struct PolicyLessThan {
       public:
-        CostBenefitLessThan()
-            : now(secondsTimestamp())
+        explicit PolicyLessThan(CleaningPolicy* policy)
+            : policy(policy),
+              now(secondsTimestamp())
         {
         }
 
-        uint64_t
-        costBenefit(Segment *s)
-        {
-            uint64_t costBenefit = ~(0UL);       // empty Segments are priceless
-
-            int utilisation = s->getUtilisation();
-            if (utilisation != 0) {
-                uint64_t timestamp = s->getAverageTimestamp();
-
-                // Mathematically this should be assured, however, a few issues
-                // can potentially pop up:
-                //  1) improper synchronisation in Segment.cc
-                //  2) unsynchronised clocks and "newer" recovered data in the
-                //     Log
-                //  3) unsynchronised TSCs (WallTime uses rdtsc)
-                assert(timestamp <= now);
-
-                uint64_t age = now - timestamp;
-                costBenefit = ((100 - utilisation) * age) / utilisation;
-            }
-
-            return costBenefit;
-        }
-
         bool
         operator()(CleanableSegment a, CleanableSegment b)
         {
-            return costBenefit(a.segment) < costBenefit(b.segment);
+            return policy->score(a.segment, now) <
+                   policy->score(b.segment, now);
         }
 
       private:
-        uint64_t now;
+        CleaningPolicy* policy;
+        uint32_t now;
     };
 
     /**
@@ -260,6 +341,7 @@ class LogCleaner {
               liveEntryBytes(0),
               liveEntriesRelocated(0),
               entriesRolledBack(0),
+              entriesEvicted(0),
               segmentsGenerated(0),
               segmentsCleaned(0),
               packLastDidWork(0),
@@ -312,6 +394,7 @@ class LogCleaner {
             _sub(liveEntryBytes);
             _sub(liveEntriesRelocated);
             _sub(entriesRolledBack);
+            _sub(entriesEvicted);
             _sub(segmentsGenerated);
             _sub(segmentsCleaned);
             _sub(packLastDidWork);
@@ -327,6 +410,58 @@ class LogCleaner {
             return ret;
         }
 
+        /**
+         * Add the counters of another PerfCounters object to this one.
+         * This is used to fold the counters kept by each thread of a
+         * cleaning pass back into the cleaner's.
+         */
+        PerfCounters&
+        operator+=(const PerfCounters& other)
+        {
+            #define _add(_x) _x += other._x
+            _add(newScanTicks);
+            _add(scanForFreeSpaceTicks);
+            _add(scanForFreeSpaceProgress);
+            _add(scanForFreeSpaceSegments);
+            _add(getSegmentsTicks);
+            _add(collectLiveEntriesTicks);
+            _add(livenessCallbackTicks);
+            _add(sortLiveEntriesTicks);
+            _add(moveLiveDataTicks);
+            _add(packLastTicks);
+            _add(segmentAppendTicks);
+            _add(closeAndSyncTicks);
+            _add(relocationCallbackTicks);
+            _add(cleaningCompleteTicks);
+            _add(cleanTicks);
+            _add(cleaningPassTicks);
+            _add(cleaningPasses);
+            _add(emergencyCleaningPasses);
+            _add(failedNormalPasses);
+            _add(failedNormalPassTicks);
+            _add(failedEmergencyPasses);
+            _add(failedEmergencyPassTicks);
+            _add(writeCostSum);
+            _add(entriesLivenessChecked);
+            _add(liveEntryBytes);
+            _add(liveEntriesRelocated);
+            _add(entriesRolledBack);
+            _add(entriesEvicted);
+            _add(segmentsGenerated);
+            _add(segmentsCleaned);
+            _add(packLastDidWork);
+            _add(packLastImprovementSum);
+            _add(generatedUtilisationSum);
+            _add(entriesInCleanedSegments);
+            for (size_t i = 0; i < arrayLength(entryTypeCounts); i++)
+                _add(entryTypeCounts[i]);
+            for (size_t i = 0; i < arrayLength(relocEntryTypeCounts); i++)
+                _add(relocEntryTypeCounts[i]);
+            #undef _add
+
+            return *this;
+        }
+
         uint64_t newScanTicks;              /// Time in scanSegment().
         uint64_t scanForFreeSpaceTicks;     /// Time in scanForFreeSpace().
         uint64_t scanForFreeSpaceProgress;  /// Invocations that got new stats.
@@ -354,6 +489,7 @@ class LogCleaner {
         uint64_t liveEntryBytes;            /// Total bytes in live entries.
         uint64_t liveEntriesRelocated;      /// Entries successfully relocated.
         uint64_t entriesRolledBack;         /// Entries rolled back (not live).
+        uint64_t entriesEvicted;            /// Live entries evicted.
         uint64_t segmentsGenerated;         /// New segments with live data.
         uint64_t segmentsCleaned;           /// Clean segments produced.
         uint64_t packLastDidWork;           /// # of segments pack last helped.
@@ -497,8 +633,53 @@ class LogCleaner {
         PerfCounters& perfCounters;
     };
 
+    /**
+     * A unit of work for the threads of a cleaning pass: a contiguous run
+     * of the age-sorted live entries, the clean segment memory set aside
+     * to relocate them into, and the survivor Segments they end up in.
+     */
+    class RelocationTask {
+      public:
+        RelocationTask(size_t firstEntry, size_t numEntries,
+                       size_t segmentsNeeded)
+            : firstEntry(firstEntry),
+              numEntries(numEntries),
+              segmentsNeeded(segmentsNeeded),
+              segmentMemory(),
+              survivors(),
+              perfCounters()
+        {
+        }
+
+        /// Index of the first live entry this task relocates.
+        size_t firstEntry;
+
+        /// Number of consecutive live entries this task relocates.
+        size_t numEntries;
+
+        /// The most survivor Segments this task's entries could need.
+        size_t segmentsNeeded;
+
+        /// Clean segment memory for this task's survivors. Any left over
+        /// when the task is done is handed back to the Log.
+        std::vector<void*> segmentMemory;
+
+        /// Survivor Segments created by this task, oldest first.
+        SegmentVector survivors;
+
+        /// Counters updated while running this task. These are added to the
+        /// cleaner's own once the task completes.
+        PerfCounters perfCounters;
+    };
+    typedef std::vector<RelocationTask> RelocationTaskVector;
+
     // cleaner thread entry point
     static void cleanerThreadEntry(LogCleaner* logCleaner, Context* context);
+    static void relocationThreadEntry(LogCleaner* logCleaner,
+                                      LiveSegmentEntryHandleVector* liveData,
+                                      RelocationTaskVector* tasks,
+                                      std::atomic<size_t>* nextTask,
+                                      Context* context);
 
     void dumpCleaningPassStats(PerfCounters& before);
     bool getCleanSegmentMemory(size_t segmentsNeeded,
@@ -512,19 +693,34 @@ class LogCleaner {
     void scanForFreeSpace();
     void scanSegmentForFreeSpace(CleanableSegment& cleanableSegment);
     void getSegmentsToClean(SegmentVector&);
+    void getSegmentsToEvict(SegmentVector&);
     size_t getLiveEntries(Segment* segment,
                           LiveSegmentEntryHandleVector& liveEntries);
     size_t getSortedLiveEntries(SegmentVector& segments,
                                 LiveSegmentEntryHandleVector& liveEntries);
     void moveToFillSegment(Segment* lastNewSegment,
                            SegmentVector& segmentsToClean);
+    static int ageClass(uint32_t timestamp, uint32_t now);
+    size_t splitLiveEntries(LiveSegmentEntryHandleVector& liveEntries,
+                            uint32_t maxTasks,
+                            bool segregateByAge,
+                            RelocationTaskVector& tasks);
+    size_t splitRun(LiveSegmentEntryHandleVector& liveEntries,
+                    size_t begin, size_t end,
+                    uint32_t maxTasks,
+                    RelocationTaskVector& tasks);
+    void relocateLiveEntries(LiveSegmentEntryHandleVector& data,
+                             RelocationTask& task);
     void moveLiveData(LiveSegmentEntryHandleVector& data,
+                      RelocationTaskVector& tasks,
                       std::vector<void*>& cleanSegmentMemory,
                       SegmentVector& segmentsToClean);
     bool setUpNormalCleaningPass(LiveSegmentEntryHandleVector& data,
+                                 RelocationTaskVector& tasks,
                                  std::vector<void*>& cleanSegmentMemory,
                                  SegmentVector& segmentsToClean);
     bool setUpEmergencyCleaningPass(LiveSegmentEntryHandleVector& data,
+                                    RelocationTaskVector& tasks,
                                     std::vector<void*>& cleanSegmentMemory,
                                     SegmentVector& segmentsToClean);
 
@@ -537,6 +733,10 @@ class LogCleaner {
     /// Maximum write cost we'll permit. Anything higher and we won't clean.
     static const double MAXIMUM_CLEANABLE_WRITE_COST = 6.0;
 
+    /// An evicting policy cleans whenever fewer than this percentage of the
+    /// log's Segments are free, so appends never have to wait for space.
+    static const size_t EVICTION_FREE_PERCENT = 10;
+
     /// When walking the age-sorted list of entries to relocate, prefetch the
     /// entry this far ahead of current position. Each operation takes long
     /// enough that prefetching need not be far ahead.
@@ -588,6 +788,19 @@ class LogCleaner {
     /// to manage the Segments we create while cleaning.
     ReplicaManager* replicaManager;
 
+    /// Serialises the creation of survivor Segments by the threads of a
+    /// cleaning pass, since opening a Segment calls into #replicaManager.
+    SpinLock replicaManagerLock;
+
+    /// The number of threads used to relocate live data in each cleaning
+    /// pass. Emergency passes always use one, since each extra thread may
+    /// need an extra survivor Segment.
+    uint32_t numThreads;
+
+    /// Ranks cleanable Segments and decides whether survivors are
+    /// segregated by age.
+    std::unique_ptr<CleaningPolicy> policy;
+
     /// Tub containing our cleaning thread, if we're told to instantiate one
     /// by whoever constructs this object.
     Tub<std::thread> thread;
@@ -17,9 +17,15 @@
  * \file
  * This implements a series of benchmarks for the log cleaner. Many of the
  * tests are cribbed from descriptions of the LFS simulator. We run this as
- * a client for end-to-end evaluation.
+ * a client for end-to-end evaluation. When it's done it reports the cleaning
+ * bandwidth the master achieved, along with the number of cleaner threads
+ * the master was started with (see --cleanerThreads) and the utilisation,
+ * so that runs can be compared. The write cost it reports shows how much
+ * the master's --cleanerPolicy gains on skewed (e.g. zipfian) workloads.
  */
 
+#include <math.h>
+
 #include "Common.h"
 
 #include "Context.h"
@@ -61,6 +67,44 @@ hotAndCold(uint64_t maxObjId)
     }
 }
 
+/**
+ * Choose object ids with a Zipfian distribution, so that a few objects are
+ * written very often and most rarely are. This uses the method from Gray
+ * et al., "Quickly Generating Billion-Record Synthetic Databases" (as does
+ * YCSB), with the same skew YCSB uses by default. Object 0 is the hottest.
+ */
+static uint64_t
+zipfian(uint64_t maxObjId)
+{
+    static const double THETA = 0.99;
+    static uint64_t n = 0;
+    static double zetan, eta, alpha, halfPowTheta;
+
+    // Precompute the constants the first time we're called.
+    if (n != maxObjId + 1) {
+        n = maxObjId + 1;
+        zetan = 0;
+        for (uint64_t i = 1; i <= n; i++)
+            zetan += 1 / pow(static_cast<double>(i), THETA);
+        double zeta2 = 1 + pow(0.5, THETA);
+        alpha = 1 / (1 - THETA);
+        eta = (1 - pow(2.0 / static_cast<double>(n), 1 - THETA)) /
+              (1 - zeta2 / zetan);
+        halfPowTheta = pow(0.5, THETA);
+    }
+
+    double u = static_cast<double>(generateRandom() >> 11) /
+               static_cast<double>(1UL << 53);
+    double uz = u * zetan;
+    if (uz < 1)
+        return 0;
+    if (uz < 1 + halfPowTheta)
+        return std::min(1UL, maxObjId);
+    uint64_t objId = static_cast<uint64_t>(static_cast<double>(n) *
+                                           pow(eta * u - eta + 1, alpha));
+    return std::min(objId, maxObjId);
+}
+
 static void
 runIt(RamCloud* client,
       uint64_t tableId,
@@ -108,6 +152,45 @@ runIt(RamCloud* client,
     printf("\n");
 }
 
+/**
+ * Print how hard the master's log cleaner worked while the benchmark ran.
+ * The last line is meant to be collected from runs with different numbers
+ * of cleaner threads and utilisations and compared.
+ */
+static void
+reportCleaning(ServerMetrics& before, ServerMetrics& after, int utilisation)
+{
+    ServerMetrics delta = after.difference(before);
+    uint64_t threads = after["master.cleanerThreads"];
+    uint64_t passes = delta["master.cleanerPassCount"];
+    uint64_t cleaned = delta["master.cleanerSegmentsCleaned"];
+    uint64_t generated = delta["master.cleanerSegmentsGenerated"];
+    double seconds = static_cast<double>(delta["master.cleanerPassTicks"]) /
+                     static_cast<double>(after["clockFrequency"]);
+    double segmentMegs = static_cast<double>(Segment::SEGMENT_SIZE) /
+                         1024 / 1024;
+
+    double cleanedMBps = 0;
+    double netMBps = 0;
+    double writeCost = 0;
+    if (cleaned > generated) {
+        writeCost = static_cast<double>(cleaned) /
+                    static_cast<double>(cleaned - generated);
+    }
+    if (seconds > 0) {
+        cleanedMBps = static_cast<double>(cleaned) * segmentMegs / seconds;
+        netMBps = (static_cast<double>(cleaned) -
+                   static_cast<double>(generated)) * segmentMegs / seconds;
+    }
+
+    printf("========== Cleaner ==========\n");
+    printf(" %lu passes in %.2f s, %lu segments cleaned, %lu generated\n",
+        passes, seconds, cleaned, generated);
+    printf(" write cost %.2f\n", writeCost);
+    printf(" threads %lu  utilisation %d%%  cleaned %.1f MB/s  "
+        "net %.1f MB/s\n", threads, utilisation, cleanedMBps, netMBps);
+}
+
 } // namespace RAMCloud
 
 using namespace RAMCloud;
@@ -146,8 +229,8 @@ try
         ("distribution,d",
          ProgramOptions::value<string>(&distribution)->
            default_value("uniform"),
-         "Object distribution; choose one of \"uniform\" or "
-         "\"hotAndCold\"");
+         "Object distribution; choose one of \"uniform\", "
+         "\"hotAndCold\" or \"zipfian\"");
 
     OptionParser optionParser(benchOptions, argc, argv);
 
@@ -160,9 +243,10 @@ try
             "inclusive\n");
         exit(1);
     }
-    if (distribution != "uniform" && distribution != "hotAndCold") {
-        fprintf(stderr, "ERROR: Distribution must be one of \"uniform\" or "
-            "\"hotAndCold\"\n");
+    if (distribution != "uniform" && distribution != "hotAndCold" &&
+      distribution != "zipfian") {
+        fprintf(stderr, "ERROR: Distribution must be one of \"uniform\", "
+            "\"hotAndCold\" or \"zipfian\"\n");
         exit(1);
     }
     if (objectSize < 1 || objectSize > MAX_OBJECT_SIZE) {
@@ -186,10 +270,16 @@ try
     client->createTable(tableName.c_str());
     uint64_t table = client->openTable(tableName.c_str());
 
+    // TODO(Rumble): u32 table ids!!
+    ServerMetrics before = client->getMetrics((uint32_t)table, 0);
     if (distribution == "uniform")
         runIt(client, table, maxObjectId, objectSize, uniform);
-    else
+    else if (distribution == "hotAndCold")
         runIt(client, table, maxObjectId, objectSize, hotAndCold);
+    else
+        runIt(client, table, maxObjectId, objectSize, zipfian);
+    ServerMetrics after = client->getMetrics((uint32_t)table, 0);
+    reportCleaning(before, after, utilisation);
 
     return 0;
 } catch (ClientException& e) {
@@ -26,6 +26,7 @@
 #include "Log.h"
 #include "LogTypes.h"
 #include "LogCleaner.h"
+#include "WallTime.h"
 
 namespace RAMCloud {
 
@@ -425,6 +426,74 @@ TEST_F(LogCleanerTest, getSegmentsToClean_costBenefitOrder) {
     }
 }
 
+TEST_F(LogCleanerTest, getSegmentsToClean_evict) {
+    Log log(serverId, 8192 * 40, 8192, 4298, NULL, Log::CLEANER_DISABLED);
+    log.registerType(LOG_ENTRY_TYPE_OBJ, true, NULL, NULL,
+        NULL, NULL, NULL, NULL, NULL);
+    LogCleaner* cleaner = &log.cleaner;
+    cleaner->policy.reset(new LogCleaner::ClockEvictionPolicy());
+    char buf[64];
+
+    // Nothing is freed, so a write cost gate would never let us clean.
+    // Evicting policies instead wait until free Segments run low.
+    SegmentVector segmentsToClean;
+    while (segmentsToClean.size() == 0) {
+        log.append(LOG_ENTRY_TYPE_OBJ, buf, sizeof(buf));
+        cleaner->scanNewCleanableSegments();
+        cleaner->getSegmentsToClean(segmentsToClean);
+    }
+    EXPECT_GT(4U, log.freeListCount());
+
+    // The oldest Segments are chosen first.
+    size_t segmentsPerPass = LogCleaner::CLEANED_SEGMENTS_PER_PASS;
+    EXPECT_EQ(segmentsPerPass, segmentsToClean.size());
+    for (size_t i = 1; i < segmentsToClean.size(); i++) {
+        EXPECT_LT(segmentsToClean[i - 1]->getId(),
+                  segmentsToClean[i]->getId());
+    }
+    EXPECT_EQ(segmentsToClean[0], cleaner->cleanableSegments.back().segment);
+}
+
+TEST_F(LogCleanerTest, cleaningPolicies) {
+    Log log(serverId, 8192 * 20, 8192, 8000, NULL, Log::CLEANER_DISABLED);
+    log.registerType(LOG_ENTRY_TYPE_OBJ, true, NULL, NULL,
+        NULL, NULL, fiveTimestampCB, NULL, NULL);
+    LogCleaner::CostBenefitPolicy costBenefit;
+    LogCleaner::GreedyPolicy greedy;
+    LogCleaner::ClockEvictionPolicy clock;
+
+    char segBuf[8192] __attribute__((aligned(8192)));
+    Segment s(1, 2, segBuf, sizeof(segBuf));
+    *const_cast<Log**>(&s.log) = &log;
+    EXPECT_EQ(std::numeric_limits<double>::max(), costBenefit.score(&s, 10));
+    EXPECT_EQ(100, greedy.score(&s, 10));
+
+    char buf[4000];
+    s.append(LOG_ENTRY_TYPE_OBJ, buf, sizeof(buf));
+    int u = s.getUtilisation();
+    uint64_t age = 10 - s.getAverageTimestamp();
+    EXPECT_EQ(100 - u, greedy.score(&s, 10));
+    EXPECT_DOUBLE_EQ(static_cast<double>((100 - u) * age) / u,
+                     costBenefit.score(&s, 10));
+
+    // Only cost-benefit prefers Segments with older data.
+    EXPECT_LT(costBenefit.score(&s, 10), costBenefit.score(&s, 20));
+    EXPECT_EQ(greedy.score(&s, 10), greedy.score(&s, 20));
+    EXPECT_TRUE(costBenefit.segregateByAge());
+    EXPECT_FALSE(greedy.segregateByAge());
+    EXPECT_FALSE(costBenefit.evicts());
+    EXPECT_FALSE(greedy.evicts());
+
+    // The clock policy only cares about log order.
+    char segBuf2[8192] __attribute__((aligned(8192)));
+    Segment s2(1, 3, segBuf2, sizeof(segBuf2));
+    *const_cast<Log**>(&s2.log) = &log;
+    EXPECT_GT(clock.score(&s, 10), clock.score(&s2, 10));
+    EXPECT_EQ(clock.score(&s, 10), clock.score(&s, 20));
+    EXPECT_FALSE(clock.segregateByAge());
+    EXPECT_TRUE(clock.evicts());
+}
+
 static bool
 livenessCB(LogEntryHandle h, void* cookie)
 {
@@ -486,6 +555,50 @@ TEST_F(LogCleanerTest, getLiveEntries) {
     EXPECT_EQ(h1->totalLength(), entries[0].totalLength);
 }
 
+static LogEntryHandle evictable = NULL;
+static int evictionCBCalled = 0;
+static bool
+evictionCB(LogEntryHandle h, void* cookie)
+{
+    evictionCBCalled++;
+    return h == evictable;
+}
+
+TEST_F(LogCleanerTest, getLiveEntries_evict) {
+    Log log(serverId, 8192 * 20, 8192, 8000, NULL, Log::CLEANER_DISABLED);
+    LogCleaner* cleaner = &log.cleaner;
+
+    log.registerType(LOG_ENTRY_TYPE_OBJ,
+                     true,
+                     livenessCB, NULL,
+                     relocationCB, NULL,
+                     timestampCB,
+                     scanCB3, NULL,
+                     evictionCB, NULL);
+
+    LogCleaner::LiveSegmentEntryHandleVector entries;
+    char buf[8192] __attribute__((aligned(8192)));
+    Segment s(1, 2, buf, sizeof(buf));
+    *const_cast<Log**>(&s.log) = &log;
+    LogEntryHandle h1 = s.append(LOG_ENTRY_TYPE_OBJ, "keep", 4);
+    evictable = s.append(LOG_ENTRY_TYPE_OBJ, "evict", 5);
+
+    // Non-evicting policies never ask.
+    evictionCBCalled = 0;
+    cleaner->getLiveEntries(&s, entries);
+    EXPECT_EQ(0, evictionCBCalled);
+    EXPECT_EQ(2U, entries.size());
+
+    entries.clear();
+    cleaner->policy.reset(new LogCleaner::ClockEvictionPolicy());
+    size_t liveBytes = cleaner->getLiveEntries(&s, entries);
+    EXPECT_EQ(2, evictionCBCalled);
+    EXPECT_EQ(h1->length(), liveBytes);
+    EXPECT_EQ(1U, entries.size());
+    EXPECT_EQ(h1, entries[0].handle);
+    EXPECT_EQ(1U, cleaner->perfCounters.entriesEvicted);
+}
+
 TEST_F(LogCleanerTest, getSortedLiveEntries) {
     Log log(serverId, 8192 * 20, 8192, 8000, NULL, Log::CLEANER_DISABLED);
     LogCleaner* cleaner = &log.cleaner;
@@ -515,6 +628,123 @@ TEST_F(LogCleanerTest, getSortedLiveEntries) {
     EXPECT_EQ(older->length() + newer->length(), liveBytes);
 }
 
+/**
+ * Fill a few Segments with 1000-byte objects and collect them, sorted, as
+ * the live entries of a cleaning pass.
+ */
+class LiveEntryFixture {
+  public:
+    LiveEntryFixture(Log& log, LogCleaner* cleaner)
+        : segments(), liveEntries()
+    {
+        for (uint32_t i = 0; i < arrayLength(bufs); i++) {
+            Segment* s = new Segment(1, i, bufs[i], sizeof(bufs[i]));
+            *const_cast<Log**>(&s->log) = &log;
+            char buf[1000];
+            for (int j = 0; j < 6; j++)
+                s->append(LOG_ENTRY_TYPE_OBJ, buf, sizeof(buf));
+            segments.push_back(s);
+        }
+        cleaner->getSortedLiveEntries(segments, liveEntries);
+    }
+
+    ~LiveEntryFixture()
+    {
+        foreach (Segment* s, segments)
+            delete s;
+    }
+
+    char bufs[4][8192] __attribute__((aligned(8192)));
+    SegmentVector segments;
+    LogCleaner::LiveSegmentEntryHandleVector liveEntries;
+    DISALLOW_COPY_AND_ASSIGN(LiveEntryFixture);
+};
+
+TEST_F(LogCleanerTest, splitLiveEntries) {
+    Log log(serverId, 8192 * 20, 8192, 2000, NULL, Log::CLEANER_DISABLED);
+    LogCleaner* cleaner = &log.cleaner;
+    log.registerType(LOG_ENTRY_TYPE_OBJ,
+                     true,
+                     livenessCB, NULL,
+                     relocationCB, NULL,
+                     timestampCB,
+                     scanCB3, NULL);
+    LiveEntryFixture f(log, cleaner);
+    ASSERT_EQ(24U, f.liveEntries.size());
+
+    LogCleaner::RelocationTaskVector tasks;
+    EXPECT_EQ(Segment::maximumSegmentsNeededForEntries(24, 24 * 1000, 2000,
+                                                       8192),
+              cleaner->splitLiveEntries(f.liveEntries, 1, true, tasks));
+    ASSERT_EQ(1U, tasks.size());
+    EXPECT_EQ(0U, tasks[0].firstEntry);
+    EXPECT_EQ(24U, tasks[0].numEntries);
+
+    // There are only about three Segments' worth of data, so no more than
+    // three threads get any.
+    tasks.clear();
+    size_t needed = cleaner->splitLiveEntries(f.liveEntries, 8, true, tasks);
+    ASSERT_EQ(2U, tasks.size());
+    EXPECT_EQ(0U, tasks[0].firstEntry);
+    EXPECT_EQ(12U, tasks[0].numEntries);
+    EXPECT_EQ(12U, tasks[1].firstEntry);
+    EXPECT_EQ(12U, tasks[1].numEntries);
+    EXPECT_EQ(tasks[0].segmentsNeeded + tasks[1].segmentsNeeded, needed);
+
+    LogCleaner::LiveSegmentEntryHandleVector none;
+    tasks.clear();
+    cleaner->splitLiveEntries(none, 8, true, tasks);
+    ASSERT_EQ(1U, tasks.size());
+    EXPECT_EQ(0U, tasks[0].numEntries);
+}
+
+TEST_F(LogCleanerTest, splitLiveEntries_segregateByAge) {
+    Log log(serverId, 8192 * 20, 8192, 2000, NULL, Log::CLEANER_DISABLED);
+    LogCleaner* cleaner = &log.cleaner;
+    log.registerType(LOG_ENTRY_TYPE_OBJ,
+                     true,
+                     livenessCB, NULL,
+                     relocationCB, NULL,
+                     timestampCB,
+                     scanCB3, NULL);
+    LiveEntryFixture f(log, cleaner);
+
+    // Make the oldest 10 entries (more than a Segment's worth) about 1000
+    // seconds old and the rest brand new.
+    mockWallTimeValue = 10000;
+    for (size_t i = 0; i < f.liveEntries.size(); i++)
+        f.liveEntries[i].timestamp = (i < 10) ? 9000 : 10000;
+
+    LogCleaner::RelocationTaskVector tasks;
+    cleaner->splitLiveEntries(f.liveEntries, 1, true, tasks);
+    ASSERT_EQ(2U, tasks.size());
+    EXPECT_EQ(0U, tasks[0].firstEntry);
+    EXPECT_EQ(10U, tasks[0].numEntries);
+    EXPECT_EQ(10U, tasks[1].firstEntry);
+    EXPECT_EQ(14U, tasks[1].numEntries);
+
+    tasks.clear();
+    cleaner->splitLiveEntries(f.liveEntries, 1, false, tasks);
+    EXPECT_EQ(1U, tasks.size());
+
+    // Less than a Segment's worth of old data isn't worth its own survivor.
+    for (size_t i = 0; i < f.liveEntries.size(); i++)
+        f.liveEntries[i].timestamp = (i < 4) ? 9000 : 10000;
+    tasks.clear();
+    cleaner->splitLiveEntries(f.liveEntries, 1, true, tasks);
+    EXPECT_EQ(1U, tasks.size());
+    mockWallTimeValue = 0;
+}
+
+TEST_F(LogCleanerTest, ageClass) {
+    EXPECT_EQ(0, LogCleaner::ageClass(100, 100));
+    EXPECT_EQ(0, LogCleaner::ageClass(101, 100));
+    EXPECT_EQ(1, LogCleaner::ageClass(99, 100));
+    EXPECT_EQ(2, LogCleaner::ageClass(97, 100));
+    EXPECT_EQ(2, LogCleaner::ageClass(98, 100));
+    EXPECT_EQ(3, LogCleaner::ageClass(96, 100));
+}
+
 static bool
 relocationCBTrue(LogEntryHandle oldH, LogEntryHandle newH, void* cookie)
 {
@@ -619,4 +849,50 @@ TEST_F(LogCleanerTest, moveLiveData_packLastSegment) {
     // TODO(Rumble)
 }
 
+TEST_F(LogCleanerTest, moveLiveData_multipleThreads) {
+    Log log(serverId, 8192 * 20, 8192, 2000, NULL, Log::CLEANER_DISABLED);
+    LogCleaner* cleaner = &log.cleaner;
+    log.registerType(LOG_ENTRY_TYPE_OBJ,
+                     true,
+                     livenessCB, NULL,
+                     relocationCBTrue, NULL,
+                     timestampCB,
+                     scanCB3, NULL);
+    LiveEntryFixture f(log, cleaner);
+
+    LogCleaner::RelocationTaskVector tasks;
+    cleaner->numThreads = 2;
+    size_t needed = cleaner->splitLiveEntries(f.liveEntries, 2, false, tasks);
+    ASSERT_EQ(2U, tasks.size());
+    std::vector<void*> cleanSegmentMemory;
+    ASSERT_TRUE(cleaner->getCleanSegmentMemory(needed, cleanSegmentMemory));
+
+    SegmentVector segmentsToClean;
+    cleaner->moveLiveData(f.liveEntries, tasks, cleanSegmentMemory,
+                          segmentsToClean);
+
+    // Each thread relocated its own half into Segments of its own, in age
+    // order, and handed back the memory it didn't need.
+    EXPECT_EQ(24U, cleaner->perfCounters.liveEntriesRelocated);
+    size_t generated = 0;
+    foreach (LogCleaner::RelocationTask& task, tasks) {
+        EXPECT_LT(0U, task.survivors.size());
+        EXPECT_EQ(0U, task.segmentMemory.size());
+        size_t entries = 0;
+        foreach (Segment* s, task.survivors) {
+            for (SegmentIterator it(s); !it.isDone(); it.next()) {
+                if (it.getType() == LOG_ENTRY_TYPE_OBJ)
+                    entries++;
+            }
+        }
+        EXPECT_EQ(12U, entries);
+        generated += task.survivors.size();
+    }
+    EXPECT_EQ(generated, cleaner->perfCounters.segmentsGenerated);
+    EXPECT_EQ(needed - generated, cleanSegmentMemory.size());
+    EXPECT_EQ(0U, segmentsToClean.size());
+
+    log.cleaningComplete(segmentsToClean, cleanSegmentMemory);
+}
+
 } // namespace RAMCloud
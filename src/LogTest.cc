@@ -90,7 +90,7 @@ TEST_F(LogTest, allocateHead_basics) {
         EXPECT_EQ(s->getId(), ld.getSegmentIds()[0]);
         EXPECT_EQ(s, l.activeIdMap[s->getId()]);
         EXPECT_EQ(s,
-            l.activeBaseAddressMap[s->getBaseAddress()]);
+            l.activeSegmentSlots[l.getSegmentSlot(s->getBaseAddress())]);
     }
 
     {
@@ -245,6 +245,34 @@ TEST_F(LogTest, getSegmentId) {
     EXPECT_EQ(0U, l.getSegmentId(p));
     EXPECT_THROW(l.getSegmentId(
         reinterpret_cast<const char *>(p) + 8192), LogException);
+    EXPECT_THROW(l.getSegmentId(
+        reinterpret_cast<const char *>(p) + 2 * 8192), LogException);
+    EXPECT_THROW(l.getSegmentId(buf), LogException);
+}
+
+TEST_F(LogTest, getHeadLogTime) {
+    Log l(serverId, 2 * 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED);
+    l.registerType(LOG_ENTRY_TYPE_OBJ, true, NULL, NULL,
+        NULL, NULL, NULL, NULL, NULL);
+    static char buf[64];
+
+    EXPECT_EQ(LogTime(0, 0), l.getHeadLogTime());
+    l.append(LOG_ENTRY_TYPE_OBJ, buf, sizeof(buf), false);
+    EXPECT_EQ(LogTime(l.head->getId(), l.head->tail), l.getHeadLogTime());
+}
+
+TEST_F(LogTest, sync_logTime) {
+    Log l(serverId, 2 * 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED);
+    l.registerType(LOG_ENTRY_TYPE_OBJ, true, NULL, NULL,
+        NULL, NULL, NULL, NULL, NULL);
+    static char buf[64];
+
+    // Nothing appended yet: nothing to wait for.
+    l.sync(l.getHeadLogTime());
+
+    l.append(LOG_ENTRY_TYPE_OBJ, buf, sizeof(buf), false);
+    l.sync(l.getHeadLogTime());
+    EXPECT_THROW(l.sync(LogTime(l.head->getId() + 1, 100)), LogException);
 }
 
 TEST_F(LogTest, append) {
@@ -269,8 +297,7 @@ TEST_F(LogTest, append) {
         + LogDigest::getBytesFromCount(1)) == seh->logTime());
     EXPECT_TRUE(l.activeIdMap.find(l.head->getId()) !=
         l.activeIdMap.end());
-    EXPECT_TRUE(l.activeBaseAddressMap.find(l.head->getBaseAddress()) !=
-        l.activeBaseAddressMap.end());
+    EXPECT_EQ(l.head, l.getSegmentFromAddress(l.head->getBaseAddress()));
     EXPECT_EQ(1U, l.freeList.size());
 
     // assert that the LogDigest is written out correctly
@@ -497,6 +524,50 @@ TEST_F(LogTest, cleaningComplete) {
     // Segments above are deallocated by log destructor
 }
 
+TEST_F(LogTest, cleaningComplete_pinnedSegment) {
+    Log l(serverId, 3 * 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED);
+
+    Segment* cleanSeg = new Segment(&l, l.allocateSegmentId(),
+        l.getFromFreeList(false), 8192, NULL, LOG_ENTRY_TYPE_UNINIT,
+        NULL, 0);
+    cleanSeg->close(NULL);
+    l.activeIdMap[cleanSeg->getId()] = cleanSeg;
+    l.activeSegmentSlots[l.getSegmentSlot(cleanSeg->getBaseAddress())] =
+        cleanSeg;
+    l.freePendingReferenceList.push_back(*cleanSeg);
+    cleanSeg->cleanedEpoch = 0;
+    ServerRpcPoolInternal::currentEpoch = 5;
+
+    SegmentVector clean;
+    std::vector<void*> empty;
+    Tub<Buffer> buffer;
+    buffer.construct();
+    const char* data = static_cast<const char*>(cleanSeg->getBaseAddress());
+    Log::PinnedChunk::appendToBuffer(buffer.get(), l, data + 10, 20);
+    Log::PinnedChunk::appendToBuffer(buffer.get(), l, data + 40, 20);
+    EXPECT_EQ(40U, buffer->getTotalLength());
+    EXPECT_EQ(data + 10, buffer->getRange(0, 20));
+    EXPECT_EQ(2, cleanSeg->pinCount.load());
+
+    // No RPCs are outstanding, but the chunks still refer to the segment.
+    l.cleaningComplete(clean, empty);
+    EXPECT_EQ(1U, l.freePendingReferenceList.size());
+
+    buffer.destroy();
+    EXPECT_EQ(0, cleanSeg->pinCount.load());
+    l.cleaningComplete(clean, empty);
+    EXPECT_EQ(0U, l.freePendingReferenceList.size());
+}
+
+TEST_F(LogTest, PinnedChunk_invalidAddress) {
+    Log l(serverId, 3 * 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED);
+    Buffer buffer;
+    char notInLog[8];
+    EXPECT_THROW(Log::PinnedChunk::appendToBuffer(&buffer, l, notInLog, 8),
+                 LogException);
+    EXPECT_EQ(0U, buffer.getTotalLength());
+}
+
 
 /**
  * Unit tests for LogDigest.
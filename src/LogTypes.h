@@ -42,7 +42,9 @@ enum LogEntryType {
     LOG_ENTRY_TYPE_SEGFOOTER = 'F',
     LOG_ENTRY_TYPE_OBJ       = 'O',
     LOG_ENTRY_TYPE_OBJTOMB   = 'T',
-    LOG_ENTRY_TYPE_LOGDIGEST = 'D'
+    LOG_ENTRY_TYPE_LOGDIGEST = 'D',
+    LOG_ENTRY_TYPE_TXINTENT  = 'P',
+    LOG_ENTRY_TYPE_TXDECISION = 'X'
 };
 
 } // namespace RAMCloud
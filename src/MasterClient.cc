@@ -26,6 +26,63 @@ namespace RAMCloud {
 // Default RejectRules to use if none are provided by the caller.
 RejectRules defaultRejectRules;
 
+/**
+ * Append the part and value of each object in a transaction to a
+ * TRANSACTION or PREPARE_TRANSACTION request.
+ */
+static void
+appendTransactionParts(Buffer& request,
+                       std::vector<MasterClient::TransactionObject*>& objects)
+{
+    foreach (MasterClient::TransactionObject* object, objects) {
+        object->status = STATUS_OK;
+        object->version = VERSION_NONEXISTENT;
+        uint32_t length = object->remove ? 0 : object->length;
+        new(&request, APPEND) TransactionRpc::Request::Part(
+            object->tableId, object->id, length,
+            object->rejectRules ? *object->rejectRules : defaultRejectRules,
+            object->remove);
+        if (length != 0)
+            Buffer::Chunk::appendToBuffer(&request, object->buf, length);
+    }
+}
+
+/**
+ * If a master refused a transaction because of one object's reject rules,
+ * report that object's current version and the reason in its
+ * TransactionObject.
+ */
+static void
+recordRejection(std::vector<MasterClient::TransactionObject*>& objects,
+                Status status, uint32_t rejectedPart, uint64_t rejectedVersion)
+{
+    if (status != STATUS_OBJECT_DOESNT_EXIST &&
+            status != STATUS_OBJECT_EXISTS &&
+            status != STATUS_WRONG_VERSION)
+        return;
+    if (rejectedPart < objects.size()) {
+        objects[rejectedPart]->status = status;
+        objects[rejectedPart]->version = rejectedVersion;
+    }
+}
+
+/**
+ * Copy the versions following a TRANSACTION or DECIDE_TRANSACTION
+ * response header into the transaction's objects.
+ */
+static void
+recordVersions(std::vector<MasterClient::TransactionObject*>& objects,
+               Buffer& response, uint32_t offset)
+{
+    foreach (MasterClient::TransactionObject* object, objects) {
+        const uint64_t* version = response.getOffset<uint64_t>(offset);
+        if (version == NULL)
+            throw ResponseFormatError(HERE);
+        object->version = *version;
+        offset += downCast<uint32_t>(sizeof(*version));
+    }
+}
+
 /// Start a create RPC. See MasterClient::create.
 MasterClient::Create::Create(MasterClient& client,
                              uint32_t tableId,
@@ -89,7 +146,7 @@ MasterClient::Write::Write(MasterClient& client,
                            uint32_t tableId, uint64_t id,
                            const void* buf, uint32_t length,
                            const RejectRules* rejectRules, uint64_t* version,
-                           bool async)
+                           bool async, uint32_t ttl)
     : client(client)
     , version(version)
     , requestBuffer()
@@ -102,6 +159,36 @@ MasterClient::Write::Write(MasterClient& client,
     reqHdr.length = length;
     reqHdr.rejectRules = rejectRules ? *rejectRules : defaultRejectRules;
     reqHdr.async = async;
+    reqHdr.ttl = ttl;
+    Buffer::Chunk::appendToBuffer(&requestBuffer, buf, length);
+    state = client.send<WriteRpc>(client.session,
+                                  requestBuffer,
+                                  responseBuffer);
+}
+
+/// Start a write RPC for an object named by a string key. See
+/// MasterClient::write.
+MasterClient::Write::Write(MasterClient& client,
+                           uint32_t tableId,
+                           const void* key, uint16_t keyLength,
+                           const void* buf, uint32_t length,
+                           const RejectRules* rejectRules, uint64_t* version,
+                           bool async, uint32_t ttl)
+    : client(client)
+    , version(version)
+    , requestBuffer()
+    , responseBuffer()
+    , state()
+{
+    WriteRpc::Request& reqHdr(client.allocHeader<WriteRpc>(requestBuffer));
+    reqHdr.id = Object::hashKey(key, keyLength);
+    reqHdr.tableId = tableId;
+    reqHdr.length = length;
+    reqHdr.rejectRules = rejectRules ? *rejectRules : defaultRejectRules;
+    reqHdr.async = async;
+    reqHdr.keyLength = keyLength;
+    reqHdr.ttl = ttl;
+    Buffer::Chunk::appendToBuffer(&requestBuffer, key, keyLength);
     Buffer::Chunk::appendToBuffer(&requestBuffer, buf, length);
     state = client.send<WriteRpc>(client.session,
                                   requestBuffer,
@@ -169,6 +256,127 @@ MasterClient::fillWithTestData(uint32_t numObjects, uint32_t objectSize)
     checkStatus(HERE);
 }
 
+/**
+ * Replace the value of an object, but only if its current value is exactly
+ * the one given. The comparison and the update happen atomically on the
+ * master.
+ *
+ * \param tableId
+ *      The table containing the object (return value from a previous call
+ *      to openTable).
+ * \param id
+ *      Identifier within tableId of the object to be updated.
+ * \param oldBuf
+ *      The value the object must currently hold.
+ * \param oldLength
+ *      Size in bytes of \a oldBuf.
+ * \param newBuf
+ *      The value to store if the object holds \a oldBuf.
+ * \param newLength
+ *      Size in bytes of \a newBuf.
+ * \param[out] currentValue
+ *      If non-NULL and the object didn't hold \a oldBuf, its current value
+ *      is returned here, so that the caller can retry without reading it
+ *      again. The previous contents of the Buffer are discarded, and it is
+ *      left empty if the value was replaced.
+ * \param[out] version
+ *      If non-NULL, the version of the object after the operation is
+ *      returned here.
+ * \return
+ *      True if the value was replaced, false if the object held some other
+ *      value.
+ *
+ * \exception ObjectDoesntExistException
+ * \exception InternalError
+ */
+bool
+MasterClient::compareAndSwap(uint32_t tableId, uint64_t id,
+                             const void* oldBuf, uint32_t oldLength,
+                             const void* newBuf, uint32_t newLength,
+                             Buffer* currentValue, uint64_t* version)
+{
+    Buffer req, localResp;
+    Buffer& resp = (currentValue != NULL) ? *currentValue : localResp;
+    resp.reset();
+    CompareAndSwapRpc::Request& reqHdr(allocHeader<CompareAndSwapRpc>(req));
+    reqHdr.id = id;
+    reqHdr.tableId = tableId;
+    reqHdr.oldLength = oldLength;
+    reqHdr.newLength = newLength;
+    Buffer::Chunk::appendToBuffer(&req, oldBuf, oldLength);
+    Buffer::Chunk::appendToBuffer(&req, newBuf, newLength);
+    const CompareAndSwapRpc::Response& respHdr(
+        sendRecv<CompareAndSwapRpc>(session, req, resp));
+    if (version != NULL)
+        *version = respHdr.version;
+    checkStatus(HERE);
+    bool swapped = respHdr.swapped;
+    resp.truncateFront(sizeof(respHdr));
+    return swapped;
+}
+
+/**
+ * Replace the value of an object named by a string key, but only if its
+ * current value is exactly the one given. See the other compareAndSwap
+ * for the remaining parameters.
+ *
+ * \param tableId
+ *      The table containing the object (return value from a previous call
+ *      to openTable).
+ * \param key
+ *      The object's string key; need not be NULL-terminated.
+ * \param keyLength
+ *      Number of bytes in \a key; must be nonzero.
+ * \param oldBuf
+ *      The value the object must currently hold.
+ * \param oldLength
+ *      Size in bytes of \a oldBuf.
+ * \param newBuf
+ *      The value to store if the object holds \a oldBuf.
+ * \param newLength
+ *      Size in bytes of \a newBuf.
+ * \param[out] currentValue
+ *      If non-NULL and the object didn't hold \a oldBuf, its current value
+ *      is returned here.
+ * \param[out] version
+ *      If non-NULL, the version of the object after the operation is
+ *      returned here.
+ * \return
+ *      True if the value was replaced, false if the object held some other
+ *      value.
+ *
+ * \exception ObjectDoesntExistException
+ * \exception InternalError
+ */
+bool
+MasterClient::compareAndSwap(uint32_t tableId,
+                             const void* key, uint16_t keyLength,
+                             const void* oldBuf, uint32_t oldLength,
+                             const void* newBuf, uint32_t newLength,
+                             Buffer* currentValue, uint64_t* version)
+{
+    Buffer req, localResp;
+    Buffer& resp = (currentValue != NULL) ? *currentValue : localResp;
+    resp.reset();
+    CompareAndSwapRpc::Request& reqHdr(allocHeader<CompareAndSwapRpc>(req));
+    reqHdr.id = Object::hashKey(key, keyLength);
+    reqHdr.tableId = tableId;
+    reqHdr.oldLength = oldLength;
+    reqHdr.newLength = newLength;
+    reqHdr.keyLength = keyLength;
+    Buffer::Chunk::appendToBuffer(&req, key, keyLength);
+    Buffer::Chunk::appendToBuffer(&req, oldBuf, oldLength);
+    Buffer::Chunk::appendToBuffer(&req, newBuf, newLength);
+    const CompareAndSwapRpc::Response& respHdr(
+        sendRecv<CompareAndSwapRpc>(session, req, resp));
+    if (version != NULL)
+        *version = respHdr.version;
+    checkStatus(HERE);
+    bool swapped = respHdr.swapped;
+    resp.truncateFront(sizeof(respHdr));
+    return swapped;
+}
+
 /**
  * Create a new object in a table, with an id assigned by the server.
  *
@@ -201,6 +409,150 @@ MasterClient::create(uint32_t tableId, const void* buf, uint32_t length,
     return Create(*this, tableId, buf, length, version, async)();
 }
 
+/**
+ * Fetch the next batch of objects from a tablet being enumerated.
+ *
+ * \param tableId
+ *      The table being enumerated (return value from a previous call to
+ *      openTable).
+ * \param startId
+ *      The first tablet key (see Object::tabletKey) of the tablet being
+ *      enumerated.
+ * \param[in,out] cursor
+ *      Where the enumeration of the tablet stands. Zero it to start;
+ *      after a successful return it holds the position to continue from.
+ *      It may be passed to whichever master owns the tablet later on.
+ * \param[out] tabletLastId
+ *      The last tablet key of the tablet is returned here.
+ * \param[out] done
+ *      Set to true once every object in the tablet has been returned.
+ * \param[out] objects
+ *      After a successful return, this Buffer holds the objects, each as a
+ *      SegmentEntry followed by an Object.
+ * \return
+ *      The number of objects in \a objects. This may be zero even when
+ *      \a done is false.
+ *
+ * \exception TableDoesntExistException
+ *      This master doesn't own the tablet (any longer).
+ * \exception InternalError
+ */
+uint32_t
+MasterClient::enumerateTable(uint32_t tableId, uint64_t startId,
+                             EnumerateTableRpc::Cursor* cursor,
+                             uint64_t* tabletLastId, bool* done,
+                             Buffer* objects)
+{
+    Buffer req;
+    objects->reset();
+    EnumerateTableRpc::Request& reqHdr(allocHeader<EnumerateTableRpc>(req));
+    reqHdr.tableId = tableId;
+    reqHdr.startId = startId;
+    reqHdr.cursor = *cursor;
+    const EnumerateTableRpc::Response& respHdr(
+        sendRecv<EnumerateTableRpc>(session, req, *objects));
+    checkStatus(HERE);
+    *cursor = respHdr.cursor;
+    *tabletLastId = respHdr.tabletLastId;
+    *done = respHdr.done;
+    uint32_t count = respHdr.count;
+    objects->truncateFront(sizeof(respHdr));
+    return count;
+}
+
+/**
+ * Atomically add to an object holding a 64-bit integer and return the sum.
+ * Unlike reading the object and writing it back conditionally, this never
+ * needs to be retried because of concurrent updates.
+ *
+ * \param tableId
+ *      The table containing the object (return value from a previous call
+ *      to openTable).
+ * \param id
+ *      Identifier within tableId of the counter. Its value must be
+ *      exactly 8 bytes: a little-endian, two's complement integer. If it
+ *      doesn't exist, it is created as if it had held zero.
+ * \param incrementValue
+ *      The amount to add; may be negative.
+ * \param rejectRules
+ *      If non-NULL, specifies conditions under which the increment
+ *      should be aborted with an error.
+ * \param[out] version
+ *      If non-NULL, the version number of the object is returned here.
+ * \return
+ *      The object's value after the increment.
+ *
+ * \exception InvalidObjectException
+ *      The object's value isn't 8 bytes long.
+ * \exception RejectRulesException
+ * \exception InternalError
+ */
+int64_t
+MasterClient::increment(uint32_t tableId, uint64_t id, int64_t incrementValue,
+                        const RejectRules* rejectRules, uint64_t* version)
+{
+    Buffer req, resp;
+    IncrementRpc::Request& reqHdr(allocHeader<IncrementRpc>(req));
+    reqHdr.id = id;
+    reqHdr.tableId = tableId;
+    reqHdr.incrementValue = incrementValue;
+    reqHdr.rejectRules = rejectRules ? *rejectRules : defaultRejectRules;
+    const IncrementRpc::Response& respHdr(
+        sendRecv<IncrementRpc>(session, req, resp));
+    if (version != NULL)
+        *version = respHdr.version;
+    checkStatus(HERE);
+    return respHdr.newValue;
+}
+
+/**
+ * Atomically add to an object named by a string key that holds a 64-bit
+ * integer, and return the sum. See the other increment.
+ *
+ * \param tableId
+ *      The table containing the object (return value from a previous call
+ *      to openTable).
+ * \param key
+ *      The counter's string key; need not be NULL-terminated. If no object
+ *      has this key, one is created as if it had held zero.
+ * \param keyLength
+ *      Number of bytes in \a key; must be nonzero.
+ * \param incrementValue
+ *      The amount to add; may be negative.
+ * \param rejectRules
+ *      If non-NULL, specifies conditions under which the increment
+ *      should be aborted with an error.
+ * \param[out] version
+ *      If non-NULL, the version number of the object is returned here.
+ * \return
+ *      The object's value after the increment.
+ *
+ * \exception InvalidObjectException
+ *      The object's value isn't 8 bytes long.
+ * \exception RejectRulesException
+ * \exception InternalError
+ */
+int64_t
+MasterClient::increment(uint32_t tableId, const void* key, uint16_t keyLength,
+                        int64_t incrementValue,
+                        const RejectRules* rejectRules, uint64_t* version)
+{
+    Buffer req, resp;
+    IncrementRpc::Request& reqHdr(allocHeader<IncrementRpc>(req));
+    reqHdr.id = Object::hashKey(key, keyLength);
+    reqHdr.tableId = tableId;
+    reqHdr.incrementValue = incrementValue;
+    reqHdr.rejectRules = rejectRules ? *rejectRules : defaultRejectRules;
+    reqHdr.keyLength = keyLength;
+    Buffer::Chunk::appendToBuffer(&req, key, keyLength);
+    const IncrementRpc::Response& respHdr(
+        sendRecv<IncrementRpc>(session, req, resp));
+    if (version != NULL)
+        *version = respHdr.version;
+    checkStatus(HERE);
+    return respHdr.newValue;
+}
+
 /**
  * Recover a set of tablets on behalf of a crashed master.
  *
@@ -275,6 +627,30 @@ MasterClient::Read::Read(MasterClient& client,
                                  responseBuffer);
 }
 
+/// Start a read RPC for an object named by a string key. See
+/// MasterClient::read.
+MasterClient::Read::Read(MasterClient& client,
+                         uint32_t tableId,
+                         const void* key, uint16_t keyLength, Buffer* value,
+                         const RejectRules* rejectRules, uint64_t* version)
+    : client(client)
+    , version(version)
+    , requestBuffer()
+    , responseBuffer(*value)
+    , state()
+{
+    responseBuffer.reset();
+    ReadRpc::Request& reqHdr(client.allocHeader<ReadRpc>(requestBuffer));
+    reqHdr.tableId = tableId;
+    reqHdr.id = Object::hashKey(key, keyLength);
+    reqHdr.rejectRules = rejectRules ? *rejectRules : defaultRejectRules;
+    reqHdr.keyLength = keyLength;
+    Buffer::Chunk::appendToBuffer(&requestBuffer, key, keyLength);
+    state = client.send<ReadRpc>(client.session,
+                                 requestBuffer,
+                                 responseBuffer);
+}
+
 void
 MasterClient::Read::operator()()
 {
@@ -318,6 +694,39 @@ MasterClient::read(uint32_t tableId, uint64_t id, Buffer* value,
     Read(*this, tableId, id, value, rejectRules, version)();
 }
 
+/**
+ * Read the current contents of an object named by a string key. The key is
+ * hashed into the object's id here, and the master checks the full key, so
+ * unlike StringKeyAdapter no extra bytes come back and no second read is
+ * needed to tell colliding keys apart.
+ *
+ * \param tableId
+ *      The table containing the desired object (return value from
+ *      a previous call to openTable).
+ * \param key
+ *      The object's string key; need not be NULL-terminated.
+ * \param keyLength
+ *      Number of bytes in \a key; must be nonzero.
+ * \param[out] value
+ *      After a successful return, this Buffer will hold the
+ *      contents of the desired object.
+ * \param rejectRules
+ *      If non-NULL, specifies conditions under which the read
+ *      should be aborted with an error.
+ * \param[out] version
+ *      If non-NULL, the version number of the object is returned
+ *      here.
+ *
+ * \exception RejectRulesException
+ * \exception InternalError
+ */
+void
+MasterClient::read(uint32_t tableId, const void* key, uint16_t keyLength,
+        Buffer* value, const RejectRules* rejectRules, uint64_t* version)
+{
+    Read(*this, tableId, key, keyLength, value, rejectRules, version)();
+}
+
 /**
  * Read the current contents of multiple objects.
  *
@@ -335,7 +744,12 @@ MasterClient::multiRead(std::vector<ReadObject*> requests)
 
     foreach (ReadObject *request, requests) {
         new(&req, APPEND) MultiReadRpc::Request::Part(request->tableId,
-                                                      request->id);
+                                                      request->id,
+                                                      request->keyLength);
+        if (request->keyLength != 0) {
+            Buffer::Chunk::appendToBuffer(&req, request->key,
+                                          request->keyLength);
+        }
     }
 
     // Send and Receive Rpc
@@ -372,7 +786,9 @@ MasterClient::multiRead(std::vector<ReadObject*> requests)
 
             request->version = obj->version;
 
-            uint32_t dataLength = obj->dataLength(entry->length);
+            // Skip the object's string key, if it has one.
+            respOffset += obj->keyLength;
+            uint32_t dataLength = obj->valueLength(entry->length);
             request->value->construct();
             respBuffer.copy(respOffset, dataLength, new(
                             request->value->get(), APPEND) char[dataLength]);
@@ -395,7 +811,12 @@ MasterClient::MultiRead::MultiRead(MasterClient& client,
 
     foreach (ReadObject *request, requests) {
         new(&requestBuffer, APPEND) MultiReadRpc::Request::Part(
-                                  request->tableId, request->id);
+                                  request->tableId, request->id,
+                                  request->keyLength);
+        if (request->keyLength != 0) {
+            Buffer::Chunk::appendToBuffer(&requestBuffer, request->key,
+                                          request->keyLength);
+        }
     }
 
     state = client.send<MultiReadRpc>(client.session, requestBuffer,
@@ -436,7 +857,9 @@ MasterClient::MultiRead::complete()
 
             request->version = obj->version;
 
-            uint32_t dataLength = obj->dataLength(entry->length);
+            // Skip the object's string key, if it has one.
+            respOffset += obj->keyLength;
+            uint32_t dataLength = obj->valueLength(entry->length);
             request->value->construct();
             responseBuffer.copy(respOffset, dataLength, new(
                             request->value->get(), APPEND) char[dataLength]);
@@ -445,6 +868,270 @@ MasterClient::MultiRead::complete()
     }
 }
 
+/**
+ * Move a tablet owned by this master to another master while both keep
+ * serving requests. The master streams the tablet's objects to the new
+ * owner, blocks updates to the tablet only for a short final catch-up,
+ * and then has the coordinator point the tablet map at the new owner.
+ * Afterwards clients with a stale tablet map get STATUS_TABLE_DOESNT_EXIST
+ * from this master and must refresh their map.
+ *
+ * \param tableId
+ *      The table containing the tablet (return value from a previous call
+ *      to openTable).
+ * \param firstId
+ *      Identifier of the first object in the tablet.
+ * \param lastId
+ *      Identifier of the last object in the tablet. \a firstId and
+ *      \a lastId must match a tablet that this master owns exactly.
+ * \param newOwnerMasterId
+ *      The master that should own the tablet afterwards.
+ *
+ * \exception TableDoesntExistException
+ *      This master doesn't own a tablet with exactly this range.
+ * \exception RetryException
+ *      This master is already migrating a tablet or receiving one.
+ * \exception RequestFormatError
+ *      \a newOwnerMasterId is this master or isn't a known server.
+ */
+void
+MasterClient::migrateTablet(uint32_t tableId, uint64_t firstId,
+                            uint64_t lastId, ServerId newOwnerMasterId)
+{
+    MigrateTablet(*this, tableId, firstId, lastId, newOwnerMasterId)();
+}
+
+/// Start a migrateTablet RPC. See MasterClient::migrateTablet.
+MasterClient::MigrateTablet::MigrateTablet(MasterClient& client,
+                                           uint32_t tableId,
+                                           uint64_t firstId,
+                                           uint64_t lastId,
+                                           ServerId newOwnerMasterId)
+    : client(client)
+    , requestBuffer()
+    , responseBuffer()
+    , state()
+{
+    MigrateTabletRpc::Request& reqHdr(
+        client.allocHeader<MigrateTabletRpc>(requestBuffer));
+    reqHdr.tableId = tableId;
+    reqHdr.firstId = firstId;
+    reqHdr.lastId = lastId;
+    reqHdr.newOwnerMasterId = newOwnerMasterId.getId();
+    state = client.send<MigrateTabletRpc>(client.session,
+                                          requestBuffer,
+                                          responseBuffer);
+}
+
+/// Wait for the migrateTablet RPC to complete.
+void
+MasterClient::MigrateTablet::operator()()
+{
+    client.recv<MigrateTabletRpc>(state);
+    client.checkStatus(HERE);
+}
+
+/**
+ * Delete multiple objects from a table, all on this master, with a single
+ * RPC. The master logs all of the tombstones together and syncs them to
+ * backups once, so this is much cheaper than a remove per object.
+ *
+ * \param requests
+ *      Vector (of RemoveObject's) listing the objects to be removed.
+ *      The status and version of each removal are returned in its
+ *      RemoveObject; see #remove for their meaning.
+ */
+void
+MasterClient::multiRemove(std::vector<RemoveObject*> requests)
+{
+    MultiRemove(*this, requests).complete();
+}
+
+/// Start a multiRemove RPC. See MasterClient::multiRemove.
+MasterClient::MultiRemove::MultiRemove(MasterClient& client,
+                                       std::vector<RemoveObject*>& requests)
+    : client(client)
+    , requestBuffer()
+    , responseBuffer()
+    , state()
+    , requests(requests)
+{
+    MultiRemoveRpc::Request& reqHdr(client.allocHeader<MultiRemoveRpc>(
+                                                    requestBuffer));
+    reqHdr.count = downCast<uint32_t>(requests.size());
+
+    foreach (RemoveObject *request, requests) {
+        new(&requestBuffer, APPEND) MultiRemoveRpc::Request::Part(
+            request->tableId, request->id,
+            request->rejectRules ? *request->rejectRules :
+                                   defaultRejectRules);
+    }
+
+    state = client.send<MultiRemoveRpc>(client.session, requestBuffer,
+                                        responseBuffer);
+}
+
+/// Wait for the multiRemove RPC to complete.
+void
+MasterClient::MultiRemove::complete()
+{
+    const MultiRemoveRpc::Response& respHdr(
+        client.recv<MultiRemoveRpc>(state));
+    client.checkStatus(HERE);
+
+    uint32_t respOffset = downCast<uint32_t>(sizeof(respHdr));
+    foreach (RemoveObject *request, requests) {
+        const MultiRemoveRpc::Response::Part* part =
+            responseBuffer.getOffset<MultiRemoveRpc::Response::Part>(
+                                                                respOffset);
+        respOffset += downCast<uint32_t>(
+                                sizeof(MultiRemoveRpc::Response::Part));
+        request->status = part->status;
+        request->version = part->version;
+    }
+}
+
+/**
+ * Write multiple objects, all on this master, with a single RPC. The
+ * master appends all of the objects to its log together and syncs them to
+ * backups once, so this is much cheaper than a write per object.
+ *
+ * \param requests
+ *      Vector (of WriteObject's) listing the objects to be written and
+ *      their new values. The status and new version of each write are
+ *      returned in its WriteObject; see #write for their meaning.
+ */
+void
+MasterClient::multiWrite(std::vector<WriteObject*> requests)
+{
+    MultiWrite(*this, requests).complete();
+}
+
+/// Start a multiWrite RPC. See MasterClient::multiWrite.
+MasterClient::MultiWrite::MultiWrite(MasterClient& client,
+                                     std::vector<WriteObject*>& requests)
+    : client(client)
+    , requestBuffer()
+    , responseBuffer()
+    , state()
+    , requests(requests)
+{
+    MultiWriteRpc::Request& reqHdr(client.allocHeader<MultiWriteRpc>(
+                                                    requestBuffer));
+    reqHdr.count = downCast<uint32_t>(requests.size());
+
+    foreach (WriteObject *request, requests) {
+        new(&requestBuffer, APPEND) MultiWriteRpc::Request::Part(
+            request->tableId, request->id, request->length,
+            request->rejectRules ? *request->rejectRules :
+                                   defaultRejectRules);
+        Buffer::Chunk::appendToBuffer(&requestBuffer, request->buf,
+                                      request->length);
+    }
+
+    state = client.send<MultiWriteRpc>(client.session, requestBuffer,
+                                       responseBuffer);
+}
+
+/// Wait for the multiWrite RPC to complete.
+void
+MasterClient::MultiWrite::complete()
+{
+    const MultiWriteRpc::Response& respHdr(client.recv<MultiWriteRpc>(state));
+    client.checkStatus(HERE);
+
+    uint32_t respOffset = downCast<uint32_t>(sizeof(respHdr));
+    foreach (WriteObject *request, requests) {
+        const MultiWriteRpc::Response::Part* part =
+            responseBuffer.getOffset<MultiWriteRpc::Response::Part>(
+                                                                respOffset);
+        respOffset += downCast<uint32_t>(
+                                sizeof(MultiWriteRpc::Response::Part));
+        request->status = part->status;
+        request->version = part->version;
+    }
+}
+
+/// Start a prepareTransaction RPC. See MasterClient::PrepareTransaction.
+MasterClient::PrepareTransaction::PrepareTransaction(
+        MasterClient& client, uint64_t transactionId,
+        std::vector<TransactionObject*>& objects)
+    : client(client)
+    , requestBuffer()
+    , responseBuffer()
+    , state()
+    , objects(objects)
+{
+    PrepareTransactionRpc::Request& reqHdr(
+        client.allocHeader<PrepareTransactionRpc>(requestBuffer));
+    reqHdr.transactionId = transactionId;
+    reqHdr.count = downCast<uint32_t>(objects.size());
+    appendTransactionParts(requestBuffer, objects);
+    state = client.send<PrepareTransactionRpc>(client.session, requestBuffer,
+                                               responseBuffer);
+}
+
+/**
+ * Wait for the prepareTransaction RPC to complete.
+ *
+ * \exception RejectRulesException
+ *      An object's reject rules failed; see TransactionObject::status.
+ * \exception RetryException
+ *      An object is locked by another transaction.
+ */
+void
+MasterClient::PrepareTransaction::complete()
+{
+    const PrepareTransactionRpc::Response& respHdr(
+        client.recv<PrepareTransactionRpc>(state));
+    recordRejection(objects, respHdr.common.status, respHdr.rejectedPart,
+                    respHdr.rejectedVersion);
+    client.checkStatus(HERE);
+}
+
+/// Start a decideTransaction RPC. See MasterClient::DecideTransaction.
+MasterClient::DecideTransaction::DecideTransaction(
+        MasterClient& client, uint64_t transactionId,
+        std::vector<TransactionObject*>& objects, bool commit)
+    : client(client)
+    , requestBuffer()
+    , responseBuffer()
+    , state()
+    , objects(objects)
+    , commit(commit)
+{
+    DecideTransactionRpc::Request& reqHdr(
+        client.allocHeader<DecideTransactionRpc>(requestBuffer));
+    reqHdr.transactionId = transactionId;
+    reqHdr.commit = commit;
+    state = client.send<DecideTransactionRpc>(client.session, requestBuffer,
+                                              responseBuffer);
+}
+
+/**
+ * Wait for the decideTransaction RPC to complete. After a commit, the new
+ * versions are returned in the TransactionObjects, or 0 if the master had
+ * already committed without them.
+ *
+ * \exception RetryException
+ *      The master couldn't commit yet; decide again.
+ */
+void
+MasterClient::DecideTransaction::complete()
+{
+    const DecideTransactionRpc::Response& respHdr(
+        client.recv<DecideTransactionRpc>(state));
+    client.checkStatus(HERE);
+    if (!commit)
+        return;
+    if (respHdr.count == 0) {
+        foreach (TransactionObject* object, objects)
+            object->version = VERSION_NONEXISTENT;
+        return;
+    }
+    recordVersions(objects, responseBuffer, sizeof(respHdr));
+}
+
 /**
  * Delete an object from a table. If the object does not currently exist
  * and no rejectRules match, then the operation succeeds without doing
@@ -482,6 +1169,125 @@ MasterClient::remove(uint32_t tableId, uint64_t id,
     checkStatus(HERE);
 }
 
+/**
+ * Delete an object named by a string key. If no object with that key
+ * exists and no rejectRules match, then the operation succeeds without
+ * doing anything.
+ *
+ * \param tableId
+ *      The table containing the object to be deleted (return value from
+ *      a previous call to openTable).
+ * \param key
+ *      The object's string key; need not be NULL-terminated.
+ * \param keyLength
+ *      Number of bytes in \a key; must be nonzero.
+ * \param rejectRules
+ *      If non-NULL, specifies conditions under which the delete
+ *      should be aborted with an error.  If NULL, the object is
+ *      deleted unconditionally.
+ * \param[out] version
+ *      If non-NULL, the version number of the object (prior to
+ *      deletion) is returned here.  If the object didn't exist
+ *      then 0 will be returned.
+ *
+ * \exception RejectRulesException
+ * \exception InternalError
+ */
+void
+MasterClient::remove(uint32_t tableId, const void* key, uint16_t keyLength,
+        const RejectRules* rejectRules, uint64_t* version)
+{
+    Buffer req, resp;
+    RemoveRpc::Request& reqHdr(allocHeader<RemoveRpc>(req));
+    reqHdr.id = Object::hashKey(key, keyLength);
+    reqHdr.tableId = tableId;
+    reqHdr.rejectRules = rejectRules ? *rejectRules : defaultRejectRules;
+    reqHdr.keyLength = keyLength;
+    Buffer::Chunk::appendToBuffer(&req, key, keyLength);
+    const RemoveRpc::Response& respHdr(sendRecv<RemoveRpc>(session, req, resp));
+    if (version != NULL)
+        *version = respHdr.version;
+    checkStatus(HERE);
+}
+
+/**
+ * Tell this master that another master is about to migrate a tablet to
+ * it. The tablet is added to this master's tablets so that
+ * #receiveMigrationData() can fill it in; clients aren't sent here until
+ * the coordinator's tablet map is switched over.
+ *
+ * \param tableId
+ *      The table containing the tablet.
+ * \param firstId
+ *      Identifier of the first object in the tablet.
+ * \param lastId
+ *      Identifier of the last object in the tablet.
+ * \param sourceMasterId
+ *      The master migrating the tablet.
+ *
+ * \exception RetryException
+ *      This master is migrating a tablet of its own away.
+ */
+void
+MasterClient::prepForMigration(uint32_t tableId, uint64_t firstId,
+                               uint64_t lastId, ServerId sourceMasterId)
+{
+    Buffer req, resp;
+    PrepForMigrationRpc::Request& reqHdr(
+        allocHeader<PrepForMigrationRpc>(req));
+    reqHdr.tableId = tableId;
+    reqHdr.firstId = firstId;
+    reqHdr.lastId = lastId;
+    reqHdr.sourceMasterId = sourceMasterId.getId();
+    sendRecv<PrepForMigrationRpc>(session, req, resp);
+    checkStatus(HERE);
+}
+
+/**
+ * Send one batch of a migrating tablet's objects and tombstones to the
+ * master taking it over. They are replayed just like a recovery segment,
+ * so batches may overlap and carry older versions of an object than the
+ * receiver already has.
+ *
+ * \param tableId
+ *      The table containing the tablet.
+ * \param firstId
+ *      Identifier of the first object in the tablet.
+ * \param lastId
+ *      Identifier of the last object in the tablet.
+ * \param segment
+ *      Log entries (each a SegmentEntry followed by its data, as in a
+ *      recovery segment) to replay.
+ * \param segmentLength
+ *      Number of bytes at \a segment.
+ * \param done
+ *      True for the last batch: once it has been replayed the receiver
+ *      makes the tablet's data durable and is ready to serve it.
+ * \param tableVersion
+ *      Only used when \a done is true: the lowest version the receiver
+ *      may assign to a new object in the table.
+ */
+void
+MasterClient::receiveMigrationData(uint32_t tableId, uint64_t firstId,
+                                   uint64_t lastId, const void* segment,
+                                   uint32_t segmentLength, bool done,
+                                   uint64_t tableVersion)
+{
+    Buffer req, resp;
+    ReceiveMigrationDataRpc::Request& reqHdr(
+        allocHeader<ReceiveMigrationDataRpc>(req));
+    reqHdr.tableId = tableId;
+    reqHdr.firstId = firstId;
+    reqHdr.lastId = lastId;
+    reqHdr.segmentLength = segmentLength;
+    reqHdr.done = done;
+    reqHdr.tableVersion = tableVersion;
+    if (segmentLength > 0)
+        Buffer::Chunk::appendToBuffer(&req, segment, segmentLength);
+    sendRecv<ReceiveMigrationDataRpc>(session, req, resp);
+    checkStatus(HERE);
+}
+
 /**
  * Set the set of tablets the master owns.
  * Any new tablets appearing in this set will have no objects. Any tablets that
@@ -500,6 +1306,42 @@ MasterClient::setTablets(const ProtoBuf::Tablets& tablets)
     checkStatus(HERE);
 }
 
+/**
+ * Atomically write and remove a set of objects, all on this master.
+ * Either every object's reject rules pass and every operation is applied,
+ * or nothing is changed. The master logs the whole transaction as one
+ * append and syncs it to backups once.
+ *
+ * \param objects
+ *      The objects to write or remove; each may appear only once. On
+ *      success each TransactionObject's version is filled in.
+ *
+ * \exception RejectRulesException
+ *      An object's reject rules failed. That object's status and version
+ *      say which one and why; nothing was changed.
+ * \exception RetryException
+ *      An object is locked by a transaction spanning several masters, or
+ *      the master is out of memory; nothing was changed.
+ * \exception RequestFormatError
+ *      An object appears twice, or the transaction is too large to log
+ *      in one piece.
+ * \exception InternalError
+ */
+void
+MasterClient::transaction(std::vector<TransactionObject*> objects)
+{
+    Buffer req, resp;
+    TransactionRpc::Request& reqHdr(allocHeader<TransactionRpc>(req));
+    reqHdr.count = downCast<uint32_t>(objects.size());
+    appendTransactionParts(req, objects);
+    const TransactionRpc::Response& respHdr(
+        sendRecv<TransactionRpc>(session, req, resp));
+    recordRejection(objects, respHdr.common.status, respHdr.rejectedPart,
+                    respHdr.rejectedVersion);
+    checkStatus(HERE);
+    recordVersions(objects, resp, sizeof(respHdr));
+}
+
 /**
  * Write a specific object in a table; overwrite any existing
  * object, or create a new object if none existed.
@@ -530,6 +1372,10 @@ MasterClient::setTablets(const ProtoBuf::Tablets& tablets)
  * \param async
  *      If true, the new object will not be immediately replicated to backups.
  *      Data loss may occur!
+ * \param ttl
+ *      If nonzero, the object expires this many seconds from now: it then
+ *      reads as nonexistent and its space is reclaimed without a tombstone.
+ *      0 means the object never expires.
  *
  * \exception RejectRulesException
  * \exception InternalError
@@ -538,9 +1384,55 @@ void
 MasterClient::write(uint32_t tableId, uint64_t id,
                     const void* buf, uint32_t length,
                     const RejectRules* rejectRules, uint64_t* version,
-                    bool async)
+                    bool async, uint32_t ttl)
+{
+    Write(*this, tableId, id, buf, length, rejectRules, version, async,
+          ttl)();
+}
+
+/**
+ * Write a specific object named by a string key in a table; overwrite any
+ * existing object with that key, or create a new object if none existed.
+ *
+ * \param tableId
+ *      The table containing the desired object (return value from a
+ *      previous call to openTable).
+ * \param key
+ *      The object's string key; need not be NULL-terminated.
+ * \param keyLength
+ *      Number of bytes in \a key; must be nonzero.
+ * \param buf
+ *      Address of the first byte of the new contents for the object;
+ *      must contain at least length bytes.
+ * \param length
+ *      Size in bytes of the new contents for the object.
+ * \param rejectRules
+ *      If non-NULL, specifies conditions under which the write
+ *      should be aborted with an error. NULL means the object should
+ *      be written unconditionally.
+ * \param[out] version
+ *      If non-NULL, the version number of the object is returned
+ *      here, as for the write of an object named by id.
+ * \param async
+ *      If true, the new object will not be immediately replicated to backups.
+ *      Data loss may occur!
+ * \param ttl
+ *      If nonzero, the object expires this many seconds from now, as for
+ *      the write of an object named by id.
+ *
+ * \exception ObjectExistsException
+ *      Another key hashes to the same object id and already has an object.
+ * \exception RejectRulesException
+ * \exception InternalError
+ */
+void
+MasterClient::write(uint32_t tableId, const void* key, uint16_t keyLength,
+                    const void* buf, uint32_t length,
+                    const RejectRules* rejectRules, uint64_t* version,
+                    bool async, uint32_t ttl)
 {
-    Write(*this, tableId, id, buf, length, rejectRules, version, async)();
+    Write(*this, tableId, key, keyLength, buf, length,
+          rejectRules, version, async, ttl)();
 }
 
 }  // namespace RAMCloud
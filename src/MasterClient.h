@@ -21,6 +21,7 @@
 #include "CoordinatorClient.h"
 #include "Transport.h"
 #include "Buffer.h"
+#include "Object.h"
 #include "ServerId.h"
 #include "Tub.h"
 
@@ -45,6 +46,15 @@ class MasterClient : public Client {
          * Identifier within tableId of the object to be read.
          */
         uint64_t id;
+        /**
+         * The object's string key, or NULL if it is named by #id alone.
+         * Must remain valid until the multiRead completes.
+         */
+        const void* key;
+        /**
+         * Number of bytes in #key.
+         */
+        uint16_t keyLength;
         /**
          * If the read for this object was successful, the Tub<Buffer>
          * will hold the contents of the desired object. If not, it will
@@ -64,6 +74,20 @@ class MasterClient : public Client {
         ReadObject(uint32_t tableId, uint64_t id, Tub<Buffer>* value)
             : tableId(tableId)
             , id(id)
+            , key(NULL)
+            , keyLength(0)
+            , value(value)
+            , version()
+            , status()
+        {
+        }
+
+        ReadObject(uint32_t tableId, const void* key, uint16_t keyLength,
+                   Tub<Buffer>* value)
+            : tableId(tableId)
+            , id(Object::hashKey(key, keyLength))
+            , key(key)
+            , keyLength(keyLength)
             , value(value)
             , version()
             , status()
@@ -73,6 +97,8 @@ class MasterClient : public Client {
         ReadObject()
             : tableId()
             , id()
+            , key(NULL)
+            , keyLength(0)
             , value()
             , version()
             , status()
@@ -80,6 +106,207 @@ class MasterClient : public Client {
         }
     };
 
+    /**
+     * Format for requesting a write of an object as a part of multiWrite.
+     */
+    struct WriteObject {
+        /**
+         * The table containing the object to be written (return value from
+         * a previous call to openTable).
+         */
+        uint32_t tableId;
+        /**
+         * Identifier within tableId of the object to be written.
+         */
+        uint64_t id;
+        /**
+         * The new value of the object. Must remain valid until the
+         * multiWrite completes.
+         */
+        const void* buf;
+        /**
+         * Number of bytes in buf.
+         */
+        uint32_t length;
+        /**
+         * If non-NULL, specifies conditions under which the write of this
+         * object should be aborted with an error.
+         */
+        const RejectRules* rejectRules;
+        /**
+         * The version number of the object is returned here.
+         */
+        uint64_t version;
+        /**
+         * The status of the write (either that the write succeeded, or the
+         * error in case it didn't) is returned here.
+         */
+        Status status;
+
+        WriteObject(uint32_t tableId, uint64_t id, const void* buf,
+                    uint32_t length, const RejectRules* rejectRules = NULL)
+            : tableId(tableId)
+            , id(id)
+            , buf(buf)
+            , length(length)
+            , rejectRules(rejectRules)
+            , version()
+            , status()
+        {
+        }
+
+        WriteObject()
+            : tableId()
+            , id()
+            , buf()
+            , length()
+            , rejectRules()
+            , version()
+            , status()
+        {
+        }
+    };
+
+    /**
+     * Format for requesting the removal of an object as a part of
+     * multiRemove.
+     */
+    struct RemoveObject {
+        /**
+         * The table containing the object to be removed (return value from
+         * a previous call to openTable).
+         */
+        uint32_t tableId;
+        /**
+         * Identifier within tableId of the object to be removed.
+         */
+        uint64_t id;
+        /**
+         * If non-NULL, specifies conditions under which the removal of this
+         * object should be aborted with an error.
+         */
+        const RejectRules* rejectRules;
+        /**
+         * The version number of the object (prior to deletion) is returned
+         * here, or 0 if the object didn't exist.
+         */
+        uint64_t version;
+        /**
+         * The status of the removal (either that it succeeded, or the
+         * error in case it didn't) is returned here.
+         */
+        Status status;
+
+        RemoveObject(uint32_t tableId, uint64_t id,
+                     const RejectRules* rejectRules = NULL)
+            : tableId(tableId)
+            , id(id)
+            , rejectRules(rejectRules)
+            , version()
+            , status()
+        {
+        }
+
+        RemoveObject()
+            : tableId()
+            , id()
+            , rejectRules()
+            , version()
+            , status()
+        {
+        }
+    };
+
+    /**
+     * Format for requesting a write or removal of an object as a part of
+     * a transaction.
+     */
+    struct TransactionObject {
+        /**
+         * The table containing the object (return value from a previous
+         * call to openTable).
+         */
+        uint32_t tableId;
+        /**
+         * Identifier within tableId of the object.
+         */
+        uint64_t id;
+        /**
+         * The new value of the object, or NULL for a removal. Must remain
+         * valid until the transaction completes.
+         */
+        const void* buf;
+        /**
+         * Number of bytes in buf; 0 for a removal.
+         */
+        uint32_t length;
+        /**
+         * True if the object is to be removed rather than written.
+         */
+        bool remove;
+        /**
+         * If non-NULL, specifies conditions under which the whole
+         * transaction should be aborted with an error.
+         */
+        const RejectRules* rejectRules;
+        /**
+         * When the transaction commits, the new version of a written
+         * object, or the version of a removed object prior to removal (0
+         * if it didn't exist), is returned here. If this object's reject
+         * rules abort the transaction, its current version is returned.
+         * A master that committed its share of a transaction before the
+         * client's decision arrived (see MasterService::decideTransaction)
+         * can't return its versions; 0 is returned for its objects.
+         */
+        uint64_t version;
+        /**
+         * STATUS_OK, unless this object's reject rules aborted the
+         * transaction, in which case the reason is returned here.
+         */
+        Status status;
+
+        /// Write \a buf to the object.
+        TransactionObject(uint32_t tableId, uint64_t id, const void* buf,
+                          uint32_t length,
+                          const RejectRules* rejectRules = NULL)
+            : tableId(tableId)
+            , id(id)
+            , buf(buf)
+            , length(length)
+            , remove(false)
+            , rejectRules(rejectRules)
+            , version()
+            , status()
+        {
+        }
+
+        /// Remove the object.
+        TransactionObject(uint32_t tableId, uint64_t id,
+                          const RejectRules* rejectRules = NULL)
+            : tableId(tableId)
+            , id(id)
+            , buf()
+            , length()
+            , remove(true)
+            , rejectRules(rejectRules)
+            , version()
+            , status()
+        {
+        }
+
+        TransactionObject()
+            : tableId()
+            , id()
+            , buf()
+            , length()
+            , remove()
+            , rejectRules()
+            , version()
+            , status()
+        {
+        }
+    };
+
     /// An asynchronous version of #create().
     class Create {
       public:
@@ -103,6 +330,10 @@ class MasterClient : public Client {
         Read(MasterClient& client,
              uint32_t tableId, uint64_t id, Buffer* value,
              const RejectRules* rejectRules, uint64_t* version);
+        Read(MasterClient& client,
+             uint32_t tableId, const void* key, uint16_t keyLength,
+             Buffer* value, const RejectRules* rejectRules,
+             uint64_t* version);
         void cancel() { state.cancel(); }
         bool isReady() { return state.isReady(); }
         void operator()();
@@ -132,6 +363,22 @@ class MasterClient : public Client {
         DISALLOW_COPY_AND_ASSIGN(Recover);
     };
 
+    /// An asynchronous version of #migrateTablet().
+    class MigrateTablet {
+      public:
+        MigrateTablet(MasterClient& client,
+                      uint32_t tableId, uint64_t firstId, uint64_t lastId,
+                      ServerId newOwnerMasterId);
+        bool isReady() { return state.isReady(); }
+        void operator()();
+      private:
+        MasterClient& client;
+        Buffer requestBuffer;
+        Buffer responseBuffer;
+        AsyncState state;
+        DISALLOW_COPY_AND_ASSIGN(MigrateTablet);
+    };
+
     /// An asynchronous version of #multiread().
     class MultiRead {
       public:
@@ -148,6 +395,79 @@ class MasterClient : public Client {
         DISALLOW_COPY_AND_ASSIGN(MultiRead);
     };
 
+    /// An asynchronous version of #multiRemove().
+    class MultiRemove {
+      public:
+        MultiRemove(MasterClient& client,
+                    std::vector<RemoveObject*>& requests);
+        bool isReady() { return state.isReady(); }
+        void complete();
+      private:
+        MasterClient& client;
+        Buffer requestBuffer;
+        Buffer responseBuffer;
+        AsyncState state;
+        std::vector<RemoveObject*>& requests;
+        DISALLOW_COPY_AND_ASSIGN(MultiRemove);
+    };
+
+    /// An asynchronous version of #multiWrite().
+    class MultiWrite {
+      public:
+        MultiWrite(MasterClient& client,
+                   std::vector<WriteObject*>& requests);
+        bool isReady() { return state.isReady(); }
+        void complete();
+      private:
+        MasterClient& client;
+        Buffer requestBuffer;
+        Buffer responseBuffer;
+        AsyncState state;
+        std::vector<WriteObject*>& requests;
+        DISALLOW_COPY_AND_ASSIGN(MultiWrite);
+    };
+
+    /**
+     * The first phase of a transaction spanning several masters: ask this
+     * master to check and lock its share of the objects. Follow up with a
+     * DecideTransaction.
+     */
+    class PrepareTransaction {
+      public:
+        PrepareTransaction(MasterClient& client, uint64_t transactionId,
+                           std::vector<TransactionObject*>& objects);
+        bool isReady() { return state.isReady(); }
+        void complete();
+      private:
+        MasterClient& client;
+        Buffer requestBuffer;
+        Buffer responseBuffer;
+        AsyncState state;
+        std::vector<TransactionObject*>& objects;
+        DISALLOW_COPY_AND_ASSIGN(PrepareTransaction);
+    };
+
+    /**
+     * The second phase of a transaction spanning several masters: tell
+     * this master to commit or abort what it prepared.
+     */
+    class DecideTransaction {
+      public:
+        DecideTransaction(MasterClient& client, uint64_t transactionId,
+                          std::vector<TransactionObject*>& objects,
+                          bool commit);
+        bool isReady() { return state.isReady(); }
+        void complete();
+      private:
+        MasterClient& client;
+        Buffer requestBuffer;
+        Buffer responseBuffer;
+        AsyncState state;
+        std::vector<TransactionObject*>& objects;
+        bool commit;
+        DISALLOW_COPY_AND_ASSIGN(DecideTransaction);
+    };
+
     /// An asynchronous version of #write().
     class Write {
       public:
@@ -159,7 +479,14 @@ class MasterClient : public Client {
         Write(MasterClient& client,
               uint32_t tableId, uint64_t id, const void* buf,
               uint32_t length, const RejectRules* rejectRules = NULL,
-              uint64_t* version = NULL, bool async = false);
+              uint64_t* version = NULL, bool async = false,
+              uint32_t ttl = 0);
+        Write(MasterClient& client,
+              uint32_t tableId, const void* key, uint16_t keyLength,
+              const void* buf, uint32_t length,
+              const RejectRules* rejectRules = NULL,
+              uint64_t* version = NULL, bool async = false,
+              uint32_t ttl = 0);
         bool isReady() { return state.isReady(); }
         void operator()();
       private:
@@ -193,23 +520,65 @@ class MasterClient : public Client {
     };
 
     explicit MasterClient(Transport::SessionRef session) : session(session) {}
+    bool compareAndSwap(uint32_t tableId, uint64_t id,
+                        const void* oldBuf, uint32_t oldLength,
+                        const void* newBuf, uint32_t newLength,
+                        Buffer* currentValue = NULL, uint64_t* version = NULL);
+    bool compareAndSwap(uint32_t tableId, const void* key, uint16_t keyLength,
+                        const void* oldBuf, uint32_t oldLength,
+                        const void* newBuf, uint32_t newLength,
+                        Buffer* currentValue = NULL, uint64_t* version = NULL);
     uint64_t create(uint32_t tableId, const void* buf, uint32_t length,
                     uint64_t* version = NULL, bool async = false);
+    uint32_t enumerateTable(uint32_t tableId, uint64_t startId,
+                            EnumerateTableRpc::Cursor* cursor,
+                            uint64_t* tabletLastId, bool* done,
+                            Buffer* objects);
     void fillWithTestData(uint32_t numObjects, uint32_t objectSize);
+    int64_t increment(uint32_t tableId, uint64_t id, int64_t incrementValue,
+                      const RejectRules* rejectRules = NULL,
+                      uint64_t* version = NULL);
+    int64_t increment(uint32_t tableId, const void* key, uint16_t keyLength,
+                      int64_t incrementValue,
+                      const RejectRules* rejectRules = NULL,
+                      uint64_t* version = NULL);
+    void migrateTablet(uint32_t tableId, uint64_t firstId, uint64_t lastId,
+                       ServerId newOwnerMasterId);
     void multiRead(std::vector<ReadObject*> requests);
+    void multiRemove(std::vector<RemoveObject*> requests);
+    void multiWrite(std::vector<WriteObject*> requests);
+    void prepForMigration(uint32_t tableId, uint64_t firstId,
+                          uint64_t lastId, ServerId sourceMasterId);
     void read(uint32_t tableId, uint64_t id, Buffer* value,
               const RejectRules* rejectRules = NULL,
               uint64_t* version = NULL);
+    void read(uint32_t tableId, const void* key, uint16_t keyLength,
+              Buffer* value, const RejectRules* rejectRules = NULL,
+              uint64_t* version = NULL);
+    void receiveMigrationData(uint32_t tableId, uint64_t firstId,
+                              uint64_t lastId, const void* segment,
+                              uint32_t segmentLength, bool done,
+                              uint64_t tableVersion);
     void recover(ServerId masterId, uint64_t partitionId,
                  const ProtoBuf::Tablets& tablets,
                  const RecoverRpc::Replica* replicas, uint32_t numReplicas);
     void remove(uint32_t tableId, uint64_t id,
                 const RejectRules* rejectRules = NULL,
                 uint64_t* version = NULL);
+    void remove(uint32_t tableId, const void* key, uint16_t keyLength,
+                const RejectRules* rejectRules = NULL,
+                uint64_t* version = NULL);
     void setTablets(const ProtoBuf::Tablets& tablets);
+    void transaction(std::vector<TransactionObject*> objects);
     void write(uint32_t tableId, uint64_t id, const void* buf,
                uint32_t length, const RejectRules* rejectRules = NULL,
-               uint64_t* version = NULL, bool async = false);
+               uint64_t* version = NULL, bool async = false,
+               uint32_t ttl = 0);
+    void write(uint32_t tableId, const void* key, uint16_t keyLength,
+               const void* buf, uint32_t length,
+               const RejectRules* rejectRules = NULL,
+               uint64_t* version = NULL, bool async = false,
+               uint32_t ttl = 0);
 
   protected:
     Transport::SessionRef session;
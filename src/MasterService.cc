@@ -13,14 +13,19 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sched.h>
 #include <unordered_map>
 #include <unordered_set>
 
+#include "BackupService.h"
 #include "Buffer.h"
 #include "ClientException.h"
 #include "Cycles.h"
 #include "Dispatch.h"
+#include "EpochManager.h"
+#include "Fence.h"
 #include "ShortMacros.h"
+#include "MasterClient.h"
 #include "MasterService.h"
 #include "RawMetrics.h"
 #include "Tub.h"
@@ -54,8 +59,75 @@ MasterService::Replica::Replica(uint64_t backupId, uint64_t segmentId,
 {
 }
 
+// class MasterService::KeyMatcher
+
+/**
+ * Construct a KeyMatcher for objects named only by their id, which have
+ * the empty key.
+ */
+MasterService::KeyMatcher::KeyMatcher()
+    : key("")
+    , keyLength(0)
+    , fingerprint(0)
+{
+}
+
+/**
+ * Construct a KeyMatcher for a string key.
+ * \param key
+ *      The key's bytes. They must stay valid as long as the KeyMatcher is
+ *      used. May be NULL if \a keyLength is 0.
+ * \param keyLength
+ *      The number of bytes in \a key. If 0, the KeyMatcher matches objects
+ *      named only by their id.
+ */
+MasterService::KeyMatcher::KeyMatcher(const void* key,
+                                      Object::KeyLength keyLength)
+    : key(keyLength == 0 ? "" : key)
+    , keyLength(keyLength)
+    , fingerprint(0)
+{
+}
+
+/**
+ * Construct a KeyMatcher for the key of a tombstone, of which only the
+ * fingerprint is known.
+ * \param fingerprint
+ *      Object::keyFingerprint() of the key.
+ */
+MasterService::KeyMatcher::KeyMatcher(uint64_t fingerprint)
+    : key(NULL)
+    , keyLength(0)
+    , fingerprint(fingerprint)
+{
+}
+
+/**
+ * Return whether an object or tombstone in #objectMap is for this key.
+ * Tombstones only carry their key's fingerprint, so they are matched on
+ * that.
+ */
+bool
+MasterService::KeyMatcher::operator()(LogEntryHandle handle) const
+{
+    if (handle->type() == LOG_ENTRY_TYPE_OBJ) {
+        const Object* obj = handle->userData<Object>();
+        if (key != NULL)
+            return obj->keyMatches(key, keyLength);
+        return obj->keyFingerprint() == fingerprint;
+    }
+    uint64_t tombFingerprint =
+        handle->userData<ObjectTombstone>()->keyFingerprint;
+    if (key != NULL)
+        return tombFingerprint == Object::keyFingerprint(key, keyLength);
+    return tombFingerprint == fingerprint;
+}
+
 // --- MasterService ---
 
+/// Picks out the #objectMap entry for a referent the caller already holds.
+typedef HashTable<LogEntryHandle>::SameReferent SameReferent;
+
 bool objectLivenessCallback(LogEntryHandle handle,
                             void* cookie);
 bool objectRelocationCallback(LogEntryHandle oldHandle,
@@ -64,6 +136,8 @@ bool objectRelocationCallback(LogEntryHandle oldHandle,
 uint32_t objectTimestampCallback(LogEntryHandle handle);
 void objectScanCallback(LogEntryHandle handle,
                         void* cookie);
+bool objectEvictionCallback(LogEntryHandle handle,
+                            void* cookie);
 
 bool tombstoneLivenessCallback(LogEntryHandle handle,
                                void* cookie);
@@ -74,6 +148,22 @@ uint32_t tombstoneTimestampCallback(LogEntryHandle handle);
 void tombstoneScanCallback(LogEntryHandle handle,
                            void* cookie);
 
+bool intentLivenessCallback(LogEntryHandle handle,
+                            void* cookie);
+bool intentRelocationCallback(LogEntryHandle oldHandle,
+                              LogEntryHandle newHandle,
+                              void* cookie);
+uint32_t intentTimestampCallback(LogEntryHandle handle);
+
+bool decisionLivenessCallback(LogEntryHandle handle,
+                              void* cookie);
+bool decisionRelocationCallback(LogEntryHandle oldHandle,
+                                LogEntryHandle newHandle,
+                                void* cookie);
+uint32_t decisionTimestampCallback(LogEntryHandle handle);
+
+__thread bool MasterService::logSyncPending = false;
+
 /**
  * Construct a MasterService.
  *
@@ -92,7 +182,10 @@ MasterService::MasterService(const ServerConfig& config,
     , coordinator(coordinator)
     , serverId()
     , serverList(serverList)
-    , replicaManager(serverList, serverId, config.master.numReplicas)
+    , replicaManager(serverList, serverId,
+                     config.master.cacheMode ? 0 : config.master.numReplicas,
+                     config.master.localReplica && !config.master.cacheMode &&
+                     config.services.has(BACKUP_SERVICE))
     , bytesWritten(0)
     , log(serverId,
           config.master.logBytes,
@@ -100,13 +193,29 @@ MasterService::MasterService(const ServerConfig& config,
           sizeof(Object) + MAX_OBJECT_SIZE,
           &replicaManager,
           config.master.disableLogCleaner ? Log::CLEANER_DISABLED :
-                                            Log::CONCURRENT_CLEANER)
+                                            Log::CONCURRENT_CLEANER,
+          config.master.cleanerThreads,
+          config.master.cacheMode ? LogCleaner::CLOCK_EVICTION_POLICY :
+                                    config.master.cleanerPolicy,
+          config.master.memoryPlacement)
     , objectMap(config.master.hashTableBytes /
-        HashTable<LogEntryHandle>::bytesPerCacheLine())
+        HashTable<LogEntryHandle>::bytesPerCacheLine(),
+        config.master.memoryPlacement)
     , tablets()
+    , tabletIndex()
+    , maxMultiReadReplyBytes(Segment::SEGMENT_SIZE)
     , initCalled(false)
     , anyWrites(false)
     , objectUpdateLock()
+    , objectMapResizer()
+    , objectMapResizerShouldExit(false)
+    , tabletSplitter()
+    , tabletSplitterShouldExit(false)
+    , splittingTablet(false)
+    , restarter()
+    , replayingRestart(false)
+    , preparedTransactions()
+    , transactionLocks()
 {
     log.registerType(LOG_ENTRY_TYPE_OBJ,
                      true,
@@ -116,6 +225,8 @@ MasterService::MasterService(const ServerConfig& config,
                      this,
                      objectTimestampCallback,
                      objectScanCallback,
+                     this,
+                     objectEvictionCallback,
                      this);
     log.registerType(LOG_ENTRY_TYPE_OBJTOMB,
                      false,
@@ -126,10 +237,58 @@ MasterService::MasterService(const ServerConfig& config,
                      tombstoneTimestampCallback,
                      tombstoneScanCallback,
                      this);
+    log.registerType(LOG_ENTRY_TYPE_TXINTENT,
+                     false,
+                     intentLivenessCallback,
+                     this,
+                     intentRelocationCallback,
+                     this,
+                     intentTimestampCallback,
+                     NULL,
+                     NULL);
+    log.registerType(LOG_ENTRY_TYPE_TXDECISION,
+                     false,
+                     decisionLivenessCallback,
+                     this,
+                     decisionRelocationCallback,
+                     this,
+                     decisionTimestampCallback,
+                     NULL,
+                     NULL);
+
+    // A cache evicts the objects that haven't been read recently, so have
+    // reads mark the objects they find.
+    if (config.master.cacheMode)
+        objectMap.setReferenceTracking(true);
+
+    if (!config.master.disableHashTableResize)
+        objectMapResizer.construct(objectMapResizerEntry, this,
+                                   &Context::get());
 }
 
 MasterService::~MasterService()
 {
+    if (restarter) {
+        restarter->join();
+        restarter.destroy();
+    }
+    if (tabletSplitter) {
+        tabletSplitterShouldExit = true;
+        Fence::sfence();
+        tabletSplitter->join();
+        tabletSplitter.destroy();
+    }
+    if (objectMapResizer) {
+        objectMapResizerShouldExit = true;
+        Fence::sfence();
+        objectMapResizer->join();
+        objectMapResizer.destroy();
+    }
+    if (tombstoneReaper) {
+        Dispatch::Lock lock;
+        tombstoneReaper.destroy();
+    }
+
     std::set<Table*> tables;
     foreach (const ProtoBuf::Tablets::Tablet& tablet, tablets.tablet())
         tables.insert(reinterpret_cast<Table*>(tablet.user_data()));
@@ -142,47 +301,141 @@ MasterService::dispatch(RpcOpcode opcode, Rpc& rpc)
 {
     assert(initCalled);
 
-    std::lock_guard<SpinLock> lock(objectUpdateLock);
-
+    // Reads take no locks, so that they can run in parallel with one
+    // another and with updates (see read()). Migrating a tablet away takes
+    // #objectUpdateLock itself, a little at a time, so that the tablet
+    // keeps taking updates while its data is copied.
     switch (opcode) {
-        case CreateRpc::opcode:
-            callHandler<CreateRpc, MasterService,
-                        &MasterService::create>(rpc);
-            break;
-        case FillWithTestDataRpc::opcode:
-            callHandler<FillWithTestDataRpc, MasterService,
-                        &MasterService::fillWithTestData>(rpc);
-            break;
+        case EnumerateTableRpc::opcode:
+            callHandler<EnumerateTableRpc, MasterService,
+                        &MasterService::enumerateTable>(rpc);
+            return;
+        case MigrateTabletRpc::opcode:
+            callHandler<MigrateTabletRpc, MasterService,
+                        &MasterService::migrateTablet>(rpc);
+            return;
         case MultiReadRpc::opcode:
             callHandler<MultiReadRpc, MasterService,
                         &MasterService::multiRead>(rpc);
-            break;
+            return;
         case ReadRpc::opcode:
             callHandler<ReadRpc, MasterService,
                         &MasterService::read>(rpc);
-            break;
-        case RecoverRpc::opcode:
-            callHandler<RecoverRpc, MasterService,
-                        &MasterService::recover>(rpc);
-            break;
-        case RemoveRpc::opcode:
-            callHandler<RemoveRpc, MasterService,
-                        &MasterService::remove>(rpc);
-            break;
-        case RereplicateSegmentsRpc::opcode:
-            callHandler<RereplicateSegmentsRpc, MasterService,
-                        &MasterService::rereplicateSegments>(rpc);
-            break;
-        case SetTabletsRpc::opcode:
-            callHandler<SetTabletsRpc, MasterService,
-                        &MasterService::setTablets>(rpc);
-            break;
-        case WriteRpc::opcode:
-            callHandler<WriteRpc, MasterService,
-                        &MasterService::write>(rpc);
-            break;
+            return;
         default:
-            throw UnimplementedRequestError(HERE);
+            break;
+    }
+
+    // Updates that must be durable before they are acknowledged don't
+    // wait for backups while holding #objectUpdateLock; they note it in
+    // #logSyncPending and wait here instead, once other updates can go
+    // ahead and have their appends replicated by the same round trip.
+    LogTime syncTime;
+    vector<uint64_t> expired;
+    {
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        logSyncPending = false;
+        findExpiredTransactions(expired);
+
+        switch (opcode) {
+            case CompareAndSwapRpc::opcode:
+                callHandler<CompareAndSwapRpc, MasterService,
+                            &MasterService::compareAndSwap>(rpc);
+                break;
+            case CreateRpc::opcode:
+                callHandler<CreateRpc, MasterService,
+                            &MasterService::create>(rpc);
+                break;
+            case DecideTransactionRpc::opcode:
+                callHandler<DecideTransactionRpc, MasterService,
+                            &MasterService::decideTransaction>(rpc);
+                break;
+            case FillWithTestDataRpc::opcode:
+                callHandler<FillWithTestDataRpc, MasterService,
+                            &MasterService::fillWithTestData>(rpc);
+                break;
+            case IncrementRpc::opcode:
+                callHandler<IncrementRpc, MasterService,
+                            &MasterService::increment>(rpc);
+                break;
+            case MultiRemoveRpc::opcode:
+                callHandler<MultiRemoveRpc, MasterService,
+                            &MasterService::multiRemove>(rpc);
+                break;
+            case MultiWriteRpc::opcode:
+                callHandler<MultiWriteRpc, MasterService,
+                            &MasterService::multiWrite>(rpc);
+                break;
+            case PrepareTransactionRpc::opcode:
+                callHandler<PrepareTransactionRpc, MasterService,
+                            &MasterService::prepareTransaction>(rpc);
+                break;
+            case PrepForMigrationRpc::opcode:
+            {
+                HashTable<LogEntryHandle>::ExclusiveLock _(objectMap);
+                callHandler<PrepForMigrationRpc, MasterService,
+                            &MasterService::prepForMigration>(rpc);
+                break;
+            }
+            case ReceiveMigrationDataRpc::opcode:
+            {
+                // Migrated data is replayed like recovery segments are.
+                HashTable<LogEntryHandle>::ExclusiveLock _(objectMap);
+                callHandler<ReceiveMigrationDataRpc, MasterService,
+                            &MasterService::receiveMigrationData>(rpc);
+                break;
+            }
+            case RecoverRpc::opcode:
+            {
+                // Recovery replays segments straight into the objectMap without
+                // taking bucket locks, so keep the resizer out entirely.
+                HashTable<LogEntryHandle>::ExclusiveLock _(objectMap);
+                callHandler<RecoverRpc, MasterService,
+                            &MasterService::recover>(rpc);
+                break;
+            }
+            case RemoveRpc::opcode:
+                callHandler<RemoveRpc, MasterService,
+                            &MasterService::remove>(rpc);
+                break;
+            case RereplicateSegmentsRpc::opcode:
+                callHandler<RereplicateSegmentsRpc, MasterService,
+                            &MasterService::rereplicateSegments>(rpc);
+                break;
+            case SetTabletsRpc::opcode:
+            {
+                HashTable<LogEntryHandle>::ExclusiveLock _(objectMap);
+                callHandler<SetTabletsRpc, MasterService,
+                            &MasterService::setTablets>(rpc);
+                break;
+            }
+            case TransactionRpc::opcode:
+                callHandler<TransactionRpc, MasterService,
+                            &MasterService::transaction>(rpc);
+                break;
+            case WriteRpc::opcode:
+                callHandler<WriteRpc, MasterService,
+                            &MasterService::write>(rpc);
+                break;
+            default:
+                throw UnimplementedRequestError(HERE);
+        }
+
+        if (logSyncPending)
+            syncTime = log.getHeadLogTime();
+    }
+    if (logSyncPending) {
+        logSyncPending = false;
+        CycleCounter<RawMetric> _(&metrics->master.updateSyncTicks);
+        ++metrics->master.updateSyncCount;
+        log.sync(syncTime);
+    }
+
+    // Asking the coordinator about prepared transactions whose clients
+    // have gone quiet shouldn't hold up this request's reply.
+    if (!expired.empty()) {
+        rpc.sendReply();
+        resolveTransactions(expired);
     }
 }
 
@@ -201,6 +454,109 @@ MasterService::init(ServerId id)
     metrics->serverId = serverId.getId();
 
     initCalled = true;
+
+    // Splitting needs our server id, so it can't start any earlier.
+    if (config.master.tabletSplitBytes != 0)
+        tabletSplitter.construct(tabletSplitterEntry, this, &Context::get());
+}
+
+/**
+ * Start taking back the tablets of the server this process ran as before a
+ * planned restart, by replaying that server's log from the backup running
+ * in this process instead of waiting for crash recovery.  The replay runs
+ * on a thread of its own, since it needs RPCs to the coordinator answered
+ * while this thread dispatches requests; see restart().
+ *
+ * \param formerId
+ *      The id this server ran under before the restart.  The coordinator
+ *      must have handed its tablets to this server when it enlisted.
+ * \param backup
+ *      The BackupService in this process, holding the former log.
+ * \param segmentIds
+ *      The segments of the former log; see BackupService::findLocalLog().
+ */
+void
+MasterService::startRestart(ServerId formerId, BackupService& backup,
+                            const vector<uint64_t>& segmentIds)
+{
+    assert(initCalled);
+    assert(!restarter);
+    restarter.construct(restarterEntry, this, &Context::get(),
+                        formerId, &backup, segmentIds);
+}
+
+/**
+ * Top-level server method to handle the COMPARE_AND_SWAP request, which
+ * replaces an object's value only if it still holds the value the client
+ * last saw. The comparison and the write happen under #objectUpdateLock,
+ * so no other update can slip in between them. If the values differ, the
+ * object's current value is returned so the client can retry without
+ * reading it again.
+ * \copydetails create
+ */
+void
+MasterService::compareAndSwap(const CompareAndSwapRpc::Request& reqHdr,
+                              CompareAndSwapRpc::Response& respHdr,
+                              Rpc& rpc)
+{
+    bool normal;
+    if (getTable(reqHdr.tableId, reqHdr.id, &normal) == NULL) {
+        respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
+        return;
+    }
+    if (!normal) {
+        respHdr.common.status = STATUS_RETRY;
+        return;
+    }
+    uint32_t oldOffset = downCast<uint32_t>(sizeof(reqHdr)) +
+                         reqHdr.keyLength;
+    uint32_t newOffset = oldOffset + reqHdr.oldLength;
+    if (newOffset + reqHdr.newLength > rpc.requestPayload.getTotalLength()) {
+        respHdr.common.status = STATUS_MESSAGE_TOO_SHORT;
+        return;
+    }
+    const void* key = rpc.requestPayload.getRange(sizeof(reqHdr),
+                                                  reqHdr.keyLength);
+
+    LogEntryHandle handle = objectMap.lookup(reqHdr.tableId, reqHdr.id,
+                                   KeyMatcher(key, reqHdr.keyLength));
+    if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ ||
+        handle->userData<Object>()->isExpired()) {
+        respHdr.common.status = STATUS_OBJECT_DOESNT_EXIST;
+        return;
+    }
+    const Object* obj = handle->userData<Object>();
+    uint32_t length = obj->valueLength(handle->length());
+    respHdr.version = obj->version;
+
+    if (length != reqHdr.oldLength ||
+        memcmp(obj->value(), rpc.requestPayload.getRange(oldOffset, length),
+               length) != 0) {
+        respHdr.swapped = 0;
+        respHdr.length = length;
+        Log::PinnedChunk::appendToBuffer(&rpc.replyPayload, log,
+                                         obj->value(), length);
+        return;
+    }
+
+    // storeData() expects the object's key, if any, right before the value.
+    Buffer newValue;
+    Buffer::Chunk::appendToBuffer(&newValue, obj->data, obj->keyLength);
+    Buffer::Chunk::appendToBuffer(&newValue,
+        rpc.requestPayload.getRange(newOffset, reqHdr.newLength),
+        reqHdr.newLength);
+
+    RejectRules rejectRules;
+    memset(&rejectRules, 0, sizeof(RejectRules));
+    Status status = storeData(reqHdr.tableId, reqHdr.id, &rejectRules,
+                              &newValue, 0, reqHdr.newLength,
+                              &respHdr.version, false, obj->keyLength,
+                              obj->expiry);
+    if (status != STATUS_OK) {
+        respHdr.common.status = status;
+        return;
+    }
+    respHdr.swapped = 1;
 }
 
 /**
@@ -219,7 +575,10 @@ MasterService::create(const CreateRpc::Request& reqHdr,
         respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
         return;
     }
+    // Skip ids that fall in tablets of this table served elsewhere.
     uint64_t id = table->AllocateKey(&objectMap);
+    while (getTable(reqHdr.tableId, id) != table)
+        id = table->AllocateKey(&objectMap);
 
     RejectRules rejectRules;
     memset(&rejectRules, 0, sizeof(RejectRules));
@@ -236,6 +595,229 @@ MasterService::create(const CreateRpc::Request& reqHdr,
     respHdr.id = id;
 }
 
+/**
+ * The objects of a tablet gathered from hash table buckets while handling
+ * an ENUMERATE_TABLE request. See enumerationCallback().
+ */
+struct EnumerationCookie {
+    EnumerationCookie(uint64_t tableId, uint64_t firstId, uint64_t lastId)
+        : tableId(tableId)
+        , firstId(firstId)
+        , lastId(lastId)
+        , cursorBucket(0)
+        , cursorNumBuckets(0)
+        , handles()
+    {
+    }
+
+    /// Only objects of this table whose tablet keys (see Object::tabletKey)
+    /// are in [firstId, lastId] are kept.
+    uint64_t tableId;
+    uint64_t firstId;
+    uint64_t lastId;
+
+    /// If nonzero, the hash table has fewer buckets than the cursor counts
+    /// in, so only objects falling in cursorBucket of a table of this many
+    /// buckets are kept.
+    uint64_t cursorBucket;
+    uint64_t cursorNumBuckets;
+
+    /// The objects found.
+    std::vector<LogEntryHandle> handles;
+
+    DISALLOW_COPY_AND_ASSIGN(EnumerationCookie);
+};
+
+/**
+ * Callback used to gather the objects of a tablet being enumerated.
+ * Invoked by HashTable::forEachInBucket.
+ */
+static void
+enumerationCallback(LogEntryHandle handle, void* cookie)
+{
+    EnumerationCookie* enumeration = static_cast<EnumerationCookie*>(cookie);
+
+    // Tombstones in the hash table are left over from recovery.
+    if (handle->type() != LOG_ENTRY_TYPE_OBJ)
+        return;
+    const Object* obj = handle->userData<Object>();
+    if (obj->isExpired())
+        return;
+    uint64_t tabletKey = Object::tabletKey(obj->id.objectId);
+    if (obj->id.tableId != enumeration->tableId ||
+        tabletKey < enumeration->firstId ||
+        tabletKey > enumeration->lastId)
+        return;
+    if (enumeration->cursorNumBuckets != 0 &&
+        HashTable<LogEntryHandle>::getBucketIndex(obj->id.tableId,
+                obj->id.objectId, enumeration->cursorNumBuckets) !=
+            enumeration->cursorBucket)
+        return;
+    enumeration->handles.push_back(handle);
+}
+
+/**
+ * Top-level server method to handle the DECIDE_TRANSACTION request, the
+ * second phase of a transaction prepared by prepareTransaction(). A commit
+ * applies the prepared operations; an abort just forgets them. Either way
+ * the transaction's objects are unlocked.
+ *
+ * A transaction that isn't prepared here has been decided already: its
+ * PREPARE_TRANSACTION failed or never arrived (and the client can only be
+ * aborting it), or this master learned the outcome from the coordinator
+ * first (see resolveTransactions()). So the request succeeds without
+ * doing anything; a commit just can't return versions.
+ *
+ * \copydetails Service::ping
+ */
+void
+MasterService::decideTransaction(const DecideTransactionRpc::Request& reqHdr,
+                                 DecideTransactionRpc::Response& respHdr,
+                                 Rpc& rpc)
+{
+    auto it = preparedTransactions.find(reqHdr.transactionId);
+    if (it == preparedTransactions.end())
+        return;
+    uint32_t count = it->second->count;
+    Status status = decidePreparedTransaction(reqHdr.transactionId,
+                                              reqHdr.commit,
+                                              rpc.replyPayload);
+    if (status != STATUS_OK) {
+        // Typically the log is out of memory; the transaction stays
+        // prepared so that the client can retry the decision.
+        respHdr.common.status = status;
+        return;
+    }
+    if (reqHdr.commit)
+        respHdr.count = count;
+}
+
+/**
+ * Top-level server method to handle the ENUMERATE_TABLE request, which
+ * returns the next batch of objects in one of this master's tablets.
+ *
+ * The enumeration walks #objectMap a bucket at a time. Its cursor counts
+ * buckets in a table of fixed size (the size when the enumeration began),
+ * and the objects in each of those buckets are returned all at once.
+ * Objects never change buckets when they are written or relocated by the
+ * cleaner, and growing the table only splits buckets, so an object that
+ * exists for the whole enumeration is returned exactly once. Every master
+ * hashes objects the same way, so if the tablet moves the client can
+ * replay its cursor at the new owner.
+ *
+ * Objects are appended to the reply straight from the log without being
+ * copied, and no locks are held while they are, so enumerations run
+ * alongside reads and writes.
+ *
+ * \copydetails Service::ping
+ */
+void
+MasterService::enumerateTable(const EnumerateTableRpc::Request& reqHdr,
+                              EnumerateTableRpc::Response& respHdr,
+                              Rpc& rpc)
+{
+    // See read() for why the objects found stay valid without locks.
+    EpochManager::ReadGuard _;
+
+    uint64_t tabletLastId;
+    bool normal;
+    if (tabletIndex.lookup(reqHdr.tableId, reqHdr.startId,
+                           &tabletLastId, &normal) == NULL) {
+        respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
+        return;
+    }
+    if (!normal) {
+        respHdr.common.status = STATUS_RETRY;
+        return;
+    }
+
+    EnumerateTableRpc::Cursor cursor = reqHdr.cursor;
+    if (cursor.numBuckets == 0) {
+        cursor.nextBucket = 0;
+        cursor.numBuckets = objectMap.getNumBuckets();
+    }
+    if (!BitOps::isPowerOfTwo(cursor.numBuckets) ||
+        cursor.nextBucket > cursor.numBuckets) {
+        respHdr.common.status = STATUS_REQUEST_FORMAT_ERROR;
+        return;
+    }
+
+    EnumerationCookie enumeration(reqHdr.tableId, reqHdr.startId,
+                                  tabletLastId);
+    uint32_t count = 0;
+    uint64_t bytes = 0;
+    uint64_t bucketsVisited = 0;
+    while (cursor.nextBucket < cursor.numBuckets &&
+           bucketsVisited < ENUMERATION_BUCKETS_PER_RPC) {
+        // Gather the cursor's bucket: a run of buckets strided by the
+        // cursor's table size if the table has grown past it, or part of
+        // one bucket if it is smaller. Start over if the table grows
+        // meanwhile, since the buckets not yet visited may have split.
+        while (1) {
+            uint64_t numBuckets = objectMap.getNumBuckets();
+            uint64_t bucket = cursor.nextBucket;
+            uint64_t stride = cursor.numBuckets;
+            enumeration.cursorNumBuckets = 0;
+            if (numBuckets < cursor.numBuckets) {
+                enumeration.cursorBucket = cursor.nextBucket;
+                enumeration.cursorNumBuckets = cursor.numBuckets;
+                bucket = cursor.nextBucket & (numBuckets - 1);
+                stride = numBuckets;
+            }
+            bool grew = false;
+            for (; bucket < numBuckets; bucket += stride) {
+                std::lock_guard<SpinLock> lock(
+                    objectMap.getBucketLockByIndex(bucket));
+                if (objectMap.getNumBuckets() != numBuckets) {
+                    grew = true;
+                    break;
+                }
+                objectMap.forEachInBucket(enumerationCallback, &enumeration,
+                                          bucket);
+                ++bucketsVisited;
+            }
+            if (!grew)
+                break;
+            enumeration.handles.clear();
+        }
+
+        // Leave the bucket for the next request if it would overflow this
+        // reply, unless the reply would otherwise be empty.
+        uint64_t bucketBytes = 0;
+        foreach (LogEntryHandle handle, enumeration.handles)
+            bucketBytes += sizeof(SegmentEntry) + handle->length();
+        if (count > 0 && bytes + bucketBytes > maxMultiReadReplyBytes)
+            break;
+
+        foreach (LogEntryHandle handle, enumeration.handles) {
+            const SegmentEntry* entry = reinterpret_cast<
+                                        const SegmentEntry*>(handle);
+            Log::PinnedChunk::appendToBuffer(&rpc.replyPayload, log, entry,
+                downCast<uint32_t>(sizeof(SegmentEntry) + handle->length()));
+        }
+        count += downCast<uint32_t>(enumeration.handles.size());
+        bytes += bucketBytes;
+        enumeration.handles.clear();
+        ++cursor.nextBucket;
+    }
+
+    // The tablet may have been migrated away and its objects purged while
+    // we looked; the client will retry at the new owner.
+    if (tabletIndex.lookup(reqHdr.tableId, reqHdr.startId) == NULL) {
+        rpc.replyPayload.truncateEnd(rpc.replyPayload.getTotalLength() -
+                                     downCast<uint32_t>(sizeof(respHdr)));
+        respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
+        return;
+    }
+
+    respHdr.tabletLastId = tabletLastId;
+    respHdr.cursor = cursor;
+    respHdr.done = (cursor.nextBucket == cursor.numBuckets);
+    respHdr.count = count;
+    metrics->master.enumerateObjects += count;
+    metrics->master.enumerateBytes += bytes;
+}
+
 /**
  * Fill this server with test data. Objects are added to all
  * existing tables in a round-robin fashion.
@@ -286,333 +868,1468 @@ MasterService::fillWithTestData(const FillWithTestDataRpc::Request& reqHdr,
 }
 
 /**
- * Top-level server method to handle the MULTIREAD request.
- *
- * \copydetails Service::ping
+ * Append a copy of a log entry, header and all, to a batch of entries being
+ * sent to a tablet's new owner. Batches have the same format as recovery
+ * segments, so the new owner can replay them with recoverSegment().
+ */
+static void
+appendMigrationEntry(Buffer& batch, LogEntryHandle handle)
+{
+    uint32_t length = handle->totalLength();
+    memcpy(new(&batch, APPEND) char[length], handle, length);
+}
+
+/**
+ * Append a tombstone to a batch of entries being sent to a tablet's new
+ * owner (see appendMigrationEntry()). The tombstone was never part of a
+ * segment, so its checksum is computed here.
+ */
+static void
+appendMigrationTombstone(Buffer& batch, const ObjectTombstone& tomb)
+{
+    uint32_t length = downCast<uint32_t>(sizeof(SegmentEntry) + sizeof(tomb));
+    char* copy = new(&batch, APPEND) char[length];
+    SegmentEntry* entry = new(copy) SegmentEntry(LOG_ENTRY_TYPE_OBJTOMB,
+                                                 sizeof(tomb));
+    memcpy(copy + sizeof(*entry), &tomb, sizeof(tomb));
+    SegmentChecksum mutableFields;
+    mutableFields.update(&entry->mutableFields, sizeof(entry->mutableFields));
+    entry->checksum = reinterpret_cast<SegmentEntryHandle>(entry)->
+                        generateChecksum() ^ mutableFields.getResult();
+}
+
+/**
+ * Callback used to copy the objects of a tablet being migrated into the
+ * migration's batch. Invoked by HashTable::forEachInBucket.
  */
 void
-MasterService::multiRead(const MultiReadRpc::Request& reqHdr,
-                         MultiReadRpc::Response& respHdr,
-                         Rpc& rpc)
+migrationCopyCallback(LogEntryHandle handle, void* cookie)
 {
-    uint32_t numRequests = reqHdr.count;
-    uint32_t reqOffset = downCast<uint32_t>(sizeof(reqHdr));
+    MasterService* service = static_cast<MasterService*>(cookie);
 
-    respHdr.count = numRequests;
+    // Tombstones in the hash table are left over from recovery; there is
+    // no object for them to stand in for.
+    if (handle->type() != LOG_ENTRY_TYPE_OBJ)
+        return;
+    const Object* obj = handle->userData<Object>();
+    if (service->migration->contains(obj->id.tableId, obj->id.objectId))
+        appendMigrationEntry(service->migration->batch, handle);
+}
 
-    // Each iteration extracts one request from request rpc, finds the
-    // corresponding object, and appends the response to the response rpc.
-    for (uint32_t i = 0; i < numRequests; i++) {
-        const MultiReadRpc::Request::Part *currentReq =
-              rpc.requestPayload.getOffset<MultiReadRpc::Request::Part>(
-              reqOffset);
-        reqOffset += downCast<uint32_t>(sizeof(MultiReadRpc::Request::Part));
-
-        Status* status = new(&rpc.replyPayload, APPEND) Status(STATUS_OK);
-        // We must note the status if the table does not exist. Also, we might
-        // have an entry in the hash table that's invalid because its tablet no
-        // longer lives here.
-        if (getTable(currentReq->tableId, currentReq->id) == NULL) {
-            *status = STATUS_TABLE_DOESNT_EXIST;
-            continue;
-        }
-        LogEntryHandle handle = objectMap.lookup(currentReq->tableId,
-                                                 currentReq->id);
-        if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ) {
-             *status = STATUS_OBJECT_DOESNT_EXIST;
-             continue;
-        }
+/**
+ * Callback used to purge the objects of a tablet that has been migrated
+ * away from the hash table. Invoked by HashTable::forEachInBucket.
+ */
+void
+migrationPurgeCallback(LogEntryHandle handle, void* cookie)
+{
+    MasterService* service = static_cast<MasterService*>(cookie);
 
-        const SegmentEntry* entry = reinterpret_cast<
-                                    const SegmentEntry*>(handle);
-        Buffer::Chunk::appendToBuffer(&rpc.replyPayload, entry,
-                                      downCast<uint32_t>(sizeof(SegmentEntry))
-                                      + handle->length());
+    // Objects and tombstones both start with their ObjectIdentifier.
+    const ObjectIdentifier* id = handle->userData<ObjectIdentifier>();
+    if (service->migration->contains(id->tableId, id->objectId)) {
+        service->objectMap.remove(id->tableId, id->objectId,
+                                  SameReferent(handle));
     }
 }
 
 /**
- * Top-level server method to handle the READ request.
+ * Callback used to purge the objects of tablets that a failed restart gave
+ * up on from the hash table; see abortRestart(). Invoked by
+ * HashTable::forEachInBucket.
+ */
+void
+restartPurgeCallback(LogEntryHandle handle, void* cookie)
+{
+    MasterService* service = static_cast<MasterService*>(cookie);
+
+    // Objects and tombstones both start with their ObjectIdentifier.
+    const ObjectIdentifier* id = handle->userData<ObjectIdentifier>();
+    if (service->getTable(downCast<uint32_t>(id->tableId),
+                          id->objectId) == NULL) {
+        service->objectMap.remove(id->tableId, id->objectId,
+                                  SameReferent(handle));
+    }
+}
+
+/**
+ * Top-level server method to handle the INCREMENT request, which adds to
+ * an object holding a 64-bit little-endian integer and returns the sum.
+ * An object that doesn't exist is treated as holding zero, unless the
+ * reject rules say otherwise. Because the read and the write both happen
+ * under #objectUpdateLock, concurrent increments never conflict and
+ * clients need no retry loop.
  * \copydetails create
  */
 void
-MasterService::read(const ReadRpc::Request& reqHdr,
-                   ReadRpc::Response& respHdr,
-                   Rpc& rpc)
+MasterService::increment(const IncrementRpc::Request& reqHdr,
+                         IncrementRpc::Response& respHdr,
+                         Rpc& rpc)
 {
-    // We must return table doesn't exist if the table does not exist. Also, we
-    // might have an entry in the hash table that's invalid because its tablet
-    // no longer lives here.
-    if (getTable(reqHdr.tableId, reqHdr.id) == NULL) {
+    bool normal;
+    if (getTable(reqHdr.tableId, reqHdr.id, &normal) == NULL) {
         respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
         return;
     }
+    if (!normal) {
+        respHdr.common.status = STATUS_RETRY;
+        return;
+    }
 
-    LogEntryHandle handle = objectMap.lookup(reqHdr.tableId, reqHdr.id);
-    if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ) {
-        respHdr.common.status = STATUS_OBJECT_DOESNT_EXIST;
+    const void* key = rpc.requestPayload.getRange(sizeof(reqHdr),
+                                                  reqHdr.keyLength);
+    if (key == NULL && reqHdr.keyLength != 0) {
+        respHdr.common.status = STATUS_MESSAGE_TOO_SHORT;
         return;
     }
 
-    const Object* obj = handle->userData<Object>();
-    respHdr.version = obj->version;
-    Status status = rejectOperation(reqHdr.rejectRules, obj->version);
+    // storeData() expects the object's key, if any, right before the value.
+    int64_t value = 0;
+    Buffer newValue;
+    if (reqHdr.keyLength != 0)
+        Buffer::Chunk::appendToBuffer(&newValue, key, reqHdr.keyLength);
+    uint32_t expiry = 0;
+    LogEntryHandle handle = objectMap.lookup(reqHdr.tableId, reqHdr.id,
+                                   KeyMatcher(key, reqHdr.keyLength));
+    if (handle != NULL && handle->type() == LOG_ENTRY_TYPE_OBJ &&
+        !handle->userData<Object>()->isExpired()) {
+        const Object* obj = handle->userData<Object>();
+        respHdr.version = obj->version;
+        Status status = rejectOperation(reqHdr.rejectRules, obj->version);
+        if (status != STATUS_OK) {
+            respHdr.common.status = status;
+            return;
+        }
+        if (obj->valueLength(handle->length()) != sizeof(value)) {
+            respHdr.common.status = STATUS_INVALID_OBJECT;
+            return;
+        }
+        memcpy(&value, obj->value(), sizeof(value));
+        // A counter that expires keeps expiring at the same time.
+        expiry = obj->expiry;
+    }
+
+    // Overflow wraps around, as it would in two's complement hardware.
+    value = static_cast<int64_t>(static_cast<uint64_t>(value) +
+                                 static_cast<uint64_t>(reqHdr.incrementValue));
+    Buffer::Chunk::appendToBuffer(&newValue, &value, sizeof(value));
+
+    Status status = storeData(reqHdr.tableId, reqHdr.id, &reqHdr.rejectRules,
+                              &newValue, 0, sizeof(value), &respHdr.version,
+                              false, reqHdr.keyLength, expiry);
     if (status != STATUS_OK) {
         respHdr.common.status = status;
         return;
     }
-    Buffer::Chunk::appendToBuffer(&rpc.replyPayload,
-        obj->data, obj->dataLength(handle->length()));
-    // TODO(ongaro): We'll need a new type of Chunk to block the cleaner
-    // from scribbling over obj->data.
-    respHdr.length = obj->dataLength(handle->length());
+    respHdr.newValue = value;
 }
 
 /**
- * Callback used to purge the tombstones from the hash table. Invoked by
- * HashTable::forEach.
+ * Top-level server method to handle the MIGRATE_TABLET request, which moves
+ * a tablet to another master while this one keeps serving it.
+ *
+ * The tablet's objects are copied out of #objectMap a few buckets at a time
+ * and streamed to the new owner in batches that it replays like recovery
+ * segments. Objects updated meanwhile are resent until only a few remain;
+ * those are then sent while updates to the tablet fail with STATUS_RETRY,
+ * the coordinator is told to point the tablet map at the new owner, and the
+ * tablet is dropped here. Only that last step refuses updates (see the
+ * migrationPauseTicks metric), and only to the migrating tablet; reads are
+ * never blocked.
+ *
+ * \copydetails Service::ping
  */
 void
-recoveryCleanup(LogEntryHandle maybeTomb, void *cookie)
+MasterService::migrateTablet(const MigrateTabletRpc::Request& reqHdr,
+                             MigrateTabletRpc::Response& respHdr,
+                             Rpc& rpc)
 {
-    if (maybeTomb->type() == LOG_ENTRY_TYPE_OBJTOMB) {
-        const ObjectTombstone *tomb = maybeTomb->userData<ObjectTombstone>();
-        MasterService *server = reinterpret_cast<MasterService*>(cookie);
-        bool r = server->objectMap.remove(tomb->id.tableId, tomb->id.objectId);
-        assert(r);
-        // Tombstones are not explicitly freed in the log. The cleaner will
-        // figure out that they're dead.
-    }
+    respHdr.common.status = migrateTablet(reqHdr.tableId, reqHdr.firstId,
+                                          reqHdr.lastId,
+                                          ServerId(reqHdr.newOwnerMasterId));
 }
 
 /**
- * A Dispatch::Poller which lazily removes tombstones from the main HashTable.
+ * Migrate a tablet this master owns to another master; see the
+ * MIGRATE_TABLET handler above for how.
+ *
+ * \param tableId
+ *      The table containing the tablet.
+ * \param firstId
+ *      Identifier of the first object in the tablet.
+ * \param lastId
+ *      Identifier of the last object in the tablet.
+ * \param newOwnerId
+ *      The master to move the tablet to.
+ * \return
+ *      STATUS_OK if the tablet now lives on \a newOwnerId,
+ *      STATUS_TABLE_DOESNT_EXIST if this master doesn't own exactly that
+ *      tablet, or STATUS_RETRY if another migration or a split is under
+ *      way or a prepared transaction locks objects in the tablet (its
+ *      intents can't follow the tablet).
+ * \throw RequestFormatError
+ *      \a newOwnerId isn't some other server this master knows of.
  */
-class RemoveTombstonePoller : public Dispatch::Poller {
-  public:
-    /**
-     * Clean tombstones from #objectMap lazily and in the background.
-     *
-     * Instances of this class must be allocated with new since they
-     * delete themselves when the #objectMap scan is completed which
-     * automatically deregisters it from Dispatch.
-     *
-     * \param masterService
-     *      The instance of MasterService which owns the #objectMap.
-     * \param objectMap
-     *      The HashTable which will be purged of tombstones.
-     */
-    RemoveTombstonePoller(MasterService& masterService,
-                          HashTable<LogEntryHandle>& objectMap)
-        : Dispatch::Poller(*Context::get().dispatch)
-        , currentBucket(0)
-        , masterService(masterService)
-        , objectMap(objectMap)
-    {
-        LOG(NOTICE, "Starting cleanup of tombstones in background");
+Status
+MasterService::migrateTablet(uint32_t tableId, uint64_t firstId,
+                             uint64_t lastId, ServerId newOwnerId)
+{
+    if (newOwnerId == serverId || !serverList.contains(newOwnerId)) {
+        LOG(WARNING, "Can't migrate tablet %u [%lu, %lu] to unknown "
+            "master %lu", tableId, firstId, lastId, newOwnerId.getId());
+        throw RequestFormatError(HERE);
     }
 
-    /**
-     * Remove tombstones from a single bucket and yield to other work
-     * in the system.
-     */
-    virtual void
-    poll()
     {
-        // This method runs in the dispatch thread, so it isn't safe to
-        // manipulate any of the objectMap state if any RPCs are currently
-        // executing.
-        if (!Context::get().serviceManager->idle())
-            return;
-        objectMap.forEachInBucket(
-            recoveryCleanup, &masterService, currentBucket);
-        ++currentBucket;
-        if (currentBucket == objectMap.getNumBuckets()) {
-            LOG(NOTICE, "Cleanup of tombstones complete");
-            delete this;
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        bool found = false;
+        foreach (const ProtoBuf::Tablets::Tablet& tablet, tablets.tablet()) {
+            if (tablet.table_id() == tableId &&
+                tablet.start_object_id() == firstId &&
+                tablet.end_object_id() == lastId)
+                found = true;
         }
+        if (!found)
+            return STATUS_TABLE_DOESNT_EXIST;
+        // A split would change the tablet's bounds underneath us.
+        if (migration || splittingTablet ||
+            preparedInTablet(tableId, firstId, lastId))
+            return STATUS_RETRY;
+        migration.construct(tableId, firstId, lastId);
     }
 
-  private:
-    /// Which bucket of #objectMap should be cleaned out next.
-    uint64_t currentBucket;
+    LOG(NOTICE, "Migrating tablet %u [%lu, %lu] to master %lu",
+        tableId, firstId, lastId, newOwnerId.getId());
+    CycleCounter<RawMetric> migrationTicks(&metrics->master.migrationTicks);
+    try {
+        MasterClient target(serverList.getSession(newOwnerId));
+        target.prepForMigration(tableId, firstId, lastId, serverId);
+
+        // Copy everything in the tablet. Updates made while this runs
+        // record the objects they touch in migration->dirty.
+        uint64_t bucket = 0;
+        while (!visitObjectMapBuckets(&bucket, migrationCopyCallback)) {
+            if (migration->batch.getTotalLength() >= MIGRATION_BATCH_BYTES)
+                sendMigrationBatch(target, false, 0);
+        }
+
+        // Resend objects updated since they were copied until few enough
+        // are left to send the rest with updates blocked.
+        for (uint32_t round = 0; round < MIGRATION_MAX_CATCHUP_ROUNDS;
+             round++) {
+            {
+                std::lock_guard<SpinLock> lock(objectUpdateLock);
+                if (migration->dirty.size() <= MIGRATION_FINAL_DIRTY_OBJECTS)
+                    break;
+                copyDirtyObjects(MIGRATION_OBJECTS_PER_LOCK);
+            }
+            if (migration->batch.getTotalLength() >= MIGRATION_BATCH_BYTES)
+                sendMigrationBatch(target, false, 0);
+        }
 
-    /// The MasterService used by the #recoveryCleanup callback.
-    MasterService& masterService;
+        {
+            CycleCounter<RawMetric> pauseTicks(
+                &metrics->master.migrationPauseTicks);
+
+            // Refuse further updates to the tablet rather than holding
+            // #objectUpdateLock while waiting on the new owner and the
+            // coordinator: the new owner may be waiting on this master.
+            uint64_t tableVersion;
+            {
+                std::lock_guard<SpinLock> lock(objectUpdateLock);
+                migration->blocked = true;
+                // No transaction can prepare in the tablet from here on.
+                if (preparedInTablet(tableId, firstId, lastId))
+                    ClientException::throwException(HERE, STATUS_RETRY);
+                Table* table = tabletIndex.lookup(tableId, firstId);
+                if (table == NULL)
+                    throw TableDoesntExistException(HERE);
+                tableVersion = table->peekVersion();
+            }
+            while (1) {
+                {
+                    std::lock_guard<SpinLock> lock(objectUpdateLock);
+                    if (migration->dirty.empty())
+                        break;
+                    copyDirtyObjects(MIGRATION_OBJECTS_PER_LOCK);
+                }
+                if (migration->batch.getTotalLength() >= MIGRATION_BATCH_BYTES)
+                    sendMigrationBatch(target, false, 0);
+            }
+            sendMigrationBatch(target, true, tableVersion);
+
+            // The new owner now serves the tablet, so updates stay refused
+            // here until the coordinator points clients at it; they then
+            // fail with STATUS_TABLE_DOESNT_EXIST instead and are retried
+            // there.
+            if (!reassignMigratedTablet(tableId, firstId, lastId,
+                                        newOwnerId))
+                throw CouldntConnectException(HERE);
+            std::lock_guard<SpinLock> lock(objectUpdateLock);
+            ProtoBuf::Tablets newTablets;
+            foreach (const ProtoBuf::Tablets::Tablet& tablet,
+                     tablets.tablet()) {
+                if (tablet.table_id() != tableId ||
+                    tablet.start_object_id() != firstId ||
+                    tablet.end_object_id() != lastId)
+                    *newTablets.add_tablet() = tablet;
+            }
+            HashTable<LogEntryHandle>::ExclusiveLock _(objectMap);
+            setTablets(newTablets);
+        }
 
-    /// The hash table to be purged of tombstones.
-    HashTable<LogEntryHandle>& objectMap;
+        bucket = 0;
+        while (!visitObjectMapBuckets(&bucket, migrationPurgeCallback))
+            continue;
+    } catch (...) {
+        LOG(WARNING, "Migration of tablet %u [%lu, %lu] to master %lu "
+            "failed; it stays here", tableId, firstId, lastId,
+            newOwnerId.getId());
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        migration.destroy();
+        throw;
+    }
 
-    DISALLOW_COPY_AND_ASSIGN(RemoveTombstonePoller);
-};
+    std::lock_guard<SpinLock> lock(objectUpdateLock);
+    migration.destroy();
+    ++metrics->master.migrationCount;
+    LOG(NOTICE, "Migrated tablet %u [%lu, %lu] to master %lu",
+        tableId, firstId, lastId, newOwnerId.getId());
+    return STATUS_OK;
+}
 
 /**
- * Remove leftover tombstones in the hash table added during recovery.
- * This method exists independently for testing purposes.
+ * Have the coordinator point a migrated tablet at its new owner, once the
+ * new owner has marked its copy NORMAL. From then on the tablet must not
+ * be served here again, so failures are retried, since reassignment is
+ * idempotent, until the coordinator's tablet map names someone else. The
+ * only way out is for the new owner to crash while the map still names
+ * this master: its copy is then gone, and no client was ever sent to it.
+ * Helper for migrateTablet().
+ *
+ * \param tableId
+ *      The table containing the tablet.
+ * \param firstId
+ *      Identifier of the first object in the tablet.
+ * \param lastId
+ *      Identifier of the last object in the tablet.
+ * \param newOwnerId
+ *      The master the tablet was migrated to.
+ * \return
+ *      True if the tablet no longer belongs here, false if the new owner
+ *      crashed first and the tablet should stay.
+ */
+bool
+MasterService::reassignMigratedTablet(uint32_t tableId, uint64_t firstId,
+                                      uint64_t lastId, ServerId newOwnerId)
+{
+    while (1) {
+        try {
+            coordinator->reassignTabletOwnership(tableId, firstId, lastId,
+                                                 newOwnerId);
+            return true;
+        } catch (ClientException& e) {
+            LOG(WARNING, "Couldn't reassign tablet %u [%lu, %lu] to master "
+                "%lu: %s", tableId, firstId, lastId, newOwnerId.getId(),
+                e.str().c_str());
+        } catch (Exception& e) {
+            LOG(WARNING, "Couldn't reassign tablet %u [%lu, %lu] to master "
+                "%lu: %s", tableId, firstId, lastId, newOwnerId.getId(),
+                e.str().c_str());
+        }
+
+        // The coordinator may have made the change and lost the reply.
+        try {
+            ProtoBuf::Tablets tabletMap;
+            coordinator->getTabletMap(tabletMap);
+            bool ownedHere = false;
+            foreach (const ProtoBuf::Tablets::Tablet& tablet,
+                     tabletMap.tablet()) {
+                if (tablet.table_id() == tableId &&
+                    tablet.start_object_id() == firstId &&
+                    tablet.end_object_id() == lastId &&
+                    tablet.server_id() == serverId.getId())
+                    ownedHere = true;
+            }
+            if (!ownedHere)
+                return true;
+            if (!serverList.contains(newOwnerId))
+                return false;
+        } catch (ClientException& e) {
+            // Just try again.
+        } catch (Exception& e) {
+            // Just try again.
+        }
+        usleep(MIGRATION_REASSIGN_RETRY_USEC);
+    }
+}
+
+/**
+ * Top-level server method to handle the MULTIREAD request.
+ *
+ * \copydetails Service::ping
  */
 void
-MasterService::removeTombstones()
+MasterService::multiRead(const MultiReadRpc::Request& reqHdr,
+                         MultiReadRpc::Response& respHdr,
+                         Rpc& rpc)
 {
-    CycleCounter<RawMetric> _(&metrics->master.removeTombstoneTicks);
-#if TESTING
-    // Asynchronous tombstone removal raises hell in unit tests.
-    objectMap.forEach(recoveryCleanup, this);
-#else
-    Dispatch::Lock lock;
-    new RemoveTombstonePoller(*this, objectMap);
-#endif
+    uint32_t numRequests = reqHdr.count;
+    uint32_t reqOffset = downCast<uint32_t>(sizeof(reqHdr));
+
+    respHdr.count = numRequests;
+
+    // Set once the reply has as many objects as it can carry.
+    bool replyFull = false;
+    uint32_t numObjectsReturned = 0;
+
+    // Each iteration extracts a batch of requests from request rpc, looks
+    // up all of their objects at once, and appends a response for each
+    // object to the response rpc.
+    uint64_t tableIds[LOOKUP_BATCH_SIZE];
+    uint64_t objectIds[LOOKUP_BATCH_SIZE];
+    KeyMatcher matchers[LOOKUP_BATCH_SIZE];
+    LogEntryHandle handles[LOOKUP_BATCH_SIZE];
+    for (uint32_t first = 0; first < numRequests;
+         first += LOOKUP_BATCH_SIZE) {
+        uint32_t batchSize = numRequests - first;
+        if (batchSize > LOOKUP_BATCH_SIZE)
+            batchSize = LOOKUP_BATCH_SIZE;
+        for (uint32_t i = 0; i < batchSize; i++) {
+            const MultiReadRpc::Request::Part *currentReq =
+                  rpc.requestPayload.getOffset<MultiReadRpc::Request::Part>(
+                  reqOffset);
+            if (currentReq == NULL)
+                throw MessageTooShortError(HERE);
+            reqOffset += downCast<uint32_t>(
+                                sizeof(MultiReadRpc::Request::Part));
+            tableIds[i] = currentReq->tableId;
+            objectIds[i] = currentReq->id;
+            // The key stays in the request until the reply is sent.
+            const void* key = rpc.requestPayload.getRange(
+                                    reqOffset, currentReq->keyLength);
+            if (key == NULL && currentReq->keyLength != 0)
+                throw MessageTooShortError(HERE);
+            matchers[i] = KeyMatcher(key, currentReq->keyLength);
+            reqOffset += currentReq->keyLength;
+        }
+
+        // See read() for why no lock is needed.
+        EpochManager::ReadGuard _;
+        if (!replyFull)
+            objectMap.lockFreeLookupBatch(batchSize, tableIds, objectIds,
+                                          matchers, handles);
+
+        for (uint32_t i = 0; i < batchSize; i++) {
+            Status* status = new(&rpc.replyPayload, APPEND) Status(STATUS_OK);
+            if (replyFull) {
+                *status = STATUS_RETRY;
+                continue;
+            }
+            // We must note the status if the table does not exist. Also, we
+            // might have an entry in the hash table that's invalid because
+            // its tablet no longer lives here.
+            uint32_t tableId = downCast<uint32_t>(tableIds[i]);
+            bool normal;
+            if (getTable(tableId, objectIds[i], &normal) == NULL) {
+                *status = STATUS_TABLE_DOESNT_EXIST;
+                continue;
+            }
+            if (!normal) {
+                *status = STATUS_RETRY;
+                continue;
+            }
+            LogEntryHandle handle = handles[i];
+            if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ ||
+                handle->userData<Object>()->isExpired()) {
+                 // The tablet may have been migrated away and its objects
+                 // purged since we checked.
+                 *status = (getTable(tableId, objectIds[i]) == NULL)
+                                ? STATUS_TABLE_DOESNT_EXIST
+                                : STATUS_OBJECT_DOESNT_EXIST;
+                 continue;
+            }
+
+            // Always return at least one object, so that the client makes
+            // progress however large the objects are.
+            uint32_t entryLength = downCast<uint32_t>(sizeof(SegmentEntry)) +
+                                   handle->length();
+            if (numObjectsReturned > 0 &&
+                    uint64_t(rpc.replyPayload.getTotalLength()) +
+                    entryLength > maxMultiReadReplyBytes) {
+                *status = STATUS_RETRY;
+                replyFull = true;
+                continue;
+            }
+
+            const SegmentEntry* entry = reinterpret_cast<
+                                        const SegmentEntry*>(handle);
+            Log::PinnedChunk::appendToBuffer(&rpc.replyPayload, log,
+                                             entry, entryLength);
+            numObjectsReturned++;
+        }
+    }
 }
 
-namespace MasterServiceInternal {
 /**
- * Each object of this class is responsible for fetching recovery data
- * for a single segment from a single backup.
+ * Top-level server method to handle the MULTI_REMOVE request.
+ * All of the tombstones are appended to the log together and synced to
+ * backups once before the response is sent.
+ *
+ * \copydetails Service::ping
  */
-class RecoveryTask {
-  PUBLIC:
-    RecoveryTask(ServerList& serverList,
-                 ServerId masterId,
-                 uint64_t partitionId,
-                 MasterService::Replica& replica)
-        : serverList(serverList)
-        , masterId(masterId)
-        , partitionId(partitionId)
-        , replica(replica)
-        , response()
-        , client(serverList.getSession(replica.backupId))
-        , startTime(Cycles::rdtsc())
-        , rpc()
-        , resendTime(0)
-    {
-        rpc.construct(client, masterId, replica.segmentId,
-                      partitionId, response);
+void
+MasterService::multiRemove(const MultiRemoveRpc::Request& reqHdr,
+                           MultiRemoveRpc::Response& respHdr,
+                           Rpc& rpc)
+{
+    uint32_t numRequests = reqHdr.count;
+    uint32_t reqOffset = downCast<uint32_t>(sizeof(reqHdr));
+    uint32_t partLength = downCast<uint32_t>(
+                                sizeof(MultiRemoveRpc::Request::Part));
+
+    if (reqOffset + uint64_t(numRequests) * partLength >
+            rpc.requestPayload.getTotalLength()) {
+        respHdr.common.status = STATUS_MESSAGE_TOO_SHORT;
+        return;
     }
-    ~RecoveryTask()
-    {
-        if (rpc && !rpc->isReady()) {
-            LOG(WARNING, "Task destroyed while RPC active: segment %lu, "
-                    "server %s", replica.segmentId,
-                    serverList.toString(replica.backupId).c_str());
+
+    respHdr.count = numRequests;
+    LogBatch batch(*this, numRequests);
+
+    // Each iteration stages the removal of one object and appends its
+    // result to the response; the results are filled in by the batch.
+    for (uint32_t i = 0; i < numRequests; i++) {
+        const MultiRemoveRpc::Request::Part *currentReq =
+              rpc.requestPayload.getOffset<MultiRemoveRpc::Request::Part>(
+              reqOffset);
+        reqOffset += partLength;
+
+        MultiRemoveRpc::Response::Part* result =
+            new(&rpc.replyPayload, APPEND) MultiRemoveRpc::Response::Part(
+                STATUS_OK, VERSION_NONEXISTENT);
+        batch.remove(currentReq->tableId, currentReq->id,
+                     currentReq->rejectRules,
+                     &result->status, &result->version);
+    }
+    batch.flush(true);
+}
+
+/**
+ * Top-level server method to handle the MULTI_WRITE request.
+ * All of the objects are appended to the log together (see LogBatch) and
+ * synced to backups once before the response is sent.
+ *
+ * \copydetails Service::ping
+ */
+void
+MasterService::multiWrite(const MultiWriteRpc::Request& reqHdr,
+                          MultiWriteRpc::Response& respHdr,
+                          Rpc& rpc)
+{
+    uint32_t numRequests = reqHdr.count;
+    uint32_t reqOffset = downCast<uint32_t>(sizeof(reqHdr));
+    uint32_t partLength = downCast<uint32_t>(
+                                sizeof(MultiWriteRpc::Request::Part));
+
+    // Validate the whole request before changing anything, so that a
+    // malformed request has no effect at all.
+    for (uint32_t i = 0; i < numRequests; i++) {
+        const MultiWriteRpc::Request::Part *currentReq =
+              rpc.requestPayload.getOffset<MultiWriteRpc::Request::Part>(
+              reqOffset);
+        if (currentReq == NULL ||
+                uint64_t(reqOffset) + partLength + currentReq->length >
+                rpc.requestPayload.getTotalLength()) {
+            respHdr.common.status = STATUS_MESSAGE_TOO_SHORT;
+            return;
         }
+        reqOffset += partLength + currentReq->length;
     }
-    void resend() {
-        LOG(DEBUG, "Resend %lu", replica.segmentId);
-        response.reset();
-        rpc.construct(client, masterId, replica.segmentId,
-                      partitionId, response);
+
+    respHdr.count = numRequests;
+    reqOffset = downCast<uint32_t>(sizeof(reqHdr));
+    LogBatch batch(*this, numRequests);
+
+    // Each iteration stages one object and appends its result to the
+    // response; the results are filled in by the batch.
+    for (uint32_t i = 0; i < numRequests; i++) {
+        const MultiWriteRpc::Request::Part *currentReq =
+              rpc.requestPayload.getOffset<MultiWriteRpc::Request::Part>(
+              reqOffset);
+        reqOffset += partLength;
+
+        MultiWriteRpc::Response::Part* result =
+            new(&rpc.replyPayload, APPEND) MultiWriteRpc::Response::Part(
+                STATUS_OK, VERSION_NONEXISTENT);
+        batch.write(currentReq->tableId, currentReq->id,
+                    currentReq->rejectRules, &rpc.requestPayload,
+                    reqOffset, currentReq->length,
+                    &result->status, &result->version);
+        reqOffset += currentReq->length;
     }
-    ServerList& serverList;
-    ServerId masterId;
-    uint64_t partitionId;
-    MasterService::Replica& replica;
-    Buffer response;
-    BackupClient client;
-    const uint64_t startTime;
-    Tub<BackupClient::GetRecoveryData> rpc;
-    /// If we have to retry a request, this variable indicates the rdtsc time at
-    /// which we should retry.  0 means we're not waiting for a retry.
-    uint64_t resendTime;
-    DISALLOW_COPY_AND_ASSIGN(RecoveryTask);
-};
-} // namespace MasterServiceInternal
-using namespace MasterServiceInternal; // NOLINT
+    batch.flush(true);
+}
 
 /**
- * Look through \a backups and ensure that for each segment id that appears
- * in the list that at least one copy of that segment was replayed.
+ * Top-level server method to handle the PREP_FOR_MIGRATION request, which
+ * the current owner of a tablet sends before migrating it here (see
+ * migrateTablet()). The tablet is added in the RECOVERING state; it is
+ * only served once the coordinator has been told this master owns it.
  *
- * \param masterId
- *      The id of the crashed master this recovery master is recovering for.
- *      Only used for logging detailed log information on failure.
- * \param partitionId
- *      The id of the partition of the crashed master this recovery master is
- *      recovering. Only used for logging detailed log information on failure.
- * \param replicas
- *      The list of replicas and their statuses to be checked to ensure
- *      recovery of this partition was successful.
- * \throw SegmentRecoveryFailedException
- *      If some segment was not recovered and the recovery master is not
- *      a valid replacement for the crashed master.
+ * \copydetails Service::ping
  */
 void
-MasterService::detectSegmentRecoveryFailure(
-            const ServerId masterId,
-            const uint64_t partitionId,
-            const vector<MasterService::Replica>& replicas)
+MasterService::prepForMigration(const PrepForMigrationRpc::Request& reqHdr,
+                                PrepForMigrationRpc::Response& respHdr,
+                                Rpc& rpc)
 {
-    std::unordered_set<uint64_t> failures;
-    foreach (const auto& replica, replicas) {
-        switch (replica.state) {
-        case MasterService::Replica::State::OK:
-            failures.erase(replica.segmentId);
-            break;
-        case MasterService::Replica::State::FAILED:
-            failures.insert(replica.segmentId);
-            break;
-        case MasterService::Replica::State::WAITING:
-        case MasterService::Replica::State::NOT_STARTED:
-        default:
-            assert(false);
-            break;
-        }
+    uint32_t tableId = reqHdr.tableId;
+    uint64_t firstId = reqHdr.firstId;
+    uint64_t lastId = reqHdr.lastId;
+
+    if (migration) {
+        // Too tangled to accept a tablet while sending one away.
+        respHdr.common.status = STATUS_RETRY;
+        return;
     }
-    if (!failures.empty()) {
-        LOG(ERROR, "Recovery master failed to recover master %lu "
-            "partition %lu", *masterId, partitionId);
-        foreach (auto segmentId, failures)
-            LOG(ERROR, "Unable to recover segment %lu", segmentId);
-        throw SegmentRecoveryFailedException(HERE);
+
+    foreach (const ProtoBuf::Tablets::Tablet& tablet, tablets.tablet()) {
+        if (tablet.table_id() != tableId ||
+            tablet.end_object_id() < firstId ||
+            tablet.start_object_id() > lastId)
+            continue;
+        // A failed migration of the same tablet leaves it behind; whatever
+        // it received is superseded by what is sent this time.
+        if (tablet.start_object_id() == firstId &&
+            tablet.end_object_id() == lastId &&
+            tablet.state() == ProtoBuf::Tablets::Tablet::RECOVERING)
+            return;
+        LOG(WARNING, "Can't migrate tablet %u [%lu, %lu] from master %lu: "
+            "it overlaps tablet [%lu, %lu] here", tableId, firstId, lastId,
+            reqHdr.sourceMasterId, tablet.start_object_id(),
+            tablet.end_object_id());
+        throw RequestFormatError(HERE);
     }
+
+    ProtoBuf::Tablets newTablets(tablets);
+    ProtoBuf::Tablets::Tablet& tablet(*newTablets.add_tablet());
+    tablet.set_table_id(tableId);
+    tablet.set_start_object_id(firstId);
+    tablet.set_end_object_id(lastId);
+    tablet.set_state(ProtoBuf::Tablets::Tablet::RECOVERING);
+    tablet.set_server_id(serverId.getId());
+    tablet.set_service_locator(config.localLocator);
+    setTablets(newTablets);
+    LOG(NOTICE, "Receiving tablet %u [%lu, %lu] from master %lu",
+        tableId, firstId, lastId, reqHdr.sourceMasterId);
 }
 
 /**
- * Helper for public recover() method.
- * Collect all the filtered log segments from backups for a set of tablets
- * formerly belonging to a crashed master which is being recovered and pass
- * them to the recovery master to have them replayed.
+ * Top-level server method to handle the PREPARE_TRANSACTION request, the
+ * first phase of a transaction spanning several masters. The reject rules
+ * of this master's share of the transaction are checked; if they all pass,
+ * the operations are logged as TransactionIntents and their objects are
+ * locked against other updates until the transaction is decided. A yes
+ * vote binds this master: it never aborts the transaction on its own. If
+ * the matching DECIDE_TRANSACTION hasn't arrived once the prepare's lease
+ * (PrepareTransactionRpc::LEASE_NS) runs out, the coordinator is asked for
+ * the outcome instead (see resolveTransactions()). The intents are replayed
+ * by recovery, so whoever takes over this master's tablets after a crash
+ * holds the transaction prepared too.
  *
- * \param masterId
- *      The id of the crashed master for which recoveryMaster will be taking
- *      over ownership of tablets.
- * \param partitionId
- *      The partition id of tablets inside the crashed master's will that
- *      this master is recovering.
- * \param replicas
- *      A list specifying for each segmentId a backup who can provide a
- *      filtered recovery data segment. A particular segment may be listed more
- *      than once if it has multiple viable backups.
- * \throw SegmentRecoveryFailedException
- *      If some segment was not recovered and the recovery master is not
- *      a valid replacement for the crashed master.
+ * \copydetails Service::ping
  */
 void
-MasterService::recover(ServerId masterId,
-                       uint64_t partitionId,
-                       vector<Replica>& replicas)
+MasterService::prepareTransaction(const PrepareTransactionRpc::Request& reqHdr,
+                                  PrepareTransactionRpc::Response& respHdr,
+                                  Rpc& rpc)
 {
-    /* Overview of the internals of this method and its structures.
-     *
-     * The main data structure is "replicas".  It works like a
-     * scoreboard, tracking which segments have requests to backup
-     * servers in-flight for data, which have been replayed, and
-     * which have failed and must be replayed by another entry in
-     * the table.
-     *
-     * replicasEnd is an iterator to the end of the segment replica list
-     * which aids in tracking when the function is out of work.
-     *
-     * notStarted tracks the furtherest entry into the list which
-     * has not been requested from a backup yet (State::NOT_STARTED).
-     *
-     * Here is a sample of what the structure might look like
-     * during execution:
-     *
-     * backupId     segmentId  state
-     * --------     ---------  -----
-     *   8            99       OK
-     *   3            88       FAILED
-     *   1            77       OK
-     *   2            77       OK
+    // The client retried a PREPARE_TRANSACTION that succeeded.
+    if (preparedTransactions.count(reqHdr.transactionId) != 0)
+        return;
+
+    uint32_t count = reqHdr.count;
+    uint32_t offset = downCast<uint32_t>(sizeof(reqHdr));
+    Status status = checkTransaction(rpc.requestPayload, offset, count,
+                                     &respHdr.rejectedPart);
+    if (status != STATUS_OK) {
+        respHdr.common.status = status;
+        return;
+    }
+
+    // Staging checks every reject rule without changing anything.
+    LogBatch batch(*this, count, true);
+    std::unique_ptr<Status[]> statuses(new Status[count]);
+    std::unique_ptr<uint64_t[]> versions(new uint64_t[count]);
+    status = stageTransaction(rpc.requestPayload, offset, count, batch,
+                              statuses.get(), versions.get(),
+                              &respHdr.rejectedPart,
+                              &respHdr.rejectedVersion);
+    batch.discard();
+    if (status != STATUS_OK) {
+        respHdr.common.status = status;
+        return;
+    }
+
+    std::unique_ptr<PreparedTransaction> prepared(new PreparedTransaction());
+    prepared->count = count;
+    prepared->expiryTime = Cycles::rdtsc() +
+        Cycles::fromNanoseconds(PrepareTransactionRpc::LEASE_NS);
+    uint32_t length = rpc.requestPayload.getTotalLength() - offset;
+    if (length != 0) {
+        rpc.requestPayload.copy(offset, length,
+                                new(&prepared->parts, APPEND) char[length]);
+    }
+
+    // The vote must be durable before it is sent.
+    try {
+        logTransactionIntents(reqHdr.transactionId, *prepared, 0, count);
+    } catch (LogOutOfMemoryException& e) {
+        // The log is out of space; vote no, as for a locked object.
+        respHdr.common.status = STATUS_RETRY;
+        return;
+    }
+    logSyncPending = true;
+    lockTransaction(prepared->parts, count, true);
+    preparedTransactions[reqHdr.transactionId] = std::move(prepared);
+}
+
+/**
+ * Top-level server method to handle the READ request.
+ * \copydetails create
+ */
+void
+MasterService::read(const ReadRpc::Request& reqHdr,
+                   ReadRpc::Response& respHdr,
+                   Rpc& rpc)
+{
+    // Writers and the cleaner may change this object's hash table entry
+    // while we look at it, but the read guard keeps both the hash table's
+    // cache lines and the segment holding whatever version we find from
+    // being freed. Once the object's data has been appended to the reply,
+    // it stays valid until the reply is sent (see Log::PinnedChunk).
+    EpochManager::ReadGuard _;
+
+    // We must return table doesn't exist if the table does not exist. Also, we
+    // might have an entry in the hash table that's invalid because its tablet
+    // no longer lives here. Tablets still being filled here can't be
+    // read yet.
+    bool normal;
+    if (getTable(reqHdr.tableId, reqHdr.id, &normal) == NULL) {
+        respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
+        return;
+    }
+    if (!normal) {
+        respHdr.common.status = STATUS_RETRY;
+        return;
+    }
+
+    const void* key = NULL;
+    if (reqHdr.keyLength != 0) {
+        key = rpc.requestPayload.getRange(sizeof(reqHdr), reqHdr.keyLength);
+        if (key == NULL) {
+            respHdr.common.status = STATUS_MESSAGE_TOO_SHORT;
+            return;
+        }
+    }
+
+    // The hash table only follows an entry into the log once the entry's
+    // fingerprint (secondary hash bits) matches the id; the full key is
+    // only compared once the ids match.
+    LogEntryHandle handle = objectMap.lockFreeLookup(reqHdr.tableId,
+                                reqHdr.id, KeyMatcher(key, reqHdr.keyLength));
+    if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ ||
+        handle->userData<Object>()->isExpired()) {
+        // The tablet may have been migrated away and its objects purged
+        // since we checked.
+        if (getTable(reqHdr.tableId, reqHdr.id) == NULL)
+            respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
+        else
+            respHdr.common.status = STATUS_OBJECT_DOESNT_EXIST;
+        return;
+    }
+
+    const Object* obj = handle->userData<Object>();
+    respHdr.version = obj->version;
+    Status status = rejectOperation(reqHdr.rejectRules, obj->version);
+    if (status != STATUS_OK) {
+        respHdr.common.status = status;
+        return;
+    }
+    // The chunk pins the object's segment, so the cleaner won't reuse it
+    // until the reply has been transmitted.
+    Log::PinnedChunk::appendToBuffer(&rpc.replyPayload, log,
+        obj->value(), obj->valueLength(handle->length()));
+    respHdr.length = obj->valueLength(handle->length());
+}
+
+/**
+ * Top-level server method to handle the RECEIVE_MIGRATION_DATA request,
+ * which carries a batch of log entries for a tablet being migrated here
+ * (see migrateTablet()). The entries are replayed as during recovery, so
+ * objects sent more than once simply keep their latest version.
+ *
+ * \copydetails Service::ping
+ */
+void
+MasterService::receiveMigrationData(
+    const ReceiveMigrationDataRpc::Request& reqHdr,
+    ReceiveMigrationDataRpc::Response& respHdr,
+    Rpc& rpc)
+{
+    Table* table = tabletIndex.lookup(reqHdr.tableId, reqHdr.firstId);
+    if (table == NULL) {
+        respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
+        return;
+    }
+
+    if (reqHdr.segmentLength > 0) {
+        const void* segment = rpc.requestPayload.getRange(sizeof(reqHdr),
+                                                          reqHdr.segmentLength);
+        if (segment == NULL)
+            throw MessageTooShortError(HERE);
+        recoverSegment(0, segment, reqHdr.segmentLength);
+    }
+
+    if (!reqHdr.done)
+        return;
+
+    // Objects removed here before the migration must keep losing to
+    // whatever is written next, so carry on from the old owner's clock.
+    table->RaiseVersion(reqHdr.tableVersion);
+    // Everything received must be durable before the old owner lets go,
+    // but don't wait for backups holding the locks (see dispatch()).
+    logSyncPending = true;
+    removeTombstones();
+    ProtoBuf::Tablets received;
+    ProtoBuf::Tablets::Tablet& tablet(*received.add_tablet());
+    tablet.set_table_id(reqHdr.tableId);
+    tablet.set_start_object_id(reqHdr.firstId);
+    tablet.set_end_object_id(reqHdr.lastId);
+    tablet.set_state(ProtoBuf::Tablets::Tablet::NORMAL);
+    markTabletsNormal(received);
+    LOG(NOTICE, "Received tablet %u [%lu, %lu]",
+        reqHdr.tableId, reqHdr.firstId, reqHdr.lastId);
+}
+
+/**
+ * Callback used to purge the tombstones from the hash table. Invoked by
+ * HashTable::forEach.
+ */
+void
+recoveryCleanup(LogEntryHandle maybeTomb, void *cookie)
+{
+    if (maybeTomb->type() == LOG_ENTRY_TYPE_OBJTOMB) {
+        const ObjectTombstone *tomb = maybeTomb->userData<ObjectTombstone>();
+        MasterService *server = reinterpret_cast<MasterService*>(cookie);
+        bool r = server->objectMap.remove(tomb->id.tableId, tomb->id.objectId,
+                                          SameReferent(maybeTomb));
+        assert(r);
+        ++metrics->master.tombstoneReapCount;
+        // Tombstones are not explicitly freed in the log. The cleaner will
+        // figure out that they're dead.
+    }
+}
+
+/**
+ * Construct an idle TombstoneReaper; see start().
+ *
+ * \param service
+ *      The MasterService whose #objectMap is to be swept.
+ */
+MasterService::TombstoneReaper::TombstoneReaper(MasterService& service)
+    : Dispatch::Poller(*Context::get().dispatch)
+    , service(service)
+    , nextBucket(0)
+    , running(false)
+{
+}
+
+/**
+ * Remove the tombstones from the next #TOMBSTONE_REAP_BUCKETS_PER_POLL
+ * buckets of #objectMap, if a sweep is in progress.
+ */
+void
+MasterService::TombstoneReaper::poll()
+{
+    if (!running)
+        return;
+
+    // This method runs in the dispatch thread. Workers hold
+    // #objectUpdateLock while they wait for backups, which needs this
+    // thread, so never wait for the lock here: try again next time.
+    if (!service.objectUpdateLock.try_lock())
+        return;
+    std::lock_guard<SpinLock> updateLock(service.objectUpdateLock,
+                                         std::adopt_lock);
+    // A sweep that was under way when a restart began waits for it; see
+    // MasterService::replayingRestart.
+    if (service.replayingRestart)
+        return;
+    CycleCounter<RawMetric> _(&metrics->master.tombstoneReapTicks);
+
+    HashTable<LogEntryHandle>& objectMap = service.objectMap;
+    for (uint64_t i = 0; i < TOMBSTONE_REAP_BUCKETS_PER_POLL; i++) {
+        if (nextBucket >= objectMap.getNumBuckets())
+            break;
+        std::lock_guard<SpinLock> bucketLock(
+            objectMap.getBucketLockByIndex(nextBucket));
+        objectMap.forEachInBucket(recoveryCleanup, &service, nextBucket);
+        ++nextBucket;
+        ++metrics->master.tombstoneReapBuckets;
+    }
+
+    uint64_t numBuckets = objectMap.getNumBuckets();
+    if (nextBucket < numBuckets) {
+        metrics->master.tombstoneReapPendingBuckets = numBuckets - nextBucket;
+        return;
+    }
+    metrics->master.tombstoneReapPendingBuckets = 0;
+    ++metrics->master.tombstoneReapSweeps;
+    running = false;
+    LOG(NOTICE, "Cleanup of tombstones complete");
+}
+
+/**
+ * Begin a sweep of the whole of #objectMap. A sweep already in progress
+ * starts over, since the tombstones it has passed may have been added
+ * behind it.
+ */
+void
+MasterService::TombstoneReaper::start()
+{
+    LOG(NOTICE, "Starting cleanup of tombstones in background");
+    nextBucket = 0;
+    running = true;
+    metrics->master.tombstoneReapPendingBuckets =
+        service.objectMap.getNumBuckets();
+}
+
+/**
+ * Remove leftover tombstones in the hash table added during recovery.
+ * This only starts the #tombstoneReaper, which does the work in the
+ * background; the master serves requests meanwhile, and the tombstones
+ * still present keep answering that their objects don't exist. While a
+ * restart is replaying (see #replayingRestart) this does nothing; restart()
+ * calls it again once the replay is over.
+ */
+void
+MasterService::removeTombstones()
+{
+    if (replayingRestart)
+        return;
+    CycleCounter<RawMetric> _(&metrics->master.removeTombstoneTicks);
+#if TESTING
+    // Asynchronous tombstone removal raises hell in unit tests.
+    objectMap.forEach(recoveryCleanup, this);
+#else
+    Dispatch::Lock lock;
+    if (!tombstoneReaper)
+        tombstoneReaper.construct(*this);
+    tombstoneReaper->start();
+#endif
+}
+
+/**
+ * Entry point for the thread that grows #objectMap. This is invoked via
+ * the std::thread() constructor and runs until the MasterService is
+ * destroyed.
+ */
+void
+MasterService::objectMapResizerEntry(MasterService* service, Context* context)
+{
+    Context::Guard _(*context);
+    LOG(NOTICE, "HashTable resizer thread spun up");
+
+    while (1) {
+        Fence::lfence();
+        if (service->objectMapResizerShouldExit)
+            break;
+        if (!service->resizeObjectMap())
+            usleep(OBJECT_MAP_RESIZER_POLL_USEC);
+    }
+}
+
+/**
+ * Perform one step of growing #objectMap: either start a resize if the
+ * table has become too full, or migrate a small batch of buckets if a
+ * resize is in progress, or make the new buckets current once they have
+ * all moved. Buckets are migrated under their own bucket locks, so
+ * lock-free reads proceed in the meantime. Each batch, and the final swap,
+ * also holds #objectUpdateLock, since updates, the cleaner's callbacks,
+ * and migration look keys up holding only that lock and must not see a
+ * key half way between the old and new bucket arrays.
+ *
+ * \return
+ *      True if there was work to do, false if the table needs no attention.
+ */
+bool
+MasterService::resizeObjectMap()
+{
+    if (objectMap.isResizing()) {
+        CycleCounter<RawMetric> _(&metrics->master.hashTableResizeTicks);
+        {
+            std::lock_guard<SpinLock> lock(objectUpdateLock);
+            if (objectMap.moveBuckets(OBJECT_MAP_REHASH_BATCH) > 0)
+                return true;
+        }
+        // Every bucket has moved. Waiting for lock-free readers to leave
+        // the old bucket array may take as long as the longest read (an
+        // enumeration, say), so don't hold up updates for it; only the
+        // swap itself needs them kept out.
+        objectMap.prepareToSwapBuckets();
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        objectMap.swapBuckets();
+        return true;
+    }
+
+    // Unmap the buckets retired by the last resize, if any, and publish
+    // the table's shape.
+    objectMap.releaseRetiredBuckets();
+    metrics->master.hashTableBuckets = objectMap.getNumBuckets();
+    metrics->master.hashTableEntries = objectMap.getNumEntries();
+    metrics->master.hashTableOverflowLines =
+        objectMap.getNumOverflowCacheLines();
+
+    if (objectMap.getLoadFactor() * 100 <=
+            static_cast<double>(MAX_OBJECT_MAP_LOAD_PERCENT))
+        return false;
+
+    // Allocating the new buckets may take a while, so don't hold up updates
+    // for it: no key moves until the first call to rehash().
+    try {
+        objectMap.startResize(2 * objectMap.getNumBuckets());
+    } catch (FatalError& e) {
+        LOG(WARNING, "Could not grow HashTable (%s); will not try again",
+            e.str().c_str());
+        objectMapResizerShouldExit = true;
+        return false;
+    }
+    ++metrics->master.hashTableResizes;
+    return true;
+}
+
+/**
+ * Entry point for the thread that splits tablets once they grow too large.
+ * This is invoked via the std::thread() constructor and runs until the
+ * MasterService is destroyed.
+ */
+void
+MasterService::tabletSplitterEntry(MasterService* service, Context* context)
+{
+    Context::Guard _(*context);
+    LOG(NOTICE, "Tablet splitter thread spun up");
+
+    while (1) {
+        Fence::lfence();
+        if (service->tabletSplitterShouldExit)
+            break;
+        bool split = false;
+        try {
+            split = service->splitTablets();
+        } catch (ClientException& e) {
+            LOG(WARNING, "Couldn't split tablet: %s", e.str().c_str());
+        } catch (Exception& e) {
+            LOG(WARNING, "Couldn't split tablet: %s", e.str().c_str());
+        }
+        if (!split)
+            usleep(TABLET_SPLITTER_POLL_USEC);
+    }
+}
+
+/**
+ * Entry point for the thread started by startRestart(). This is invoked
+ * via the std::thread() constructor and exits once the former log has
+ * been replayed. If that fails, restart() has already handed the tablets
+ * back to the coordinator, so all that's left is to log why.
+ */
+void
+MasterService::restarterEntry(MasterService* service, Context* context,
+                              ServerId formerId, BackupService* backup,
+                              vector<uint64_t> segmentIds)
+{
+    Context::Guard _(*context);
+    try {
+        service->restart(formerId, *backup, segmentIds);
+    } catch (ClientException& e) {
+        LOG(ERROR, "Couldn't reload the log of former server %lu: %s",
+            formerId.getId(), e.str().c_str());
+    } catch (Exception& e) {
+        LOG(ERROR, "Couldn't reload the log of former server %lu: %s",
+            formerId.getId(), e.str().c_str());
+    }
+}
+
+/**
+ * Decide whether a tablet has grown large enough to split, according to
+ * its table's TabletProfiler, and if so where.
+ *
+ * \param tablet
+ *      The tablet to check. The caller must hold #objectUpdateLock.
+ * \param maxBytes
+ *      Split the tablet if it holds more than this many bytes of objects.
+ * \param maxReferents
+ *      Split the tablet if it holds more than this many objects.
+ * \param[out] splitId
+ *      Set to the first object id of the upper half if the tablet should
+ *      be split.
+ * \return
+ *      Whether the tablet is too large and a split point inside it could
+ *      be found.
+ */
+bool
+MasterService::findTabletSplit(const ProtoBuf::Tablets::Tablet& tablet,
+                               uint64_t maxBytes, uint64_t maxReferents,
+                               uint64_t* splitId)
+{
+    uint64_t firstId = tablet.start_object_id();
+    uint64_t lastId = tablet.end_object_id();
+
+    // The profiler covers the table's whole key space, so only count the
+    // partitions overlapping this tablet (which may overestimate a little).
+    // Asking for half-sized partitions yields split points near the middle
+    // of a tablet that has only just grown too large.
+    Table* table = reinterpret_cast<Table*>(tablet.user_data());
+    std::unique_ptr<PartitionList> partitions(
+        table->profiler.getPartitions(maxBytes / 2, maxReferents / 2, 0, 0));
+    uint64_t bytes = 0;
+    uint64_t referents = 0;
+    foreach (const Partition& partition, *partitions) {
+        if (partition.lastKey < firstId || partition.firstKey > lastId)
+            continue;
+        bytes += partition.maxBytes;
+        referents += partition.maxReferents;
+    }
+    if (bytes <= maxBytes && referents <= maxReferents)
+        return false;
+
+    // Split at the partition boundary that best halves whichever measure
+    // made the tablet too large.
+    bool byBytes = bytes > maxBytes;
+    uint64_t half = (byBytes ? bytes : referents) / 2;
+    uint64_t lower = 0;
+    uint64_t bestDistance = ~0UL;
+    foreach (const Partition& partition, *partitions) {
+        if (partition.lastKey < firstId || partition.firstKey > lastId)
+            continue;
+        if (partition.lastKey >= lastId)
+            break;
+        lower += byBytes ? partition.maxBytes : partition.maxReferents;
+        uint64_t distance = (lower > half) ? lower - half : half - lower;
+        if (distance < bestDistance) {
+            *splitId = partition.lastKey + 1;
+            bestDistance = distance;
+        }
+    }
+    return bestDistance != ~0UL;
+}
+
+/**
+ * Choose the master that the upper half of a split tablet should move to:
+ * the one serving the fewest tablets other than this one.
+ *
+ * \return
+ *      The chosen master, or an invalid ServerId if there are no others.
+ */
+ServerId
+MasterService::pickMigrationTarget()
+{
+    ProtoBuf::ServerList masters;
+    coordinator->getMasterList(masters);
+    ProtoBuf::Tablets tabletMap;
+    coordinator->getTabletMap(tabletMap);
+
+    std::map<uint64_t, uint32_t> tabletCounts;
+    foreach (const ProtoBuf::ServerList::Entry& master, masters.server()) {
+        ServerId id(master.server_id());
+        if (id != serverId && serverList.contains(id))
+            tabletCounts[master.server_id()] = 0;
+    }
+    foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
+        auto it = tabletCounts.find(tablet.server_id());
+        if (it != tabletCounts.end())
+            ++it->second;
+    }
+
+    ServerId target;
+    uint32_t fewest = ~0U;
+    foreach (auto& count, tabletCounts) {
+        if (count.second < fewest) {
+            target = ServerId(count.first);
+            fewest = count.second;
+        }
+    }
+    return target;
+}
+
+/**
+ * Split one of this master's tablets in two, both of which stay here. The
+ * coordinator's tablet map is updated first; here only #tablets changes,
+ * since the objects of both halves are already in #objectMap and the log.
+ * The will is then recomputed so that recovery partitions stay small.
+ *
+ * \param tableId
+ *      The table containing the tablet.
+ * \param firstId
+ *      Identifier of the first object in the tablet.
+ * \param lastId
+ *      Identifier of the last object in the tablet.
+ * \param splitId
+ *      Identifier of the first object in the upper half.
+ */
+void
+MasterService::splitTablet(uint32_t tableId, uint64_t firstId,
+                           uint64_t lastId, uint64_t splitId)
+{
+    coordinator->splitTablet(tableId, firstId, lastId, splitId);
+
+    ProtoBuf::Tablets will;
+    {
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        ProtoBuf::Tablets newTablets;
+        foreach (const ProtoBuf::Tablets::Tablet& tablet, tablets.tablet()) {
+            *newTablets.add_tablet() = tablet;
+            if (tablet.table_id() != tableId ||
+                tablet.start_object_id() != firstId ||
+                tablet.end_object_id() != lastId)
+                continue;
+            newTablets.mutable_tablet(newTablets.tablet_size() - 1)->
+                set_end_object_id(splitId - 1);
+            ProtoBuf::Tablets::Tablet& upper(*newTablets.add_tablet());
+            upper = tablet;
+            upper.set_start_object_id(splitId);
+        }
+        {
+            HashTable<LogEntryHandle>::ExclusiveLock _(objectMap);
+            setTablets(newTablets);
+        }
+        Will newWill(tablets, maxBytesPerPartition, maxReferentsPerPartition);
+        newWill.serialize(will);
+        ++metrics->master.tabletSplitCount;
+    }
+    coordinator->setWill(serverId.getId(), will);
+
+    LOG(NOTICE, "Split tablet %u [%lu, %lu] at %lu",
+        tableId, firstId, lastId, splitId);
+}
+
+/**
+ * Split the first tablet found to have grown too large (see
+ * findTabletSplit()) and, if ServerConfig::Master::migrateSplitTablets is
+ * set, migrate its upper half to the least loaded master.
+ *
+ * \return
+ *      True if a tablet was split, false if none needed it.
+ */
+bool
+MasterService::splitTablets()
+{
+    uint32_t tableId = 0;
+    uint64_t firstId = 0;
+    uint64_t lastId = 0;
+    uint64_t splitId = 0;
+    uint64_t maxBytes = config.master.tabletSplitBytes;
+    uint64_t maxReferents = config.master.tabletSplitReferents;
+    if (maxReferents == 0)
+        maxReferents = ~0UL;
+    bool found = false;
+    {
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        // A migration expects its tablet to keep its bounds.
+        if (migration)
+            return false;
+        foreach (const ProtoBuf::Tablets::Tablet& tablet, tablets.tablet()) {
+            if (tablet.state() != ProtoBuf::Tablets::Tablet::NORMAL)
+                continue;
+            if (findTabletSplit(tablet, maxBytes, maxReferents, &splitId)) {
+                tableId = downCast<uint32_t>(tablet.table_id());
+                firstId = tablet.start_object_id();
+                lastId = tablet.end_object_id();
+                found = true;
+                break;
+            }
+        }
+        // Keep migrations away until the tablet has its new bounds.
+        if (found)
+            splittingTablet = true;
+    }
+    if (!found)
+        return false;
+
+    try {
+        splitTablet(tableId, firstId, lastId, splitId);
+    } catch (...) {
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        splittingTablet = false;
+        throw;
+    }
+    {
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        splittingTablet = false;
+    }
+    if (config.master.migrateSplitTablets) {
+        ServerId target = pickMigrationTarget();
+        if (target.isValid())
+            migrateTablet(tableId, splitId, lastId, target);
+    }
+    return true;
+}
+
+namespace MasterServiceInternal {
+/**
+ * Each object of this class is responsible for fetching recovery data
+ * for a single segment from a single backup.
+ */
+class RecoveryTask {
+  PUBLIC:
+    RecoveryTask(ServerList& serverList,
+                 ServerId masterId,
+                 uint64_t partitionId,
+                 MasterService::Replica& replica)
+        : serverList(serverList)
+        , masterId(masterId)
+        , partitionId(partitionId)
+        , replica(replica)
+        , response()
+        , client(serverList.getSession(replica.backupId))
+        , startTime(Cycles::rdtsc())
+        , rpc()
+        , resendTime(0)
+    {
+        rpc.construct(client, masterId, replica.segmentId,
+                      partitionId, response);
+    }
+    ~RecoveryTask()
+    {
+        if (rpc && !rpc->isReady()) {
+            LOG(WARNING, "Task destroyed while RPC active: segment %lu, "
+                    "server %s", replica.segmentId,
+                    serverList.toString(replica.backupId).c_str());
+        }
+    }
+    void resend() {
+        LOG(DEBUG, "Resend %lu", replica.segmentId);
+        response.reset();
+        rpc.construct(client, masterId, replica.segmentId,
+                      partitionId, response);
+    }
+    ServerList& serverList;
+    ServerId masterId;
+    uint64_t partitionId;
+    MasterService::Replica& replica;
+    Buffer response;
+    BackupClient client;
+    const uint64_t startTime;
+    Tub<BackupClient::GetRecoveryData> rpc;
+    /// If we have to retry a request, this variable indicates the rdtsc time at
+    /// which we should retry.  0 means we're not waiting for a retry.
+    uint64_t resendTime;
+    DISALLOW_COPY_AND_ASSIGN(RecoveryTask);
+};
+} // namespace MasterServiceInternal
+using namespace MasterServiceInternal; // NOLINT
+
+/**
+ * Look through \a backups and ensure that for each segment id that appears
+ * in the list that at least one copy of that segment was replayed.
+ *
+ * \param masterId
+ *      The id of the crashed master this recovery master is recovering for.
+ *      Only used for logging detailed log information on failure.
+ * \param partitionId
+ *      The id of the partition of the crashed master this recovery master is
+ *      recovering. Only used for logging detailed log information on failure.
+ * \param replicas
+ *      The list of replicas and their statuses to be checked to ensure
+ *      recovery of this partition was successful.
+ * \throw SegmentRecoveryFailedException
+ *      If some segment was not recovered and the recovery master is not
+ *      a valid replacement for the crashed master.
+ */
+void
+MasterService::detectSegmentRecoveryFailure(
+            const ServerId masterId,
+            const uint64_t partitionId,
+            const vector<MasterService::Replica>& replicas)
+{
+    std::unordered_set<uint64_t> failures;
+    foreach (const auto& replica, replicas) {
+        switch (replica.state) {
+        case MasterService::Replica::State::OK:
+            failures.erase(replica.segmentId);
+            break;
+        case MasterService::Replica::State::FAILED:
+            failures.insert(replica.segmentId);
+            break;
+        case MasterService::Replica::State::WAITING:
+        case MasterService::Replica::State::NOT_STARTED:
+        default:
+            assert(false);
+            break;
+        }
+    }
+    if (!failures.empty()) {
+        LOG(ERROR, "Recovery master failed to recover master %lu "
+            "partition %lu", *masterId, partitionId);
+        foreach (auto segmentId, failures)
+            LOG(ERROR, "Unable to recover segment %lu", segmentId);
+        throw SegmentRecoveryFailedException(HERE);
+    }
+}
+
+/**
+ * Helper for public recover() method.
+ * Collect all the filtered log segments from backups for a set of tablets
+ * formerly belonging to a crashed master which is being recovered and pass
+ * them to the recovery master to have them replayed.
+ *
+ * \param masterId
+ *      The id of the crashed master for which recoveryMaster will be taking
+ *      over ownership of tablets.
+ * \param partitionId
+ *      The partition id of tablets inside the crashed master's will that
+ *      this master is recovering.
+ * \param replicas
+ *      A list specifying for each segmentId a backup who can provide a
+ *      filtered recovery data segment. A particular segment may be listed more
+ *      than once if it has multiple viable backups.
+ * \param transactions
+ *      If non-NULL, the transactions found in the segments are gathered
+ *      here; see recoverSegment().
+ * \throw SegmentRecoveryFailedException
+ *      If some segment was not recovered and the recovery master is not
+ *      a valid replacement for the crashed master.
+ */
+void
+MasterService::recover(ServerId masterId,
+                       uint64_t partitionId,
+                       vector<Replica>& replicas,
+                       RecoveredTransactions* transactions)
+{
+    /* Overview of the internals of this method and its structures.
+     *
+     * The main data structure is "replicas".  It works like a
+     * scoreboard, tracking which segments have requests to backup
+     * servers in-flight for data, which have been replayed, and
+     * which have failed and must be replayed by another entry in
+     * the table.
+     *
+     * replicasEnd is an iterator to the end of the segment replica list
+     * which aids in tracking when the function is out of work.
+     *
+     * notStarted tracks the furtherest entry into the list which
+     * has not been requested from a backup yet (State::NOT_STARTED).
+     *
+     * Here is a sample of what the structure might look like
+     * during execution:
+     *
+     * backupId     segmentId  state
+     * --------     ---------  -----
+     *   8            99       OK
+     *   3            88       FAILED
+     *   1            77       OK
+     *   2            77       OK
      *   6            88       WAITING
      *   2            66       NOT_STARTED  <- notStarted
      *   3            55       WAITING
@@ -641,702 +2358,1957 @@ MasterService::recover(ServerId masterId,
      */
     uint64_t usefulTime = 0;
     uint64_t start = Cycles::rdtsc();
-    LOG(NOTICE, "Recovering master %lu, partition %lu, %lu replicas available",
-        *masterId, partitionId, replicas.size());
+    LOG(NOTICE, "Recovering master %lu, partition %lu, %lu replicas available",
+        *masterId, partitionId, replicas.size());
+
+    std::unordered_set<uint64_t> runningSet;
+    Tub<RecoveryTask> tasks[4];
+    uint32_t activeRequests = 0;
+
+    auto notStarted = replicas.begin();
+    auto replicasEnd = replicas.end();
+
+    // Start RPCs
+    auto replicaIt = notStarted;
+    foreach (auto& task, tasks) {
+        while (!task) {
+            if (replicaIt == replicasEnd)
+                goto doneStartingInitialTasks;
+            auto& replica = *replicaIt;
+            LOG(DEBUG, "Starting getRecoveryData from %s for segment %lu "
+                "on channel %ld (initial round of RPCs)",
+                serverList.toString(replica.backupId).c_str(),
+                replica.segmentId,
+                &task - &tasks[0]);
+            try {
+                task.construct(serverList, masterId, partitionId, replica);
+                replica.state = Replica::State::WAITING;
+                runningSet.insert(replica.segmentId);
+                ++metrics->master.segmentReadCount;
+                ++activeRequests;
+            } catch (const TransportException& e) {
+                LOG(WARNING, "Couldn't contact %s, trying next backup; "
+                    "failure was: %s",
+                    serverList.toString(replica.backupId).c_str(),
+                    e.str().c_str());
+                replica.state = Replica::State::FAILED;
+            } catch (const ServerListException& e) {
+                LOG(WARNING, "No record of backup ID %lu, trying next backup",
+                    replica.backupId.getId());
+                replica.state = Replica::State::FAILED;
+            }
+            ++replicaIt;
+            while (replicaIt != replicasEnd &&
+                   contains(runningSet, replicaIt->segmentId)) {
+                ++replicaIt;
+            }
+        }
+    }
+  doneStartingInitialTasks:
+
+    // As RPCs complete, process them and start more
+    Tub<CycleCounter<RawMetric>> readStallTicks;
+
+    bool gotFirstGRD = false;
+
+    std::unordered_multimap<uint64_t, Replica*> segmentIdToBackups;
+    foreach (Replica& replica, replicas)
+        segmentIdToBackups.insert({replica.segmentId, &replica});
+
+    while (activeRequests) {
+        if (!readStallTicks)
+            readStallTicks.construct(&metrics->master.segmentReadStallTicks);
+        replicaManager.proceed();
+        uint64_t currentTime = Cycles::rdtsc();
+        foreach (auto& task, tasks) {
+            if (!task)
+                continue;
+            if (task->resendTime != 0) {
+                if (currentTime > task->resendTime) {
+                    task->resendTime = 0;
+                    task->resend();
+                }
+                continue;
+            }
+            if (!task->rpc->isReady())
+                continue;
+            readStallTicks.destroy();
+            LOG(DEBUG, "Waiting on recovery data for segment %lu from %s",
+                task->replica.segmentId,
+                serverList.toString(task->replica.backupId).c_str());
+            try {
+                (*task->rpc)();
+                uint64_t grdTime = Cycles::rdtsc() - task->startTime;
+                metrics->master.segmentReadTicks += grdTime;
+
+                if (!gotFirstGRD) {
+                    metrics->master.replicationBytes =
+                        0 - metrics->transport.transmit.byteCount;
+                    gotFirstGRD = true;
+                }
+                LOG(DEBUG, "Got getRecoveryData response from %s, took %.1f us "
+                    "on channel %ld",
+                    serverList.toString(task->replica.backupId).c_str(),
+                    Cycles::toSeconds(grdTime)*1e06,
+                    &task - &tasks[0]);
+
+                uint32_t responseLen = task->response.getTotalLength();
+                metrics->master.segmentReadByteCount += responseLen;
+                LOG(DEBUG, "Recovering segment %lu with size %u",
+                    task->replica.segmentId, responseLen);
+                uint64_t startUseful = Cycles::rdtsc();
+                recoverSegment(task->replica.segmentId,
+                               task->response.getRange(0, responseLen),
+                               responseLen, transactions);
+                usefulTime += Cycles::rdtsc() - startUseful;
+
+                runningSet.erase(task->replica.segmentId);
+                // Mark this and any other entries for this segment as OK.
+                LOG(DEBUG, "Checking %s off the list for %lu",
+                    serverList.toString(task->replica.backupId).c_str(),
+                    task->replica.segmentId);
+                task->replica.state = Replica::State::OK;
+                foreach (auto it, segmentIdToBackups.equal_range(
+                                        task->replica.segmentId)) {
+                    Replica& otherReplica = *it.second;
+                    LOG(DEBUG, "Checking %s off the list for %lu",
+                        serverList.toString(otherReplica.backupId).c_str(),
+                        otherReplica.segmentId);
+                    otherReplica.state = Replica::State::OK;
+                }
+            } catch (const RetryException& e) {
+                // The backup isn't ready yet, try back in 1 ms.
+                task->resendTime = currentTime +
+                    static_cast<int>(Cycles::perSecond()/1000.0);
+                continue;
+            } catch (const TransportException& e) {
+                LOG(WARNING, "Couldn't contact %s for segment %lu, "
+                    "trying next backup; failure was: %s",
+                    serverList.toString(task->replica.backupId).c_str(),
+                    task->replica.segmentId,
+                    e.str().c_str());
+                task->replica.state = Replica::State::FAILED;
+                runningSet.erase(task->replica.segmentId);
+            } catch (const ClientException& e) {
+                LOG(WARNING, "getRecoveryData failed on %s, "
+                    "trying next backup; failure was: %s",
+                    serverList.toString(task->replica.backupId).c_str(),
+                    e.str().c_str());
+                task->replica.state = Replica::State::FAILED;
+                runningSet.erase(task->replica.segmentId);
+            }
+
+            task.destroy();
+
+            // move notStarted up as far as possible
+            while (notStarted != replicasEnd &&
+                   notStarted->state != Replica::State::NOT_STARTED) {
+                ++notStarted;
+            }
+
+            // Find the next NOT_STARTED entry that isn't in-flight
+            // from another entry.
+            auto replicaIt = notStarted;
+            while (!task && replicaIt != replicasEnd) {
+                while (replicaIt->state != Replica::State::NOT_STARTED ||
+                       contains(runningSet, replicaIt->segmentId)) {
+                    ++replicaIt;
+                    if (replicaIt == replicasEnd)
+                        goto outOfHosts;
+                }
+                Replica& replica = *replicaIt;
+                LOG(DEBUG, "Starting getRecoveryData from %s for segment %lu "
+                    "on channel %ld (after RPC completion)",
+                    serverList.toString(replica.backupId).c_str(),
+                    replica.segmentId,
+                    &task - &tasks[0]);
+                try {
+                    task.construct(serverList, masterId, partitionId, replica);
+                    replica.state = Replica::State::WAITING;
+                    runningSet.insert(replica.segmentId);
+                    ++metrics->master.segmentReadCount;
+                } catch (const TransportException& e) {
+                    LOG(WARNING, "Couldn't contact %s, trying next backup; "
+                        "failure was: %s",
+                        serverList.toString(replica.backupId).c_str(),
+                        e.str().c_str());
+                    replica.state = Replica::State::FAILED;
+                } catch (const ServerListException& e) {
+                    LOG(WARNING, "No record of backup ID %lu, "
+                        "trying next backup",
+                        replica.backupId.getId());
+                    replica.state = Replica::State::FAILED;
+                }
+            }
+          outOfHosts:
+            if (!task)
+                --activeRequests;
+        }
+    }
+    readStallTicks.destroy();
+
+    detectSegmentRecoveryFailure(masterId, partitionId, replicas);
+
+    {
+        CycleCounter<RawMetric> logSyncTicks(&metrics->master.logSyncTicks);
+        LOG(NOTICE, "Syncing the log");
+        metrics->master.logSyncBytes =
+            0 - metrics->transport.transmit.byteCount;
+        log.sync();
+        metrics->master.logSyncBytes += metrics->transport.transmit.byteCount;
+    }
+
+    metrics->master.replicationBytes += metrics->transport.transmit.byteCount;
+
+    double totalSecs = Cycles::toSeconds(Cycles::rdtsc() - start);
+    double usefulSecs = Cycles::toSeconds(usefulTime);
+    LOG(NOTICE, "Recovery complete, took %.1f ms, useful replaying "
+        "time %.1f ms (%.1f%% effective)",
+        totalSecs * 1e03,
+        usefulSecs * 1e03,
+        100 * usefulSecs / totalSecs);
+}
+
+/**
+ * Top-level server method to handle the RECOVER request.
+ * \copydetails Service::ping
+ */
+void
+MasterService::recover(const RecoverRpc::Request& reqHdr,
+                       RecoverRpc::Response& respHdr,
+                       Rpc& rpc)
+{
+    CycleCounter<RawMetric> recoveryTicks(&metrics->master.recoveryTicks);
+    metrics->master.recoveryCount++;
+    metrics->master.replicas = replicaManager.numReplicas;
+
+    ServerId masterId(reqHdr.masterId);
+    uint64_t partitionId = reqHdr.partitionId;
+    ProtoBuf::Tablets recoveryTablets;
+    ProtoBuf::parseFromResponse(rpc.requestPayload, sizeof(reqHdr),
+                                reqHdr.tabletsLength, recoveryTablets);
+
+    uint32_t offset = (downCast<uint32_t>(sizeof(reqHdr)) +
+                       reqHdr.tabletsLength);
+    vector<Replica> replicas;
+    replicas.reserve(reqHdr.numReplicas);
+    for (uint32_t i = 0; i < reqHdr.numReplicas; ++i) {
+        const RecoverRpc::Replica* replicaLocation =
+            rpc.requestPayload.getOffset<RecoverRpc::Replica>(offset);
+        offset += downCast<uint32_t>(sizeof(RecoverRpc::Replica));
+        Replica replica(replicaLocation->backupId,
+                        replicaLocation->segmentId);
+        replicas.push_back(replica);
+    }
+    LOG(DEBUG, "Starting recovery of %u tablets on masterId %lu",
+        recoveryTablets.tablet_size(), serverId.getId());
+    rpc.sendReply();
+
+    // reqHdr, respHdr, and rpc are off-limits now
+
+    // Union the new tablets into an updated tablet map
+    ProtoBuf::Tablets newTablets(tablets);
+    newTablets.mutable_tablet()->MergeFrom(recoveryTablets.tablet());
+    // and set ourself as open for business.
+    setTablets(newTablets);
+
+    // Recover Segments, firing MasterService::recoverSegment for each one.
+    RecoveredTransactions transactions;
+    recover(masterId, partitionId, replicas, &transactions);
+
+    // Transactions the crashed master prepared but never decided keep
+    // their objects locked here; their intents must be durable again
+    // before the tablets are served.
+    if (!transactions.empty()) {
+        {
+            std::lock_guard<SpinLock> lock(objectUpdateLock);
+            restorePreparedTransactions(transactions);
+        }
+        log.sync();
+    }
+
+    // Free recovery tombstones left in the hash table.
+    removeTombstones();
+
+    // Clients with stale tablet maps have been told to retry until now.
+    markTabletsNormal(recoveryTablets);
+
+    // Once the coordinator and the recovery master agree that the
+    // master has taken over for the tablets it can update its tables
+    // and begin serving requests.
+
+    // Update the recoveryTablets to reflect the fact that this master is
+    // going to try to become the owner.
+    foreach (ProtoBuf::Tablets::Tablet& tablet,
+             *recoveryTablets.mutable_tablet()) {
+        LOG(NOTICE, "set tablet %lu %lu %lu to locator %s, id %lu",
+                 tablet.table_id(), tablet.start_object_id(),
+                 tablet.end_object_id(), config.localLocator.c_str(),
+                 serverId.getId());
+        tablet.set_service_locator(config.localLocator);
+        tablet.set_server_id(serverId.getId());
+    }
+
+    // TODO(ongaro): don't need to calculate a new will here
+    ProtoBuf::Tablets recoveryWill;
+    {
+        CycleCounter<RawMetric> _(&metrics->master.recoveryWillTicks);
+        Will will(tablets, maxBytesPerPartition, maxReferentsPerPartition);
+        will.serialize(recoveryWill);
+    }
+
+    {
+        coordinator->tabletsRecovered(serverId.getId(),
+                                      recoveryTablets,
+                                      recoveryWill);
+    }
+    // Ok - we're free to start serving now.
+
+    // TODO(stutsman) update local copy of the will
+}
+
+/**
+ * Replay the log this master's former incarnation left in the co-located
+ * backup's storage and then tell the coordinator that its tablets are
+ * served again.  The backup loads and filters segments on a thread of its
+ * own while this one replays the segments already read, so a restart is
+ * bounded by local disk bandwidth rather than by the network.  If the
+ * replay fails, the tablets fall back to crash recovery; see
+ * abortRestart().
+ *
+ * \param formerId
+ *      The id this server ran under before the restart.
+ * \param backup
+ *      The BackupService in this process, holding the former log.
+ * \param segmentIds
+ *      The segments of the former log; see BackupService::findLocalLog().
+ */
+void
+MasterService::restart(ServerId formerId, BackupService& backup,
+                       const vector<uint64_t>& segmentIds)
+{
+    CycleCounter<RawMetric> restartTicks(&metrics->master.restartTicks);
+    uint64_t start = Cycles::rdtsc();
 
-    std::unordered_set<uint64_t> runningSet;
-    Tub<RecoveryTask> tasks[4];
-    uint32_t activeRequests = 0;
+    // The coordinator handed the former server's tablets to us when we
+    // enlisted, marked as RECOVERING.
+    ProtoBuf::Tablets tabletMap;
+    coordinator->getTabletMap(tabletMap);
+    ProtoBuf::Tablets restartTablets;
+    foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
+        if (tablet.server_id() == serverId.getId() &&
+            tablet.state() == ProtoBuf::Tablets_Tablet::RECOVERING) {
+            ProtoBuf::Tablets::Tablet& restartTablet(
+                *restartTablets.add_tablet());
+            restartTablet = tablet;
+            restartTablet.set_user_data(0);
+        }
+    }
+    LOG(NOTICE, "Reloading %d tablets of former server %lu from %lu "
+        "segments in local storage", restartTablets.tablet_size(),
+        formerId.getId(), segmentIds.size());
 
-    auto notStarted = replicas.begin();
-    auto replicasEnd = replicas.end();
+    // The tablets stay RECOVERING, so requests for them are refused until
+    // they have been replayed, and the tombstone reaper waits too.
+    {
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        HashTable<LogEntryHandle>::ExclusiveLock _(objectMap);
+        ProtoBuf::Tablets newTablets(tablets);
+        newTablets.mutable_tablet()->MergeFrom(restartTablets.tablet());
+        setTablets(newTablets);
+        replayingRestart = true;
+    }
 
-    // Start RPCs
-    auto replicaIt = notStarted;
-    foreach (auto& task, tasks) {
-        while (!task) {
-            if (replicaIt == replicasEnd)
-                goto doneStartingInitialTasks;
-            auto& replica = *replicaIt;
-            LOG(DEBUG, "Starting getRecoveryData from %s for segment %lu "
-                "on channel %ld (initial round of RPCs)",
-                serverList.toString(replica.backupId).c_str(),
-                replica.segmentId,
-                &task - &tasks[0]);
-            try {
-                task.construct(serverList, masterId, partitionId, replica);
-                replica.state = Replica::State::WAITING;
-                runningSet.insert(replica.segmentId);
-                ++metrics->master.segmentReadCount;
-                ++activeRequests;
-            } catch (const TransportException& e) {
-                LOG(WARNING, "Couldn't contact %s, trying next backup; "
-                    "failure was: %s",
-                    serverList.toString(replica.backupId).c_str(),
-                    e.str().c_str());
-                replica.state = Replica::State::FAILED;
-            } catch (const ServerListException& e) {
-                LOG(WARNING, "No record of backup ID %lu, trying next backup",
-                    replica.backupId.getId());
-                replica.state = Replica::State::FAILED;
-            }
-            ++replicaIt;
-            while (replicaIt != replicasEnd &&
-                   contains(runningSet, replicaIt->segmentId)) {
-                ++replicaIt;
+    uint64_t bytes = 0;
+    try {
+        RecoveredTransactions transactions;
+        bytes = replayLocalLog(formerId, backup, segmentIds, restartTablets,
+                               &transactions);
+        {
+            std::lock_guard<SpinLock> lock(objectUpdateLock);
+            replayingRestart = false;
+            restorePreparedTransactions(transactions);
+        }
+        removeTombstones();
+        CycleCounter<RawMetric> logSyncTicks(&metrics->master.logSyncTicks);
+        LOG(NOTICE, "Syncing the log");
+        log.sync();
+    } catch (...) {
+        {
+            std::lock_guard<SpinLock> lock(objectUpdateLock);
+            replayingRestart = false;
+        }
+        abortRestart(formerId, restartTablets);
+        // Recoveries and migrations that finished meanwhile left their
+        // tombstones for us.
+        removeTombstones();
+        throw;
+    }
+
+    {
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        markTabletsNormal(restartTablets);
+    }
+
+    foreach (ProtoBuf::Tablets::Tablet& tablet,
+             *restartTablets.mutable_tablet()) {
+        tablet.set_service_locator(config.localLocator);
+        tablet.set_server_id(serverId.getId());
+    }
+    ProtoBuf::Tablets will;
+    {
+        CycleCounter<RawMetric> _(&metrics->master.recoveryWillTicks);
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        Will(tablets, maxBytesPerPartition,
+             maxReferentsPerPartition).serialize(will);
+    }
+    coordinator->tabletsRecovered(serverId.getId(), restartTablets, will);
+
+    // Our own log now holds everything; the former one can go.
+    backup.freeLocalLog(formerId);
+
+    double secs = Cycles::toSeconds(Cycles::rdtsc() - start);
+    LOG(NOTICE, "Restart complete, replayed %lu MB in %.1f ms (%.1f MB/s)",
+        bytes / (1 << 20), secs * 1e03,
+        static_cast<double>(bytes) / (1 << 20) / secs);
+}
+
+/**
+ * Give up on the tablets a restart could not reload: stop serving them,
+ * drop whatever of them was replayed, and have the coordinator recover
+ * them from the former server's replicas instead, as it would have if
+ * this server hadn't restarted in place.
+ *
+ * \param formerId
+ *      The id this server ran under before the restart.
+ * \param restartTablets
+ *      The tablets restart() took on. Their server ids are changed to
+ *      \a formerId.
+ */
+void
+MasterService::abortRestart(ServerId formerId,
+                            ProtoBuf::Tablets& restartTablets)
+{
+    {
+        std::lock_guard<SpinLock> lock(objectUpdateLock);
+        ProtoBuf::Tablets newTablets;
+        foreach (const ProtoBuf::Tablets::Tablet& tablet, tablets.tablet()) {
+            bool restarting = false;
+            foreach (const ProtoBuf::Tablets::Tablet& restartTablet,
+                     restartTablets.tablet()) {
+                if (tablet.table_id() == restartTablet.table_id() &&
+                    tablet.start_object_id() ==
+                        restartTablet.start_object_id() &&
+                    tablet.end_object_id() == restartTablet.end_object_id())
+                    restarting = true;
             }
+            if (!restarting)
+                *newTablets.add_tablet() = tablet;
         }
+        HashTable<LogEntryHandle>::ExclusiveLock _(objectMap);
+        setTablets(newTablets);
     }
-  doneStartingInitialTasks:
 
-    // As RPCs complete, process them and start more
-    Tub<CycleCounter<RawMetric>> readStallTicks;
+    uint64_t bucket = 0;
+    while (!visitObjectMapBuckets(&bucket, restartPurgeCallback))
+        continue;
 
-    bool gotFirstGRD = false;
+    LOG(WARNING, "Giving %d tablets of former server %lu back to the "
+        "coordinator for recovery", restartTablets.tablet_size(),
+        formerId.getId());
+    foreach (ProtoBuf::Tablets::Tablet& tablet,
+             *restartTablets.mutable_tablet())
+        tablet.set_server_id(formerId.getId());
+    coordinator->tabletsRecovered(serverId.getId(), restartTablets,
+                                  ProtoBuf::Tablets(), STATUS_INTERNAL_ERROR);
+}
 
-    std::unordered_multimap<uint64_t, Replica*> segmentIdToBackups;
-    foreach (Replica& replica, replicas)
-        segmentIdToBackups.insert({replica.segmentId, &replica});
+/**
+ * Replay a log held by the backup in this process, as restart() does.
+ * The backup loads and filters segments on a thread of its own while this
+ * one replays the segments already read.
+ *
+ * \param formerId
+ *      The id the log was written under.
+ * \param backup
+ *      The BackupService in this process, holding the log.
+ * \param segmentIds
+ *      The segments of the log; see BackupService::findLocalLog().
+ * \param partitions
+ *      The tablets to take back, all in partition 0.  The backup drops
+ *      the objects of any other tablets; they were dropped since they
+ *      were written.
+ * \param transactions
+ *      If non-NULL, the transactions found in the log are gathered here;
+ *      see recoverSegment().
+ * \return
+ *      The number of bytes of objects and tombstones replayed.
+ */
+uint64_t
+MasterService::replayLocalLog(ServerId formerId, BackupService& backup,
+                              const vector<uint64_t>& segmentIds,
+                              const ProtoBuf::Tablets& partitions,
+                              RecoveredTransactions* transactions)
+{
+    backup.startReadingLocalLog(formerId, segmentIds, partitions);
+    uint64_t bytes = 0;
+    foreach (uint64_t segmentId, segmentIds) {
+        Buffer buffer;
+        while (backup.getLocalRecoveryData(formerId, segmentId, buffer) ==
+               STATUS_RETRY)
+            sched_yield();
+        uint32_t length = buffer.getTotalLength();
+        {
+            // Requests are being served meanwhile, unlike during recovery.
+            std::lock_guard<SpinLock> lock(objectUpdateLock);
+            HashTable<LogEntryHandle>::ExclusiveLock _(objectMap);
+            recoverSegment(segmentId, buffer.getRange(0, length), length,
+                           transactions);
+        }
+        bytes += length;
+        backup.releaseLocalRecoveryData(formerId, segmentId);
+    }
+    return bytes;
+}
 
-    while (activeRequests) {
-        if (!readStallTicks)
-            readStallTicks.construct(&metrics->master.segmentReadStallTicks);
-        replicaManager.proceed();
-        uint64_t currentTime = Cycles::rdtsc();
-        foreach (auto& task, tasks) {
-            if (!task)
-                continue;
-            if (task->resendTime != 0) {
-                if (currentTime > task->resendTime) {
-                    task->resendTime = 0;
-                    task->resend();
+/**
+ * Look up, all at once, the objects and tombstones of the next few
+ * entries of the Segment we're currently recovering, so that the hash
+ * table's cache misses for them overlap. This is used exclusively by
+ * recoverSegment().
+ *
+ * \param[in] i
+ *      A RecoverySegmentIterator positioned at the first entry to consider.
+ *      It is advanced past the last object or tombstone looked up, so the
+ *      caller should not use it for its own iteration.
+ * \param[out] tableIds
+ *      The table of each object or tombstone looked up.
+ * \param[out] objectIds
+ *      The id of each object or tombstone looked up.
+ * \param[out] matchers
+ *      The key of each object or tombstone looked up.
+ * \param[out] handles
+ *      What #objectMap held for each one, or NULL.
+ * \return
+ *      The number of objects and tombstones looked up, at most
+ *      #LOOKUP_BATCH_SIZE. Zero once \a i is done.
+ */
+uint32_t
+MasterService::recoverSegmentLookupBatch(RecoverySegmentIterator& i,
+                                         uint64_t tableIds[],
+                                         uint64_t objectIds[],
+                                         KeyMatcher matchers[],
+                                         LogEntryHandle handles[])
+{
+    uint32_t count = 0;
+    for (; !i.isDone() && count < LOOKUP_BATCH_SIZE; i.next()) {
+        LogEntryType type = i.getType();
+        if (type == LOG_ENTRY_TYPE_OBJ) {
+            const Object *recoverObj = reinterpret_cast<const Object *>(
+                         i.getPointer());
+            tableIds[count] = recoverObj->id.tableId;
+            objectIds[count] = recoverObj->id.objectId;
+            matchers[count] = KeyMatcher(recoverObj->data,
+                                         recoverObj->keyLength);
+        } else if (type == LOG_ENTRY_TYPE_OBJTOMB) {
+            const ObjectTombstone *recoverTomb =
+                reinterpret_cast<const ObjectTombstone *>(i.getPointer());
+            tableIds[count] = recoverTomb->id.tableId;
+            objectIds[count] = recoverTomb->id.objectId;
+            matchers[count] = KeyMatcher(recoverTomb->keyFingerprint);
+        } else {
+            continue;
+        }
+        count++;
+    }
+
+    objectMap.lookupBatch(count, tableIds, objectIds, matchers, handles);
+    return count;
+}
+
+/**
+ * Replay a filtered segment from a crashed Master that this Master is taking
+ * over for.
+ *
+ * \param segmentId
+ *      The segmentId of the segment as it was in the log of the crashed Master.
+ * \param buffer 
+ *      A pointer to a valid segment which has been pre-filtered of all
+ *      objects except those that pertain to the tablet ranges this Master
+ *      will be responsible for after the recovery completes.
+ * \param bufferLength
+ *      Length of the buffer in bytes.
+ * \param transactions
+ *      If non-NULL, the TransactionIntents and TransactionDecisions in the
+ *      segment are gathered here, to be passed to
+ *      restorePreparedTransactions() once every segment is replayed.
+ *      Otherwise they are dropped.
+ */
+void
+MasterService::recoverSegment(uint64_t segmentId, const void *buffer,
+                              uint32_t bufferLength,
+                              RecoveredTransactions* transactions)
+{
+    uint64_t startReplicationTicks = metrics->master.replicaManagerTicks;
+    LOG(DEBUG, "recoverSegment %lu, ...", segmentId);
+    CycleCounter<RawMetric> _(&metrics->master.recoverSegmentTicks);
+
+    RecoverySegmentIterator i(buffer, bufferLength);
+    RecoverySegmentIterator lookahead(buffer, bufferLength);
+
+    // The objects and tombstones of the entries i is about to replay, and
+    // what objectMap held for them. See recoverSegmentLookupBatch().
+    uint64_t tableIds[LOOKUP_BATCH_SIZE];
+    uint64_t objectIds[LOOKUP_BATCH_SIZE];
+    KeyMatcher matchers[LOOKUP_BATCH_SIZE];
+    LogEntryHandle handles[LOOKUP_BATCH_SIZE];
+    uint32_t batchSize = 0;
+    uint32_t batchIndex = 0;
+
+    uint64_t lastOffsetBackupProgress = 0;
+    while (!i.isDone()) {
+        LogEntryType type = i.getType();
+
+        if (i.getOffset() > lastOffsetBackupProgress + 50000) {
+            lastOffsetBackupProgress = i.getOffset();
+            replicaManager.proceed();
+        }
+
+        metrics->master.recoverySegmentEntryCount++;
+        metrics->master.recoverySegmentEntryBytes += i.getLength();
+
+        LogEntryHandle handle = NULL;
+        if (type == LOG_ENTRY_TYPE_OBJ || type == LOG_ENTRY_TYPE_OBJTOMB) {
+            if (batchIndex == batchSize) {
+                batchSize = recoverSegmentLookupBatch(lookahead, tableIds,
+                                                      objectIds, matchers,
+                                                      handles);
+                batchIndex = 0;
+            }
+            handle = handles[batchIndex];
+            // An earlier entry of this batch for the same id may have
+            // already replaced (and maybe freed) what was looked up.
+            for (uint32_t j = 0; j < batchIndex; j++) {
+                if (tableIds[j] == tableIds[batchIndex] &&
+                    objectIds[j] == objectIds[batchIndex]) {
+                    handle = objectMap.lookup(tableIds[batchIndex],
+                                              objectIds[batchIndex],
+                                              matchers[batchIndex]);
+                    break;
                 }
-                continue;
             }
-            if (!task->rpc->isReady())
-                continue;
-            readStallTicks.destroy();
-            LOG(DEBUG, "Waiting on recovery data for segment %lu from %s",
-                task->replica.segmentId,
-                serverList.toString(task->replica.backupId).c_str());
-            try {
-                (*task->rpc)();
-                uint64_t grdTime = Cycles::rdtsc() - task->startTime;
-                metrics->master.segmentReadTicks += grdTime;
+            batchIndex++;
+        }
 
-                if (!gotFirstGRD) {
-                    metrics->master.replicationBytes =
-                        0 - metrics->transport.transmit.byteCount;
-                    gotFirstGRD = true;
-                }
-                LOG(DEBUG, "Got getRecoveryData response from %s, took %.1f us "
-                    "on channel %ld",
-                    serverList.toString(task->replica.backupId).c_str(),
-                    Cycles::toSeconds(grdTime)*1e06,
-                    &task - &tasks[0]);
+        if (type == LOG_ENTRY_TYPE_OBJ) {
+            const Object *recoverObj = reinterpret_cast<const Object *>(
+                i.getPointer());
+
+            const Object *localObj = NULL;
+            const ObjectTombstone *tomb = NULL;
+            if (handle != NULL) {
+                if (handle->type() == LOG_ENTRY_TYPE_OBJTOMB)
+                    tomb = handle->userData<ObjectTombstone>();
+                else
+                    localObj = handle->userData<Object>();
+            }
+
+            // can't have both a tombstone and an object in the hash tables
+            assert(tomb == NULL || localObj == NULL);
+
+            uint64_t minSuccessor = 0;
+            if (localObj != NULL)
+                minSuccessor = localObj->version + 1;
+            else if (tomb != NULL)
+                minSuccessor = tomb->objectVersion + 1;
+
+            if (recoverObj->version >= minSuccessor) {
+                // write to log (with lazy backup flush) & update hash table
+                LogEntryHandle newObjHandle = log.append(LOG_ENTRY_TYPE_OBJ,
+                    recoverObj, i.getLength(), false, i.checksum());
+                ++metrics->master.objectAppendCount;
+                metrics->master.liveObjectBytes +=
+                    recoverObj->dataLength(i.getLength());
 
-                uint32_t responseLen = task->response.getTotalLength();
-                metrics->master.segmentReadByteCount += responseLen;
-                LOG(DEBUG, "Recovering segment %lu with size %u",
-                    task->replica.segmentId, responseLen);
-                uint64_t startUseful = Cycles::rdtsc();
-                recoverSegment(task->replica.segmentId,
-                               task->response.getRange(0, responseLen),
-                               responseLen);
-                usefulTime += Cycles::rdtsc() - startUseful;
+                // The TabletProfiler is updated asynchronously.
+                objectMap.replace(newObjHandle, SameReferent(handle));
 
-                runningSet.erase(task->replica.segmentId);
-                // Mark this and any other entries for this segment as OK.
-                LOG(DEBUG, "Checking %s off the list for %lu",
-                    serverList.toString(task->replica.backupId).c_str(),
-                    task->replica.segmentId);
-                task->replica.state = Replica::State::OK;
-                foreach (auto it, segmentIdToBackups.equal_range(
-                                        task->replica.segmentId)) {
-                    Replica& otherReplica = *it.second;
-                    LOG(DEBUG, "Checking %s off the list for %lu",
-                        serverList.toString(otherReplica.backupId).c_str(),
-                        otherReplica.segmentId);
-                    otherReplica.state = Replica::State::OK;
+                // The cleaner will figure out that the tombstone is dead.
+
+                // nuke the old object, if it existed
+                if (localObj != NULL) {
+                    metrics->master.liveObjectBytes -=
+                        localObj->dataLength(handle->length());
+                    log.free(handle);
+                } else {
+                    ++metrics->master.liveObjectCount;
                 }
-            } catch (const RetryException& e) {
-                // The backup isn't ready yet, try back in 1 ms.
-                task->resendTime = currentTime +
-                    static_cast<int>(Cycles::perSecond()/1000.0);
-                continue;
-            } catch (const TransportException& e) {
-                LOG(WARNING, "Couldn't contact %s for segment %lu, "
-                    "trying next backup; failure was: %s",
-                    serverList.toString(task->replica.backupId).c_str(),
-                    task->replica.segmentId,
-                    e.str().c_str());
-                task->replica.state = Replica::State::FAILED;
-                runningSet.erase(task->replica.segmentId);
-            } catch (const ClientException& e) {
-                LOG(WARNING, "getRecoveryData failed on %s, "
-                    "trying next backup; failure was: %s",
-                    serverList.toString(task->replica.backupId).c_str(),
-                    e.str().c_str());
-                task->replica.state = Replica::State::FAILED;
-                runningSet.erase(task->replica.segmentId);
+            } else {
+                ++metrics->master.objectDiscardCount;
             }
+        } else if (type == LOG_ENTRY_TYPE_OBJTOMB) {
+            const ObjectTombstone *recoverTomb =
+                reinterpret_cast<const ObjectTombstone *>(i.getPointer());
+            uint64_t objId = recoverTomb->id.objectId;
+            uint64_t tblId = recoverTomb->id.tableId;
 
-            task.destroy();
+            bool checksumIsValid = ({
+                CycleCounter<RawMetric> c(&metrics->master.verifyChecksumTicks);
+                i.isChecksumValid();
+            });
+            if (!checksumIsValid) {
+                LOG(WARNING, "invalid tombstone checksum! tbl: %lu, obj: %lu, "
+                    "ver: %lu", tblId, objId, recoverTomb->objectVersion);
+            }
 
-            // move notStarted up as far as possible
-            while (notStarted != replicasEnd &&
-                   notStarted->state != Replica::State::NOT_STARTED) {
-                ++notStarted;
+            const Object *localObj = NULL;
+            const ObjectTombstone *tomb = NULL;
+            if (handle != NULL) {
+                if (handle->type() == LOG_ENTRY_TYPE_OBJTOMB)
+                    tomb = handle->userData<ObjectTombstone>();
+                else
+                    localObj = handle->userData<Object>();
             }
 
-            // Find the next NOT_STARTED entry that isn't in-flight
-            // from another entry.
-            auto replicaIt = notStarted;
-            while (!task && replicaIt != replicasEnd) {
-                while (replicaIt->state != Replica::State::NOT_STARTED ||
-                       contains(runningSet, replicaIt->segmentId)) {
-                    ++replicaIt;
-                    if (replicaIt == replicasEnd)
-                        goto outOfHosts;
-                }
-                Replica& replica = *replicaIt;
-                LOG(DEBUG, "Starting getRecoveryData from %s for segment %lu "
-                    "on channel %ld (after RPC completion)",
-                    serverList.toString(replica.backupId).c_str(),
-                    replica.segmentId,
-                    &task - &tasks[0]);
-                try {
-                    task.construct(serverList, masterId, partitionId, replica);
-                    replica.state = Replica::State::WAITING;
-                    runningSet.insert(replica.segmentId);
-                    ++metrics->master.segmentReadCount;
-                } catch (const TransportException& e) {
-                    LOG(WARNING, "Couldn't contact %s, trying next backup; "
-                        "failure was: %s",
-                        serverList.toString(replica.backupId).c_str(),
-                        e.str().c_str());
-                    replica.state = Replica::State::FAILED;
-                } catch (const ServerListException& e) {
-                    LOG(WARNING, "No record of backup ID %lu, "
-                        "trying next backup",
-                        replica.backupId.getId());
-                    replica.state = Replica::State::FAILED;
+            // can't have both a tombstone and an object in the hash tables
+            assert(tomb == NULL || localObj == NULL);
+
+            uint64_t minSuccessor = 0;
+            if (localObj != NULL)
+                minSuccessor = localObj->version;
+            else if (tomb != NULL)
+                minSuccessor = tomb->objectVersion + 1;
+
+            if (recoverTomb->objectVersion >= minSuccessor) {
+                ++metrics->master.tombstoneAppendCount;
+                LogEntryHandle newTomb = log.append(LOG_ENTRY_TYPE_OBJTOMB,
+                    recoverTomb, sizeof(*recoverTomb), false, i.checksum());
+                objectMap.replace(newTomb, SameReferent(handle));
+
+                // The cleaner will figure out that the tombstone is dead.
+
+                // nuke the object, if it existed
+                if (localObj != NULL) {
+                    --metrics->master.liveObjectCount;
+                    metrics->master.liveObjectBytes -=
+                        localObj->dataLength(handle->length());
+                    log.free(handle);
                 }
+            } else {
+                ++metrics->master.tombstoneDiscardCount;
             }
-          outOfHosts:
-            if (!task)
-                --activeRequests;
+        } else if (type == LOG_ENTRY_TYPE_TXINTENT && transactions != NULL) {
+            const TransactionIntent* intent =
+                reinterpret_cast<const TransactionIntent*>(i.getPointer());
+            const TransactionRpc::Request::Part* part =
+                reinterpret_cast<const TransactionRpc::Request::Part*>(
+                    intent->part);
+            (*transactions)[intent->transactionId].parts[
+                std::make_pair(part->tableId, part->id)].assign(
+                    intent->part, i.getLength() - sizeof(TransactionIntent));
+        } else if (type == LOG_ENTRY_TYPE_TXDECISION &&
+                   transactions != NULL) {
+            const TransactionDecision* decision =
+                reinterpret_cast<const TransactionDecision*>(i.getPointer());
+            (*transactions)[decision->transactionId].decided = true;
         }
-    }
-    readStallTicks.destroy();
 
-    detectSegmentRecoveryFailure(masterId, partitionId, replicas);
-
-    {
-        CycleCounter<RawMetric> logSyncTicks(&metrics->master.logSyncTicks);
-        LOG(NOTICE, "Syncing the log");
-        metrics->master.logSyncBytes =
-            0 - metrics->transport.transmit.byteCount;
-        log.sync();
-        metrics->master.logSyncBytes += metrics->transport.transmit.byteCount;
+        i.next();
     }
-
-    metrics->master.replicationBytes += metrics->transport.transmit.byteCount;
-
-    double totalSecs = Cycles::toSeconds(Cycles::rdtsc() - start);
-    double usefulSecs = Cycles::toSeconds(usefulTime);
-    LOG(NOTICE, "Recovery complete, took %.1f ms, useful replaying "
-        "time %.1f ms (%.1f%% effective)",
-        totalSecs * 1e03,
-        usefulSecs * 1e03,
-        100 * usefulSecs / totalSecs);
+    LOG(DEBUG, "Segment %lu replay complete", segmentId);
+    metrics->master.backupInRecoverTicks +=
+        metrics->master.replicaManagerTicks - startReplicationTicks;
 }
 
 /**
- * Top-level server method to handle the RECOVER request.
- * \copydetails Service::ping
+ * Top-level server method to handle the REMOVE request.
+ * \copydetails create
  */
 void
-MasterService::recover(const RecoverRpc::Request& reqHdr,
-                       RecoverRpc::Response& respHdr,
-                       Rpc& rpc)
+MasterService::remove(const RemoveRpc::Request& reqHdr,
+                      RemoveRpc::Response& respHdr,
+                      Rpc& rpc)
 {
-    CycleCounter<RawMetric> recoveryTicks(&metrics->master.recoveryTicks);
-    metrics->master.recoveryCount++;
-    metrics->master.replicas = replicaManager.numReplicas;
-
-    ServerId masterId(reqHdr.masterId);
-    uint64_t partitionId = reqHdr.partitionId;
-    ProtoBuf::Tablets recoveryTablets;
-    ProtoBuf::parseFromResponse(rpc.requestPayload, sizeof(reqHdr),
-                                reqHdr.tabletsLength, recoveryTablets);
-
-    uint32_t offset = (downCast<uint32_t>(sizeof(reqHdr)) +
-                       reqHdr.tabletsLength);
-    vector<Replica> replicas;
-    replicas.reserve(reqHdr.numReplicas);
-    for (uint32_t i = 0; i < reqHdr.numReplicas; ++i) {
-        const RecoverRpc::Replica* replicaLocation =
-            rpc.requestPayload.getOffset<RecoverRpc::Replica>(offset);
-        offset += downCast<uint32_t>(sizeof(RecoverRpc::Replica));
-        Replica replica(replicaLocation->backupId,
-                        replicaLocation->segmentId);
-        replicas.push_back(replica);
+    bool normal;
+    Table* table = getTable(reqHdr.tableId, reqHdr.id, &normal);
+    if (table == NULL) {
+        respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
+        return;
     }
-    LOG(DEBUG, "Starting recovery of %u tablets on masterId %lu",
-        recoveryTablets.tablet_size(), serverId.getId());
-    rpc.sendReply();
-
-    // reqHdr, respHdr, and rpc are off-limits now
-
-    // Union the new tablets into an updated tablet map
-    ProtoBuf::Tablets newTablets(tablets);
-    newTablets.mutable_tablet()->MergeFrom(recoveryTablets.tablet());
-    // and set ourself as open for business.
-    setTablets(newTablets);
-
-    // Recover Segments, firing MasterService::recoverSegment for each one.
-    recover(masterId, partitionId, replicas);
-
-    // Free recovery tombstones left in the hash table.
-    removeTombstones();
-
-    // Once the coordinator and the recovery master agree that the
-    // master has taken over for the tablets it can update its tables
-    // and begin serving requests.
-
-    // Update the recoveryTablets to reflect the fact that this master is
-    // going to try to become the owner.
-    foreach (ProtoBuf::Tablets::Tablet& tablet,
-             *recoveryTablets.mutable_tablet()) {
-        LOG(NOTICE, "set tablet %lu %lu %lu to locator %s, id %lu",
-                 tablet.table_id(), tablet.start_object_id(),
-                 tablet.end_object_id(), config.localLocator.c_str(),
-                 serverId.getId());
-        tablet.set_service_locator(config.localLocator);
-        tablet.set_server_id(serverId.getId());
+    if (!normal || updateBlocked(reqHdr.tableId, reqHdr.id)) {
+        respHdr.common.status = STATUS_RETRY;
+        return;
+    }
+    const void* key = NULL;
+    if (reqHdr.keyLength != 0) {
+        key = rpc.requestPayload.getRange(sizeof(reqHdr), reqHdr.keyLength);
+        if (key == NULL) {
+            respHdr.common.status = STATUS_MESSAGE_TOO_SHORT;
+            return;
+        }
+    }
+    LogEntryHandle handle = objectMap.lookup(reqHdr.tableId, reqHdr.id,
+                                   KeyMatcher(key, reqHdr.keyLength));
+    if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ ||
+        handle->userData<Object>()->isExpired()) {
+        Status status = rejectOperation(reqHdr.rejectRules,
+                                        VERSION_NONEXISTENT);
+        if (status != STATUS_OK)
+            respHdr.common.status = status;
+        return;
     }
 
-    // TODO(ongaro): don't need to calculate a new will here
-    ProtoBuf::Tablets recoveryWill;
-    {
-        CycleCounter<RawMetric> _(&metrics->master.recoveryWillTicks);
-        Will will(tablets, maxBytesPerPartition, maxReferentsPerPartition);
-        will.serialize(recoveryWill);
+    const Object *obj = handle->userData<Object>();
+    respHdr.version = obj->version;
+
+    // Abort if we're trying to delete the wrong version.
+    Status status = rejectOperation(reqHdr.rejectRules, respHdr.version);
+    if (status != STATUS_OK) {
+        respHdr.common.status = status;
+        return;
     }
 
-    {
-        coordinator->tabletsRecovered(serverId.getId(),
-                                      recoveryTablets,
-                                      recoveryWill);
+    ObjectTombstone tomb(log.getSegmentId(obj), obj);
+
+    // Write the tombstone into the Log, increment the tablet version
+    // number, and remove from the hash table.
+    try {
+        log.append(LOG_ENTRY_TYPE_OBJTOMB, &tomb, sizeof(tomb), false);
+        logSyncPending = true;
+    } catch (LogException& e) {
+        // The log is out of space. Tell the client to retry and hope
+        // that either the cleaner makes space soon or we shift load
+        // off of this server.
+        respHdr.common.status = STATUS_RETRY;
+        return;
     }
-    // Ok - we're free to start serving now.
 
-    // TODO(stutsman) update local copy of the will
+    table->RaiseVersion(obj->version + 1);
+    log.free(handle);
+    std::lock_guard<SpinLock> lock(objectMap.getBucketLock(reqHdr.tableId,
+                                                           reqHdr.id));
+    objectMap.remove(reqHdr.tableId, reqHdr.id, SameReferent(handle));
+    markMigrationDirty(reqHdr.tableId, reqHdr.id, tomb.keyFingerprint);
 }
 
+
 /**
- * Given a RecoverySegmentIterator for the Segment we're currently
- * recovering, advance it and issue prefetches on the hash tables.
- * This is used exclusively by recoverSegment().
+ * Top-level server method to handle the REREPLICATE_SEGMENTS request.
+ * Using the server id of a crashed backup from #reqHdr this MasterService
+ * rereplicates any live segments it had stored on that backup to new backups
+ * in order to maintain any replication requirements after a backup failure.
  *
- * \param[in] i
- *      A RecoverySegmentIterator to use for prefetching. Note that this
- *      method modifies the iterator, so the caller should not use
- *      it for its own iteration.
+ * \copydetails Service::ping
  */
 void
-MasterService::recoverSegmentPrefetcher(RecoverySegmentIterator& i)
+MasterService::rereplicateSegments(
+    const RereplicateSegmentsRpc::Request& reqHdr,
+    RereplicateSegmentsRpc::Response& respHdr,
+    Rpc& rpc)
 {
-    i.next();
-
-    if (i.isDone())
-        return;
-
-    LogEntryType type = i.getType();
-    uint64_t objId = ~0UL, tblId = ~0UL;
-
-    if (type == LOG_ENTRY_TYPE_OBJ) {
-        const Object *recoverObj = reinterpret_cast<const Object *>(
-                     i.getPointer());
-        objId = recoverObj->id.objectId;
-        tblId = recoverObj->id.tableId;
-    } else if (type == LOG_ENTRY_TYPE_OBJTOMB) {
-        const ObjectTombstone *recoverTomb =
-            reinterpret_cast<const ObjectTombstone *>(i.getPointer());
-        objId = recoverTomb->id.objectId;
-        tblId = recoverTomb->id.tableId;
-    } else {
-        return;
-    }
-
-    objectMap.prefetchBucket(tblId, objId);
+    const uint64_t failedBackupId = reqHdr.backupId;
+    LOG(NOTICE, "Backup %lu failed, rereplicating segments elsewhere",
+        failedBackupId);
 }
 
 /**
- * Replay a filtered segment from a crashed Master that this Master is taking
- * over for.
+ * Set the list of tablets that this master serves.
  *
- * \param segmentId
- *      The segmentId of the segment as it was in the log of the crashed Master.
- * \param buffer 
- *      A pointer to a valid segment which has been pre-filtered of all
- *      objects except those that pertain to the tablet ranges this Master
- *      will be responsible for after the recovery completes.
- * \param bufferLength
- *      Length of the buffer in bytes.
+ * Notice that this method does nothing about the objects and data
+ * for a particular tablet.  That is, the log and hashtable must already
+ * contain a consistent view of the tablet before being set as an active
+ * tablet with this method.
+ *
+ * \param newTablets
+ *      The new set of tablets this master is serving.
  */
 void
-MasterService::recoverSegment(uint64_t segmentId, const void *buffer,
-                              uint32_t bufferLength)
+MasterService::setTablets(const ProtoBuf::Tablets& newTablets)
 {
-    uint64_t startReplicationTicks = metrics->master.replicaManagerTicks;
-    LOG(DEBUG, "recoverSegment %lu, ...", segmentId);
-    CycleCounter<RawMetric> _(&metrics->master.recoverSegmentTicks);
+    typedef std::map<uint32_t, Table*> Tables;
+    Tables tables;
 
-    RecoverySegmentIterator i(buffer, bufferLength);
-    RecoverySegmentIterator prefetch(buffer, bufferLength);
+    // create map from table ID to Table of pre-existing tables
+    foreach (const ProtoBuf::Tablets::Tablet& oldTablet, tablets.tablet()) {
+        tables[downCast<uint32_t>(oldTablet.table_id())] =
+            reinterpret_cast<Table*>(oldTablet.user_data());
+    }
 
-    uint64_t lastOffsetBackupProgress = 0;
-    while (!i.isDone()) {
-        LogEntryType type = i.getType();
+    // overwrite tablets with new tablets
+    tablets = newTablets;
 
-        if (i.getOffset() > lastOffsetBackupProgress + 50000) {
-            lastOffsetBackupProgress = i.getOffset();
-            replicaManager.proceed();
+    // delete pre-existing tables that no longer live here
+    foreach (Tables::value_type oldTable, tables) {
+        foreach (const ProtoBuf::Tablets::Tablet& newTablet,
+                 tablets.tablet()) {
+            if (oldTable.first == newTablet.table_id())
+                goto next;
         }
+        delete oldTable.second;
+        oldTable.second = NULL;
+      next:
+        { /* pass */ }
+    }
 
-        recoverSegmentPrefetcher(prefetch);
-
-        metrics->master.recoverySegmentEntryCount++;
-        metrics->master.recoverySegmentEntryBytes += i.getLength();
-
-        if (type == LOG_ENTRY_TYPE_OBJ) {
-            const Object *recoverObj = reinterpret_cast<const Object *>(
-                i.getPointer());
-            uint64_t objId = recoverObj->id.objectId;
-            uint64_t tblId = recoverObj->id.tableId;
-
-            const Object *localObj = NULL;
-            const ObjectTombstone *tomb = NULL;
-            LogEntryHandle handle = objectMap.lookup(tblId, objId);
-            if (handle != NULL) {
-                if (handle->type() == LOG_ENTRY_TYPE_OBJTOMB)
-                    tomb = handle->userData<ObjectTombstone>();
-                else
-                    localObj = handle->userData<Object>();
-            }
+    // create new Tables and assign all new tablets tables
+    LOG(NOTICE, "Now serving tablets:");
+    foreach (ProtoBuf::Tablets::Tablet& newTablet, *tablets.mutable_tablet()) {
+        LOG(NOTICE, "table: %20lu, start: %20lu, end  : %20lu",
+            newTablet.table_id(), newTablet.start_object_id(),
+            newTablet.end_object_id());
+        Table* table = tables[downCast<uint32_t>(newTablet.table_id())];
+        if (table == NULL) {
+            table = new Table(newTablet.table_id());
+            tables[downCast<uint32_t>(newTablet.table_id())] = table;
+        }
+        newTablet.set_user_data(reinterpret_cast<uint64_t>(table));
+    }
 
-            // can't have both a tombstone and an object in the hash tables
-            assert(tomb == NULL || localObj == NULL);
+    tabletIndex.rebuild(tablets);
+}
 
-            uint64_t minSuccessor = 0;
-            if (localObj != NULL)
-                minSuccessor = localObj->version + 1;
-            else if (tomb != NULL)
-                minSuccessor = tomb->objectVersion + 1;
+/**
+ * Start serving tablets this master has finished filling, by recovery,
+ * restart, or migration: mark them NORMAL, so that requests for them are
+ * no longer refused with STATUS_RETRY (see getTable()). The caller must
+ * hold #objectUpdateLock.
+ *
+ * \param filled
+ *      The tablets to mark; only their table and object ids are used.
+ */
+void
+MasterService::markTabletsNormal(const ProtoBuf::Tablets& filled)
+{
+    foreach (ProtoBuf::Tablets::Tablet& tablet, *tablets.mutable_tablet()) {
+        foreach (const ProtoBuf::Tablets::Tablet& f, filled.tablet()) {
+            if (tablet.table_id() == f.table_id() &&
+                tablet.start_object_id() == f.start_object_id() &&
+                tablet.end_object_id() == f.end_object_id())
+                tablet.set_state(ProtoBuf::Tablets::Tablet::NORMAL);
+        }
+    }
+    tabletIndex.rebuild(tablets);
+}
 
-            if (recoverObj->version >= minSuccessor) {
-                // write to log (with lazy backup flush) & update hash table
-                LogEntryHandle newObjHandle = log.append(LOG_ENTRY_TYPE_OBJ,
-                    recoverObj, i.getLength(), false, i.checksum());
-                ++metrics->master.objectAppendCount;
-                metrics->master.liveObjectBytes +=
-                    recoverObj->dataLength(i.getLength());
+/**
+ * Top-level server method to handle the SET_TABLETS request.
+ * \copydetails create
+ */
+void
+MasterService::setTablets(const SetTabletsRpc::Request& reqHdr,
+                          SetTabletsRpc::Response& respHdr,
+                          Rpc& rpc)
+{
+    ProtoBuf::Tablets newTablets;
+    ProtoBuf::parseFromRequest(rpc.requestPayload, sizeof(reqHdr),
+                               reqHdr.tabletsLength, newTablets);
+    setTablets(newTablets);
+}
 
-                // The TabletProfiler is updated asynchronously.
-                objectMap.replace(newObjHandle);
+/**
+ * Top-level server method to handle the TRANSACTION request, which
+ * atomically writes and removes a set of objects all owned by this master.
+ * Either every reject rule passes and every operation is applied, in a
+ * single append to the log, or nothing is changed and the response names
+ * the first object whose rule failed.
+ *
+ * \copydetails Service::ping
+ */
+void
+MasterService::transaction(const TransactionRpc::Request& reqHdr,
+                           TransactionRpc::Response& respHdr,
+                           Rpc& rpc)
+{
+    uint32_t count = reqHdr.count;
+    uint32_t offset = downCast<uint32_t>(sizeof(reqHdr));
+    Status status = checkTransaction(rpc.requestPayload, offset, count,
+                                     &respHdr.rejectedPart);
+    if (status == STATUS_OK) {
+        status = commitTransaction(rpc.requestPayload, offset, count,
+                                   rpc.replyPayload, &respHdr.rejectedPart,
+                                   &respHdr.rejectedVersion);
+    }
+    if (status != STATUS_OK) {
+        respHdr.common.status = status;
+        return;
+    }
+    respHdr.count = count;
+}
 
-                // The cleaner will figure out that the tombstone is dead.
+/**
+ * Top-level server method to handle the WRITE request.
+ * \copydetails create
+ */
+void
+MasterService::write(const WriteRpc::Request& reqHdr,
+                    WriteRpc::Response& respHdr,
+                    Rpc& rpc)
+{
+    uint32_t expiry = 0;
+    if (reqHdr.ttl != 0)
+        expiry = secondsTimestamp() + reqHdr.ttl;
+    Status status = storeData(reqHdr.tableId, reqHdr.id, &reqHdr.rejectRules,
+                              &rpc.requestPayload, sizeof(reqHdr),
+                              static_cast<uint32_t>(reqHdr.length),
+                              &respHdr.version, reqHdr.async,
+                              reqHdr.keyLength, expiry);
+    if (status != STATUS_OK) {
+        respHdr.common.status = status;
+        return;
+    }
+}
 
-                // nuke the old object, if it existed
-                if (localObj != NULL) {
-                    metrics->master.liveObjectBytes -=
-                        localObj->dataLength(handle->length());
-                    log.free(handle);
-                } else {
-                    ++metrics->master.liveObjectCount;
-                }
-            } else {
-                ++metrics->master.objectDiscardCount;
-            }
-        } else if (type == LOG_ENTRY_TYPE_OBJTOMB) {
-            const ObjectTombstone *recoverTomb =
-                reinterpret_cast<const ObjectTombstone *>(i.getPointer());
-            uint64_t objId = recoverTomb->id.objectId;
-            uint64_t tblId = recoverTomb->id.tableId;
+/**
+ * Ensures that this master owns the tablet for the given object
+ * and returns the corresponding Table.
+ *
+ * \param tableId
+ *      Identifier for a desired table.
+ * \param objectId
+ *      Identifier for a desired object.
+ * \param[out] normal
+ *      If not NULL and the tablet is found, whether it is NORMAL is
+ *      returned here. Requests for tablets this master is still filling,
+ *      by recovery, restart, or migration, must be refused with
+ *      STATUS_RETRY: clients with stale tablet maps may send them here
+ *      early.
+ *
+ * \return
+ *      The Table of which the tablet containing this object is a part,
+ *      or NULL if this master does not own the tablet.
+ */
+Table*
+MasterService::getTable(uint32_t tableId, uint64_t objectId, bool* normal) {
+    return tabletIndex.lookup(tableId, Object::tabletKey(objectId), NULL,
+                              normal);
+}
 
-            bool checksumIsValid = ({
-                CycleCounter<RawMetric> c(&metrics->master.verifyChecksumTicks);
-                i.isChecksumValid();
-            });
-            if (!checksumIsValid) {
-                LOG(WARNING, "invalid tombstone checksum! tbl: %lu, obj: %lu, "
-                    "ver: %lu", tblId, objId, recoverTomb->objectVersion);
-            }
+/**
+ * Check a set of RejectRules against the current state of an object
+ * to decide whether an operation is allowed.
+ *
+ * \param rejectRules
+ *      Specifies conditions under which the operation should fail.
+ * \param version
+ *      The current version of an object, or VERSION_NONEXISTENT
+ *      if the object does not currently exist (used to test rejectRules)
+ *
+ * \return
+ *      The return value is STATUS_OK if none of the reject rules
+ *      indicate that the operation should be rejected. Otherwise
+ *      the return value indicates the reason for the rejection.
+ */
+Status
+MasterService::rejectOperation(const RejectRules& rejectRules, uint64_t version)
+{
+    if (version == VERSION_NONEXISTENT) {
+        if (rejectRules.doesntExist)
+            return STATUS_OBJECT_DOESNT_EXIST;
+        return STATUS_OK;
+    }
+    if (rejectRules.exists)
+        return STATUS_OBJECT_DOESNT_EXIST;
+    if (rejectRules.versionLeGiven && version <= rejectRules.givenVersion)
+        return STATUS_WRONG_VERSION;
+    if (rejectRules.versionNeGiven && version != rejectRules.givenVersion)
+        return STATUS_WRONG_VERSION;
+    return STATUS_OK;
+}
 
-            const Object *localObj = NULL;
-            const ObjectTombstone *tomb = NULL;
-            LogEntryHandle handle = objectMap.lookup(tblId, objId);
-            if (handle != NULL) {
-                if (handle->type() == LOG_ENTRY_TYPE_OBJTOMB)
-                    tomb = handle->userData<ObjectTombstone>();
-                else
-                    localObj = handle->userData<Object>();
-            }
+/**
+ * Resend, as part of the current migration's next batch, up to a given
+ * number of objects updated since they were last copied. Objects that no
+ * longer exist are sent as tombstones so that the new owner removes any
+ * copy it already has. The caller must hold #objectUpdateLock.
+ *
+ * \param maxObjects
+ *      The most objects to copy before returning.
+ */
+void
+MasterService::copyDirtyObjects(uint32_t maxObjects)
+{
+    Table* table = tabletIndex.lookup(migration->tableId,
+                                      migration->firstId);
+    std::set<std::pair<uint64_t, uint64_t>>& dirty = migration->dirty;
+    for (uint32_t i = 0; i < maxObjects && !dirty.empty(); i++) {
+        uint64_t id = dirty.begin()->first;
+        uint64_t keyFingerprint = dirty.begin()->second;
+        dirty.erase(dirty.begin());
+
+        LogEntryHandle handle = objectMap.lookup(migration->tableId, id,
+                                                 KeyMatcher(keyFingerprint));
+        if (handle != NULL && handle->type() == LOG_ENTRY_TYPE_OBJ) {
+            appendMigrationEntry(migration->batch, handle);
+            continue;
+        }
 
-            // can't have both a tombstone and an object in the hash tables
-            assert(tomb == NULL || localObj == NULL);
+        // Every version the object could have had is below the table's
+        // clock, so this tombstone overrides whatever the new owner holds.
+        if (table == NULL)
+            continue;
+        DECLARE_OBJECT(removed, 0);
+        removed->id.tableId = migration->tableId;
+        removed->id.objectId = id;
+        removed->version = table->peekVersion() - 1;
+        ObjectTombstone tomb(0, removed);
+        tomb.keyFingerprint = keyFingerprint;
+        appendMigrationTombstone(migration->batch, tomb);
+    }
+}
 
-            uint64_t minSuccessor = 0;
-            if (localObj != NULL)
-                minSuccessor = localObj->version;
-            else if (tomb != NULL)
-                minSuccessor = tomb->objectVersion + 1;
+/**
+ * Record that an object was just created, overwritten or removed, so that
+ * an ongoing migration of its tablet resends it. The caller must hold
+ * #objectUpdateLock.
+ *
+ * \param tableId
+ *      The table containing the object.
+ * \param id
+ *      The object's identifier within the table.
+ * \param keyFingerprint
+ *      Object::keyFingerprint() of the object's string key, which tells it
+ *      apart from other objects whose keys hash to the same id.
+ */
+void
+MasterService::markMigrationDirty(uint64_t tableId, uint64_t id,
+                                  uint64_t keyFingerprint)
+{
+    if (migration && migration->contains(tableId, id))
+        migration->dirty.insert(std::make_pair(id, keyFingerprint));
+}
 
-            if (recoverTomb->objectVersion >= minSuccessor) {
-                ++metrics->master.tombstoneAppendCount;
-                LogEntryHandle newTomb = log.append(LOG_ENTRY_TYPE_OBJTOMB,
-                    recoverTomb, sizeof(*recoverTomb), false, i.checksum());
-                objectMap.replace(newTomb);
+/**
+ * Send the current migration's batch of log entries to the tablet's new
+ * owner and start a new batch.
+ *
+ * \param target
+ *      The tablet's new owner.
+ * \param done
+ *      Whether this is the last batch of the migration.
+ * \param tableVersion
+ *      If \a done, the version the table's master vector clock has
+ *      reached on this master; otherwise ignored.
+ */
+void
+MasterService::sendMigrationBatch(MasterClient& target, bool done,
+                                  uint64_t tableVersion)
+{
+    Buffer& batch = migration->batch;
+    uint32_t length = batch.getTotalLength();
+    target.receiveMigrationData(migration->tableId, migration->firstId,
+                                migration->lastId,
+                                length ? batch.getRange(0, length) : NULL,
+                                length, done, tableVersion);
+    metrics->master.migrationBytes += length;
+    batch.reset();
+}
 
-                // The cleaner will figure out that the tombstone is dead.
+/**
+ * Apply a callback to the entries in the next #MIGRATION_BUCKETS_PER_LOCK
+ * buckets of #objectMap, holding #objectUpdateLock and each bucket's lock
+ * while doing so. Callers loop until the whole table has been visited,
+ * releasing the locks between calls so updates are not held up for long.
+ * If the table is resized between calls some entries may be visited twice.
+ *
+ * \param bucket
+ *      The first bucket to visit; updated to the first bucket the next
+ *      call should visit. Start with 0.
+ * \param callback
+ *      Invoked with each entry and this MasterService.
+ * \return
+ *      True once every bucket has been visited.
+ */
+bool
+MasterService::visitObjectMapBuckets(uint64_t* bucket,
+                                     void (*callback)(LogEntryHandle, void*))
+{
+    std::lock_guard<SpinLock> updateLock(objectUpdateLock);
+    for (uint64_t i = 0; i < MIGRATION_BUCKETS_PER_LOCK; i++) {
+        if (*bucket >= objectMap.getNumBuckets())
+            return true;
+        std::lock_guard<SpinLock> bucketLock(
+            objectMap.getBucketLockByIndex(*bucket));
+        objectMap.forEachInBucket(callback, this, *bucket);
+        ++*bucket;
+    }
+    return *bucket >= objectMap.getNumBuckets();
+}
 
-                // nuke the object, if it existed
-                if (localObj != NULL) {
-                    --metrics->master.liveObjectCount;
-                    metrics->master.liveObjectBytes -=
-                        localObj->dataLength(handle->length());
-                    log.free(handle);
-                }
-            } else {
-                ++metrics->master.tombstoneDiscardCount;
-            }
+/**
+ * Validate the parts of a TRANSACTION or PREPARE_TRANSACTION request
+ * before anything is staged, so that they can be applied all or nothing.
+ *
+ * \param parts
+ *      Holds the TransactionRpc::Request::Parts and their values.
+ * \param offset
+ *      Offset of the first part in \a parts.
+ * \param count
+ *      Number of parts.
+ * \param[out] rejectedPart
+ *      Set to the index of the offending part on STATUS_REQUEST_FORMAT_ERROR.
+ * \return
+ *      STATUS_OK, STATUS_MESSAGE_TOO_SHORT if the parts run past the end of
+ *      \a parts, or STATUS_REQUEST_FORMAT_ERROR if an object is named twice,
+ *      a remove carries a value, or the whole transaction (or, once
+ *      prepared, its TransactionIntents) would not fit in one log segment.
+ */
+Status
+MasterService::checkTransaction(Buffer& parts, uint32_t offset,
+                                uint32_t count, uint32_t* rejectedPart)
+{
+    uint32_t partLength = downCast<uint32_t>(
+                                sizeof(TransactionRpc::Request::Part));
+    uint64_t limit = Segment::maximumAppendableBytes(
+                                        log.getSegmentCapacity());
+    // A prepared transaction commits with its TransactionDecision, which
+    // names at most one segment per part.
+    uint64_t totalBytes = TransactionDecision::length(count) +
+                          sizeof(SegmentEntry);
+    uint64_t intentBytes = 0;
+    std::set<std::pair<uint32_t, uint64_t>> seen;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const TransactionRpc::Request::Part* part =
+            parts.getOffset<TransactionRpc::Request::Part>(offset);
+        if (part == NULL ||
+                uint64_t(offset) + partLength + part->length >
+                parts.getTotalLength())
+            return STATUS_MESSAGE_TOO_SHORT;
+        offset += partLength + part->length;
+
+        // Mirrors the worst case LogBatch::makeRoom() allows for.
+        totalBytes += sizeof(ObjectTombstone) + 2 * sizeof(SegmentEntry);
+        if (!part->remove)
+            totalBytes += sizeof(Object) + part->length;
+        intentBytes += sizeof(TransactionIntent) + partLength + part->length +
+                       sizeof(SegmentEntry);
+        if ((part->remove && part->length != 0) ||
+                !seen.insert(std::make_pair(part->tableId, part->id)).second ||
+                totalBytes > limit || intentBytes > limit) {
+            *rejectedPart = i;
+            return STATUS_REQUEST_FORMAT_ERROR;
         }
+    }
+    return STATUS_OK;
+}
 
-        i.next();
+/**
+ * Apply the parts of a transaction already vetted by checkTransaction(),
+ * all or nothing, and sync them to backups.
+ *
+ * \param parts
+ *      Holds the TransactionRpc::Request::Parts and their values.
+ * \param offset
+ *      Offset of the first part in \a parts.
+ * \param count
+ *      Number of parts.
+ * \param reply
+ *      On success, one uint64_t version per part is appended here, as
+ *      described in TransactionRpc::Response.
+ * \param[out] rejectedPart
+ *      See stageTransaction().
+ * \param[out] rejectedVersion
+ *      See stageTransaction().
+ * \param decision
+ *      If non-NULL, the TransactionDecision of a prepared transaction,
+ *      which is logged in the same append as the parts.
+ * \return
+ *      STATUS_OK if every part was applied. Otherwise nothing was changed:
+ *      either a reject rule failed (see stageTransaction()) or the log is
+ *      out of memory (STATUS_RETRY).
+ */
+Status
+MasterService::commitTransaction(Buffer& parts, uint32_t offset,
+                                 uint32_t count, Buffer& reply,
+                                 uint32_t* rejectedPart,
+                                 uint64_t* rejectedVersion,
+                                 const TransactionDecision* decision)
+{
+    LogBatch batch(*this, count, true);
+    std::unique_ptr<Status[]> statuses(new Status[count]);
+    std::unique_ptr<uint64_t[]> versions(new uint64_t[count]);
+    Status status = stageTransaction(parts, offset, count, batch,
+                                     statuses.get(), versions.get(),
+                                     rejectedPart, rejectedVersion);
+    if (status != STATUS_OK) {
+        batch.discard();
+        return status;
     }
-    LOG(DEBUG, "Segment %lu replay complete", segmentId);
-    metrics->master.backupInRecoverTicks +=
-        metrics->master.replicaManagerTicks - startReplicationTicks;
+
+    // The batch goes to the log in one multiAppend, so either every
+    // operation fails here or none does.
+    if (decision != NULL) {
+        batch.append(LOG_ENTRY_TYPE_TXDECISION, decision,
+                     TransactionDecision::length(decision->segmentCount));
+    }
+    batch.flush(true);
+    for (uint32_t i = 0; i < count; i++) {
+        if (statuses[i] != STATUS_OK)
+            return statuses[i];
+    }
+    for (uint32_t i = 0; i < count; i++)
+        new(&reply, APPEND) uint64_t(versions[i]);
+    return STATUS_OK;
 }
 
 /**
- * Top-level server method to handle the REMOVE request.
- * \copydetails create
+ * Lock or unlock the objects named by a prepared transaction; see
+ * #transactionLocks.
+ *
+ * \param parts
+ *      PreparedTransaction::parts of the transaction.
+ * \param count
+ *      Number of parts.
+ * \param lock
+ *      True to lock the objects, false to unlock them.
  */
 void
-MasterService::remove(const RemoveRpc::Request& reqHdr,
-                      RemoveRpc::Response& respHdr,
-                      Rpc& rpc)
+MasterService::lockTransaction(Buffer& parts, uint32_t count, bool lock)
 {
-    Table* table = getTable(reqHdr.tableId, reqHdr.id);
-    if (table == NULL) {
-        respHdr.common.status = STATUS_TABLE_DOESNT_EXIST;
-        return;
-    }
-    LogEntryHandle handle = objectMap.lookup(reqHdr.tableId, reqHdr.id);
-    if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ) {
-        Status status = rejectOperation(reqHdr.rejectRules,
-                                        VERSION_NONEXISTENT);
-        if (status != STATUS_OK)
-            respHdr.common.status = status;
-        return;
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const TransactionRpc::Request::Part* part =
+            parts.getOffset<TransactionRpc::Request::Part>(offset);
+        offset += downCast<uint32_t>(sizeof(*part)) + part->length;
+        auto key = std::make_pair(part->tableId, part->id);
+        if (lock)
+            transactionLocks.insert(key);
+        else
+            transactionLocks.erase(key);
     }
+}
 
-    const Object *obj = handle->userData<Object>();
-    respHdr.version = obj->version;
+/**
+ * Apply the outcome of a prepared transaction, unlock its objects, and
+ * log a TransactionDecision so that its TransactionIntents aren't replayed
+ * by recovery. The caller must hold #objectUpdateLock, and must sync the
+ * log before reporting the outcome (see #logSyncPending).
+ *
+ * \param transactionId
+ *      A transaction in #preparedTransactions.
+ * \param commit
+ *      True to commit the transaction, false to abort it.
+ * \param reply
+ *      After a commit, one uint64_t version per part is appended here, as
+ *      described in TransactionRpc::Response.
+ * \return
+ *      STATUS_OK if the transaction was decided, or STATUS_RETRY if the
+ *      log is out of memory and it stays prepared.
+ */
+Status
+MasterService::decidePreparedTransaction(uint64_t transactionId, bool commit,
+                                         Buffer& reply)
+{
+    auto it = preparedTransactions.find(transactionId);
+    assert(it != preparedTransactions.end());
+    PreparedTransaction& prepared = *it->second;
+
+    std::set<uint64_t> segmentIds;
+    foreach (LogEntryHandle intent, prepared.intents)
+        segmentIds.insert(log.getSegmentId(intent));
+    uint32_t length = TransactionDecision::length(
+                                    downCast<uint32_t>(segmentIds.size()));
+    std::unique_ptr<char[]> storage(new char[length]);
+    TransactionDecision* decision = new(storage.get()) TransactionDecision(
+        transactionId, commit, downCast<uint32_t>(segmentIds.size()));
+    std::copy(segmentIds.begin(), segmentIds.end(), decision->segmentIds);
+
+    lockTransaction(prepared.parts, prepared.count, false);
+    if (commit) {
+        uint32_t rejectedPart;
+        uint64_t rejectedVersion;
+        Status status = commitTransaction(prepared.parts, 0, prepared.count,
+                                          reply, &rejectedPart,
+                                          &rejectedVersion, decision);
+        if (status != STATUS_OK) {
+            lockTransaction(prepared.parts, prepared.count, true);
+            return status;
+        }
+    } else {
+        try {
+            log.append(LOG_ENTRY_TYPE_TXDECISION, decision, length, false);
+            logSyncPending = true;
+        } catch (LogOutOfMemoryException& e) {
+            // Without the decision, recovery would ask the coordinator
+            // about the transaction, and be told to abort it: nobody
+            // records a commit once a master has been told to abort.
+        }
+    }
+    preparedTransactions.erase(it);
+    return STATUS_OK;
+}
 
-    // Abort if we're trying to delete the wrong version.
-    Status status = rejectOperation(reqHdr.rejectRules, respHdr.version);
-    if (status != STATUS_OK) {
-        respHdr.common.status = status;
+/**
+ * Find the prepared transactions whose leases have run out, because their
+ * clients have gone quiet or they were recovered from another master's
+ * log, and renew their leases so that only one thread resolves each, and
+ * it tries again later if it fails. Called with #objectUpdateLock held
+ * before each update is handled; the caller then passes them to
+ * resolveTransactions().
+ *
+ * \param[out] expired
+ *      The ids of the transactions found are appended here.
+ */
+void
+MasterService::findExpiredTransactions(vector<uint64_t>& expired)
+{
+    if (preparedTransactions.empty())
         return;
+    uint64_t now = Cycles::rdtsc();
+    foreach (auto& entry, preparedTransactions) {
+        PreparedTransaction& prepared = *entry.second;
+        if (now <= prepared.expiryTime)
+            continue;
+        prepared.expiryTime = now +
+            Cycles::fromNanoseconds(PrepareTransactionRpc::LEASE_NS);
+        expired.push_back(entry.first);
     }
+}
 
-    ObjectTombstone tomb(log.getSegmentId(obj), obj);
+/**
+ * Learn the outcome of prepared transactions from the coordinator and
+ * apply it, so that a client that vanishes between PREPARE_TRANSACTION and
+ * DECIDE_TRANSACTION can't lock their objects forever. The coordinator is
+ * asked to record an abort, but if the client recorded a commit first the
+ * transaction commits here too. Must be called without #objectUpdateLock
+ * held.
+ *
+ * \param expired
+ *      Transactions returned by findExpiredTransactions(). Any that have
+ *      been decided meanwhile are skipped.
+ */
+void
+MasterService::resolveTransactions(const vector<uint64_t>& expired)
+{
+    foreach (uint64_t transactionId, expired) {
+        Tub<bool> commit;
+        try {
+            commit.construct(coordinator->setTransactionOutcome(transactionId,
+                                                                false));
+        } catch (ClientException& e) {
+            LOG(WARNING, "Couldn't learn the outcome of transaction %lu: %s",
+                transactionId, e.str().c_str());
+        } catch (TransportException& e) {
+            LOG(WARNING, "Couldn't learn the outcome of transaction %lu: %s",
+                transactionId, e.str().c_str());
+        }
 
-    // Write the tombstone into the Log, increment the tablet version
-    // number, and remove from the hash table.
-    try {
-        log.append(LOG_ENTRY_TYPE_OBJTOMB, &tomb, sizeof(tomb));
-    } catch (LogException& e) {
-        // The log is out of space. Tell the client to retry and hope
-        // that either the cleaner makes space soon or we shift load
-        // off of this server.
-        respHdr.common.status = STATUS_RETRY;
-        return;
+        LogTime syncTime;
+        {
+            std::lock_guard<SpinLock> lock(objectUpdateLock);
+            auto it = preparedTransactions.find(transactionId);
+            if (it == preparedTransactions.end() || !commit)
+                continue;
+            LOG(NOTICE, "Transaction %lu %s: its client never decided it",
+                transactionId, *commit ? "commits" : "aborts");
+            Buffer reply;
+            decidePreparedTransaction(transactionId, *commit, reply);
+            if (logSyncPending)
+                syncTime = log.getHeadLogTime();
+        }
+        if (logSyncPending) {
+            logSyncPending = false;
+            log.sync(syncTime);
+        }
     }
-
-    table->RaiseVersion(obj->version + 1);
-    log.free(handle);
-    objectMap.remove(reqHdr.tableId, reqHdr.id);
 }
 
-
 /**
- * Top-level server method to handle the REREPLICATE_SEGMENTS request.
- * Using the server id of a crashed backup from #reqHdr this MasterService
- * rereplicates any live segments it had stored on that backup to new backups
- * in order to maintain any replication requirements after a backup failure.
+ * Log a TransactionIntent for each of a run of parts of a prepared
+ * transaction, in one append, and add them to PreparedTransaction::intents.
+ * The caller must hold #objectUpdateLock, and must sync the log before
+ * relying on the intents (see #logSyncPending).
  *
- * \copydetails Service::ping
+ * \param transactionId
+ *      The transaction's id.
+ * \param prepared
+ *      The transaction. The intents become live when it is added to
+ *      #preparedTransactions, if it isn't there already.
+ * \param offset
+ *      Offset in PreparedTransaction::parts of the first part to log.
+ * \param count
+ *      Number of parts to log; checkTransaction() ensures they fit in a
+ *      segment.
+ * \throw LogOutOfMemoryException
+ *      The log is out of memory; nothing was logged.
  */
 void
-MasterService::rereplicateSegments(
-    const RereplicateSegmentsRpc::Request& reqHdr,
-    RereplicateSegmentsRpc::Response& respHdr,
-    Rpc& rpc)
+MasterService::logTransactionIntents(uint64_t transactionId,
+                                     PreparedTransaction& prepared,
+                                     uint32_t offset, uint32_t count)
 {
-    const uint64_t failedBackupId = reqHdr.backupId;
-    LOG(NOTICE, "Backup %lu failed, rereplicating segments elsewhere",
-        failedBackupId);
+    std::unique_ptr<Tub<TransactionIntent>[]> intents(
+        new Tub<TransactionIntent>[count]);
+    LogMultiAppendVector appends;
+    for (uint32_t i = 0; i < count; i++) {
+        const TransactionRpc::Request::Part* part =
+            prepared.parts.getOffset<TransactionRpc::Request::Part>(offset);
+        uint32_t length = downCast<uint32_t>(sizeof(*part)) + part->length;
+        intents[i].construct(part->tableId, part->id, transactionId);
+        appends.push_back({ LOG_ENTRY_TYPE_TXINTENT,
+                            intents[i].get(),
+                            downCast<uint32_t>(sizeof(TransactionIntent)),
+                            &prepared.parts,
+                            offset,
+                            length });
+        offset += length;
+    }
+    LogEntryHandleVector handles = log.multiAppend(appends, false);
+    prepared.intents.insert(prepared.intents.end(),
+                            handles.begin(), handles.end());
 }
 
 /**
- * Set the list of tablets that this master serves.
+ * Return whether a prepared transaction locks any object in a tablet.
+ * The caller must hold #objectUpdateLock.
  *
- * Notice that this method does nothing about the objects and data
- * for a particular tablet.  That is, the log and hashtable must already
- * contain a consistent view of the tablet before being set as an active
- * tablet with this method.
+ * \param tableId
+ *      The table containing the tablet.
+ * \param firstId
+ *      Identifier of the first object in the tablet.
+ * \param lastId
+ *      Identifier of the last object in the tablet.
+ */
+bool
+MasterService::preparedInTablet(uint32_t tableId, uint64_t firstId,
+                                uint64_t lastId) const
+{
+    foreach (const auto& key, transactionLocks) {
+        uint64_t tabletKey = Object::tabletKey(key.second);
+        if (key.first == tableId && tabletKey >= firstId &&
+            tabletKey <= lastId)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Hold the transactions found undecided by a log replay prepared here, as
+ * the master that logged them did; see recoverSegment(). No client will
+ * decide them here, so the coordinator is asked for their outcomes as soon
+ * as updates arrive. Their intents are logged again, since the log they
+ * came from is going away. The caller must hold #objectUpdateLock, and
+ * must sync the log before serving the tablets replayed.
  *
- * \param newTablets
- *      The new set of tablets this master is serving.
+ * \param transactions
+ *      What the replay found.
  */
 void
-MasterService::setTablets(const ProtoBuf::Tablets& newTablets)
+MasterService::restorePreparedTransactions(RecoveredTransactions& transactions)
 {
-    typedef std::map<uint32_t, Table*> Tables;
-    Tables tables;
+    foreach (auto& entry, transactions) {
+        uint64_t transactionId = entry.first;
+        RecoveredTransaction& recovered = entry.second;
+        if (recovered.decided || recovered.parts.empty())
+            continue;
 
-    // create map from table ID to Table of pre-existing tables
-    foreach (const ProtoBuf::Tablets::Tablet& oldTablet, tablets.tablet()) {
-        tables[downCast<uint32_t>(oldTablet.table_id())] =
-            reinterpret_cast<Table*>(oldTablet.user_data());
+        // This master may have prepared its own share of the transaction;
+        // the recovered parts then follow it, so that the versions that
+        // decideTransaction() returns for it still come first.
+        std::unique_ptr<PreparedTransaction>& prepared =
+            preparedTransactions[transactionId];
+        if (!prepared)
+            prepared.reset(new PreparedTransaction());
+        uint32_t offset = prepared->parts.getTotalLength();
+        foreach (auto& part, recovered.parts) {
+            uint32_t length = downCast<uint32_t>(part.second.size());
+            memcpy(new(&prepared->parts, APPEND) char[length],
+                   part.second.data(), length);
+        }
+        uint32_t count = downCast<uint32_t>(recovered.parts.size());
+        logTransactionIntents(transactionId, *prepared, offset, count);
+        prepared->count += count;
+        prepared->expiryTime = 0;
+        lockTransaction(prepared->parts, prepared->count, true);
+        LOG(NOTICE, "Recovered %u objects of undecided transaction %lu",
+            count, transactionId);
     }
+    transactions.clear();
+}
 
-    // overwrite tablets with new tablets
-    tablets = newTablets;
+/**
+ * Stage every part of a transaction in an all-or-nothing LogBatch,
+ * stopping at the first one that can't be applied.
+ *
+ * \param parts
+ *      Holds the TransactionRpc::Request::Parts and their values. Must
+ *      stay valid until \a batch is flushed or discarded.
+ * \param offset
+ *      Offset of the first part in \a parts.
+ * \param count
+ *      Number of parts.
+ * \param batch
+ *      Batch to stage the parts in. The caller flushes or discards it.
+ * \param[out] statuses
+ *      Room for \a count statuses, which the batch fills in.
+ * \param[out] versions
+ *      Room for \a count versions, which the batch fills in.
+ * \param[out] rejectedPart
+ *      Index of the part that couldn't be applied, if any.
+ * \param[out] rejectedVersion
+ *      Current version of that part's object, or VERSION_NONEXISTENT.
+ * \return
+ *      STATUS_OK if every part was staged, otherwise the status of the
+ *      rejected part, for instance STATUS_WRONG_VERSION or STATUS_RETRY if
+ *      its object is locked by another transaction.
+ */
+Status
+MasterService::stageTransaction(Buffer& parts, uint32_t offset,
+                                uint32_t count, LogBatch& batch,
+                                Status statuses[], uint64_t versions[],
+                                uint32_t* rejectedPart,
+                                uint64_t* rejectedVersion)
+{
+    uint32_t partLength = downCast<uint32_t>(
+                                sizeof(TransactionRpc::Request::Part));
+    for (uint32_t i = 0; i < count; i++) {
+        const TransactionRpc::Request::Part* part =
+            parts.getOffset<TransactionRpc::Request::Part>(offset);
+        offset += partLength;
+
+        statuses[i] = STATUS_OK;
+        versions[i] = VERSION_NONEXISTENT;
+        if (part->remove) {
+            batch.remove(part->tableId, part->id, part->rejectRules,
+                         &statuses[i], &versions[i]);
+        } else {
+            batch.write(part->tableId, part->id, part->rejectRules,
+                        &parts, offset, part->length,
+                        &statuses[i], &versions[i]);
+        }
+        offset += part->length;
 
-    // delete pre-existing tables that no longer live here
-    foreach (Tables::value_type oldTable, tables) {
-        foreach (const ProtoBuf::Tablets::Tablet& newTablet,
-                 tablets.tablet()) {
-            if (oldTable.first == newTablet.table_id())
-                goto next;
+        if (statuses[i] != STATUS_OK) {
+            *rejectedPart = i;
+            *rejectedVersion = versions[i];
+            return statuses[i];
         }
-        delete oldTable.second;
-        oldTable.second = NULL;
-      next:
-        { /* pass */ }
     }
+    return STATUS_OK;
+}
 
-    // create new Tables and assign all new tablets tables
-    LOG(NOTICE, "Now serving tablets:");
-    foreach (ProtoBuf::Tablets::Tablet& newTablet, *tablets.mutable_tablet()) {
-        LOG(NOTICE, "table: %20lu, start: %20lu, end  : %20lu",
-            newTablet.table_id(), newTablet.start_object_id(),
-            newTablet.end_object_id());
-        Table* table = tables[downCast<uint32_t>(newTablet.table_id())];
-        if (table == NULL) {
-            table = new Table(newTablet.table_id());
-            tables[downCast<uint32_t>(newTablet.table_id())] = table;
+/**
+ * Construct an empty batch.
+ *
+ * \param service
+ *      The master whose log and objectMap the batch updates.
+ * \param maxOperations
+ *      The number of write and remove calls that will be made on this
+ *      batch; storage for that many objects is reserved up front.
+ * \param allOrNothing
+ *      If true, the caller guarantees that the operations staged fit in
+ *      one segment and name no object twice, so that they are all applied
+ *      by the same #flush (or all dropped by #discard).
+ */
+MasterService::LogBatch::LogBatch(MasterService& service,
+                                  uint32_t maxOperations,
+                                  bool allOrNothing)
+    : service(service)
+    , objects(new Tub<Object>[maxOperations])
+    , tombstones(new Tub<ObjectTombstone>[maxOperations])
+    , nextSlot(0)
+    , appends()
+    , appendBytes(0)
+    , operations()
+    , keys()
+    , allOrNothing(allOrNothing)
+{
+}
+
+/**
+ * Stage a write of one object. See MasterService::storeData for the
+ * semantics; the outcome is reported through \a status and \a version when
+ * the batch is flushed, or immediately if the write is rejected.
+ *
+ * \param tableId
+ *      The table in which to store the object.
+ * \param id
+ *      Identifier within the table of the object to be written.
+ * \param rejectRules
+ *      Specifies conditions under which the write should be aborted.
+ * \param data
+ *      Contains the object's value. Must stay valid until #flush.
+ * \param dataOffset
+ *      The offset into \a data where the value begins.
+ * \param dataLength
+ *      The size in bytes of the value.
+ * \param[out] status
+ *      Result of the write.
+ * \param[out] version
+ *      The new version of the object if the write succeeds; otherwise its
+ *      current version, or VERSION_NONEXISTENT.
+ */
+void
+MasterService::LogBatch::write(uint32_t tableId, uint64_t id,
+                               const RejectRules& rejectRules, Buffer* data,
+                               uint32_t dataOffset, uint32_t dataLength,
+                               Status* status, uint64_t* version)
+{
+    bool normal;
+    Table* table = service.getTable(tableId, id, &normal);
+    if (table == NULL) {
+        *status = STATUS_TABLE_DOESNT_EXIST;
+        return;
+    }
+    if (!normal || service.updateBlocked(tableId, id)) {
+        *status = STATUS_RETRY;
+        return;
+    }
+
+    if (!service.anyWrites)
+        service.openBackupSessions();
+
+    makeRoom(tableId, id, downCast<uint32_t>(sizeof(ObjectTombstone) +
+                                             sizeof(Object)) + dataLength);
+
+    const Object *obj = NULL;
+    LogEntryHandle handle = service.objectMap.lookup(tableId, id,
+                                                     KeyMatcher());
+    if (handle != NULL) {
+        if (handle->type() == LOG_ENTRY_TYPE_OBJTOMB) {
+            std::lock_guard<SpinLock> lock(
+                service.objectMap.getBucketLock(tableId, id));
+            recoveryCleanup(handle, &service);
+            handle = NULL;
+        } else {
+            assert(handle->type() == LOG_ENTRY_TYPE_OBJ);
+            obj = handle->userData<Object>();
         }
-        newTablet.set_user_data(reinterpret_cast<uint64_t>(table));
     }
+
+    // An expired object is still overwritten (and given a tombstone) like
+    // any other, but to the client it no longer exists.
+    uint64_t currentVersion = (obj != NULL && !obj->isExpired()) ?
+                              obj->version : VERSION_NONEXISTENT;
+    *status = service.rejectOperation(rejectRules, currentVersion);
+    if (*status != STATUS_OK) {
+        *version = currentVersion;
+        return;
+    }
+
+    uint32_t slot = nextSlot++;
+    if (obj != NULL) {
+        tombstones[slot].construct(service.log.getSegmentId(obj), obj);
+        appends.push_back({ LOG_ENTRY_TYPE_OBJTOMB,
+                            tombstones[slot].get(),
+                            sizeof(ObjectTombstone) });
+        appendBytes += downCast<uint32_t>(sizeof(SegmentEntry) +
+                                          sizeof(ObjectTombstone));
+    }
+
+    Object* newObject = objects[slot].construct(sizeof(Object));
+    newObject->id.objectId = id;
+    newObject->id.tableId = tableId;
+    if (obj != NULL)
+        newObject->version = obj->version + 1;
+    else
+        newObject->version = table->AllocateVersion();
+    assert(obj == NULL || newObject->version > obj->version);
+
+    appends.push_back({ LOG_ENTRY_TYPE_OBJ,
+                        newObject,
+                        newObject->objectLength(0),
+                        data,
+                        dataOffset,
+                        dataLength });
+    appendBytes += downCast<uint32_t>(sizeof(SegmentEntry)) +
+                   newObject->objectLength(dataLength);
+
+    Operation operation = { tableId, id, table, handle,
+                            downCast<uint32_t>(appends.size() - 1),
+                            dataLength, newObject->version, status,
+                            version };
+    operations.push_back(operation);
+    keys.insert(std::make_pair(tableId, id));
 }
 
 /**
- * Top-level server method to handle the SET_TABLETS request.
- * \copydetails create
+ * Stage the removal of one object. See MasterService::remove for the
+ * semantics; the outcome is reported through \a status and \a version.
+ *
+ * \param tableId
+ *      The table containing the object to be removed.
+ * \param id
+ *      Identifier within the table of the object to be removed.
+ * \param rejectRules
+ *      Specifies conditions under which the removal should be aborted.
+ * \param[out] status
+ *      Result of the removal.
+ * \param[out] version
+ *      The version of the object prior to removal, or VERSION_NONEXISTENT
+ *      if it didn't exist.
  */
 void
-MasterService::setTablets(const SetTabletsRpc::Request& reqHdr,
-                          SetTabletsRpc::Response& respHdr,
-                          Rpc& rpc)
+MasterService::LogBatch::remove(uint32_t tableId, uint64_t id,
+                                const RejectRules& rejectRules,
+                                Status* status, uint64_t* version)
 {
-    ProtoBuf::Tablets newTablets;
-    ProtoBuf::parseFromRequest(rpc.requestPayload, sizeof(reqHdr),
-                               reqHdr.tabletsLength, newTablets);
-    setTablets(newTablets);
+    bool normal;
+    Table* table = service.getTable(tableId, id, &normal);
+    if (table == NULL) {
+        *status = STATUS_TABLE_DOESNT_EXIST;
+        return;
+    }
+    if (!normal || service.updateBlocked(tableId, id)) {
+        *status = STATUS_RETRY;
+        return;
+    }
+
+    makeRoom(tableId, id, downCast<uint32_t>(sizeof(ObjectTombstone)));
+
+    LogEntryHandle handle = service.objectMap.lookup(tableId, id,
+                                                     KeyMatcher());
+    if (handle == NULL || handle->type() != LOG_ENTRY_TYPE_OBJ ||
+        handle->userData<Object>()->isExpired()) {
+        *status = service.rejectOperation(rejectRules, VERSION_NONEXISTENT);
+        return;
+    }
+
+    const Object *obj = handle->userData<Object>();
+    *version = obj->version;
+
+    // Abort if we're trying to delete the wrong version.
+    *status = service.rejectOperation(rejectRules, obj->version);
+    if (*status != STATUS_OK)
+        return;
+
+    uint32_t slot = nextSlot++;
+    tombstones[slot].construct(service.log.getSegmentId(obj), obj);
+    appends.push_back({ LOG_ENTRY_TYPE_OBJTOMB,
+                        tombstones[slot].get(),
+                        sizeof(ObjectTombstone) });
+    appendBytes += downCast<uint32_t>(sizeof(SegmentEntry) +
+                                      sizeof(ObjectTombstone));
+
+    Operation operation = { tableId, id, table, handle, NO_OBJECT, 0,
+                            obj->version, status, NULL };
+    operations.push_back(operation);
+    keys.insert(std::make_pair(tableId, id));
 }
 
 /**
- * Top-level server method to handle the WRITE request.
- * \copydetails create
+ * Stage a log entry that isn't an object or tombstone, such as a
+ * TransactionDecision, to be appended along with the batch's operations.
+ * Only all-or-nothing batches take them, since the entry never causes an
+ * early #flush.
+ *
+ * \param type
+ *      The type of the entry.
+ * \param buffer
+ *      The entry's contents. Must stay valid until #flush.
+ * \param length
+ *      The size in bytes of the entry.
  */
 void
-MasterService::write(const WriteRpc::Request& reqHdr,
-                    WriteRpc::Response& respHdr,
-                    Rpc& rpc)
+MasterService::LogBatch::append(LogEntryType type, const void* buffer,
+                                uint32_t length)
 {
-    Status status = storeData(reqHdr.tableId, reqHdr.id, &reqHdr.rejectRules,
-                              &rpc.requestPayload, sizeof(reqHdr),
-                              static_cast<uint32_t>(reqHdr.length),
-                              &respHdr.version, reqHdr.async);
-    if (status != STATUS_OK) {
-        respHdr.common.status = status;
-        return;
-    }
+    assert(allOrNothing);
+    appends.push_back({ type, buffer, length });
+    appendBytes += downCast<uint32_t>(sizeof(SegmentEntry)) + length;
 }
 
 /**
- * Ensures that this master owns the tablet for the given object
- * and returns the corresponding Table.
- *
- * \param tableId
- *      Identifier for a desired table.
- * \param objectId
- *      Identifier for a desired object.
+ * Append every staged entry to the log as a single multiAppend and then
+ * apply the staged operations to the objectMap. If the log is out of
+ * memory, every staged operation fails with STATUS_RETRY instead.
  *
- * \return
- *      The Table of which the tablet containing this object is a part,
- *      or NULL if this master does not own the tablet.
+ * \param sync
+ *      If true, this batch and everything flushed before it will be durable
+ *      on backups before the reply is sent (see #logSyncPending).
  */
-Table*
-MasterService::getTable(uint32_t tableId, uint64_t objectId) {
+void
+MasterService::LogBatch::flush(bool sync)
+{
+    LogEntryHandleVector handles;
+    if (!appends.empty()) {
+        try {
+            handles = service.log.multiAppend(appends, false);
+        } catch (LogOutOfMemoryException& e) {
+            // The log is out of space. Tell the client to retry and hope
+            // that either the cleaner makes space soon or we shift load
+            // off of this server.
+            foreach (Operation& operation, operations)
+                *operation.status = STATUS_RETRY;
+        }
+    }
 
-    foreach (const ProtoBuf::Tablets::Tablet& tablet, tablets.tablet()) {
-        if (tablet.table_id() == tableId &&
-            tablet.start_object_id() <= objectId &&
-            objectId <= tablet.end_object_id()) {
-            return reinterpret_cast<Table*>(tablet.user_data());
+    if (!handles.empty()) {
+        foreach (Operation& operation, operations) {
+            if (operation.objectIndex != NO_OBJECT) {
+                {
+                    std::lock_guard<SpinLock> lock(
+                        service.objectMap.getBucketLock(operation.tableId,
+                                                        operation.id));
+                    service.objectMap.replace(
+                        handles[operation.objectIndex],
+                        SameReferent(operation.oldHandle));
+                }
+                service.markMigrationDirty(operation.tableId, operation.id,
+                                           0);
+                if (operation.oldHandle != NULL)
+                    service.log.free(operation.oldHandle);
+                *operation.newVersion = operation.version;
+                service.bytesWritten += operation.dataLength;
+            } else {
+                operation.table->RaiseVersion(operation.version + 1);
+                service.log.free(operation.oldHandle);
+                std::lock_guard<SpinLock> lock(
+                    service.objectMap.getBucketLock(operation.tableId,
+                                                    operation.id));
+                service.objectMap.remove(operation.tableId, operation.id,
+                                         SameReferent(operation.oldHandle));
+                service.markMigrationDirty(operation.tableId, operation.id,
+                                           0);
+            }
         }
     }
-    return NULL;
+
+    discard();
+
+    if (sync)
+        logSyncPending = true;
 }
 
 /**
- * Check a set of RejectRules against the current state of an object
- * to decide whether an operation is allowed.
- *
- * \param rejectRules
- *      Specifies conditions under which the operation should fail.
- * \param version
- *      The current version of an object, or VERSION_NONEXISTENT
- *      if the object does not currently exist (used to test rejectRules)
+ * Drop every staged operation without applying it. Their outcomes, as
+ * reported when they were staged, are left for the caller to override.
+ */
+void
+MasterService::LogBatch::discard()
+{
+    appends.clear();
+    appendBytes = 0;
+    operations.clear();
+    keys.clear();
+}
+
+/**
+ * Flush the batch first if adding an entry for the given object would make
+ * it too large to append to a single segment, or if the object already has
+ * an operation staged (later operations must see the effect of earlier
+ * ones).
  *
- * \return
- *      The return value is STATUS_OK if none of the reject rules
- *      indicate that the operation should be rejected. Otherwise
- *      the return value indicates the reason for the rejection.
+ * \param tableId
+ *      Table of the object about to be staged.
+ * \param id
+ *      Identifier of the object about to be staged.
+ * \param entryBytes
+ *      Upper bound on the bytes of log entries that will be staged for it,
+ *      not counting entry headers.
  */
-Status
-MasterService::rejectOperation(const RejectRules& rejectRules, uint64_t version)
+void
+MasterService::LogBatch::makeRoom(uint32_t tableId, uint64_t id,
+                                  uint32_t entryBytes)
 {
-    if (version == VERSION_NONEXISTENT) {
-        if (rejectRules.doesntExist)
-            return STATUS_OBJECT_DOESNT_EXIST;
-        return STATUS_OK;
+    uint32_t limit = Segment::maximumAppendableBytes(
+                                        service.log.getSegmentCapacity());
+    uint64_t needBytes = uint64_t(appendBytes) + entryBytes +
+                         2 * sizeof(SegmentEntry);
+    if (needBytes > limit || keys.count(std::make_pair(tableId, id)) != 0) {
+        assert(!allOrNothing);
+        flush(false);
     }
-    if (rejectRules.exists)
-        return STATUS_OBJECT_DOESNT_EXIST;
-    if (rejectRules.versionLeGiven && version <= rejectRules.givenVersion)
-        return STATUS_WRONG_VERSION;
-    if (rejectRules.versionNeGiven && version != rejectRules.givenVersion)
-        return STATUS_WRONG_VERSION;
-    return STATUS_OK;
 }
 
 //-----------------------------------------------------------------------
@@ -1349,7 +4321,12 @@ MasterService::rejectOperation(const RejectRules& rejectRules, uint64_t version)
  * Determine whether or not an object is still alive (i.e. is referenced
  * by the hash table). If so, the cleaner must perpetuate it. If not, it
  * can be safely discarded.
- * 
+ *
+ * An object that has passed its expiry (see Object::expiry) is dead even
+ * if the hash table still refers to it. It is dropped here, as a remove
+ * would, except that no tombstone is needed: any earlier versions already
+ * have one, and the object itself stays dead if it's ever replayed.
+ *
  * \param[in] handle
  *      LogEntryHandle to the object whose liveness is being queried.
  * \param[in] cookie
@@ -1375,16 +4352,30 @@ objectLivenessCallback(LogEntryHandle handle, void* cookie)
     if (t == NULL)
         return false;
 
+    // Other objects may share the id; only this one's entry will do.
     LogEntryHandle hashTblHandle =
-        svr->objectMap.lookup(evictObj->id.tableId, evictObj->id.objectId);
+        svr->objectMap.lookup(evictObj->id.tableId, evictObj->id.objectId,
+                              SameReferent(handle));
     if (hashTblHandle == NULL)
         return false;
 
-    assert(hashTblHandle->type() == LOG_ENTRY_TYPE_OBJ);
-    const Object *hashTblObj = hashTblHandle->userData<Object>();
-
-    // simple pointer comparison suffices
-    return (hashTblObj == evictObj);
+    if (evictObj->isExpired()) {
+        {
+            std::lock_guard<SpinLock> bucketLock(svr->objectMap.getBucketLock(
+                evictObj->id.tableId, evictObj->id.objectId));
+            svr->objectMap.remove(evictObj->id.tableId, evictObj->id.objectId,
+                                  SameReferent(handle));
+        }
+        t->RaiseVersion(evictObj->version + 1);
+        t->profiler.untrack(Object::tabletKey(evictObj->id.objectId),
+                            handle->totalLength(),
+                            handle->logTime());
+        ++metrics->master.expiredObjectCount;
+        metrics->master.expiredObjectBytes += handle->totalLength();
+        svr->log.free(handle);
+        return false;
+    }
+    return true;
 }
 
 /**
@@ -1431,35 +4422,91 @@ objectRelocationCallback(LogEntryHandle oldHandle,
     if (table == NULL) {
         // That tablet doesn't exist on this server anymore.
         // Just remove the hash table entry, if it exists.
-        svr->objectMap.remove(evictObj->id.tableId, evictObj->id.objectId);
+        std::lock_guard<SpinLock> bucketLock(svr->objectMap.getBucketLock(
+            evictObj->id.tableId, evictObj->id.objectId));
+        svr->objectMap.remove(evictObj->id.tableId, evictObj->id.objectId,
+                              SameReferent(oldHandle));
         return false;
     }
 
+    // Other objects may share the id; only this one's entry will do.
     LogEntryHandle hashTblHandle =
-        svr->objectMap.lookup(evictObj->id.tableId, evictObj->id.objectId);
-
-    bool keepNewObject = false;
-    if (hashTblHandle != NULL) {
-        assert(hashTblHandle->type() == LOG_ENTRY_TYPE_OBJ);
-        const Object *hashTblObj = hashTblHandle->userData<Object>();
-
-        // simple pointer comparison suffices
-        keepNewObject = (hashTblObj == evictObj);
-        if (keepNewObject) {
-            svr->objectMap.replace(newHandle);
-        }
+        svr->objectMap.lookup(evictObj->id.tableId, evictObj->id.objectId,
+                              SameReferent(oldHandle));
+
+    bool keepNewObject = (hashTblHandle != NULL);
+    if (keepNewObject) {
+        std::lock_guard<SpinLock> bucketLock(svr->objectMap.getBucketLock(
+            evictObj->id.tableId, evictObj->id.objectId));
+        svr->objectMap.replace(newHandle, SameReferent(oldHandle));
     }
 
     // Remove the evicted entry whether it is discarded or not. If
     // we keep it we'll track it again in the objectScanCallback
     // function.
-    table->profiler.untrack(evictObj->id.objectId,
+    table->profiler.untrack(Object::tabletKey(evictObj->id.objectId),
                             oldHandle->totalLength(),
                             oldHandle->logTime());
 
     return keepNewObject;
 }
 
+/**
+ * Callback used by the LogCleaner in cache mode when its CLOCK hand reaches
+ * a live Object (i.e. an entry of type LOG_ENTRY_TYPE_OBJ) in a Segment
+ * it's cleaning.
+ *
+ * If the Object has been read since the hand last passed it, it gets a
+ * second chance: its referenced bit is cleared and the cleaner relocates
+ * it as usual. Otherwise it is evicted: removed from the hash table and
+ * freed. No tombstone is written, since a cache keeps no backup replicas
+ * that one would need to override.
+ *
+ * \param[in] handle
+ *      LogEntryHandle to the object the cleaner would otherwise relocate.
+ * \param[in] cookie
+ *      The opaque state pointer registered with the callback.
+ * \return
+ *      True if the object was evicted, false if it should be relocated.
+ */
+bool
+objectEvictionCallback(LogEntryHandle handle, void* cookie)
+{
+    assert(handle->type() == LOG_ENTRY_TYPE_OBJ);
+
+    MasterService* svr = static_cast<MasterService *>(cookie);
+    assert(svr != NULL);
+
+    const Object* evictObj = handle->userData<Object>();
+    assert(evictObj != NULL);
+    uint32_t tableId = downCast<uint32_t>(evictObj->id.tableId);
+    uint64_t objectId = evictObj->id.objectId;
+
+    std::lock_guard<SpinLock> lock(svr->objectUpdateLock);
+
+    Table* table = svr->getTable(tableId, objectId);
+    if (table == NULL || svr->updateBlocked(tableId, objectId))
+        return false;
+
+    std::lock_guard<SpinLock> bucketLock(
+        svr->objectMap.getBucketLock(tableId, objectId));
+    if (svr->objectMap.lookup(tableId, objectId,
+                              SameReferent(handle)) == NULL)
+        return false;
+    if (svr->objectMap.testAndClearReferenced(tableId, objectId,
+                                              SameReferent(handle)))
+        return false;
+
+    // Versions must keep increasing if the object is written again.
+    table->RaiseVersion(evictObj->version + 1);
+    svr->objectMap.remove(tableId, objectId, SameReferent(handle));
+    table->profiler.untrack(Object::tabletKey(objectId),
+                            handle->totalLength(),
+                            handle->logTime());
+    svr->log.free(handle);
+    return true;
+}
+
 /**
  * Callback used by the Log to determine the modification timestamp of an
  * Object. Timestamps are stored in the Object itself, rather than in the
@@ -1510,7 +4557,7 @@ objectScanCallback(LogEntryHandle handle, void* cookie)
         return;
     }
 
-    t->profiler.track(obj->id.objectId,
+    t->profiler.track(Object::tabletKey(obj->id.objectId),
                       handle->totalLength(),
                       handle->logTime());
 }
@@ -1588,7 +4635,7 @@ tombstoneRelocationCallback(LogEntryHandle oldHandle,
     Table* table = svr->getTable(downCast<uint32_t>(tomb->id.tableId),
                                  tomb->id.objectId);
     if (table != NULL) {
-        table->profiler.untrack(tomb->id.objectId,
+        table->profiler.untrack(Object::tabletKey(tomb->id.objectId),
                                 oldHandle->totalLength(),
                                 oldHandle->logTime());
     }
@@ -1645,11 +4692,181 @@ tombstoneScanCallback(LogEntryHandle handle, void* cookie)
         return;
     }
 
-    t->profiler.track(tomb->id.objectId,
+    t->profiler.track(Object::tabletKey(tomb->id.objectId),
                       handle->totalLength(),
                       handle->logTime());
 }
 
+/**
+ * Determine whether or not a TransactionIntent is still alive, i.e. its
+ * transaction is still prepared here. If so, the cleaner must perpetuate it.
+ *
+ * \param[in] handle
+ *      LogEntryHandle to the intent whose liveness is being queried.
+ * \param[in] cookie
+ *      The opaque state pointer registered with the callback.
+ * \return
+ *      True if the intent is still alive, else false.
+ */
+bool
+intentLivenessCallback(LogEntryHandle handle, void* cookie)
+{
+    assert(handle->type() == LOG_ENTRY_TYPE_TXINTENT);
+
+    MasterService* svr = static_cast<MasterService *>(cookie);
+    assert(svr != NULL);
+
+    const TransactionIntent* intent = handle->userData<TransactionIntent>();
+    std::lock_guard<SpinLock> lock(svr->objectUpdateLock);
+    return svr->preparedTransactions.count(intent->transactionId) != 0;
+}
+
+/**
+ * Callback used by the LogCleaner when it moves a TransactionIntent to a
+ * new Segment. If its transaction is still prepared, the transaction's
+ * record of its intents is pointed at the new copy.
+ *
+ * \param[in] oldHandle
+ *      LogEntryHandle to the intent's old location that will soon be
+ *      invalid.
+ * \param[in] newHandle
+ *      LogEntryHandle to the intent's new location.
+ * \param[in] cookie
+ *      The opaque state pointer registered with the callback.
+ * \return
+ *      True if newHandle is needed (i.e. it replaced oldHandle). False
+ *      indicates that newHandle wasn't needed and can be immediately
+ *      deleted.
+ */
+bool
+intentRelocationCallback(LogEntryHandle oldHandle,
+                         LogEntryHandle newHandle,
+                         void* cookie)
+{
+    assert(oldHandle->type() == LOG_ENTRY_TYPE_TXINTENT);
+
+    MasterService* svr = static_cast<MasterService *>(cookie);
+    assert(svr != NULL);
+
+    const TransactionIntent* intent =
+        oldHandle->userData<TransactionIntent>();
+    std::lock_guard<SpinLock> lock(svr->objectUpdateLock);
+    auto it = svr->preparedTransactions.find(intent->transactionId);
+    if (it == svr->preparedTransactions.end())
+        return false;
+    foreach (LogEntryHandle& handle, it->second->intents) {
+        if (handle == oldHandle) {
+            handle = newHandle;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Callback used by the Log to determine the age of a TransactionIntent.
+ *
+ * \param[in]  handle
+ *      LogEntryHandle to the entry being examined.
+ * \return
+ *      The intent's creation timestamp.
+ */
+uint32_t
+intentTimestampCallback(LogEntryHandle handle)
+{
+    assert(handle->type() == LOG_ENTRY_TYPE_TXINTENT);
+    return handle->userData<TransactionIntent>()->timestamp;
+}
+
+/**
+ * Determine whether or not a TransactionDecision is still alive, i.e. any
+ * segment that held its transaction's intents still exists, in which case
+ * recovery could replay them.
+ *
+ * \param[in] handle
+ *      LogEntryHandle to the decision whose liveness is being queried.
+ * \param[in] cookie
+ *      The opaque state pointer registered with the callback.
+ * \return
+ *      True if the decision is still alive, else false.
+ */
+bool
+decisionLivenessCallback(LogEntryHandle handle, void* cookie)
+{
+    assert(handle->type() == LOG_ENTRY_TYPE_TXDECISION);
+
+    MasterService* svr = static_cast<MasterService *>(cookie);
+    assert(svr != NULL);
+
+    const TransactionDecision* decision =
+        handle->userData<TransactionDecision>();
+    for (uint32_t i = 0; i < decision->segmentCount; i++) {
+        if (svr->log.isSegmentLive(decision->segmentIds[i]))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Callback used by the LogCleaner when it moves a TransactionDecision to a
+ * new Segment. Nothing refers to decisions, so the new copy is kept if the
+ * decision is still alive.
+ *
+ * \param[in] oldHandle
+ *      LogEntryHandle to the decision's old location.
+ * \param[in] newHandle
+ *      LogEntryHandle to the decision's new location.
+ * \param[in] cookie
+ *      The opaque state pointer registered with the callback.
+ * \return
+ *      True if newHandle is needed, false if it can be deleted.
+ */
+bool
+decisionRelocationCallback(LogEntryHandle oldHandle,
+                           LogEntryHandle newHandle,
+                           void* cookie)
+{
+    return decisionLivenessCallback(oldHandle, cookie);
+}
+
+/**
+ * Callback used by the Log to determine the age of a TransactionDecision.
+ *
+ * \param[in]  handle
+ *      LogEntryHandle to the entry being examined.
+ * \return
+ *      The decision's creation timestamp.
+ */
+uint32_t
+decisionTimestampCallback(LogEntryHandle handle)
+{
+    assert(handle->type() == LOG_ENTRY_TYPE_TXDECISION);
+    return handle->userData<TransactionDecision>()->timestamp;
+}
+
+/**
+ * Called on the first write request; use this as a trigger to update the
+ * cluster configuration information and open a session with each backup,
+ * so it won't slow down recovery benchmarks.  This is a temporary hack, and
+ * needs to be replaced with a more robust approach to updating cluster
+ * configuration information.
+ */
+void
+MasterService::openBackupSessions()
+{
+    anyWrites = true;
+
+    // NULL coordinator means we're in test mode, so skip this.
+    if (coordinator) {
+        ProtoBuf::ServerList backups;
+        coordinator->getBackupList(backups);
+        TransportManager& transportManager =
+            *Context::get().transportManager;
+        foreach(auto& backup, backups.server())
+            transportManager.getSession(backup.service_locator().c_str());
+    }
+}
+
 /**
  * \param tableId
  *      The table in which to store the object.
@@ -1676,7 +4893,16 @@ tombstoneScanCallback(LogEntryHandle handle, void* cookie)
  *      exist.
  * \param async
  *      If true, the replication may happen sometime later.
- *      If false, this write will be replicated to backups before return.
+ *      If false, this write will be replicated to backups before the reply
+ *      is sent (see #logSyncPending).
+ * \param keyLength
+ *      If nonzero, the object is named by a string key of this many bytes,
+ *      which is found at \a dataOffset in \a data, ahead of the blob, and
+ *      \a id must be Object::hashKey() of it. Objects with other keys at
+ *      the same id are left alone.
+ * \param expiry
+ *      The time (see #secondsTimestamp) at which the new object expires, or
+ *      0 if it never does. See Object::expiry.
  * \return
  *      STATUS_OK if the object was written. Otherwise, for example,
  *      STATUS_TABLE_DOESNT_EXIST may be returned.
@@ -1689,35 +4915,34 @@ MasterService::storeData(uint64_t tableId,
                          uint32_t dataOffset,
                          uint32_t dataLength,
                          uint64_t* newVersion,
-                         bool async)
+                         bool async,
+                         Object::KeyLength keyLength,
+                         uint32_t expiry)
 {
-    Table* table = getTable(downCast<uint32_t>(tableId), id);
+    bool normal;
+    Table* table = getTable(downCast<uint32_t>(tableId), id, &normal);
     if (table == NULL)
         return STATUS_TABLE_DOESNT_EXIST;
+    if (!normal || updateBlocked(downCast<uint32_t>(tableId), id))
+        return STATUS_RETRY;
 
-    if (!anyWrites) {
-        // This is the first write; use this as a trigger to update the
-        // cluster configuration information and open a session with each
-        // backup, so it won't slow down recovery benchmarks.  This is a
-        // temporary hack, and needs to be replaced with a more robust
-        // approach to updating cluster configuration information.
-        anyWrites = true;
-
-        // NULL coordinator means we're in test mode, so skip this.
-        if (coordinator) {
-            ProtoBuf::ServerList backups;
-            coordinator->getBackupList(backups);
-            TransportManager& transportManager =
-                *Context::get().transportManager;
-            foreach(auto& backup, backups.server())
-                transportManager.getSession(backup.service_locator().c_str());
-        }
+    if (!anyWrites)
+        openBackupSessions();
+
+    const void* key = NULL;
+    if (keyLength != 0) {
+        key = data->getRange(dataOffset, keyLength);
+        if (key == NULL)
+            return STATUS_MESSAGE_TOO_SHORT;
     }
 
     const Object *obj = NULL;
-    LogEntryHandle handle = objectMap.lookup(tableId, id);
+    LogEntryHandle handle = objectMap.lookup(tableId, id,
+                                             KeyMatcher(key, keyLength));
     if (handle != NULL) {
         if (handle->type() == LOG_ENTRY_TYPE_OBJTOMB) {
+            std::lock_guard<SpinLock> lock(objectMap.getBucketLock(tableId,
+                                                                   id));
             recoveryCleanup(handle,
                             this);
             handle = NULL;
@@ -1727,7 +4952,11 @@ MasterService::storeData(uint64_t tableId,
         }
     }
 
-    uint64_t version = (obj != NULL) ? obj->version : VERSION_NONEXISTENT;
+    // An expired object is still overwritten (and given a tombstone) like
+    // any other, but to the client it no longer exists.
+    bool expired = (obj != NULL && obj->isExpired());
+    uint64_t version = (obj != NULL && !expired) ? obj->version :
+                                                   VERSION_NONEXISTENT;
 
     Status status = rejectOperation(*rejectRules, version);
     if (status != STATUS_OK) {
@@ -1735,16 +4964,22 @@ MasterService::storeData(uint64_t tableId,
         return status;
     }
 
-    DECLARE_OBJECT(newObject, dataLength);
+    if (dataOffset + keyLength + dataLength > data->getTotalLength())
+        return STATUS_MESSAGE_TOO_SHORT;
+
+    // Only the object's header is built here; the key and data are gathered
+    // straight from the request into the log by multiAppend below.
+    DECLARE_OBJECT(newObject, 0);
 
     newObject->id.objectId = id;
     newObject->id.tableId = tableId;
+    newObject->keyLength = keyLength;
+    newObject->expiry = expiry;
     if (obj != NULL)
         newObject->version = obj->version + 1;
     else
         newObject->version = table->AllocateVersion();
     assert(obj == NULL || newObject->version > obj->version);
-    data->copy(dataOffset, dataLength, newObject->data);
 
     // Perform a multi-append to atomically add the tombstone and
     // new object (if we need a tombstone for the prior one).
@@ -1764,14 +4999,22 @@ MasterService::storeData(uint64_t tableId,
     try {
         appends.push_back({ LOG_ENTRY_TYPE_OBJ,
                             newObject,
-                            newObject->objectLength(dataLength) });
-        LogEntryHandleVector objHandles = log.multiAppend(appends, !async);
-        if (obj == NULL) {
-            objectMap.replace(objHandles[0]);
-        } else {
-            objectMap.replace(objHandles[1]);
-            log.free(handle);
+                            newObject->objectLength(0),
+                            data,
+                            dataOffset,
+                            keyLength + dataLength });
+        LogEntryHandleVector objHandles = log.multiAppend(appends, false);
+        if (!async)
+            logSyncPending = true;
+        {
+            std::lock_guard<SpinLock> lock(objectMap.getBucketLock(tableId,
+                                                                   id));
+            objectMap.replace(objHandles.back(), SameReferent(handle));
         }
+        markMigrationDirty(tableId, id,
+                           Object::keyFingerprint(key, keyLength));
+        if (obj != NULL)
+            log.free(handle);
         *newVersion = newObject->version;
         bytesWritten += dataLength;
         return STATUS_OK;
@@ -16,6 +16,10 @@
 #ifndef RAMCLOUD_MASTERSERVICE_H
 #define RAMCLOUD_MASTERSERVICE_H
 
+#include <map>
+#include <set>
+#include <thread>
+
 #include "Common.h"
 #include "CoordinatorClient.h"
 #include "Log.h"
@@ -30,10 +34,13 @@
 #include "ServerConfig.h"
 #include "SpinLock.h"
 #include "Table.h"
+#include "TabletIndex.h"
 
 namespace RAMCloud {
 
-// forward declaration
+// forward declarations
+class BackupService;
+class MasterClient;
 namespace MasterServiceInternal {
 class RecoveryTask;
 }
@@ -52,8 +59,13 @@ class MasterService : public Service {
                   ServerList& serverList);
     virtual ~MasterService();
     void init(ServerId id);
+    void startRestart(ServerId formerId, BackupService& backup,
+                      const vector<uint64_t>& segmentIds);
     void dispatch(RpcOpcode opcode,
                   Rpc& rpc);
+    virtual int maxThreads() {
+        return downCast<int>(config.master.workerThreads);
+    }
 
   PRIVATE:
 
@@ -85,40 +97,135 @@ class MasterService : public Service {
         State state;
     };
 
+    /**
+     * A matcher for #objectMap (see HashTable) that picks out, among the
+     * objects and tombstones stored under one (table, id) pair, the one for
+     * a particular string key. Keys that hash to the same id share the pair
+     * and are stored side by side. Objects named only by their id have the
+     * empty key.
+     */
+    class KeyMatcher {
+      public:
+        KeyMatcher();
+        KeyMatcher(const void* key, Object::KeyLength keyLength);
+        explicit KeyMatcher(uint64_t fingerprint);
+        bool operator()(LogEntryHandle handle) const;
+
+      PRIVATE:
+        /// The key's bytes, or NULL if only its #fingerprint is known.
+        const void* key;
+
+        /// The number of bytes in #key.
+        Object::KeyLength keyLength;
+
+        /// Object::keyFingerprint() of the key, if #key is NULL.
+        uint64_t fingerprint;
+    };
+
+    /**
+     * A prepared transaction found while replaying a log for recovery or
+     * restart; see recoverSegment() and restorePreparedTransactions().
+     */
+    struct RecoveredTransaction {
+        RecoveredTransaction()
+            : parts()
+            , decided(false)
+        {
+        }
+
+        /// The TransactionRpc::Request::Part and value of each object
+        /// replayed, by (tableId, id), as its TransactionIntent logged them.
+        std::map<std::pair<uint32_t, uint64_t>, string> parts;
+
+        /// Whether the transaction's TransactionDecision was replayed, in
+        /// which case its intents are stale.
+        bool decided;
+    };
+
+    /// RecoveredTransactions by transaction id.
+    typedef std::map<uint64_t, RecoveredTransaction> RecoveredTransactions;
+
+    void compareAndSwap(const CompareAndSwapRpc::Request& reqHdr,
+                        CompareAndSwapRpc::Response& respHdr,
+                        Rpc& rpc);
     void create(const CreateRpc::Request& reqHdr,
                 CreateRpc::Response& respHdr,
                 Rpc& rpc);
+    void decideTransaction(const DecideTransactionRpc::Request& reqHdr,
+                           DecideTransactionRpc::Response& respHdr,
+                           Rpc& rpc);
+    void enumerateTable(const EnumerateTableRpc::Request& reqHdr,
+                        EnumerateTableRpc::Response& respHdr,
+                        Rpc& rpc);
     void fillWithTestData(const FillWithTestDataRpc::Request& reqHdr,
                           FillWithTestDataRpc::Response& respHdr,
                           Rpc& rpc);
+    void increment(const IncrementRpc::Request& reqHdr,
+                   IncrementRpc::Response& respHdr,
+                   Rpc& rpc);
+    void migrateTablet(const MigrateTabletRpc::Request& reqHdr,
+                       MigrateTabletRpc::Response& respHdr,
+                       Rpc& rpc);
     void multiRead(const MultiReadRpc::Request& reqHdr,
                    MultiReadRpc::Response& respHdr,
                    Rpc& rpc);
+    void multiRemove(const MultiRemoveRpc::Request& reqHdr,
+                     MultiRemoveRpc::Response& respHdr,
+                     Rpc& rpc);
+    void multiWrite(const MultiWriteRpc::Request& reqHdr,
+                    MultiWriteRpc::Response& respHdr,
+                    Rpc& rpc);
+    void prepForMigration(const PrepForMigrationRpc::Request& reqHdr,
+                          PrepForMigrationRpc::Response& respHdr,
+                          Rpc& rpc);
+    void prepareTransaction(const PrepareTransactionRpc::Request& reqHdr,
+                            PrepareTransactionRpc::Response& respHdr,
+                            Rpc& rpc);
     void read(const ReadRpc::Request& reqHdr,
               ReadRpc::Response& respHdr,
               Rpc& rpc);
+    void receiveMigrationData(const ReceiveMigrationDataRpc::Request& reqHdr,
+                              ReceiveMigrationDataRpc::Response& respHdr,
+                              Rpc& rpc);
     void recover(const RecoverRpc::Request& reqHdr,
                  RecoverRpc::Response& respHdr,
                  Rpc& rpc);
 
-    void recoverSegmentPrefetcher(RecoverySegmentIterator& i);
+    uint32_t recoverSegmentLookupBatch(RecoverySegmentIterator& i,
+                                       uint64_t tableIds[],
+                                       uint64_t objectIds[],
+                                       KeyMatcher matchers[],
+                                       LogEntryHandle handles[]);
     void recoverSegment(uint64_t segmentId, const void *buffer,
-                        uint32_t bufferLength);
+                        uint32_t bufferLength,
+                        RecoveredTransactions* transactions = NULL);
 
     void recover(ServerId masterId,
                  uint64_t partitionId,
-                 vector<Replica>& replicas);
+                 vector<Replica>& replicas,
+                 RecoveredTransactions* transactions = NULL);
 
     void remove(const RemoveRpc::Request& reqHdr,
                 RemoveRpc::Response& respHdr,
                 Rpc& rpc);
+    void abortRestart(ServerId formerId, ProtoBuf::Tablets& restartTablets);
+    uint64_t replayLocalLog(ServerId formerId, BackupService& backup,
+                            const vector<uint64_t>& segmentIds,
+                            const ProtoBuf::Tablets& partitions,
+                            RecoveredTransactions* transactions = NULL);
+    void restart(ServerId formerId, BackupService& backup,
+                 const vector<uint64_t>& segmentIds);
     void rereplicateSegments(const RereplicateSegmentsRpc::Request& reqHdr,
                              RereplicateSegmentsRpc::Response& respHdr,
                              Rpc& rpc);
+    void markTabletsNormal(const ProtoBuf::Tablets& filled);
     void setTablets(const ProtoBuf::Tablets& newTablets);
     void setTablets(const SetTabletsRpc::Request& reqHdr,
                     SetTabletsRpc::Response& respHdr,
                     Rpc& rpc);
+    void transaction(const TransactionRpc::Request& reqHdr,
+                     TransactionRpc::Response& respHdr,
+                     Rpc& rpc);
     void write(const WriteRpc::Request& reqHdr,
                WriteRpc::Response& respHdr,
                Rpc& rpc);
@@ -168,6 +275,27 @@ class MasterService : public Service {
      */
     ProtoBuf::Tablets tablets;
 
+    /**
+     * Index over #tablets used by getTable(). Rebuilt by setTablets()
+     * whenever #tablets changes.
+     */
+    TabletIndex tabletIndex;
+
+    /**
+     * A MULTI_READ reply stops growing once adding another object would
+     * take it past this many bytes; the remaining objects are returned with
+     * STATUS_RETRY and the client asks for them again. This keeps replies
+     * within what every transport can carry (InfRcTransport allows a
+     * little more than a segment). ENUMERATE_TABLE replies are bounded the
+     * same way. Only changed by tests.
+     */
+    uint32_t maxMultiReadReplyBytes;
+
+    /// The number of objects multiRead() and recoverSegment() look up in
+    /// #objectMap at once, so that the hash table's cache misses for them
+    /// overlap. See HashTable::lookupBatch().
+    static const uint32_t LOOKUP_BATCH_SIZE = 16;
+
     /**
      * Used to ensure that init() is invoked before the dispatcher runs.
      */
@@ -184,11 +312,400 @@ class MasterService : public Service {
     /**
      * Lock that serialises all object updates (creations, overwrites,
      * deletions, and cleaning relocations). This protects regular RPC
-     * operations from the log cleaner. When we work on multithreaded
-     * writes we'll need to revisit this.
+     * operations from the log cleaner. Reads do not take this lock;
+     * instead, any modification of #objectMap must hold both this lock
+     * and the bucket lock for the key being modified (see
+     * HashTable::getBucketLock), and changes to #tablets must hold this
+     * lock and every bucket lock. Reads look objects and tablets up
+     * without locks from inside an EpochManager::ReadGuard (see
+     * HashTable::lockFreeLookup and TabletIndex). When we work on
+     * multithreaded writes we'll need to revisit this.
      */
     SpinLock objectUpdateLock;
 
+    /**
+     * Set, on the worker thread running it, by an update handler that has
+     * appended to #log entries that must be durable before it replies.
+     * dispatch() then waits for them to be replicated after releasing
+     * #objectUpdateLock, which lets concurrent updates share one round of
+     * replication instead of each taking its own under the lock.
+     */
+    static __thread bool logSyncPending;
+
+    /**
+     * Grow #objectMap once it holds more than this percentage of the
+     * entries that fit in its buckets without chaining.
+     */
+    static const uint64_t MAX_OBJECT_MAP_LOAD_PERCENT = 100;
+
+    /**
+     * Number of #objectMap buckets migrated per HashTable::moveBuckets()
+     * call while growing. Kept small so that no RPC waits long on a bucket
+     * lock.
+     */
+    static const uint64_t OBJECT_MAP_REHASH_BATCH = 16;
+
+    /// How long the resizer thread sleeps when #objectMap needs no work.
+    static const uint32_t OBJECT_MAP_RESIZER_POLL_USEC = 10000;
+
+    /// Thread that grows #objectMap in the background, if enabled.
+    Tub<std::thread> objectMapResizer;
+
+    /// Set by the destructor to ask #objectMapResizer to exit.
+    bool objectMapResizerShouldExit;
+
+    static void objectMapResizerEntry(MasterService* service,
+                                      Context* context);
+    bool resizeObjectMap();
+
+    /// How long the tablet splitter thread sleeps between checks.
+    static const uint32_t TABLET_SPLITTER_POLL_USEC = 100000;
+
+    /**
+     * Thread that splits tablets once they grow too large, if
+     * ServerConfig::Master::tabletSplitBytes is set.
+     */
+    Tub<std::thread> tabletSplitter;
+
+    /// Set by the destructor to ask #tabletSplitter to exit.
+    bool tabletSplitterShouldExit;
+
+    /// True while splitTablets() is changing a tablet's bounds, during
+    /// which migrateTablet() is refused. Only changed with
+    /// #objectUpdateLock held.
+    bool splittingTablet;
+
+    static void tabletSplitterEntry(MasterService* service, Context* context);
+
+    /**
+     * Thread that replays this master's former log from its co-located
+     * backup after a restart, if started by startRestart().
+     */
+    Tub<std::thread> restarter;
+
+    /**
+     * True while restart() is replaying the former log, during which the
+     * #tombstoneReaper must not run: a tombstone reaped between segments
+     * would let an older version of its object, replayed from a later
+     * segment, come back. Only changed with #objectUpdateLock held.
+     */
+    bool replayingRestart;
+
+    static void restarterEntry(MasterService* service, Context* context,
+                               ServerId formerId, BackupService* backup,
+                               vector<uint64_t> segmentIds);
+    bool findTabletSplit(const ProtoBuf::Tablets::Tablet& tablet,
+                         uint64_t maxBytes, uint64_t maxReferents,
+                         uint64_t* splitId);
+    ServerId pickMigrationTarget();
+    void splitTablet(uint32_t tableId, uint64_t firstId, uint64_t lastId,
+                     uint64_t splitId);
+    bool splitTablets();
+
+    /**
+     * Collects the log entries for the objects named in a MULTI_WRITE or
+     * MULTI_REMOVE request so that they can be appended to the log with one
+     * Log::multiAppend and made durable with a single sync, rather than
+     * paying for an append and a round of replication per object. These
+     * requests name objects by id alone, so they only reach objects that
+     * have no string key.
+     *
+     * Each staged operation is checked against the object's current state
+     * when it is staged. Operations only take effect (and #objectMap only
+     * changes) when the batch is flushed, so a batch is flushed early if
+     * it would no longer fit in one segment or if the same object is named
+     * twice. Transactions use an all-or-nothing batch instead, which the
+     * caller guarantees never needs flushing early, and #discard it if any
+     * operation is rejected. Callers must hold #objectUpdateLock.
+     */
+    class LogBatch {
+      public:
+        LogBatch(MasterService& service, uint32_t maxOperations,
+                 bool allOrNothing = false);
+        void write(uint32_t tableId, uint64_t id,
+                   const RejectRules& rejectRules, Buffer* data,
+                   uint32_t dataOffset, uint32_t dataLength,
+                   Status* status, uint64_t* version);
+        void remove(uint32_t tableId, uint64_t id,
+                    const RejectRules& rejectRules,
+                    Status* status, uint64_t* version);
+        void append(LogEntryType type, const void* buffer,
+                    uint32_t length);
+        void flush(bool sync);
+        void discard();
+
+      PRIVATE:
+        /// One operation staged in #appends.
+        struct Operation {
+            uint32_t tableId;
+            uint64_t id;
+            /// Table holding the object; its version is raised on removes.
+            Table* table;
+            /// Entry superseded by this operation, or NULL if none.
+            LogEntryHandle oldHandle;
+            /// Index of the new object in #appends, or NO_OBJECT for removes.
+            uint32_t objectIndex;
+            /// Bytes of object data written, for bytesWritten.
+            uint32_t dataLength;
+            /// For writes, the version of the new object. For removes, the
+            /// version of the object being removed.
+            uint64_t version;
+            /// Where the outcome of the operation is reported.
+            Status* status;
+            /// Where the new version is reported for writes; NULL for
+            /// removes, which report the old version when staged.
+            uint64_t* newVersion;
+        };
+        static const uint32_t NO_OBJECT = ~0U;
+
+        void makeRoom(uint32_t tableId, uint64_t id, uint32_t entryBytes);
+
+        MasterService& service;
+
+        /// Object headers for new objects, one slot per operation.
+        std::unique_ptr<Tub<Object>[]> objects;
+
+        /// Tombstones for superseded objects, one slot per operation.
+        std::unique_ptr<Tub<ObjectTombstone>[]> tombstones;
+
+        /// Next unused slot in #objects and #tombstones.
+        uint32_t nextSlot;
+
+        /// Entries to be appended by the next #flush.
+        LogMultiAppendVector appends;
+
+        /// Bytes #appends will occupy in a segment, including entry headers.
+        uint32_t appendBytes;
+
+        /// Operations whose entries are in #appends.
+        std::vector<Operation> operations;
+
+        /// (tableId, id) of every object named in #operations.
+        std::set<std::pair<uint32_t, uint64_t>> keys;
+
+        /// If true, the batch must never be flushed early (see #makeRoom).
+        bool allOrNothing;
+
+        DISALLOW_COPY_AND_ASSIGN(LogBatch);
+    };
+
+    /**
+     * A tablet this master is migrating to another master (see
+     * migrateTablet()). Only the thread running the migration uses
+     * #batch; #dirty is shared with every update and must only be
+     * touched with #objectUpdateLock held.
+     */
+    struct Migration {
+        Migration(uint32_t tableId, uint64_t firstId, uint64_t lastId)
+            : tableId(tableId)
+            , firstId(firstId)
+            , lastId(lastId)
+            , dirty()
+            , batch()
+            , blocked(false)
+        {
+        }
+
+        /// Return whether an object belongs to the tablet being migrated.
+        bool
+        contains(uint64_t objectTableId, uint64_t objectId) const
+        {
+            uint64_t tabletKey = Object::tabletKey(objectId);
+            return objectTableId == tableId &&
+                   tabletKey >= firstId && tabletKey <= lastId;
+        }
+
+        /// The tablet being migrated, as a range of tablet keys (see
+        /// Object::tabletKey).
+        uint32_t tableId;
+        uint64_t firstId;
+        uint64_t lastId;
+
+        /// Objects in the tablet created, overwritten or removed since the
+        /// current pass over #objectMap started or since they were last
+        /// sent, whichever is later, by id and Object::keyFingerprint().
+        /// These are sent (again) before the new owner takes over.
+        std::set<std::pair<uint64_t, uint64_t>> dirty;
+
+        /// Log entries, in recovery segment format, not yet sent to the new
+        /// owner.
+        Buffer batch;
+
+        /// Set once the last objects are being sent: from then on updates
+        /// to the tablet fail with STATUS_RETRY until the migration ends,
+        /// so that no new ones need sending.
+        bool blocked;
+
+        DISALLOW_COPY_AND_ASSIGN(Migration);
+    };
+
+    /// The tablet being migrated away, if any. Only changed with
+    /// #objectUpdateLock held.
+    Tub<Migration> migration;
+
+    /**
+     * Buckets of #objectMap visited per acquisition of #objectUpdateLock
+     * when copying a migrating tablet, so that updates are never blocked
+     * for long.
+     */
+    static const uint64_t MIGRATION_BUCKETS_PER_LOCK = 64;
+
+    /// Upper bound on the hash table buckets visited by one ENUMERATE_TABLE
+    /// request, so that enumerating a sparse tablet doesn't keep the
+    /// request's thread busy for long.
+    static const uint64_t ENUMERATION_BUCKETS_PER_RPC = 16384;
+
+    /// Objects resent per acquisition of #objectUpdateLock while catching
+    /// up with updates made during a migration.
+    static const uint32_t MIGRATION_OBJECTS_PER_LOCK = 256;
+
+    /**
+     * A migration stops catching up with updates and blocks them instead
+     * once this few objects remain to be resent, or after
+     * #MIGRATION_MAX_CATCHUP_ROUNDS rounds if updates keep outpacing it.
+     */
+    static const size_t MIGRATION_FINAL_DIRTY_OBJECTS = 1000;
+    static const uint32_t MIGRATION_MAX_CATCHUP_ROUNDS = 1000;
+
+    /// A batch of migrated log entries is sent once it reaches this size.
+    static const uint32_t MIGRATION_BATCH_BYTES = 1024 * 1024;
+
+    /// How long reassignMigratedTablet() waits between attempts.
+    static const uint32_t MIGRATION_REASSIGN_RETRY_USEC = 10 * 1000;
+
+    void copyDirtyObjects(uint32_t maxObjects);
+    Status migrateTablet(uint32_t tableId, uint64_t firstId, uint64_t lastId,
+                         ServerId newOwnerId);
+    void markMigrationDirty(uint64_t tableId, uint64_t id,
+                            uint64_t keyFingerprint);
+    bool reassignMigratedTablet(uint32_t tableId, uint64_t firstId,
+                                uint64_t lastId, ServerId newOwnerId);
+    void sendMigrationBatch(MasterClient& target, bool done,
+                            uint64_t tableVersion);
+    bool visitObjectMapBuckets(uint64_t* bucket,
+                               void (*callback)(LogEntryHandle, void*));
+
+    /**
+     * A transaction this master has prepared (see prepareTransaction())
+     * and which is waiting for the client's DECIDE_TRANSACTION.
+     */
+    struct PreparedTransaction {
+        PreparedTransaction()
+            : count(0)
+            , parts()
+            , intents()
+            , expiryTime(0)
+        {
+        }
+
+        /// Number of objects in the transaction.
+        uint32_t count;
+
+        /// A copy of the transaction's parts and values, laid out as they
+        /// follow the header of a TRANSACTION request.
+        Buffer parts;
+
+        /// The TransactionIntents logged for the parts; kept up to date as
+        /// the cleaner relocates them.
+        std::vector<LogEntryHandle> intents;
+
+        /// Cycles::rdtsc() time after which, if the transaction is still
+        /// undecided, the coordinator is asked for its outcome; see
+        /// findExpiredTransactions().
+        uint64_t expiryTime;
+
+        DISALLOW_COPY_AND_ASSIGN(PreparedTransaction);
+    };
+
+    /// Prepared transactions, by transaction id. Only touched with
+    /// #objectUpdateLock held.
+    std::map<uint64_t, std::unique_ptr<PreparedTransaction>>
+        preparedTransactions;
+
+    /**
+     * (tableId, id) of every object named by a transaction in
+     * #preparedTransactions. Other updates to these objects fail with
+     * STATUS_RETRY until the transaction is decided. Only touched with
+     * #objectUpdateLock held.
+     */
+    std::set<std::pair<uint32_t, uint64_t>> transactionLocks;
+
+    /// Return whether an object is locked by a prepared transaction.
+    bool
+    lockedByTransaction(uint32_t tableId, uint64_t id) const
+    {
+        return !transactionLocks.empty() &&
+               transactionLocks.count(std::make_pair(tableId, id)) != 0;
+    }
+
+    /// Return whether updates to an object must fail with STATUS_RETRY for
+    /// now, because a prepared transaction locks it or because its tablet
+    /// is finishing a migration (see Migration::blocked).
+    bool
+    updateBlocked(uint32_t tableId, uint64_t id) const
+    {
+        return lockedByTransaction(tableId, id) ||
+               (migration && migration->blocked &&
+                migration->contains(tableId, id));
+    }
+
+    Status checkTransaction(Buffer& parts, uint32_t offset, uint32_t count,
+                            uint32_t* rejectedPart);
+    Status commitTransaction(Buffer& parts, uint32_t offset, uint32_t count,
+                             Buffer& reply, uint32_t* rejectedPart,
+                             uint64_t* rejectedVersion,
+                             const TransactionDecision* decision = NULL);
+    Status decidePreparedTransaction(uint64_t transactionId, bool commit,
+                                     Buffer& reply);
+    void findExpiredTransactions(vector<uint64_t>& expired);
+    void lockTransaction(Buffer& parts, uint32_t count, bool lock);
+    void logTransactionIntents(uint64_t transactionId,
+                               PreparedTransaction& prepared,
+                               uint32_t offset, uint32_t count);
+    bool preparedInTablet(uint32_t tableId, uint64_t firstId,
+                          uint64_t lastId) const;
+    void resolveTransactions(const vector<uint64_t>& expired);
+    void restorePreparedTransactions(RecoveredTransactions& transactions);
+    Status stageTransaction(Buffer& parts, uint32_t offset, uint32_t count,
+                            LogBatch& batch, Status statuses[],
+                            uint64_t versions[], uint32_t* rejectedPart,
+                            uint64_t* rejectedVersion);
+
+    /**
+     * A Dispatch::Poller that sweeps the tombstones left by recovery and
+     * tablet migration out of #objectMap, a few buckets per pass through
+     * the dispatch loop, so that the master keeps serving requests while
+     * it does so. See removeTombstones().
+     */
+    class TombstoneReaper : public Dispatch::Poller {
+      public:
+        explicit TombstoneReaper(MasterService& service);
+        virtual void poll();
+        void start();
+
+        /// Return whether a sweep is in progress.
+        bool isRunning() const { return running; }
+
+      PRIVATE:
+        MasterService& service;
+
+        /// The bucket of #objectMap the sweep visits next.
+        uint64_t nextBucket;
+
+        /// Whether a sweep is in progress.
+        bool running;
+
+        DISALLOW_COPY_AND_ASSIGN(TombstoneReaper);
+    };
+
+    /// Buckets of #objectMap the TombstoneReaper visits per poll, which
+    /// bounds how long it can keep the dispatch thread from other work.
+    static const uint64_t TOMBSTONE_REAP_BUCKETS_PER_POLL = 64;
+
+    /// Created by the first call to removeTombstones(). Only touched with
+    /// the Dispatch lock held.
+    Tub<TombstoneReaper> tombstoneReaper;
+
     /* Tombstone cleanup method used after recovery. */
     void removeTombstones();
 
@@ -204,22 +721,38 @@ class MasterService : public Service {
                                          LogEntryHandle newHandle,
                                          void* cookie);
     friend void objectScanCallback(LogEntryHandle handle, void* cookie);
+    friend bool objectEvictionCallback(LogEntryHandle handle, void* cookie);
     friend bool tombstoneLivenessCallback(LogEntryHandle handle, void* cookie);
     friend bool tombstoneRelocationCallback(LogEntryHandle oldHandle,
                                             LogEntryHandle newHandle,
                                             void* cookie);
     friend void tombstoneScanCallback(LogEntryHandle handle, void* cookie);
+    friend bool intentLivenessCallback(LogEntryHandle handle, void* cookie);
+    friend bool intentRelocationCallback(LogEntryHandle oldHandle,
+                                         LogEntryHandle newHandle,
+                                         void* cookie);
+    friend bool decisionLivenessCallback(LogEntryHandle handle,
+                                         void* cookie);
+    friend bool decisionRelocationCallback(LogEntryHandle oldHandle,
+                                           LogEntryHandle newHandle,
+                                           void* cookie);
     friend void segmentReplayCallback(Segment* seg, void* cookie);
-    Table* getTable(uint32_t tableId, uint64_t objectId)
+    friend void migrationCopyCallback(LogEntryHandle handle, void* cookie);
+    friend void migrationPurgeCallback(LogEntryHandle handle, void* cookie);
+    friend void restartPurgeCallback(LogEntryHandle handle, void* cookie);
+    Table* getTable(uint32_t tableId, uint64_t objectId, bool* normal = NULL)
         __attribute__((warn_unused_result));
     Status rejectOperation(const RejectRules& rejectRules, uint64_t version)
         __attribute__((warn_unused_result));
+    void openBackupSessions();
     Status storeData(uint64_t table, uint64_t id,
                      const RejectRules* rejectRules, Buffer* data,
                      uint32_t dataOffset, uint32_t dataLength,
-                     uint64_t* newVersion, bool async)
+                     uint64_t* newVersion, bool async,
+                     Object::KeyLength keyLength = 0, uint32_t expiry = 0)
         __attribute__((warn_unused_result));
     friend class RecoverSegmentBenchmark;
+    friend class RestartBenchmark;
     friend class MasterServiceInternal::RecoveryTask;
     DISALLOW_COPY_AND_ASSIGN(MasterService);
 };
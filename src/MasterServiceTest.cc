@@ -14,6 +14,7 @@
  */
 
 #include "TestUtil.h"
+#include "AtomicInt.h"
 #include "BackupStorage.h"
 #include "Buffer.h"
 #include "CoordinatorClient.h"
@@ -21,6 +22,7 @@
 #include "Memory.h"
 #include "MasterClient.h"
 #include "MasterService.h"
+#include "RecoverySegmentIterator.h"
 #include "ReplicaManager.h"
 #include "ShortMacros.h"
 
@@ -71,6 +73,7 @@ class MasterServiceTest : public ::testing::Test {
         tablet.set_start_object_id(0);
         tablet.set_end_object_id(~0UL);
         tablet.set_user_data(reinterpret_cast<uint64_t>(new Table(0)));
+        service->tabletIndex.rebuild(service->tablets);
     }
 
     uint32_t
@@ -125,6 +128,38 @@ class MasterServiceTest : public ::testing::Test {
                 s == "tabletsRecovered" || s == "setTablets");
     }
 
+    static bool
+    resolveTransactionsFilter(string s)
+    {
+        return s == "resolveTransactions";
+    }
+
+    void
+    appendRecoveryEntry(Buffer& segment, LogEntryType type,
+                        const void* data, uint32_t length)
+    {
+        new(&segment, APPEND) SegmentEntry(type, length);
+        memcpy(new(&segment, APPEND) char[length], data, length);
+    }
+
+    void
+    appendIntent(Buffer& segment, uint64_t transactionId, uint64_t id,
+                 string value)
+    {
+        RejectRules rules;
+        memset(&rules, 0, sizeof(rules));
+        uint32_t valueLength = downCast<uint32_t>(value.length());
+        TransactionRpc::Request::Part part(0, id, valueLength, rules, false);
+        Buffer intent;
+        new(&intent, APPEND) TransactionIntent(0, id, transactionId);
+        new(&intent, APPEND) TransactionRpc::Request::Part(part);
+        memcpy(new(&intent, APPEND) char[valueLength], value.data(),
+               valueLength);
+        uint32_t length = intent.getTotalLength();
+        appendRecoveryEntry(segment, LOG_ENTRY_TYPE_TXINTENT,
+                            intent.getRange(0, length), length);
+    }
+
     void
     appendTablet(ProtoBuf::Tablets& tablets,
                     uint64_t partitionId,
@@ -148,9 +183,92 @@ class MasterServiceTest : public ::testing::Test {
         appendTablet(tablets, 0, 124, 20, 100);
     }
 
+    /**
+     * Continue enumerating table 0 until the end (or until maxRpcs requests
+     * have been made), counting how often each object id is returned.
+     * \return
+     *      True once the enumeration has finished.
+     */
+    bool
+    enumerate(EnumerateTableRpc::Cursor* cursor,
+              std::map<uint64_t, uint32_t>* seen,
+              uint32_t maxRpcs = ~0U)
+    {
+        bool done = false;
+        for (uint32_t i = 0; i < maxRpcs && !done; i++) {
+            Buffer objects;
+            uint64_t tabletLastId;
+            uint32_t count = client->enumerateTable(0, 0, cursor,
+                                                    &tabletLastId, &done,
+                                                    &objects);
+            EXPECT_EQ(~0UL, tabletLastId);
+            uint32_t offset = 0;
+            for (uint32_t j = 0; j < count; j++) {
+                const SegmentEntry* entry =
+                    objects.getOffset<SegmentEntry>(offset);
+                offset += downCast<uint32_t>(sizeof(*entry));
+                const Object* obj = objects.getOffset<Object>(offset);
+                offset += entry->length;
+                ++(*seen)[obj->id.objectId];
+            }
+            EXPECT_EQ(offset, objects.getTotalLength());
+        }
+        return done;
+    }
+
     DISALLOW_COPY_AND_ASSIGN(MasterServiceTest);
 };
 
+TEST_F(MasterServiceTest, compareAndSwap) {
+    client->write(0, 3, "item0", 5);
+    uint64_t version;
+    EXPECT_TRUE(client->compareAndSwap(0, 3, "item0", 5, "item1", 5,
+                                       NULL, &version));
+    EXPECT_EQ(2U, version);
+    Buffer value;
+    client->read(0, 3, &value);
+    EXPECT_EQ("item1", TestUtil::toString(&value));
+}
+
+TEST_F(MasterServiceTest, compareAndSwap_mismatch) {
+    client->write(0, 3, "item0", 5);
+    Buffer current;
+    uint64_t version;
+    EXPECT_FALSE(client->compareAndSwap(0, 3, "item", 4, "item1", 5,
+                                        &current, &version));
+    EXPECT_EQ("item0", TestUtil::toString(&current));
+    EXPECT_EQ(1U, version);
+    EXPECT_FALSE(client->compareAndSwap(0, 3, "itemX", 5, "item1", 5,
+                                        &current));
+    EXPECT_EQ("item0", TestUtil::toString(&current));
+
+    // Retrying with the value returned succeeds.
+    EXPECT_TRUE(client->compareAndSwap(0, 3, "item0", 5, "item1", 5,
+                                       &current, &version));
+    EXPECT_EQ(0U, current.getTotalLength());
+    EXPECT_EQ(2U, version);
+}
+
+TEST_F(MasterServiceTest, compareAndSwap_badArguments) {
+    EXPECT_THROW(client->compareAndSwap(4, 3, "a", 1, "b", 1),
+                 TableDoesntExistException);
+    EXPECT_THROW(client->compareAndSwap(0, 3, "a", 1, "b", 1),
+                 ObjectDoesntExistException);
+}
+
+TEST_F(MasterServiceTest, compareAndSwap_stringKey) {
+    client->write(0, "alpha", 5, "abc", 3);
+    EXPECT_TRUE(client->compareAndSwap(0, "alpha", 5, "abc", 3, "xyz", 3));
+    Buffer value;
+    client->read(0, "alpha", 5, &value);
+    EXPECT_EQ("xyz", TestUtil::toString(&value));
+
+    // The object's id alone doesn't name it.
+    EXPECT_THROW(client->compareAndSwap(0, Object::hashKey("alpha", 5),
+                                        "xyz", 3, "abc", 3),
+                 ObjectDoesntExistException);
+}
+
 TEST_F(MasterServiceTest, create_basics) {
     uint64_t version;
     EXPECT_EQ(0U, client->create(0, "item0", 5, &version));
@@ -173,6 +291,350 @@ TEST_F(MasterServiceTest, create_badTable) {
                  TableDoesntExistException);
 }
 
+TEST_F(MasterServiceTest, create_skipsIdsServedElsewhere) {
+    // Serve only the lower half of table 0's tablet key space; the tablet
+    // key of id 1 falls in the upper half.
+    ProtoBuf::Tablets newTablets;
+    appendTablet(newTablets, 0, 0, 0, ~0UL >> 1);
+    newTablets.mutable_tablet(0)->set_state(
+        ProtoBuf::Tablets::Tablet::NORMAL);
+    service->setTablets(newTablets);
+    EXPECT_EQ(0U, client->create(0, "item0", 5));
+    EXPECT_EQ(2U, client->create(0, "item2", 5));
+    EXPECT_EQ(3U, client->create(0, "item3", 5));
+}
+
+TEST_F(MasterServiceTest, enumerateTable) {
+    for (uint32_t i = 0; i < 100; i++)
+        client->create(0, "item", 4);
+    client->write(0, "alpha", 5, "abcdef", 6);
+
+    EnumerateTableRpc::Cursor cursor;
+    memset(&cursor, 0, sizeof(cursor));
+    std::map<uint64_t, uint32_t> seen;
+    EXPECT_TRUE(enumerate(&cursor, &seen));
+    EXPECT_EQ(101U, seen.size());
+    EXPECT_EQ(1U, seen[99]);
+    EXPECT_EQ(1U, seen[Object::hashKey("alpha", 5)]);
+    EXPECT_EQ(service->objectMap.getNumBuckets(), cursor.numBuckets);
+    EXPECT_EQ(cursor.numBuckets, cursor.nextBucket);
+    EXPECT_EQ(101U, metrics->master.enumerateObjects);
+}
+
+TEST_F(MasterServiceTest, enumerateTable_badArguments) {
+    EnumerateTableRpc::Cursor cursor;
+    memset(&cursor, 0, sizeof(cursor));
+    Buffer objects;
+    uint64_t tabletLastId;
+    bool done;
+    EXPECT_THROW(client->enumerateTable(4, 0, &cursor, &tabletLastId, &done,
+                                        &objects),
+                 TableDoesntExistException);
+    cursor.numBuckets = 3;
+    EXPECT_THROW(client->enumerateTable(0, 0, &cursor, &tabletLastId, &done,
+                                        &objects),
+                 RequestFormatError);
+    cursor.numBuckets = 4;
+    cursor.nextBucket = 5;
+    EXPECT_THROW(client->enumerateTable(0, 0, &cursor, &tabletLastId, &done,
+                                        &objects),
+                 RequestFormatError);
+}
+
+TEST_F(MasterServiceTest, enumerateTable_tableGrows) {
+    for (uint32_t i = 0; i < 100; i++)
+        client->create(0, "item", 4);
+
+    // Each request returns a single bucket's worth of objects.
+    service->maxMultiReadReplyBytes = 1;
+    EnumerateTableRpc::Cursor cursor;
+    memset(&cursor, 0, sizeof(cursor));
+    std::map<uint64_t, uint32_t> seen;
+    EXPECT_FALSE(enumerate(&cursor, &seen, 10));
+    uint64_t numBuckets = service->objectMap.getNumBuckets();
+
+    // Continue part way through a resize, and after it.
+    service->objectMap.startResize(2 * numBuckets);
+    service->objectMap.rehash(numBuckets / 2);
+    EXPECT_FALSE(enumerate(&cursor, &seen, 10));
+    while (service->objectMap.isResizing())
+        service->resizeObjectMap();
+    EXPECT_TRUE(enumerate(&cursor, &seen));
+
+    EXPECT_EQ(numBuckets, cursor.numBuckets);
+    EXPECT_EQ(100U, seen.size());
+    typedef std::map<uint64_t, uint32_t>::value_type Seen;
+    foreach (const Seen& s, seen)
+        EXPECT_EQ(1U, s.second) << "object " << s.first;
+}
+
+TEST_F(MasterServiceTest, enumerateTable_cursorFromLargerTable) {
+    for (uint32_t i = 0; i < 100; i++)
+        client->create(0, "item", 4);
+
+    // A cursor from a master with a larger hash table, as after migration.
+    EnumerateTableRpc::Cursor cursor;
+    cursor.nextBucket = 0;
+    cursor.numBuckets = 4 * service->objectMap.getNumBuckets();
+    std::map<uint64_t, uint32_t> seen;
+    EXPECT_TRUE(enumerate(&cursor, &seen));
+    EXPECT_EQ(100U, seen.size());
+    typedef std::map<uint64_t, uint32_t>::value_type Seen;
+    foreach (const Seen& s, seen)
+        EXPECT_EQ(1U, s.second) << "object " << s.first;
+}
+
+TEST_F(MasterServiceTest, increment) {
+    uint64_t version;
+    EXPECT_EQ(5, client->increment(0, 3, 5, NULL, &version));
+    EXPECT_EQ(1U, version);
+    EXPECT_EQ(-2, client->increment(0, 3, -7, NULL, &version));
+    EXPECT_EQ(2U, version);
+
+    Buffer value;
+    client->read(0, 3, &value);
+    ASSERT_EQ(sizeof(int64_t), value.getTotalLength());
+    EXPECT_EQ(-2, *value.getStart<int64_t>());
+}
+
+TEST_F(MasterServiceTest, increment_overflow) {
+    int64_t max = std::numeric_limits<int64_t>::max();
+    client->increment(0, 3, max);
+    EXPECT_EQ(std::numeric_limits<int64_t>::min(),
+              client->increment(0, 3, 1));
+}
+
+TEST_F(MasterServiceTest, increment_badArguments) {
+    EXPECT_THROW(client->increment(4, 3, 1),
+                 TableDoesntExistException);
+    client->write(0, 3, "abc", 3);
+    EXPECT_THROW(client->increment(0, 3, 1),
+                 InvalidObjectException);
+}
+
+TEST_F(MasterServiceTest, increment_rejectRules) {
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.doesntExist = true;
+    uint64_t version;
+    EXPECT_THROW(client->increment(0, 3, 1, &rules, &version),
+                 ObjectDoesntExistException);
+    EXPECT_EQ(VERSION_NONEXISTENT, version);
+    client->increment(0, 3, 1);
+    EXPECT_EQ(2, client->increment(0, 3, 1, &rules));
+}
+
+TEST_F(MasterServiceTest, increment_stringKey) {
+    int64_t zero = 0;
+    client->write(0, "alpha", 5, &zero, sizeof(zero));
+    EXPECT_EQ(1, client->increment(0, "alpha", 5, 1));
+    Buffer value;
+    client->read(0, "alpha", 5, &value);
+    EXPECT_EQ(1, *value.getStart<int64_t>());
+
+    // The object's id alone doesn't name it.
+    EXPECT_THROW(client->increment(0, Object::hashKey("alpha", 5), 1),
+                 ObjectDoesntExistException);
+}
+
+TEST_F(MasterServiceTest, increment_keepsExpiry) {
+    int64_t zero = 0;
+    mockWallTimeValue = 100;
+    client->write(0, 3, &zero, sizeof(zero), NULL, NULL, false, 10);
+    client->increment(0, 3, 1);
+    LogEntryHandle handle = service->objectMap.lookup(0, 3);
+    EXPECT_EQ(110U, handle->userData<Object>()->expiry);
+    mockWallTimeValue = 0;
+}
+
+TEST_F(MasterServiceTest, migrateTablet) {
+    ServerConfig master2Config = ServerConfig::forTesting();
+    master2Config.localLocator = "mock:host=master2";
+    master2Config.services = {MASTER_SERVICE, MEMBERSHIP_SERVICE};
+    master2Config.master.numReplicas = 1;
+    Server* server2 = cluster.addServer(master2Config);
+    MasterService* service2 = server2->master.get();
+    auto client2 = cluster.get<MasterClient>(server2);
+
+    // The coordinator must know who owns the tablet to reassign it.
+    ProtoBuf::Tablets::Tablet& tablet(
+        *cluster.coordinator->tabletMap.add_tablet());
+    tablet.set_table_id(0);
+    tablet.set_start_object_id(0);
+    tablet.set_end_object_id(~0UL);
+    tablet.set_state(ProtoBuf::Tablets::Tablet::NORMAL);
+    tablet.set_server_id(service->serverId.getId());
+    tablet.set_service_locator("mock:host=master");
+
+    client->write(0, 1, "one", 3);
+    client->write(0, 2, "two", 3);
+    client->remove(0, 2);
+
+    client->migrateTablet(0, 0, ~0UL, server2->serverId);
+
+    Buffer value;
+    EXPECT_THROW(client->read(0, 1, &value), TableDoesntExistException);
+    EXPECT_EQ(0, service->tablets.tablet_size());
+    EXPECT_FALSE(service->migration);
+    EXPECT_EQ(NULL, service->objectMap.lookup(0, 1));
+
+    client2->read(0, 1, &value);
+    EXPECT_EQ("one", TestUtil::toString(&value));
+    EXPECT_THROW(client2->read(0, 2, &value), ObjectDoesntExistException);
+    ASSERT_EQ(1, service2->tablets.tablet_size());
+    EXPECT_EQ(ProtoBuf::Tablets::Tablet::NORMAL,
+              service2->tablets.tablet(0).state());
+    EXPECT_EQ(server2->serverId.getId(),
+              cluster.coordinator->tabletMap.tablet(0).server_id());
+
+    // The new owner must not reuse the removed object's version.
+    uint64_t version;
+    client2->write(0, 2, "again", 5, NULL, &version);
+    EXPECT_EQ(3U, version);
+}
+
+TEST_F(MasterServiceTest, migrateTablet_badArguments) {
+    // The new owner must be some other server we know of.
+    EXPECT_THROW(client->migrateTablet(0, 0, ~0UL, ServerId(9, 0)),
+                 RequestFormatError);
+    EXPECT_THROW(client->migrateTablet(0, 0, 10, service->serverId),
+                 RequestFormatError);
+
+    ServerConfig master2Config = ServerConfig::forTesting();
+    master2Config.localLocator = "mock:host=master2";
+    master2Config.services = {MASTER_SERVICE, MEMBERSHIP_SERVICE};
+    ServerId master2Id = cluster.addServer(master2Config)->serverId;
+    // Only whole tablets can be migrated.
+    EXPECT_THROW(client->migrateTablet(0, 0, 10, master2Id),
+                 TableDoesntExistException);
+}
+
+TEST_F(MasterServiceTest, reassignMigratedTablet) {
+    ProtoBuf::Tablets::Tablet& tablet(
+        *cluster.coordinator->tabletMap.add_tablet());
+    tablet.set_table_id(0);
+    tablet.set_start_object_id(0);
+    tablet.set_end_object_id(~0UL);
+    tablet.set_state(ProtoBuf::Tablets::Tablet::NORMAL);
+    tablet.set_server_id(service->serverId.getId());
+    tablet.set_service_locator("mock:host=master");
+
+    // The new owner is gone and never got the tablet: keep it.
+    EXPECT_FALSE(service->reassignMigratedTablet(0, 0, ~0UL,
+                                                 ServerId(9, 0)));
+
+    // The coordinator already moved the tablet; the reply was lost.
+    tablet.set_server_id(ServerId(9, 0).getId());
+    EXPECT_TRUE(service->reassignMigratedTablet(0, 0, ~0UL,
+                                                ServerId(9, 0)));
+}
+
+TEST_F(MasterServiceTest, migrateTablet_whileSplitting) {
+    ServerConfig master2Config = ServerConfig::forTesting();
+    master2Config.localLocator = "mock:host=master2";
+    master2Config.services = {MASTER_SERVICE, MEMBERSHIP_SERVICE};
+    ServerId master2Id = cluster.addServer(master2Config)->serverId;
+
+    service->splittingTablet = true;
+    EXPECT_EQ(STATUS_RETRY,
+              service->migrateTablet(0, 0, ~0UL, master2Id));
+    EXPECT_FALSE(service->migration);
+    service->splittingTablet = false;
+}
+
+TEST_F(MasterServiceTest, migrateTablet_preparedTransaction) {
+    ServerConfig master2Config = ServerConfig::forTesting();
+    master2Config.localLocator = "mock:host=master2";
+    master2Config.services = {MASTER_SERVICE, MEMBERSHIP_SERVICE};
+    ServerId master2Id = cluster.addServer(master2Config)->serverId;
+
+    std::vector<MasterClient::TransactionObject*> objects;
+    MasterClient::TransactionObject object(0, 5, "abc", 3);
+    objects.push_back(&object);
+    MasterClient::PrepareTransaction(*client, 17, objects).complete();
+
+    // The transaction's intents would be left behind.
+    EXPECT_EQ(STATUS_RETRY,
+              service->migrateTablet(0, 0, ~0UL, master2Id));
+    EXPECT_FALSE(service->migration);
+    EXPECT_TRUE(service->preparedInTablet(0, 0, ~0UL));
+    MasterClient::DecideTransaction(*client, 17, objects, false).complete();
+}
+
+TEST_F(MasterServiceTest, markMigrationDirty) {
+    // The migration covers tablet keys 0 through 10.
+    uint64_t id1 = Object::objectIdForTabletKey(1);
+    uint64_t id3 = Object::objectIdForTabletKey(3);
+    uint64_t id11 = Object::objectIdForTabletKey(11);
+    client->write(0, id3, "abc", 3);
+    service->migration.construct(0, 0, 10);
+    client->write(0, id1, "abc", 3);
+    client->remove(0, id3);
+    client->write(0, id11, "abc", 3);
+    EXPECT_EQ(2U, service->migration->dirty.size());
+    EXPECT_EQ(1U, service->migration->dirty.count(std::make_pair(id1, 0UL)));
+    EXPECT_EQ(1U, service->migration->dirty.count(std::make_pair(id3, 0UL)));
+    service->migration.destroy();
+}
+
+TEST_F(MasterServiceTest, markMigrationDirty_blocked) {
+    uint64_t id1 = Object::objectIdForTabletKey(1);
+    uint64_t id3 = Object::objectIdForTabletKey(3);
+    uint64_t id11 = Object::objectIdForTabletKey(11);
+    client->write(0, id3, "abc", 3);
+    service->migration.construct(0, 0, 10);
+    service->migration->blocked = true;
+    EXPECT_THROW(client->write(0, id1, "abc", 3), RetryException);
+    EXPECT_THROW(client->remove(0, id3), RetryException);
+    client->write(0, id11, "abc", 3);
+    EXPECT_EQ(0U, service->migration->dirty.size());
+    service->migration.destroy();
+    client->write(0, id1, "abc", 3);
+}
+
+TEST_F(MasterServiceTest, copyDirtyObjects) {
+    client->write(0, 1, "abc", 3);
+    service->migration.construct(0, 0, 10);
+    service->markMigrationDirty(0, 1, 0);
+    service->markMigrationDirty(0, 2, 0);
+
+    service->copyDirtyObjects(1);
+    EXPECT_EQ(1U, service->migration->dirty.size());
+    service->copyDirtyObjects(10);
+    EXPECT_EQ(0U, service->migration->dirty.size());
+
+    Buffer& batch = service->migration->batch;
+    RecoverySegmentIterator it(batch.getRange(0, batch.getTotalLength()),
+                               batch.getTotalLength());
+    ASSERT_FALSE(it.isDone());
+    EXPECT_EQ(LOG_ENTRY_TYPE_OBJ, it.getType());
+    EXPECT_TRUE(it.isChecksumValid());
+    it.next();
+    ASSERT_FALSE(it.isDone());
+    EXPECT_EQ(LOG_ENTRY_TYPE_OBJTOMB, it.getType());
+    EXPECT_TRUE(it.isChecksumValid());
+    const ObjectTombstone* tomb =
+        static_cast<const ObjectTombstone*>(it.getPointer());
+    EXPECT_EQ(2U, tomb->id.objectId);
+    EXPECT_EQ(1U, tomb->objectVersion);
+    it.next();
+    EXPECT_TRUE(it.isDone());
+    service->migration.destroy();
+}
+
+TEST_F(MasterServiceTest, prepForMigration_overlap) {
+    EXPECT_THROW(client->prepForMigration(0, 5, 10, ServerId(9, 0)),
+                 RequestFormatError);
+
+    client->prepForMigration(7, 0, 10, ServerId(9, 0));
+    ASSERT_EQ(2, service->tablets.tablet_size());
+    EXPECT_EQ(ProtoBuf::Tablets::Tablet::RECOVERING,
+              service->tablets.tablet(1).state());
+    // Retrying after a failed migration is fine.
+    client->prepForMigration(7, 0, 10, ServerId(9, 0));
+    EXPECT_EQ(2, service->tablets.tablet_size());
+}
+
 TEST_F(MasterServiceTest, read_basics) {
     client->create(0, "abcdef", 6);
     Buffer value;
@@ -182,6 +644,24 @@ TEST_F(MasterServiceTest, read_basics) {
     EXPECT_EQ("abcdef", TestUtil::toString(&value));
 }
 
+TEST_F(MasterServiceTest, read_tabletNotNormal) {
+    client->write(0, 1, "abc", 3);
+    ProtoBuf::Tablets newTablets(service->tablets);
+    newTablets.mutable_tablet(0)->set_state(
+        ProtoBuf::Tablets::Tablet::RECOVERING);
+    service->setTablets(newTablets);
+
+    // Clients with stale tablet maps must wait until it's filled.
+    Buffer value;
+    EXPECT_THROW(client->read(0, 1, &value), RetryException);
+    EXPECT_THROW(client->write(0, 1, "def", 3), RetryException);
+    EXPECT_THROW(client->remove(0, 1), RetryException);
+
+    service->markTabletsNormal(newTablets);
+    client->read(0, 1, &value);
+    EXPECT_EQ("abc", TestUtil::toString(&value));
+}
+
 TEST_F(MasterServiceTest, read_badTable) {
     Buffer value;
     EXPECT_THROW(client->read(4, 0, &value),
@@ -208,6 +688,26 @@ TEST_F(MasterServiceTest, read_rejectRules) {
     EXPECT_EQ(1U, version);
 }
 
+TEST_F(MasterServiceTest, read_stringKey) {
+    client->write(0, "alpha", 5, "abcdef", 6);
+    Buffer value;
+    uint64_t version;
+    client->read(0, "alpha", 5, &value, NULL, &version);
+    EXPECT_EQ(1U, version);
+    EXPECT_EQ("abcdef", TestUtil::toString(&value));
+
+    // The object's id alone doesn't name it.
+    EXPECT_THROW(client->read(0, Object::hashKey("alpha", 5), &value),
+                 ObjectDoesntExistException);
+
+    // An object at the same id with a different key doesn't match.
+    client->write(0, Object::hashKey("beta", 4), "ghi", 3);
+    EXPECT_THROW(client->read(0, "beta", 4, &value),
+                 ObjectDoesntExistException);
+    EXPECT_THROW(client->read(0, "gamma", 5, &value),
+                 ObjectDoesntExistException);
+}
+
 TEST_F(MasterServiceTest, multiRead_basics) {
     client->create(0, "firstVal", 8);
     client->create(0, "secondVal", 9);
@@ -233,6 +733,35 @@ TEST_F(MasterServiceTest, multiRead_basics) {
     EXPECT_EQ("secondVal", TestUtil::toString(val2.get()));
 }
 
+TEST_F(MasterServiceTest, multiRead_stringKey) {
+    client->write(0, "alpha", 5, "abcdef", 6);
+    client->write(0, Object::hashKey("alpha", 5), "ghi", 3);
+
+    std::vector<MasterClient::ReadObject*> requests;
+
+    Tub<Buffer> val1;
+    MasterClient::ReadObject request1(0, "alpha", 5, &val1);
+    request1.status = STATUS_RETRY;
+    requests.push_back(&request1);
+    Tub<Buffer> val2;
+    MasterClient::ReadObject request2(0, Object::hashKey("alpha", 5), &val2);
+    request2.status = STATUS_RETRY;
+    requests.push_back(&request2);
+    Tub<Buffer> val3;
+    MasterClient::ReadObject request3(0, "beta", 4, &val3);
+    request3.status = STATUS_RETRY;
+    requests.push_back(&request3);
+
+    client->multiRead(requests);
+
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request1.status));
+    EXPECT_EQ("abcdef", TestUtil::toString(val1.get()));
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request2.status));
+    EXPECT_EQ("ghi", TestUtil::toString(val2.get()));
+    EXPECT_STREQ("STATUS_OBJECT_DOESNT_EXIST",
+                 statusToSymbol(request3.status));
+}
+
 TEST_F(MasterServiceTest, multiRead_badTable) {
     client->create(0, "value1", 6);
 
@@ -290,6 +819,156 @@ TEST_F(MasterServiceTest, multiRead_noSuchObject) {
     EXPECT_EQ("secondVal", TestUtil::toString(val2.get()));
 }
 
+TEST_F(MasterServiceTest, multiRead_replyFull) {
+    client->create(0, "firstVal", 8);
+    client->create(0, "secondVal", 9);
+    client->create(0, "thirdVal", 8);
+    service->maxMultiReadReplyBytes = 1;
+
+    std::vector<MasterClient::ReadObject*> requests;
+    Tub<Buffer> val1;
+    MasterClient::ReadObject requestError(0, 20, &val1);
+    requests.push_back(&requestError);
+    Tub<Buffer> val2;
+    MasterClient::ReadObject request2(0, 1, &val2);
+    requests.push_back(&request2);
+    Tub<Buffer> val3;
+    MasterClient::ReadObject request3(0, 2, &val3);
+    requests.push_back(&request3);
+
+    client->multiRead(requests);
+
+    // The first object is always returned, however large; the rest are
+    // left for the client to ask for again.
+    EXPECT_STREQ("STATUS_OBJECT_DOESNT_EXIST",
+                 statusToSymbol(requestError.status));
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request2.status));
+    EXPECT_EQ("secondVal", TestUtil::toString(val2.get()));
+    EXPECT_STREQ("STATUS_RETRY", statusToSymbol(request3.status));
+    EXPECT_FALSE(val3);
+}
+
+TEST_F(MasterServiceTest, multiRemove_basics) {
+    client->create(0, "firstVal", 8);
+    client->create(0, "secondVal", 9);
+
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.versionNeGiven = true;
+    rules.givenVersion = 1;
+
+    std::vector<MasterClient::RemoveObject*> requests;
+    MasterClient::RemoveObject request1(0, 0);
+    requests.push_back(&request1);
+    MasterClient::RemoveObject requestRejected(0, 1, &rules);
+    requests.push_back(&requestRejected);
+    MasterClient::RemoveObject requestNoSuchObject(0, 20);
+    requests.push_back(&requestNoSuchObject);
+    MasterClient::RemoveObject requestBadTable(10, 0);
+    requests.push_back(&requestBadTable);
+
+    client->multiRemove(requests);
+
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request1.status));
+    EXPECT_EQ(1U, request1.version);
+    EXPECT_STREQ("STATUS_WRONG_VERSION",
+                 statusToSymbol(requestRejected.status));
+    EXPECT_EQ(2U, requestRejected.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(requestNoSuchObject.status));
+    EXPECT_EQ(VERSION_NONEXISTENT, requestNoSuchObject.version);
+    EXPECT_STREQ("STATUS_TABLE_DOESNT_EXIST",
+                 statusToSymbol(requestBadTable.status));
+
+    Buffer value;
+    EXPECT_THROW(client->read(0, 0, &value), ObjectDoesntExistException);
+    client->read(0, 1, &value);
+    EXPECT_EQ("secondVal", TestUtil::toString(&value));
+}
+
+TEST_F(MasterServiceTest, multiWrite_basics) {
+    client->create(0, "firstVal", 8);
+
+    std::vector<MasterClient::WriteObject*> requests;
+    MasterClient::WriteObject request1(0, 0, "overwrite", 9);
+    request1.status = STATUS_RETRY;
+    requests.push_back(&request1);
+    MasterClient::WriteObject request2(0, 5, "newVal", 6);
+    request2.status = STATUS_RETRY;
+    requests.push_back(&request2);
+    MasterClient::WriteObject requestBadTable(10, 0, "badTable", 8);
+    requests.push_back(&requestBadTable);
+
+    client->multiWrite(requests);
+
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request1.status));
+    EXPECT_EQ(2U, request1.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request2.status));
+    EXPECT_EQ(2U, request2.version);
+    EXPECT_STREQ("STATUS_TABLE_DOESNT_EXIST",
+                 statusToSymbol(requestBadTable.status));
+
+    Buffer value;
+    uint64_t version;
+    client->read(0, 0, &value, NULL, &version);
+    EXPECT_EQ("overwrite", TestUtil::toString(&value));
+    EXPECT_EQ(2U, version);
+    client->read(0, 5, &value, NULL, &version);
+    EXPECT_EQ("newVal", TestUtil::toString(&value));
+    EXPECT_EQ(2U, version);
+}
+
+TEST_F(MasterServiceTest, multiWrite_rejectRules) {
+    client->create(0, "firstVal", 8);
+
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.versionNeGiven = true;
+    rules.givenVersion = 2;
+
+    std::vector<MasterClient::WriteObject*> requests;
+    MasterClient::WriteObject requestRejected(0, 0, "rejected", 8, &rules);
+    requests.push_back(&requestRejected);
+    MasterClient::WriteObject request2(0, 1, "accepted", 8);
+    requests.push_back(&request2);
+
+    client->multiWrite(requests);
+
+    EXPECT_STREQ("STATUS_WRONG_VERSION",
+                 statusToSymbol(requestRejected.status));
+    EXPECT_EQ(1U, requestRejected.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request2.status));
+
+    Buffer value;
+    client->read(0, 0, &value);
+    EXPECT_EQ("firstVal", TestUtil::toString(&value));
+    client->read(0, 1, &value);
+    EXPECT_EQ("accepted", TestUtil::toString(&value));
+}
+
+TEST_F(MasterServiceTest, multiWrite_sameObjectTwice) {
+    std::vector<MasterClient::WriteObject*> requests;
+    MasterClient::WriteObject request1(0, 7, "first", 5);
+    requests.push_back(&request1);
+    MasterClient::WriteObject request2(0, 7, "second", 6);
+    requests.push_back(&request2);
+
+    uint64_t appendsBefore = service->log.stats.getAppends();
+    client->multiWrite(requests);
+
+    // The second write must see the first, so the batch is split and the
+    // second write also logs a tombstone for the first.
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request1.status));
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request2.status));
+    EXPECT_EQ(request1.version + 1, request2.version);
+    EXPECT_EQ(3U, service->log.stats.getAppends() - appendsBefore);
+
+    Buffer value;
+    uint64_t version;
+    client->read(0, 7, &value, NULL, &version);
+    EXPECT_EQ("second", TestUtil::toString(&value));
+    EXPECT_EQ(request2.version, version);
+}
+
 TEST_F(MasterServiceTest, detectSegmentRecoveryFailure_success) {
     typedef MasterService::Replica::State State;
     vector<MasterService::Replica> replicas {
@@ -684,6 +1363,140 @@ TEST_F(MasterServiceTest, recoverSegment) {
     free(seg);
 }
 
+TEST_F(MasterServiceTest, recoverSegment_sameObjectInBatch) {
+    // Several versions of an object replayed in the same lookup batch:
+    // each must see what the previous one left in the hash table rather
+    // than what was there when the batch was looked up.
+    uint32_t segLen = 8192;
+    char* seg = static_cast<char*>(Memory::xmemalign(HERE, segLen, segLen));
+    Segment s(0UL, 0, seg, segLen, NULL);
+    struct {
+        uint64_t objId;
+        uint64_t version;
+        const char* contents;
+    } objects[] = {
+        { 2100, 1, "one" },
+        { 2101, 1, "other" },
+        { 2100, 3, "three" },
+        { 2100, 2, "two" },
+    };
+    for (uint32_t i = 0; i < unsafeArrayLength(objects); i++) {
+        uint32_t len = downCast<uint32_t>(strlen(objects[i].contents)) + 1;
+        DECLARE_OBJECT(newObject, len);
+        newObject->id.objectId = objects[i].objId;
+        newObject->id.tableId = 0;
+        newObject->version = objects[i].version;
+        strcpy(newObject->data, objects[i].contents); // NOLINT
+        s.append(LOG_ENTRY_TYPE_OBJ, newObject, newObject->objectLength(len));
+    }
+    ObjectTombstone tomb(0, 0, 2101, 1);
+    const void* p = s.append(LOG_ENTRY_TYPE_OBJTOMB, &tomb,
+                             sizeof(tomb))->userData();
+    s.close(NULL);
+
+    uint64_t discards = metrics->master.objectDiscardCount;
+    service->recoverSegment(0, seg,
+            downCast<uint32_t>(static_cast<const char*>(p) - seg));
+    verifyRecoveryObject(0, 2100, "three");
+    EXPECT_EQ(discards + 1, metrics->master.objectDiscardCount);
+    Buffer value;
+    EXPECT_THROW(client->read(0, 2101, &value),
+                 ObjectDoesntExistException);
+
+    free(seg);
+}
+
+
+TEST_F(MasterServiceTest, recoverSegment_transactions) {
+    // Transaction 17 was decided; 18 wasn't.
+    Buffer segment;
+    appendIntent(segment, 17, 1, "decided");
+    appendIntent(segment, 18, 2, "two");
+    appendIntent(segment, 18, 3, "three");
+    TransactionDecision decision(17, true, 0);
+    appendRecoveryEntry(segment, LOG_ENTRY_TYPE_TXDECISION,
+                        &decision, sizeof(decision));
+    uint32_t length = segment.getTotalLength();
+
+    MasterService::RecoveredTransactions transactions;
+    service->recoverSegment(0, segment.getRange(0, length), length,
+                            &transactions);
+    ASSERT_EQ(2U, transactions.size());
+    EXPECT_TRUE(transactions[17].decided);
+    EXPECT_FALSE(transactions[18].decided);
+    EXPECT_EQ(2U, transactions[18].parts.size());
+
+    {
+        std::lock_guard<SpinLock> lock(service->objectUpdateLock);
+        service->restorePreparedTransactions(transactions);
+    }
+    EXPECT_EQ(0U, transactions.size());
+    ASSERT_EQ(1U, service->preparedTransactions.size());
+    MasterService::PreparedTransaction& prepared =
+        *service->preparedTransactions[18];
+    EXPECT_EQ(2U, prepared.count);
+    EXPECT_EQ(2U, prepared.intents.size());
+    EXPECT_EQ(0U, prepared.expiryTime);
+    EXPECT_FALSE(service->lockedByTransaction(0, 1));
+    EXPECT_TRUE(service->lockedByTransaction(0, 2));
+    EXPECT_TRUE(service->lockedByTransaction(0, 3));
+
+    // Its client is gone, so whoever writes next has the coordinator
+    // abort it.
+    EXPECT_THROW(client->write(0, 2, "abc", 3), RetryException);
+    EXPECT_EQ(0U, service->preparedTransactions.size());
+    client->write(0, 2, "abc", 3);
+    Buffer value;
+    EXPECT_THROW(client->read(0, 3, &value), ObjectDoesntExistException);
+
+    // Without a place to put them, transactions are dropped.
+    service->recoverSegment(0, segment.getRange(0, length), length);
+    EXPECT_EQ(0U, service->preparedTransactions.size());
+}
+TEST_F(MasterServiceTest, tombstoneReaper) {
+    ObjectTombstone tomb(0, 0, 2002, 1);
+    LogEntryHandle logTomb = service->log.append(LOG_ENTRY_TYPE_OBJTOMB,
+        &tomb, sizeof(tomb));
+    service->objectMap.replace(logTomb);
+    client->write(0, 2003, "live", 4);
+
+    service->tombstoneReaper.construct(*service);
+    MasterService::TombstoneReaper& reaper = *service->tombstoneReaper;
+    reaper.poll();
+    EXPECT_EQ(logTomb, service->objectMap.lookup(0, 2002));
+
+    // A worker holding the update lock holds up the sweep without
+    // blocking the dispatch thread.
+    reaper.start();
+    service->objectUpdateLock.lock();
+    reaper.poll();
+    service->objectUpdateLock.unlock();
+    EXPECT_EQ(0U, reaper.nextBucket);
+
+    // So does a restart replaying its former log.
+    service->replayingRestart = true;
+    reaper.poll();
+    EXPECT_EQ(0U, reaper.nextBucket);
+    service->removeTombstones();
+    EXPECT_EQ(logTomb, service->objectMap.lookup(0, 2002));
+    service->replayingRestart = false;
+
+    uint64_t sweeps = metrics->master.tombstoneReapSweeps;
+    uint64_t numPolls = 0;
+    while (reaper.isRunning()) {
+        reaper.poll();
+        ++numPolls;
+    }
+    uint64_t numBuckets = service->objectMap.getNumBuckets();
+    EXPECT_EQ((numBuckets + MasterService::TOMBSTONE_REAP_BUCKETS_PER_POLL
+               - 1) / MasterService::TOMBSTONE_REAP_BUCKETS_PER_POLL,
+              numPolls);
+    EXPECT_EQ(sweeps + 1, metrics->master.tombstoneReapSweeps);
+    EXPECT_EQ(0U, metrics->master.tombstoneReapPendingBuckets);
+    EXPECT_TRUE(NULL == service->objectMap.lookup(0, 2002));
+    EXPECT_TRUE(NULL != service->objectMap.lookup(0, 2003));
+}
+
 TEST_F(MasterServiceTest, remove_basics) {
     client->create(0, "item0", 5);
 
@@ -732,6 +1545,68 @@ TEST_F(MasterServiceTest, remove_objectAlreadyDeleted) {
     EXPECT_EQ(VERSION_NONEXISTENT, version);
 }
 
+TEST_F(MasterServiceTest, remove_stringKey) {
+    client->write(0, "alpha", 5, "abcdef", 6);
+    uint64_t version;
+
+    // Only the object's own key removes it.
+    client->write(0, Object::hashKey("beta", 4), "ghi", 3);
+    client->remove(0, "beta", 4, NULL, &version);
+    EXPECT_EQ(VERSION_NONEXISTENT, version);
+    Buffer value;
+    client->read(0, Object::hashKey("beta", 4), &value);
+    EXPECT_EQ("ghi", TestUtil::toString(&value));
+
+    client->remove(0, "alpha", 5, NULL, &version);
+    EXPECT_EQ(1U, version);
+    EXPECT_THROW(client->read(0, "alpha", 5, &value),
+                 ObjectDoesntExistException);
+}
+
+TEST_F(MasterServiceTest, abortRestart) {
+    client->create(0, "item0", 5);
+
+    // Pretend table 1 was being reloaded from a former log.
+    ProtoBuf::Tablets restartTablets;
+    ProtoBuf::Tablets::Tablet& tablet(*restartTablets.add_tablet());
+    tablet.set_table_id(1);
+    tablet.set_start_object_id(0);
+    tablet.set_end_object_id(~0UL);
+    tablet.set_state(ProtoBuf::Tablets::Tablet::RECOVERING);
+    tablet.set_user_data(0);
+    ProtoBuf::Tablets newTablets(service->tablets);
+    newTablets.mutable_tablet()->MergeFrom(restartTablets.tablet());
+    service->setTablets(newTablets);
+    // Stand in for the replay, which clients can't do yet.
+    service->markTabletsNormal(restartTablets);
+    client->create(1, "item1", 5);
+
+    service->abortRestart(ServerId(9, 0), restartTablets);
+    EXPECT_EQ(1, service->tablets.tablet_size());
+    EXPECT_EQ(0U, service->tablets.tablet(0).table_id());
+    EXPECT_TRUE(service->objectMap.lookup(1, 0) == NULL);
+    EXPECT_TRUE(service->objectMap.lookup(0, 0) != NULL);
+    EXPECT_EQ(9U, restartTablets.tablet(0).server_id());
+}
+
+TEST_F(MasterServiceTest, resizeObjectMap) {
+    client->create(0, "item0", 5);
+    uint64_t numBuckets = service->objectMap.getNumBuckets();
+    EXPECT_FALSE(service->resizeObjectMap());
+    EXPECT_EQ(numBuckets, metrics->master.hashTableBuckets);
+    EXPECT_EQ(1U, metrics->master.hashTableEntries);
+
+    service->objectMap.startResize(2 * numBuckets);
+    while (service->objectMap.isResizing())
+        EXPECT_TRUE(service->resizeObjectMap());
+    EXPECT_FALSE(service->resizeObjectMap());
+    EXPECT_EQ(2 * numBuckets, metrics->master.hashTableBuckets);
+
+    Buffer value;
+    client->read(0, 0, &value);
+    EXPECT_EQ("item0", TestUtil::toString(&value));
+}
+
 TEST_F(MasterServiceTest, setTablets) {
 
     std::unique_ptr<Table> table1(new Table(1));
@@ -759,6 +1634,7 @@ TEST_F(MasterServiceTest, setTablets) {
         t2.set_end_object_id(1);
         t2.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
         t2.set_user_data(reinterpret_cast<uint64_t>(table2.release()));
+        service->tabletIndex.rebuild(service->tablets);
 
         EXPECT_EQ(format(
             "tablet { table_id: 1 start_object_id: 0 end_object_id: 1 "
@@ -805,6 +1681,232 @@ TEST_F(MasterServiceTest, setTablets) {
     }
 }
 
+TEST_F(MasterServiceTest, transaction) {
+    client->create(0, "firstVal", 8);
+    client->write(0, 7, "doomed", 6);
+
+    std::vector<MasterClient::TransactionObject*> objects;
+    MasterClient::TransactionObject overwrite(0, 0, "overwrite", 9);
+    objects.push_back(&overwrite);
+    MasterClient::TransactionObject create(0, 5, "newVal", 6);
+    objects.push_back(&create);
+    MasterClient::TransactionObject remove(0, 7);
+    objects.push_back(&remove);
+    MasterClient::TransactionObject removeMissing(0, 8);
+    objects.push_back(&removeMissing);
+
+    client->transaction(objects);
+    EXPECT_EQ(2U, overwrite.version);
+    EXPECT_EQ(3U, create.version);
+    EXPECT_EQ(2U, remove.version);
+    EXPECT_EQ(VERSION_NONEXISTENT, removeMissing.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(overwrite.status));
+
+    Buffer value;
+    client->read(0, 0, &value);
+    EXPECT_EQ("overwrite", TestUtil::toString(&value));
+    client->read(0, 5, &value);
+    EXPECT_EQ("newVal", TestUtil::toString(&value));
+    EXPECT_THROW(client->read(0, 7, &value), ObjectDoesntExistException);
+}
+
+TEST_F(MasterServiceTest, transaction_rejectRules) {
+    client->create(0, "firstVal", 8);
+    client->write(0, 1, "secondVal", 9);
+
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.versionNeGiven = true;
+    rules.givenVersion = 2;
+
+    std::vector<MasterClient::TransactionObject*> objects;
+    MasterClient::TransactionObject accepted(0, 0, "accepted", 8);
+    objects.push_back(&accepted);
+    MasterClient::TransactionObject rejected(0, 1, &rules);
+    objects.push_back(&rejected);
+
+    EXPECT_THROW(client->transaction(objects), WrongVersionException);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(accepted.status));
+    EXPECT_STREQ("STATUS_WRONG_VERSION", statusToSymbol(rejected.status));
+    EXPECT_EQ(1U, rejected.version);
+
+    // Nothing was applied, not even the object ahead of the rejected one.
+    Buffer value;
+    client->read(0, 0, &value);
+    EXPECT_EQ("firstVal", TestUtil::toString(&value));
+    client->read(0, 1, &value);
+    EXPECT_EQ("secondVal", TestUtil::toString(&value));
+}
+
+TEST_F(MasterServiceTest, transaction_badArguments) {
+    client->create(0, "firstVal", 8);
+
+    std::vector<MasterClient::TransactionObject*> objects;
+    MasterClient::TransactionObject first(0, 0, "abc", 3);
+    objects.push_back(&first);
+    MasterClient::TransactionObject badTable(10, 0, "def", 3);
+    objects.push_back(&badTable);
+    EXPECT_THROW(client->transaction(objects), TableDoesntExistException);
+
+    MasterClient::TransactionObject again(0, 0);
+    objects[1] = &again;
+    EXPECT_THROW(client->transaction(objects), RequestFormatError);
+
+    Buffer value;
+    client->read(0, 0, &value);
+    EXPECT_EQ("firstVal", TestUtil::toString(&value));
+}
+
+TEST_F(MasterServiceTest, transaction_tooLarge) {
+    uint32_t length = Segment::maximumAppendableBytes(
+                                service->log.getSegmentCapacity());
+    std::unique_ptr<char[]> buf(new char[length]);
+    std::vector<MasterClient::TransactionObject*> objects;
+    MasterClient::TransactionObject object(0, 0, buf.get(), length);
+    objects.push_back(&object);
+    EXPECT_THROW(client->transaction(objects), RequestFormatError);
+}
+
+TEST_F(MasterServiceTest, prepareTransaction) {
+    client->create(0, "firstVal", 8);
+
+    std::vector<MasterClient::TransactionObject*> objects;
+    MasterClient::TransactionObject overwrite(0, 0, "overwrite", 9);
+    objects.push_back(&overwrite);
+    MasterClient::TransactionObject create(0, 5, "newVal", 6);
+    objects.push_back(&create);
+    MasterClient::PrepareTransaction(*client, 17, objects).complete();
+    // Retries are harmless.
+    MasterClient::PrepareTransaction(*client, 17, objects).complete();
+
+    EXPECT_EQ(1U, service->preparedTransactions.size());
+    EXPECT_TRUE(service->lockedByTransaction(0, 0));
+    EXPECT_TRUE(service->lockedByTransaction(0, 5));
+    EXPECT_FALSE(service->lockedByTransaction(0, 6));
+
+    // Locked objects can be read, but not updated.
+    Buffer value;
+    client->read(0, 0, &value);
+    EXPECT_EQ("firstVal", TestUtil::toString(&value));
+    EXPECT_THROW(client->write(0, 0, "abc", 3), RetryException);
+    EXPECT_THROW(client->remove(0, 5), RetryException);
+    std::vector<MasterClient::TransactionObject*> others;
+    MasterClient::TransactionObject other(0, 5, "other", 5);
+    others.push_back(&other);
+    EXPECT_THROW(client->transaction(others), RetryException);
+
+    MasterClient::DecideTransaction(*client, 17, objects, true).complete();
+    EXPECT_EQ(2U, overwrite.version);
+    EXPECT_LT(1U, create.version);
+    EXPECT_EQ(0U, service->preparedTransactions.size());
+    EXPECT_FALSE(service->lockedByTransaction(0, 0));
+    client->read(0, 0, &value);
+    EXPECT_EQ("overwrite", TestUtil::toString(&value));
+    client->read(0, 5, &value);
+    EXPECT_EQ("newVal", TestUtil::toString(&value));
+    client->write(0, 0, "abc", 3);
+}
+
+TEST_F(MasterServiceTest, prepareTransaction_rejectRules) {
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.doesntExist = true;
+
+    std::vector<MasterClient::TransactionObject*> objects;
+    MasterClient::TransactionObject object(0, 0, "abc", 3, &rules);
+    objects.push_back(&object);
+    EXPECT_THROW(MasterClient::PrepareTransaction(*client, 17,
+                                                  objects).complete(),
+                 ObjectDoesntExistException);
+    EXPECT_STREQ("STATUS_OBJECT_DOESNT_EXIST",
+                 statusToSymbol(object.status));
+    EXPECT_EQ(0U, service->preparedTransactions.size());
+    EXPECT_FALSE(service->lockedByTransaction(0, 0));
+}
+
+TEST_F(MasterServiceTest, prepareTransaction_leaseExpires) {
+    TestLog::Enable _(&resolveTransactionsFilter);
+    client->create(0, "firstVal", 8);
+
+    std::vector<MasterClient::TransactionObject*> objects;
+    MasterClient::TransactionObject overwrite(0, 0, "overwrite", 9);
+    objects.push_back(&overwrite);
+    Cycles::mockTscValue = 1000;
+    MasterClient::PrepareTransaction(*client, 17, objects).complete();
+
+    // Not yet.
+    Cycles::mockTscValue += Cycles::fromNanoseconds(
+                                    PrepareTransactionRpc::LEASE_NS);
+    EXPECT_THROW(client->write(0, 0, "abc", 3), RetryException);
+    EXPECT_EQ(1U, service->preparedTransactions.size());
+
+    // The coordinator records an abort, since the client hasn't recorded
+    // a commit.
+    Cycles::mockTscValue++;
+    EXPECT_THROW(client->write(0, 0, "abc", 3), RetryException);
+    EXPECT_EQ(0U, service->preparedTransactions.size());
+    EXPECT_FALSE(service->lockedByTransaction(0, 0));
+    EXPECT_EQ("resolveTransactions: Transaction 17 aborts: its client "
+              "never decided it", TestLog::get());
+    EXPECT_FALSE(coordinator->setTransactionOutcome(17, true));
+    client->write(0, 0, "abc", 3);
+
+    // A late decision is harmless, and can't return versions.
+    MasterClient::DecideTransaction(*client, 17, objects, false).complete();
+    Buffer value;
+    client->read(0, 0, &value);
+    EXPECT_EQ("abc", TestUtil::toString(&value));
+    Cycles::mockTscValue = 0;
+}
+
+TEST_F(MasterServiceTest, prepareTransaction_leaseExpiresAfterCommit) {
+    client->create(0, "firstVal", 8);
+
+    std::vector<MasterClient::TransactionObject*> objects;
+    MasterClient::TransactionObject overwrite(0, 0, "overwrite", 9);
+    objects.push_back(&overwrite);
+    Cycles::mockTscValue = 1000;
+    MasterClient::PrepareTransaction(*client, 17, objects).complete();
+
+    // The client recorded its commit, but the decision never arrived.
+    EXPECT_TRUE(coordinator->setTransactionOutcome(17, true));
+    Cycles::mockTscValue += Cycles::fromNanoseconds(
+                                    PrepareTransactionRpc::LEASE_NS) + 1;
+    client->write(0, 1, "abc", 3);
+    EXPECT_EQ(0U, service->preparedTransactions.size());
+    Buffer value;
+    client->read(0, 0, &value);
+    EXPECT_EQ("overwrite", TestUtil::toString(&value));
+
+    // The decision turns up after all.
+    overwrite.version = 5;
+    MasterClient::DecideTransaction(*client, 17, objects, true).complete();
+    EXPECT_EQ(VERSION_NONEXISTENT, overwrite.version);
+    Cycles::mockTscValue = 0;
+}
+
+TEST_F(MasterServiceTest, decideTransaction_abort) {
+    client->create(0, "firstVal", 8);
+
+    std::vector<MasterClient::TransactionObject*> objects;
+    MasterClient::TransactionObject remove(0, 0);
+    objects.push_back(&remove);
+    MasterClient::PrepareTransaction(*client, 17, objects).complete();
+    MasterClient::DecideTransaction(*client, 17, objects, false).complete();
+
+    EXPECT_EQ(0U, service->preparedTransactions.size());
+    EXPECT_FALSE(service->lockedByTransaction(0, 0));
+    Buffer value;
+    client->read(0, 0, &value);
+    EXPECT_EQ("firstVal", TestUtil::toString(&value));
+
+    // Deciding a transaction that isn't prepared here is fine: it was
+    // decided already.
+    MasterClient::DecideTransaction(*client, 18, objects, false).complete();
+    MasterClient::DecideTransaction(*client, 18, objects, true).complete();
+    EXPECT_EQ(VERSION_NONEXISTENT, remove.version);
+}
+
 TEST_F(MasterServiceTest, write) {
     Buffer value;
     uint64_t version;
@@ -836,6 +1938,162 @@ TEST_F(MasterServiceTest, write_rejectRules) {
     EXPECT_EQ(VERSION_NONEXISTENT, version);
 }
 
+TEST_F(MasterServiceTest, write_stringKey) {
+    uint64_t version;
+    client->write(0, "alpha", 5, "abcdef", 6, NULL, &version);
+    EXPECT_EQ(1U, version);
+    client->write(0, "alpha", 5, "xyz", 3, NULL, &version);
+    EXPECT_EQ(2U, version);
+    Buffer value;
+    client->read(0, "alpha", 5, &value);
+    EXPECT_EQ("xyz", TestUtil::toString(&value));
+
+    LogEntryHandle handle = service->objectMap.lookup(0,
+                                        Object::hashKey("alpha", 5));
+    ASSERT_TRUE(handle != NULL);
+    const Object* obj = handle->userData<Object>();
+    EXPECT_EQ(5U, obj->keyLength);
+    EXPECT_TRUE(obj->keyMatches("alpha", 5));
+    EXPECT_EQ(3U, obj->valueLength(handle->length()));
+}
+
+TEST_F(MasterServiceTest, write_stringKeyCollision) {
+    // A keyless object at the key's id is a different object.
+    client->write(0, Object::hashKey("alpha", 5), "ghi", 3);
+    uint64_t version;
+    client->write(0, "alpha", 5, "abcdef", 6, NULL, &version);
+    EXPECT_EQ(2U, version);
+    Buffer value;
+    client->read(0, Object::hashKey("alpha", 5), &value);
+    EXPECT_EQ("ghi", TestUtil::toString(&value));
+    client->read(0, "alpha", 5, &value);
+    EXPECT_EQ("abcdef", TestUtil::toString(&value));
+
+    // So are objects whose keys hash to the same id; store two at id 42
+    // directly, since finding a real Murmur3 collision isn't practical.
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    Buffer alpha, beta;
+    Buffer::Chunk::appendToBuffer(&alpha, "alphaabc", 8);
+    Buffer::Chunk::appendToBuffer(&beta, "betaxyz", 7);
+    EXPECT_EQ(STATUS_OK, service->storeData(0, 42, &rules, &alpha, 0, 3,
+                                            &version, false, 5));
+    EXPECT_EQ(STATUS_OK, service->storeData(0, 42, &rules, &beta, 0, 3,
+                                            &version, false, 4));
+    client->write(0, 42, "keyless", 7);
+    EXPECT_EQ(STATUS_OK, service->storeData(0, 42, &rules, &alpha, 0, 3,
+                                            &version, false, 5));
+
+    LogEntryHandle handle = service->objectMap.lookup(0, 42,
+                                    MasterService::KeyMatcher("alpha", 5));
+    ASSERT_TRUE(handle != NULL);
+    EXPECT_EQ(version, handle->userData<Object>()->version);
+    handle = service->objectMap.lookup(0, 42,
+                                       MasterService::KeyMatcher("beta", 4));
+    ASSERT_TRUE(handle != NULL);
+    EXPECT_TRUE(handle->userData<Object>()->keyMatches("beta", 4));
+
+    // Removing one leaves the others alone.
+    client->remove(0, 42);
+    EXPECT_THROW(client->read(0, 42, &value), ObjectDoesntExistException);
+    EXPECT_TRUE(service->objectMap.lookup(0, 42,
+                        MasterService::KeyMatcher("alpha", 5)) != NULL);
+    EXPECT_TRUE(service->objectMap.lookup(0, 42,
+                        MasterService::KeyMatcher("beta", 4)) != NULL);
+}
+
+TEST_F(MasterServiceTest, write_syncAfterUpdateLock) {
+    uint64_t syncs = metrics->master.updateSyncCount;
+    client->write(0, 3, "item0", 5, NULL, NULL, true);
+    EXPECT_EQ(syncs, metrics->master.updateSyncCount);
+    client->write(0, 3, "item0", 5);
+    EXPECT_EQ(syncs + 1, metrics->master.updateSyncCount);
+
+    // Rejected updates append nothing, so there is nothing to wait for.
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.exists = true;
+    EXPECT_THROW(client->write(0, 3, "item0", 5, &rules),
+                 ObjectExistsException);
+    EXPECT_EQ(syncs + 1, metrics->master.updateSyncCount);
+
+    client->remove(0, 3);
+    EXPECT_EQ(syncs + 2, metrics->master.updateSyncCount);
+    EXPECT_FALSE(MasterService::logSyncPending);
+}
+
+TEST_F(MasterServiceTest, write_ttl) {
+    mockWallTimeValue = 100;
+    uint64_t version;
+    client->write(0, 3, "item0", 5, NULL, &version, false, 10);
+    Buffer value;
+    client->read(0, 3, &value);
+    EXPECT_EQ("item0", TestUtil::toString(&value));
+
+    mockWallTimeValue = 110;
+    EXPECT_THROW(client->read(0, 3, &value), ObjectDoesntExistException);
+    Tub<Buffer> multiValue;
+    MasterClient::ReadObject object(0, 3, &multiValue);
+    std::vector<MasterClient::ReadObject*> requests;
+    requests.push_back(&object);
+    client->multiRead(requests);
+    EXPECT_EQ(STATUS_OBJECT_DOESNT_EXIST, object.status);
+
+    // An expired object no longer exists as far as reject rules go, but
+    // its replacement must still get a higher version.
+    RejectRules rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.exists = true;
+    uint64_t newVersion;
+    client->write(0, 3, "item1", 5, &rules, &newVersion);
+    EXPECT_GT(newVersion, version);
+    client->read(0, 3, &value);
+    EXPECT_EQ("item1", TestUtil::toString(&value));
+    mockWallTimeValue = 0;
+}
+
+TEST_F(MasterServiceTest, findTabletSplit) {
+    const ProtoBuf::Tablets::Tablet& tablet(service->tablets.tablet(0));
+    Table* table = reinterpret_cast<Table*>(tablet.user_data());
+    for (uint64_t i = 0; i < 8; i++)
+        table->profiler.track(i << 56, 10000, LogTime(1, i));
+
+    uint64_t splitId = 0;
+    EXPECT_FALSE(service->findTabletSplit(tablet, 100000, 1000, &splitId));
+    EXPECT_TRUE(service->findTabletSplit(tablet, 50000, 1000, &splitId));
+    EXPECT_EQ(3UL << 56, splitId);
+}
+
+TEST_F(MasterServiceTest, splitTablet) {
+    ProtoBuf::Tablets::Tablet& tablet(
+        *cluster.coordinator->tabletMap.add_tablet());
+    tablet.set_table_id(0);
+    tablet.set_start_object_id(0);
+    tablet.set_end_object_id(~0UL);
+    tablet.set_state(ProtoBuf::Tablets::Tablet::NORMAL);
+    tablet.set_server_id(service->serverId.getId());
+    tablet.set_service_locator("mock:host=master");
+    client->write(0, 5, "lower", 5);
+    client->write(0, 2000, "upper", 5);
+
+    service->splitTablet(0, 0, ~0UL, 1000);
+
+    ASSERT_EQ(2, service->tablets.tablet_size());
+    EXPECT_EQ(999U, service->tablets.tablet(0).end_object_id());
+    EXPECT_EQ(1000U, service->tablets.tablet(1).start_object_id());
+    EXPECT_EQ(service->tablets.tablet(0).user_data(),
+              service->tablets.tablet(1).user_data());
+    EXPECT_EQ(2, cluster.coordinator->tabletMap.tablet_size());
+    EXPECT_EQ(2, cluster.coordinator->serverList[service->serverId].will->
+                    tablet_size());
+
+    Buffer value;
+    client->read(0, 5, &value);
+    EXPECT_EQ("lower", TestUtil::toString(&value));
+    client->read(0, 2000, &value);
+    EXPECT_EQ("upper", TestUtil::toString(&value));
+}
+
 TEST_F(MasterServiceTest, getTable) {
     // Table exists.
     EXPECT_TRUE(service->getTable(0, 0) != NULL);
@@ -844,6 +2102,25 @@ TEST_F(MasterServiceTest, getTable) {
     EXPECT_TRUE(service->getTable(1000, 0) == NULL);
 }
 
+TEST_F(MasterServiceTest, getTable_afterSetTablets) {
+    ProtoBuf::Tablets newTablets;
+    appendTablet(newTablets, 0, 1, 10, 19);
+    appendTablet(newTablets, 0, 0, 0, 9);
+    service->setTablets(newTablets);
+
+    // Objects are placed by tablet key, not by id.
+    Table* table0 = service->getTable(0, Object::objectIdForTabletKey(9));
+    ASSERT_TRUE(table0 != NULL);
+    EXPECT_EQ(0U, table0->getId());
+    EXPECT_TRUE(service->getTable(0, Object::objectIdForTabletKey(10)) ==
+                NULL);
+    EXPECT_TRUE(service->getTable(1, Object::objectIdForTabletKey(9)) ==
+                NULL);
+    EXPECT_EQ(1U, service->getTable(1, Object::objectIdForTabletKey(15))->
+                    getId());
+    EXPECT_TRUE(service->getTable(0, 9) == NULL);
+}
+
 TEST_F(MasterServiceTest, rejectOperation) {
     RejectRules empty, rules;
     memset(&empty, 0, sizeof(empty));
@@ -889,6 +2166,72 @@ TEST_F(MasterServiceTest, rejectOperation) {
               STATUS_WRONG_VERSION);
 }
 
+bool objectLivenessCallback(LogEntryHandle handle, void* cookie);
+bool objectEvictionCallback(LogEntryHandle handle, void* cookie);
+void objectScanCallback(LogEntryHandle handle, void* cookie);
+
+TEST_F(MasterServiceTest, objectEvictionCallback) {
+    service->objectMap.setReferenceTracking(true);
+    client->create(0, "abcdef", 6);
+    client->create(0, "ghijkl", 6);
+    LogEntryHandle h0 = service->objectMap.lookup(0, 0);
+    LogEntryHandle h1 = service->objectMap.lookup(0, 1);
+
+    // The cleaner only sees objects the scan callback has already tracked.
+    objectScanCallback(h0, service);
+    objectScanCallback(h1, service);
+
+    // Object 0 was never read, so it's evicted right away.
+    Buffer value;
+    EXPECT_TRUE(objectEvictionCallback(h0, service));
+    EXPECT_TRUE(service->objectMap.lookup(0, 0) == NULL);
+    EXPECT_THROW(client->read(0, 0, &value), ObjectDoesntExistException);
+
+    // Reading object 1 gives it a second chance, but only one.
+    client->read(0, 1, &value);
+    EXPECT_FALSE(objectEvictionCallback(h1, service));
+    EXPECT_EQ(h1, service->objectMap.lookup(0, 1));
+    EXPECT_TRUE(objectEvictionCallback(h1, service));
+    EXPECT_TRUE(service->objectMap.lookup(0, 1) == NULL);
+
+    // A stale copy never evicts the current one.
+    client->create(0, "mnopqr", 6);
+    LogEntryHandle stale = service->objectMap.lookup(0, 2);
+    client->write(0, 2, "stuvwx", 6);
+    EXPECT_FALSE(objectEvictionCallback(stale, service));
+    client->read(0, 2, &value);
+    EXPECT_EQ("stuvwx", TestUtil::toString(&value));
+}
+
+TEST_F(MasterServiceTest, objectEvictionCallback_raisesVersion) {
+    service->objectMap.setReferenceTracking(true);
+    uint64_t version;
+    client->create(0, "abcdef", 6);
+    client->write(0, 0, "ghijkl", 6, NULL, &version);
+    LogEntryHandle handle = service->objectMap.lookup(0, 0);
+    objectScanCallback(handle, service);
+    EXPECT_TRUE(objectEvictionCallback(handle, service));
+
+    uint64_t newVersion;
+    client->write(0, 0, "mnopqr", 6, NULL, &newVersion);
+    EXPECT_GT(newVersion, version);
+}
+
+TEST_F(MasterServiceTest, objectLivenessCallback_expired) {
+    mockWallTimeValue = 100;
+    client->write(0, 3, "item0", 5, NULL, NULL, false, 10);
+    LogEntryHandle handle = service->objectMap.lookup(0, 3);
+    objectScanCallback(handle, service);
+    EXPECT_TRUE(objectLivenessCallback(handle, service));
+
+    uint64_t expired = metrics->master.expiredObjectCount;
+    mockWallTimeValue = 110;
+    EXPECT_FALSE(objectLivenessCallback(handle, service));
+    EXPECT_TRUE(service->objectMap.lookup(0, 3) == NULL);
+    EXPECT_EQ(expired + 1, metrics->master.expiredObjectCount);
+    mockWallTimeValue = 0;
+}
+
 /**
  * Unit tests requiring a full segment size (rather than the smaller default
  * allocation that's done to make tests faster).
@@ -920,6 +2263,190 @@ TEST_F(MasterServiceFullSegmentSizeTest, write_maximumObjectSize) {
     delete[] buf;
 }
 
+/**
+ * Unit tests that run a master with its HashTable resizer thread going,
+ * starting from a table small enough that writes keep it growing. The master
+ * keeps no replicas so that it can fill whole Segments for the cleaner.
+ */
+class MasterServiceResizeTest : public MasterServiceTest {
+  public:
+    MasterServiceResizeTest()
+        : MasterServiceTest()
+    {
+        ServerConfig config = ServerConfig::forTesting();
+        config.localLocator = "mock:host=master2";
+        config.services = {MASTER_SERVICE, MEMBERSHIP_SERVICE};
+        config.master.numReplicas = 0;
+        config.master.logBytes = 64 * 1024 * 1024;
+        config.master.hashTableBytes =
+            4 * HashTable<LogEntryHandle>::bytesPerCacheLine();
+        config.master.disableHashTableResize = false;
+        Server* server = cluster.addServer(config);
+        service = server->master.get();
+        client = cluster.get<MasterClient>(server);
+
+        ProtoBuf::Tablets_Tablet& tablet(*service->tablets.add_tablet());
+        tablet.set_table_id(0);
+        tablet.set_start_object_id(0);
+        tablet.set_end_object_id(~0UL);
+        tablet.set_user_data(reinterpret_cast<uint64_t>(new Table(0)));
+        service->tabletIndex.rebuild(service->tablets);
+    }
+
+    /**
+     * Run a cleaning pass over every closed Segment of the master's log,
+     * regardless of how much it would free.
+     *
+     * \return
+     *      The number of Segments cleaned.
+     */
+    size_t
+    cleanClosedSegments()
+    {
+        LogCleaner& cleaner = service->log.cleaner;
+        cleaner.scanNewCleanableSegments();
+        SegmentVector segmentsToClean;
+        foreach (LogCleaner::CleanableSegment& c, cleaner.cleanableSegments)
+            segmentsToClean.push_back(c.segment);
+        cleaner.cleanableSegments.clear();
+        size_t numCleaned = segmentsToClean.size();
+
+        LogCleaner::LiveSegmentEntryHandleVector liveEntries;
+        cleaner.getSortedLiveEntries(segmentsToClean, liveEntries);
+        LogCleaner::RelocationTaskVector tasks;
+        size_t needed = cleaner.splitLiveEntries(liveEntries, 1, false,
+                                                 tasks);
+        std::vector<void*> cleanSegmentMemory;
+        EXPECT_TRUE(cleaner.getCleanSegmentMemory(needed,
+                                                  cleanSegmentMemory));
+        cleaner.moveLiveData(liveEntries, tasks, cleanSegmentMemory,
+                             segmentsToClean);
+        service->log.cleaningComplete(segmentsToClean, cleanSegmentMemory);
+        return numCleaned;
+    }
+
+    DISALLOW_COPY_AND_ASSIGN(MasterServiceResizeTest);
+};
+
+TEST_F(MasterServiceResizeTest, writeAndClean) {
+    uint64_t resizes = metrics->master.hashTableResizes;
+    const uint32_t numObjects = 512;
+    const uint32_t objectBytes = 8192;
+    char buf[objectBytes];
+
+    // Overwrite every object a few times, leaving mostly dead Segments
+    // behind while the resizer grows the table underneath the writes.
+    for (char round = 'a'; round <= 'd'; round++) {
+        memset(buf, round, objectBytes);
+        for (uint64_t i = 0; i < numObjects; i++)
+            client->write(0, i, buf, objectBytes);
+    }
+
+    // The cleaner's callbacks look objects up while buckets may be moving.
+    EXPECT_LE(2U, cleanClosedSegments());
+
+    // Let the resizer catch up before checking on it.
+    for (int i = 0; i < 1000; i++) {
+        if (metrics->master.hashTableResizes != resizes &&
+                !service->objectMap.isResizing())
+            break;
+        usleep(1000);
+    }
+    EXPECT_LT(resizes, metrics->master.hashTableResizes);
+    EXPECT_EQ(numObjects, service->objectMap.getNumEntries());
+
+    Buffer value;
+    for (uint64_t i = 0; i < numObjects; i++) {
+        client->read(0, i, &value);
+        EXPECT_EQ(objectBytes, value.getTotalLength());
+        EXPECT_EQ('d', *value.getStart<char>()) << "object " << i;
+    }
+}
+
+/// State shared between MasterServiceResizeTest.readWhileCleaning and its
+/// reader thread.
+struct CleanerStress {
+    CleanerStress(MasterService* service, uint32_t numObjects)
+        : service(service), numObjects(numObjects), stop(false), errors(),
+          reads() {}
+    MasterService* service;
+    const uint32_t numObjects;
+    volatile bool stop;
+    AtomicInt errors;
+    AtomicInt reads;
+    DISALLOW_COPY_AND_ASSIGN(CleanerStress);
+};
+
+/**
+ * Look objects up without locks, as MasterService::read does, and check
+ * that every one found is intact: it has the id that was asked for, every
+ * byte of its value is the same, and that byte, the round that wrote it,
+ * never goes backwards. A segment reused while a reader could still see it
+ * would show up as some other object or as a value torn between two
+ * writes.
+ */
+static void
+cleanerStressReader(CleanerStress* s)
+{
+    std::vector<unsigned char> rounds(s->numObjects, 0);
+    uint32_t i = 0;
+    while (!s->stop) {
+        EpochManager::ReadGuard _;
+        LogEntryHandle handle = s->service->objectMap.lockFreeLookup(0, i,
+                                    MasterService::KeyMatcher(NULL, 0));
+        if (handle != NULL) {
+            const Object* obj = handle->userData<Object>();
+            const unsigned char* value =
+                reinterpret_cast<const unsigned char*>(obj->value());
+            uint32_t length = obj->valueLength(handle->length());
+            bool intact = handle->type() == LOG_ENTRY_TYPE_OBJ &&
+                          obj->id.tableId == 0 && obj->id.objectId == i &&
+                          length != 0 && value[0] >= rounds[i];
+            for (uint32_t j = 1; intact && j < length; j++)
+                intact = (value[j] == value[0]);
+            if (!intact)
+                s->errors.inc();
+            else
+                rounds[i] = value[0];
+        }
+        s->reads.inc();
+        i = (i + 1) % s->numObjects;
+    }
+}
+
+TEST_F(MasterServiceResizeTest, readWhileCleaning) {
+    const uint32_t numObjects = 512;
+    const uint32_t objectBytes = 8192;
+    char buf[objectBytes];
+    memset(buf, 1, objectBytes);
+    for (uint64_t i = 0; i < numObjects; i++)
+        client->write(0, i, buf, objectBytes);
+
+    CleanerStress s(service, numObjects);
+    std::thread reader(cleanerStressReader, &s);
+    while (s.reads == 0)
+        sched_yield();
+
+    // Write several times the log's capacity, cleaning after each round,
+    // so that the cleaner keeps relocating live objects out from under the
+    // reader and the segments it frees are filled again with new writes.
+    const uint64_t numRounds = 40;
+    for (uint64_t round = 2; round <= numRounds; round++) {
+        memset(buf, static_cast<char>(round), objectBytes);
+        for (uint64_t i = 0; i < numObjects; i++)
+            client->write(0, i, buf, objectBytes);
+        cleanClosedSegments();
+    }
+    s.stop = true;
+    reader.join();
+
+    EXPECT_EQ(0, s.errors.load());
+    EXPECT_LT(0, s.reads.load());
+    Buffer value;
+    client->read(0, numObjects - 1, &value);
+    EXPECT_EQ(static_cast<char>(numRounds), *value.getStart<char>());
+}
+
 class MasterRecoverTest : public ::testing::Test {
   public:
     Tub<MockCluster> cluster;
@@ -18,6 +18,7 @@
 
 #include "Common.h"
 #include "HashTable.h"
+#include "MurmurHash3.h"
 #include "WallTime.h"
 
 namespace RAMCloud {
@@ -39,8 +40,26 @@ struct ObjectIdentifier {
     uint64_t objectId;
 } __attribute__((__packed__));
 
+/**
+ * An object in a table, as it is stored in the log.
+ *
+ * Objects are normally named by a 64-bit id chosen by the client. An object
+ * may instead be named by a variable-length string key; its id is then the
+ * #hashKey() of that key, so tablets, recovery, and migration, which place
+ * objects by id, treat it like any other object. The key bytes are stored at the
+ * front of #data, ahead of the object's value, so that the master can check
+ * the full key once the hash table has matched on the id. Keys that hash to
+ * the same id are told apart this way and are stored side by side.
+ *
+ * An object written with a time-to-live carries an #expiry. Once that time
+ * has passed the master treats the object as if it didn't exist, and the
+ * log cleaner drops it rather than relocating it; no tombstone is needed.
+ */
 class Object {
   public:
+    /// The type used to record the length of an object's string key.
+    typedef uint16_t KeyLength;
+
     /*
      * This buf_size parameter is here to annoy you a little bit if you try
      * stack-allocating one of these. You'll think twice about it, maybe
@@ -50,9 +69,11 @@ class Object {
     explicit Object(size_t buf_size)
         : id(-1, -1),
           version(-1),
-          timestamp(secondsTimestamp())
+          timestamp(secondsTimestamp()),
+          expiry(0),
+          keyLength(0)
     {
-        static_assert(sizeof(*this) == 28, "bad Object size!");
+        static_assert(sizeof(*this) == 34, "bad Object size!");
         assert(buf_size >= sizeof(*this));
     }
 
@@ -70,7 +91,8 @@ class Object {
 
     /**
      * Return the number of bytes of data an Object contains, given
-     * the total size of the Object.
+     * the total size of the Object. This includes the object's string
+     * key, if it has one.
      */
     uint32_t
     dataLength(uint32_t totalObjectBytes) const
@@ -79,13 +101,133 @@ class Object {
         return totalObjectBytes - downCast<uint32_t>(sizeof(*this));
     }
 
+    /**
+     * Return the object's value, which follows its string key (if any)
+     * in #data.
+     */
+    const char*
+    value() const
+    {
+        return data + keyLength;
+    }
+
+    /**
+     * Return the number of bytes in the object's value, given the total
+     * size of the Object.
+     */
+    uint32_t
+    valueLength(uint32_t totalObjectBytes) const
+    {
+        assert(dataLength(totalObjectBytes) >= keyLength);
+        return dataLength(totalObjectBytes) - keyLength;
+    }
+
+    /**
+     * Return whether this object has outlived its #expiry and must be
+     * treated as if it didn't exist.
+     */
+    bool
+    isExpired() const
+    {
+        return expiry != 0 && expiry <= secondsTimestamp();
+    }
+
+    /**
+     * Return whether this object is named by the given string key. Objects
+     * named only by their 64-bit id have an empty key.
+     */
+    bool
+    keyMatches(const void* key, KeyLength length) const
+    {
+        return keyLength == length && memcmp(data, key, length) == 0;
+    }
+
+    /**
+     * Return the object id that names the object with the given string key.
+     * Clients use this to route requests, and masters place the object at
+     * this id.
+     */
+    static uint64_t
+    hashKey(const void* key, KeyLength length)
+    {
+        uint64_t out[2];
+        MurmurHash3_x64_128(key, length, 0, &out);
+        return out[0];
+    }
+
+    /**
+     * Return a second 64-bit hash of the given string key, independent of
+     * #hashKey(), or 0 for the empty key. Tombstones carry it in place of
+     * the key itself, so that recovery can tell apart the objects whose
+     * keys hash to one id.
+     */
+    static uint64_t
+    keyFingerprint(const void* key, KeyLength length)
+    {
+        if (length == 0)
+            return 0;
+        uint64_t out[2];
+        MurmurHash3_x64_128(key, length, 0, &out);
+        return out[1];
+    }
+
+    /// Return #keyFingerprint() of this object's string key.
+    uint64_t
+    keyFingerprint() const
+    {
+        return keyFingerprint(data, keyLength);
+    }
+
+    /**
+     * Return the position of an object id in its table's tablet key space.
+     * Tablets, will partitions, and migrations cover ranges of these keys
+     * rather than of raw ids, so that a table split into several tablets
+     * gets an even share of densely allocated ids in each. The mapping is
+     * MurmurHash3's 64-bit finalizer, a bijection that maps 0 to 0, so a
+     * tablet covering [0, ~0] still holds every id.
+     */
+    static uint64_t
+    tabletKey(uint64_t objectId)
+    {
+        uint64_t k = objectId;
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdUL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53UL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    /**
+     * Return the object id at a given position in the tablet key space;
+     * the inverse of #tabletKey(). Handy for picking ids that land in a
+     * particular tablet.
+     */
+    static uint64_t
+    objectIdForTabletKey(uint64_t tabletKey)
+    {
+        uint64_t k = tabletKey;
+        k ^= k >> 33;
+        k *= 0x9cb4b2f8129337dbUL;
+        k ^= k >> 33;
+        k *= 0x4f74430c22a54005UL;
+        k ^= k >> 33;
+        return k;
+    }
+
     struct ObjectIdentifier id;
     uint64_t version;
     uint32_t timestamp;         // see WallTime.cc
+    uint32_t expiry;            // timestamp at which the object dies, or 0
+    KeyLength keyLength;        // bytes of string key at the front of data
     char data[0];
 
   PRIVATE:
-    Object() : id(-1, -1), version(-1), timestamp(secondsTimestamp()) { }
+    Object()
+        : id(-1, -1), version(-1), timestamp(secondsTimestamp()), expiry(0),
+          keyLength(0)
+    {
+    }
 
     // to use default constructor in arrays
     friend void hashTableBenchmark(uint64_t, uint64_t);
@@ -99,25 +241,91 @@ class ObjectTombstone {
         : id(object->id),
           segmentId(segmentId),
           objectVersion(object->version),
-          timestamp(secondsTimestamp())
+          timestamp(secondsTimestamp()),
+          keyFingerprint(object->keyFingerprint())
     {
-        static_assert(sizeof(*this) == 36, "bad Object size!");
+        static_assert(sizeof(*this) == 44, "bad Object size!");
     }
 
     struct ObjectIdentifier id;
     uint64_t segmentId;
     uint64_t objectVersion;
     uint32_t timestamp;
+    uint64_t keyFingerprint;    // Object::keyFingerprint() of the dead
+                                // object's string key, or 0 if it had none
 
   PRIVATE:
     ObjectTombstone(uint64_t segmentId, uint64_t tableId,
-                    uint64_t objectId, uint64_t objectVersion)
+                    uint64_t objectId, uint64_t objectVersion,
+                    uint64_t keyFingerprint = 0)
         : id(tableId, objectId),
           segmentId(segmentId),
           objectVersion(objectVersion),
+          timestamp(secondsTimestamp()),
+          keyFingerprint(keyFingerprint)
+    {
+    }
+} __attribute__((__packed__));
+
+/**
+ * One object of a transaction prepared by a master (see
+ * MasterService::prepareTransaction()), as it is logged so that the
+ * prepare survives the master crashing or restarting. The entry is live
+ * until the transaction is decided. It starts with the object's id, like
+ * objects and tombstones, so that backups place it in the same recovery
+ * partition as the object.
+ */
+class TransactionIntent {
+  public:
+    TransactionIntent(uint64_t tableId, uint64_t objectId,
+                      uint64_t transactionId)
+        : id(tableId, objectId),
+          transactionId(transactionId),
           timestamp(secondsTimestamp())
     {
+        static_assert(sizeof(*this) == 28, "bad TransactionIntent size!");
+    }
+
+    struct ObjectIdentifier id;
+    uint64_t transactionId;
+    uint32_t timestamp;
+    char part[0];               // TransactionRpc::Request::Part for the
+                                // object, followed by its value
+} __attribute__((__packed__));
+
+/**
+ * Logged when a master decides a transaction it prepared; a commit logs
+ * it in the same append as the transaction's objects. Replaying it tells
+ * recovery that the transaction's TransactionIntents are stale. It must
+ * outlive them, so it stays live as long as any of the segments that held
+ * them at the time does.
+ */
+class TransactionDecision {
+  public:
+    TransactionDecision(uint64_t transactionId, bool commit,
+                        uint32_t segmentCount)
+        : transactionId(transactionId),
+          timestamp(secondsTimestamp()),
+          commit(commit),
+          segmentCount(segmentCount)
+    {
+        static_assert(sizeof(*this) == 17, "bad TransactionDecision size!");
     }
+
+    /// Bytes taken by a decision listing the given number of segments.
+    static uint32_t
+    length(uint32_t segmentCount)
+    {
+        return downCast<uint32_t>(sizeof(TransactionDecision) +
+                                  segmentCount * sizeof(uint64_t));
+    }
+
+    uint64_t transactionId;
+    uint32_t timestamp;
+    uint8_t commit;             // 0 if the transaction was aborted
+    uint32_t segmentCount;
+    uint64_t segmentIds[0];     // Segments holding the transaction's
+                                // TransactionIntents when it was decided
 } __attribute__((__packed__));
 
 } // namespace RAMCloud
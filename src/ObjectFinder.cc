@@ -57,6 +57,18 @@ ObjectFinder::ObjectFinder(CoordinatorClient& coordinator)
  */
 Transport::SessionRef
 ObjectFinder::lookup(uint32_t table, uint64_t objectId) {
+    return lookupTablet(table, Object::tabletKey(objectId));
+}
+
+/**
+ * Lookup the master for the tablet covering a particular tablet key (see
+ * Object::tabletKey) in a given table. Tablet operations such as migration
+ * and enumeration name tablets this way.
+ * \throw TableDoesntExistException
+ *      The coordinator has no record of the table.
+ */
+Transport::SessionRef
+ObjectFinder::lookupTablet(uint32_t table, uint64_t tabletKey) {
     /*
      * The control flow in here is a bit tricky:
      * Since tabletMap is a cache of the coordinator's tablet map, we can only
@@ -69,8 +81,8 @@ ObjectFinder::lookup(uint32_t table, uint64_t objectId) {
     while (true) {
         foreach (const ProtoBuf::Tablets::Tablet& tablet, tabletMap.tablet()) {
             if (tablet.table_id() == table &&
-                tablet.start_object_id() <= objectId &&
-                objectId <= tablet.end_object_id()) {
+                tablet.start_object_id() <= tabletKey &&
+                tabletKey <= tablet.end_object_id()) {
                 if (tablet.state() == ProtoBuf::Tablets_Tablet_State_NORMAL) {
                     // TODO(ongaro): add cache
                     return Context::get().transportManager->getSession(
@@ -97,18 +109,80 @@ ObjectFinder::lookup(uint32_t table, uint64_t objectId) {
 /**
  * Lookup the masters for a multiple object IDs in multiple tables.
  * \param requests
- *      Array listing the objects to be read/written
+ *      Array listing the objects to be read
  * \param numRequests
  *      Length of requests array
  * \return requestBins
  *      Bins requests according to the master they correspond to.
  */
-
 std::vector<ObjectFinder::MasterRequests>
 ObjectFinder::multiLookup(MasterClient::ReadObject* requests[],
                           uint32_t numRequests) {
+    return binRequests(requests, numRequests);
+}
+
+/**
+ * Lookup the masters for a multiple object IDs in multiple tables.
+ * \param requests
+ *      Array listing the objects to be written
+ * \param numRequests
+ *      Length of requests array
+ * \return requestBins
+ *      Bins requests according to the master they correspond to.
+ */
+std::vector<ObjectFinder::MasterWriteRequests>
+ObjectFinder::multiLookup(MasterClient::WriteObject* requests[],
+                          uint32_t numRequests) {
+    return binRequests(requests, numRequests);
+}
+
+/**
+ * Lookup the masters for a multiple object IDs in multiple tables.
+ * \param requests
+ *      Array listing the objects to be removed
+ * \param numRequests
+ *      Length of requests array
+ * \return requestBins
+ *      Bins requests according to the master they correspond to.
+ */
+std::vector<ObjectFinder::MasterRemoveRequests>
+ObjectFinder::multiLookup(MasterClient::RemoveObject* requests[],
+                          uint32_t numRequests) {
+    return binRequests(requests, numRequests);
+}
 
-    std::vector<ObjectFinder::MasterRequests> requestBins;
+/**
+ * Lookup the masters for a multiple object IDs in multiple tables.
+ * \param requests
+ *      Array listing the objects in a transaction
+ * \param numRequests
+ *      Length of requests array
+ * \return requestBins
+ *      Bins requests according to the master they correspond to.
+ */
+std::vector<ObjectFinder::MasterTransactionRequests>
+ObjectFinder::multiLookup(MasterClient::TransactionObject* requests[],
+                          uint32_t numRequests) {
+    return binRequests(requests, numRequests);
+}
+
+/**
+ * Shared implementation of the multiLookup methods: group requests by the
+ * master that owns each object. Requests for tables that don't exist are
+ * left out of every bin and have their status set to
+ * STATUS_TABLE_DOESNT_EXIST.
+ * \param requests
+ *      Array listing the objects to be operated on.
+ * \param numRequests
+ *      Length of requests array
+ * \return requestBins
+ *      Bins requests according to the master they correspond to.
+ */
+template<typename Request>
+std::vector<ObjectFinder::MasterRequestsOf<Request>>
+ObjectFinder::binRequests(Request* requests[], uint32_t numRequests)
+{
+    std::vector<ObjectFinder::MasterRequestsOf<Request>> requestBins;
     for (uint32_t i = 0; i < numRequests; i++){
         try {
             Transport::SessionRef currentSessionRef =
@@ -126,7 +200,8 @@ ObjectFinder::multiLookup(MasterClient::ReadObject* requests[],
             }
             // else create a new requestBin corresponding to this master
             if (!masterFound) {
-                requestBins.push_back(ObjectFinder::MasterRequests());
+                requestBins.push_back(ObjectFinder::MasterRequestsOf<
+                                                                Request>());
                 requestBins.back().sessionRef = currentSessionRef;
                 requestBins.back().requests.push_back(requests[i]);
             }
@@ -36,17 +36,33 @@ class ObjectFinder {
 
     /**
      * A partition (or bin) corresponding to the requests to be sent
-     * to one master in a multiRead / multiWrite operation.
+     * to one master in a multiRead / multiWrite / multiRemove operation.
      */
-    struct MasterRequests {
-        MasterRequests() : sessionRef(), requests() {}
+    template<typename Request>
+    struct MasterRequestsOf {
+        MasterRequestsOf() : sessionRef(), requests() {}
         Transport::SessionRef sessionRef;
-        std::vector<MasterClient::ReadObject*> requests;
+        std::vector<Request*> requests;
     };
+    typedef MasterRequestsOf<MasterClient::ReadObject> MasterRequests;
+    typedef MasterRequestsOf<MasterClient::WriteObject> MasterWriteRequests;
+    typedef MasterRequestsOf<MasterClient::RemoveObject> MasterRemoveRequests;
+    typedef MasterRequestsOf<MasterClient::TransactionObject>
+        MasterTransactionRequests;
 
     Transport::SessionRef lookup(uint32_t table, uint64_t objectId);
+    Transport::SessionRef lookupTablet(uint32_t table, uint64_t tabletKey);
     std::vector<MasterRequests> multiLookup(MasterClient::ReadObject* input[],
                                             uint32_t numRequests);
+    std::vector<MasterWriteRequests> multiLookup(
+                                        MasterClient::WriteObject* input[],
+                                        uint32_t numRequests);
+    std::vector<MasterRemoveRequests> multiLookup(
+                                        MasterClient::RemoveObject* input[],
+                                        uint32_t numRequests);
+    std::vector<MasterTransactionRequests> multiLookup(
+                                    MasterClient::TransactionObject* input[],
+                                    uint32_t numRequests);
 
 
     /**
@@ -82,6 +98,10 @@ class ObjectFinder {
      */
     std::unique_ptr<ObjectFinder::TabletMapFetcher> tabletMapFetcher;
 
+    template<typename Request>
+    std::vector<MasterRequestsOf<Request>> binRequests(Request* requests[],
+                                                       uint32_t numRequests);
+
     DISALLOW_COPY_AND_ASSIGN(ObjectFinder);
 };
 
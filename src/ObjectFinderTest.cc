@@ -100,6 +100,39 @@ TEST_F(ObjectFinderTest, lookup) {
         static_cast<BindTransport::BindSession*>(session.get())->locator);
 }
 
+TEST_F(ObjectFinderTest, lookup_byTabletKey) {
+    // Table 5 is split in half between the two servers.
+    ProtoBuf::Tablets_Tablet& lower(*objectFinder->tabletMap.add_tablet());
+    lower.set_table_id(5);
+    lower.set_start_object_id(0);
+    lower.set_end_object_id(~0UL >> 1);
+    lower.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
+    lower.set_service_locator("mock:host=server0");
+    ProtoBuf::Tablets_Tablet& upper(*objectFinder->tabletMap.add_tablet());
+    upper = lower;
+    upper.set_start_object_id((~0UL >> 1) + 1);
+    upper.set_end_object_id(~0UL);
+    upper.set_service_locator("mock:host=server1");
+
+    // Neighbouring ids are placed by their tablet keys.
+    std::map<string, int> counts;
+    for (uint64_t id = 0; id < 100; id++) {
+        Transport::SessionRef session(objectFinder->lookup(5, id));
+        string locator =
+            static_cast<BindTransport::BindSession*>(session.get())->locator;
+        EXPECT_EQ(Object::tabletKey(id) <= (~0UL >> 1) ?
+                    "mock:host=server0" : "mock:host=server1", locator);
+        counts[locator]++;
+    }
+    EXPECT_LT(20, counts["mock:host=server0"]);
+    EXPECT_LT(20, counts["mock:host=server1"]);
+
+    Transport::SessionRef session(objectFinder->lookupTablet(5, ~0UL));
+    EXPECT_EQ("mock:host=server1",
+        static_cast<BindTransport::BindSession*>(session.get())->locator);
+    EXPECT_EQ(0U, refresher->called);
+}
+
 TEST_F(ObjectFinderTest, multiLookup_basics) {
     MasterClient::ReadObject* requests[3];
 
@@ -168,4 +201,33 @@ TEST_F(ObjectFinderTest, multiLookup_badTable) {
                             statusToSymbol(requestError.status));
 }
 
+TEST_F(ObjectFinderTest, multiLookup_writes) {
+    MasterClient::WriteObject* requests[3];
+
+    MasterClient::WriteObject request1(1, 0, "a", 1);
+    request1.status = STATUS_RETRY;
+    requests[0] = &request1;
+    MasterClient::WriteObject request2(2, 0, "b", 1);
+    request2.status = STATUS_RETRY;
+    requests[1] = &request2;
+    MasterClient::WriteObject requestError(3, 0, "c", 1);
+    requestError.status = STATUS_RETRY;
+    requests[2] = &requestError;
+
+    std::vector<ObjectFinder::MasterWriteRequests> requestBins =
+                                    objectFinder->multiLookup(requests, 3);
+
+    ASSERT_EQ(2U, requestBins.size());
+    EXPECT_EQ("mock:host=server0",
+        static_cast<BindTransport::BindSession*>(
+        requestBins[0].sessionRef.get())->locator);
+    EXPECT_EQ(&request1, requestBins[0].requests[0]);
+    EXPECT_EQ("mock:host=server1",
+        static_cast<BindTransport::BindSession*>(
+        requestBins[1].sessionRef.get())->locator);
+    EXPECT_EQ(&request2, requestBins[1].requests[0]);
+    EXPECT_STREQ("STATUS_TABLE_DOESNT_EXIST",
+                            statusToSymbol(requestError.status));
+}
+
 }  // namespace RAMCloud
@@ -48,6 +48,7 @@
 #include "Segment.h"
 #include "SegmentIterator.h"
 #include "SpinLock.h"
+#include "TabletIndex.h"
 #include "ClientException.h"
 #include "PerfHelper.h"
 
@@ -247,13 +248,16 @@ class TestObject {
 // be enabled to measure its effect. This test is a lot
 // slower than the others (takes several seconds) due to the
 // set up cost, but we really need a large hash table to
-// avoid caching.
-template<int prefetchBucketAhead = 0, int prefetchReferentAhead = 0>
+// avoid caching. The SSE2 comparison of each cache line's
+// entries can be turned off to measure what it saves.
+template<int prefetchBucketAhead = 0, int prefetchReferentAhead = 0,
+         bool simdLookups = true>
 double hashTableLookup()
 {
     uint64_t numBuckets = 16777216;       // 16M * 64 = 1GB
     int numLookups = 1000000;
     HashTable<TestObject*> hashTable(numBuckets);
+    hashTable.setSimdLookups(simdLookups);
 
     // fill with some objects to look up (enough to blow caches)
     for (int i = 0; i < numLookups; i++)
@@ -284,6 +288,42 @@ double hashTableLookup()
     return Cycles::toSeconds((stop - start) / numLookups);
 }
 
+// Measure lookups of random keys in a hash table much larger than the
+// TLB can map with normal pages, so nearly every lookup takes a TLB miss
+// on its bucket unless the table is on huge pages. The pages can be chosen
+// to measure what transparent huge pages save.
+template<MemoryPlacement::HugePages hugePages>
+double hashTableRandomLookup()
+{
+    uint64_t numBuckets = 67108864;       // 64M * 64 = 4GB
+    int numObjects = 4000000;
+    int numLookups = 1000000;
+    MemoryPlacement placement;
+    placement.hugePages = hugePages;
+    HashTable<TestObject*> hashTable(numBuckets, placement);
+
+    for (int i = 0; i < numObjects; i++)
+        hashTable.replace(new TestObject(0, i));
+
+    // choose the keys ahead of time so generating them isn't measured
+    std::vector<uint64_t> keys(numLookups);
+    for (int i = 0; i < numLookups; i++)
+        keys[i] = generateRandom() % numObjects;
+
+    PerfHelper::flushCache();
+
+    uint64_t start = Cycles::rdtsc();
+    for (int i = 0; i < numLookups; i++)
+        hashTable.lookup(0, keys[i]);
+    uint64_t stop = Cycles::rdtsc();
+
+    // clean up
+    for (int i = 0; i < numObjects; i++)
+        delete hashTable.lookup(0, i);
+
+    return Cycles::toSeconds((stop - start) / numLookups);
+}
+
 // Measure the cost of an lfence instruction.
 double lfence()
 {
@@ -590,6 +630,60 @@ double segmentIterator()
     return time;
 }
 
+// Measure the cost of finding the tablet that owns an object on a master
+// serving numTablets tablets (spread across 10 tables), either by walking
+// the tablet protocol buffers as MasterService::getTable used to, or by
+// searching a TabletIndex.
+template<int numTablets, bool useIndex>
+double tabletLookup()
+{
+    const uint64_t objectsPerTablet = 1000;
+    const int tabletsPerTable = (numTablets + 9) / 10;
+    ProtoBuf::Tablets tablets;
+    for (int i = 0; i < numTablets; i++) {
+        ProtoBuf::Tablets::Tablet& tablet(*tablets.add_tablet());
+        tablet.set_table_id(i % 10);
+        tablet.set_start_object_id((i / 10) * objectsPerTablet);
+        tablet.set_end_object_id((i / 10 + 1) * objectsPerTablet - 1);
+        tablet.set_user_data(i + 1);
+    }
+    TabletIndex index;
+    index.rebuild(tablets);
+
+    // Scanning 100k tablets is slow; don't take all day about it.
+    int count = useIndex ? 1000000 : 100000000 / (numTablets * 10);
+    const int numKeys = 1024;
+    uint64_t tableIds[numKeys], objectIds[numKeys];
+    for (int i = 0; i < numKeys; i++) {
+        tableIds[i] = generateRandom() % 10;
+        objectIds[i] = generateRandom() % (tabletsPerTable * objectsPerTablet);
+    }
+
+    uint64_t sum = 0;
+    uint64_t start = Cycles::rdtsc();
+    for (int i = 0; i < count; i++) {
+        uint64_t tableId = tableIds[i & (numKeys - 1)];
+        uint64_t objectId = objectIds[i & (numKeys - 1)];
+        if (useIndex) {
+            sum += reinterpret_cast<uint64_t>(index.lookup(tableId, objectId));
+        } else {
+            foreach (const ProtoBuf::Tablets::Tablet& tablet,
+                     tablets.tablet()) {
+                if (tablet.table_id() == tableId &&
+                    tablet.start_object_id() <= objectId &&
+                    objectId <= tablet.end_object_id()) {
+                    sum += tablet.user_data();
+                    break;
+                }
+            }
+        }
+    }
+    uint64_t stop = Cycles::rdtsc();
+    if (sum == 0)
+        printf("tabletLookup: no tablets found\n");
+    return Cycles::toSeconds(stop - start)/count;
+}
+
 // Measure the cost of acquiring and releasing a SpinLock (assuming the
 // lock is initially free).
 double spinLock()
@@ -772,6 +866,14 @@ TestInfo tests[] = {
      "Key lookup in a 1GB HashTable"},
     {"hashTableLookupPf", hashTableLookup<20, 10>,
      "Key lookup in a 1GB HashTable with prefetching"},
+    {"hashTableLookupScalar", hashTableLookup<0, 0, false>,
+     "Key lookup in a 1GB HashTable without SSE2 entry comparison"},
+    {"hashTableRandomLookup",
+     hashTableRandomLookup<MemoryPlacement::NO_HUGE_PAGES>,
+     "Random key lookup in a 4GB HashTable"},
+    {"hashTableRandomLookupThp",
+     hashTableRandomLookup<MemoryPlacement::TRANSPARENT_HUGE_PAGES>,
+     "Random key lookup in a 4GB HashTable on transparent huge pages"},
     {"lfence", lfence,
      "Lfence instruction"},
     {"lockInDispThrd", lockInDispThrd,
@@ -800,6 +902,18 @@ TestInfo tests[] = {
      "Acquire/release SpinLock"},
     {"startStopTimer", startStopTimer,
      "Start and stop a Dispatch::Timer"},
+    {"tabletIndex", tabletLookup<10, true>,
+     "Find owning tablet with TabletIndex, 10 tablets"},
+    {"tabletIndex", tabletLookup<1000, true>,
+     "Find owning tablet with TabletIndex, 1k tablets"},
+    {"tabletIndex", tabletLookup<100000, true>,
+     "Find owning tablet with TabletIndex, 100k tablets"},
+    {"tabletScan", tabletLookup<10, false>,
+     "Find owning tablet by linear scan, 10 tablets"},
+    {"tabletScan", tabletLookup<1000, false>,
+     "Find owning tablet by linear scan, 1k tablets"},
+    {"tabletScan", tabletLookup<100000, false>,
+     "Find owning tablet by linear scan, 100k tablets"},
     {"throwInt", throwInt,
      "Throw an int"},
     {"throwIntNL", throwIntNL,
@@ -16,7 +16,10 @@
 
 #include "RamCloud.h"
 #include "MasterClient.h"
+#include "Object.h"
 #include "PingClient.h"
+#include "Segment.h"
+#include "ShortMacros.h"
 
 namespace RAMCloud {
 
@@ -63,10 +66,10 @@ RamCloud::RamCloud(Context& context, const char* serviceLocator)
 
 /// \copydoc CoordinatorClient::createTable
 void
-RamCloud::createTable(const char* name)
+RamCloud::createTable(const char* name, uint32_t serverSpan)
 {
     Context::Guard _(clientContext);
-    coordinator.createTable(name);
+    coordinator.createTable(name, serverSpan);
 }
 
 /// \copydoc CoordinatorClient::dropTable
@@ -77,6 +80,111 @@ RamCloud::dropTable(const char* name)
     coordinator.dropTable(name);
 }
 
+/**
+ * Start enumerating the objects of a table. No RPCs are issued until the
+ * first call to #next().
+ *
+ * \param ramCloud
+ *      The RAMCloud cluster holding the table.
+ * \param tableId
+ *      The table to enumerate (return value from a previous call to
+ *      openTable).
+ */
+RamCloud::Enumeration::Enumeration(RamCloud& ramCloud, uint32_t tableId)
+    : ramCloud(ramCloud)
+    , tableId(tableId)
+    , startId(0)
+    , cursor()
+    , tabletLastId(0)
+    , tabletDone(false)
+    , batch()
+    , batchOffset(0)
+    , batchRemaining(0)
+{
+    memset(&cursor, 0, sizeof(cursor));
+}
+
+/**
+ * Return the next object in the table.
+ *
+ * \param[out] id
+ *      The object's identifier is returned here.
+ * \param[out] value
+ *      The object's value is appended here, without being copied if
+ *      possible. It refers to memory owned by this Enumeration and is only
+ *      valid until the next call to this method.
+ * \param[out] version
+ *      If non-NULL, the object's version is returned here.
+ * \param[out] key
+ *      If non-NULL, the object's string key, if it has one, is appended
+ *      here under the same terms as \a value.
+ * \return
+ *      True if an object was returned, false once the whole table has been
+ *      enumerated.
+ *
+ * \exception TableDoesntExistException
+ *      The table was dropped.
+ * \exception InternalError
+ */
+bool
+RamCloud::Enumeration::next(uint64_t* id, Buffer* value, uint64_t* version,
+                            Buffer* key)
+{
+    Context::Guard _(ramCloud.clientContext);
+    if (batchRemaining == 0)
+        fetchBatch();
+    if (batchRemaining == 0)
+        return false;
+
+    const SegmentEntry* entry = batch.getOffset<SegmentEntry>(batchOffset);
+    batchOffset += downCast<uint32_t>(sizeof(SegmentEntry));
+    const Object* obj = static_cast<const Object*>(
+        batch.getRange(batchOffset, entry->length));
+    batchOffset += entry->length;
+    --batchRemaining;
+
+    *id = obj->id.objectId;
+    if (version != NULL)
+        *version = obj->version;
+    if (key != NULL)
+        Buffer::Chunk::appendToBuffer(key, obj->data, obj->keyLength);
+    Buffer::Chunk::appendToBuffer(value, obj->value(),
+                                  obj->valueLength(entry->length));
+    return true;
+}
+
+/**
+ * Fetch the next non-empty batch of objects into #batch, moving on to the
+ * following tablet whenever one is finished. Leaves #batchRemaining at
+ * zero once the whole table has been enumerated.
+ */
+void
+RamCloud::Enumeration::fetchBatch()
+{
+    while (batchRemaining == 0) {
+        if (tabletDone) {
+            if (tabletLastId == ~0UL)
+                return;
+            startId = tabletLastId + 1;
+            memset(&cursor, 0, sizeof(cursor));
+            tabletDone = false;
+        }
+        MasterClient master(ramCloud.objectFinder.lookupTablet(tableId,
+                                                               startId));
+        try {
+            batchRemaining = master.enumerateTable(tableId, startId, &cursor,
+                                                   &tabletLastId, &tabletDone,
+                                                   &batch);
+            batchOffset = 0;
+        } catch (TableDoesntExistException& e) {
+            // The tablet moved; the cursor can be replayed at its new
+            // owner.
+            ramCloud.objectFinder.flush();
+        } catch (RetryException& e) {
+        }
+    }
+}
+
 /// \copydoc CoordinatorClient::openTable
 uint32_t
 RamCloud::openTable(const char* name)
@@ -85,6 +193,50 @@ RamCloud::openTable(const char* name)
     return coordinator.openTable(name);
 }
 
+/// \copydoc MasterClient::compareAndSwap
+bool
+RamCloud::compareAndSwap(uint32_t tableId, uint64_t id,
+                         const void* oldBuf, uint32_t oldLength,
+                         const void* newBuf, uint32_t newLength,
+                         Buffer* currentValue, uint64_t* version)
+{
+    Context::Guard _(clientContext);
+    MasterClient master(objectFinder.lookup(tableId, id));
+    while (1) {
+        // Keep trying the operation if the server responded with a retry
+        // status.
+        try {
+            return master.compareAndSwap(tableId, id, oldBuf, oldLength,
+                                         newBuf, newLength, currentValue,
+                                         version);
+        } catch (RetryException& e) {
+        }
+    }
+}
+
+/// Compare and swap an object named by a string key. See
+/// MasterClient::compareAndSwap.
+bool
+RamCloud::compareAndSwap(uint32_t tableId, const void* key, uint16_t keyLength,
+                         const void* oldBuf, uint32_t oldLength,
+                         const void* newBuf, uint32_t newLength,
+                         Buffer* currentValue, uint64_t* version)
+{
+    Context::Guard _(clientContext);
+    MasterClient master(objectFinder.lookup(tableId,
+                                            Object::hashKey(key, keyLength)));
+    while (1) {
+        // Keep trying the operation if the server responded with a retry
+        // status.
+        try {
+            return master.compareAndSwap(tableId, key, keyLength,
+                                         oldBuf, oldLength, newBuf, newLength,
+                                         currentValue, version);
+        } catch (RetryException& e) {
+        }
+    }
+}
+
 /// \copydoc MasterClient::create
 uint64_t
 RamCloud::create(uint32_t tableId, const void* buf, uint32_t length,
@@ -129,6 +281,70 @@ RamCloud::getServiceLocator()
     return &coordinatorLocator;
 }
 
+/// \copydoc MasterClient::increment
+int64_t
+RamCloud::increment(uint32_t tableId, uint64_t id, int64_t incrementValue,
+                    const RejectRules* rejectRules, uint64_t* version)
+{
+    Context::Guard _(clientContext);
+    MasterClient master(objectFinder.lookup(tableId, id));
+    while (1) {
+        // Keep trying the operation if the server responded with a retry
+        // status.
+        try {
+            return master.increment(tableId, id, incrementValue, rejectRules,
+                                    version);
+        } catch (RetryException& e) {
+        }
+    }
+}
+
+/// Increment an object named by a string key. See MasterClient::increment.
+int64_t
+RamCloud::increment(uint32_t tableId, const void* key, uint16_t keyLength,
+                    int64_t incrementValue, const RejectRules* rejectRules,
+                    uint64_t* version)
+{
+    Context::Guard _(clientContext);
+    MasterClient master(objectFinder.lookup(tableId,
+                                            Object::hashKey(key, keyLength)));
+    while (1) {
+        // Keep trying the operation if the server responded with a retry
+        // status.
+        try {
+            return master.increment(tableId, key, keyLength, incrementValue,
+                                    rejectRules, version);
+        } catch (RetryException& e) {
+        }
+    }
+}
+
+/**
+ * Move a tablet to another master without taking it offline.
+ *
+ * \param tableId
+ *      The table containing the tablet (return value from a previous call
+ *      to openTable).
+ * \param firstId
+ *      Identifier of the first object in the tablet.
+ * \param lastId
+ *      Identifier of the last object in the tablet. \a firstId and
+ *      \a lastId must match an existing tablet exactly.
+ * \param newOwnerMasterId
+ *      The master that should own the tablet afterwards.
+ *
+ * \see MasterClient::migrateTablet
+ */
+void
+RamCloud::migrateTablet(uint32_t tableId, uint64_t firstId, uint64_t lastId,
+                        ServerId newOwnerMasterId)
+{
+    Context::Guard _(clientContext);
+    MasterClient master(objectFinder.lookupTablet(tableId, firstId));
+    master.migrateTablet(tableId, firstId, lastId, newOwnerMasterId);
+    objectFinder.flush();
+}
+
 /**
  * Ping a server at the given ServiceLocator string.
  *
@@ -213,9 +429,32 @@ RamCloud::read(uint32_t tableId, uint64_t id, Buffer* value,
     return Read(*this, tableId, id, value, rejectRules, version)();
 }
 
+/// Read an object named by a string key. See MasterClient::read.
+void
+RamCloud::read(uint32_t tableId, const void* key, uint16_t keyLength,
+               Buffer* value, const RejectRules* rejectRules,
+               uint64_t* version)
+{
+    Context::Guard _(clientContext);
+    MasterClient master(objectFinder.lookup(tableId,
+                                            Object::hashKey(key, keyLength)));
+    master.read(tableId, key, keyLength, value, rejectRules, version);
+}
+
 /**
  * Read the current contents of multiple objects.
  *
+ * Objects are grouped by the master that owns them, and each group is
+ * split into MULTI_READ RPCs of at most #MAX_OBJECTS_PER_MULTI_READ
+ * objects. All of the RPCs are outstanding at once and are completed in
+ * whatever order their replies arrive, so the latency of the whole call
+ * is that of the slowest master rather than the sum over all masters.
+ * A master may return only part of a large batch (the rest come back
+ * with STATUS_RETRY) to keep its reply within transport limits, and a
+ * master that no longer owns a tablet reports STATUS_TABLE_DOESNT_EXIST;
+ * in either case only the affected objects are looked up again and
+ * reissued.
+ *
  * \param requests
  *      Array (of ReadObject's) listing the objects to be read
  *      and where to place their values
@@ -226,31 +465,145 @@ void
 RamCloud::multiRead(MasterClient::ReadObject* requests[], uint32_t numRequests)
 {
     Context::Guard _(clientContext);
-    std::vector<ObjectFinder::MasterRequests> requestBins =
-                            objectFinder.multiLookup(requests, numRequests);
+    Dispatch& dispatch = *Context::get().dispatch;
 
-    // By default multiRead is to be done in parallel. Can be changed here
-    // if we need to do it sequentially for benchmarking.
-    bool parallel = true;
+    std::vector<MasterClient::ReadObject*> unfinished(requests,
+                                                      requests + numRequests);
+    bool refreshedTabletMap = false;
+
+    // Each iteration issues one round of RPCs for every object that has
+    // not yet been read.
+    while (!unfinished.empty()) {
+        std::vector<ObjectFinder::MasterRequests> requestBins =
+            objectFinder.multiLookup(&unfinished[0],
+                                     downCast<uint32_t>(unfinished.size()));
+        unfinished.clear();
+
+        std::vector<ObjectFinder::MasterRequests> rpcBins;
+        foreach (ObjectFinder::MasterRequests& requestBin, requestBins) {
+            for (size_t i = 0; i < requestBin.requests.size();
+                 i += MAX_OBJECTS_PER_MULTI_READ) {
+                size_t end = i + MAX_OBJECTS_PER_MULTI_READ;
+                if (end > requestBin.requests.size())
+                    end = requestBin.requests.size();
+                rpcBins.push_back(ObjectFinder::MasterRequests());
+                rpcBins.back().sessionRef = requestBin.sessionRef;
+                rpcBins.back().requests.assign(
+                    requestBin.requests.begin() + i,
+                    requestBin.requests.begin() + end);
+            }
+        }
 
-    if (parallel == true) {
-        uint32_t numBins = downCast<uint32_t>(requestBins.size());
-        Tub<MasterClient::MultiRead> multiReadInstances[numBins];
-        for (uint32_t i = 0; i < numBins; i++) {
-            MasterClient master(requestBins[i].sessionRef);
-            multiReadInstances[i].construct(master, requestBins[i].requests);
+        // The MasterClients must outlive the RPCs that refer to them.
+        uint32_t numRpcs = downCast<uint32_t>(rpcBins.size());
+        Tub<MasterClient> masters[numRpcs];
+        Tub<MasterClient::MultiRead> rpcs[numRpcs];
+        for (uint32_t i = 0; i < numRpcs; i++) {
+            masters[i].construct(rpcBins[i].sessionRef);
+            rpcs[i].construct(*masters[i], rpcBins[i].requests);
         }
-        for (uint32_t i = 0; i < numBins; i++) {
-            multiReadInstances[i]->complete();
+
+        bool tabletMoved = false;
+        uint32_t numOutstanding = numRpcs;
+        while (numOutstanding > 0) {
+            for (uint32_t i = 0; i < numRpcs; i++) {
+                if (!rpcs[i] || !rpcs[i]->isReady())
+                    continue;
+                rpcs[i]->complete();
+                rpcs[i].destroy();
+                numOutstanding--;
+
+                foreach (MasterClient::ReadObject* request,
+                         rpcBins[i].requests) {
+                    if (request->status == STATUS_RETRY) {
+                        unfinished.push_back(request);
+                    } else if (request->status == STATUS_TABLE_DOESNT_EXIST &&
+                               !refreshedTabletMap) {
+                        // Our tablet map may be stale; try once more with
+                        // a fresh one before believing the master.
+                        unfinished.push_back(request);
+                        tabletMoved = true;
+                    }
+                }
+            }
+            if (numOutstanding > 0 && dispatch.isDispatchThread())
+                dispatch.poll();
         }
-    } else {
-        foreach (ObjectFinder::MasterRequests requestBin, requestBins) {
-            MasterClient master(requestBin.sessionRef);
-            master.multiRead(requestBin.requests);
+
+        if (tabletMoved) {
+            objectFinder.flush();
+            refreshedTabletMap = true;
         }
     }
 }
 
+/**
+ * Delete multiple objects. Objects are grouped by the master that owns
+ * them, and each master is sent a single MULTI_REMOVE RPC; the RPCs to
+ * different masters proceed in parallel.
+ *
+ * \param requests
+ *      Array (of RemoveObject's) listing the objects to be removed.
+ *      The status and version of each removal are returned in its
+ *      RemoveObject.
+ * \param numRequests
+ *      Number of valid entries in \c requests.
+ */
+void
+RamCloud::multiRemove(MasterClient::RemoveObject* requests[],
+                      uint32_t numRequests)
+{
+    Context::Guard _(clientContext);
+    std::vector<ObjectFinder::MasterRemoveRequests> requestBins =
+                            objectFinder.multiLookup(requests, numRequests);
+
+    uint32_t numBins = downCast<uint32_t>(requestBins.size());
+    // The MasterClients must outlive the RPCs that refer to them.
+    Tub<MasterClient> masters[numBins];
+    Tub<MasterClient::MultiRemove> multiRemoveInstances[numBins];
+    for (uint32_t i = 0; i < numBins; i++) {
+        masters[i].construct(requestBins[i].sessionRef);
+        multiRemoveInstances[i].construct(*masters[i], requestBins[i].requests);
+    }
+    for (uint32_t i = 0; i < numBins; i++) {
+        multiRemoveInstances[i]->complete();
+    }
+}
+
+/**
+ * Write multiple objects. Objects are grouped by the master that owns
+ * them, and each master is sent a single MULTI_WRITE RPC, which it logs
+ * and replicates as one batch; the RPCs to different masters proceed in
+ * parallel. This is the fast path for bulk loading.
+ *
+ * \param requests
+ *      Array (of WriteObject's) listing the objects to be written and
+ *      their new values. The status and new version of each write are
+ *      returned in its WriteObject.
+ * \param numRequests
+ *      Number of valid entries in \c requests.
+ */
+void
+RamCloud::multiWrite(MasterClient::WriteObject* requests[],
+                     uint32_t numRequests)
+{
+    Context::Guard _(clientContext);
+    std::vector<ObjectFinder::MasterWriteRequests> requestBins =
+                            objectFinder.multiLookup(requests, numRequests);
+
+    uint32_t numBins = downCast<uint32_t>(requestBins.size());
+    // The MasterClients must outlive the RPCs that refer to them.
+    Tub<MasterClient> masters[numBins];
+    Tub<MasterClient::MultiWrite> multiWriteInstances[numBins];
+    for (uint32_t i = 0; i < numBins; i++) {
+        masters[i].construct(requestBins[i].sessionRef);
+        multiWriteInstances[i].construct(*masters[i], requestBins[i].requests);
+    }
+    for (uint32_t i = 0; i < numBins; i++) {
+        multiWriteInstances[i]->complete();
+    }
+}
+
 /// \copydoc MasterClient::remove
 void
 RamCloud::remove(uint32_t tableId, uint64_t id,
@@ -271,12 +624,202 @@ RamCloud::remove(uint32_t tableId, uint64_t id,
     }
 }
 
+/// Delete an object named by a string key. See MasterClient::remove.
+void
+RamCloud::remove(uint32_t tableId, const void* key, uint16_t keyLength,
+                 const RejectRules* rejectRules, uint64_t* version)
+{
+    Context::Guard _(clientContext);
+    MasterClient master(objectFinder.lookup(tableId,
+                                            Object::hashKey(key, keyLength)));
+    while (1) {
+        // Keep trying the operation if the server responded with a retry
+        // status.
+        try {
+            master.remove(tableId, key, keyLength, rejectRules, version);
+            break;
+        } catch (RetryException& e) {
+        } catch (...) {
+            throw;
+        }
+    }
+}
+
+/**
+ * Atomically write and remove a set of objects, which may live on any
+ * number of masters. Either every object's reject rules pass and every
+ * operation is applied, or nothing is changed.
+ *
+ * If every object lives on one master it is sent a single TRANSACTION
+ * RPC. Otherwise the transaction is committed in two phases: each master
+ * checks and locks its share of the objects (PREPARE_TRANSACTION), and
+ * only if they all agree, and the coordinator records the commit, is each
+ * told to commit (DECIDE_TRANSACTION).
+ * Transactions that meet locked objects are retried from scratch after a
+ * random delay, whose range doubles with each attempt, so that
+ * transactions contending for the same objects don't keep locking each
+ * other out.
+ *
+ * \param objects
+ *      Array (of TransactionObject's) listing the objects to write or
+ *      remove; each may appear only once. On success each one's version is
+ *      filled in; see MasterClient::TransactionObject.
+ * \param numObjects
+ *      Number of valid entries in \c objects.
+ *
+ * \exception TableDoesntExistException
+ * \exception RejectRulesException
+ *      An object's reject rules failed. That object's status and version
+ *      say which one and why; nothing was changed.
+ * \exception RequestFormatError
+ *      An object appears twice, or a master's share of the transaction is
+ *      too large for it to log in one piece.
+ */
+void
+RamCloud::transaction(MasterClient::TransactionObject* objects[],
+                      uint32_t numObjects)
+{
+    Context::Guard _(clientContext);
+    uint32_t backoffUsec = 100;
+    while (1) {
+        for (uint32_t i = 0; i < numObjects; i++)
+            objects[i]->status = STATUS_OK;
+        std::vector<ObjectFinder::MasterTransactionRequests> requestBins =
+                            objectFinder.multiLookup(objects, numObjects);
+        for (uint32_t i = 0; i < numObjects; i++) {
+            if (objects[i]->status == STATUS_TABLE_DOESNT_EXIST)
+                throw TableDoesntExistException(HERE);
+        }
+
+        try {
+            if (requestBins.size() == 1) {
+                MasterClient master(requestBins[0].sessionRef);
+                master.transaction(requestBins[0].requests);
+            } else if (requestBins.size() > 1) {
+                twoPhaseTransaction(requestBins);
+            }
+            return;
+        } catch (RetryException& e) {
+            // Some object was locked by another transaction, or a master
+            // was out of memory; nothing was changed.
+        }
+        usleep(downCast<uint32_t>(generateRandom() % backoffUsec));
+        backoffUsec = std::min(2 * backoffUsec, 100U * 1000);
+    }
+}
+
+/**
+ * Commit a transaction spanning several masters in two phases. Helper for
+ * #transaction().
+ *
+ * A master that has prepared stays prepared until it learns the outcome,
+ * and if the decision is slow to arrive it asks the coordinator, proposing
+ * an abort. So the commit is only decided once the coordinator has
+ * recorded it; if a master's abort got there first, the transaction
+ * aborts. Every master is then told the outcome, even if some of them
+ * fail, and the coordinator is told to forget it once they all have it.
+ * A master that can't be reached (because it crashed, for instance) is
+ * left to learn the outcome from the coordinator, which keeps it.
+ *
+ * \param requestBins
+ *      The transaction's objects, grouped by master.
+ *
+ * \exception RetryException
+ *      The transaction aborted because it met locked objects, a master
+ *      was out of memory, or a master gave up waiting for the decision.
+ * \exception ClientException
+ *      A master refused its share of the transaction, or failed to apply
+ *      the decision. The latter is only thrown once every master has been
+ *      told the outcome; the transaction committed if every vote passed.
+ */
+void
+RamCloud::twoPhaseTransaction(
+        std::vector<ObjectFinder::MasterTransactionRequests>& requestBins)
+{
+    uint64_t transactionId = generateRandom();
+    uint32_t numBins = downCast<uint32_t>(requestBins.size());
+    // The MasterClients must outlive the RPCs that refer to them.
+    Tub<MasterClient> masters[numBins];
+    Tub<MasterClient::PrepareTransaction> prepares[numBins];
+    for (uint32_t i = 0; i < numBins; i++) {
+        masters[i].construct(requestBins[i].sessionRef);
+        prepares[i].construct(*masters[i], transactionId,
+                              requestBins[i].requests);
+    }
+
+    // Collect every vote, even after one has failed, so that no master
+    // prepares after it has been told to abort.
+    Status failure = STATUS_OK;
+    for (uint32_t i = 0; i < numBins; i++) {
+        try {
+            prepares[i]->complete();
+        } catch (ClientException& e) {
+            if (failure == STATUS_OK)
+                failure = e.status;
+        }
+    }
+
+    // A master that gave up waiting for us may have recorded an abort
+    // with the coordinator already; the first outcome recorded stands.
+    bool commit = (failure == STATUS_OK);
+    bool recorded = commit;
+    if (commit) {
+        commit = coordinator.setTransactionOutcome(transactionId, true);
+        if (!commit)
+            failure = STATUS_RETRY;
+    }
+
+    Tub<MasterClient::DecideTransaction> decides[numBins];
+    for (uint32_t i = 0; i < numBins; i++) {
+        decides[i].construct(*masters[i], transactionId,
+                             requestBins[i].requests, commit);
+    }
+    bool allDecided = true;
+    Status decideFailure = STATUS_OK;
+    for (uint32_t i = 0; i < numBins; i++) {
+        while (1) {
+            // Keep deciding until each master has applied the outcome; a
+            // master that can't yet (its log is full, say) keeps the
+            // transaction prepared meanwhile.
+            try {
+                decides[i]->complete();
+                break;
+            } catch (RetryException& e) {
+                decides[i].construct(*masters[i], transactionId,
+                                     requestBins[i].requests, commit);
+            } catch (ClientException& e) {
+                LOG(WARNING, "Master couldn't apply the outcome of "
+                    "transaction %lu: %s", transactionId, e.str().c_str());
+                if (decideFailure == STATUS_OK)
+                    decideFailure = e.status;
+                allDecided = false;
+                break;
+            } catch (TransportException& e) {
+                LOG(WARNING, "Couldn't tell a master the outcome of "
+                    "transaction %lu: %s", transactionId, e.str().c_str());
+                allDecided = false;
+                break;
+            }
+        }
+    }
+
+    // Had no outcome been recorded, a master asking the coordinator later
+    // would be told to abort, which is what it was told here too.
+    if (recorded && allDecided)
+        coordinator.forgetTransactionOutcome(transactionId);
+
+    if (!commit)
+        ClientException::throwException(HERE, failure);
+    if (decideFailure != STATUS_OK)
+        ClientException::throwException(HERE, decideFailure);
+}
+
 /// \copydoc MasterClient::write
 void
 RamCloud::write(uint32_t tableId, uint64_t id,
                 const void* buf, uint32_t length,
                 const RejectRules* rejectRules, uint64_t* version,
-                bool async)
+                bool async, uint32_t ttl)
 {
     Context::Guard _(clientContext);
     while (1) {
@@ -284,7 +827,7 @@ RamCloud::write(uint32_t tableId, uint64_t id,
         // status.
         try {
             Write(*this, tableId, id, buf, length,
-                  rejectRules, version, async)();
+                  rejectRules, version, async, ttl)();
             break;
         } catch (RetryException& e) {
         } catch (...) {
@@ -325,4 +868,28 @@ RamCloud::write(uint32_t tableId, uint64_t id, const char* s)
     }
 }
 
+/// Write an object named by a string key. See MasterClient::write.
+void
+RamCloud::write(uint32_t tableId, const void* key, uint16_t keyLength,
+                const void* buf, uint32_t length,
+                const RejectRules* rejectRules, uint64_t* version,
+                bool async, uint32_t ttl)
+{
+    Context::Guard _(clientContext);
+    MasterClient master(objectFinder.lookup(tableId,
+                                            Object::hashKey(key, keyLength)));
+    while (1) {
+        // Keep trying the operation if the server responded with a retry
+        // status.
+        try {
+            master.write(tableId, key, keyLength, buf, length,
+                         rejectRules, version, async, ttl);
+            break;
+        } catch (RetryException& e) {
+        } catch (...) {
+            throw;
+        }
+    }
+}
+
 }  // namespace RAMCloud
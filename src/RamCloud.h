@@ -67,6 +67,53 @@ class RamCloud {
         DISALLOW_COPY_AND_ASSIGN(Create);
     };
 
+    /**
+     * Iterates over every object in a table, a batch of objects at a time.
+     * Objects that exist for the whole enumeration are returned once,
+     * even if they are written, relocated by the log cleaner, or migrated
+     * meanwhile (an object whose tablet is split may be returned twice).
+     * Objects created or removed during the enumeration may or may not be
+     * returned. Objects come back in no particular order.
+     */
+    class Enumeration {
+      public:
+        Enumeration(RamCloud& ramCloud, uint32_t tableId);
+        bool next(uint64_t* id, Buffer* value, uint64_t* version = NULL,
+                  Buffer* key = NULL);
+      private:
+        void fetchBatch();
+
+        RamCloud& ramCloud;
+
+        /// The table being enumerated.
+        uint32_t tableId;
+
+        /// The first tablet key (see Object::tabletKey) of the tablet being
+        /// enumerated.
+        uint64_t startId;
+
+        /// Where the enumeration of the current tablet stands.
+        EnumerateTableRpc::Cursor cursor;
+
+        /// The last tablet key of the current tablet.
+        uint64_t tabletLastId;
+
+        /// Set once every object in the current tablet has been fetched.
+        bool tabletDone;
+
+        /// The objects fetched by the last request; see
+        /// MasterClient::enumerateTable().
+        Buffer batch;
+
+        /// Offset in #batch of the next object to return.
+        uint32_t batchOffset;
+
+        /// Number of objects in #batch not yet returned.
+        uint32_t batchRemaining;
+
+        DISALLOW_COPY_AND_ASSIGN(Enumeration);
+    };
+
     /// An asynchronous version of #read().
     class Read {
       public:
@@ -128,12 +175,13 @@ class RamCloud {
         Write(RamCloud& ramCloud,
               uint32_t tableId, uint64_t id, const void* buf,
               uint32_t length, const RejectRules* rejectRules = NULL,
-              uint64_t* version = NULL, bool async = false)
+              uint64_t* version = NULL, bool async = false,
+              uint32_t ttl = 0)
             : constructorContext(ramCloud.clientContext)
             , ramCloud(ramCloud)
             , master(ramCloud.objectFinder.lookup(tableId, id))
             , masterWrite(master, tableId, id, buf, length,
-                          rejectRules, version, async)
+                          rejectRules, version, async, ttl)
         {
             // This should be the last line on all return paths of this
             // constructor.
@@ -157,16 +205,40 @@ class RamCloud {
         DISALLOW_COPY_AND_ASSIGN(Write);
     };
 
+    /**
+     * The largest number of objects multiRead will request from a master
+     * in a single RPC; larger groups are split into several RPCs, which
+     * the master can also serve in parallel.
+     */
+    static const size_t MAX_OBJECTS_PER_MULTI_READ = 1000;
+
     explicit RamCloud(const char* serviceLocator);
     RamCloud(Context& context, const char* serviceLocator);
-    void createTable(const char* name);
+    void createTable(const char* name, uint32_t serverSpan = 1);
     void dropTable(const char* name);
     uint32_t openTable(const char* name);
+    bool compareAndSwap(uint32_t tableId, uint64_t id,
+                        const void* oldBuf, uint32_t oldLength,
+                        const void* newBuf, uint32_t newLength,
+                        Buffer* currentValue = NULL, uint64_t* version = NULL);
+    bool compareAndSwap(uint32_t tableId, const void* key, uint16_t keyLength,
+                        const void* oldBuf, uint32_t oldLength,
+                        const void* newBuf, uint32_t newLength,
+                        Buffer* currentValue = NULL, uint64_t* version = NULL);
     uint64_t create(uint32_t tableId, const void* buf, uint32_t length,
                     uint64_t* version = NULL, bool async = false);
     string* getServiceLocator();
     ServerMetrics getMetrics(const char* serviceLocator);
     ServerMetrics getMetrics(uint32_t table, uint64_t objectId);
+    int64_t increment(uint32_t tableId, uint64_t id, int64_t incrementValue,
+                      const RejectRules* rejectRules = NULL,
+                      uint64_t* version = NULL);
+    int64_t increment(uint32_t tableId, const void* key, uint16_t keyLength,
+                      int64_t incrementValue,
+                      const RejectRules* rejectRules = NULL,
+                      uint64_t* version = NULL);
+    void migrateTablet(uint32_t tableId, uint64_t firstId, uint64_t lastId,
+                       ServerId newOwnerMasterId);
     uint64_t ping(const char* serviceLocator, uint64_t nonce,
                   uint64_t timeoutNanoseconds);
     uint64_t ping(uint32_t table, uint64_t objectId, uint64_t nonce,
@@ -178,14 +250,32 @@ class RamCloud {
     void read(uint32_t tableId, uint64_t id, Buffer* value,
               const RejectRules* rejectRules = NULL,
               uint64_t* version = NULL);
+    void read(uint32_t tableId, const void* key, uint16_t keyLength,
+              Buffer* value, const RejectRules* rejectRules = NULL,
+              uint64_t* version = NULL);
     void multiRead(MasterClient::ReadObject* requests[], uint32_t numRequests);
+    void multiRemove(MasterClient::RemoveObject* requests[],
+                     uint32_t numRequests);
+    void multiWrite(MasterClient::WriteObject* requests[],
+                    uint32_t numRequests);
     void remove(uint32_t tableId, uint64_t id,
                 const RejectRules* rejectRules = NULL,
                 uint64_t* version = NULL);
+    void remove(uint32_t tableId, const void* key, uint16_t keyLength,
+                const RejectRules* rejectRules = NULL,
+                uint64_t* version = NULL);
+    void transaction(MasterClient::TransactionObject* objects[],
+                     uint32_t numObjects);
     void write(uint32_t tableId, uint64_t id, const void* buf,
                uint32_t length, const RejectRules* rejectRules = NULL,
-               uint64_t* version = NULL, bool async = false);
+               uint64_t* version = NULL, bool async = false,
+               uint32_t ttl = 0);
     void write(uint32_t tableId, uint64_t id, const char* s);
+    void write(uint32_t tableId, const void* key, uint16_t keyLength,
+               const void* buf, uint32_t length,
+               const RejectRules* rejectRules = NULL,
+               uint64_t* version = NULL, bool async = false,
+               uint32_t ttl = 0);
 
   PRIVATE:
     /**
@@ -222,6 +312,8 @@ class RamCloud {
     ObjectFinder objectFinder;
 
   private:
+    void twoPhaseTransaction(
+        std::vector<ObjectFinder::MasterTransactionRequests>& requestBins);
     DISALLOW_COPY_AND_ASSIGN(RamCloud);
 };
 } // namespace RAMCloud
@@ -25,6 +25,7 @@ class RamCloudTest : public ::testing::Test {
   public:
     MockCluster cluster;
     Tub<RamCloud> ramcloud;
+    MasterService* master1;
     uint32_t tableId1;
     uint32_t tableId2;
 
@@ -32,6 +33,7 @@ class RamCloudTest : public ::testing::Test {
     RamCloudTest()
         : cluster()
         , ramcloud()
+        , master1()
         , tableId1(-1)
         , tableId2(-2)
     {
@@ -41,7 +43,7 @@ class RamCloudTest : public ::testing::Test {
         ServerConfig config = ServerConfig::forTesting();
         config.services = {MASTER_SERVICE, PING_SERVICE};
         config.localLocator = "mock:host=master1";
-        cluster.addServer(config);
+        master1 = cluster.addServer(config)->master.get();
         config.services = {MASTER_SERVICE, PING_SERVICE};
         config.localLocator = "mock:host=master2";
         cluster.addServer(config);
@@ -80,6 +82,36 @@ TEST_F(RamCloudTest, proxyPing) {
                 "mock:host=master1", 100000, 100000));
 }
 
+TEST_F(RamCloudTest, enumeration) {
+    // Spread the table over both masters so the iterator has to move
+    // from one tablet to the next.
+    ramcloud->createTable("table3", 2);
+    uint32_t tableId3 = ramcloud->openTable("table3");
+    ramcloud->write(tableId3, 1, "one");
+    ramcloud->write(tableId3, ~0UL - 1, "last");
+    ramcloud->write(tableId3, "stringKey", 9, "keyed", 5);
+
+    std::map<string, string> seen;
+    RamCloud::Enumeration enumeration(*ramcloud, tableId3);
+    uint64_t id;
+    Buffer value;
+    Buffer key;
+    while (true) {
+        value.reset();
+        key.reset();
+        if (!enumeration.next(&id, &value, NULL, &key))
+            break;
+        string name = (key.getTotalLength() > 0) ?
+            TestUtil::toString(&key) : format("%lu", id);
+        seen[name] = TestUtil::toString(&value);
+    }
+    EXPECT_EQ(3U, seen.size());
+    EXPECT_EQ("one", seen["1"]);
+    EXPECT_EQ("last", seen[format("%lu", ~0UL - 1)]);
+    EXPECT_EQ("keyed", seen["stringKey"]);
+    EXPECT_FALSE(enumeration.next(&id, &value));
+}
+
 TEST_F(RamCloudTest, multiRead) {
     // Create objects to be read later
     uint64_t version1;
@@ -121,6 +153,110 @@ TEST_F(RamCloudTest, multiRead) {
     EXPECT_EQ("thirdVal", TestUtil::toString(readValue3.get()));
 }
 
+TEST_F(RamCloudTest, multiRead_partialReplies) {
+    ramcloud->write(tableId1, 0, "firstVal", 8);
+    ramcloud->write(tableId1, 1, "secondVal", 9);
+    ramcloud->write(tableId1, 2, "thirdVal", 8);
+
+    // Each reply can only hold one object, so the rest must be reissued.
+    master1->maxMultiReadReplyBytes = 1;
+
+    MasterClient::ReadObject* requests[3];
+    Tub<Buffer> values[3];
+    MasterClient::ReadObject objects[3];
+    for (uint32_t i = 0; i < 3; i++) {
+        objects[i] = MasterClient::ReadObject(tableId1, i, &values[i]);
+        objects[i].status = STATUS_RETRY;
+        requests[i] = &objects[i];
+    }
+
+    ramcloud->multiRead(requests, 3);
+
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(objects[0].status));
+    EXPECT_EQ("firstVal", TestUtil::toString(values[0].get()));
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(objects[1].status));
+    EXPECT_EQ("secondVal", TestUtil::toString(values[1].get()));
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(objects[2].status));
+    EXPECT_EQ("thirdVal", TestUtil::toString(values[2].get()));
+}
+
+TEST_F(RamCloudTest, multiRead_splitLargeBatches) {
+    const uint32_t numObjects = RamCloud::MAX_OBJECTS_PER_MULTI_READ + 1;
+    for (uint32_t i = 0; i < numObjects; i++)
+        ramcloud->write(tableId1, i, &i, sizeof(i));
+
+    uint64_t multiReadsBefore = metrics->rpc.multiReadCount;
+    std::vector<Tub<Buffer>> values(numObjects);
+    std::vector<MasterClient::ReadObject> reads(numObjects);
+    std::vector<MasterClient::ReadObject*> readRequests(numObjects);
+    for (uint32_t i = 0; i < numObjects; i++) {
+        reads[i] = MasterClient::ReadObject(tableId1, i, &values[i]);
+        readRequests[i] = &reads[i];
+    }
+    ramcloud->multiRead(&readRequests[0], numObjects);
+
+    EXPECT_EQ(2U, metrics->rpc.multiReadCount - multiReadsBefore);
+    for (uint32_t i = 0; i < numObjects; i++) {
+        EXPECT_STREQ("STATUS_OK", statusToSymbol(reads[i].status));
+        EXPECT_EQ(i, *values[i]->getStart<uint32_t>());
+    }
+}
+
+TEST_F(RamCloudTest, multiRemove) {
+    ramcloud->write(tableId1, 0, "firstVal", 8);
+    ramcloud->write(tableId2, 0, "secondVal", 9);
+
+    MasterClient::RemoveObject* requests[2];
+    MasterClient::RemoveObject request1(tableId1, 0);
+    request1.status = STATUS_RETRY;
+    requests[0] = &request1;
+    MasterClient::RemoveObject request2(tableId2, 0);
+    request2.status = STATUS_RETRY;
+    requests[1] = &request2;
+
+    ramcloud->multiRemove(requests, 2);
+
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request1.status));
+    EXPECT_EQ(1U, request1.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request2.status));
+    EXPECT_EQ(1U, request2.version);
+    Buffer value;
+    EXPECT_THROW(ramcloud->read(tableId1, 0, &value),
+                 ObjectDoesntExistException);
+    EXPECT_THROW(ramcloud->read(tableId2, 0, &value),
+                 ObjectDoesntExistException);
+}
+
+TEST_F(RamCloudTest, multiWrite) {
+    MasterClient::WriteObject* requests[3];
+    MasterClient::WriteObject request1(tableId1, 0, "firstVal", 8);
+    request1.status = STATUS_RETRY;
+    requests[0] = &request1;
+    MasterClient::WriteObject request2(tableId2, 0, "secondVal", 9);
+    request2.status = STATUS_RETRY;
+    requests[1] = &request2;
+    MasterClient::WriteObject request3(tableId2, 1, "thirdVal", 8);
+    request3.status = STATUS_RETRY;
+    requests[2] = &request3;
+
+    ramcloud->multiWrite(requests, 3);
+
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request1.status));
+    EXPECT_EQ(1U, request1.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request2.status));
+    EXPECT_EQ(1U, request2.version);
+    EXPECT_STREQ("STATUS_OK", statusToSymbol(request3.status));
+    EXPECT_EQ(2U, request3.version);
+
+    Buffer value;
+    ramcloud->read(tableId1, 0, &value);
+    EXPECT_EQ("firstVal", TestUtil::toString(&value));
+    ramcloud->read(tableId2, 0, &value);
+    EXPECT_EQ("secondVal", TestUtil::toString(&value));
+    ramcloud->read(tableId2, 1, &value);
+    EXPECT_EQ("thirdVal", TestUtil::toString(&value));
+}
+
 TEST_F(RamCloudTest, writeString) {
     uint32_t tableId1 = ramcloud->openTable("table1");
     ramcloud->write(tableId1, 99, "abcdef");
@@ -79,8 +79,9 @@ class RecoverSegmentBenchmark {
         /* Update the list of Tablets */
         ProtoBuf::Tablets_Tablet tablet;
         tablet.set_table_id(0);
+        // Objects are placed by the hash of their ids; take them all.
         tablet.set_start_object_id(0);
-        tablet.set_end_object_id(nextObjId - 1);
+        tablet.set_end_object_id(~0UL);
         tablet.set_state(ProtoBuf::Tablets_Tablet_State_NORMAL);
         tablet.set_server_id(service->serverId.getId());
         ProtoBuf::Tablets tablets;
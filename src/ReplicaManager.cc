@@ -34,17 +34,24 @@ namespace RAMCloud {
  *      Server id of master that this will be managing replicas for (also
  *      serves as the log id).
  * \param numReplicas
- *      Number replicas to keep of each segment.
+ *      Number replicas to keep of each segment on backups other than the
+ *      one running alongside this master.
+ * \param localReplica
+ *      If true, keep one more replica of each segment on the backup running
+ *      alongside this master (which shares its server id).
  */
 ReplicaManager::ReplicaManager(ServerList& serverList,
                                const ServerId& masterId,
-                               uint32_t numReplicas)
+                               uint32_t numReplicas,
+                               bool localReplica)
     : numReplicas(numReplicas)
+    , localReplica(localReplica)
     , tracker(serverList)
-    , backupSelector(tracker)
+    , backupSelector(tracker, masterId, localReplica)
     , dataMutex()
     , masterId(masterId)
-    , replicatedSegmentPool(ReplicatedSegment::sizeOf(numReplicas))
+    , replicatedSegmentPool(
+        ReplicatedSegment::sizeOf(numReplicas + localReplica))
     , replicatedSegmentList()
     , taskManager()
     , writeRpcsInFlight(0)
@@ -123,7 +130,8 @@ ReplicaManager::openSegment(uint64_t segmentId, const void* data,
                                  writeRpcsInFlight,
                                  dataMutex,
                                  masterId, segmentId,
-                                 data, openLen, numReplicas);
+                                 data, openLen,
+                                 numReplicas + localReplica);
     replicatedSegmentList.push_back(*replicatedSegment);
     replicatedSegment->schedule();
     return replicatedSegment;
@@ -59,7 +59,8 @@ class ReplicaManager
 {
    PUBLIC:
     ReplicaManager(ServerList& serverList,
-                   const ServerId& masterId, uint32_t numReplicas);
+                   const ServerId& masterId, uint32_t numReplicas,
+                   bool localReplica = false);
     ~ReplicaManager();
 
     ReplicatedSegment* openSegment(uint64_t segmentId,
@@ -67,9 +68,12 @@ class ReplicaManager
         __attribute__((warn_unused_result));
     void proceed();
 
-    /// Number replicas to keep of each segment.
+    /// Number replicas to keep of each segment on remote backups.
     const uint32_t numReplicas;
 
+    /// Whether one more replica of each segment is kept on the local backup.
+    const bool localReplica;
+
   PRIVATE:
     void clusterConfigurationChanged();
 
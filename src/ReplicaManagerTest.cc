@@ -141,7 +141,7 @@ TEST_F(ReplicaManagerTest, writeSegment) {
     ProtoBuf::Tablets::Tablet& tablet(*will.add_tablet());
     tablet.set_table_id(123);
     tablet.set_start_object_id(0);
-    tablet.set_end_object_id(100);
+    tablet.set_end_object_id(~0UL);
     tablet.set_state(ProtoBuf::Tablets::Tablet::RECOVERING);
     tablet.set_user_data(0); // partition id
 
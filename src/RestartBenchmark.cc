@@ -0,0 +1,193 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * \file
+ * Measures how long a master takes to reload its log from the replicas its
+ * co-located backup kept on local disk across a planned restart (see
+ * ServerConfig::restartServerId), next to the bandwidth of that disk.
+ */
+
+#include <unistd.h>
+
+#include "BackupService.h"
+#include "ClientException.h"
+#include "Cycles.h"
+#include "MasterService.h"
+#include "Memory.h"
+#include "Tablets.pb.h"
+
+namespace RAMCloud {
+
+class RestartBenchmark {
+
+  public:
+    ServerConfig config;
+    ServerList serverList;
+    const ServerId formerId;
+    const uint32_t numSegments;
+
+    RestartBenchmark(string logSize, string hashTableSize,
+                     uint32_t numSegments)
+        : config(ServerConfig::forTesting())
+        , serverList()
+        , formerId(1, 0)
+        , numSegments(numSegments)
+    {
+        config.localLocator = "bogus";
+        config.coordinatorLocator = "bogus";
+        config.setLogAndHashTableSize(logSize, hashTableSize);
+        config.master.numReplicas = 0;
+        config.backup.inMemory = false;
+        config.backup.file = "/var/tmp/ramcloud-restart-benchmark.log";
+        config.backup.segmentSize = Segment::SEGMENT_SIZE;
+        // Leave room for the frames BackupStorage::benchmark() uses.
+        config.backup.numSegmentFrames = numSegments + 16;
+    }
+
+    ~RestartBenchmark()
+    {
+        unlink(config.backup.file.c_str());
+    }
+
+    /**
+     * Store a log of #numSegments segments full of objects of objectBytes
+     * bytes on a backup and shut the backup down cleanly, leaving the head
+     * open as a planned restart would. Objects go in table 0.
+     */
+    void
+    writeLog(int objectBytes)
+    {
+        BackupService backup(config);
+        uint32_t readSpeed, writeSpeed;
+        backup.benchmark(readSpeed, writeSpeed);
+        printf("Backup storage reads at %u MB/s, writes at %u MB/s\n",
+               readSpeed, writeSpeed);
+
+        char digestBuffer[LogDigest::getBytesFromCount(numSegments)];
+        LogDigest digest(numSegments, digestBuffer, sizeof(digestBuffer));
+        for (uint32_t i = 0; i < numSegments; i++)
+            digest.addSegment(i);
+
+        uint64_t nextObjId = 0;
+        void* p = Memory::xmalloc(HERE, Segment::SEGMENT_SIZE);
+        for (uint32_t i = 0; i < numSegments; i++) {
+            bool head = (i == numSegments - 1);
+            Segment segment(*formerId, i, p, Segment::SEGMENT_SIZE);
+            if (head) {
+                segment.append(LOG_ENTRY_TYPE_LOGDIGEST, digestBuffer,
+                               downCast<uint32_t>(sizeof(digestBuffer)));
+            }
+            while (1) {
+                DECLARE_OBJECT(o, objectBytes);
+                o->id.objectId = nextObjId;
+                o->id.tableId = 0;
+                o->version = 0;
+                if (segment.append(LOG_ENTRY_TYPE_OBJ, o,
+                                   o->objectLength(objectBytes)) == NULL)
+                    break;
+                nextObjId++;
+            }
+            if (!head)
+                segment.close(NULL);
+
+            BackupService::SegmentInfo* info =
+                new BackupService::SegmentInfo(*backup.storage, backup.pool,
+                                               backup.ioScheduler, formerId,
+                                               i, Segment::SEGMENT_SIZE,
+                                               true);
+            backup.segments[BackupService::MasterSegmentIdPair(formerId, i)] =
+                info;
+            info->open();
+            Buffer buffer;
+            Buffer::Chunk::appendToBuffer(&buffer, p,
+                                          segment.getAppendedLength());
+            info->write(buffer, 0, buffer.getTotalLength(), 0);
+            if (!head)
+                info->close();
+            segment.freeReplicas();
+        }
+        free(p);
+
+        // ~BackupService stores the open head along with everything else.
+    }
+
+    void
+    run(int objectBytes)
+    {
+        writeLog(objectBytes);
+
+        ProtoBuf::Tablets tablets;
+        ProtoBuf::Tablets_Tablet& tablet(*tablets.add_tablet());
+        tablet.set_table_id(0);
+        // Objects are placed by the hash of their ids; take them all.
+        tablet.set_start_object_id(0);
+        tablet.set_end_object_id(~0UL);
+        tablet.set_state(ProtoBuf::Tablets_Tablet_State_RECOVERING);
+        tablet.set_user_data(0);
+
+        config.services = {MASTER_SERVICE};
+        MasterService master(config, NULL, serverList);
+        master.serverId = ServerId(2, 0);
+        master.setTablets(tablets);
+
+        /*
+         * Time what a restarted server does before it can serve again:
+         * find the replicas on disk, then read and replay them.
+         */
+        config.restartServerId = formerId;
+        uint64_t before = Cycles::rdtsc();
+        Tub<BackupService> backup;
+        backup.construct(config);
+        vector<uint64_t> segmentIds;
+        if (!backup->findLocalLog(formerId, segmentIds))
+            DIE("Couldn't find the log just written");
+        uint64_t bytes = master.replayLocalLog(formerId, *backup, segmentIds,
+                                               tablets);
+        uint64_t ticks = Cycles::rdtsc() - before;
+
+        uint64_t diskBytes = static_cast<uint64_t>(numSegments) *
+                             Segment::SEGMENT_SIZE;
+        double secs = Cycles::toSeconds(ticks);
+        printf("Restart from %u %uKB Segments with %d byte Objects took %lu "
+               "milliseconds\n", numSegments, Segment::SEGMENT_SIZE / 1024,
+               objectBytes, Cycles::toNanoseconds(ticks) / 1000 / 1000);
+        printf("Read %.1f MB/s from disk, replayed %.1f MB/s of objects\n",
+               static_cast<double>(diskBytes) / (1 << 20) / secs,
+               static_cast<double>(bytes) / (1 << 20) / secs);
+
+        backup->freeLocalLog(formerId);
+        config.restartServerId = ServerId();
+    }
+
+    DISALLOW_COPY_AND_ASSIGN(RestartBenchmark);
+};
+
+}  // namespace RAMCloud
+
+int
+main()
+{
+    uint32_t numSegments = 40;
+    int objectBytes[] = { 128, 1024, 8192, 0 };
+
+    for (int i = 0; objectBytes[i] != 0; i++) {
+        printf("==========================\n");
+        RAMCloud::RestartBenchmark rb("2048", "10%", numSegments);
+        rb.run(objectBytes[i]);
+    }
+
+    return 0;
+}
@@ -83,6 +83,21 @@ Rpc::opcodeSymbol(uint32_t opcode)
         case UPDATE_SERVER_LIST:         return "UDPATE_SERVER_LIST";
         case REQUEST_SERVER_LIST:        return "REQUEST_SERVER_LIST";
         case GET_SERVER_ID:              return "GET_SERVER_ID";
+        case MULTI_WRITE:                return "MULTI_WRITE";
+        case MULTI_REMOVE:               return "MULTI_REMOVE";
+        case MIGRATE_TABLET:             return "MIGRATE_TABLET";
+        case PREP_FOR_MIGRATION:         return "PREP_FOR_MIGRATION";
+        case RECEIVE_MIGRATION_DATA:     return "RECEIVE_MIGRATION_DATA";
+        case REASSIGN_TABLET_OWNERSHIP:  return "REASSIGN_TABLET_OWNERSHIP";
+        case SPLIT_TABLET:               return "SPLIT_TABLET";
+        case ENUMERATE_TABLE:            return "ENUMERATE_TABLE";
+        case INCREMENT:                  return "INCREMENT";
+        case COMPARE_AND_SWAP:           return "COMPARE_AND_SWAP";
+        case TRANSACTION:                return "TRANSACTION";
+        case PREPARE_TRANSACTION:        return "PREPARE_TRANSACTION";
+        case DECIDE_TRANSACTION:         return "DECIDE_TRANSACTION";
+        case SET_TRANSACTION_OUTCOME:    return "SET_TRANSACTION_OUTCOME";
+        case FORGET_TRANSACTION_OUTCOME: return "FORGET_TRANSACTION_OUTCOME";
         case ILLEGAL_RPC_TYPE:           return "ILLEGAL_RPC_TYPE";
     }
 
@@ -96,7 +96,22 @@ enum RpcOpcode {
     UPDATE_SERVER_LIST      = 38,
     REQUEST_SERVER_LIST     = 39,
     GET_SERVER_ID           = 40,
-    ILLEGAL_RPC_TYPE        = 41,  // 1 + the highest legitimate RpcOpcode
+    MULTI_WRITE             = 41,
+    MULTI_REMOVE            = 42,
+    MIGRATE_TABLET          = 43,
+    PREP_FOR_MIGRATION      = 44,
+    RECEIVE_MIGRATION_DATA  = 45,
+    REASSIGN_TABLET_OWNERSHIP = 46,
+    SPLIT_TABLET            = 47,
+    ENUMERATE_TABLE         = 48,
+    INCREMENT               = 49,
+    COMPARE_AND_SWAP        = 50,
+    TRANSACTION             = 51,
+    PREPARE_TRANSACTION     = 52,
+    DECIDE_TRANSACTION      = 53,
+    SET_TRANSACTION_OUTCOME = 54,
+    FORGET_TRANSACTION_OUTCOME = 55,
+    ILLEGAL_RPC_TYPE        = 56,  // 1 + the highest legitimate RpcOpcode
 };
 
 /**
@@ -129,6 +144,32 @@ struct RpcResponseCommon {
 
 // Master RPCs follow, see MasterService.cc
 
+struct CompareAndSwapRpc {
+    static const RpcOpcode opcode = COMPARE_AND_SWAP;
+    static const ServiceType service = MASTER_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint64_t id;
+        uint32_t tableId;
+        uint32_t oldLength;           // Length of the value the object must
+                                      // currently have. Those bytes follow
+                                      // immediately after this header.
+        uint32_t newLength;           // Length of the replacement value,
+                                      // whose bytes follow the old value.
+        uint16_t keyLength;           // See ReadRpc; the key bytes follow
+                                      // immediately after this header,
+                                      // ahead of the old value.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+        uint64_t version;             // The object's version afterwards.
+        uint8_t swapped;              // 0 if the old value didn't match.
+        uint32_t length;              // If not swapped, the length of the
+                                      // object's current value, whose bytes
+                                      // follow immediately after this header.
+    } __attribute__((packed));
+};
+
 struct CreateRpc {
     static const RpcOpcode opcode = CREATE;
     static const ServiceType service = MASTER_SERVICE;
@@ -147,6 +188,54 @@ struct CreateRpc {
     } __attribute__((packed));
 };
 
+struct DecideTransactionRpc {
+    static const RpcOpcode opcode = DECIDE_TRANSACTION;
+    static const ServiceType service = MASTER_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint64_t transactionId;       // See PrepareTransactionRpc.
+        uint8_t commit;               // 0 means abort.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+        uint32_t count;               // Number of versions that follow, as
+                                      // in TransactionRpc; 0 for aborts.
+    } __attribute__((packed));
+};
+
+struct EnumerateTableRpc {
+    static const RpcOpcode opcode = ENUMERATE_TABLE;
+    static const ServiceType service = MASTER_SERVICE;
+    /// Where an enumeration of a tablet stands. Clients should treat this
+    /// as opaque and pass back what the previous response returned.
+    struct Cursor {
+        uint64_t nextBucket;       // Next hash table bucket to visit,
+                                   // counting in a table of numBuckets.
+        uint64_t numBuckets;       // Size of the hash table the enumeration
+                                   // is counted in; 0 to start afresh.
+    } __attribute__((packed));
+    struct Request {
+        RpcRequestCommon common;
+        uint32_t tableId;
+        uint64_t startId;          // The first tablet key of the tablet
+                                   // being enumerated (see
+                                   // Object::tabletKey); only objects at or
+                                   // after it are returned.
+        Cursor cursor;
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+        uint64_t tabletLastId;     // The last tablet key of the tablet that
+                                   // holds startId on this master.
+        Cursor cursor;             // Pass back to continue the enumeration.
+        uint8_t done;              // Nonzero once the whole tablet has been
+                                   // returned.
+        uint32_t count;            // Number of objects in this response.
+                                   // Each is a SegmentEntry followed by an
+                                   // Object, as for MultiReadRpc.
+    } __attribute__((packed));
+};
+
 struct FillWithTestDataRpc {
     static const RpcOpcode opcode = FILL_WITH_TEST_DATA;
     static const ServiceType service = MASTER_SERVICE;
@@ -161,6 +250,40 @@ struct FillWithTestDataRpc {
     } __attribute__((packed));
 };
 
+struct IncrementRpc {
+    static const RpcOpcode opcode = INCREMENT;
+    static const ServiceType service = MASTER_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint64_t id;
+        uint32_t tableId;
+        int64_t incrementValue;
+        RejectRules rejectRules;
+        uint16_t keyLength;           // See ReadRpc; the key bytes follow
+                                      // immediately after this header.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+        uint64_t version;
+        int64_t newValue;
+    } __attribute__((packed));
+};
+
+struct MigrateTabletRpc {
+    static const RpcOpcode opcode = MIGRATE_TABLET;
+    static const ServiceType service = MASTER_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint32_t tableId;
+        uint64_t firstId;          // First and last object ids of the tablet;
+        uint64_t lastId;           // they must match a tablet exactly.
+        uint64_t newOwnerMasterId; // Server Id of the master to move it to.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+    } __attribute__((packed));
+};
+
 struct MultiReadRpc {
     static const RpcOpcode opcode = MULTI_READ;
     static const ServiceType service = MASTER_SERVICE;
@@ -170,8 +293,11 @@ struct MultiReadRpc {
         struct Part {
             uint32_t tableId;
             uint64_t id;
-            Part(uint32_t tableId, uint64_t id) : tableId(tableId), id(id) {}
-        };
+            uint16_t keyLength;       // See ReadRpc; the key bytes follow
+                                      // immediately after this part.
+            Part(uint32_t tableId, uint64_t id, uint16_t keyLength = 0)
+                : tableId(tableId), id(id), keyLength(keyLength) {}
+        } __attribute__((packed));
     } __attribute__((packed));
     struct Response {
         // RpcResponseCommon contains a status field. But it is not used in
@@ -181,7 +307,109 @@ struct MultiReadRpc {
         uint32_t count;
         // In buffer: Status, SegmentEntry and Object go here
         // Object has variable number of bytes (depending on data size.)
-        // In case of an error, only Status goes here
+        // In case of an error, only Status goes here. Objects that did not
+        // fit in the reply come back as STATUS_RETRY and should be reissued.
+    } __attribute__((packed));
+};
+
+struct MultiRemoveRpc {
+    static const RpcOpcode opcode = MULTI_REMOVE;
+    static const ServiceType service = MASTER_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint32_t count;
+        struct Part {
+            uint32_t tableId;
+            uint64_t id;
+            RejectRules rejectRules;
+            Part(uint32_t tableId, uint64_t id, const RejectRules& rejectRules)
+                : tableId(tableId), id(id), rejectRules(rejectRules) {}
+        } __attribute__((packed));
+    } __attribute__((packed));
+    struct Response {
+        // As in MultiReadRpc, the common status only reports problems with
+        // the request as a whole; each object gets its own Part below.
+        RpcResponseCommon common;
+        uint32_t count;
+        // In buffer: one Part per object, in the order they were requested.
+        struct Part {
+            Status status;
+            uint64_t version;
+            Part(Status status, uint64_t version)
+                : status(status), version(version) {}
+        } __attribute__((packed));
+    } __attribute__((packed));
+};
+
+struct MultiWriteRpc {
+    static const RpcOpcode opcode = MULTI_WRITE;
+    static const ServiceType service = MASTER_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint32_t count;
+        // In buffer: one Part per object, each immediately followed by the
+        // length bytes of that object's value.
+        struct Part {
+            uint32_t tableId;
+            uint64_t id;
+            uint32_t length;
+            RejectRules rejectRules;
+            Part(uint32_t tableId, uint64_t id, uint32_t length,
+                 const RejectRules& rejectRules)
+                : tableId(tableId), id(id), length(length),
+                  rejectRules(rejectRules) {}
+        } __attribute__((packed));
+    } __attribute__((packed));
+    struct Response {
+        // As in MultiReadRpc, the common status only reports problems with
+        // the request as a whole; each object gets its own Part below.
+        RpcResponseCommon common;
+        uint32_t count;
+        // In buffer: one Part per object, in the order they were requested.
+        struct Part {
+            Status status;
+            uint64_t version;
+            Part(Status status, uint64_t version)
+                : status(status), version(version) {}
+        } __attribute__((packed));
+    } __attribute__((packed));
+};
+
+struct PrepForMigrationRpc {
+    static const RpcOpcode opcode = PREP_FOR_MIGRATION;
+    static const ServiceType service = MASTER_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint32_t tableId;
+        uint64_t firstId;
+        uint64_t lastId;
+        uint64_t sourceMasterId;   // Server Id of the master migrating the
+                                   // tablet here.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+    } __attribute__((packed));
+};
+
+struct PrepareTransactionRpc {
+    static const RpcOpcode opcode = PREPARE_TRANSACTION;
+    static const ServiceType service = MASTER_SERVICE;
+    /// How long a master waits for DECIDE_TRANSACTION before asking the
+    /// coordinator for the transaction's outcome instead (see
+    /// SetTransactionOutcomeRpc).
+    static const uint64_t LEASE_NS = 1000UL * 1000 * 1000;
+    struct Request {
+        RpcRequestCommon common;
+        uint64_t transactionId;       // Chosen by the client; names the
+                                      // transaction in DECIDE_TRANSACTION.
+        uint32_t count;
+        // In buffer: count TransactionRpc::Request::Parts, each followed
+        // by its value, exactly as in TransactionRpc.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+        uint32_t rejectedPart;        // See TransactionRpc.
+        uint64_t rejectedVersion;
     } __attribute__((packed));
 };
 
@@ -193,6 +421,11 @@ struct ReadRpc {
         uint32_t tableId;
         uint64_t id;
         RejectRules rejectRules;
+        uint16_t keyLength;           // Length of the object's string key in
+                                      // bytes, or 0 if it is named by id
+                                      // alone. The key bytes follow
+                                      // immediately after this header, and
+                                      // id must be Object::hashKey() of them.
     } __attribute__((packed));
     struct Response {
         RpcResponseCommon common;
@@ -203,6 +436,27 @@ struct ReadRpc {
     } __attribute__((packed));
 };
 
+struct ReceiveMigrationDataRpc {
+    static const RpcOpcode opcode = RECEIVE_MIGRATION_DATA;
+    static const ServiceType service = MASTER_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint32_t tableId;
+        uint64_t firstId;
+        uint64_t lastId;
+        uint32_t segmentLength;    // Number of bytes of log entries, in the
+                                   // same format as a recovery segment, that
+                                   // follow immediately after this header.
+        uint8_t done;              // Nonzero on the last batch, once the
+                                   // target may take over the tablet.
+        uint64_t tableVersion;     // On the last batch, the lowest version
+                                   // the target may assign to new objects.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+    } __attribute__((packed));
+};
+
 struct RecoverRpc {
     static const RpcOpcode opcode = RECOVER;
     static const ServiceType service = MASTER_SERVICE;
@@ -260,6 +514,8 @@ struct RemoveRpc {
         uint64_t id;
         uint32_t tableId;
         RejectRules rejectRules;
+        uint16_t keyLength;           // See ReadRpc; the key bytes follow
+                                      // immediately after this header.
     } __attribute__((packed));
     struct Response {
         RpcResponseCommon common;
@@ -283,6 +539,40 @@ struct SetTabletsRpc {
     } __attribute__((packed));
 };
 
+struct TransactionRpc {
+    static const RpcOpcode opcode = TRANSACTION;
+    static const ServiceType service = MASTER_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint32_t count;
+        // In buffer: one Part per object, each immediately followed by the
+        // length bytes of that object's new value.
+        struct Part {
+            uint32_t tableId;
+            uint64_t id;
+            uint32_t length;          // Must be 0 for removes.
+            RejectRules rejectRules;
+            uint8_t remove;           // If nonzero, remove the object
+                                      // instead of writing it.
+            Part(uint32_t tableId, uint64_t id, uint32_t length,
+                 const RejectRules& rejectRules, bool remove)
+                : tableId(tableId), id(id), length(length),
+                  rejectRules(rejectRules), remove(remove) {}
+        } __attribute__((packed));
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+        uint32_t rejectedPart;        // If the status reports a failed
+                                      // reject rule, the index of the part
+                                      // that failed it...
+        uint64_t rejectedVersion;     // ...and its object's current version.
+        uint32_t count;
+        // In buffer on success: count uint64_t versions, one per Part in
+        // the order requested. Writes get the object's new version and
+        // removes the version removed (VERSION_NONEXISTENT if none).
+    } __attribute__((packed));
+};
+
 struct WriteRpc {
     static const RpcOpcode opcode = WRITE;
     static const ServiceType service = MASTER_SERVICE;
@@ -292,9 +582,14 @@ struct WriteRpc {
         uint32_t tableId;
         uint32_t length;              // Length of the object's value in bytes.
                                       // The actual bytes of the object follow
-                                      // immediately after this header.
+                                      // immediately after this header and
+                                      // the key.
         RejectRules rejectRules;
         uint8_t async;
+        uint16_t keyLength;           // See ReadRpc; the key bytes follow
+                                      // immediately after this header.
+        uint32_t ttl;                 // If nonzero, the object expires this
+                                      // many seconds after it is written.
     } __attribute__((packed));
     struct Response {
         RpcResponseCommon common;
@@ -313,6 +608,8 @@ struct CreateTableRpc {
                                       // including terminating NULL
                                       // character. The bytes of the name
                                       // follow immediately after this header.
+        uint32_t serverSpan;          // Number of tablets to split the table
+                                      // into, each on a different master.
     } __attribute__((packed));
     struct Response {
         RpcResponseCommon common;
@@ -359,6 +656,13 @@ struct EnlistServerRpc {
                                            ///< on the enlisting server.
         uint32_t readSpeed;            // MB/s read speed if a BACKUP
         uint32_t writeSpeed;           // MB/s write speed if a BACKUP
+        uint64_t replacesId;           // ServerId this process is restarting
+                                       // as, or 0 (never allocated) if it
+                                       // is a new server.
+        uint8_t takeOverTablets;       // If nonzero the enlisting master
+                                       // will replay replacesId's log from
+                                       // local storage and keep its tablets
+                                       // instead of crash recovering them.
         uint32_t serviceLocatorLength; // Number of bytes in the serviceLocator,
                                        // including terminating NULL character.
                                        // The bytes of the service locator
@@ -453,6 +757,64 @@ struct SetWillRpc {
     } __attribute__((packed));
 };
 
+struct ReassignTabletOwnershipRpc {
+    static const RpcOpcode opcode = REASSIGN_TABLET_OWNERSHIP;
+    static const ServiceType service = COORDINATOR_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint32_t tableId;
+        uint64_t firstId;
+        uint64_t lastId;
+        uint64_t newOwnerMasterId; // Server Id of the master taking over.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+    } __attribute__((packed));
+};
+
+struct SetTransactionOutcomeRpc {
+    static const RpcOpcode opcode = SET_TRANSACTION_OUTCOME;
+    static const ServiceType service = COORDINATOR_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint64_t transactionId;       // See PrepareTransactionRpc.
+        uint8_t commit;               // The outcome to record if none has
+                                      // been yet; 0 means abort.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+        uint8_t commit;               // The outcome recorded, which may
+                                      // differ from the one requested.
+    } __attribute__((packed));
+};
+
+struct ForgetTransactionOutcomeRpc {
+    static const RpcOpcode opcode = FORGET_TRANSACTION_OUTCOME;
+    static const ServiceType service = COORDINATOR_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint64_t transactionId;       // See PrepareTransactionRpc.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+    } __attribute__((packed));
+};
+
+struct SplitTabletRpc {
+    static const RpcOpcode opcode = SPLIT_TABLET;
+    static const ServiceType service = COORDINATOR_SERVICE;
+    struct Request {
+        RpcRequestCommon common;
+        uint32_t tableId;
+        uint64_t firstId;
+        uint64_t lastId;
+        uint64_t splitId;          // First object id of the upper half.
+    } __attribute__((packed));
+    struct Response {
+        RpcResponseCommon common;
+    } __attribute__((packed));
+};
+
 struct RequestServerListRpc {
     static const RpcOpcode opcode = REQUEST_SERVER_LIST;
     static const ServiceType service = COORDINATOR_SERVICE;
@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "Buffer.h"
 #include "Crc32C.h"
 #include "CycleCounter.h"
 #include "RawMetrics.h"
@@ -84,6 +85,7 @@ Segment::Segment(Log *log,
       entryCountsByType(),
       listEntries(),
       cleanedEpoch(-1),
+      pinCount(0),
       replicatedSegment(NULL)
 {
     commonConstructor(type, buffer, length);
@@ -130,6 +132,7 @@ Segment::Segment(uint64_t logId,
       entryCountsByType(),
       listEntries(),
       cleanedEpoch(-1),
+      pinCount(0),
       replicatedSegment(NULL)
 {
     commonConstructor(LOG_ENTRY_TYPE_INVALID, NULL, 0);
@@ -241,7 +244,7 @@ Segment::multiAppend(SegmentMultiAppendVector& appends, bool sync)
     for (size_t i = 0; i < appends.size(); i++) {
         if (appends[i].type == LOG_ENTRY_TYPE_SEGFOOTER)
             return {};
-        totalEntryBytes += appends[i].length;
+        totalEntryBytes += appends[i].totalLength();
     }
 
     if (!locklessCanAppendEntries(appends.size(), totalEntryBytes))
@@ -252,7 +255,10 @@ Segment::multiAppend(SegmentMultiAppendVector& appends, bool sync)
                                          appends[i].buffer,
                                          appends[i].length,
                                          false,
-                                         appends[i].expectedChecksum));
+                                         appends[i].expectedChecksum,
+                                         appends[i].payload,
+                                         appends[i].payloadOffset,
+                                         appends[i].payloadLength));
 
         // This should never fail. It was up to this method to ensure
         // success before starting the appends.
@@ -428,6 +434,31 @@ Segment::sync()
         replicatedSegment->sync(tail);
 }
 
+/**
+ * Wait for the first \a offset bytes of the segment to be replicated.
+ * Unlike sync(), this does not hold the segment's lock while it waits, so
+ * other threads can keep appending to the segment, and waiting for their
+ * own appends, in the meantime; whichever of them is driving replication
+ * sends everything appended so far, so one round trip to the backups can
+ * make many appends durable.
+ *
+ * \param offset
+ *      The number of bytes into the segment that must be durable, as
+ *      returned by getAppendedLength() after the appends of interest.
+ */
+void
+Segment::sync(uint32_t offset)
+{
+    ReplicatedSegment* replica;
+    {
+        std::lock_guard<SpinLock> lock(mutex);
+        assert(offset <= tail);
+        replica = replicatedSegment;
+    }
+    if (replica)
+        replica->sync(offset);
+}
+
 /**
  * Request the eventual freeing all known replicas of a segment from its
  * backups.  Requires that the segment has been closed.
@@ -474,6 +505,17 @@ Segment::getCapacity() const
     return capacity;
 }
 
+/**
+ * Return the number of bytes appended to this Segment so far, including
+ * its header and the metadata of every entry.
+ */
+uint32_t
+Segment::getAppendedLength()
+{
+    std::lock_guard<SpinLock> lock(mutex);
+    return tail;
+}
+
 /**
  * \copydoc Segment::locklessAppendableBytes
  */
@@ -573,6 +615,14 @@ Segment::getAverageTimestamp()
  *      The checksum we expect this entry to have once appended. If the
  *      actual calculated checksum does not match, an exception is
  *      thrown and nothing is appended. This parameter is optional.
+ * \param[in] payload
+ *      If non-NULL, a Buffer whose contents in the range given by
+ *      \a payloadOffset and \a payloadLength are appended following
+ *      \a buffer as part of the same entry. Optional.
+ * \param[in] payloadOffset
+ *      Offset of the first byte of \a payload to append.
+ * \param[in] payloadLength
+ *      Number of bytes of \a payload to append.
  * \return
  *      On success, a SegmentEntryHandle is returned, which points to the
  *      ``buffer'' written. On failure, the handle is NULL. We avoid using
@@ -580,16 +630,17 @@ Segment::getAverageTimestamp()
  */
 SegmentEntryHandle
 Segment::locklessAppend(LogEntryType type, const void *buffer, uint32_t length,
-    bool sync, Tub<SegmentChecksum::ResultType> expectedChecksum)
+    bool sync, Tub<SegmentChecksum::ResultType> expectedChecksum,
+    const Buffer* payload, uint32_t payloadOffset, uint32_t payloadLength)
 {
     CycleCounter<RawMetric> _(&metrics->master.segmentAppendTicks);
 
     if (closed || type == LOG_ENTRY_TYPE_SEGFOOTER ||
-      !locklessCanAppendEntries(1, length))
+      !locklessCanAppendEntries(1, length + payloadLength))
         return NULL;
 
     return forceAppendWithEntry(type, buffer, length,
-        sync, true, expectedChecksum);
+        sync, true, expectedChecksum, payload, payloadOffset, payloadLength);
 }
 
 /**
@@ -710,12 +761,16 @@ Segment::adjustSpaceTimeSum(SegmentEntryHandle handle, bool subtract)
  *      Pointer to the data to be appended to the Segment's backing memory.
  * \param[in] length
  *      Length of the buffer to be appended in bytes.
+ * \param[in] entryChecksum
+ *      If non-NULL, this checksum is updated with the appended bytes as they
+ *      are copied, so the data is only brought into cache once.
  * \return
  *      A pointer into the Segment corresponding to the first byte that was
  *      copied in to.
  */
-const void *
-Segment::forceAppendBlob(const void *buffer, uint32_t length)
+void *
+Segment::forceAppendBlob(const void *buffer, uint32_t length,
+                         SegmentChecksum* entryChecksum)
 {
     assert((tail + length) <= capacity);
     assert(!closed);
@@ -723,12 +778,46 @@ Segment::forceAppendBlob(const void *buffer, uint32_t length)
     const uint8_t *src = reinterpret_cast<const uint8_t *>(buffer);
     uint8_t       *dst = reinterpret_cast<uint8_t *>(baseAddress) + tail;
 
-    memcpy(dst, src, length);
+    if (entryChecksum == NULL) {
+        memcpy(dst, src, length);
+    } else {
+        for (uint32_t done = 0; done < length; ) {
+            uint32_t bytes = length - done;
+            if (bytes > COPY_CHECKSUM_BLOCK_BYTES)
+                bytes = COPY_CHECKSUM_BLOCK_BYTES;
+            memcpy(dst + done, src + done, bytes);
+            entryChecksum->update(dst + done, bytes);
+            done += bytes;
+        }
+    }
 
     tail += length;
     return reinterpret_cast<void *>(dst);
 }
 
+/**
+ * Append a range of a Buffer to the memory backing this Segment, gathering
+ * it from the Buffer's chunks. Like #forceAppendBlob(), no SegmentEntry is
+ * written.
+ * \param[in] buffer
+ *      Buffer containing the data to be appended.
+ * \param[in] offset
+ *      Offset within \a buffer of the first byte to append.
+ * \param[in] length
+ *      Number of bytes to append. The range must lie within \a buffer.
+ * \param[in] entryChecksum
+ *      If non-NULL, this checksum is updated with the appended bytes as they
+ *      are copied.
+ */
+void
+Segment::forceAppendBuffer(const Buffer& buffer, uint32_t offset,
+                           uint32_t length, SegmentChecksum* entryChecksum)
+{
+    assert(offset + length <= buffer.getTotalLength());
+    for (Buffer::Iterator it(buffer, offset, length); !it.isDone(); it.next())
+        forceAppendBlob(it.getData(), it.getLength(), entryChecksum);
+}
+
 /**
  * Append an entry of any type to the Segment. This function will always
  * succeed so long as there is sufficient room left in the tail of the Segment.
@@ -753,33 +842,59 @@ Segment::forceAppendBlob(const void *buffer, uint32_t length)
  *      for recovery to avoid calculating the checksum twice (once to check
  *      the recovered object, and again when adding to the log). This
  *      parameter is optional and is not normally used.
+ * \param[in] payload
+ *      If non-NULL, a Buffer whose contents in the range given by
+ *      \a payloadOffset and \a payloadLength are appended following
+ *      \a buffer as part of the same entry. The checksum is computed as
+ *      the payload is copied, so it is read exactly once.
+ * \param[in] payloadOffset
+ *      Offset of the first byte of \a payload to append.
+ * \param[in] payloadLength
+ *      Number of bytes of \a payload to append.
  * \return
  *      A SegmentEntryHandle corresponding to the data just written. 
  */
 SegmentEntryHandle
 Segment::forceAppendWithEntry(LogEntryType type, const void *buffer,
     uint32_t length, bool sync, bool updateChecksum,
-    Tub<SegmentChecksum::ResultType> expectedChecksum)
+    Tub<SegmentChecksum::ResultType> expectedChecksum,
+    const Buffer* payload, uint32_t payloadOffset, uint32_t payloadLength)
 {
     assert(!closed);
 
     uint64_t freeBytes = capacity - tail;
-    uint64_t needBytes = sizeof(SegmentEntry) + length;
+    uint64_t needBytes = sizeof(SegmentEntry) + length + payloadLength;
     if (freeBytes < needBytes)
         return NULL;
 
-    SegmentEntry entry(type, length);
+    SegmentEntry entry(type, length + payloadLength);
+    SegmentChecksum entryChecksum;
+    entryChecksum.update(&entry, sizeof(entry));
+
+    void* entryPointer = NULL;
+    if (payload != NULL) {
+        // Gather the contents straight into the segment, checksumming each
+        // block while it is still in cache. The header is filled in below
+        // once its checksum is known.
+        CycleCounter<RawMetric> _(&metrics->master.segmentAppendCopyTicks);
+        entryPointer = forceAppendBlob(&entry, sizeof(entry));
+        forceAppendBlob(buffer, length,
+                        updateChecksum ? &entryChecksum : NULL);
+        forceAppendBuffer(*payload, payloadOffset, payloadLength,
+                          updateChecksum ? &entryChecksum : NULL);
+    }
 
     if (updateChecksum) {
         CycleCounter<RawMetric> _(&metrics->master.segmentAppendChecksumTicks);
-        SegmentChecksum entryChecksum;
-        entryChecksum.update(&entry, sizeof(entry));
-        entryChecksum.update(buffer, length);
+        if (payload == NULL)
+            entryChecksum.update(buffer, length);
 
         // The incoming checksum will have had the mutableFields checksum
         // XORed back out, so compare it now.
         if (expectedChecksum) {
             if (*expectedChecksum != entryChecksum.getResult()) {
+                if (payload != NULL)
+                    tail -= downCast<uint32_t>(needBytes);
                 throw SegmentException(HERE, format("checksum didn't match "
                     "expected (wanted: 0x%08x, got 0x%08x)", *expectedChecksum,
                     entryChecksum.getResult()));
@@ -806,11 +921,12 @@ Segment::forceAppendWithEntry(LogEntryType type, const void *buffer,
                          mutableFieldsChecksum.getResult();
     }
 
-    const void* entryPointer;
-    {
+    if (payload == NULL) {
         CycleCounter<RawMetric> _(&metrics->master.segmentAppendCopyTicks);
         entryPointer = forceAppendBlob(&entry, sizeof(entry));
         forceAppendBlob(buffer, length);
+    } else {
+        memcpy(entryPointer, &entry, sizeof(entry));
     }
 
     if (sync && replicatedSegment) {
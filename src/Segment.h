@@ -18,6 +18,7 @@
 
 #include <vector>
 
+#include "AtomicInt.h"
 #include "BitOps.h"
 #include "BoostIntrusive.h"
 #include "Common.h"
@@ -108,6 +109,7 @@ struct SegmentException : public Exception {
 };
 
 // forward decls
+class Buffer;
 class Log;
 class Segment;
 class _SegmentEntryHandle;
@@ -119,6 +121,13 @@ typedef const _SegmentEntryHandle* SegmentEntryHandle;
 /// Vector of Segment pointers.
 typedef std::vector<Segment*> SegmentVector;
 
+/**
+ * Describes one entry of a Segment::multiAppend() or Log::multiAppend().
+ * The entry's contents are #length bytes at #buffer, optionally followed by
+ * a range of a Buffer (the "payload"). The payload form lets an entry such
+ * as an object be gathered straight from an RPC's request Buffer into
+ * segment memory without first being assembled contiguously.
+ */
 class SegmentMultiAppendEntry {
   public:
     SegmentMultiAppendEntry(LogEntryType type,
@@ -129,7 +138,26 @@ class SegmentMultiAppendEntry {
         : type(type),
           buffer(buffer),
           length(length),
-          expectedChecksum(expectedChecksum)
+          expectedChecksum(expectedChecksum),
+          payload(NULL),
+          payloadOffset(0),
+          payloadLength(0)
+    {
+    }
+
+    SegmentMultiAppendEntry(LogEntryType type,
+                            const void* buffer,
+                            uint32_t length,
+                            const Buffer* payload,
+                            uint32_t payloadOffset,
+                            uint32_t payloadLength)
+        : type(type),
+          buffer(buffer),
+          length(length),
+          expectedChecksum(),
+          payload(payload),
+          payloadOffset(payloadOffset),
+          payloadLength(payloadLength)
     {
     }
 
@@ -137,7 +165,10 @@ class SegmentMultiAppendEntry {
         : type(other.type),
           buffer(other.buffer),
           length(other.length),
-          expectedChecksum(other.expectedChecksum)
+          expectedChecksum(other.expectedChecksum),
+          payload(other.payload),
+          payloadOffset(other.payloadOffset),
+          payloadLength(other.payloadLength)
     {
     }
 
@@ -148,13 +179,29 @@ class SegmentMultiAppendEntry {
         buffer = other.buffer;
         length = other.length;
         expectedChecksum = other.expectedChecksum;
+        payload = other.payload;
+        payloadOffset = other.payloadOffset;
+        payloadLength = other.payloadLength;
         return *this;
     }
 
+    /// Total length of the entry's contents in bytes.
+    uint32_t
+    totalLength() const
+    {
+        return length + payloadLength;
+    }
+
     LogEntryType type;
     const void* buffer;
     uint32_t length;
     Tub<SegmentChecksum::ResultType> expectedChecksum;
+
+    /// If non-NULL, #payloadLength bytes starting at #payloadOffset in this
+    /// Buffer are appended after #buffer as part of the same entry.
+    const Buffer* payload;
+    uint32_t payloadOffset;
+    uint32_t payloadLength;
 };
 
 /// TODO(Rumble)
@@ -201,10 +248,12 @@ class Segment {
                                                 uint64_t freeSpaceTimeSum);
     void               close(Segment* nextHead, bool sync = true);
     void               sync();
+    void               sync(uint32_t offset);
     void               freeReplicas();
     const void        *getBaseAddress() const;
     uint64_t           getId() const;
     uint32_t           getCapacity() const;
+    uint32_t           getAppendedLength();
     uint32_t           appendableBytes();
     int                getUtilisation();
     uint32_t           getLiveBytes();
@@ -290,11 +339,19 @@ class Segment {
     static const uint64_t  INVALID_SEGMENT_ID = ~(0ull);
 
   PRIVATE:
+    /// When appending from a Buffer, data is copied and checksummed in
+    /// blocks of this many bytes so that each block is checksummed while
+    /// it is still in the L1 cache.
+    static const uint32_t COPY_CHECKSUM_BLOCK_BYTES = 8192;
+
     void               commonConstructor(LogEntryType type,
                                          const void *buffer, uint32_t length);
     SegmentEntryHandle locklessAppend(LogEntryType type,
                             const void *buffer, uint32_t length, bool sync,
-                            Tub<SegmentChecksum::ResultType> expectedChecksum);
+                            Tub<SegmentChecksum::ResultType> expectedChecksum,
+                            const Buffer* payload = NULL,
+                            uint32_t payloadOffset = 0,
+                            uint32_t payloadLength = 0);
     uint32_t           locklessGetLiveBytes() const;
     uint32_t           locklessAppendableBytes() const;
     bool               locklessCanAppendEntries(size_t numberOfEntries,
@@ -303,15 +360,23 @@ class Segment {
     void               decrementSpaceTimeSum(SegmentEntryHandle handle);
     void               adjustSpaceTimeSum(SegmentEntryHandle handle,
                                           bool subtract);
-    const void        *forceAppendBlob(const void *buffer,
-                                       uint32_t length);
+    void              *forceAppendBlob(const void *buffer,
+                                       uint32_t length,
+                                       SegmentChecksum* entryChecksum = NULL);
+    void               forceAppendBuffer(const Buffer& buffer,
+                                         uint32_t offset,
+                                         uint32_t length,
+                                         SegmentChecksum* entryChecksum);
     SegmentEntryHandle forceAppendWithEntry(LogEntryType type,
                              const void *buffer,
                              uint32_t length,
                              bool sync = true,
                              bool updateChecksum = true,
                              Tub<SegmentChecksum::ResultType> expectedChecksum =
-                                 Tub<SegmentChecksum::ResultType>());
+                                 Tub<SegmentChecksum::ResultType>(),
+                             const Buffer* payload = NULL,
+                             uint32_t payloadOffset = 0,
+                             uint32_t payloadLength = 0);
 
     /// ReplicaManager used to replicate this Segment. This is responsible for
     /// making operations on this Segment durable.
@@ -405,6 +470,11 @@ class Segment {
     /// is safe to return the memory backing this Segment to the free list.
     uint64_t          cleanedEpoch;
 
+    /// The number of Log::PinnedChunks currently referring to data in this
+    /// Segment. A cleaned Segment's memory is not reused while this is
+    /// non-zero, regardless of #cleanedEpoch.
+    AtomicInt         pinCount;
+
      /// Handle to the open segment on backups, or NULL if the segment is freed.
     ReplicatedSegment* replicatedSegment;
 
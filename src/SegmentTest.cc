@@ -424,6 +424,54 @@ TEST_F(SegmentTest, forceAppendWithEntry) {
     EXPECT_EQ(2U, s.entryCountsByType[LOG_ENTRY_TYPE_OBJ]);
 }
 
+TEST_F(SegmentTest, forceAppendWithEntry_payload) {
+    Log l(serverId, 8192, 8192, 4298, NULL, Log::CLEANER_DISABLED);
+    l.registerType(LOG_ENTRY_TYPE_OBJ,
+                   true,
+                   livenessCallback, NULL,
+                   relocationCallback, NULL,
+                   timestampCallback,
+                   scanCallback, NULL);
+
+    char contiguousBuf[8192] __attribute__((aligned(8192)));
+    char gatherBuf[8192] __attribute__((aligned(8192)));
+
+    char buf[200];
+    for (unsigned int i = 0; i < sizeof(buf); i++)
+        buf[i] = static_cast<char>(i);
+    reinterpret_cast<Object*>(buf)->timestamp = 0;
+
+    // The header comes from buf and the rest from a Buffer with several
+    // chunks, starting partway into its first chunk.
+    Buffer payload;
+    Buffer::Chunk::appendToBuffer(&payload, "junk", 4);
+    Buffer::Chunk::appendToBuffer(&payload, buf + 28, 100);
+    Buffer::Chunk::appendToBuffer(&payload, buf + 128, 72);
+
+    Segment contiguous(112233, 445566, contiguousBuf, sizeof(contiguousBuf));
+    *const_cast<Log**>(&contiguous.log) = &l;
+    SegmentEntryHandle expected = contiguous.forceAppendWithEntry(
+        LOG_ENTRY_TYPE_OBJ, buf, sizeof(buf));
+
+    Segment gather(112233, 445566, gatherBuf, sizeof(gatherBuf));
+    *const_cast<Log**>(&gather.log) = &l;
+    uint32_t tail = gather.tail;
+    EXPECT_THROW(gather.forceAppendWithEntry(LOG_ENTRY_TYPE_OBJ, buf, 28,
+                                             true, true, 5, &payload, 4, 172),
+                 SegmentException);
+    EXPECT_EQ(tail, gather.tail);
+
+    SegmentEntryHandle seh = gather.forceAppendWithEntry(
+        LOG_ENTRY_TYPE_OBJ, buf, 28, true, true,
+        Tub<SegmentChecksum::ResultType>(), &payload, 4, 172);
+    ASSERT_TRUE(seh != NULL);
+    EXPECT_EQ(sizeof(buf), seh->length());
+    EXPECT_EQ(0, memcmp(buf, seh->userData(), sizeof(buf)));
+    EXPECT_EQ(expected->checksum(), seh->checksum());
+    EXPECT_EQ(contiguous.checksum.getResult(), gather.checksum.getResult());
+    EXPECT_EQ(contiguous.tail, gather.tail);
+}
+
 TEST_F(SegmentTest, syncToBackup) {
     char alignedBuf[8192] __attribute__((aligned(8192)));
     ReplicaManager replicaManager(serverList, serverId, 0);
@@ -437,6 +485,19 @@ TEST_F(SegmentTest, syncToBackup) {
               TestLog::get());
 }
 
+TEST_F(SegmentTest, syncToBackup_offset) {
+    char alignedBuf[8192] __attribute__((aligned(8192)));
+    ReplicaManager replicaManager(serverList, serverId, 0);
+    Segment s(1, 2, alignedBuf, sizeof(alignedBuf), &replicaManager);
+    static SegmentHeader header;
+    s.append(LOG_ENTRY_TYPE_SEGHEADER, &header, sizeof(header), true);
+    uint32_t offset = s.getAppendedLength();
+    EXPECT_EQ(s.tail, offset);
+    TestLog::Enable _;
+    s.sync(offset);
+    EXPECT_EQ("sync: syncing", TestLog::get());
+}
+
 TEST_F(SegmentTest, freeReplicas) {
     TestLog::Enable _(&freeFilter);
     char alignedBuf[8192] __attribute__((aligned(8192)));
@@ -19,6 +19,8 @@
 
 namespace RAMCloud {
 
+volatile sig_atomic_t Server::shutdownRequested = 0;
+
 /**
  * Create services according to #config, enlist with the coordinator and
  * then return. This method should almost exclusively be used by MockCluster
@@ -39,7 +41,10 @@ Server::startForTesting(BindTransport& bindTransport)
 /**
  * Create services according to #config and enlist with the coordinator.
  * Either call this method or startForTesting(), not both.  Loops
- * forever calling Dispatch::poll() to serve requests.
+ * calling Dispatch::poll() to serve requests until requestShutdown() is
+ * called, then stores the backup's replicas and returns.  The caller
+ * should exit without destroying the Server: the master's teardown waits
+ * on replication that no one is polling for any more.
  */
 void
 Server::run()
@@ -60,8 +65,14 @@ Server::run()
 
     enlist();
 
-    while (true)
+    while (!shutdownRequested)
+        dispatch.poll();
+
+    LOG(NOTICE, "Shutting down; restart with --restartServerId %lu to "
+        "reload this server's log from its backup", *serverId);
+    while (!Context::get().serviceManager->idle())
         dispatch.poll();
+    backup.destroy();
 }
 
 // - private -
@@ -151,14 +162,25 @@ Server::enlist()
     // to rpc dispatch. This reduces the window of being unavailable to
     // service rpcs after enlisting with the coordinator (which can
     // lead to session open timeouts).
+    ServerId formerId = config.restartServerId;
+    vector<uint64_t> segmentIds;
+    bool warmRestart = formerId.isValid() && master && backup &&
+                       backup->findLocalLog(formerId, segmentIds);
+    if (formerId.isValid() && master && !warmRestart) {
+        LOG(WARNING, "Can't reload the log of former server %lu locally; "
+            "leaving its tablets to crash recovery", *formerId);
+    }
     serverId = coordinator->enlistServer(config.services,
                                          config.localLocator,
-                                         backupReadSpeed, backupWriteSpeed);
+                                         backupReadSpeed, backupWriteSpeed,
+                                         formerId, warmRestart);
 
     if (master)
         master->init(serverId);
     if (backup)
         backup->init(serverId);
+    if (warmRestart)
+        master->startRestart(formerId, *backup, segmentIds);
     if (config.detectFailures) {
         failureDetector.construct(
             config.coordinatorLocator,
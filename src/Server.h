@@ -16,6 +16,8 @@
 #ifndef RAMCLOUD_SERVER_H
 #define RAMCLOUD_SERVER_H
 
+#include <csignal>
+
 #include "BackupService.h"
 #include "CoordinatorClient.h"
 #include "FailureDetector.h"
@@ -65,7 +67,19 @@ class Server {
     }
 
     void startForTesting(BindTransport& bindTransport);
-    void run() __attribute__ ((noreturn));
+    void run();
+
+    /**
+     * Ask run() to stop serving requests and store this server's backup
+     * replicas, including the open heads of logs, so that the server can
+     * be restarted with ServerConfig::restartServerId.  Safe to call from a
+     * signal handler.
+     */
+    static void
+    requestShutdown()
+    {
+        shutdownRequested = 1;
+    }
 
   PRIVATE:
     void createAndRegisterServices(BindTransport* bindTransport);
@@ -147,6 +161,9 @@ class Server {
      * See config.services.
      */
     Tub<PingService> ping;
+
+    /// Set by requestShutdown(); polled by run().
+    static volatile sig_atomic_t shutdownRequested;
 };
 
 } // namespace RAMCloud
@@ -18,6 +18,7 @@
 
 #include "Log.h"
 #include "Segment.h"
+#include "ServerId.h"
 #include "ServiceMask.h"
 
 namespace RAMCloud {
@@ -49,6 +50,7 @@ struct ServerConfig {
                    MEMBERSHIP_SERVICE}
         , detectFailures(false)
         , pinMemory(false)
+        , restartServerId()
         , master(testing)
         , backup(testing)
     {}
@@ -66,6 +68,7 @@ struct ServerConfig {
                    PING_SERVICE, MEMBERSHIP_SERVICE}
         , detectFailures(true)
         , pinMemory(true)
+        , restartServerId()
         , master()
         , backup()
     {}
@@ -115,6 +118,14 @@ struct ServerConfig {
      */
     bool pinMemory;
 
+    /**
+     * If valid, this process is a planned restart of the server that ran
+     * under this id. The backup reloads the replicas left in its storage
+     * file, and the master replays its former log from them and takes over
+     * its former tablets instead of leaving them to crash recovery.
+     */
+    ServerId restartServerId;
+
     /**
      * Configuration details specific to the MasterService on a server,
      * if any.  If !config.has(MASTER_SERVICE) then this field is ignored.
@@ -128,7 +139,17 @@ struct ServerConfig {
             : logBytes(32 * 1024 * 1024)
             , hashTableBytes(1 * 1024 * 1024)
             , disableLogCleaner(true)
+            , cleanerThreads(1)
+            , cleanerPolicy(LogCleaner::COST_BENEFIT_POLICY)
+            , disableHashTableResize(true)
             , numReplicas(0)
+            , localReplica(false)
+            , workerThreads(1)
+            , tabletSplitBytes(0)
+            , tabletSplitReferents(0)
+            , migrateSplitTablets(false)
+            , memoryPlacement()
+            , cacheMode(false)
         {}
 
         /**
@@ -140,7 +161,17 @@ struct ServerConfig {
             : logBytes()
             , hashTableBytes()
             , disableLogCleaner()
+            , cleanerThreads()
+            , cleanerPolicy(LogCleaner::COST_BENEFIT_POLICY)
+            , disableHashTableResize()
             , numReplicas()
+            , localReplica(false)
+            , workerThreads()
+            , tabletSplitBytes()
+            , tabletSplitReferents()
+            , migrateSplitTablets()
+            , memoryPlacement()
+            , cacheMode(false)
         {}
 
         /// Total number bytes to use for the in-memory Log.
@@ -152,8 +183,63 @@ struct ServerConfig {
         /// If true, disable the log cleaner entirely.
         bool disableLogCleaner;
 
+        /// Number of threads the log cleaner uses to relocate live data.
+        uint32_t cleanerThreads;
+
+        /// How the log cleaner chooses which Segments to clean.
+        LogCleaner::CleaningPolicyType cleanerPolicy;
+
+        /**
+         * If true, the HashTable never grows beyond #hashTableBytes, even
+         * when it becomes heavily loaded.
+         */
+        bool disableHashTableResize;
+
         /// Number of replicas to keep per segment stored on backups.
         uint32_t numReplicas;
+
+        /**
+         * If true, one more replica of each segment is kept on the backup
+         * running in this same server, so the master can reload its log
+         * from local disk after a planned restart (see restartServerId).
+         */
+        bool localReplica;
+
+        /**
+         * Maximum number of worker threads that may execute MasterService
+         * RPCs concurrently. Reads proceed in parallel; writes are still
+         * serialised with one another.
+         */
+        uint32_t workerThreads;
+
+        /**
+         * Tablets holding more than this many bytes of objects are split in
+         * two. 0 disables splitting.
+         */
+        uint64_t tabletSplitBytes;
+
+        /// Tablets holding more than this many objects are split in two.
+        /// Ignored if #tabletSplitBytes is 0.
+        uint64_t tabletSplitReferents;
+
+        /**
+         * If true, the upper half of each tablet split is migrated to the
+         * master serving the fewest tablets; otherwise both halves stay.
+         */
+        bool migrateSplitTablets;
+
+        /**
+         * Where the memory for the Log and the HashTable comes from: huge
+         * pages and/or a particular NUMA node.
+         */
+        MemoryPlacement memoryPlacement;
+
+        /**
+         * If true, this master is a bounded-memory cache: when its log fills
+         * up, the log cleaner evicts the objects read least recently instead
+         * of refusing writes, and no backup replicas are kept.
+         */
+        bool cacheMode;
     } master;
 
     /**
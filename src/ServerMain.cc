@@ -18,6 +18,9 @@
  * This file provides the main program for RAMCloud storage servers.
  */
 
+#include <csignal>
+#include <unistd.h>
+
 #include "Context.h"
 #include "InfRcTransport.h"
 #include "OptionParser.h"
@@ -25,6 +28,17 @@
 #include "ShortMacros.h"
 #include "TransportManager.h"
 
+namespace {
+
+/// Lets the server store its backup replicas before exiting on SIGTERM.
+void
+handleSigterm(int signal)
+{
+    RAMCloud::Server::requestShutdown();
+}
+
+} // anonymous namespace
+
 int
 main(int argc, char *argv[])
 {
@@ -34,6 +48,10 @@ main(int argc, char *argv[])
     try {
         ServerConfig config = ServerConfig::forExecution();
         string masterTotalMemory, hashTableMemory;
+        string cleanerPolicy;
+        string hugePages;
+        uint64_t tabletSplitMegs;
+        uint64_t restartServerId;
 
         bool masterOnly;
         bool backupOnly;
@@ -51,10 +69,30 @@ main(int argc, char *argv[])
                default_value(RANDOM_REFINE_AVG),
              "0 random refine min, 1 random refine avg, 2 even distribution, "
              "3 uniform random")
+            ("cacheMode",
+             ProgramOptions::bool_switch(&config.master.cacheMode),
+             "Run the master as a bounded-memory cache: when the log is "
+             "full, evict the least recently read objects rather than "
+             "refusing writes. Overrides --cleanerPolicy and --replicas.")
+            ("cleanerPolicy",
+             ProgramOptions::value<string>(&cleanerPolicy)->
+                default_value("costBenefit"),
+             "How the log cleaner chooses segments to clean; one of "
+             "\"costBenefit\" or \"greedy\"")
+            ("cleanerThreads",
+             ProgramOptions::value<uint32_t>(&config.master.cleanerThreads)->
+                default_value(1),
+             "Number of threads the log cleaner uses to relocate live data "
+             "in each cleaning pass")
             ("disableLogCleaner,d",
              ProgramOptions::bool_switch(&config.master.disableLogCleaner),
              "Disable the log cleaner entirely. You will eventually run out "
              "of memory, but at least you can do so faster this way.")
+            ("disableHashTableResize",
+             ProgramOptions::bool_switch(
+                &config.master.disableHashTableResize),
+             "Never grow the hash table beyond HashTableMemory, even if "
+             "it fills up and lookups get slower.")
             ("file,f",
              ProgramOptions::value<string>(&config.backup.file)->
                 default_value("/var/tmp/backup.log"),
@@ -64,9 +102,37 @@ main(int argc, char *argv[])
                 default_value("10%"),
              "Percentage or megabytes of master memory allocated to "
              "the hash table")
+            ("hugePages",
+             ProgramOptions::value<string>(&hugePages)->
+                default_value("none"),
+             "Back the log and hash table with huge pages: \"none\", "
+             "\"transparent\", or the path of a hugetlbfs mount, whose page "
+             "size (2 MB or 1 GB) is used. Falls back to normal pages if "
+             "none are available.")
+            ("localReplica",
+             ProgramOptions::bool_switch(&config.master.localReplica),
+             "Keep one more replica of each segment on this server's own "
+             "backup so that the master can reload its log from local disk "
+             "after a planned restart (see --restartServerId)")
             ("masterOnly,M",
              ProgramOptions::bool_switch(&masterOnly),
              "The server should run the master service only (no backup)")
+            ("masterWorkerThreads",
+             ProgramOptions::value<uint32_t>(&config.master.workerThreads)->
+                default_value(1),
+             "Number of worker threads that may service master RPCs "
+             "concurrently")
+            ("migrateSplitTablets",
+             ProgramOptions::bool_switch(&config.master.migrateSplitTablets),
+             "Move the upper half of each tablet split to the master "
+             "serving the fewest tablets")
+            ("numaNode",
+             ProgramOptions::value<int>(
+                &config.master.memoryPlacement.numaNode)->
+                default_value(-1),
+             "Run all of the server's threads on this NUMA node's CPUs and "
+             "allocate the log and hash table from its memory; -1 lets "
+             "the OS decide")
             ("totalMasterMemory,t",
              ProgramOptions::value<string>(&masterTotalMemory)->
                 default_value("10%"),
@@ -76,6 +142,22 @@ main(int argc, char *argv[])
              ProgramOptions::value<uint32_t>(&config.master.numReplicas)->
                 default_value(0),
              "Number of backup copies to make for each segment")
+            ("restartServerId",
+             ProgramOptions::value<uint64_t>(&restartServerId)->
+                default_value(0),
+             "Server id this process ran under before a planned restart; "
+             "the backup keeps the replicas in its --file and the master "
+             "reloads its tablets from them. 0 means a fresh server.")
+            ("tabletSplitMegs",
+             ProgramOptions::value<uint64_t>(&tabletSplitMegs)->
+                default_value(640),
+             "Split tablets holding more than this many megabytes of "
+             "objects; 0 disables splitting")
+            ("tabletSplitObjects",
+             ProgramOptions::value<uint64_t>(
+                &config.master.tabletSplitReferents)->
+                default_value(10 * 1000 * 1000),
+             "Split tablets holding more than this many objects")
             ("segmentFrames",
              ProgramOptions::value<uint32_t>(&config.backup.numSegmentFrames)->
                 default_value(512),
@@ -99,6 +181,34 @@ main(int argc, char *argv[])
         if (masterOnly && backupOnly)
             DIE("Can't specify both -B and -M options");
 
+        config.master.tabletSplitBytes = tabletSplitMegs * 1024 * 1024;
+        if (restartServerId != 0)
+            config.restartServerId = ServerId(restartServerId);
+
+        if (cleanerPolicy == "costBenefit")
+            config.master.cleanerPolicy = LogCleaner::COST_BENEFIT_POLICY;
+        else if (cleanerPolicy == "greedy")
+            config.master.cleanerPolicy = LogCleaner::GREEDY_POLICY;
+        else
+            DIE("Unknown cleaner policy: %s", cleanerPolicy.c_str());
+
+        MemoryPlacement& placement = config.master.memoryPlacement;
+        if (hugePages == "none") {
+            placement.hugePages = MemoryPlacement::NO_HUGE_PAGES;
+        } else if (hugePages == "transparent") {
+            placement.hugePages = MemoryPlacement::TRANSPARENT_HUGE_PAGES;
+        } else {
+            placement.hugePages = MemoryPlacement::HUGETLBFS_PAGES;
+            placement.hugetlbfsPath = hugePages;
+        }
+
+        // Threads started from here on (the transports', the dispatch
+        // thread's, and the workers') inherit this affinity.
+        if (placement.numaNode >= 0 &&
+                !pinToNumaNode(downCast<uint32_t>(placement.numaNode))) {
+            LOG(WARNING, "Not running on NUMA node %d", placement.numaNode);
+        }
+
         if (masterOnly) {
             config.services = {MASTER_SERVICE,
                                MEMBERSHIP_SERVICE, PING_SERVICE};
@@ -133,9 +243,12 @@ main(int argc, char *argv[])
         }
 
         Server server(config);
-        server.run(); // Never returns except for exceptions.
+        signal(SIGTERM, handleSigterm);
+        server.run(); // Returns only after a SIGTERM, or by exceptions.
 
-        return 0;
+        // Skip destructors: tearing down the master would wait on
+        // replication that no one is polling for any more.
+        _exit(0);
     } catch (std::exception& e) {
         using namespace RAMCloud;
         LOG(ERROR, "Fatal error in server at %s: %s",
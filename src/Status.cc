@@ -42,6 +42,7 @@ static const char* messages[] = {
     "service not available",                     // SERVICE_NOT_AVAILABLE
     "operation took too long",                   // STATUS_TIMEOUT
     "internal RAMCloud error",                   // STATUS_INTERNAL_ERROR
+    "object has wrong format for operation",     // STATUS_INVALID_OBJECT
 };
 
 // The following table maps from a Status value to the internal name
@@ -67,6 +68,7 @@ static const char* symbols[] = {
     "STATUS_SERVICE_NOT_AVAILABLE",
     "STATUS_TIMEOUT",
     "STATUS_INTERNAL_ERROR",
+    "STATUS_INVALID_OBJECT",
 };
 
 /**
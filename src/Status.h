@@ -52,7 +52,8 @@ enum Status {
     STATUS_SERVICE_NOT_AVAILABLE        = 17,
     STATUS_TIMEOUT                      = 18,
     STATUS_INTERNAL_ERROR               = 19,
-    STATUS_MAX_VALUE                    = 19
+    STATUS_INVALID_OBJECT               = 20,
+    STATUS_MAX_VALUE                    = 20
     // Note: if you add a new status value you must make the following
     // additional updates:
     // * Modify STATUS_MAX_VALUE to have a value equal to the largest
@@ -78,6 +78,16 @@ class Table {
             nextVersion = minimum;
     }
 
+    /**
+     * Return the version the master vector clock would hand out next,
+     * without consuming it. Tablet migration passes this on so that the
+     * new owner never reuses a version.
+     * \see #nextVersion
+     */
+    uint64_t peekVersion() {
+        return nextVersion;
+    }
+
     /**
      * Get the Table's identifier.
      */
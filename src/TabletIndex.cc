@@ -0,0 +1,94 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "EpochManager.h"
+#include "Fence.h"
+#include "TabletIndex.h"
+
+namespace RAMCloud {
+
+TabletIndex::~TabletIndex()
+{
+    freeRetired(true);
+    delete tablets;
+}
+
+/**
+ * Replace the contents of the index with a new set of tablets.
+ *
+ * \param newTablets
+ *      The tablets to index. The user_data field of each tablet must point
+ *      to the Table it belongs to. Tablets must not overlap.
+ */
+void
+TabletIndex::rebuild(const ProtoBuf::Tablets& newTablets)
+{
+    TabletVector* sorted = new TabletVector();
+    sorted->reserve(newTablets.tablet_size());
+    foreach (const ProtoBuf::Tablets::Tablet& tablet, newTablets.tablet()) {
+        sorted->push_back({tablet.table_id(),
+                           tablet.start_object_id(),
+                           tablet.end_object_id(),
+                           reinterpret_cast<Table*>(tablet.user_data()),
+                           tablet.state() ==
+                               ProtoBuf::Tablets::Tablet::NORMAL});
+    }
+    std::sort(sorted->begin(), sorted->end(), compareTablets);
+
+    // Readers must see the new array fully built before they can find it.
+    Fence::sfence();
+    TabletVector* old = tablets;
+    tablets = sorted;
+    retired.push_back({EpochManager::advance(), old});
+    freeRetired(false);
+}
+
+/**
+ * Free arrays replaced by #rebuild() that no reader can still be using.
+ *
+ * \param all
+ *      Free every retired array regardless of readers. Only for use when
+ *      the index itself is being destroyed.
+ */
+void
+TabletIndex::freeRetired(bool all)
+{
+    uint64_t earliest = EpochManager::IDLE;
+    if (!all)
+        earliest = EpochManager::getEarliestActiveEpoch();
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++) {
+        if (retired[i].first < earliest)
+            delete retired[i].second;
+        else
+            retired[kept++] = retired[i];
+    }
+    retired.resize(kept);
+}
+
+/**
+ * Ordering used to sort #tablets.
+ */
+bool
+TabletIndex::compareTablets(const Tablet& a, const Tablet& b)
+{
+    if (a.tableId != b.tableId)
+        return a.tableId < b.tableId;
+    return a.startObjectId < b.startObjectId;
+}
+
+} // namespace RAMCloud
@@ -0,0 +1,137 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef RAMCLOUD_TABLETINDEX_H
+#define RAMCLOUD_TABLETINDEX_H
+
+#include <vector>
+
+#include "Common.h"
+#include "Tablets.pb.h"
+
+namespace RAMCloud {
+
+class Table;
+
+/**
+ * Maps (table id, object id) pairs to the Table that owns them among the
+ * tablets served by a master. The tablets are kept in one array sorted by
+ * table id and start object id, so a lookup is a binary search over a few
+ * contiguous cache lines rather than a walk over every tablet protocol
+ * buffer.
+ *
+ * The index is a snapshot: it must be rebuilt whenever the set of tablets
+ * changes. Rebuilding must be serialized by the caller (see
+ * MasterService::objectUpdateLock), but lookups may run concurrently with
+ * it from inside an EpochManager::ReadGuard: a rebuild publishes a new
+ * array and only frees the old one once no reader can still be using it.
+ */
+class TabletIndex {
+  public:
+    TabletIndex()
+        : tablets(new TabletVector())
+        , retired()
+    {
+    }
+
+    ~TabletIndex();
+
+    void rebuild(const ProtoBuf::Tablets& newTablets);
+
+    /**
+     * Find the Table owning a given object.
+     *
+     * \param tableId
+     *      Identifier for a desired table.
+     * \param objectId
+     *      Identifier for a desired object.
+     * \param[out] endObjectId
+     *      If not NULL and the object is found, the last object id of the
+     *      tablet containing it is returned here.
+     * \param[out] normal
+     *      If not NULL and the object is found, whether the tablet
+     *      containing it is in the NORMAL state is returned here.
+     * \return
+     *      The Table of which the tablet containing this object is a part,
+     *      or NULL if no tablet in the index contains it.
+     */
+    Table*
+    lookup(uint64_t tableId, uint64_t objectId,
+           uint64_t* endObjectId = NULL, bool* normal = NULL) const
+    {
+        // Find the first tablet that starts after the object, then check
+        // the one before it.
+        const TabletVector& current = *tablets;
+        size_t low = 0;
+        size_t high = current.size();
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            const Tablet& t = current[mid];
+            if (t.tableId < tableId ||
+                (t.tableId == tableId && t.startObjectId <= objectId))
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        if (low == 0)
+            return NULL;
+        const Tablet& t = current[low - 1];
+        if (t.tableId != tableId || t.endObjectId < objectId)
+            return NULL;
+        if (endObjectId != NULL)
+            *endObjectId = t.endObjectId;
+        if (normal != NULL)
+            *normal = t.normal;
+        return t.table;
+    }
+
+    /**
+     * Return the number of tablets in the index.
+     */
+    size_t
+    size() const
+    {
+        return tablets->size();
+    }
+
+  PRIVATE:
+    /// The part of a ProtoBuf::Tablets::Tablet needed for lookups.
+    struct Tablet {
+        uint64_t tableId;
+        uint64_t startObjectId;
+        uint64_t endObjectId;
+        Table* table;
+        bool normal;
+    };
+
+    typedef std::vector<Tablet> TabletVector;
+
+    static bool compareTablets(const Tablet& a, const Tablet& b);
+    void freeRetired(bool all);
+
+    /// Tablets sorted by (#Tablet::tableId, #Tablet::startObjectId).
+    /// Replaced wholesale by #rebuild(), never modified in place.
+    TabletVector* volatile tablets;
+
+    /// Arrays replaced by #rebuild() that readers may still be using, each
+    /// tagged with the epoch in which it was replaced.
+    std::vector<std::pair<uint64_t, TabletVector*>> retired;
+
+    DISALLOW_COPY_AND_ASSIGN(TabletIndex);
+};
+
+} // namespace RAMCloud
+
+#endif // RAMCLOUD_TABLETINDEX_H
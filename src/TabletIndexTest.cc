@@ -0,0 +1,131 @@
+/* Copyright (c) 2012 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "TestUtil.h"
+#include "EpochManager.h"
+#include "TabletIndex.h"
+
+namespace RAMCloud {
+
+class TabletIndexTest : public ::testing::Test {
+  public:
+    ProtoBuf::Tablets tablets;
+    TabletIndex index;
+
+    TabletIndexTest()
+        : tablets()
+        , index()
+    {
+    }
+
+    /**
+     * Add a tablet to #tablets whose user_data is a fake Table pointer
+     * equal to \a tag.
+     */
+    void
+    addTablet(uint64_t tableId, uint64_t start, uint64_t end, uint64_t tag)
+    {
+        ProtoBuf::Tablets::Tablet& tablet(*tablets.add_tablet());
+        tablet.set_table_id(tableId);
+        tablet.set_start_object_id(start);
+        tablet.set_end_object_id(end);
+        tablet.set_state(ProtoBuf::Tablets::Tablet::NORMAL);
+        tablet.set_user_data(tag);
+    }
+
+    uint64_t
+    lookup(uint64_t tableId, uint64_t objectId)
+    {
+        return reinterpret_cast<uint64_t>(index.lookup(tableId, objectId));
+    }
+
+    DISALLOW_COPY_AND_ASSIGN(TabletIndexTest);
+};
+
+TEST_F(TabletIndexTest, lookup_empty) {
+    EXPECT_EQ(0U, lookup(0, 0));
+}
+
+TEST_F(TabletIndexTest, lookup) {
+    // Deliberately out of order.
+    addTablet(2, 0, ~0UL, 4);
+    addTablet(1, 100, 199, 3);
+    addTablet(0, 0, 9, 1);
+    addTablet(1, 0, 9, 2);
+    index.rebuild(tablets);
+    EXPECT_EQ(4U, index.size());
+
+    EXPECT_EQ(1U, lookup(0, 0));
+    EXPECT_EQ(1U, lookup(0, 9));
+    EXPECT_EQ(0U, lookup(0, 10));
+    EXPECT_EQ(2U, lookup(1, 5));
+    EXPECT_EQ(0U, lookup(1, 50));
+    EXPECT_EQ(3U, lookup(1, 100));
+    EXPECT_EQ(3U, lookup(1, 199));
+    EXPECT_EQ(0U, lookup(1, 200));
+    EXPECT_EQ(4U, lookup(2, 0));
+    EXPECT_EQ(4U, lookup(2, ~0UL));
+    EXPECT_EQ(0U, lookup(3, 0));
+}
+
+TEST_F(TabletIndexTest, lookup_endObjectId) {
+    addTablet(1, 100, 199, 3);
+    index.rebuild(tablets);
+    uint64_t end = 0;
+    EXPECT_TRUE(index.lookup(1, 150, &end) != NULL);
+    EXPECT_EQ(199U, end);
+    end = 0;
+    EXPECT_TRUE(index.lookup(1, 200, &end) == NULL);
+    EXPECT_EQ(0U, end);
+}
+
+TEST_F(TabletIndexTest, lookup_normal) {
+    addTablet(1, 0, 99, 2);
+    addTablet(1, 100, 199, 3);
+    tablets.mutable_tablet(1)->set_state(
+        ProtoBuf::Tablets::Tablet::RECOVERING);
+    index.rebuild(tablets);
+    bool normal = false;
+    EXPECT_TRUE(index.lookup(1, 50, NULL, &normal) != NULL);
+    EXPECT_TRUE(normal);
+    EXPECT_TRUE(index.lookup(1, 150, NULL, &normal) != NULL);
+    EXPECT_FALSE(normal);
+}
+
+TEST_F(TabletIndexTest, rebuild_replaces) {
+    addTablet(0, 0, 9, 1);
+    index.rebuild(tablets);
+    tablets.Clear();
+    addTablet(5, 0, 9, 7);
+    index.rebuild(tablets);
+    EXPECT_EQ(1U, index.size());
+    EXPECT_EQ(0U, lookup(0, 0));
+    EXPECT_EQ(7U, lookup(5, 0));
+}
+
+TEST_F(TabletIndexTest, rebuild_defersFreeingOldTablets) {
+    addTablet(0, 0, 9, 1);
+    {
+        EpochManager::ReadGuard _;
+        index.rebuild(tablets);
+        index.rebuild(tablets);
+        EXPECT_EQ(2U, index.retired.size());
+    }
+    index.rebuild(tablets);
+    EXPECT_EQ(0U, index.retired.size());
+    EXPECT_EQ(1U, lookup(0, 0));
+}
+
+} // namespace RAMCloud